@@ -0,0 +1,5 @@
+// Host build stand-in: the parts of FastLED the benchmarked kernels use are in native_globals.h
+
+#pragma once
+
+#include "native_globals.h"
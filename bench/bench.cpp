@@ -0,0 +1,343 @@
+//+--------------------------------------------------------------------------
+//
+// File:        bench.cpp
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+//
+// Description:
+//
+//    Runs the drawing and analysis kernels the effects are built on for a
+//    number of frames at several sizes on the host, and reports the time
+//    each frame took, so changes to them can be compared and profiled
+//    with the host's own tools.  Build and run it with:
+//
+//        pio run -e native && .pio/build/native/program --frames 500
+//
+//    Other options: --case picks the cases whose name contains the given
+//    text, --sizes takes a list like 32x8,64x32, and --ppm writes the last
+//    frame of each case that draws to that directory, to check the visuals.
+//
+//    Each case is the real kernel from include/ or src/; only FastLED,
+//    the clock and the allocators are stand-ins, from native_globals.h.
+//    The ESP32 runs these several times slower than a desktop CPU, so the
+//    numbers are for comparing builds against each other, not for working
+//    out the frame rate on a device.
+//
+//---------------------------------------------------------------------------
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+#include "globals.h"
+#include "effectrandom.h"
+#include "effects/strip/firekernel.h"
+#include "floatfft.h"
+#include "memoryplacement.h"
+#include "noisefield.h"
+
+MemoryPlacementReport g_MemoryPlacement;
+
+// BenchSize
+//
+// For the matrix cases a grid of pixels; the FFT takes the width as its number of samples
+
+struct BenchSize
+{
+    int Width;
+    int Height;
+};
+
+// BenchCase
+//
+// Make sets a case up for a size and returns what draws one frame into the pixels.  The pixels are left alone by
+// the cases that don't draw.
+
+struct BenchCase
+{
+    using Frame = std::function<void()>;
+
+    const char * Name;
+    bool         bDraws;
+    std::function<Frame(const BenchSize &, std::vector<CRGB> &)> Make;
+    std::vector<BenchSize> Sizes;                    // If set, used instead of the matrix sizes
+};
+
+// FireCase
+//
+// What the fire effects do each frame, with a column of heat cells for every column of the matrix: cool every cell,
+// let the heat drift up, light a few sparks at the bottom and color the cells from the heat table
+
+static BenchCase::Frame FireCase(const BenchSize & size, std::vector<CRGB> & leds)
+{
+    struct State
+    {
+        EffectRandom         Random { 1 };
+        std::vector<uint8_t> Heat;
+        HeatColorTable       Colors;
+    };
+
+    auto pState = std::make_shared<State>();
+    pState->Heat.assign(size.Width * size.Height, 0);
+
+    return [pState, size, &leds]()
+    {
+        auto & state = *pState;
+
+        for (int x = 0; x < size.Width; x++)
+        {
+            uint8_t * pColumn = &state.Heat[x * size.Height];
+
+            CoolHeat(state.Random, pColumn, size.Height, 60);
+            DiffuseHeat<0, 1, 2, 0>(pColumn, size.Height);
+
+            if (state.Random.Range(0, 255) < 100)
+                pColumn[size.Height - 1 - state.Random.Below(std::max(1, size.Height / 8))] = state.Random.Range(160, 255);
+        }
+
+        state.Colors.Update(0, HeatColor);
+
+        for (int x = 0; x < size.Width; x++)
+            for (int y = 0; y < size.Height; y++)
+                leds[y * size.Width + x] = state.Colors[state.Heat[x * size.Height + (size.Height - 1 - y)]];
+    };
+}
+
+// RandomCase
+//
+// A random byte for every pixel, from the effects' own generator or from the C library's, as most effects drew
+// them before they had one
+
+template <bool bEffectRandom>
+static BenchCase::Frame RandomCase(const BenchSize &, std::vector<CRGB> & leds)
+{
+    auto pRandom = std::make_shared<EffectRandom>(1);
+
+    return [pRandom, &leds]()
+    {
+        for (auto & led : leds)
+        {
+            uint8_t value = bEffectRandom ? pRandom->Range(0, 256) : rand() % 256;
+            led = CRGB(value, value, value);
+        }
+    };
+}
+
+// NoiseCase
+//
+// A noise field over the matrix that drifts in x and y and moves through z, as the noise effects move theirs, sampled
+// at every pixel or through the noise field cache
+
+template <bool bCached>
+static BenchCase::Frame NoiseCase(const BenchSize & size, std::vector<CRGB> & leds)
+{
+    NoiseLattice lattice;
+    lattice.Depth  = NoiseDepth::Sixteen;
+    lattice.StepX  = 1 << 11;
+    lattice.StepY  = 1 << 11;
+    lattice.Width  = size.Width;
+    lattice.Height = size.Height;
+
+    auto pZ = std::make_shared<uint32_t>(0);
+
+    return [lattice, pZ, size, &leds]() mutable
+    {
+        auto put = [&](uint16_t i, uint16_t j, uint16_t value)
+        {
+            uint8_t level = value >> 8;
+            leds[j * size.Width + i] = CRGB(level, level / 2, 255 - level);
+        };
+
+        if (bCached)
+        {
+            g_NoiseFields.Fill(lattice, *pZ, put);
+        }
+        else
+        {
+            for (uint16_t j = 0; j < lattice.Height; j++)
+                for (uint16_t i = 0; i < lattice.Width; i++)
+                    put(i, j, lattice.Sample(lattice.X + lattice.StepX * i, lattice.Y + lattice.StepY * j, *pZ));
+        }
+
+        *pZ += 256;
+        lattice.X += 700;
+        lattice.Y -= 300;
+    };
+}
+
+// FFTCase
+//
+// One audio window through the analyzer's FFT: a couple of tones and some noise, windowed and transformed to the
+// magnitudes of its bins
+
+static BenchCase::Frame FFTCase(const BenchSize & size, std::vector<CRGB> &)
+{
+    struct State
+    {
+        FloatFFT<2048>     FFT;
+        std::vector<float> Samples;
+        std::vector<float> Real;
+        std::vector<float> Imaginary;
+    };
+
+    auto pState = std::make_shared<State>();
+    pState->FFT.Configure(size.Width);
+
+    EffectRandom random(1);
+    for (int i = 0; i < size.Width; i++)
+        pState->Samples.push_back(1000.0f * sinf(i * 0.05f) + 400.0f * sinf(i * 0.31f) + random.Range(-100.0f, 100.0f));
+
+    pState->Real.resize(size.Width);
+    pState->Imaginary.resize(size.Width);
+
+    return [pState]()
+    {
+        auto & state = *pState;
+        std::copy(state.Samples.begin(), state.Samples.end(), state.Real.begin());
+        state.FFT.Magnitudes(state.Real.data(), state.Imaginary.data());
+    };
+}
+
+// WritePPM
+//
+// The pixels as a binary PPM, which any image viewer opens, each pixel blown up to a block so small matrices can
+// be seen
+
+static bool WritePPM(const std::string & path, const BenchSize & size, const std::vector<CRGB> & leds)
+{
+    constexpr int kScale = 8;
+
+    FILE * pFile = fopen(path.c_str(), "wb");
+    if (!pFile)
+        return false;
+
+    fprintf(pFile, "P6\n%d %d\n255\n", size.Width * kScale, size.Height * kScale);
+    for (int y = 0; y < size.Height * kScale; y++)
+    {
+        for (int x = 0; x < size.Width * kScale; x++)
+        {
+            const CRGB & led = leds[(y / kScale) * size.Width + x / kScale];
+            const uint8_t rgb[3] = { led.r, led.g, led.b };
+            fwrite(rgb, 1, sizeof(rgb), pFile);
+        }
+    }
+    fclose(pFile);
+    return true;
+}
+
+static std::vector<BenchSize> ParseSizes(const std::string & text)
+{
+    std::vector<BenchSize> sizes;
+    size_t start = 0;
+
+    while (start < text.size())
+    {
+        size_t end = text.find(',', start);
+        if (end == std::string::npos)
+            end = text.size();
+
+        BenchSize size;
+        if (sscanf(text.substr(start, end - start).c_str(), "%dx%d", &size.Width, &size.Height) == 2 && size.Width > 0 && size.Height > 0)
+            sizes.push_back(size);
+        start = end + 1;
+    }
+    return sizes;
+}
+
+int main(int argc, char * argv[])
+{
+    int frames = 200;
+    std::string filter;
+    std::string ppmDirectory;
+    std::vector<BenchSize> sizes = { { 32, 8 }, { 64, 32 }, { 128, 64 } };
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool bHasValue = i + 1 < argc;
+
+        if (arg == "--frames" && bHasValue)
+            frames = std::max(1, atoi(argv[++i]));
+        else if (arg == "--case" && bHasValue)
+            filter = argv[++i];
+        else if (arg == "--sizes" && bHasValue)
+            sizes = ParseSizes(argv[++i]);
+        else if (arg == "--ppm" && bHasValue)
+            ppmDirectory = argv[++i];
+        else
+        {
+            fprintf(stderr, "Usage: %s [--frames N] [--case NAME] [--sizes WxH,...] [--ppm DIRECTORY]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    const std::vector<BenchCase> cases =
+    {
+        { "fire",               true,  FireCase,          {} },
+        { "random-effect",      false, RandomCase<true>,  {} },
+        { "random-libc",        false, RandomCase<false>, {} },
+        { "noise-direct",       true,  NoiseCase<false>,  {} },
+        { "noise-cached",       true,  NoiseCase<true>,   {} },
+        { "fft",                false, FFTCase,           { { 256, 1 }, { 512, 1 }, { 1024, 1 }, { 2048, 1 } } }
+    };
+
+    printf("%-16s %10s %14s %12s\n", "case", "size", "ns/frame", "frames/s");
+
+    for (const auto & benchCase : cases)
+    {
+        if (!filter.empty() && std::string(benchCase.Name).find(filter) == std::string::npos)
+            continue;
+
+        for (const auto & size : benchCase.Sizes.empty() ? sizes : benchCase.Sizes)
+        {
+            // The noise field cache only holds fields up to the matrix size it was built for
+
+            if (std::string(benchCase.Name).rfind("noise", 0) == 0 && (size.Width > std::max(MATRIX_WIDTH, MATRIX_HEIGHT) || size.Height > std::max(MATRIX_WIDTH, MATRIX_HEIGHT)))
+                continue;
+
+            std::vector<CRGB> leds(size.Width * size.Height);
+            auto frame = benchCase.Make(size, leds);
+
+            // A few frames first, so the caches and tables have been filled before the timing starts
+
+            for (int i = 0; i < std::min(frames, 10); i++)
+                frame();
+
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < frames; i++)
+                frame();
+            auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+            double nsPerFrame = elapsed / frames;
+            char sizeText[32];
+            snprintf(sizeText, sizeof(sizeText), "%dx%d", size.Width, size.Height);
+            printf("%-16s %10s %14.0f %12.1f\n", benchCase.Name, sizeText, nsPerFrame, 1e9 / nsPerFrame);
+
+            if (!ppmDirectory.empty() && benchCase.bDraws)
+            {
+                std::string path = ppmDirectory + "/" + benchCase.Name + "-" + sizeText + ".ppm";
+                if (!WritePPM(path, size, leds))
+                    fprintf(stderr, "Couldn't write %s\n", path.c_str());
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,10 @@
+// Host build stand-in: there's only the one heap, so every capability comes from it
+
+#pragma once
+
+#include <cstdlib>
+
+#define MALLOC_CAP_8BIT     (1 << 2)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+
+inline void * heap_caps_malloc(size_t bytes, uint32_t) { return malloc(bytes); }
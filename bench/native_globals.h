@@ -0,0 +1,223 @@
+//+--------------------------------------------------------------------------
+//
+// File:        native_globals.h
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+//
+// Description:
+//
+//    What globals.h provides in the host build instead of the real
+//    settings and libraries: the handful of settings the benchmarked
+//    kernels read, and thin stand-ins for the parts of FastLED, the
+//    Arduino time functions and the ESP32 allocators they use
+//
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <sys/types.h>
+
+// Settings
+//
+// The matrix size only bounds what the noise field cache will hold; the benchmarks pick their own sizes up to it
+
+#ifndef MATRIX_WIDTH
+#define MATRIX_WIDTH 128
+#endif
+
+#ifndef MATRIX_HEIGHT
+#define MATRIX_HEIGHT 64
+#endif
+
+#define USE_NOISE 1
+#define ENABLE_FLOAT_FFT 1
+#define HOT_MEMORY_INTERNAL 0
+#define PLACEMENT_INTERNAL_RESERVE 0
+#define NOISE_FIELD_MAX_STEP 4
+#define NOISE_FIELD_Z_SPAN 4096
+#define NOISE_FIELD_CACHE_ENTRIES 2
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+
+// Time
+//
+// Counted from the first call, like the Arduino functions count from boot
+
+inline uint64_t NativeMicros()
+{
+    static const auto start = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+inline unsigned long micros() { return (unsigned long) NativeMicros(); }
+inline unsigned long millis() { return (unsigned long)(NativeMicros() / 1000); }
+
+// Random numbers
+
+inline uint32_t esp_random()
+{
+    static std::mt19937 generator(12345);
+    return generator();
+}
+
+// Allocation
+//
+// Everything is the one heap here, so the PSRAM functions just use it
+
+inline bool psramInit() { return false; }
+inline void * ps_malloc(size_t bytes) { return malloc(bytes); }
+inline void * PreferPSRAMAlloc(size_t bytes) { return malloc(bytes); }
+
+struct free_deleter
+{
+    void operator()(void * p) const { free(p); }
+};
+
+template <typename T>
+using unique_free_array = std::unique_ptr<T[], free_deleter>;
+
+template<typename T>
+std::unique_ptr<T[]> make_unique_psram_array(size_t size)
+{
+    return std::unique_ptr<T[]>(new T[size]);
+}
+
+// FastLED
+//
+// Just enough of CRGB and the 8-bit math for the kernels.  The noise is a Perlin gradient noise over the same ranges
+// as FastLED's inoise8 and inoise16, so the work per sample is about the same, but the values aren't FastLED's.
+
+typedef uint8_t fract8;
+
+inline uint8_t scale8(uint8_t i, fract8 scale)        { return ((uint16_t) i * (1 + (uint16_t) scale)) >> 8; }
+inline uint8_t qadd8(uint8_t i, uint8_t j)            { return std::min(255, i + j); }
+inline uint8_t qsub8(uint8_t i, uint8_t j)            { return std::max(0, i - j); }
+
+struct CRGB
+{
+    uint8_t r = 0;
+    uint8_t g = 0;
+    uint8_t b = 0;
+
+    CRGB() = default;
+    constexpr CRGB(uint8_t ir, uint8_t ig, uint8_t ib) : r(ir), g(ig), b(ib) {}
+    constexpr CRGB(uint32_t colorcode) : r(colorcode >> 16), g(colorcode >> 8), b(colorcode) {}
+
+    bool operator==(const CRGB & other) const { return r == other.r && g == other.g && b == other.b; }
+    bool operator!=(const CRGB & other) const { return !(*this == other); }
+
+    CRGB & nscale8(uint8_t scale)
+    {
+        r = scale8(r, scale);
+        g = scale8(g, scale);
+        b = scale8(b, scale);
+        return *this;
+    }
+
+    CRGB & operator+=(const CRGB & other)
+    {
+        r = qadd8(r, other.r);
+        g = qadd8(g, other.g);
+        b = qadd8(b, other.b);
+        return *this;
+    }
+};
+
+// HeatColor
+//
+// FastLED's black body ramp: black through red and yellow to white
+
+inline CRGB HeatColor(uint8_t temperature)
+{
+    uint8_t t192 = scale8(temperature, 191);
+    uint8_t heatramp = (t192 & 0x3F) << 2;
+
+    if (t192 & 0x80)
+        return CRGB(255, 255, heatramp);
+    if (t192 & 0x40)
+        return CRGB(255, heatramp, 0);
+    return CRGB(heatramp, 0, 0);
+}
+
+namespace NativeNoise
+{
+    inline const uint8_t * Permutation()
+    {
+        static uint8_t table[512];
+        static bool bReady = false;
+        if (!bReady)
+        {
+            std::mt19937 generator(0);
+            for (int i = 0; i < 256; i++)
+                table[i] = i;
+            std::shuffle(table, table + 256, generator);
+            std::copy(table, table + 256, table + 256);
+            bReady = true;
+        }
+        return table;
+    }
+
+    inline float Fade(float t) { return t * t * t * (t * (t * 6 - 15) + 10); }
+    inline float Lerp(float t, float a, float b) { return a + t * (b - a); }
+
+    inline float Grad(uint8_t hash, float x, float y, float z)
+    {
+        uint8_t h = hash & 15;
+        float u = h < 8 ? x : y;
+        float v = h < 4 ? y : (h == 12 || h == 14) ? x : z;
+        return ((h & 1) ? -u : u) + ((h & 2) ? -v : v);
+    }
+
+    // Noise at a point given in lattice cells and a fraction of one, from about -1 to 1
+    inline float Noise(uint32_t X, uint32_t Y, uint32_t Z, float x, float y, float z)
+    {
+        const uint8_t * p = Permutation();
+        X &= 255; Y &= 255; Z &= 255;
+
+        float u = Fade(x), v = Fade(y), w = Fade(z);
+        int A = p[X] + Y, AA = p[A] + Z, AB = p[A + 1] + Z;
+        int B = p[X + 1] + Y, BA = p[B] + Z, BB = p[B + 1] + Z;
+
+        return Lerp(w, Lerp(v, Lerp(u, Grad(p[AA], x, y, z),         Grad(p[BA], x - 1, y, z)),
+                               Lerp(u, Grad(p[AB], x, y - 1, z),     Grad(p[BB], x - 1, y - 1, z))),
+                       Lerp(v, Lerp(u, Grad(p[AA + 1], x, y, z - 1), Grad(p[BA + 1], x - 1, y, z - 1)),
+                               Lerp(u, Grad(p[AB + 1], x, y - 1, z - 1), Grad(p[BB + 1], x - 1, y - 1, z - 1))));
+    }
+}
+
+inline uint16_t inoise16(uint32_t x, uint32_t y, uint32_t z)
+{
+    float n = NativeNoise::Noise(x >> 16, y >> 16, z >> 16, (x & 0xFFFF) / 65536.0f, (y & 0xFFFF) / 65536.0f, (z & 0xFFFF) / 65536.0f);
+    return (uint16_t) std::clamp(32768.0f + n * 32767.0f, 0.0f, 65535.0f);
+}
+
+inline uint8_t inoise8(uint16_t x, uint16_t y, uint16_t z)
+{
+    float n = NativeNoise::Noise(x >> 8, y >> 8, z >> 8, (x & 0xFF) / 256.0f, (y & 0xFF) / 256.0f, (z & 0xFF) / 256.0f);
+    return (uint8_t) std::clamp(128.0f + n * 127.0f, 0.0f, 255.0f);
+}
@@ -0,0 +1,5 @@
+// Host build stand-in: there's no external RAM, so every buffer is internal
+
+#pragma once
+
+inline bool esp_ptr_external_ram(const void *) { return false; }
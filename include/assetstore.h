@@ -0,0 +1,226 @@
+//+--------------------------------------------------------------------------
+//
+// File:        assetstore.h
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+//
+// Description:
+//
+//    GIFs, fonts and palettes kept in their own data partition, so they
+//    can be added over the REST API rather than built into the firmware.
+//
+//    The partition (ASSET_PARTITION_LABEL) is memory mapped once, and the
+//    consumers get pointers straight into the mapping, so an asset is
+//    read from flash as it's used and never copied to RAM.  It starts
+//    with two index sectors, each an AssetIndexHeader and the entries
+//    that say where each asset is; the one with the higher generation
+//    and a good CRC is the current one, and a change is written to the
+//    other, so a write that's cut short leaves the last index in place.
+//    The assets follow, each written once after the last.
+//
+//    Space is never reused while running, so a pointer an effect holds
+//    stays good even if its asset is replaced or deleted.  At boot the
+//    free space starts after the last asset still listed, so deleting
+//    the newest assets, or all of them, and restarting reclaims it.
+//
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <vector>
+#include <esp_partition.h>
+#include <gfxfont.h>
+
+#include "globals.h"
+
+#if ENABLE_ASSET_STORE
+
+#define ASSET_INDEX_MAGIC   0x5341444E      // "NDAS", little-endian like everything else in the partition
+#define ASSET_INDEX_VERSION 1
+
+enum class AssetType : uint8_t
+{
+    None    = 0,
+    GIF     = 1,                            // A GIF file, at most the size of the matrix
+    Font    = 2,                            // A FontAssetHeader, then Adafruit GFX glyphs and bitmaps
+    Palette = 3                             // A FastLED gradient palette: index, red, green, blue, up to index 255
+};
+
+// AssetEntry
+//
+// Where one asset is.  Offsets are from the start of the partition.
+
+struct __attribute__((packed)) AssetEntry
+{
+    uint16_t  Id;
+    AssetType Type;
+    uint8_t   Reserved;
+    uint32_t  Offset;
+    uint32_t  Length;
+    uint32_t  Param;                        // Frames per second for a GIF, or 0 for its default
+    char      Name[16];                     // Zero terminated
+};
+
+static_assert(sizeof(AssetEntry) == 32, "The index format has 32-byte entries");
+
+// AssetIndexHeader
+//
+// The start of each index sector
+
+struct __attribute__((packed)) AssetIndexHeader
+{
+    uint32_t Magic;                         // ASSET_INDEX_MAGIC
+    uint32_t CRC;                           // Over everything that follows it, up to the last entry in use
+    uint32_t Generation;                    // One more than the index it replaced
+    uint16_t Version;                       // ASSET_INDEX_VERSION
+    uint16_t Count;
+    uint8_t  Reserved[16];
+};
+
+// FontAssetHeader
+//
+// What a font asset starts with.  The glyphs are GFXglyph records and the bitmap is packed as Adafruit GFX packs it,
+// so a font made with fontconvert only needs this header put in front of its two arrays.
+
+struct __attribute__((packed)) FontAssetHeader
+{
+    uint16_t First;                         // First and last character the glyphs cover
+    uint16_t Last;
+    uint8_t  YAdvance;                      // Line height
+    uint8_t  Reserved[3];
+    uint32_t GlyphOffset;                   // From the start of the asset; must be even
+    uint32_t BitmapOffset;
+};
+
+// AssetStore
+//
+// Lookups come from the effects and uploads from the web server, so the index is swapped under a lock and the
+// flash is only ever written by one upload or change at a time
+
+class AssetStore
+{
+  public:
+
+    static constexpr size_t kSectorSize = 4096;
+    static constexpr size_t kMaxAssets  = (kSectorSize - sizeof(AssetIndexHeader)) / sizeof(AssetEntry);
+
+  private:
+
+    struct AssetIndex
+    {
+        AssetIndexHeader Header;
+        AssetEntry       Entries[kMaxAssets];
+    };
+
+    static_assert(sizeof(AssetIndex) == kSectorSize, "The index fills one sector");
+
+    const esp_partition_t *     _pPartition = nullptr;
+    const uint8_t *             _pAssets    = nullptr;      // The mapped partition
+    esp_partition_mmap_handle_t _hMapping   = 0;
+
+    mutable std::mutex          _indexMutex;                // Held while the index is read or swapped
+    std::mutex                  _writeMutex;                // Held for as long as an upload or change runs
+    AssetIndex *                _pIndex     = nullptr;      // The current index
+    AssetIndex *                _pSpare     = nullptr;      // Where the next one is put together
+    size_t                      _iIndexSector = 0;          // Which sector the current index came from
+
+    size_t                      _dataEnd    = 2 * kSectorSize;  // Where the next asset goes
+    size_t                      _erasedEnd  = 2 * kSectorSize;  // Everything from here on still has to be erased
+
+    // The upload in progress, if Length isn't 0
+
+    AssetEntry                  _upload     = {};
+    size_t                      _cbUploaded = 0;
+    bool                        _bUploadFailed = false;
+
+    static uint32_t IndexCRC(const AssetIndex & index);
+    static void RemoveEntry(AssetIndex & index, uint16_t id);
+    const AssetEntry * FindEntry(uint16_t id) const;
+    bool UpdateIndex(const std::function<void(AssetIndex &)> & edit);
+    bool Validate(const AssetEntry & entry, String & error) const;
+
+  public:
+
+    ~AssetStore();
+
+    // begin
+    //
+    // Maps the asset partition and reads its index, returning false if there's no partition
+
+    bool begin();
+
+    bool IsAvailable() const
+    {
+        return _pAssets;
+    }
+
+    size_t Capacity() const
+    {
+        return _pPartition ? _pPartition->size : 0;
+    }
+
+    // Space left for new assets before a restart gives back what deleted ones took
+    size_t FreeSpace() const;
+
+    // The entries as they stand, for listing
+    std::vector<AssetEntry> Entries() const;
+
+    // Find
+    //
+    // The entry for an asset, if there is one of that type, and where its bytes are in the mapping
+
+    std::optional<AssetEntry> Find(uint16_t id, AssetType type) const;
+
+    const uint8_t * Data(const AssetEntry & entry) const
+    {
+        return _pAssets + entry.Offset;
+    }
+
+    // Font and Palette
+    //
+    // A font or palette asset made ready to use.  The font's glyphs and bitmap stay in flash.
+
+    std::optional<GFXfont> Font(uint16_t id) const;
+    std::optional<CRGBPalette16> Palette(uint16_t id) const;
+
+    // BeginUpload, WriteUpload and FinishUpload
+    //
+    // Add an asset a piece at a time as the body of a request comes in, replacing any asset with the same id once the
+    // last piece is in and the asset checks out.  Each sector is erased as the upload first reaches it.  An upload
+    // that's begun before the last one finished throws that one away.
+
+    bool BeginUpload(uint16_t id, AssetType type, const String & name, uint32_t param, size_t length, String & error);
+    void WriteUpload(const uint8_t * pData, size_t cbData);
+    std::optional<AssetEntry> FinishUpload(String & error);
+
+    // Remove and Clear
+    //
+    // Take one asset, or all of them, out of the index
+
+    bool Remove(uint16_t id);
+    bool Clear();
+
+    static const char * TypeName(AssetType type);
+    static AssetType TypeFromName(const String & name);
+};
+
+#endif
@@ -0,0 +1,127 @@
+//+--------------------------------------------------------------------------
+//
+// File:        audiolatency.h
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+//
+// Description:
+//
+//    Measures how long the sound takes to turn into light: from when the
+//    samples were heard to when the analyzer published them, and from the
+//    start of the frame that drew with them to when that frame went out.
+//    The sum is the audio-to-light latency, which the analyzer uses to
+//    time the levels it hands the effects to when their frame will be
+//    seen, and which beat effects can use to flash ahead of a beat.
+//
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <esp_timer.h>
+#include "globals.h"
+
+#if ENABLE_AUDIO && ENABLE_AUDIO_LATENCY
+
+// AudioLatency
+//
+// The stamps of the frame being drawn are handed on with the frame to whoever shows it, so with a pipelined present
+// the frame that goes out is matched with its own stamps rather than those of the one being drawn meanwhile.  The
+// hand over and the show happen on either side of the present semaphore, which orders them.  The measures are
+// smoothed so one slow frame doesn't throw the timing about.
+
+class AudioLatency
+{
+    static constexpr int kSmoothing = 16;                   // Frames or passes in the running average
+
+    std::atomic<int64_t>  _latestCaptureMicros   { 0 };     // When the newest published pass was heard
+    std::atomic<uint32_t> _captureToPublishMicros { 0 };
+    std::atomic<uint32_t> _drawToLightMicros     { 0 };
+    std::atomic<uint32_t> _audioToLightMicros    { 0 };
+
+    int64_t _drawStartMicros    = 0;                        // The frame being drawn
+    int64_t _drawCaptureMicros  = 0;
+    int64_t _shownStartMicros   = 0;                        // The frame handed on to be shown
+    int64_t _shownCaptureMicros = 0;
+
+    static void Smooth(std::atomic<uint32_t> & average, int64_t sample)
+    {
+        uint32_t value = (uint32_t) std::clamp<int64_t>(sample, 0, MICROS_PER_SECOND);
+        uint32_t old = average.load(std::memory_order_relaxed);
+        average.store(old ? old + ((int32_t) value - (int32_t) old) / kSmoothing : value, std::memory_order_relaxed);
+    }
+
+  public:
+
+    // AudioPublished
+    //
+    // The audio task, when a pass's levels are out
+
+    void AudioPublished(int64_t captureMicros)
+    {
+        Smooth(_captureToPublishMicros, esp_timer_get_time() - captureMicros);
+        _latestCaptureMicros.store(captureMicros, std::memory_order_relaxed);
+    }
+
+    // FrameStarted, FrameHandedOver and FrameShown
+    //
+    // The draw loop stamps each frame as it starts, the graphics hand the stamps on as they pass the frame to be
+    // shown, and whatever shows it says when it went out
+
+    void FrameStarted(int64_t frameMicros)
+    {
+        _drawStartMicros   = frameMicros;
+        _drawCaptureMicros = _latestCaptureMicros.load(std::memory_order_relaxed);
+    }
+
+    void FrameHandedOver()
+    {
+        _shownStartMicros   = _drawStartMicros;
+        _shownCaptureMicros = _drawCaptureMicros;
+    }
+
+    void FrameShown()
+    {
+        int64_t now = esp_timer_get_time();
+        Smooth(_drawToLightMicros, now - _shownStartMicros);
+        if (_shownCaptureMicros)
+            Smooth(_audioToLightMicros, now - _shownCaptureMicros);
+    }
+
+    // PresentationMicros
+    //
+    // When the frame being drawn should be seen, going by how long the last frames took to get out.  Only means
+    // something on the draw task.
+
+    int64_t PresentationMicros() const
+    {
+        return _drawStartMicros + _drawToLightMicros.load(std::memory_order_relaxed);
+    }
+
+    // What each part of the pipeline takes, and all of it
+
+    uint32_t CaptureToPublishMicros() const { return _captureToPublishMicros.load(std::memory_order_relaxed); }
+    uint32_t DrawToLightMicros() const      { return _drawToLightMicros.load(std::memory_order_relaxed); }
+    uint32_t AudioToLightMicros() const     { return _audioToLightMicros.load(std::memory_order_relaxed); }
+};
+
+extern AudioLatency g_AudioLatency;
+
+#endif
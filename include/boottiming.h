@@ -0,0 +1,99 @@
+//+--------------------------------------------------------------------------
+//
+// File:        boottiming.h
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+//
+// Description:
+//
+//    Notes when each stage of startup finishes, for the serial output
+//    and /statistics
+//
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#include <atomic>
+#include <Arduino.h>
+#include "globals.h"
+
+// The stages of setup(), in the order they run
+
+enum class BootStage : uint8_t
+{
+    Core,               // Serial, the file system, NVS and the device config
+    Display,            // Screens, the LED hardware and the splash effect
+    Effects,            // Loading the effects and starting the drawing
+    Network,            // WiFi, the servers and the network tasks
+    Count
+};
+
+// BootTiming
+//
+// The millis() at which each stage finished, or 0 for those still to come.  With ENABLE_FAST_BOOT the network stage
+// runs on its own task, so it finishes some time after the first frames have gone out.
+
+class BootTiming
+{
+    std::atomic<uint32_t> _stageEnd[(size_t) BootStage::Count] = {};
+
+  public:
+
+    static const char * StageName(BootStage stage)
+    {
+        static const char * const names[] = { "core", "display", "effects", "network" };
+        return names[(size_t) stage];
+    }
+
+    void StageDone(BootStage stage)
+    {
+        _stageEnd[(size_t) stage] = std::max<uint32_t>(1, millis());
+    }
+
+    bool IsDone(BootStage stage) const
+    {
+        return _stageEnd[(size_t) stage] != 0;
+    }
+
+    // How long the stage took, counting from the end of the one before it, or from power on for the first
+    uint32_t StageMilliseconds(BootStage stage) const
+    {
+        if (!IsDone(stage))
+            return 0;
+
+        uint32_t start = stage == BootStage::Core ? 0 : _stageEnd[(size_t) stage - 1].load();
+        return _stageEnd[(size_t) stage] - start;
+    }
+
+    String ToString() const
+    {
+        String text;
+
+        for (size_t i = 0; i < (size_t) BootStage::Count && IsDone((BootStage) i); i++)
+        {
+            if (i > 0)
+                text += ", ";
+            text += str_sprintf("%s %lu ms", StageName((BootStage) i), (unsigned long) StageMilliseconds((BootStage) i));
+        }
+
+        return text;
+    }
+};
+
+extern BootTiming g_BootTiming;
@@ -0,0 +1,223 @@
+//+--------------------------------------------------------------------------
+//
+// File:        clocksync.h
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+//
+// Description:
+//
+//    Keeps a clock that follows the sender's, by trading timestamps with
+//    it over UDP much like PTP does, so the frames on every node of a
+//    wall come due at the same moment even when SNTP leaves their own
+//    clocks tens of milliseconds apart
+//
+//    The node sends a request and the sender echoes it back with the
+//    times it received and answered it, all in microseconds since 1970
+//    and in network byte order:
+//
+//      uint32_t  magic         ascii "NDCS"
+//      uint32_t  sequence      request number, echoed back
+//      uint64_t  t1            node's clock when it sent the request
+//      uint64_t  t2            sender's clock when it received it (reply only)
+//      uint64_t  t3            sender's clock when it replied (reply only)
+//
+//    A sender that doesn't answer leaves the clock as the node's own.
+//
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <sys/time.h>
+#include <arpa/inet.h>
+#include "globals.h"
+#include "types.h"
+
+#define CLOCK_SYNC_HEADER       (0x5343444E)                                    // ascii "NDCS" as header
+
+// Outside the #if, as an effect sync leader answers these whether or not it syncs its own clock
+
+struct __attribute__((packed)) ClockSyncPacket
+{
+    uint32_t magic;
+    uint32_t sequence;
+    uint64_t t1;
+    uint64_t t2;
+    uint64_t t3;
+};
+
+// Turns a 64 bit time to network byte order and back, as htonl does for 32 bits
+inline uint64_t ClockSyncByteOrder(uint64_t value)
+{
+    return ((uint64_t) htonl((uint32_t) value) << 32) | htonl((uint32_t) (value >> 32));
+}
+
+#if ENABLE_CLOCK_SYNC && ENABLE_WIFI
+
+// ClockSync
+//
+// Each exchange gives an offset to the sender's clock, give or take half the round trip.  The exchanges with the
+// shortest round trips are the ones least held up in a queue somewhere, so only those are kept, and a line fitted
+// through their offsets over time gives both the offset now and how fast our clock drifts from the sender's.
+
+class ClockSync
+{
+    struct Sample
+    {
+        int64_t LocalUs;                    // Our clock halfway through the exchange
+        int64_t OffsetUs;                   // Sender's clock minus ours
+        int64_t DelayUs;                    // Round trip, less the time the sender took to answer
+    };
+
+    mutable std::mutex _mutex;
+    Sample   _samples[CLOCK_SYNC_SAMPLES] = {};
+    size_t   _cSamples = 0;
+    size_t   _iNext = 0;
+    uint32_t _sequence = 0;
+    uint32_t  _reference = 0;               // The sender's address, or 0 if we haven't heard from one
+    std::atomic<int> _socket { -1 };        // Made by the receive task; Exchange() sends on it too
+
+    // The fitted line: offset = OffsetUs + Skew * (local - BaseUs)
+    int64_t  _baseUs = 0;
+    double   _offsetUs = 0.0;
+    double   _skew = 0.0;
+    bool     _bSynced = false;
+
+    static int64_t LocalMicros()
+    {
+        timeval tv;
+        gettimeofday(&tv, nullptr);
+        return (int64_t) tv.tv_sec * MICROS_PER_SECOND + tv.tv_usec;
+    }
+
+    void AddSample(const Sample & sample);
+
+  public:
+
+    // Where the frames come from, which is who we sync with, as an s_addr
+    void SetReference(uint32_t address)
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        if (address != _reference)
+        {
+            _reference = address;
+            _cSamples = _iNext = 0;
+            _bSynced = false;
+        }
+    }
+
+    // Exchange
+    //
+    // Sends the sender a request, and leaves the answer to ReceiveLoop(), so the NetworkReader it's run from never
+    // waits on it.  Returns false if there's no sender yet or the request couldn't be sent.
+
+    bool Exchange();
+
+    // ReceiveLoop
+    //
+    // Runs on the clock sync task for good, taking in the answers as they come so they're stamped straight away.
+    // An answer to any but the latest request, or one that took over CLOCK_SYNC_TIMEOUT ms, is dropped.
+
+    void ReceiveLoop();
+
+    // AddOneWay
+    //
+    // The time the sender stamped on a broadcast as it sent it, and ours when it came in.  The time it spent on the
+    // way counts as part of the offset, so this only suits a link as quick and steady as ESP-NOW.
+
+    void AddOneWay(int64_t localUs, int64_t senderUs)
+    {
+        AddSample({ localUs, senderUs - localUs, 0 });
+    }
+
+    // The sender's clock, in microseconds since 1970, or ours if we're not synced
+    int64_t NowMicros() const
+    {
+        int64_t local = LocalMicros();
+
+        std::lock_guard<std::mutex> guard(_mutex);
+        if (!_bSynced)
+            return local;
+        return local + (int64_t)(_offsetUs + _skew * (local - _baseUs));
+    }
+
+    bool IsSynced() const
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        return _bSynced;
+    }
+
+    double OffsetMicros() const
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        return _offsetUs;
+    }
+
+    // How much faster the sender's clock runs than ours, in parts per million
+    double SkewPPM() const
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        return _skew * 1e6;
+    }
+
+    // The shortest round trip in the samples we're using
+    int64_t BestDelayMicros() const;
+};
+
+extern ClockSync g_ClockSync;
+
+#endif
+
+// SyncedTime, SyncedMicros and SyncedTimeval
+//
+// The clock frames are timed against: the sender's, as far as ClockSync can tell, or our own without it
+
+inline double SyncedTime()
+{
+    #if ENABLE_CLOCK_SYNC && ENABLE_WIFI
+        return g_ClockSync.NowMicros() / (double) MICROS_PER_SECOND;
+    #else
+        return CAppTime::CurrentTime();
+    #endif
+}
+
+inline int64_t SyncedMicros()
+{
+    #if ENABLE_CLOCK_SYNC && ENABLE_WIFI
+        return g_ClockSync.NowMicros();
+    #else
+        timeval tv;
+        gettimeofday(&tv, nullptr);
+        return (int64_t) tv.tv_sec * MICROS_PER_SECOND + tv.tv_usec;
+    #endif
+}
+
+inline timeval SyncedTimeval()
+{
+    timeval tv;
+    #if ENABLE_CLOCK_SYNC && ENABLE_WIFI
+        int64_t us = g_ClockSync.NowMicros();
+        tv.tv_sec  = us / MICROS_PER_SECOND;
+        tv.tv_usec = us % MICROS_PER_SECOND;
+    #else
+        gettimeofday(&tv, nullptr);
+    #endif
+    return tv;
+}
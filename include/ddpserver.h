@@ -0,0 +1,126 @@
+//+--------------------------------------------------------------------------
+//
+// File:        ddpserver.h
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+// Description:
+//
+//    Receives pixel data over DDP, the Distributed Display Protocol
+//    (http://www.3waylabs.com/ddp/), whose 10 byte header makes for much
+//    less overhead per pixel than PIXELDATA64 over TCP on big displays.
+//
+//    Each datagram is a fragment of a frame, placed by its byte offset.
+//    Fragments are received straight into the frame being put together
+//    in the channel's LEDBuffer ring, and the frame is committed when one
+//    arrives with the push flag set.  Destination 1 is channel 0, 2 is
+//    channel 1 and so on, and 255 sends to every channel.  A fragment
+//    with a timecode times the frame when it's pushed, so it's shown at
+//    the same moment as on the other nodes; frames without one are drawn
+//    as soon as they arrive.
+//
+//    Pixels the sender leaves out of a frame keep whatever their slot of
+//    the ring last held, so senders should send every pixel.
+//
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <bitset>
+#include <memory>
+
+#include "ledbuffer.h"
+
+#if ENABLE_DDP_INGEST
+
+#if !INCOMING_WIFI_ENABLED
+    #error ENABLE_DDP_INGEST requires INCOMING_WIFI_ENABLED
+#endif
+
+#define DDP_HEADER_SIZE             10
+#define DDP_TIMECODE_SIZE           4
+#define DDP_FLAG_VERSION_MASK       0xC0
+#define DDP_FLAG_VERSION_1          0x40
+#define DDP_FLAG_TIMECODE           0x10
+#define DDP_FLAG_STORAGE            0x08
+#define DDP_FLAG_REPLY              0x04
+#define DDP_FLAG_QUERY              0x02
+#define DDP_FLAG_PUSH               0x01
+#define DDP_ID_DISPLAY              1               // The first channel; the ones after it follow on
+#define DDP_ID_ALL                  255
+
+// DDPServer
+//
+// Listens for DDP datagrams and assembles their fragments into frames in the LEDBufferManager rings
+
+class DDPServer
+{
+private:
+
+    // The frame being put together for one channel
+    struct ChannelFrame
+    {
+        std::shared_ptr<LEDBuffer> pBuffer;             // The reserved head of the ring, or nullptr between frames
+        size_t                     cbExtent = 0;        // How far into the frame the fragments have reached
+        std::bitset<NUM_LEDS>      received;            // The pixels some fragment has written to
+        uint64_t                   seconds  = 0;        // When the frame is due, from the last timecode, or 0 for now
+        uint64_t                   micros   = 0;
+    };
+
+    int             _fd = -1;
+    ChannelFrame    _frames[NUM_CHANNELS];
+
+    static void TimecodeToTimestamp(uint32_t timecode, uint64_t & seconds, uint64_t & micros);
+    ChannelFrame & PendingFrame(size_t iChannel);
+    void CommitChannel(size_t iChannel);
+    void Discard();
+    void ReceiveFragment();
+
+public:
+
+    uint32_t        _cReceived = 0;
+    uint32_t        _cDropped  = 0;
+    uint32_t        _cFrames   = 0;
+
+    void release()
+    {
+        if (_fd >= 0)
+        {
+            close(_fd);
+            _fd = -1;
+        }
+
+        // A part built frame is left where it is in the ring and simply filled again
+
+        for (auto & frame : _frames)
+            frame = ChannelFrame();
+    }
+
+    bool begin();
+
+    // ProcessIncomingFragmentsLoop
+    //
+    // Receives fragments until the socket fails or WiFi drops
+
+    void ProcessIncomingFragmentsLoop();
+};
+
+#endif
@@ -0,0 +1,181 @@
+//+--------------------------------------------------------------------------
+//
+// File:        deepframe.h
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+//
+// Description:
+//
+//    A frame with 16 bits a channel for effects that fade and blur what
+//    they drew before, so dim trails don't round down to black, and that
+//    is dithered down to the 8 bit pixels once a frame
+//
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#include "globals.h"
+#include "effectmemory.h"
+#include "gfxbase.h"
+
+// CRGB16
+//
+// A pixel in 8.8 fixed point: the top byte is what a CRGB would hold, the bottom one the fraction below it
+
+struct CRGB16
+{
+    uint16_t r, g, b;
+};
+
+// DeepFrame
+//
+// Effects draw into it in place of the leds, and Resolve() turns it into the leds at the end of the frame with an
+// ordered dither that moves every frame, so the fraction shows up as in-between levels over space and time.  The
+// brightness, gamma and power limit stay where they are, in each backend's output stage.
+//
+// The frame is effect state, charged to the effect that makes it.  A matrix's goes in PSRAM, but a strip's is small
+// enough to keep in internal RAM, where the per-pixel passes over it are faster.
+
+class DeepFrame
+{
+    uint16_t _width;
+    uint16_t _height;
+    effect_unique_array<CRGB16> _pixels;
+    uint8_t _ditherFrame = 0;
+
+    static constexpr uint8_t kBayer4x4[16] = { 0, 8, 2, 10, 12, 4, 14, 6, 3, 11, 1, 9, 15, 7, 13, 5 };
+
+    static inline uint16_t Saturate(uint32_t value)
+    {
+        return value > UINT16_MAX ? UINT16_MAX : value;
+    }
+
+    // BlurLine
+    //
+    // The blur GFXBase::BlurLine does, in 8.8 and with coefficients (out of 65536) that add up to no more than one,
+    // as without the rounding down to take the excess away it would slowly brighten.  Any fade is already in them,
+    // so it costs nothing on top of the blur.
+
+    static void BlurLine(CRGB16 * pFirst, size_t stride, uint16_t first, uint16_t length, uint32_t keep, uint32_t seep)
+    {
+        CRGB16 carryover = { 0, 0, 0 };
+
+        for (uint16_t i = first; i < length; i++)
+        {
+            CRGB16 & pixel = pFirst[i * stride];
+            CRGB16 part = { (uint16_t) ((pixel.r * seep) >> 16), (uint16_t) ((pixel.g * seep) >> 16), (uint16_t) ((pixel.b * seep) >> 16) };
+
+            pixel.r = Saturate(((pixel.r * keep) >> 16) + carryover.r);
+            pixel.g = Saturate(((pixel.g * keep) >> 16) + carryover.g);
+            pixel.b = Saturate(((pixel.b * keep) >> 16) + carryover.b);
+
+            if (i > first)
+            {
+                CRGB16 & previous = pFirst[(i - 1) * stride];
+                previous.r = Saturate(previous.r + part.r);
+                previous.g = Saturate(previous.g + part.g);
+                previous.b = Saturate(previous.b + part.b);
+            }
+            carryover = part;
+        }
+    }
+
+  public:
+
+    DeepFrame(uint16_t width, uint16_t height)
+        : _width(width),
+          _height(height),
+          _pixels(static_cast<CRGB16 *>(EffectAlloc(sizeof(CRGB16) * width * height, height > 1)))
+    {
+        Clear();
+    }
+
+    // False if there wasn't the memory for the frame, in which case nothing else may be called
+    bool IsValid() const
+    {
+        return _pixels != nullptr;
+    }
+
+    void Clear()
+    {
+        if (_pixels)
+            memset(_pixels.get(), 0, sizeof(CRGB16) * _width * _height);
+    }
+
+    CRGB16 & At(uint16_t x, uint16_t y)
+    {
+        return _pixels[y * _width + x];
+    }
+
+    // Adds a color in, saturating, and ignores anything off the frame
+    void Add(int16_t x, int16_t y, const CRGB & color)
+    {
+        if (x < 0 || y < 0 || x >= _width || y >= _height)
+            return;
+
+        CRGB16 & pixel = At(x, y);
+        pixel.r = Saturate(pixel.r + (color.r << 8));
+        pixel.g = Saturate(pixel.g + (color.g << 8));
+        pixel.b = Saturate(pixel.b + (color.b << 8));
+    }
+
+    // FadeAndBlur
+    //
+    // Blurs the rows and then the columns by blurAmount, as GFXBase::blur2d does, and scales everything by fade/256
+    // in the same pass.  Columns skip the rows before firstRow the way BlurFrame() leaves the VU meter row alone.
+
+    void FadeAndBlur(fract8 blurAmount, uint16_t fade = 256, uint16_t firstRow = 0)
+    {
+        const uint32_t keep = (256 - blurAmount) << 8;
+        const uint32_t seep = (blurAmount >> 1) << 8;
+
+        for (uint16_t y = 0; y < _height; y++)
+            BlurLine(&At(0, y), 1, 0, _width, keep * fade >> 8, seep * fade >> 8);
+
+        if (_height > 1)
+            for (uint16_t x = 0; x < _width; x++)
+                BlurLine(&At(x, 0), _width, firstRow, _height, keep, seep);
+    }
+
+    // Resolve
+    //
+    // Dithers the frame down into the device's leds
+
+    void Resolve(GFXBase & graphics)
+    {
+        _ditherFrame++;
+
+        for (uint16_t y = 0; y < _height; y++)
+        {
+            const uint8_t * pBayerRow = &kBayer4x4[((y + _ditherFrame) & 3) * 4];
+            const CRGB16 * pRow = &At(0, y);
+
+            for (uint16_t x = 0; x < _width; x++)
+            {
+                uint32_t threshold = (pBayerRow[(x + (_ditherFrame >> 2)) & 3] << 4) + 8;
+                CRGB & pixel = graphics.pixelUnchecked(x, y);
+                pixel.r = std::min<uint32_t>(255, (pRow[x].r + threshold) >> 8);
+                pixel.g = std::min<uint32_t>(255, (pRow[x].g + threshold) >> 8);
+                pixel.b = std::min<uint32_t>(255, (pRow[x].b + threshold) >> 8);
+            }
+        }
+
+        graphics.MarkAllDirty();
+    }
+};
@@ -0,0 +1,64 @@
+//+--------------------------------------------------------------------------
+//
+// File:        deflate.h
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+//
+// Description:
+//
+//    Compresses data with uzlib's deflate, reusing its buffers from one
+//    call to the next so nothing is allocated once they've grown
+//
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#include <vector>
+#include "globals.h"
+
+// Deflater
+//
+// Writes raw deflate data, with no zlib or gzip wrapper.  uzlib only writes static Huffman blocks, so it's quick
+// and needs little memory, and still takes runs and repeated patterns down to a fraction of their size.
+
+class Deflater
+{
+    static constexpr unsigned kHashBits = 12;
+
+    std::vector<const uint8_t *, psram_allocator<const uint8_t *>> _hashTable;
+    uint8_t * _pOutput = nullptr;                       // uzlib grows this with realloc, so we keep it between calls
+    int       _cbOutput = 0;
+
+  public:
+
+    Deflater() : _hashTable(1 << kHashBits)
+    {
+    }
+
+    ~Deflater()
+    {
+        free(_pOutput);
+    }
+
+    Deflater(const Deflater &) = delete;
+    Deflater & operator=(const Deflater &) = delete;
+
+    // Adds the compressed data to the end of out
+    void Deflate(const uint8_t * pData, size_t length, std::vector<uint8_t, psram_allocator<uint8_t>> & out);
+};
@@ -84,6 +84,15 @@
 #define BRIGHTNESS_MAX uint8_t(255)
 #define POWER_LIMIT_MIN 2000
 #define POWER_LIMIT_DEFAULT 4500
+#define AUDIO_PROFILE_MIN 0
+#define AUDIO_PROFILE_MAX 2
+#define AUDIO_PROFILE_DEFAULT 1
+#define RADIO_PROFILE_STREAMING 0           // Power save off, for the lowest latency on incoming frames
+#define RADIO_PROFILE_BALANCED 1            // The WiFi driver's default light modem sleep
+#define RADIO_PROFILE_INFORMATIONAL 2       // Deepest modem sleep, for nodes that only show their own effects
+#define RADIO_PROFILE_MIN RADIO_PROFILE_STREAMING
+#define RADIO_PROFILE_MAX RADIO_PROFILE_INFORMATIONAL
+#define RADIO_PROFILE_DEFAULT RADIO_PROFILE_BALANCED
 
 // DeviceConfig holds, persists and loads device-wide configuration settings. Effect-specific settings should
 // be managed using overrides of the respective methods in LEDStripEffect (HasSettings(), GetSettingSpecs(),
@@ -123,6 +132,9 @@ class DeviceConfig : public IJSONSerializable
     CRGB    globalColor = CRGB::Red;
     bool    applyGlobalColors = false;
     CRGB    secondColor = CRGB::Red;
+    int     audioProfile = AUDIO_PROFILE_DEFAULT;
+    int     radioProfile = RADIO_PROFILE_DEFAULT;
+    int     taskProfile = TASK_PROFILE_DEFAULT;
 
     std::vector<SettingSpec, psram_allocator<SettingSpec>> settingSpecs;
     std::vector<std::reference_wrapper<SettingSpec>> settingSpecReferences;
@@ -175,6 +187,14 @@ class DeviceConfig : public IJSONSerializable
     static constexpr const char * GlobalColorTag = NAME_OF(globalColor);
     static constexpr const char * ApplyGlobalColorsTag = NAME_OF(applyGlobalColors);
     static constexpr const char * SecondColorTag = NAME_OF(secondColor);
+    // No need to publish the audio profile tag unless there's audio to analyze
+    #if ENABLE_AUDIO
+    static constexpr const char * AudioProfileTag = NAME_OF(audioProfile);
+    #endif
+    #if ENABLE_WIFI
+    static constexpr const char * RadioProfileTag = NAME_OF(radioProfile);
+    #endif
+    static constexpr const char * TaskProfileTag = NAME_OF(taskProfile);
 
     DeviceConfig();
 
@@ -206,6 +226,13 @@ class DeviceConfig : public IJSONSerializable
         jsonDoc[GlobalColorTag] = globalColor;
         jsonDoc[ApplyGlobalColorsTag] = applyGlobalColors;
         jsonDoc[SecondColorTag] = secondColor;
+        #if ENABLE_AUDIO
+        jsonDoc[AudioProfileTag] = audioProfile;
+        #endif
+        #if ENABLE_WIFI
+        jsonDoc[RadioProfileTag] = radioProfile;
+        #endif
+        jsonDoc[TaskProfileTag] = taskProfile;
 
         if (includeSensitive)
             jsonDoc[OpenWeatherApiKeyTag] = openWeatherApiKey;
@@ -241,6 +268,16 @@ class DeviceConfig : public IJSONSerializable
         SetIfPresentIn(jsonObject, globalColor, GlobalColorTag);
         SetIfPresentIn(jsonObject, applyGlobalColors, ApplyGlobalColorsTag);
         SetIfPresentIn(jsonObject, secondColor, SecondColorTag);
+        #if ENABLE_AUDIO
+        SetIfPresentIn(jsonObject, audioProfile, AudioProfileTag);
+        audioProfile = std::clamp(audioProfile, AUDIO_PROFILE_MIN, AUDIO_PROFILE_MAX);
+        #endif
+        #if ENABLE_WIFI
+        SetIfPresentIn(jsonObject, radioProfile, RadioProfileTag);
+        radioProfile = std::clamp(radioProfile, RADIO_PROFILE_MIN, RADIO_PROFILE_MAX);
+        #endif
+        SetIfPresentIn(jsonObject, taskProfile, TaskProfileTag);
+        taskProfile = std::clamp(taskProfile, TASK_PROFILE_MIN, TASK_PROFILE_MAX);
 
         if (ntpServer.isEmpty())
             ntpServer = NTP_SERVER_DEFAULT;
@@ -388,6 +425,42 @@ class DeviceConfig : public IJSONSerializable
                 SettingSpec::SettingType::Color
             );
 
+            // Only publish the audio profile setting if the build has audio
+            #if ENABLE_AUDIO
+            settingSpecs.emplace_back(
+                AudioProfileTag,
+                "Audio analysis profile",
+                "Trades latency and CPU time against frequency resolution in the audio analysis: 0 is low latency, 1 is "
+                "balanced and 2 is high resolution bass. Takes effect right away.",
+                SettingSpec::SettingType::Slider,
+                AUDIO_PROFILE_MIN,
+                AUDIO_PROFILE_MAX
+            ).HasValidation = true;
+            #endif
+
+            #if ENABLE_WIFI
+            settingSpecs.emplace_back(
+                RadioProfileTag,
+                "WiFi radio profile",
+                "Trades power against latency on the WiFi radio: 0 turns power save off for streaming pixel data, 1 is the "
+                "default light sleep and 2 sleeps deepest, for a node that only shows its own effects. Takes effect right away.",
+                SettingSpec::SettingType::Slider,
+                RADIO_PROFILE_MIN,
+                RADIO_PROFILE_MAX
+            ).HasValidation = true;
+            #endif
+
+            settingSpecs.emplace_back(
+                TaskProfileTag,
+                "Task placement profile",
+                "Which core and priority the network, audio and helper tasks get: 0 is the default layout, 1 is for streaming pixel "
+                "data to the device, 2 leaves a core to effects drawn on the device and 3 gives audio reactive effects the most "
+                "room for the audio analysis. Compare them with the task list in the statistics. Takes effect after a reboot.",
+                SettingSpec::SettingType::Slider,
+                TASK_PROFILE_MIN,
+                TASK_PROFILE_MAX
+            ).HasValidation = true;
+
             settingSpecReferences.insert(settingSpecReferences.end(), settingSpecs.begin(), settingSpecs.end());
         }
 
@@ -585,6 +658,68 @@ class DeviceConfig : public IJSONSerializable
         SetAndSave(secondColor, newSecondColor);
     }
 
+    int GetAudioProfile() const
+    {
+        return audioProfile;
+    }
+
+    ValidateResponse ValidateAudioProfile(const String& newAudioProfile)
+    {
+        auto newNumericProfile = newAudioProfile.toInt();
+
+        if (newNumericProfile < AUDIO_PROFILE_MIN || newNumericProfile > AUDIO_PROFILE_MAX)
+            return { false, String("audioProfile must be between ") + AUDIO_PROFILE_MIN + " and " + AUDIO_PROFILE_MAX };
+
+        return { true, "" };
+    }
+
+    void SetAudioProfile(int newAudioProfile)
+    {
+        SetAndSave(audioProfile, std::clamp<int>(newAudioProfile, AUDIO_PROFILE_MIN, AUDIO_PROFILE_MAX));
+    }
+
+    int GetRadioProfile() const
+    {
+        return radioProfile;
+    }
+
+    ValidateResponse ValidateRadioProfile(const String& newRadioProfile)
+    {
+        auto newNumericProfile = newRadioProfile.toInt();
+
+        if (newNumericProfile < RADIO_PROFILE_MIN || newNumericProfile > RADIO_PROFILE_MAX)
+            return { false, String("radioProfile must be between ") + RADIO_PROFILE_MIN + " and " + RADIO_PROFILE_MAX };
+
+        return { true, "" };
+    }
+
+    // The network task applies it the next time it wakes, which is within a second
+    void SetRadioProfile(int newRadioProfile)
+    {
+        SetAndSave(radioProfile, std::clamp<int>(newRadioProfile, RADIO_PROFILE_MIN, RADIO_PROFILE_MAX));
+    }
+
+    int GetTaskProfile() const
+    {
+        return taskProfile;
+    }
+
+    ValidateResponse ValidateTaskProfile(const String& newTaskProfile)
+    {
+        auto newNumericProfile = newTaskProfile.toInt();
+
+        if (newNumericProfile < TASK_PROFILE_MIN || newNumericProfile > TASK_PROFILE_MAX)
+            return { false, String("taskProfile must be between ") + TASK_PROFILE_MIN + " and " + TASK_PROFILE_MAX };
+
+        return { true, "" };
+    }
+
+    // The tasks are placed by it when they're started, so a new profile is used from the next boot
+    void SetTaskProfile(int newTaskProfile)
+    {
+        SetAndSave(taskProfile, std::clamp<int>(newTaskProfile, TASK_PROFILE_MIN, TASK_PROFILE_MAX));
+    }
+
     void SetColorSettings(const CRGB& globalColor, const CRGB& secondColor);
     void ApplyColorSettings(std::optional<CRGB> globalColor, std::optional<CRGB> secondColor, bool clearGlobalColor, bool applyGlobalColor);
 };
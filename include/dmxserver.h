@@ -0,0 +1,135 @@
+//+--------------------------------------------------------------------------
+//
+// File:        dmxserver.h
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+// Description:
+//
+//    Receives pixel data as DMX universes over E1.31 (sACN) and Art-Net,
+//    so lighting desks and media servers can drive us directly.
+//
+//    Universes map onto the channels in order, DMX_UNIVERSES_PER_CHANNEL
+//    to a channel, with 170 RGB pixels to a universe.  The first universe
+//    is DMX_SACN_START_UNIVERSE for sACN and DMX_ARTNET_START_UNIVERSE for
+//    Art-Net.  Each universe is copied straight into the frame being put
+//    together in the channel's LEDBuffer ring, and the frame is committed
+//    when a sync packet arrives (while the sender sends them), when every
+//    universe of the channel is in, or when one repeats, which means the
+//    sender has moved on to the next frame.  Universes that didn't arrive
+//    keep the pixels of the frame before.
+//
+//    Frames carry no timestamp, so they're drawn as soon as they're due.
+//    Another source sending to the same channel at the same time would
+//    interfere with the frame being put together.
+//
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <memory>
+
+#include "ledbuffer.h"
+
+#if ENABLE_DMX_INGEST
+
+#if !INCOMING_WIFI_ENABLED
+    #error ENABLE_DMX_INGEST requires INCOMING_WIFI_ENABLED
+#endif
+
+#define DMX_PIXELS_PER_UNIVERSE     170                 // 510 of the 512 slots, as whole RGB triples
+#define DMX_MAX_DATAGRAM            640                 // The largest sACN data packet is 638 bytes, Art-Net's 530
+#define DMX_SEQUENCE_WINDOW         20                  // A sequence up to this far behind the last is a late packet (E1.31 6.7.2)
+
+static_assert(DMX_UNIVERSES_PER_CHANNEL >= 1 && DMX_UNIVERSES_PER_CHANNEL <= 32, "A channel takes between 1 and 32 universes");
+
+// DMXServer
+//
+// Listens on the sACN and Art-Net ports and assembles the universes into frames in the LEDBufferManager rings
+
+class DMXServer
+{
+private:
+
+    static constexpr size_t   kUniverses    = NUM_CHANNELS * DMX_UNIVERSES_PER_CHANNEL;
+    static constexpr size_t   kSlotsInUse   = std::min<size_t>(DMX_UNIVERSES_PER_CHANNEL, (NUM_LEDS + DMX_PIXELS_PER_UNIVERSE - 1) / DMX_PIXELS_PER_UNIVERSE);
+    static constexpr uint32_t kAllUniverses = kSlotsInUse == 32 ? UINT32_MAX : (1u << kSlotsInUse) - 1;         // The ones that have pixels to go to
+
+    // The frame being put together for one channel
+    struct ChannelFrame
+    {
+        std::shared_ptr<LEDBuffer> pBuffer;             // The reserved head of the ring, or nullptr between frames
+        uint32_t                   received = 0;        // The universes of the frame that are in, one bit each
+    };
+
+    int             _fdSACN   = -1;
+    int             _fdArtNet = -1;
+    uint8_t         _abPacket[DMX_MAX_DATAGRAM];
+    ChannelFrame    _frames[NUM_CHANNELS];
+    uint8_t         _lastSequence[kUniverses] = { 0 };
+    bool            _bHaveSequence[kUniverses] = { false };
+    unsigned long   _lastSyncMs = 0;                    // When the last sync packet came in, or 0 if none has
+
+    static bool OpenSocket(int & fd, int port);
+    void JoinSACNGroups();
+
+    bool SyncActive() const;
+    bool IsCurrentSequence(size_t iUniverse, uint8_t sequence);
+
+    void ProcessSACN(size_t cbPacket);
+    void ProcessArtNet(size_t cbPacket);
+    void UniverseReceived(size_t iUniverse, int sequence, const uint8_t * pData, size_t cbData, bool bWaitForSync);     // A sequence of -1 isn't counted
+    void CommitChannel(size_t iChannel);
+    void CommitAllChannels();
+
+public:
+
+    uint32_t        _cReceived = 0;
+    uint32_t        _cDropped  = 0;
+    uint32_t        _cFrames   = 0;
+
+    void release()
+    {
+        for (int * pfd : { &_fdSACN, &_fdArtNet })
+        {
+            if (*pfd >= 0)
+            {
+                close(*pfd);
+                *pfd = -1;
+            }
+        }
+
+        // A part built frame is left where it is in the ring and simply filled again
+
+        for (auto & frame : _frames)
+            frame = ChannelFrame();
+    }
+
+    bool begin();
+
+    // ProcessIncomingPacketsLoop
+    //
+    // Receives packets from both ports until a socket fails or WiFi drops
+
+    void ProcessIncomingPacketsLoop();
+};
+
+#endif
@@ -23,7 +23,7 @@
 //
 // Description:
 //
-//    This file contains the effect factory container class and its
+//    This file contains the effect factory tables class and its
 //    supporting types.
 //
 //
@@ -33,6 +33,7 @@
 
 #pragma once
 
+#include <algorithm>
 #include <vector>
 #include <map>
 #include <functional>
@@ -47,9 +48,11 @@ using JSONEffectFactory = std::shared_ptr<LEDStripEffect>(*)(const JsonObjectCon
 // -----------------------------------------------------------------------------
 // Class: EffectFactories
 //
-// This class manages a collection of default and JSON effect factories. Each
-// factory is associated with a unique effect number. Factories are categorized
-// into two types: default and JSON, managed separately using respective containers.
+// This class gives access to the default and JSON effect factories for the
+// project being built. Each factory is associated with an effect number. The
+// factories live in two constant tables that are worked out by the compiler from
+// the effect list in effects.cpp, so they sit in flash and nothing is registered
+// or allocated for them at boot.
 //
 // Sub-Structure:
 //
@@ -60,25 +63,19 @@ using JSONEffectFactory = std::shared_ptr<LEDStripEffect>(*)(const JsonObjectCon
 //                  Besides these member variables, the class includes a function to
 //                  create the effect in accordance with an instance's member variables'
 //                  values.
-//
-// Member Variables:
-//
-// defaultFactories: A vector of NumberedFactory instances. Each NumberedFactory holds an
-//                   effect number and a DefaultEffectFactory instance.
-// jsonFactories: A map linking each effect number to its corresponding JSONEffectFactory.
+// NumberedJSONFactory: A JSON factory coupled with the effect number it's for.
+// Table: The tables themselves, filled in at compile time by the ADD_EFFECT macros.
+//        The default factories are kept in the order they're added; the JSON ones
+//        are kept sorted by effect number, one per number, the first that was added.
+// Counter: Stands in for a Table to count the effects first, so the Table can be
+//          made exactly big enough.
 //
 // Member Functions:
 //
-// GetDefaultFactories: Returns a const reference to the vector of default factories.
-// GetJSONFactories: Returns a const reference to the map of JSON factories.
-// AddEffect: Adds a new effect factory into the collection. It takes three parameters:
-//            - An effect number which is an integer.
-//            - A DefaultEffectFactory reference.
-//            - A JSONEffectFactory reference.
-//            It returns a reference to the NumberedFactory that was created around the
-//            DefaultEffectFactory.
-// IsEmpty: Returns a boolean indicating whether both defaultFactories and jsonFactories are empty.
-// ClearDefaultFactories: Clears the vector of default factories.
+// GetDefaultFactories: Returns the range of default factories, in the order they were added.
+// FindJSONFactory: Returns a pointer to the JSON factory for an effect number, or nullptr
+//                  if there is none. It does a binary search of the sorted table.
+// IsEmpty: Returns a boolean indicating whether there are no factories at all.
 //
 // -----------------------------------------------------------------------------
 
@@ -88,18 +85,20 @@ class EffectFactories
 
     class NumberedFactory
     {
-        int effectNumber;
-        DefaultEffectFactory factory;
+        int effectNumber = 0;
+        DefaultEffectFactory factory = nullptr;
 
       public:
         bool LoadDisabled = false;
 
-        NumberedFactory(int effectNumber, const DefaultEffectFactory& factory)
+        constexpr NumberedFactory() = default;
+
+        constexpr NumberedFactory(int effectNumber, DefaultEffectFactory factory)
           : effectNumber(effectNumber),
             factory(factory)
         {}
 
-        int EffectNumber() const
+        constexpr int EffectNumber() const
         {
             return effectNumber;
         }
@@ -116,38 +115,103 @@ class EffectFactories
         }
     };
 
-  private:
+    struct NumberedJSONFactory
+    {
+        int EffectNumber = 0;
+        JSONEffectFactory Factory = nullptr;
+    };
 
-    std::vector<NumberedFactory, psram_allocator<NumberedFactory>> defaultFactories;
-    std::map<int, JSONEffectFactory, std::less<int>, psram_allocator<std::pair<const int, JSONEffectFactory>>> jsonFactories;
+    template <size_t N>
+    struct Table
+    {
+        NumberedFactory     Defaults[N] = {};
+        NumberedJSONFactory JSON[N] = {};
+        size_t              DefaultCount = 0;
+        size_t              JSONCount = 0;
 
-  public:
+        constexpr NumberedFactory& AddEffect(int effectNumber, DefaultEffectFactory defaultFactory, JSONEffectFactory jsonFactory)
+        {
+            // Find where the effect number goes in the sorted JSON table, and insert it there unless it's in already
+            size_t pos = 0;
+            while (pos < JSONCount && JSON[pos].EffectNumber < effectNumber)
+                pos++;
+
+            if (pos == JSONCount || JSON[pos].EffectNumber != effectNumber)
+            {
+                for (size_t i = JSONCount; i > pos; i--)
+                    JSON[i] = JSON[i - 1];
+                JSON[pos] = { effectNumber, jsonFactory };
+                JSONCount++;
+            }
+
+            Defaults[DefaultCount] = NumberedFactory(effectNumber, defaultFactory);
+            return Defaults[DefaultCount++];
+        }
+    };
 
-    const std::vector<NumberedFactory, psram_allocator<NumberedFactory>>& GetDefaultFactories()
+    struct Counter
     {
-        return defaultFactories;
-    }
+        NumberedFactory Unused;
+        size_t          DefaultCount = 0;
 
-    const std::map<int, JSONEffectFactory, std::less<int>, psram_allocator<std::pair<const int, JSONEffectFactory>>>& GetJSONFactories()
-    {
-        return jsonFactories;
-    }
+        constexpr NumberedFactory& AddEffect(int, DefaultEffectFactory, JSONEffectFactory)
+        {
+            DefaultCount++;
+            return Unused;
+        }
+    };
 
-    NumberedFactory& AddEffect(int effectNumber, const DefaultEffectFactory& defaultFactory, const JSONEffectFactory& jsonFactory)
+    class DefaultRange
     {
-        auto& numberedFactory = defaultFactories.emplace_back(effectNumber, defaultFactory);
-        jsonFactories.try_emplace(effectNumber, jsonFactory);
+        const NumberedFactory* first;
+        const NumberedFactory* last;
+
+      public:
+        constexpr DefaultRange(const NumberedFactory* first, const NumberedFactory* last)
+          : first(first),
+            last(last)
+        {}
+
+        const NumberedFactory* begin() const { return first; }
+        const NumberedFactory* end() const   { return last; }
+    };
+
+  private:
 
-        return numberedFactory;
+    const NumberedFactory* defaultFactories;
+    size_t defaultCount;
+    const NumberedJSONFactory* jsonFactories;
+    size_t jsonCount;
+
+  public:
+
+    template <size_t N>
+    constexpr EffectFactories(const Table<N>& table)
+      : defaultFactories(table.Defaults),
+        defaultCount(table.DefaultCount),
+        jsonFactories(table.JSON),
+        jsonCount(table.JSONCount)
+    {}
+
+    DefaultRange GetDefaultFactories() const
+    {
+        return DefaultRange(defaultFactories, defaultFactories + defaultCount);
     }
 
-    bool IsEmpty()
+    const JSONEffectFactory* FindJSONFactory(int effectNumber) const
     {
-        return defaultFactories.size() == 0 && jsonFactories.size() == 0;
+        auto last = jsonFactories + jsonCount;
+        auto entry = std::lower_bound(jsonFactories, last, effectNumber,
+            [](const NumberedJSONFactory& factory, int number) { return factory.EffectNumber < number; });
+
+        return entry != last && entry->EffectNumber == effectNumber ? &entry->Factory : nullptr;
     }
 
-    void ClearDefaultFactories()
+    bool IsEmpty() const
     {
-        defaultFactories.clear();
+        return defaultCount == 0 && jsonCount == 0;
     }
 };
+
+// The factories for the project being built, defined with the effect list in effects.cpp
+extern const EffectFactories g_EffectFactories;
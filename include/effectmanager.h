@@ -41,18 +41,51 @@
 #include <set>
 #include <algorithm>
 #include <math.h>
+#include <mutex>
+#include <atomic>
 
 #include "effectfactories.h"
+#include "transition.h"
+#include "layerstack.h"
+#include "renderzones.h"
+#include "governor.h"
+#include "playlist.h"
+
+#if ENABLE_EFFECT_SYNC
+    #include "clocksync.h"
+#endif
 
 #define JSON_FORMAT_VERSION         1
 #define CURRENT_EFFECT_CONFIG_FILE  "/current.cfg"
+#define EFFECT_STATE_FILE           "/effectstate.bin"
 
 // Forward references to functions in our accompanying CPP file
 
 void InitSplashEffectManager();
 void InitEffectsManager();
 void SaveEffectManagerConfig();
+void SaveEffectState();
 void RemoveEffectManagerConfig();
+void SavePlaylistsConfig();
+void NotifyEffectPrepareThread();
+
+// EffectOperation
+//
+// One change to the effect list, as part of a batch that's applied with ApplyEffectOperations()
+
+struct EffectOperation
+{
+    enum class OperationType : char
+    {
+        Enable  = 'e',
+        Disable = 'd',
+        Move    = 'm'
+    };
+
+    OperationType Type;
+    size_t Index;
+    size_t NewIndex = 0;                                // Only used by Move
+};
 
 // EffectManager
 //
@@ -68,12 +101,178 @@ class  EffectManager : public IJSONSerializable
     bool _bPlayAll;
     bool _bShowVU = true;
     bool _clearTempEffectWhenExpired = false;
-    bool _newFrameAvailable = false;
+    std::atomic<uint32_t> _frameSequence = 0;          // Counts the frames drawn, so the color data server can tell when there's a new one
     int _effectSetVersion = 1;
+    uint32_t _configGeneration = 0;                     // Bumped on every write of the effects file, so a state record can be matched to it
+    std::atomic<uint32_t> _effectListVersion = 0;       // Bumped whenever effects are added to or removed from the list
+    std::atomic<uint32_t> _effectChanges = 0;           // Bumped when effects are moved, turned on or off, or have their settings changed
 
     std::vector<std::shared_ptr<GFXBase>> _gfx;
     std::shared_ptr<LEDStripEffect> _tempEffect;
 
+    #if ENABLE_CROSSFADE_COMPOSITOR
+        std::shared_ptr<LEDStripEffect> _lastDrawnEffect;   // Whose frame is in leds, so it can be the outgoing effect
+        TransitionCompositor _compositor;
+    #endif
+
+    #if ENABLE_LAZY_EFFECTS
+        std::shared_ptr<LEDStripEffect> _residentEffect;    // The effect Update() last drew
+        std::shared_ptr<LEDStripEffect> _prewarmedEffect;   // The one PrewarmNextEffect() brought in ahead
+        std::vector<std::shared_ptr<LEDStripEffect>> _evictionQueue;
+
+        // ManageResidency
+        //
+        // Called from Update() on the drawing thread.  Effects we've switched away from give up their state once
+        // nothing draws them anymore, and the next effect is brought in ahead of the change so it starts cheaply.
+        // If something else comes on instead, like a remote effect or a jump, the one brought in goes too.
+
+        void ManageResidency(const std::shared_ptr<LEDStripEffect> & effect)
+        {
+            if (_residentEffect != effect)
+            {
+                if (_residentEffect)
+                    _evictionQueue.push_back(_residentEffect);
+                if (_prewarmedEffect && _prewarmedEffect != effect)
+                    _evictionQueue.push_back(_prewarmedEffect);
+                _prewarmedEffect.reset();
+                _residentEffect = effect;
+            }
+
+            #if ENABLE_CROSSFADE_COMPOSITOR
+                bool bStillDrawn = _compositor.IsActive();          // The outgoing effect draws until the blend is done
+            #else
+                bool bStillDrawn = false;
+            #endif
+
+            if (!bStillDrawn && !_evictionQueue.empty())
+            {
+                for (auto & pEffect : _evictionQueue)
+                    if (pEffect != effect)
+                        pEffect->Evict();
+                _evictionQueue.clear();
+            }
+        }
+    #endif
+
+    #if ENABLE_EFFECT_LAYERS
+        LayerStack _layers;
+    #endif
+
+    #if ENABLE_RENDER_ZONES
+        ZoneStack _zones;
+        std::vector<RenderZone> _loadedZones;               // Read from the config and set up once Init() runs; any that fail stay
+    #endif
+
+    #if ENABLE_PLAYLISTS
+        PlaylistScheduler _scheduler;
+    #endif
+
+    #if ENABLE_EFFECT_SYNC
+        uint32_t _effectSeed = 0;                           // What the RNGs were seeded with as the current effect started
+        uint64_t _effectStartMicros = 0;                    // When it started, on the synced clock
+        bool     _bSeedGiven = false;                       // The next start takes the seed and start time it was given
+        bool     _bFollowing = false;                       // Another node picks the effects, so ours don't change by themselves
+    #endif
+
+    #if ENABLE_EFFECT_PREPARE
+        std::mutex _prepareMutex;
+        std::shared_ptr<LEDStripEffect> _prepareRequest;    // Guarded by _prepareMutex; taken by the prepare task
+    #endif
+
+    #if ENABLE_EFFECT_QUALITY
+        const LEDStripEffect * _pQualityEffect = nullptr;   // The effect the draw times below are for
+        unsigned long _usQualityDraw = 0;
+        uint32_t _cQualityFrames = 0;
+
+        // GovernQuality
+        //
+        // Every EFFECT_QUALITY_FRAMES frames, compares the effect's average draw time with what its frame rate leaves
+        // for it.  Over that, its quality comes down in proportion to how far over it went, and at least a step;
+        // well under, it goes back up a step.  The gap between the two keeps it from hunting back and forth.
+
+        void GovernQuality(LEDStripEffect & effect, unsigned long usDraw)
+        {
+            constexpr int kStep = 5;
+            constexpr float kRaiseBelow = 0.6f;                 // Of the budget
+
+            if (&effect != _pQualityEffect)
+            {
+                _pQualityEffect = &effect;
+                _usQualityDraw = 0;
+                _cQualityFrames = 0;
+            }
+
+            _usQualityDraw += usDraw;
+            if (++_cQualityFrames < EFFECT_QUALITY_FRAMES)
+                return;
+
+            size_t fps = effect.DesiredFramesPerSecond();
+            #if ENABLE_GOVERNOR
+                fps = g_Governor.LimitFramesPerSecond(fps);     // A capped frame rate leaves more time for each frame
+            #endif
+
+            float usBudget  = EFFECT_PROFILE_BUDGET_RATIO * MICROS_PER_SECOND / std::max<size_t>(1, fps);
+            float usAverage = (float) _usQualityDraw / _cQualityFrames;
+            _usQualityDraw = 0;
+            _cQualityFrames = 0;
+
+            int quality = effect.Quality();
+            if (usAverage > usBudget)
+                quality = std::max<int>(EFFECT_QUALITY_MIN, std::min<int>(quality - kStep, quality * usBudget / usAverage));
+            else if (usAverage < kRaiseBelow * usBudget)
+                quality = std::min(100, quality + kStep);
+
+            if (quality != effect.Quality())
+            {
+                debugV("%s quality %d after %.1fms frames", effect.FriendlyName().c_str(), quality, usAverage / 1000);
+                effect.SetQuality(quality);
+            }
+        }
+    #endif
+
+    #if ENABLE_LAZY_EFFECTS || ENABLE_EFFECT_PREPARE
+
+        // PrewarmNextEffect
+        //
+        // Gets the next effect ready EFFECT_PREWARM_TIME ahead of the change, so starting it doesn't cost the frame it
+        // starts on.  With the prepare task that's where the work happens; otherwise we just bring its state in here.
+
+        void PrewarmNextEffect(const std::shared_ptr<LEDStripEffect> & effect)
+        {
+            #if ENABLE_LAZY_EFFECTS
+                if (!_evictionQueue.empty())                        // The next one might be on its way out
+                    return;
+            #endif
+
+            if (GetTimeRemainingForCurrentEffect() >= EFFECT_PREWARM_TIME)
+                return;
+
+            auto & next = _vEffects[NextEnabledEffectIndex()];
+            if (next == effect)
+                return;
+
+            #if ENABLE_LAZY_EFFECTS
+                if (_prewarmedEffect != next)                       // The next one changed since we brought one in
+                {
+                    if (_prewarmedEffect)
+                        _evictionQueue.push_back(_prewarmedEffect);
+                    _prewarmedEffect = next;
+                }
+            #endif
+
+            #if ENABLE_EFFECT_PREPARE
+                if (next->QueuePrepare())
+                {
+                    std::lock_guard<std::mutex> guard(_prepareMutex);
+                    _prepareRequest = next;
+                    NotifyEffectPrepareThread();
+                }
+            #else
+                next->EnsureResident(_gfx);
+            #endif
+        }
+    #endif
+
     void construct(bool clearTempEffect)
     {
         _bPlayAll = false;
@@ -102,18 +301,54 @@ class  EffectManager : public IJSONSerializable
             // Effects in the default list are core effects. These can be disabled but not deleted.
             pEffect->MarkAsCoreEffect();
             _vEffects.push_back(pEffect);
+            _effectListVersion++;
         }
     }
 
     // Implementation is in effects.cpp
     void LoadJSONAndMissingEffects(const JsonArrayConst& effectsArray);
 
+    #if ENABLE_RENDER_ZONES
+        void LoadZones(const JsonArrayConst& zonesArray);
+        bool SerializeZones(JsonArray& zonesArray) const;
+    #endif
+
     void SaveCurrentEffectIndex();
     bool ReadCurrentEffectIndex(size_t& index);
 
+    #if ENABLE_EFFECT_STATE_RECORD
+        bool ReadEffectState(size_t& index);
+    #endif
+
+    // SaveEnabledState
+    //
+    // Turning effects on and off doesn't change what they are, so with the state record that's all that needs writing
+
+    void SaveEnabledState()
+    {
+        #if ENABLE_EFFECT_STATE_RECORD
+            SaveEffectState();
+        #else
+            SaveEffectManagerConfig();
+        #endif
+    }
+
+    // Everything a move touches: the order of the effects, the current index and what the playlists point to
+    void SaveMovedEffects()
+    {
+        SaveCurrentEffectIndex();
+
+        #if ENABLE_PLAYLISTS
+            SavePlaylistsConfig();
+        #endif
+
+        SaveEffectManagerConfig();
+    }
+
     void ClearEffects()
     {
         _vEffects.clear();
+        _effectListVersion++;
     }
 
 public:
@@ -125,7 +360,7 @@ public:
     {
         debugV("EffectManager Splash Effect Constructor");
 
-        if (effect->Init(_gfx))
+        if (effect->EnsureResident(_gfx))
             _tempEffect = effect;
 
         construct(false);
@@ -153,19 +388,19 @@ public:
         ClearEffects();
     }
 
-    std::shared_ptr<GFXBase> GetBaseGraphics()
+    const std::shared_ptr<GFXBase> & GetBaseGraphics() const
     {
         return _gfx[0];
     }
 
-    bool IsNewFrameAvailable() const
+    uint32_t FrameSequence() const
     {
-        return _newFrameAvailable;
+        return _frameSequence;
     }
 
-    void SetNewFrameAvailable(bool available)
+    void NewFrameDrawn()
     {
-        _newFrameAvailable = available;
+        _frameSequence++;
     }
 
     // Implementation is in effects.cpp
@@ -236,8 +471,23 @@ public:
         // "ivl" contains the effect interval in ms
         SetInterval(jsonObject.containsKey("ivl") ? jsonObject["ivl"] : DEFAULT_EFFECT_INTERVAL, true);
 
+        if (jsonObject.containsKey("gen"))
+            _configGeneration = jsonObject["gen"];
+
+        // "zns" are the render zones, each with effects of its own
+
+        #if ENABLE_RENDER_ZONES
+            LoadZones(jsonObject["zns"].as<JsonArrayConst>());
+        #endif
+
         // Try to read the effectindex from its own file. If that fails, "cei" may contain the current effect index instead
-        if (!ReadCurrentEffectIndex(_iCurrentEffect) && jsonObject.containsKey("cei"))
+        #if ENABLE_EFFECT_STATE_RECORD
+            bool readIndex = ReadEffectState(_iCurrentEffect) || ReadCurrentEffectIndex(_iCurrentEffect);
+        #else
+            bool readIndex = ReadCurrentEffectIndex(_iCurrentEffect);
+        #endif
+
+        if (!readIndex && jsonObject.containsKey("cei"))
             _iCurrentEffect = jsonObject["cei"];
 
         // Make sure that if we read an index, it's sane
@@ -276,6 +526,7 @@ public:
         jsonObject["ivl"] = _effectInterval;
         jsonObject[PTY_PROJECT] = PROJECT_NAME;
         jsonObject[PTY_EFFECTSETVER] = _effectSetVersion;
+        jsonObject["gen"] = _configGeneration;
 
         JsonArray effectsArray = jsonObject.createNestedArray("efs");
 
@@ -286,11 +537,20 @@ public:
                 return false;
         }
 
+        #if ENABLE_RENDER_ZONES
+            if (!_zones.Zones().empty() || !_loadedZones.empty())
+            {
+                JsonArray zonesArray = jsonObject.createNestedArray("zns");
+                if (!SerializeZones(zonesArray))
+                    return false;
+            }
+        #endif
+
         return true;
     }
 
     // Must provide at least one drawing instance, like the first matrix or strip we are drawing on
-    inline std::shared_ptr<GFXBase> g(int iChannel = 0) const
+    inline const std::shared_ptr<GFXBase> & g(int iChannel = 0) const
     {
         return _gfx[iChannel];
     }
@@ -317,12 +577,50 @@ public:
         std::shared_ptr<LEDStripEffect> & effect = _tempEffect ? _tempEffect : _vEffects[_iCurrentEffect];
 
         #if USE_HUB75
-            auto pMatrix = std::static_pointer_cast<LEDMatrixGFX>(_gfx[0]);
+            auto pMatrix = static_cast<LEDMatrixGFX *>(_gfx[0].get());
             pMatrix->SetCaption(effect->FriendlyName(), CAPTION_TIME);
         #endif
 
-        effect->Start();
+        #if ENABLE_CROSSFADE_COMPOSITOR
+            if (_lastDrawnEffect && _lastDrawnEffect != effect)
+                _compositor.Begin(_lastDrawnEffect, _gfx);
+        #endif
+
+        if (!effect->EnsurePrepared(_gfx))
+            debugW("Could not bring in the state for %s", effect->FriendlyName().c_str());
+
+        // A new effect shouldn't start out held to the frame rate the last one was getting by on
+
+        #if ENABLE_GOVERNOR
+            g_Governor.Boost();
+        #endif
+
+        // Every node that starts the effect from the same seed draws the same random choices in it
+
+        #if ENABLE_EFFECT_SYNC
+            if (!_bSeedGiven)
+            {
+                _effectSeed = esp_random();
+                _effectStartMicros = SyncedMicros();
+            }
+            _bSeedGiven = false;
+            randomSeed(_effectSeed);
+            random16_set_seed(_effectSeed);
+            effect->SeedRandom(_effectSeed);
+        #else
+            effect->SeedRandom(esp_random());
+        #endif
+
+        {
+            EFFECT_MEMORY_SCOPE(effect->MemoryAccount());
+            effect->Start();
+        }
         _effectStartTime = millis();
+
+        #if ENABLE_CROSSFADE_COMPOSITOR
+            if (_compositor.IsActive())
+                _compositor.SeedIncoming(_gfx);
+        #endif
     }
 
     void EnableEffect(size_t i, bool skipSave = false)
@@ -341,9 +639,10 @@ public:
                 ClearRemoteColor(true);
 
             effect->SetEnabled(true);
+            _effectChanges++;
 
             if (!skipSave)
-                SaveEffectManagerConfig();
+                SaveEnabledState();
         }
     }
 
@@ -360,12 +659,13 @@ public:
         if (effect->IsEnabled())
         {
             effect->SetEnabled(false);
+            _effectChanges++;
 
             if (!AreEffectsEnabled())
                 ApplyGlobalColor(CRGB::Black);
 
             if (!skipSave)
-                SaveEffectManagerConfig();
+                SaveEnabledState();
         }
     }
 
@@ -379,7 +679,7 @@ public:
         return _vEffects[i]->IsEnabled();
     }
 
-    void MoveEffect(size_t from, size_t to)
+    void MoveEffect(size_t from, size_t to, bool skipSave = false)
     {
         if (from >= _vEffects.size() || to >= _vEffects.size())
         {
@@ -394,23 +694,68 @@ public:
         else // from > to
             std::rotate(_vEffects.rend() - from - 1, _vEffects.rend() - from, _vEffects.rend() - to);
 
+        _effectChanges++;
+
         if (from == _iCurrentEffect)
-        {
             _iCurrentEffect = to;
-            SaveCurrentEffectIndex();
-        }
         else if (from < _iCurrentEffect && to >= _iCurrentEffect)
-        {
             _iCurrentEffect--;
-            SaveCurrentEffectIndex();
-        }
         else if (from > _iCurrentEffect && to <= _iCurrentEffect)
-        {
             _iCurrentEffect++;
-            SaveCurrentEffectIndex();
+
+        #if ENABLE_PLAYLISTS
+            _scheduler.EffectMoved(from, to);
+        #endif
+
+        if (!skipSave)
+            SaveMovedEffects();
+    }
+
+    // ApplyEffectOperations
+    //
+    // Applies a batch of changes in one go, and saves once at the end.  Every index is checked before anything changes,
+    // so either the whole batch is applied or none of it is.  Moves don't change the number of effects, so an index
+    // that's valid up front stays valid all the way through.
+
+    bool ApplyEffectOperations(const std::vector<EffectOperation> & operations)
+    {
+        for (auto& operation : operations)
+        {
+            if (operation.Index >= _vEffects.size()
+                || (operation.Type == EffectOperation::OperationType::Move && operation.NewIndex >= _vEffects.size()))
+            {
+                debugW("Invalid index in effect operation batch");
+                return false;
+            }
         }
 
-        SaveEffectManagerConfig();
+        bool bMoved = false;
+
+        for (auto& operation : operations)
+        {
+            switch (operation.Type)
+            {
+                case EffectOperation::OperationType::Enable:
+                    EnableEffect(operation.Index, true);
+                    break;
+
+                case EffectOperation::OperationType::Disable:
+                    DisableEffect(operation.Index, true);
+                    break;
+
+                case EffectOperation::OperationType::Move:
+                    MoveEffect(operation.Index, operation.NewIndex, true);
+                    bMoved = true;
+                    break;
+            }
+        }
+
+        if (bMoved)
+            SaveMovedEffects();
+        else if (!operations.empty())
+            SaveEnabledState();
+
+        return true;
     }
 
     // Creates a copy of an existing effect in the list. Note that the effect is created but not yet added to the effect list;
@@ -421,10 +766,15 @@ public:
     //   is undefined but potentially messy.
     bool AppendEffect(std::shared_ptr<LEDStripEffect>& effect)
     {
-        if (!effect->Init(_gfx))
+        if (!effect->EnsureResident(_gfx))
             return false;
 
+        #if ENABLE_LAZY_EFFECTS
+            effect->Evict();
+        #endif
+
         _vEffects.push_back(effect);
+        _effectListVersion++;
         EnableEffect(_vEffects.size() - 1, true);
 
         SaveEffectManagerConfig();
@@ -450,6 +800,7 @@ public:
             NextEffect();
 
         _vEffects.erase(_vEffects.begin() + index);
+        _effectListVersion++;
 
         if (index <= _iCurrentEffect)
         {
@@ -457,6 +808,11 @@ public:
             SaveCurrentEffectIndex();
         }
 
+        #if ENABLE_PLAYLISTS
+            _scheduler.EffectDeleted(index);
+            SavePlaylistsConfig();
+        #endif
+
         SaveEffectManagerConfig();
 
         return true;
@@ -484,11 +840,90 @@ public:
         return _vEffects;
     }
 
+    uint32_t ConfigGeneration() const
+    {
+        return _configGeneration;
+    }
+
+    void NewConfigGeneration()
+    {
+        _configGeneration++;
+    }
+
+    // Changes whenever an effect joins or leaves the list, so anything kept per effect knows to let go of it
+    uint32_t EffectListVersion() const
+    {
+        return _effectListVersion;
+    }
+
+    // Changes whenever anything the effect list shows, other than how the effects are drawing, might have changed
+    uint32_t EffectChangeVersion() const
+    {
+        return _effectListVersion + _effectChanges;
+    }
+
+    // For changes made to an effect directly, like its settings
+    void NoteEffectChanged()
+    {
+        _effectChanges++;
+    }
+
     const size_t EffectCount() const
     {
         return _vEffects.size();
     }
 
+    // ShouldSkipEffect
+    //
+    // With EFFECT_PROFILE_SKIP_SLOW set, effects that have been measured as too slow for this hardware are stepped over
+    // by NextEffect and PreviousEffect.  Once every effect has been skipped once we stop, since they must all be slow.
+    // Effects that have outgrown their memory budget are stepped over the same way.
+
+    bool ShouldSkipEffect(size_t i, size_t & skipped) const
+    {
+        #if EFFECT_PROFILE_SKIP_SLOW
+            if (skipped < EffectCount() && _vEffects[i]->IsOverBudget())
+            {
+                skipped++;
+                return true;
+            }
+        #endif
+        #if ENABLE_EFFECT_MEMORY_ACCOUNTING
+            if (skipped < EffectCount() && _vEffects[i]->IsOverMemoryBudget())
+            {
+                skipped++;
+                return true;
+            }
+        #endif
+        return false;
+    }
+
+    #if ENABLE_EFFECT_MEMORY_ACCOUNTING
+
+        // PutAsideIfOverMemoryBudget
+        //
+        // If the current effect has gone over its memory budget, its state is let go and we move on, rather than
+        // let it run the heap down.  It's skipped from then on, until the next reboot.
+
+        void PutAsideIfOverMemoryBudget()
+        {
+            auto & effect = _vEffects[_iCurrentEffect];
+            if (_tempEffect || !effect->IsOverMemoryBudget() || EffectCount() < 2)
+                return;
+
+            debugW("%s is using %zu bytes, over its budget of %zu, so it's being put aside",
+                   effect->FriendlyName().c_str(), effect->MemoryAccount().Total(), effect->MemoryAccount().Budget);
+
+            #if ENABLE_CROSSFADE_COMPOSITOR
+                _lastDrawnEffect.reset();                   // Cut straight over, since it won't be drawing any more
+            #endif
+
+            effect->Evict();
+            NextEffect();
+        }
+
+    #endif
+
     const bool AreEffectsEnabled() const
     {
         return std::any_of(_vEffects.begin(), _vEffects.end(), [](const auto& pEffect){ return pEffect->IsEnabled(); } );
@@ -528,6 +963,57 @@ public:
         SaveCurrentEffectIndex();
     }
 
+    #if ENABLE_EFFECT_SYNC
+
+        // FollowEffect
+        //
+        // Starts the effect another node started, from the same seed, on the drawing thread.  Unlike a change made
+        // here it isn't saved, as it's up to the leader which effect comes after a reboot.  Its start time is taken
+        // back to when the leader started it, so the effect's timer runs out when the leader's does.
+
+        void FollowEffect(size_t i, uint32_t seed, uint64_t startMicros)
+        {
+            if (i >= _vEffects.size())
+            {
+                debugW("Invalid index %zu for FollowEffect", i);
+                return;
+            }
+
+            _iCurrentEffect    = i;
+            _effectSeed        = seed;
+            _effectStartMicros = startMicros;
+            _bSeedGiven        = true;
+
+            StartEffect();
+
+            int64_t usLate = SyncedMicros() - (int64_t) startMicros;
+            if (usLate > 0 && usLate < EFFECT_SYNC_TIMEOUT * 1000LL)
+                _effectStartTime -= usLate / 1000;
+        }
+
+        // While following, the effect only changes when the leader says so
+        void SetFollowing(bool bFollowing)
+        {
+            _bFollowing = bFollowing;
+        }
+
+        bool IsFollowing() const
+        {
+            return _bFollowing;
+        }
+
+        uint32_t GetEffectSeed() const
+        {
+            return _effectSeed;
+        }
+
+        uint64_t GetEffectStartMicros() const
+        {
+            return _effectStartMicros;
+        }
+
+    #endif
+
     uint GetTimeUsedByCurrentEffect() const
     {
         return millis() - _effectStartTime;
@@ -545,11 +1031,23 @@ public:
     uint GetEffectiveInterval() const
     {
         auto& currentEffect = GetCurrentEffect();
+        auto interval = GetScheduledInterval();
         // This allows you to return a MaximumEffectTime and your effect won't be shown longer than that
-        return min((IsIntervalEternal() ? std::numeric_limits<uint>::max() : _effectInterval),
+        return min((interval == 0 ? std::numeric_limits<uint>::max() : interval),
                    (currentEffect.HasMaximumEffectTime() ? currentEffect.MaximumEffectTime() : std::numeric_limits<uint>::max()));
     }
 
+    // The interval for the current effect: the playlist entry's own duration if it has one, else the global one
+    uint GetScheduledInterval() const
+    {
+        #if ENABLE_PLAYLISTS
+            if (!_tempEffect)
+                if (auto interval = _scheduler.CurrentInterval())
+                    return *interval;
+        #endif
+        return _effectInterval;
+    }
+
     uint GetInterval() const
     {
         return _effectInterval;
@@ -562,9 +1060,14 @@ public:
 
     void CheckEffectTimerExpired()
     {
+        #if ENABLE_EFFECT_SYNC
+            if (_bFollowing)
+                return;
+        #endif
+
         // If interval is zero, the current effect never expires unless it thas a max effect time set
 
-        if (IsIntervalEternal() && !GetCurrentEffect().HasMaximumEffectTime())
+        if (GetScheduledInterval() == 0 && !GetCurrentEffect().HasMaximumEffectTime())
             return;
 
         if (GetTimeUsedByCurrentEffect() >= GetEffectiveInterval()) // See if it's time for a new effect yet
@@ -591,18 +1094,41 @@ public:
     {
         g()->CyclePalette(-1);
     }
-    // Update to the next effect and abort the current effect.
+    // The effect NextEffect() would move to, without moving there
 
-    void NextEffect(bool skipSave = false)
+    size_t NextEnabledEffectIndex() const
     {
+        #if ENABLE_PLAYLISTS
+            if (auto next = _scheduler.PeekNextEffect(); next && *next < EffectCount())
+                return *next;
+        #endif
+
         auto enabled = AreEffectsEnabled();
+        size_t skipped = 0;
+        size_t i = _iCurrentEffect;
 
         do
         {
-            _iCurrentEffect++; //   ... if so advance to next effect
-            _iCurrentEffect %= EffectCount();
-            _effectStartTime = millis();
-        } while (enabled && false == _bPlayAll && false == IsEffectEnabled(_iCurrentEffect));
+            i++;
+            i %= EffectCount();
+        } while ((enabled && false == _bPlayAll && false == IsEffectEnabled(i)) || ShouldSkipEffect(i, skipped));
+
+        return i;
+    }
+
+    // Update to the next effect and abort the current effect.
+
+    void NextEffect(bool skipSave = false)
+    {
+        #if ENABLE_PLAYLISTS
+            if (auto next = _scheduler.Advance(_vEffects); next && *next < EffectCount())
+                _iCurrentEffect = *next;
+            else
+                _iCurrentEffect = NextEnabledEffectIndex();
+        #else
+            _iCurrentEffect = NextEnabledEffectIndex();
+        #endif
+        _effectStartTime = millis();
 
         StartEffect();
         SaveCurrentEffectIndex();
@@ -612,7 +1138,20 @@ public:
 
     void PreviousEffect()
     {
+        #if ENABLE_PLAYLISTS
+            if (auto previous = _scheduler.Retreat(_vEffects); previous && *previous < EffectCount())
+            {
+                _iCurrentEffect = *previous;
+                _effectStartTime = millis();
+
+                StartEffect();
+                SaveCurrentEffectIndex();
+                return;
+            }
+        #endif
+
         auto enabled = AreEffectsEnabled();
+        size_t skipped = 0;
 
         do
         {
@@ -621,7 +1160,7 @@ public:
 
             _iCurrentEffect--;
             _effectStartTime = millis();
-        } while (enabled && false == _bPlayAll && false == IsEffectEnabled(_iCurrentEffect));
+        } while ((enabled && false == _bPlayAll && false == IsEffectEnabled(_iCurrentEffect)) || ShouldSkipEffect(_iCurrentEffect, skipped));
 
         StartEffect();
         SaveCurrentEffectIndex();
@@ -629,25 +1168,203 @@ public:
 
     bool Init();
 
+    #if ENABLE_PLAYLISTS
+
+        // SetPlaylist, DeletePlaylist and ActivatePlaylist
+        //
+        // Change the playlists without touching the effects list, so only the small playlists file is rewritten.
+        // Activating one switches to its first effect right away; an empty name goes back to the effect list.
+
+        bool SetPlaylist(Playlist playlist)
+        {
+            if (!_scheduler.SetPlaylist(std::move(playlist), EffectCount()))
+                return false;
+
+            SavePlaylistsConfig();
+            return true;
+        }
+
+        bool DeletePlaylist(const String & name)
+        {
+            if (!_scheduler.DeletePlaylist(name))
+                return false;
+
+            SavePlaylistsConfig();
+            return true;
+        }
+
+        bool ActivatePlaylist(const String & name)
+        {
+            auto first = _scheduler.Activate(name, _vEffects);
+            SavePlaylistsConfig();
+
+            if (!name.isEmpty() && !first)
+                return false;
+
+            if (first && *first < EffectCount())
+                SetCurrentEffectIndex(*first);
+            return true;
+        }
+
+        // Takes the playlists from their file, once the effects are in, and picks up the one that was playing
+        void LoadPlaylists(const JsonObjectConst& jsonObject)
+        {
+            _scheduler.DeserializeFromJSON(jsonObject);
+
+            auto active = _scheduler.SavedActiveName();
+            if (active.isEmpty())
+                return;
+
+            if (auto first = _scheduler.Activate(active, _vEffects); first && *first < EffectCount())
+                _iCurrentEffect = *first;
+        }
+
+        PlaylistScheduler & Scheduler()
+        {
+            return _scheduler;
+        }
+
+    #endif
+
+    #if ENABLE_EFFECT_PREPARE
+        // Called on the prepare task when it's notified
+        void RunPendingPrepare()
+        {
+            std::shared_ptr<LEDStripEffect> effect;
+            {
+                std::lock_guard<std::mutex> guard(_prepareMutex);
+                effect = std::move(_prepareRequest);
+            }
+
+            if (effect)
+            {
+                debugV("Preparing %s ahead of time", effect->FriendlyName().c_str());
+                effect->PrepareAhead(_gfx);
+            }
+        }
+    #endif
+
+    #if ENABLE_EFFECT_LAYERS
+
+        // AddLayer
+        //
+        // Draws an effect over the current one from now on.  It's redrawn at most every updateInterval ms, and
+        // only when its HasLayerChanged() says so; the rest of the time its cached frame is blended in.
+
+        bool AddLayer(std::shared_ptr<LEDStripEffect> effect, uint8_t opacity = 255, LayerBlend blend = LayerBlend::Alpha, uint updateInterval = 0)
+        {
+            if (!effect->EnsurePrepared(_gfx))
+                return false;
+
+            effect->Start();
+            return _layers.Add(effect, _gfx, opacity, blend, updateInterval);
+        }
+
+        void ClearLayers()
+        {
+            _layers.Clear();
+        }
+
+        const std::vector<EffectLayer> & Layers() const
+        {
+            return _layers.Layers();
+        }
+
+    #endif
+
+    #if ENABLE_RENDER_ZONES
+
+        // AddZone
+        //
+        // Gives the channels in the zone's mask, or its region of them, effects of their own.  Zones go over the
+        // current effect, later ones over earlier ones, and under any layers.
+
+        bool AddZone(RenderZone zone)
+        {
+            return _zones.Add(std::move(zone), _gfx);
+        }
+
+        void ClearZones()
+        {
+            _zones.Clear();
+        }
+
+        const std::vector<RenderZone> & Zones() const
+        {
+            return _zones.Zones();
+        }
+
+    #endif
+
     // EffectManager::Update
     //
-    // Draws the current effect.  If gUIDirty has been set by an interrupt handler, it is reset here
+    // Draws the current effect, then the zones and the layers over it
 
     void Update()
     {
         if ((_gfx[0])->GetLEDCount() == 0)
             return;
 
+        DrawCurrentEffect();
+
+        #if ENABLE_RENDER_ZONES
+            _zones.Compose();
+        #endif
+
+        #if ENABLE_EFFECT_LAYERS
+            _layers.Compose(_gfx);
+        #endif
+    }
+
+    // EffectManager::DrawCurrentEffect
+    //
+    // Draws the current effect and works out the fader for where it is in its interval
+
+    void DrawCurrentEffect()
+    {
         constexpr auto msFadeTime = EFFECT_CROSS_FADE_TIME;
 
         CheckEffectTimerExpired();
 
+        #if ENABLE_EFFECT_MEMORY_ACCOUNTING
+            PutAsideIfOverMemoryBudget();
+        #endif
+
         // If a remote control effect is set, we draw that, otherwise we draw the regular effect
 
-        if (_tempEffect)
-            _tempEffect->Draw();
-        else
-            _vEffects[_iCurrentEffect]->Draw(); // Draw the currently active effect
+        auto& effect = _tempEffect ? _tempEffect : _vEffects[_iCurrentEffect];
+
+        #if ENABLE_LAZY_EFFECTS
+            ManageResidency(effect);
+        #endif
+
+        #if ENABLE_LAZY_EFFECTS || ENABLE_EFFECT_PREPARE
+            PrewarmNextEffect(effect);
+        #endif
+
+        #if ENABLE_CROSSFADE_COMPOSITOR
+
+            // The compositor blends from one effect to the next, so the brightness doesn't need to dip in between
+
+            g_Values.Fader = 255;
+            _lastDrawnEffect = effect;
+
+            if (_compositor.IsActive() && _compositor.Render(*effect, _gfx))
+                return;
+        #endif
+
+        auto usStart = micros();
+        effect->DrawFrame();                    // Draw the currently active effect
+        auto usEnd = micros();
+        effect->RecordDraw(usStart, usEnd);
+
+        #if ENABLE_EFFECT_QUALITY
+            GovernQuality(*effect, usEnd - usStart);
+        #endif
+
+        #if ENABLE_CROSSFADE_COMPOSITOR
+            return;
+        #endif
 
         // If we do indeed have multiple effects (BUGBUG what if only a single enabled?) then we
         // fade in and out at the appropriate time based on the time remaining/used by the effect
@@ -658,7 +1375,7 @@ public:
             return;
         }
 
-        if (IsIntervalEternal())
+        if (GetScheduledInterval() == 0)
         {
             g_Values.Fader = 255;
             return;
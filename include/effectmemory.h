@@ -0,0 +1,271 @@
+//+--------------------------------------------------------------------------
+//
+// File:        effectmemory.h
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+//
+// Description:
+//
+//    Keeps count of the memory each effect allocates for its state, so
+//    the ones that outgrow their budget can be found and put aside
+//
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <new>
+#include <vector>
+#include <esp_heap_caps.h>
+#include <soc/soc_memory_layout.h>
+#include "types.h"
+
+// EffectMemoryAccount
+//
+// What one effect has allocated through the effect allocators, split by where it landed.  Once the total goes over
+// the budget the account is marked, and stays marked so the EffectManager can put the effect aside.
+
+struct EffectMemoryAccount
+{
+    std::atomic<size_t> DRAM       { 0 };
+    std::atomic<size_t> PSRAM      { 0 };
+    std::atomic<bool>   Exceeded   { false };
+    size_t              Budget     = EFFECT_MEMORY_BUDGET;
+
+    size_t Total() const
+    {
+        return DRAM + PSRAM;
+    }
+
+    void Add(void * p, size_t bytes)
+    {
+        (esp_ptr_external_ram(p) ? PSRAM : DRAM) += bytes;
+        if (Budget && Total() > Budget)
+            Exceeded = true;
+    }
+
+    void Remove(void * p, size_t bytes)
+    {
+        (esp_ptr_external_ram(p) ? PSRAM : DRAM) -= bytes;
+    }
+};
+
+#if ENABLE_EFFECT_MEMORY_ACCOUNTING
+
+// The account the effect that's running on this task charges its allocations to, or nullptr outside any effect
+extern thread_local EffectMemoryAccount * g_pEffectMemoryAccount;
+
+// EffectMemoryScope
+//
+// Charges what's allocated through the effect allocators to the account for as long as the scope lasts
+
+class EffectMemoryScope
+{
+    EffectMemoryAccount * _pPrevious;
+
+public:
+
+    explicit EffectMemoryScope(EffectMemoryAccount & account) : _pPrevious(g_pEffectMemoryAccount)
+    {
+        g_pEffectMemoryAccount = &account;
+    }
+
+    ~EffectMemoryScope()
+    {
+        g_pEffectMemoryAccount = _pPrevious;
+    }
+
+    EffectMemoryScope(const EffectMemoryScope &) = delete;
+    EffectMemoryScope & operator=(const EffectMemoryScope &) = delete;
+};
+
+#define EFFECT_MEMORY_SCOPE(account) EffectMemoryScope _memoryScope(account)
+
+// Set while make_shared_effect() constructs an effect, so LEDStripEffect's constructor knows it may charge its own
+// account for what the rest of the construction allocates
+extern thread_local bool g_bConstructingEffect;
+
+// EffectConstructionScope
+//
+// Lets the effect being constructed take over the account, and puts back the one that was in use once it's built
+
+class EffectConstructionScope
+{
+    EffectMemoryAccount * _pPrevious;
+    bool                  _bPreviouslyConstructing;
+
+public:
+
+    EffectConstructionScope() : _pPrevious(g_pEffectMemoryAccount), _bPreviouslyConstructing(g_bConstructingEffect)
+    {
+        g_bConstructingEffect = true;
+    }
+
+    ~EffectConstructionScope()
+    {
+        g_pEffectMemoryAccount = _pPrevious;
+        g_bConstructingEffect  = _bPreviouslyConstructing;
+    }
+
+    EffectConstructionScope(const EffectConstructionScope &) = delete;
+    EffectConstructionScope & operator=(const EffectConstructionScope &) = delete;
+};
+
+#define EFFECT_CONSTRUCTION_SCOPE() EffectConstructionScope _constructionScope
+
+// Called from LEDStripEffect's constructors, on the account of the effect being constructed
+inline void ChargeConstructionTo(EffectMemoryAccount & account)
+{
+    if (g_bConstructingEffect)
+    {
+        g_pEffectMemoryAccount = &account;
+        g_bConstructingEffect  = false;             // Only the outermost LEDStripEffect of this construction
+    }
+}
+
+// EffectAlloc and EffectFree
+//
+// Every block starts with a header naming the account it was charged to, so it's credited back to the right effect
+// however and wherever it's freed.  The header is the size of the strictest alignment, so the block stays aligned.
+
+struct alignas(std::max_align_t) EffectBlockHeader
+{
+    EffectMemoryAccount * pAccount;
+    size_t                bytes;
+};
+
+inline void * EffectAlloc(size_t bytes, bool bPreferPSRAM)
+{
+    void * pBlock = bPreferPSRAM ? PreferPSRAMAlloc(sizeof(EffectBlockHeader) + bytes) : malloc(sizeof(EffectBlockHeader) + bytes);
+    if (!pBlock)
+        return nullptr;
+
+    auto pHeader = static_cast<EffectBlockHeader *>(pBlock);
+    pHeader->pAccount = g_pEffectMemoryAccount;
+    pHeader->bytes    = bytes;
+    if (pHeader->pAccount)
+        pHeader->pAccount->Add(pBlock, bytes);
+
+    return pHeader + 1;
+}
+
+inline void EffectFree(void * p)
+{
+    if (!p)
+        return;
+
+    auto pHeader = static_cast<EffectBlockHeader *>(p) - 1;
+    if (pHeader->pAccount)
+        pHeader->pAccount->Remove(pHeader, pHeader->bytes);
+    free(pHeader);
+}
+
+#else
+
+#define EFFECT_MEMORY_SCOPE(account)
+#define EFFECT_CONSTRUCTION_SCOPE()
+
+inline void ChargeConstructionTo(EffectMemoryAccount &) {}
+
+inline void * EffectAlloc(size_t bytes, bool bPreferPSRAM)
+{
+    return bPreferPSRAM ? PreferPSRAMAlloc(bytes) : malloc(bytes);
+}
+
+inline void EffectFree(void * p)
+{
+    free(p);
+}
+
+#endif
+
+// effect_allocator
+//
+// An allocator for the containers effects keep their state in.  It allocates like the default one does, or from
+// PSRAM first if asked, and charges the effect that's running when the allocation is made.
+
+template <typename T, bool PreferPSRAM = false>
+class effect_allocator
+{
+public:
+    typedef T value_type;
+
+    effect_allocator() = default;
+    template <class U> effect_allocator(const effect_allocator<U, PreferPSRAM>&) {}
+
+    template <class U> struct rebind { typedef effect_allocator<U, PreferPSRAM> other; };
+
+    T * allocate(size_t n)
+    {
+        void * pmem = EffectAlloc(n * sizeof(T), PreferPSRAM);
+        if (!pmem)
+            throw std::bad_alloc();
+        return static_cast<T *>(pmem);
+    }
+
+    void deallocate(T * p, size_t)
+    {
+        EffectFree(p);
+    }
+
+    template <class U> bool operator==(const effect_allocator<U, PreferPSRAM>&) const { return true; }
+    template <class U> bool operator!=(const effect_allocator<U, PreferPSRAM>&) const { return false; }
+};
+
+template <typename T>
+using effect_vector = std::vector<T, effect_allocator<T>>;
+
+template <typename T>
+using effect_deque = std::deque<T, effect_allocator<T>>;
+
+// make_unique_effect_array
+//
+// Like make_unique_psram_array, for an effect's buffers
+
+struct effect_array_deleter
+{
+    void operator()(void * p) const
+    {
+        EffectFree(p);
+    }
+};
+
+template <typename T>
+using effect_unique_array = std::unique_ptr<T[], effect_array_deleter>;
+
+template <typename T>
+effect_unique_array<T> make_unique_effect_array(size_t size)
+{
+    return effect_unique_array<T>(static_cast<T *>(EffectAlloc(size * sizeof(T), true)));
+}
+
+// make_shared_effect
+//
+// Like make_shared_psram, for an effect, so what its constructors allocate through the effect allocators is
+// charged to the effect too
+
+template <typename T, typename... Args>
+std::shared_ptr<T> make_shared_effect(Args&&... args)
+{
+    EFFECT_CONSTRUCTION_SCOPE();
+    return make_shared_psram<T>(std::forward<Args>(args)...);
+}
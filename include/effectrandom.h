@@ -0,0 +1,145 @@
+//+--------------------------------------------------------------------------
+//
+// File:        effectrandom.h
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+//
+// Description:
+//
+//    A small, fast random number generator each effect keeps for itself,
+//    so the random choices it makes can be repeated from a seed
+//
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// EffectRandom
+//
+// xoshiro128**, seeded through splitmix64.  A number is a handful of shifts, rotates and a multiply, where Arduino's
+// random() goes through newlib's locked rand() and a divide, and the state is the effect's own, so what one effect
+// draws doesn't change the sequence another one sees.  Ranges are taken with a multiply rather than a modulo, and
+// follow Arduino's random(): the upper bound is never returned.
+
+class EffectRandom
+{
+    uint32_t _state[4];
+
+    static constexpr uint32_t Rotate(uint32_t x, int k)
+    {
+        return (x << k) | (x >> (32 - k));
+    }
+
+  public:
+
+    explicit EffectRandom(uint32_t seed = 1)
+    {
+        Seed(seed);
+    }
+
+    // Seed
+    //
+    // Every generator given the same seed hands out the same numbers from then on
+
+    void Seed(uint32_t seed)
+    {
+        uint64_t x = seed;
+        for (int i = 0; i < 4; i += 2)
+        {
+            uint64_t z = (x += 0x9E3779B97F4A7C15ull);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+            z ^= z >> 31;
+            _state[i]     = (uint32_t) z;
+            _state[i + 1] = (uint32_t)(z >> 32);
+        }
+    }
+
+    uint32_t Next()
+    {
+        const uint32_t result = Rotate(_state[1] * 5, 7) * 9;
+        const uint32_t t = _state[1] << 9;
+
+        _state[2] ^= _state[0];
+        _state[3] ^= _state[1];
+        _state[1] ^= _state[2];
+        _state[0] ^= _state[3];
+        _state[2] ^= t;
+        _state[3] = Rotate(_state[3], 11);
+
+        return result;
+    }
+
+    uint8_t Next8()
+    {
+        return Next() >> 24;
+    }
+
+    uint16_t Next16()
+    {
+        return Next() >> 16;
+    }
+
+    // A number from 0 up to, but not including, upper
+    uint32_t Below(uint32_t upper)
+    {
+        return (uint32_t)(((uint64_t) Next() * upper) >> 32);
+    }
+
+    // A number from lower up to, but not including, upper, or lower if the range is empty
+    int32_t Range(int32_t lower, int32_t upper)
+    {
+        return upper > lower ? lower + (int32_t) Below((uint32_t)(upper - lower)) : lower;
+    }
+
+    // A float from 0 up to, but not including, 1
+    float Float()
+    {
+        return (Next() >> 8) * (1.0f / 16777216.0f);
+    }
+
+    float Range(float lower, float upper)
+    {
+        return lower + Float() * (upper - lower);
+    }
+
+    // Fill
+    //
+    // Random bytes for a whole buffer, four from every number, for loops that want a random value per cell or pixel
+
+    void Fill(void * buffer, size_t bytes)
+    {
+        auto out = static_cast<uint8_t *>(buffer);
+
+        for (; bytes >= sizeof(uint32_t); bytes -= sizeof(uint32_t), out += sizeof(uint32_t))
+        {
+            uint32_t value = Next();
+            memcpy(out, &value, sizeof(value));
+        }
+
+        if (bytes)
+        {
+            uint32_t value = Next();
+            memcpy(out, &value, bytes);
+        }
+    }
+};
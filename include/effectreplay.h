@@ -0,0 +1,82 @@
+//+--------------------------------------------------------------------------
+//
+// File:        effectreplay.h
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+//
+// Description:
+//
+//    Renders effects off-screen with a seeded RNG, a fixed timestep and
+//    replayed audio, and reports a CRC and cycle count for every frame,
+//    so regressions in how effects look or how fast they draw show up
+//
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#include <optional>
+#include <vector>
+#include "globals.h"
+
+#if ENABLE_EFFECT_REPLAY
+
+struct ReplayFrame
+{
+    uint32_t CRC    = 0;                        // Over every channel's pixels
+    uint32_t Cycles = 0;                        // CPU cycles the Step()s and Draw() took
+};
+
+// ReplayResult
+//
+// How one effect did.  An effect is deterministic if a second run from the same seed gave the very same frames;
+// the ones that aren't read millis() or the hardware RNG themselves and can only be compared on speed.
+
+struct ReplayResult
+{
+    size_t   EffectIndex   = 0;
+    String   Name;
+    uint32_t SequenceCRC   = 0;                 // The frame CRCs run together, so one number covers the whole run
+    uint32_t MinCycles     = 0;
+    uint32_t MaxCycles     = 0;
+    uint64_t TotalCycles   = 0;
+    bool     Deterministic = false;
+    std::vector<ReplayFrame> Frames;            // Only kept when a single effect is replayed
+};
+
+struct ReplayReport
+{
+    bool     Pending       = false;             // Still running, so Results is partial
+    uint     Frames        = 0;
+    uint32_t Seed          = 0;
+    bool     RecordedAudio = false;             // Audio came from a recording rather than the built in track
+    std::vector<ReplayResult> Results;
+};
+
+// Queue a replay of one effect, or every effect if no index is given.  Returns false if one is already running.
+bool QueueEffectReplay(std::optional<size_t> effectIndex, uint frames, uint32_t seed);
+
+// Record the live audio for the next frames drawn, to be played back to the effects in place of the built in track
+bool QueueReplayAudioRecording(uint frames);
+
+// Called by the draw loop every frame.  Replays at most one effect per call, so the display keeps going in between.
+void RunPendingEffectReplay();
+
+ReplayReport GetEffectReplayReport();
+
+#endif
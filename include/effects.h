@@ -32,7 +32,7 @@
 
 // Each effect class needs to have exactly one associated effect number defined in
 // the below list. The effect numbers and their respective classes are linked in the
-// effect factory definitions that are created in the LoadEffectFactories()
+// effect factory definitions that are built by the BuildEffectFactories()
 // function in effects.cpp. The link is used when the effect list is deserialized
 // from the effects list JSON file on file storage, to determine which effect
 // class to construct for a particular effect JSON object - which has the effect
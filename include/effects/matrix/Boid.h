@@ -179,11 +179,47 @@ class Boid
       }
     }
 
+    // What a pass over the other boids adds up for the three rules, so they can all be had from a single pass
+    struct Neighborhood {
+      PVector separation;     // Sum of the unit vectors away from the boids that are too close, each over its distance
+      int separationCount = 0;
+      PVector velocity;       // Sum of the velocities of the neighbors
+      PVector location;       // Sum of the locations of the neighbors
+      int count = 0;
+
+      // Adds another boid that's distanceSq away, if it's close enough to count
+      void add(const Boid & self, const Boid & other, float distanceSq) {
+        if (distanceSq <= 0)
+          return;
+        if (distanceSq < self.desiredseparation * self.desiredseparation) {
+          float d = sqrtf(distanceSq);
+          separation += (self.location - other.location) / (d * d);
+          separationCount++;
+        }
+        if (distanceSq < self.neighbordist * self.neighbordist) {
+          velocity += other.velocity;
+          location += other.location;
+          count++;
+        }
+      }
+    };
+
     // We accumulate a new acceleration each time based on three rules
     void flock(Boid boids [], uint8_t boidCount) {
-      PVector sep = separate(boids, boidCount);   // Separation
-      PVector ali = align(boids, boidCount);      // Alignment
-      PVector coh = cohesion(boids, boidCount);   // Cohesion
+      Neighborhood neighborhood;
+      for (int i = 0; i < boidCount; i++) {
+        const Boid & other = boids[i];
+        if (other.enabled)
+          neighborhood.add(*this, other, (location - other.location).magSq());
+      }
+      flock(neighborhood);
+    }
+
+    // Applies the three rules to what was added up for the neighbors
+    void flock(const Neighborhood & neighborhood) {
+      PVector sep = separate(neighborhood);   // Separation
+      PVector ali = align(neighborhood);      // Alignment
+      PVector coh = cohesion(neighborhood);   // Cohesion
       // Arbitrarily weight these forces
       sep *= 1.5;
       ali *= 1.0;
@@ -196,32 +232,15 @@ class Boid
 
     // Separation
     // Method checks for nearby boids and steers away
-    PVector separate(Boid boids [], uint8_t boidCount) {
-      PVector steer = PVector(0, 0);
-      int count = 0;
-      // For every boid in the system, check if it's too close
-      for (int i = 0; i < boidCount; i++) {
-        Boid other = boids[i];
-        if (!other.enabled)
-          continue;
-        float d = location.dist(other.location);
-        // If the distance is greater than 0 and less than an arbitrary amount (0 when you are yourself)
-        if ((d > 0) && (d < desiredseparation)) {
-          // Calculate vector pointing away from neighbor
-          PVector diff = location - other.location;
-          diff.normalize();
-          diff /= d;        // Weight by distance
-          steer += diff;
-          count++;            // Keep track of how many
-        }
-      }
+    PVector separate(const Neighborhood & neighborhood) {
+      PVector steer = neighborhood.separation;
       // Average -- divide by how many
-      if (count > 0) {
-        steer /= (float) count;
+      if (neighborhood.separationCount > 0) {
+        steer /= (float) neighborhood.separationCount;
       }
 
       // As long as the vector is greater than 0
-      if (steer.mag() > 0) {
+      if (steer.magSq() > 0) {
         // Implement Reynolds: Steering = Desired - Velocity
         steer.normalize();
         steer *= maxspeed;
@@ -233,21 +252,10 @@ class Boid
 
     // Alignment
     // For every nearby boid in the system, calculate the average velocity
-    PVector align(Boid boids [], uint8_t boidCount) {
-      PVector sum = PVector(0, 0);
-      int count = 0;
-      for (int i = 0; i < boidCount; i++) {
-        Boid other = boids[i];
-        if (!other.enabled)
-          continue;
-        float d = location.dist(other.location);
-        if ((d > 0) && (d < neighbordist)) {
-          sum += other.velocity;
-          count++;
-        }
-      }
-      if (count > 0) {
-        sum /= (float) count;
+    PVector align(const Neighborhood & neighborhood) {
+      PVector sum = neighborhood.velocity;
+      if (neighborhood.count > 0) {
+        sum /= (float) neighborhood.count;
         sum.normalize();
         sum *= maxspeed;
         PVector steer = sum - velocity;
@@ -261,21 +269,10 @@ class Boid
 
     // Cohesion
     // For the average location (i.e. center) of all nearby boids, calculate steering vector towards that location
-    PVector cohesion(Boid boids [], uint8_t boidCount) {
-      PVector sum = PVector(0, 0);   // Start with empty vector to accumulate all locations
-      int count = 0;
-      for (int i = 0; i < boidCount; i++) {
-        Boid other = boids[i];
-        if (!other.enabled)
-          continue;
-        float d = location.dist(other.location);
-        if ((d > 0) && (d < neighbordist)) {
-          sum += other.location; // Add location
-          count++;
-        }
-      }
-      if (count > 0) {
-        sum /= count;
+    PVector cohesion(const Neighborhood & neighborhood) {
+      PVector sum = neighborhood.location;
+      if (neighborhood.count > 0) {
+        sum /= neighborhood.count;
         return seek(sum);  // Steer towards the location
       }
       else {
@@ -29,6 +29,8 @@
 #ifndef Geometry_H
 #define Geometry_H
 
+#include "gfxbase.h"
+
 // Description: This file contains the definitions of various geometry-related structures.
 //              It includes structures for representing vertices in 3D space, points on a plane,
 //              edges with visibility, and structures to represent square and triangular faces.
@@ -152,4 +154,163 @@ struct triFace
   }
 };
 
+// Fixed point 3D
+//
+// Coordinates and matrix terms are 16.16 fixed point, and angles run 0-65535 around the circle so they wrap on their
+// own.  Sines and cosines come from FastLED's sin16/cos16 tables rather than the float library.
+
+typedef int32_t q16_t;
+
+static constexpr int   kQ16Shift = 16;
+static constexpr q16_t kQ16One   = 1 << kQ16Shift;
+
+inline q16_t ToQ16(float value)
+{
+    return (q16_t) (value * kQ16One);
+}
+
+inline q16_t MulQ16(q16_t a, q16_t b)
+{
+    return (q16_t) (((int64_t) a * b) >> kQ16Shift);
+}
+
+inline q16_t SinQ16(uint16_t angle)
+{
+    return (q16_t) sin16(angle) * 2;                // sin16 is +/-32767, one bit short of 16.16
+}
+
+inline q16_t CosQ16(uint16_t angle)
+{
+    return (q16_t) cos16(angle) * 2;
+}
+
+struct VertexQ16
+{
+    q16_t x, y, z;
+
+    void set(int x, int y, int z)
+    {
+        this->x = x * kQ16One;
+        this->y = y * kQ16One;
+        this->z = z * kQ16One;
+    }
+};
+
+struct ScreenPoint
+{
+    int16_t x, y;
+};
+
+struct MatrixQ16
+{
+    q16_t m[3][3];
+
+    // The rotation about x and then y that the Aurora wireframes have always used
+
+    static MatrixQ16 RotationXY(uint16_t angx, uint16_t angy)
+    {
+        q16_t cx = CosQ16(angx), sx = SinQ16(angx);
+        q16_t cy = CosQ16(angy), sy = SinQ16(angy);
+
+        return MatrixQ16 { {
+            { cy,              0,   -sy              },
+            { MulQ16(sx, sy),  cx,  MulQ16(sx, cy)   },
+            { MulQ16(cx, sy),  -sx, MulQ16(cx, cy)   }
+        } };
+    }
+
+    // Transform
+    //
+    // Rotates a batch of vertices, then moves them by the offset
+
+    void Transform(const VertexQ16 * in, VertexQ16 * out, size_t count, const VertexQ16 & offset = {0, 0, 0}) const
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            const VertexQ16 & v = in[i];
+            out[i].x = (q16_t) (((int64_t) m[0][0] * v.x + (int64_t) m[0][1] * v.y + (int64_t) m[0][2] * v.z) >> kQ16Shift) + offset.x;
+            out[i].y = (q16_t) (((int64_t) m[1][0] * v.x + (int64_t) m[1][1] * v.y + (int64_t) m[1][2] * v.z) >> kQ16Shift) + offset.y;
+            out[i].z = (q16_t) (((int64_t) m[2][0] * v.x + (int64_t) m[2][1] * v.y + (int64_t) m[2][2] * v.z) >> kQ16Shift) + offset.z;
+        }
+    }
+};
+
+// ProjectQ16
+//
+// Perspective projection of a batch of camera space vertices onto the screen, centered on ox, oy, with y up.  The
+// vertices have to be in front of the camera (z > 0).
+
+inline void ProjectQ16(const VertexQ16 * in, ScreenPoint * out, size_t count, q16_t focal, q16_t ox, q16_t oy)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        q16_t scale = (q16_t) (((int64_t) focal << kQ16Shift) / in[i].z);
+        out[i].x = (ox + MulQ16(scale, in[i].x)) >> kQ16Shift;          // The shifts floor, like the float version did
+        out[i].y = (oy - MulQ16(scale, in[i].y)) >> kQ16Shift;
+    }
+}
+
+// DrawClippedLine
+//
+// Draws the same line as GFXBase::BresenhamLine.  Lines entirely on the screen, which for a wireframe is most of
+// them, are written straight into the frame buffer with no per-pixel bounds checks; lines entirely off one side
+// of it are dropped, and only the few that cross an edge go pixel by pixel through the checked version.
+
+inline void DrawClippedLine(GFXBase & g, int x0, int y0, int x1, int y1, CRGB color)
+{
+    const int right  = g.width() - 1;
+    const int bottom = g.height() - 1;
+
+    // Cohen-Sutherland outcodes: a bit for each side of the screen the point is beyond
+
+    auto outcode = [&](int x, int y)
+    {
+        return (x < 0 ? 1 : 0) | (x > right ? 2 : 0) | (y < 0 ? 4 : 0) | (y > bottom ? 8 : 0);
+    };
+
+    int code0 = outcode(x0, y0);
+    int code1 = outcode(x1, y1);
+
+    if (code0 & code1)
+        return;
+
+    if (code0 | code1)
+    {
+        g.BresenhamLine(x0, y0, x1, y1, color);
+        return;
+    }
+
+    g.MarkDirty(x0, y0);
+    g.MarkDirty(x1, y1);
+
+    int dx = abs(x1 - x0), sx = x0 < x1 ? 1 : -1;
+    int dy = -abs(y1 - y0), sy = y0 < y1 ? 1 : -1;
+    int err = dx + dy;
+
+    for (;;)
+    {
+        g.leds[g.fastXY(x0, y0)] = color;
+
+        if (x0 == x1 && y0 == y1)
+            break;
+
+        int e2 = 2 * err;
+        if (e2 >= dy)
+        {
+            err += dy;
+            x0 += sx;
+        }
+        if (x0 == x1 && y0 == y1)
+            break;
+
+        if (e2 <= dx)
+        {
+            err += dx;
+            y0 += sy;
+        }
+        if (x0 == x1 && y0 == y1)
+            break;
+    }
+}
+
 #endif
@@ -29,7 +29,8 @@
 //   that to extract frames from the GIF and then plot them on the
 //   LED matrix.  We do that by supplying callbacks to the GIF decoder
 //   that it calls to fetch the GIF data and to plot the pixels on the
-//   LED matrix.
+//   LED matrix.  With GIF_FRAME_CACHE the frames are kept as they're
+//   decoded the first time through, and later loops just blit them.
 //
 // History:     Nov-21-2023         Davepl      Created
 //
@@ -46,6 +47,7 @@
 #include <ArduinoJson.h>
 #include "systemcontainer.h"
 #include <map>
+#include <optional>
 #include "effects.h"
 #include "types.h"
 #include <GifDecoder.h>
@@ -144,6 +146,20 @@ private:
     CRGB _bkColor            = BLACK16;
     bool _preClear           = false;
     bool _gifReadyToDraw     = false;
+    std::optional<GIFInfo> _gif;                                // What _gifIndex was found to be
+
+    #if GIF_FRAME_CACHE
+        // The frames as they came out of the decoder on the first loop, as indexes into a palette of the colors
+        // they use.  It's only kept when it fits in GIF_FRAME_CACHE_BYTES and the frames use no more than 256 colors
+        // between them.
+
+        effect_unique_array<uint8_t> _frameCache;
+        effect_unique_array<CRGB>    _cachePalette;
+        size_t   _cacheFrames      = 0;                         // Frames in one loop of the GIF
+        size_t   _cachedFrames     = 0;                         // How many of them are in the cache so far
+        uint16_t _cachePaletteSize = 0;
+        size_t   _frame            = 0;                         // The frame the next step shows
+    #endif
 
     // GIF decoder callbacks.  These are static because the decoder doesn't allow you to pass any context, so they
     // have to be global.  We use the global g_gifDecoderState to track state.  The GifDecoder code calls back to
@@ -185,23 +201,201 @@ private:
 
     static void drawLineCallback(int16_t x, int16_t y, uint8_t *buf, int16_t w, uint16_t *palette, int16_t skip)
     {
-        // I don't think this is ever called, but if it is, we may need to implement it.  For now, it seems they just
-        // call drawPixelCallback for each pixel in the image.
+        // The line comes as palette indexes into an RGB565 palette, and pixels with the skip index are transparent
+
+        auto& g = *(g_ptrSystem->EffectManager().g(0));
+        x += g_gifDecoderState._offsetX;
+        y += g_gifDecoderState._offsetY;
+
+        if (y < 0 || y >= MATRIX_HEIGHT)
+            return;
 
-        throw new std::runtime_error("drawLineCallback not implemented for animated GIFs");
+        for (int16_t i = std::max<int16_t>(0, -x); i < w && x + i < MATRIX_WIDTH; i++)
+        {
+            if (buf[i] == skip)
+                continue;
+
+            uint16_t color = palette[buf[i]];
+            uint8_t  red   = (color >> 11) & 0x1F;
+            uint8_t  green = (color >> 5) & 0x3F;
+            uint8_t  blue  = color & 0x1F;
+            g.leds[XY(x + i, y)] = CRGB((red << 3) | (red >> 2), (green << 2) | (green >> 4), (blue << 3) | (blue >> 2));
+        }
     }
 
-    // For slower animations that run at a lower framerate, we double the framerate by discarding every other frame,
-    // which allows us to draw the VU meter and so on at a useable rate even though the animation doesn't paint every time.
+    #if GIF_FRAME_CACHE
+
+        // CountFrames
+        //
+        // Walks the blocks of a GIF to count the images in it, so we know how big the cache has to be
+
+        static size_t CountFrames(const uint8_t * data, size_t length)
+        {
+            size_t pos = 13;
+
+            // Steps over a run of data sub-blocks, returning false if it runs off the end
+
+            auto skipSubBlocks = [&]()
+            {
+                while (pos < length)
+                {
+                    uint8_t size = data[pos++];
+                    if (size == 0)
+                        return true;
+                    pos += size;
+                }
+                return false;
+            };
+
+            auto skipColorTable = [&](uint8_t flags)
+            {
+                if (flags & 0x80)
+                    pos += 3 << ((flags & 0x07) + 1);
+            };
+
+            if (length < pos || memcmp(data, "GIF", 3) != 0)
+                return 0;
+
+            skipColorTable(data[10]);
+
+            size_t frames = 0;
+            while (pos < length)
+            {
+                switch (data[pos++])
+                {
+                    case 0x21:                                          // Extension: a label and its sub-blocks
+                        pos++;
+                        if (!skipSubBlocks())
+                            return frames;
+                        break;
+
+                    case 0x2C:                                          // Image: descriptor, color table, LZW size and data
+                        if (pos + 9 > length)
+                            return frames;
+                        pos += 9;
+                        skipColorTable(data[pos - 1]);
+                        pos++;
+                        if (!skipSubBlocks())
+                            return frames;
+                        frames++;
+                        break;
+
+                    default:                                            // The trailer, or something we don't understand
+                        return frames;
+                }
+            }
+            return frames;
+        }
+
+        bool IsCached() const
+        {
+            return _frameCache && _cachedFrames == _cacheFrames;
+        }
+
+        // CacheFrame
+        //
+        // Keeps the frame the decoder just drew.  If it brings in one color too many the cache is dropped, and the
+        // GIF goes on being decoded every loop.
+
+        void CacheFrame(const GIFInfo & gif)
+        {
+            if (!_frameCache || _cachedFrames >= _cacheFrames)
+                return;
+
+            uint8_t * pFrame = _frameCache.get() + _cachedFrames * gif._width * gif._height;
+            uint8_t lastIndex = 0;
+
+            for (uint16_t y = 0; y < gif._height; y++)
+            {
+                for (uint16_t x = 0; x < gif._width; x++)
+                {
+                    CRGB color = g()->leds[XY(x + g_gifDecoderState._offsetX, y + g_gifDecoderState._offsetY)];
+
+                    // Runs of the same color are common, so try the last one before searching the palette
+
+                    if (_cachePaletteSize == 0 || _cachePalette[lastIndex] != color)
+                    {
+                        uint16_t i = 0;
+                        while (i < _cachePaletteSize && _cachePalette[i] != color)
+                            i++;
+
+                        if (i == _cachePaletteSize)
+                        {
+                            if (_cachePaletteSize == 256)
+                            {
+                                debugW("GIF uses more than 256 colors, so it won't be cached");
+                                _frameCache.reset();
+                                _cachePalette.reset();
+                                return;
+                            }
+                            _cachePalette[_cachePaletteSize++] = color;
+                        }
+                        lastIndex = i;
+                    }
+                    *pFrame++ = lastIndex;
+                }
+            }
+
+            _cachedFrames++;
+        }
+
+        void DrawCachedFrame(const GIFInfo & gif, size_t frame)
+        {
+            const uint8_t * pFrame = _frameCache.get() + frame * gif._width * gif._height;
+
+            for (uint16_t y = 0; y < gif._height; y++)
+                for (uint16_t x = 0; x < gif._width; x++)
+                    g()->leds[XY(x + g_gifDecoderState._offsetX, y + g_gifDecoderState._offsetY)] = _cachePalette[*pFrame++];
+        }
+
+    #endif
 
-    static bool FrameDoubling()
+    // FindGIF
+    //
+    // Looks the GIF up among the built-in ones and then, with the asset store, among the uploaded GIFs by their asset
+    // id.  An uploaded GIF is decoded straight out of the asset partition, like the built-in ones are out of the
+    // firmware, and stays there until a restart even if it's replaced.
+
+    void FindGIF()
     {
-        return g_gifDecoderState._fps <= 15;
+        _gif.reset();
+
+        auto builtIn = AnimatedGIFs.find(_gifIndex);
+        if (builtIn != AnimatedGIFs.end())
+        {
+            _gif.emplace(builtIn->second);
+            return;
+        }
+
+        #if ENABLE_ASSET_STORE
+            auto id = to_value(_gifIndex);
+            if (!g_ptrSystem->HasAssetStore() || id < 0 || id > UINT16_MAX)
+                return;
+
+            auto& assets = g_ptrSystem->AssetStore();
+            auto entry = assets.Find(id, AssetType::GIF);
+            if (!entry)
+                return;
+
+            // The store checked the GIF fits the matrix when it was uploaded
+
+            const uint8_t * pData = assets.Data(*entry);
+            _gif.emplace(pData, pData + entry->Length, pData[6] | pData[7] << 8, pData[8] | pData[9] << 8,
+                         entry->Param ? std::min<uint32_t>(entry->Param, 255) : 24);
+        #endif
+    }
+
+    // The animation advances a GIF frame per step at its own rate, while we draw at least 30 times a second so the
+    // VU meter and so on stay responsive over slower animations.
+
+    float StepsPerSecond() const override
+    {
+        return g_gifDecoderState._fps;
     }
 
     size_t DesiredFramesPerSecond() const override
     {
-        return FrameDoubling() ? g_gifDecoderState._fps * 2 : g_gifDecoderState._fps;
+        return std::max<size_t>(g_gifDecoderState._fps, 30);
     }
 
 public:
@@ -237,27 +431,89 @@ public:
         return jsonObject.set(jsonDoc.as<JsonObjectConst>());
     }
 
+    #if GIF_FRAME_CACHE
+
+        bool AcquireState() override
+        {
+            FindGIF();
+            if (!_gif)
+                return true;                                    // Start() will say so; there's just nothing to cache
+
+            size_t frames = CountFrames(_gif->contents, _gif->length);
+            size_t bytes  = frames * _gif->_width * _gif->_height;
+
+            if (frames > 0 && bytes <= GIF_FRAME_CACHE_BYTES)
+            {
+                _frameCache   = make_unique_effect_array<uint8_t>(bytes);
+                _cachePalette = make_unique_effect_array<CRGB>(256);
+                if (!_frameCache || !_cachePalette)
+                {
+                    _frameCache.reset();
+                    _cachePalette.reset();
+                }
+            }
+
+            _cacheFrames      = frames;
+            _cachedFrames     = 0;
+            _cachePaletteSize = 0;
+            return true;                                        // Without the cache we decode every loop, as before
+        }
+
+        void ReleaseState() override
+        {
+            _frameCache.reset();
+            _cachePalette.reset();
+            _cachedFrames     = 0;
+            _cachePaletteSize = 0;
+        }
+
+    #endif
+
     void Start() override
     {
         g()->Clear(_bkColor);
 
-        // Open the GIF and start decoding
+        // Open the GIF and start decoding.  With the frame cache, AcquireState() has already looked it up and sized the
+        // cache to match.
 
-        auto gif = AnimatedGIFs.find(_gifIndex);
-        if (gif == AnimatedGIFs.end())
-            throw std::runtime_error(str_sprintf("Unable to locate GIF by index %d in the map.", (int) _gifIndex).c_str());
+        #if !GIF_FRAME_CACHE
+            FindGIF();
+        #endif
+
+        if (!_gif)
+        {
+            // Step() draws nothing until the GIF is ready, so the effect just shows the background
+            COUNT_ERROR(ErrorCounter::MissingGIF, "Unable to locate GIF by index %d among the built-in or uploaded GIFs.", (int) _gifIndex);
+            _gifReadyToDraw = false;
+            return;
+        }
 
         // Set up the gifDecoderState with all of the context that it will need to decode and
         // draw the GIF, since the static callbacks will have no other context to work with.
 
-        assert(gif->second._width <= MATRIX_WIDTH);
-        assert(gif->second._height <= MATRIX_HEIGHT);
+        assert(_gif->_width <= MATRIX_WIDTH);
+        assert(_gif->_height <= MATRIX_HEIGHT);
 
-        g_gifDecoderState._offsetX   = (MATRIX_WIDTH  - gif->second._width) / 2;
-        g_gifDecoderState._offsetY   = (MATRIX_HEIGHT - gif->second._height) / 2;
-        g_gifDecoderState._fps       = gif->second._fps;
+        g_gifDecoderState._offsetX   = (MATRIX_WIDTH  - _gif->_width) / 2;
+        g_gifDecoderState._offsetY   = (MATRIX_HEIGHT - _gif->_height) / 2;
+        g_gifDecoderState._fps       = _gif->_fps;
         g_gifDecoderState._bkColor   = _bkColor;
 
+        #if GIF_FRAME_CACHE
+            _frame = 0;
+
+            // Once every frame is in the cache the decoder has nothing left to do for us
+
+            if (IsCached())
+            {
+                _gifReadyToDraw = true;
+                return;
+            }
+
+            _cachedFrames     = 0;
+            _cachePaletteSize = 0;
+        #endif
+
         // Set the GIF decoder callbacks to our static functions
 
         g_ptrGIFDecoder->setScreenClearCallback( screenClearCallback );
@@ -265,24 +521,13 @@ public:
         g_ptrGIFDecoder->setDrawPixelCallback( drawPixelCallback );
         g_ptrGIFDecoder->setDrawLineCallback( drawLineCallback );
 
-        _gifReadyToDraw = (ERROR_NONE == g_ptrGIFDecoder->startDecoding((uint8_t *) gif->second.contents, gif->second.length));
+        _gifReadyToDraw = (ERROR_NONE == g_ptrGIFDecoder->startDecoding((uint8_t *) _gif->contents, _gif->length));
         if (!_gifReadyToDraw)
             debugW("Failed to start decoding GIF");
     }
 
-    void Draw() override
+    void Step(float dt) override
     {
-        // If we're running a low FPS animation, we discard alternate frames and draw every other one, which allows
-        // the VU meter to paint on every frame and remain responsive.
-
-        static bool discardFrame = false;
-        if (FrameDoubling())
-        {
-            discardFrame = !discardFrame;
-            if (discardFrame)
-                return;
-        }
-
         // GIFs that use transparency will leave the previous frame in place, so we need
         // to clear the screen before we draw the next frame.  We can skip this if the
         // GIF doesn't use transparency.
@@ -290,9 +535,31 @@ public:
         if (_preClear)
             g()->Clear(_bkColor);
 
-        if (_gifReadyToDraw)
-            g_ptrGIFDecoder->decodeFrame(false);
+        if (!_gifReadyToDraw)
+            return;
+
+        #if GIF_FRAME_CACHE
+            const GIFInfo & gif = *_gif;
+
+            if (IsCached())
+            {
+                DrawCachedFrame(gif, _frame);
+                _frame = (_frame + 1) % _cacheFrames;
+                return;
+            }
+        #endif
+
+        g_ptrGIFDecoder->decodeFrame(false);
 
+        #if GIF_FRAME_CACHE
+            CacheFrame(gif);
+            _frame = _cacheFrames ? (_frame + 1) % _cacheFrames : 0;
+        #endif
+    }
+
+    void Draw() override
+    {
+        // The decoder paints straight into leds as each step decodes a frame, so the last one is still there
     }
 };
 
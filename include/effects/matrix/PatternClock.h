@@ -45,6 +45,14 @@ class PatternClock : public LEDStripEffect
     // on rectangular display
 
     float    radius;
+    int      lastTick = -1;                 // Sixtieth of a minute we last drew
+
+    static int CurrentTick()
+    {
+        timeval tv;
+        gettimeofday(&tv, nullptr);
+        return (tv.tv_sec % 60) * 60 + tv.tv_usec * 60 / 1000000;
+    }
 
   public:
 
@@ -66,6 +74,13 @@ class PatternClock : public LEDStripEffect
         return 60;
     }
 
+    // Nothing moves faster than the sixtieths pixel, so as a layer we only need to draw when that has moved on
+
+    bool HasLayerChanged() const override
+    {
+        return CurrentTick() != lastTick;
+    }
+
     void Draw() override
     {
         // Get the hours, minutes, and seconds of hte current time
@@ -81,6 +96,7 @@ class PatternClock : public LEDStripEffect
         timeval tv;
         gettimeofday(&tv, nullptr);
         auto sixtieths = tv.tv_usec * 60 / 1000000;
+        lastTick = (tv.tv_sec % 60) * 60 + sixtieths;
 
         // Draw the clock face, outer ring and inner dot where the hands mount
 
@@ -80,26 +80,28 @@
 class PatternCube : public LEDStripEffect
 {
   private:
-    float focal = 30; // Focal of the camera
+    // Angles are in 65536ths of a turn, and the rest is 16.16 fixed point
+
+    static constexpr uint16_t kRadian = 10430; // 65536 / TWO_PI
+
+    q16_t focal = ToQ16(30); // Focal of the camera
     int cubeWidth = 28; // Cube size
-    float Angx = 20.0, AngxSpeed = 0.05; // rotation (angle+speed) around X-axis
-    float Angy = 10.0, AngySpeed = 0.05; // rotation (angle+speed) around Y-axis
-    float Ox = 15.5, Oy = 15.5; // position (x,y) of the frame center
+    uint16_t Angx = (uint16_t) (int32_t) (20.0f * kRadian), AngxSpeed; // rotation (angle+speed) around X-axis
+    uint16_t Angy = (uint16_t) (int32_t) (10.0f * kRadian), AngySpeed; // rotation (angle+speed) around Y-axis
+    q16_t Ox = ToQ16(15.5), Oy = ToQ16(15.5); // position (x,y) of the frame center
     int zCamera = 110; // distance from cube to the eye of the camera
 
     // Local vertices
-    Vertex  local[8];
+    VertexQ16 local[8];
     // Camera aligned vertices
-    Vertex  aligned[8];
+    VertexQ16 aligned[8];
     // On-screen projected vertices
-    Point   screen[8];
+    ScreenPoint screen[8];
     // Faces
     squareFace face[6];
     // Edges
     EdgePoint edge[12];
     int nbEdges;
-    // ModelView matrix
-    float m00, m01, m02, m10, m11, m12, m20, m21, m22;
 
     // constructs the cube
     void make(int w)
@@ -144,33 +146,12 @@ class PatternCube : public LEDStripEffect
     }
 
     // rotates according to angle x&y
-    void rotate(float angx, float angy)
+    void rotate(uint16_t angx, uint16_t angy)
     {
       int i;
-      float cx = cos(angx);
-      float sx = sin(angx);
-      float cy = cos(angy);
-      float sy = sin(angy);
-
-      m00 = cy;
-      m01 = 0;
-      m02 = -sy;
-      m10 = sx * sy;
-      m11 = cx;
-      m12 = sx * cy;
-      m20 = cx * sy;
-      m21 = -sx;
-      m22 = cx * cy;
-
-      for (i = 0; i < 8; i++)
-      {
-        aligned[i].x = m00 * local[i].x + m01 * local[i].y + m02 * local[i].z;
-        aligned[i].y = m10 * local[i].x + m11 * local[i].y + m12 * local[i].z;
-        aligned[i].z = m20 * local[i].x + m21 * local[i].y + m22 * local[i].z + zCamera;
 
-        screen[i].x = floor((Ox + focal * aligned[i].x / aligned[i].z));
-        screen[i].y = floor((Oy - focal * aligned[i].y / aligned[i].z));
-      }
+      MatrixQ16::RotationXY(angx, angy).Transform(local, aligned, 8, VertexQ16 { 0, 0, zCamera * kQ16One });
+      ProjectQ16(aligned, screen, 8, focal, Ox, Oy);
 
       for (i = 0; i < 12; i++)
         edge[i].visible = false;
@@ -228,16 +209,12 @@ class PatternCube : public LEDStripEffect
     {
       g()->Clear();
       zCamera = beatsin8(2, 100, 140);
-      AngxSpeed = beatsin8(3, 3, 10) / 100.0f;
-      AngySpeed = g()->beatcos8(5, 3, 10) / 100.0f;
+      AngxSpeed = beatsin8(3, 3, 10) * kRadian / 100;
+      AngySpeed = g()->beatcos8(5, 3, 10) * kRadian / 100;
 
-      // Update values
+      // Update values; the angles wrap around on their own
       Angx += AngxSpeed;
       Angy += AngySpeed;
-      if (Angx >= TWO_PI)
-        Angx -= TWO_PI;
-      if (Angy >= TWO_PI)
-        Angy -= TWO_PI;
 
       rotate(Angx, Angy);
 
@@ -253,7 +230,7 @@ class PatternCube : public LEDStripEffect
         {
           e = edge + i;
           if (!e->visible) 
-              g()->BresenhamLine(screen[e->x].x+xOffset, screen[e->x].y, screen[e->y].x+xOffset, screen[e->y].y, color);
+              DrawClippedLine(*g(), screen[e->x].x+xOffset, screen[e->x].y, screen[e->y].x+xOffset, screen[e->y].y, color);
         }
 
         color = g()->ColorFromCurrentPalette(hue + 128 + xOffset);
@@ -263,7 +240,7 @@ class PatternCube : public LEDStripEffect
         {
           e = edge + i;
           if (e->visible)
-              g()->BresenhamLine(screen[e->x].x+xOffset, screen[e->x].y, screen[e->y].x+xOffset, screen[e->y].y, color);
+              DrawClippedLine(*g(), screen[e->x].x+xOffset, screen[e->x].y, screen[e->y].x+xOffset, screen[e->y].y, color);
         }
 
         step++;
@@ -24,7 +24,7 @@
 // Description:
 //
 //   Effect code ported from Aurora to Mesmerizer's draw routines
-//   and added the cycle detection CRC stuff
+//   and added the cycle detection CRC stuff, now on a bit-packed board
 //
 // History:     Jun-25-2022         Davepl      Based on Aurora
 //              Jul-08-2022         Davepl      Added loop checks
@@ -64,11 +64,6 @@
 
 #include <bitset>
 
-extern "C"
-{
-    #include "uzlib/src/uzlib.h"
-}
-
 // Introduction:
 // -------------
 // This file contains the implementation for a life simulation game, inspired by Conway's Game of Life,
@@ -114,43 +109,212 @@ extern "C"
 //    visualization on the LED matrix.
 //
 
-class Cell
+// LifeBoard
+//
+// The alive bits of a toroidal board, a row at a time in 64 bit words with bit x of a row for column x.  A
+// generation is worked out a word at a time: the eight neighbors of 64 cells are added up in parallel with bitwise
+// adders, so counting takes a handful of operations per word instead of eight lookups per cell.
+
+template <int Width, int Height>
+class LifeBoard
 {
-public:
-  uint8_t alive : 1;
-  uint8_t prev  : 1;
-  uint8_t hue;
-  uint8_t brightness;
+  public:
+
+    static constexpr int      kWordsPerRow  = (Width + 63) / 64;
+    static constexpr uint64_t kLastWordMask = (Width % 64) ? ((1ull << (Width % 64)) - 1) : ~0ull;
+
+  private:
+
+    effect_unique_array<uint64_t> _cells;
+    effect_unique_array<uint64_t> _next;
+
+    uint64_t * Row(uint64_t * board, int y) const
+    {
+        return board + y * kWordsPerRow;
+    }
+
+    // Each bit x of the output is bit x+1 (east) or x-1 (west) of the row, wrapping around the ends
+
+    static void RotateEast(const uint64_t * row, uint64_t * out)
+    {
+        for (int k = 0; k < kWordsPerRow; k++)
+            out[k] = (row[k] >> 1) | (k + 1 < kWordsPerRow ? row[k + 1] << 63 : 0);
+        out[kWordsPerRow - 1] |= (row[0] & 1) << ((Width - 1) % 64);
+    }
+
+    static void RotateWest(const uint64_t * row, uint64_t * out)
+    {
+        for (int k = 0; k < kWordsPerRow; k++)
+            out[k] = (row[k] << 1) | (k > 0 ? row[k - 1] >> 63 : 0);
+        out[kWordsPerRow - 1] &= kLastWordMask;
+        out[0] |= (row[kWordsPerRow - 1] >> ((Width - 1) % 64)) & 1;
+    }
+
+  public:
+
+    bool Allocate()
+    {
+        _cells = make_unique_effect_array<uint64_t>(kWordsPerRow * Height);
+        _next  = make_unique_effect_array<uint64_t>(kWordsPerRow * Height);
+        return _cells && _next;
+    }
+
+    void Release()
+    {
+        _cells.reset();
+        _next.reset();
+    }
+
+    void Clear()
+    {
+        memset(_cells.get(), 0, kWordsPerRow * Height * sizeof(uint64_t));
+    }
+
+    bool IsAlive(int x, int y) const
+    {
+        return (_cells[y * kWordsPerRow + x / 64] >> (x % 64)) & 1;
+    }
+
+    void SetAlive(int x, int y)
+    {
+        _cells[y * kWordsPerRow + x / 64] |= 1ull << (x % 64);
+    }
+
+    // Hash
+    //
+    // 64 bits over the alive cells, for spotting a board that's been seen before
+
+    uint64_t Hash() const
+    {
+        uint64_t hash = 0xcbf29ce484222325ull;
+        for (int i = 0; i < kWordsPerRow * Height; i++)
+        {
+            hash ^= _cells[i];
+            hash *= 0x100000001b3ull;
+            hash ^= hash >> 29;
+        }
+        return hash;
+    }
+
+    // Step
+    //
+    // Moves on a generation, and calls back with each cell that was born or died as (x, y, bAlive)
+
+    template <typename Callback>
+    void Step(Callback changed)
+    {
+        uint64_t above[3][kWordsPerRow], here[3][kWordsPerRow], below[3][kWordsPerRow];
+
+        for (int y = 0; y < Height; y++)
+        {
+            const uint64_t * rowAbove = Row(_cells.get(), (y + Height - 1) % Height);
+            const uint64_t * rowHere  = Row(_cells.get(), y);
+            const uint64_t * rowBelow = Row(_cells.get(), (y + 1) % Height);
+
+            RotateWest(rowAbove, above[0]); RotateEast(rowAbove, above[2]);
+            RotateWest(rowHere,  here[0]);  RotateEast(rowHere,  here[2]);
+            RotateWest(rowBelow, below[0]); RotateEast(rowBelow, below[2]);
+
+            uint64_t * rowNext = Row(_next.get(), y);
+
+            for (int k = 0; k < kWordsPerRow; k++)
+            {
+                // Three full adders take the row above, the sides and the row below down to sums and carries
+
+                uint64_t a0 = above[0][k], a1 = rowAbove[k], a2 = above[2][k];
+                uint64_t sumAbove   = a0 ^ a1 ^ a2;
+                uint64_t carryAbove = (a0 & a1) | (a2 & (a0 ^ a1));
+
+                uint64_t sumSides   = here[0][k] ^ here[2][k];
+                uint64_t carrySides = here[0][k] & here[2][k];
+
+                uint64_t b0 = below[0][k], b1 = rowBelow[k], b2 = below[2][k];
+                uint64_t sumBelow   = b0 ^ b1 ^ b2;
+                uint64_t carryBelow = (b0 & b1) | (b2 & (b0 ^ b1));
+
+                // And then the count's ones, twos, fours and eights
+
+                uint64_t ones      = sumAbove ^ sumSides ^ sumBelow;
+                uint64_t onesCarry = (sumAbove & sumSides) | (sumBelow & (sumAbove ^ sumSides));
+
+                uint64_t carries   = carryAbove ^ carrySides ^ carryBelow;
+                uint64_t carries2  = (carryAbove & carrySides) | (carryBelow & (carryAbove ^ carrySides));
+
+                uint64_t twos      = carries ^ onesCarry;
+                uint64_t fours     = carries2 ^ (carries & onesCarry);
+                uint64_t eights    = carries2 & carries & onesCarry;
+
+                // Alive next with three neighbors, or with two if alive now
+
+                uint64_t alive = rowHere[k];
+                uint64_t next  = twos & ~fours & ~eights & (ones | alive);
+                if (k == kWordsPerRow - 1)
+                    next &= kLastWordMask;
+                rowNext[k] = next;
+
+                for (uint64_t diff = next ^ alive; diff; diff &= diff - 1)
+                {
+                    int bit = __builtin_ctzll(diff);
+                    changed(k * 64 + bit, y, (next >> bit) & 1);
+                }
+            }
+        }
+
+        std::swap(_cells, _next);
+    }
 };
 
 // We check for loops by keeping a number of hashes of previous frames.  A walker that goes up and across
 // the screen cycles every 2 times it crosses, so max dimension times 2 is a good place to start
 
-constexpr auto CRC_LENGTH = (std::max(MATRIX_HEIGHT, MATRIX_WIDTH) * 4 + 1);
+constexpr auto LIFE_BOARD_COLUMNS = std::max(LIFE_BOARD_WIDTH, MATRIX_WIDTH);
+constexpr auto LIFE_BOARD_ROWS    = std::max(LIFE_BOARD_HEIGHT, MATRIX_HEIGHT);
+constexpr auto CRC_LENGTH = (std::max(LIFE_BOARD_ROWS, LIFE_BOARD_COLUMNS) * 4 + 1);
 
 class PatternLife : public LEDStripEffect
 {
 private:
-    std::unique_ptr<Cell [][MATRIX_HEIGHT]> world;
-    std::unique_ptr<uint32_t []> checksums;
+
+    static constexpr uint64_t kNoHash = ~0ull;
+
+    // The board can be bigger than the matrix, in which case we show a window on it that drifts across
+    static constexpr int kScrollGenerations = 8;
+
+    LifeBoard<LIFE_BOARD_COLUMNS, LIFE_BOARD_ROWS> board;
+    effect_unique_array<uint8_t> hue;             // Color of each cell, kept apart from the board, row by row
+    effect_unique_array<uint8_t> brightness;
+    effect_unique_array<uint64_t> checksums;
     int iChecksum = 0;
     uint32_t bStuckInLoop = 0;
     unsigned int density = 50;
     int cGeneration = 0;
+    int viewX = 0;
+    int viewY = 0;
     unsigned long seed;
 
-
-    bool Init(std::vector<std::shared_ptr<GFXBase>>& gfx) override
+    static constexpr size_t CellIndex(int x, int y)
     {
-        LEDStripEffect::Init(gfx);
+        return y * LIFE_BOARD_COLUMNS + x;
+    }
 
+    bool AcquireState() override
+    {
         // Note: placing the world in PSRAM may slow this effect down, but it's currently running
         //       fast enough (30+ fps) that we can afford to use it
 
-        world.reset(psram_allocator<Cell [MATRIX_HEIGHT]>().allocate(MATRIX_WIDTH)) ;
-        checksums.reset(psram_allocator<uint32_t>().allocate(CRC_LENGTH));
+        hue        = make_unique_effect_array<uint8_t>(LIFE_BOARD_COLUMNS * LIFE_BOARD_ROWS);
+        brightness = make_unique_effect_array<uint8_t>(LIFE_BOARD_COLUMNS * LIFE_BOARD_ROWS);
+        checksums  = make_unique_effect_array<uint64_t>(CRC_LENGTH);
 
-        return true;
+        return board.Allocate() && hue && brightness && checksums;
+    }
+
+    void ReleaseState() override
+    {
+        board.Release();
+        hue.reset();
+        brightness.reset();
+        checksums.reset();
     }
 
     bool RequiresDoubleBuffering() const override
@@ -203,35 +367,26 @@ private:
             debugV("Randomized Seed: %lu", seed);
         }
 
+        // Filled column by column, as it always has been, so the baked in seeds still give the same worlds
+
         srand(seed);
-        for (int i = 0; i < MATRIX_WIDTH; i++) {
-            for (int j = 0; j < MATRIX_HEIGHT; j++) {
+        board.Clear();
+        for (int i = 0; i < LIFE_BOARD_COLUMNS; i++) {
+            for (int j = 0; j < LIFE_BOARD_ROWS; j++) {
                 if ((rand() % 100) < density) {
-                    world[i][j].alive = 1;
-                    world[i][j].brightness = 128;
+                    board.SetAlive(i, j);
+                    brightness[CellIndex(i, j)] = 128;
                 }
                 else {
-                    world[i][j].alive = 0;
-                    world[i][j].brightness = 0;
+                    brightness[CellIndex(i, j)] = 0;
                 }
-                world[i][j].prev = world[i][j].alive;
-                world[i][j].hue = 0;
+                hue[CellIndex(i, j)] = 0;
             }
         }
 
         for (int i = 0; i < CRC_LENGTH; i++)
-            checksums[i] = 0xFFFFFFF;
-    }
-
-    int neighbours(int x, int y) {
-        return (world[(x + 1) % MATRIX_WIDTH][y].prev) +
-            (world[x][(y + 1) % MATRIX_HEIGHT].prev) +
-            (world[(x + MATRIX_WIDTH - 1) % MATRIX_WIDTH][y].prev) +
-            (world[x][(y + MATRIX_HEIGHT - 1) % MATRIX_HEIGHT].prev) +
-            (world[(x + 1) % MATRIX_WIDTH][(y + 1) % MATRIX_HEIGHT].prev) +
-            (world[(x + MATRIX_WIDTH - 1) % MATRIX_WIDTH][(y + 1) % MATRIX_HEIGHT].prev) +
-            (world[(x + MATRIX_WIDTH - 1) % MATRIX_WIDTH][(y + MATRIX_HEIGHT - 1) % MATRIX_HEIGHT].prev) +
-            (world[(x + 1) % MATRIX_WIDTH][(y + MATRIX_HEIGHT - 1) % MATRIX_HEIGHT].prev);
+            checksums[i] = kNoHash;
+        viewX = viewY = 0;
     }
 
 public:
@@ -248,109 +403,114 @@ public:
     {
         randomFillWorld();
         for (int i = 0; i < CRC_LENGTH; i++)
-            checksums[i] = 0xFFFFFFF;
+            checksums[i] = kNoHash;
         cGeneration = 0;
         bStuckInLoop = 0;
     }
 
-    void Draw() override
+    // Seeding the world is the slow part of starting, and doesn't draw, so it can happen ahead of time
+
+    void Prepare() override
     {
-        if (cGeneration == 0)
-            Reset();
+        Reset();
+    }
+
+    // A generation per step, at the rate the effect used to draw at, so it keeps its pace whatever the frame rate
+
+    float StepsPerSecond() const override
+    {
+        return DesiredFramesPerSecond();
+    }
 
-        // Display current generation
+    static constexpr int kFlashTime = 250;
+    static constexpr int kResetTime = 1500;
+
+    void Draw() override
+    {
+        // Display current generation, or the window on it we're at
 
         for (int i = 0; i < MATRIX_WIDTH; i++) {
             for (int j = 0; j < MATRIX_HEIGHT; j++) {
-                if (world[i][j].brightness > 0)
-                    g()->leds[XY(i, j)] += g()->ColorFromCurrentPalette(world[i][j].hue * 4, world[i][j].brightness);
+                auto cell = CellIndex((i + viewX) % LIFE_BOARD_COLUMNS, (j + viewY) % LIFE_BOARD_ROWS);
+                if (brightness[cell] > 0)
+                    g()->leds[XY(i, j)] += g()->ColorFromCurrentPalette(hue[cell] * 4, brightness[cell]);
                 else
                     g()->leds[XY(i, j)] = CRGB::Black;
             }
         }
 
-        // We maintain a scrolling window of the last N crcs and if the current crc makes it all
-        // the way down to the bottom half we assume we're stuck in a loop and restart.
-        // We have to first extract the alive bits alone because we don't want the hue and brightness
-        // data to mess with the CRC.
+        // Flash and fade out when we're stuck in a loop, until Step() starts a new world
 
-        bool alive[MATRIX_WIDTH][MATRIX_HEIGHT];
-        for (int i = 0; i < MATRIX_WIDTH; i++)
-            for (int j = 0; j < MATRIX_HEIGHT; j++)
-                alive[i][j] = world[i][j].alive;
+        if (bStuckInLoop)
+        {
+            auto elapsed = millis() - bStuckInLoop;
+            if (elapsed < kFlashTime)
+            {
+                auto whiteColor = CRGB(0x60, 0x00, 0x00);
+                g()->fillRectangle(0, 0, MATRIX_WIDTH, MATRIX_HEIGHT, whiteColor);
+            }
+            g()->DimAll(255 - 255*std::min<unsigned long>(elapsed, kResetTime)/kResetTime);
+        }
+    }
 
-        auto crc = uzlib_crc32(alive, sizeof(alive), 0xffffffff);
-        for (int i = 0; i < CRC_LENGTH - 1; i++)
-            checksums[i] = checksums[i+1];
-        checksums[CRC_LENGTH - 1] = crc;
+    void Step(float dt) override
+    {
+        // We maintain a scrolling window of the last N hashes and if the current one makes it all
+        // the way down to the bottom half we assume we're stuck in a loop and restart.  The hash is
+        // over the board alone, so the hue and brightness don't mess with it.
 
+        auto hash = board.Hash();
+        memmove(&checksums[0], &checksums[1], (CRC_LENGTH - 1) * sizeof(checksums[0]));
+        checksums[CRC_LENGTH - 1] = hash;
 
-        // Look for any occurrences of the current CRC in the first half of the window, which would mean
+        // Look for any occurrences of the current hash in the first half of the window, which would mean
         // a loop has occurred.  If
 
         if (bStuckInLoop)
         {
-            const int flashTime = 250;
-            const int resetTime = 1500;
-
             auto elapsed = millis() - bStuckInLoop;
-            if (elapsed < flashTime)
-            {
-                auto whiteColor = CRGB(0x60, 0x00, 0x00);
-                g()->fillRectangle(0, 0, MATRIX_WIDTH, MATRIX_HEIGHT, whiteColor);
-            }
-            g()->DimAll(255 - 255*elapsed/resetTime);
 
-            for (int x = 0; x < MATRIX_WIDTH; x++)
-                for (int y = 0; y < MATRIX_HEIGHT; y++)
-                        world[x][y].brightness *= 0.9;
-            if (elapsed > resetTime)
+            for (int i = 0; i < LIFE_BOARD_COLUMNS * LIFE_BOARD_ROWS; i++)
+                brightness[i] *= 0.9;
+            if (elapsed > kResetTime)
                 Reset();
         }
         else
         {
             for (int i = CRC_LENGTH - 2; i >= 0; i--)
             {
-                if (checksums[i] == crc)
+                if (checksums[i] == hash)
                 {
                     bStuckInLoop = millis();
                     debugV("Seed: %10lu, Generations: %5d, %s", seed, cGeneration, cGeneration > 3000 ? "Y" : "N");
                 }
-                if (checksums[i] == 0xFFFFFFF)
+                if (checksums[i] == kNoHash)
                     break;
             }
         }
 
-        // Birth and death cycle
-        for (int x = 0; x < MATRIX_WIDTH; x++) {
-            for (int y = 0; y < MATRIX_HEIGHT; y++) {
-                // Default is for cell to stay the same
-                if (world[x][y].brightness > 0 && world[x][y].prev == 0)
-                  world[x][y].brightness *= 0.75;
-
-                int count = neighbours(x, y);
-                if (count == 3 && world[x][y].prev == 0) {
-                    // A new cell is born
-                    world[x][y].alive = 1;
-                    world[x][y].hue += 1;
-                    world[x][y].brightness = 255;
-                } else if ((count < 2 || count > 3) && world[x][y].prev == 1) {
-                    // Cell dies
-                    world[x][y].alive = 0;
-                    world[x][y].brightness = 0;
-                }
-            }
-        }
-
-        // Copy next generation into place
+        // Birth and death cycle; only the cells that change need their colors touched
 
-        int cCount = 0;
+        board.Step([&](int x, int y, bool bBorn)
+        {
+            auto cell = CellIndex(x, y);
+            if (bBorn)
+            {
+                hue[cell] += 1;
+                brightness[cell] = 255;
+            }
+            else
+            {
+                brightness[cell] = 0;
+            }
+        });
 
-        for (int x = 0; x < MATRIX_WIDTH; x++) {
-            for (int y = 0; y < MATRIX_HEIGHT; y++) {
-                if (world[x][y].prev != world[x][y].alive)
-                    cCount++;
-                world[x][y].prev = world[x][y].alive;
+        if (LIFE_BOARD_COLUMNS > MATRIX_WIDTH || LIFE_BOARD_ROWS > MATRIX_HEIGHT)
+        {
+            if (cGeneration % kScrollGenerations == 0)
+            {
+                viewX = (viewX + (LIFE_BOARD_COLUMNS > MATRIX_WIDTH)) % LIFE_BOARD_COLUMNS;
+                viewY = (viewY + (LIFE_BOARD_ROWS > MATRIX_HEIGHT)) % LIFE_BOARD_ROWS;
             }
         }
 
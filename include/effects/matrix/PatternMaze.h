@@ -56,6 +56,8 @@
 #ifndef PatternMaze_H
 #define PatternMaze_H
 
+#include "workslice.h"
+
 // The `PatternMaze` class, inheriting from `LEDStripEffect`, is designed to create
 // dynamic maze patterns on an LED matrix. It showcases an intricate combination of
 // object-oriented programming and LED display manipulation in C++. This class is 
@@ -81,8 +83,9 @@
 // - Utilizes a combination of different maze generation algorithms, such as recursive 
 //   backtracking and Prim's algorithm. This flexibility allows for a variety of maze 
 //   patterns.
-// - `drawNextCell`: The core function for drawing each cell of the maze, updating the 
-//   grid, and managing cell progression.
+// - `buildNextCell`: The core function for carving each cell of the maze, updating the 
+//   grid, and managing cell progression.  The next maze is built a slice at a time while
+//   the current one is drawn, one recorded step per frame, by `drawStep`.
 
 
 class PatternMaze : public LEDStripEffect
@@ -143,30 +146,56 @@ private:
         }
     };
 
-//    int width = 16;
-//    int height = 16;
-
     static const int width = MATRIX_WIDTH / 4;
     static const int height = MATRIX_HEIGHT / 2;
 
+    // Every maze is worked out in full before it's shown, and then drawn one step per frame the way it was carved, while
+    // the next one is built a slice at a time alongside.  Each step lights a cell and, if the maze grew from it, the
+    // passage to the new neighbor.
 
-    Directions grid[width][height];
+    static const int maxSteps = 2 * width * height;
+    static const uint32_t buildSliceMicros = 2000;
 
-    Point point;
+    struct MazeStep
+    {
+        uint8_t x;
+        uint8_t y;
+        Directions direction;       // None if the cell was a dead end
+    };
+
+    struct MazePlan
+    {
+        MazeStep steps[maxSteps];
+        int stepCount = 0;
+        uint8_t hue = 0;
+        int algorithm = 0;
+    };
+
+    // The plans and the grid of the maze being built, which ends up in plans.Back().  They're what's big, so they're
+    // only around while the effect is resident.
 
-    Point cells[width*height];
+    struct MazeState
+    {
+        DoubleBuffer<MazePlan> plans;
+        Directions grid[height][width];
+        Point cells[width*height];
+    };
+
+    std::unique_ptr<MazeState> state;
+    WorkSlice buildSlice { buildSliceMicros };
+    int nextStep = 0;
+
+    Point point;
     int cellCount = 0;
 
     int algorithm = 0;
     int algorithmCount = 1;
 
-    size_t hue = 0;
-
     Directions directions[4] = { Up, Down, Left, Right };
 
     void removeCell(int index) {// shift cells after index down one
         for (int i = index; i < cellCount - 1; i++) {
-            cells[i] = cells[i + 1];
+            state->cells[i] = state->cells[i + 1];
         }
 
         cellCount--;
@@ -189,14 +218,14 @@ private:
         return p;
     }
 
-    CRGB chooseColor(int index)
+    CRGB chooseColor(const MazePlan& plan)
     {
-        switch (algorithm) {
+        switch (plan.algorithm) {
             case 0:
             default:
-                return CHSV(hue, 255, 200);
+                return CHSV(plan.hue, 255, 200);
             case 1:
-                return CHSV(hue + 128, 255, 200);
+                return CHSV(plan.hue + 128, 255, 200);
         }
     }
 
@@ -218,59 +247,94 @@ private:
         }
     }
 
-    void generateMaze() {
-        while (cellCount > 1) {
-            drawNextCell();
+    void beginMaze()
+    {
+        auto& plan = state->plans.Back();
+        plan.stepCount = 0;
+        plan.hue = random(256);
+        plan.algorithm = algorithm;
+
+        // reset the maze grid
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                state->grid[y][x] = None;
+            }
         }
+
+        int x = random(width);
+        int y = random(height);
+
+        state->cells[0] = createPoint(x, y);
+
+        cellCount = 1;
     }
 
-    void drawNextCell()
+    // Carves the next cell of the maze being built, and returns false once it's complete
+
+    bool buildNextCell()
     {
         int index = chooseIndex(cellCount);
 
         if (index < 0)
-            return;
+            return false;
 
-        point = cells[index];
+        point = state->cells[index];
 
-        Point imagePoint = createPoint(point.x * 2, point.y * 2);
+        auto& plan = state->plans.Back();
+        MazeStep& step = plan.steps[plan.stepCount++];
+        step.x = point.x;
+        step.y = point.y;
+        step.direction = None;
 
         shuffleDirections();
 
-        CRGB color = chooseColor(index);
-        g()->drawPixel(imagePoint.x, imagePoint.y, color);
-        g()->drawPixel(MATRIX_WIDTH - 1 - imagePoint.x, imagePoint.y, color);
-
         for (int i = 0; i < 4; i++)
         {
             Directions direction = directions[i];
 
             Point newPoint = point.Move(direction);
+            auto& grid = state->grid;
             if (newPoint.x >= 0 && newPoint.y >= 0 && newPoint.x < width && newPoint.y < height && grid[newPoint.y][newPoint.x] == None)
             {
                 grid[point.y][point.x]       = (Directions) ((int) grid[point.y][point.x] | (int) direction);
                 grid[newPoint.y][newPoint.x] = (Directions) ((int) grid[newPoint.y][newPoint.x] | (int) point.Opposite(direction));
 
-                Point newImagePoint = imagePoint.Move(direction);
-
-                g()->drawPixel(newImagePoint.x, newImagePoint.y, color);
-                g()->drawPixel(MATRIX_WIDTH - 1 - newImagePoint.x, newImagePoint.y, color);
+                step.direction = direction;
 
                 cellCount++;
-                cells[cellCount - 1] = newPoint;
+                state->cells[cellCount - 1] = newPoint;
 
                 index = -1;
                 break;
             }
         }
 
-        if (index > -1) {
-            Point finishedPoint = cells[index];
-            imagePoint = createPoint(finishedPoint.x * 2, finishedPoint.y * 2);
-            g()->drawPixel(imagePoint.x, imagePoint.y, color);
-            g()->drawPixel(MATRIX_WIDTH - 1 - imagePoint.x, imagePoint.y, color);
-
+        if (index > -1)
             removeCell(index);
+
+        if (cellCount > 0)
+            return true;
+
+        algorithm++;
+        if (algorithm >= algorithmCount)
+            algorithm = 0;
+
+        return false;
+    }
+
+    void drawStep(const MazePlan& plan, const MazeStep& step)
+    {
+        CRGB color = chooseColor(plan);
+
+        Point imagePoint = createPoint(step.x * 2, step.y * 2);
+        g()->drawPixel(imagePoint.x, imagePoint.y, color);
+        g()->drawPixel(MATRIX_WIDTH - 1 - imagePoint.x, imagePoint.y, color);
+
+        if (step.direction != None)
+        {
+            Point newImagePoint = imagePoint.Move(step.direction);
+            g()->drawPixel(newImagePoint.x, newImagePoint.y, color);
+            g()->drawPixel(MATRIX_WIDTH - 1 - newImagePoint.x, newImagePoint.y, color);
         }
     }
 
@@ -286,34 +350,28 @@ public:
 
     void Draw() override
     {
-        if (cellCount < 1)
-        {
-            hue = random(256);
-            g()->Clear();
-
-            // reset the maze grid
-            for (int y = 0; y < height; y++) {
-                for (int x = 0; x < width; x++) {
-                    grid[x][y] = None;
-                }
-            }
-
-            int x = random(width);
-            int y = random(height);
+        // Bring the next maze along, and start on the one after as soon as it's been handed over
 
-            cells[0] = createPoint(x, y);
-
-            cellCount = 1;
+        auto& plans = state->plans;
+        if (!plans.BackReady())
+        {
+            if (cellCount < 1)
+                beginMaze();
 
+            if (buildSlice.Run([this] { return buildNextCell(); }))
+                plans.SetBackReady();
         }
 
-        drawNextCell();
+        if (nextStep >= plans.Front().stepCount)
+        {
+            if (!plans.Swap())
+                return;
 
-        if (cellCount < 1) {
-            algorithm++;
-            if (algorithm >= algorithmCount)
-                algorithm = 0;
+            nextStep = 0;
+            g()->Clear();
         }
+
+        drawStep(plans.Front(), plans.Front().steps[nextStep++]);
     }
 
     virtual bool Init(std::vector<std::shared_ptr<GFXBase>>& gfx)
@@ -322,12 +380,26 @@ public:
             return false;
 
         cellCount = 0;
-        hue = 0;
         return true;
     }
 
+    bool AcquireState() override
+    {
+        state.reset(new(std::nothrow) MazeState);
+        return state != nullptr;
+    }
+
+    void ReleaseState() override
+    {
+        state.reset();
+    }
+
     void Start() override
     {
+        state->plans.Reset();
+        state->plans.Front().stepCount = 0;
+        nextStep = 0;
+        cellCount = 0;
         g()->Clear();
     }
 };
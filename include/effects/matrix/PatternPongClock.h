@@ -67,6 +67,7 @@
 #define PatternPongClock_H
 
 #include "systemcontainer.h"
+#include "textraster.h"
 
 #define BAT1_X 2 // Pong left bat x pos (this is where the ball collision occurs, the bat is drawn 1 behind these coords)
 #define BAT2_X (MATRIX_WIDTH - 4)
@@ -93,6 +94,9 @@ class PatternPongClock : public LEDStripEffect
     uint8_t mins;
     uint8_t hours;
 
+    TextRaster hoursText;       // The score digits, which only change once a minute
+    TextRaster minsText;
+
   public:
 
     PatternPongClock() : LEDStripEffect(EFFECT_MATRIX_PONG_CLOCK, "PongClock")
@@ -148,8 +152,6 @@ class PatternPongClock : public LEDStripEffect
             g()->setPixel(MATRIX_WIDTH / 2, 6, RED16);
         }
 
-        LEDMatrixGFX::backgroundLayer.setFont(gohufont11b);
-
         // The compiler warns that with a nul terminator, 4 bytes could be needed, which is true
         // but we're only writing 3 bytes, but I'll waste the byte to avoid the warning.
 
@@ -157,10 +159,12 @@ class PatternPongClock : public LEDStripEffect
 
         auto clockColor = rgb24(255,255,255);
         sprintf(buffer, "%2d", hours);
-        LEDMatrixGFX::backgroundLayer.drawString(MATRIX_WIDTH / 2 - 12, 0, clockColor, buffer);
+        hoursText.Update(buffer, gohufont11b);
+        hoursText.Draw(LEDMatrixGFX::backgroundLayer, MATRIX_WIDTH / 2 - 12, 0, clockColor);
 
         sprintf(buffer, "%02d", mins);
-        LEDMatrixGFX::backgroundLayer.drawString(MATRIX_WIDTH / 2 + 2, 0, clockColor, buffer);
+        minsText.Update(buffer, gohufont11b);
+        minsText.Draw(LEDMatrixGFX::backgroundLayer, MATRIX_WIDTH / 2 + 2, 0, clockColor);
 
         // if restart flag is 1, set up a new game
         if (restart)
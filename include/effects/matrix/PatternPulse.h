@@ -82,7 +82,7 @@ class PatternPulse : public LEDStripEffect
 
     void Draw() override
     {
-        auto graphics = g();
+        auto& graphics = g();
 
         graphics->DimAll(245);
 
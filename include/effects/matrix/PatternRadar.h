@@ -59,6 +59,7 @@ class PatternRadar : public LEDStripEffect
 private:
   uint8_t theta = 0;
   uint8_t hueoffset = 0;
+  std::unique_ptr<GFXBase::IndexedFrameLease> _indexedFrame;      // Held while the state is resident
 
 public:
   PatternRadar() : LEDStripEffect(EFFECT_MATRIX_RADAR, "Radar")
@@ -69,19 +70,35 @@ public:
   {
   }
 
+  // The sweep is drawn in palette indexes, so the trail keeps up with the palette as it changes
+
+  bool AcquireState() override
+  {
+    _indexedFrame = g()->LeaseIndexedFrame(MemoryAccount());
+    return _indexedFrame != nullptr;
+  }
+
+  void ReleaseState() override
+  {
+    _indexedFrame.reset();
+  }
+
+  void Start() override
+  {
+    g()->ClearIndexed();
+  }
+
   void Draw() override
   {
     auto graphics = (GFXBase *)_GFX[0].get();
-    graphics->DimAll(254);
+    graphics->DimIndexed(254);
 
     for (int offset = 0; offset < MATRIX_CENTER_X; offset++)
     {
       uint8_t hue = 255 - (offset * 16 + hueoffset);
-      CRGB color = graphics->ColorFromCurrentPalette(hue);
       uint8_t x = graphics->mapcos8(theta, offset, (MATRIX_WIDTH - 1) - offset);
       uint8_t y = graphics->mapsin8(theta, offset, (MATRIX_HEIGHT - 1) - offset);
-      uint16_t xzy = graphics->xy(x, y);
-      graphics->leds[xzy] = color;
+      graphics->SetIndexedPixel(x, y, hue);
 
       EVERY_N_MILLIS(25)
       {
@@ -89,6 +106,8 @@ public:
         hueoffset += 1;
       }
     }
+
+    graphics->PresentIndexed();
   }
 };
 
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "effectmanager.h"
+#include "noisefield.h"
 
 // Derived from https://editor.soulmatelights.com/gallery/388-fire2021
 
@@ -45,24 +46,33 @@ class PatternSMFire2021 : public LEDStripEffect
     void Draw() override
     {
         ff_x += step; // static uint32_t t += speed;
-        for (unsigned x = 0; x < MATRIX_WIDTH; x++)
+
+        // The noise at x * deltaValue, (y * deltaValue) - ff_x, ff_z, from the shared noise field cache
+
+        NoiseLattice lattice;
+        lattice.Depth  = NoiseDepth::Eight;
+        lattice.X      = 0;
+        lattice.Y      = (uint16_t) -ff_x;
+        lattice.StepX  = deltaValue;
+        lattice.StepY  = deltaValue;
+        lattice.Width  = MATRIX_WIDTH;
+        lattice.Height = MATRIX_HEIGHT;
+
+        g_NoiseFields.Fill(lattice, ff_z, [&](uint16_t x, uint16_t y, uint16_t value)
         {
-            for (unsigned y = 0; y < MATRIX_HEIGHT; y++)
-            {
-                int16_t Bri = inoise8(x * deltaValue, (y * deltaValue) - ff_x, ff_z) - (y * (255 / MATRIX_HEIGHT));
-                byte Col = Bri; // inoise8(x * deltaValue, (y * deltaValue) - ff_x, ff_z) - (y * (255 / MATRIX_HEIGHT));
-                if (Bri < 0)
-                    Bri = 0;
-                if (Bri != 0)
-                    Bri = 256 - (Bri * 0.2);
+            int16_t Bri = (value >> 8) - (y * (255 / MATRIX_HEIGHT));
+            byte Col = Bri;
+            if (Bri < 0)
+                Bri = 0;
+            if (Bri != 0)
+                Bri = 256 - (Bri * 0.2);
 
-                // Get the flame color using the black body radiation approximation, but when the palette is paused
-                // we make flame in that base color instead of the normal red
-                // NightDriver mod - invert Y argument.
+            // Get the flame color using the black body radiation approximation, but when the palette is paused
+            // we make flame in that base color instead of the normal red
+            // NightDriver mod - invert Y argument.
 
-                nblend(g()->leds[XY(x, MATRIX_HEIGHT - 1 - y)], GetBlackBodyHeatColor(Col/255.0f, g()->ColorFromCurrentPalette(0, Bri)).fadeToBlackBy(255-Bri), pcnt);
-            }
-        }
+            nblend(g()->leds[XY(x, MATRIX_HEIGHT - 1 - y)], GetBlackBodyHeatColor(Col/255.0f, g()->ColorFromCurrentPalette(0, Bri)).fadeToBlackBy(255-Bri), pcnt);
+        });
 
         if (!random8())
             ff_z++;
@@ -102,8 +102,12 @@ class PatternSMFlowFields : public LEDStripEffect
 
     void Draw() override
     {
-        for (auto &boid : boids)
+        // At lower quality fewer of the particles are moved and drawn; the rest wait where they were
+
+        size_t cParticles = QualityScaled<size_t>(NUM_PARTICLES, NUM_PARTICLES / 4);
+        for (size_t i = 0; i < cParticles; i++)
         {
+            auto &boid = boids[i];
             int ioffset = scale * boid.location.x;
             int joffset = scale * boid.location.y;
 
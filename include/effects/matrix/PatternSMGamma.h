@@ -39,7 +39,7 @@ class PatternSMGamma : public LEDStripEffect
             179, 181, 183, 185, 187, 190, 192, 194, 196, 198, 200, 202, 204, 207, 209, 211, 213, 216, 218, 220,
             222, 225, 227, 229, 232, 234, 236, 239, 241, 244, 246, 249, 251, 253, 254, 255};
 
-        int a = millis() / 8;
+        int a = g_Values.AppTime.FrameMillis() / 8;
         for (uint x = 0; x < MATRIX_WIDTH; x++)
         {
             for (uint y = 0; y < MATRIX_HEIGHT; y++)
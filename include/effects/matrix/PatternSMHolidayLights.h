@@ -114,12 +114,12 @@ void spruce()
     // Set a specific LED color based on some conditions and time.
     if (!(MATRIX_WIDTH & 0x01))
     {
-        g()->leds[XY(MATRIX_WIDTH / 2 - ((millis() >> 9) & 0x01 ? 1 : 0), minDim - 1 - ((millis() >> 8) & 0x01 ? 1 : 0))] =
+        g()->leds[XY(MATRIX_WIDTH / 2 - ((g_Values.AppTime.FrameMillis() >> 9) & 0x01 ? 1 : 0), minDim - 1 - ((g_Values.AppTime.FrameMillis() >> 8) & 0x01 ? 1 : 0))] =
             CHSV(0, 255, 255);
     }
     else
     {
-        g()->leds[XY(MATRIX_WIDTH / 2, minDim - 1)] = CHSV(0, (millis() >> 9) & 0x01 ? 0 : 255, 255);
+        g()->leds[XY(MATRIX_WIDTH / 2, minDim - 1)] = CHSV(0, (g_Values.AppTime.FrameMillis() >> 9) & 0x01 ? 0 : 255, 255);
     }
 
     // If 'glitch' is true, call the 'confetti' function.
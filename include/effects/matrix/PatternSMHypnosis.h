@@ -1,6 +1,7 @@
 #pragma once
 
 #include "effectmanager.h"
+#include "polarmap.h"
 
 // Inspired by https://editor.soulmatelights.com/gallery/2272-hypnosis
 // Spiraling swirls of rotating colors.
@@ -8,14 +9,7 @@
 class PatternSMHypnosis : public LEDStripEffect
 {
   private:
-    const uint8_t C_X = MATRIX_WIDTH / 2;
-    const uint8_t C_Y = MATRIX_HEIGHT / 2;
     const uint8_t mapp = 255 / MATRIX_WIDTH;
-    struct
-    {
-        uint8_t angle;
-        uint8_t radius;
-    } rMap[MATRIX_WIDTH][MATRIX_HEIGHT];
 
   public:
     PatternSMHypnosis() : LEDStripEffect(EFFECT_MATRIX_SMHYPNOSIS, "Hypnosis")
@@ -31,18 +25,14 @@ class PatternSMHypnosis : public LEDStripEffect
         return 45;
     }
 
+    bool AcquireState() override
+    {
+        return g_PolarMap.Prepare();
+    }
+
     void Start() override
     {
         g()->Clear();
-        for (int8_t x = -C_X; x < C_X + (MATRIX_WIDTH % 2); x++)
-        {
-            for (int8_t y = -C_Y; y < C_Y + (MATRIX_HEIGHT % 2); y++)
-            {
-                rMap[x + C_X][y + C_Y].angle = 128 * (atan2(y, x) / PI);
-                rMap[x + C_X][y + C_Y].radius = hypot(x, y) * mapp; // thanks
-                                                                    // Sutaburosu
-            }
-        }
     }
 
     uint16_t t = 0;
@@ -51,9 +41,15 @@ class PatternSMHypnosis : public LEDStripEffect
     {
         t += 4;
         for (uint x = 0; x < MATRIX_WIDTH; x++)
+        {
             for (uint y = 0; y < MATRIX_HEIGHT; y++)
+            {
+                uint8_t angle = g_PolarMap.Angle(x, y);
+                uint8_t radius = g_PolarMap.Radius(x, y, mapp);
                 g()->leds[XY(x, y)] = ColorFromPalette(g()->IsPalettePaused()
                                       ? g()->GetCurrentPalette()
-                                      : RainbowStripeColors_p, t / 2 + rMap[x][y].radius + rMap[x][y].angle, sin8(rMap[x][y].angle + (rMap[x][y].radius * 2) - t));
+                                      : RainbowStripeColors_p, t / 2 + radius + angle, sin8(angle + (radius * 2) - t));
+            }
+        }
     }
 };
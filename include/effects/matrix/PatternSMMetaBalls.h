@@ -1,6 +1,7 @@
 #pragma once
 
 #include "effectmanager.h"
+#include "polarmap.h"
 
 // Derived from https://wokwi.com/projects/289218075224441356
 // N Glowing balls in orbit around each other around a rotating plane.
@@ -12,16 +13,10 @@ class PatternSMMetaBalls : public LEDStripEffect
     uint8_t bx[5];
     uint8_t by[5];
 
+    // 220 / sqrt16(a * a + b * b + 1), from the inverse distance table rather than a root and a divide
     byte dist(uint8_t x1, uint8_t y1, uint8_t x2, uint8_t y2)
     {
-        int a = y2 - y1;
-        int b = x2 - x1;
-        a *= a;
-        b *= b;
-        //    byte dist = 220 / (sqrt16(a + b) + 1);
-        // Avoid a div/0 crash.
-        byte dist = 220 / (sqrt16(a + b + 1));
-        return dist;
+        return (220 * g_PolarMap.InverseDistance(x2 - x1, y2 - y1)) >> 15;
     }
 
   public:
@@ -33,6 +28,19 @@ class PatternSMMetaBalls : public LEDStripEffect
     {
     }
 
+    bool AcquireState() override
+    {
+        return g_PolarMap.Prepare();
+    }
+
+    // The balls are soft enough that they're worked out at a fraction of the pixels and scaled up, which also does
+    // the smoothing the full size version blurred for
+
+    uint8_t FieldScale() const override
+    {
+        return FIELD_RENDER_SCALE;
+    }
+
     void Start() override
     {
         g()->Clear();
@@ -45,21 +53,30 @@ class PatternSMMetaBalls : public LEDStripEffect
             bx[a] = beatsin8(15 + a * 2, 0, MATRIX_WIDTH - 1, 0, a * 32);
             by[a] = beatsin8(18 + a * 2, 0, MATRIX_HEIGHT - 1, 0, a * 32);
         }
-        for (unsigned i = 0; i < MATRIX_WIDTH - 1; i++)
+        // Every pixel only depends on the balls, so the columns are shared between the cores.  Each field pixel
+        // is worked out at the middle of the matrix pixels it stands for.
+
+        auto & field = Field();
+        g_ParallelFor.Run(field.Width(), [&](uint16_t begin, uint16_t end)
         {
-            for (unsigned j = 0; j < MATRIX_HEIGHT - 1; j++)
+            for (unsigned i = begin; i < end; i++)
             {
-                byte sum = dist(i, j, bx[0], by[0]);
-                for (uint8_t a = 1; a < 5; a++)
+                const uint8_t x = field.MatrixX(i);
+
+                for (unsigned j = 0; j < field.Height(); j++)
                 {
-                    sum = qadd8(sum, dist(i, j, bx[a], by[a]));
+                    const uint8_t y = field.MatrixY(j);
+
+                    byte sum = dist(x, y, bx[0], by[0]);
+                    for (uint8_t a = 1; a < 5; a++)
+                    {
+                        sum = qadd8(sum, dist(x, y, bx[a], by[a]));
+                    }
+                    // HeatColors2_p peaks with blue instead of white and looks nicer for this effect.  The brightness
+                    // takes off what the full size version faded each frame.
+                    field.At(i, j) = ColorFromPalette(HeatColors2_p, sum + 220, 244, LINEARBLEND);
                 }
-                // HeatColors2_p peaks with blue instead of white and looks nicer for this effect
-                g()->leds[XY(i, j)] = ColorFromPalette(HeatColors2_p, sum + 220, 254, LINEARBLEND);
             }
-        }
-
-        g()->blur2d(g()->leds, MATRIX_WIDTH - 1, 0, MATRIX_HEIGHT - 1, 0, 32);
-        fadeAllChannelsToBlackBy(10);
+        });
     }
 };
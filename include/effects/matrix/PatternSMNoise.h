@@ -1,6 +1,7 @@
 #pragma once
 
 #include "effectmanager.h"
+#include "noisefield.h"
 
 // Derived from https://editor.soulmatelights.com/gallery/1509-noise-palettes
 // Cycles through 17 effects of pallette noise, looking like a surreal topo.
@@ -395,6 +396,13 @@ class PatternSMNoise : public LEDStripEffect
         return jsonObject.set(jsonDoc.as<JsonObjectConst>());
     }
 
+    // The noise is smooth enough that it's worked out at a fraction of the pixels and scaled up
+
+    uint8_t FieldScale() const override
+    {
+        return FIELD_RENDER_SCALE;
+    }
+
     void Start() override
     {
         g()->Clear();
@@ -444,6 +452,7 @@ class PatternSMNoise : public LEDStripEffect
     EffectType _effect;
 
     static const int MAX_DIMENSION = ((MATRIX_WIDTH > MATRIX_HEIGHT) ? MATRIX_WIDTH : MATRIX_HEIGHT);
+    static const int FIELD_DIMENSION = (MAX_DIMENSION + FIELD_RENDER_SCALE - 1) / FIELD_RENDER_SCALE;
 
     // The 16 bit version of our coordinates
     uint16_t noisex;
@@ -466,7 +475,7 @@ class PatternSMNoise : public LEDStripEffect
     uint16_t noisescale = 30; // scale is set dynamically once we've started up
 
     // This is the array that we keep our computed noise values in
-    uint8_t noise[MAX_DIMENSION][MAX_DIMENSION];
+    uint8_t noise[FIELD_DIMENSION][FIELD_DIMENSION];
 
     uint8_t colorLoop = 0;
 
@@ -519,31 +528,34 @@ class PatternSMNoise : public LEDStripEffect
             dataSmoothing = 200 - (lowestNoise * 4);
         }
 
-        for (int i = 0; i < MAX_DIMENSION; i++)
-        {
-            int ioffset = noisescale * i;
-            for (int j = 0; j < MAX_DIMENSION; j++)
-            {
-                int joffset = noisescale * j;
-
-                uint8_t data = inoise8(noisex + ioffset, noisey + joffset, noisez);
+        NoiseLattice lattice;
+        lattice.Depth  = NoiseDepth::Eight;
+        lattice.X      = noisex;
+        lattice.Y      = noisey;
+        lattice.StepX  = noisescale * FIELD_RENDER_SCALE;     // Each field pixel covers that many of the matrix
+        lattice.StepY  = noisescale * FIELD_RENDER_SCALE;
+        lattice.Width  = FIELD_DIMENSION;
+        lattice.Height = FIELD_DIMENSION;
 
-                // The range of the inoise8 function is roughly 16-238.
-                // These two operations expand those values out to roughly 0..255
-                // You can comment them out if you want the raw noise data.
-                data = qsub8(data, 16);
-                data = qadd8(data, scale8(data, 39));
+        g_NoiseFields.Fill(lattice, noisez, [&](uint16_t i, uint16_t j, uint16_t value)
+        {
+            uint8_t data = value >> 8;
 
-                if (dataSmoothing)
-                {
-                    uint8_t olddata = noise[i][j];
-                    uint8_t newdata = scale8(olddata, dataSmoothing) + scale8(data, 256 - dataSmoothing);
-                    data = newdata;
-                }
+            // The range of the inoise8 function is roughly 16-238.
+            // These two operations expand those values out to roughly 0..255
+            // You can comment them out if you want the raw noise data.
+            data = qsub8(data, 16);
+            data = qadd8(data, scale8(data, 39));
 
-                noise[i][j] = data;
+            if (dataSmoothing)
+            {
+                uint8_t olddata = noise[i][j];
+                uint8_t newdata = scale8(olddata, dataSmoothing) + scale8(data, 256 - dataSmoothing);
+                data = newdata;
             }
-        }
+
+            noise[i][j] = data;
+        });
 
         noisex += noisespeedx;
         noisey += noisespeedy;
@@ -553,10 +565,11 @@ class PatternSMNoise : public LEDStripEffect
     void mapNoiseToLEDsUsingPalette(CRGBPalette16 palette, uint8_t hueReduce = 0)
     {
         static uint8_t ihue = 0;
+        auto & field = Field();
 
-        for (int i = 0; i < MATRIX_WIDTH; i++)
+        for (int i = 0; i < field.Width(); i++)
         {
-            for (int j = 0; j < MATRIX_HEIGHT; j++)
+            for (int j = 0; j < field.Height(); j++)
             {
                 // We use the value at the (i,j) coordinate in the noise
                 // array for our brightness, and the flipped value from (j,i)
@@ -590,10 +603,7 @@ class PatternSMNoise : public LEDStripEffect
                         index -= hueReduce;
                 }
 
-                CRGB color = ColorFromPalette(palette, index, bri);
-                uint16_t n = XY(i, j);
-
-                g()->leds[n] = color;
+                field.At(i, j) = ColorFromPalette(palette, index, bri);
             }
         }
         ihue += 1;
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "effectmanager.h"
+#include "polarmap.h"
 
 // Derived from https://editor.soulmatelights.com/gallery/1570-radialfire
 
@@ -8,12 +9,6 @@ class PatternSMRadialFire : public LEDStripEffect
 {
   private:
 
-    static auto constexpr C_X = (MATRIX_WIDTH / 2);
-    static auto constexpr C_Y = (MATRIX_HEIGHT / 2);
-    // BUGBUG: should probably be dynamically allocated into non-DMAable RAM.
-    byte XY_angle[MATRIX_WIDTH][MATRIX_HEIGHT];
-    byte XY_radius[MATRIX_WIDTH][MATRIX_HEIGHT];
-
   public:
     PatternSMRadialFire() : LEDStripEffect(EFFECT_MATRIX_SMRADIAL_FIRE, "RadialFire")
     {
@@ -23,17 +18,23 @@ class PatternSMRadialFire : public LEDStripEffect
     {
     }
 
+    bool AcquireState() override
+    {
+        return g_PolarMap.Prepare();
+    }
+
+    // The flames are soft enough that they're worked out at a fraction of the pixels and scaled up.  The field
+    // keeps what was drawn last, which each frame blends towards.
+
+    uint8_t FieldScale() const override
+    {
+        return FIELD_RENDER_SCALE;
+    }
+
     void Start() override
     {
         g()->Clear();
-        for (int8_t x = -C_X; x < C_X + (MATRIX_WIDTH % 2); x++)
-        {
-            for (int8_t y = -C_Y; y < C_Y + (MATRIX_HEIGHT % 2); y++)
-            {
-                XY_angle[x + C_X][y + C_Y] = 128 * (atan2(y, x) / PI);
-                XY_radius[x + C_X][y + C_Y] = hypot(x, y); // thanks Sutaburosu
-            }
-        }
+        Field().Clear();
     }
 
     void Draw() override
@@ -44,25 +45,44 @@ class PatternSMRadialFire : public LEDStripEffect
         static byte speed = 24;
         static uint32_t t;
         t += speed;
-        for (uint8_t x = 0; x < MATRIX_WIDTH; x++)
+
+        // Each pixel only depends on where it is and the time, so the columns are shared between the cores.  Each
+        // field pixel is worked out at the middle of the matrix pixels it stands for.
+
+        auto& graphics = g();
+        auto& field = Field();
+
+        // The palette's table is built here, as ColorFromCurrentPalette() won't build it from inside the loop
+
+        if (graphics->IsPalettePaused())
+            graphics->ColorFromCurrentPalette(0);
+
+        g_ParallelFor.Run(field.Width(), [&](uint16_t begin, uint16_t end)
         {
-            for (uint8_t y = 0; y < MATRIX_HEIGHT; y++)
+            for (uint16_t i = begin; i < end; i++)
             {
-                byte angle = XY_angle[x][y];
-                byte radius = XY_radius[x][y];
-                int16_t Bri = inoise8(angle * scaleX, (radius * scaleY) - t) - radius * (255 / MATRIX_HEIGHT);
-                byte Col = Bri;
-                if (Bri < 0)
-                    Bri = 0;
-                if (Bri != 0)
-                    Bri = 256 - (Bri * 0.2);
-
-                // If the palette is paused, we use it to color the fire, otherwise we just use red
-                CRGB color = (GetBlackBodyHeatColor(Col/255.0f, g()->IsPalettePaused() ? 
-                                    g()->ColorFromCurrentPalette(Col) 
-                                  : CRGB::Red).fadeToBlackBy(255-Bri));
-                nblend(g()->leds[XY(x, y)], color, speed);
+                const uint8_t x = field.MatrixX(i);
+
+                for (uint16_t j = 0; j < field.Height(); j++)
+                {
+                    const uint8_t y = field.MatrixY(j);
+
+                    byte angle = g_PolarMap.Angle(x, y);
+                    byte radius = g_PolarMap.Radius(x, y);
+                    int16_t Bri = inoise8(angle * scaleX, (radius * scaleY) - t) - radius * (255 / MATRIX_HEIGHT);
+                    byte Col = Bri;
+                    if (Bri < 0)
+                        Bri = 0;
+                    if (Bri != 0)
+                        Bri = 256 - (Bri * 0.2);
+
+                    // If the palette is paused, we use it to color the fire, otherwise we just use red
+                    CRGB color = (GetBlackBodyHeatColor(Col/255.0f, graphics->IsPalettePaused() ?
+                                        graphics->ColorFromCurrentPalette(Col)
+                                      : CRGB::Red).fadeToBlackBy(255-Bri));
+                    nblend(field.At(i, j), color, speed);
+                }
             }
-        }
+        });
     }
 };
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "effectmanager.h"
+#include "polarmap.h"
 
 // Inspired by https://editor.soulmatelights.com/gallery/1620-rainbow-tunel
 // Like Hypnosis, a swirling radial rainbow, but entering a black hole.
@@ -12,16 +13,8 @@ class PatternSMRainbowTunnel : public LEDStripEffect
     // Stepko and Sutaburosu
     // 23/12/21
 
-    static constexpr uint8_t C_X = MATRIX_WIDTH / 2;
-    static constexpr uint8_t C_Y = MATRIX_HEIGHT / 2;
     static constexpr uint8_t mapp = 255 / MATRIX_WIDTH;
 
-    struct
-    {
-        uint8_t angle;
-        uint8_t radius;
-    } rMap[MATRIX_WIDTH][MATRIX_HEIGHT];
-
   public:
     PatternSMRainbowTunnel() : LEDStripEffect(EFFECT_MATRIX_SMRAINBOW_TUNNEL, "Colorspin")
     {
@@ -31,18 +24,14 @@ class PatternSMRainbowTunnel : public LEDStripEffect
     {
     }
 
+    bool AcquireState() override
+    {
+        return g_PolarMap.Prepare();
+    }
+
     void Start() override
     {
         g()->Clear();
-        for (int8_t x = -C_X; x < C_X + (MATRIX_WIDTH % 2); x++)
-        {
-            for (int8_t y = -C_Y; y < C_Y + (MATRIX_HEIGHT % 2); y++)
-            {
-                rMap[x + C_X][y + C_Y].angle = 128 * (atan2(y, x) / PI);
-                rMap[x + C_X][y + C_Y].radius = hypot(x, y) * mapp; // thanks
-                                                                    // Sutaburosu
-            }
-        }
     }
 
     void Draw() override
@@ -58,8 +47,8 @@ class PatternSMRainbowTunnel : public LEDStripEffect
         {
             for (uint8_t y = 0; y < MATRIX_HEIGHT; y++)
             {
-                byte angle = rMap[x][y].angle;
-                byte radius = rMap[x][y].radius;
+                byte angle = g_PolarMap.Angle(x, y);
+                byte radius = g_PolarMap.Radius(x, y, mapp);
                 g()->leds[XY(x, y)] =
                     CHSV((angle * scaleX) - t + (radius * scaleY), 255, constrain(radius * 3, 0, 255));
             }
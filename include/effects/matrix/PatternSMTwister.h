@@ -47,7 +47,7 @@ class PatternSMTwister : public LEDStripEffect
 
     void Draw() override
     {
-        uint16_t a = millis() / 10;
+        uint16_t a = g_Values.AppTime.FrameMillis() / 10;
         LEDS.clear();
 
         for (uint16_t i = 0; i < MATRIX_HEIGHT; i++)
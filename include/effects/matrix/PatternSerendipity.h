@@ -78,7 +78,7 @@ private:
     // counts all variables with different speeds linear up and down
     void UpdateTimers()
     {
-        unsigned long now = millis();
+        unsigned long now = g_Values.AppTime.FrameMillis();
         for (int i = 0; i < timers; i++)
         {
             while (now - multiTimer[i].lastMillis >= multiTimer[i].takt)
@@ -113,7 +113,7 @@ public:
 
         // set range (up/down), speed (takt=ms between steps) and starting point of all oszillators
 
-        unsigned long now = millis();
+        unsigned long now = g_Values.AppTime.FrameMillis();
 
         multiTimer[0].lastMillis = now;
         multiTimer[0].takt = 42; // x1
@@ -150,7 +150,7 @@ public:
 
     void Draw() override
     {
-        auto graphics = g();
+        auto& graphics = g();
 
         // manage the Oszillators
         UpdateTimers();
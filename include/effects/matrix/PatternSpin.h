@@ -56,6 +56,8 @@
 
 class PatternSpin : public LEDStripEffect
 {
+    std::unique_ptr<GFXBase::IndexedFrameLease> _indexedFrame;    // Held while the state is resident
+
 public:
     PatternSpin() : LEDStripEffect(EFFECT_MATRIX_SPIN, "Spin")
     {
@@ -80,18 +82,32 @@ public:
     float speed = speedStart;
     float velocity = velocityStart;
 
+    // The spinner is drawn in palette indexes, so the trail keeps up with the palette as it changes
+
+    bool AcquireState() override
+    {
+        _indexedFrame = g()->LeaseIndexedFrame(MemoryAccount());
+        return _indexedFrame != nullptr;
+    }
+
+    void ReleaseState() override
+    {
+        _indexedFrame.reset();
+    }
+
     void Start() override
     {
         speed = speedStart;
         velocity = velocityStart;
         degrees = 0;
+        g()->ClearIndexed();
     }
 
     void Draw() override
     {
-        g()->DimAll(190);
+        g()->DimIndexed(190);
 
-        CRGB color = g()->ColorFromCurrentPalette(speed * 8);
+        uint8_t index = speed * 8;
 
         // start position
         int x;
@@ -110,8 +126,8 @@ public:
             x = (int) (MATRIX_CENTER_X + radius * cos(radians));
             y = (int) (MATRIX_CENTER_Y - radius * sin(radians));
 
-            g()->drawPixel(x, y, color);
-            g()->drawPixel(y, x, color);
+            g()->SetIndexedPixel(x, y, index);
+            g()->SetIndexedPixel(y, x, index);
 
             tempDegrees += 1;
             if (tempDegrees >= 360)
@@ -133,6 +149,8 @@ public:
                 velocity *= -1;
             }
         }
+
+        g()->PresentIndexed();
     }
 };
 
@@ -95,7 +95,7 @@ public:
   }
   void Draw() override
   {
-    auto graphics = g();
+    auto& graphics = g();
     graphics->DimAll(253);
 
     // effects.ShowFrame();
@@ -34,6 +34,7 @@
 
 #include <UrlEncode.h>
 #include "systemcontainer.h"
+#include "textraster.h"
 
 // Update subscribers every 30 minutes, retry after 30 seconds on error, and check other things every 5 seconds
 #define SUB_CHECK_INTERVAL          (30 * 60000)
@@ -58,6 +59,9 @@ class PatternSubscribers : public LEDStripEffect
     unsigned long msLastCheck;
     bool succeededBefore                    = false;
 
+    TextRaster channelNameText;
+    TextRaster subscriberText;
+
     time_t latestUpdate                     = 0;
 
     void SubscriberReader()
@@ -74,7 +78,7 @@ class PatternSubscribers : public LEDStripEffect
 
     void UpdateSubscribers()
     {
-        if (!WiFi.isConnected())
+        if (!IsWiFiConnected())
         {
             debugW("Skipping Subscriber update, waiting for WiFi...");
             return;
@@ -93,18 +97,16 @@ class PatternSubscribers : public LEDStripEffect
 
         guidUpdated = false;
 
-        HTTPClient http;
-
-        http.begin("http://tools.tastethecode.com/api/youtube-sight/" + youtubeChannelGuid);
-        int httpResponseCode = http.GET();
+        // Copies of the effect for the same channel share the count when they check within a while of each other
+        auto pResponse = g_ptrSystem->HTTPService().Get("http://tools.tastethecode.com/api/youtube-sight/" + youtubeChannelGuid, SUB_CHECK_INTERVAL / 2);
 
-        if (httpResponseCode <= 0)
+        if (!pResponse)
         {
             debugW("Error fetching subscribers for channel %s (GUID %s)", youtubeChannelName.c_str(), youtubeChannelGuid.c_str());
-            http.end();
+            return;
         }
 
-        String response = http.getString();
+        String response = pResponse->ToString();
         int commaIndex = -1;
         int startIndex;
 
@@ -224,14 +226,14 @@ class PatternSubscribers : public LEDStripEffect
     void Draw() override
     {
         LEDMatrixGFX::backgroundLayer.fillScreen(rgb24(backgroundColor.r, backgroundColor.g, backgroundColor.b));
-        LEDMatrixGFX::backgroundLayer.setFont(font5x7);
 
         // Draw a border around the edge of the panel
         LEDMatrixGFX::backgroundLayer.drawRectangle(0, 1, MATRIX_WIDTH - 1, MATRIX_HEIGHT - 2,
                                                     rgb24(borderColor.r, borderColor.g, borderColor.b));
 
         // Draw the channel name
-        LEDMatrixGFX::backgroundLayer.drawString(2, 3, rgb24(255,255,255), youtubeChannelName.c_str());
+        channelNameText.Update(youtubeChannelName, font5x7);
+        channelNameText.Draw(LEDMatrixGFX::backgroundLayer, 2, 3, rgb24(255,255,255));
 
         // Start in the middle of the panel and then back up a half a row to center vertically,
         // then back up left one half a char for every 10s digit in the subscriber count.  This
@@ -246,15 +248,8 @@ class PatternSubscribers : public LEDStripEffect
         while (z/=10)
           x-= CHAR_WIDTH / 2;
 
-        String result = str_sprintf("%ld", subscribers);
-        const char * pszText = result.c_str();
-
-        LEDMatrixGFX::backgroundLayer.setFont(gohufont11b);
-        LEDMatrixGFX::backgroundLayer.drawString(x-1, y,   rgb24(0,0,0),          pszText);
-        LEDMatrixGFX::backgroundLayer.drawString(x+1, y,   rgb24(0,0,0),          pszText);
-        LEDMatrixGFX::backgroundLayer.drawString(x,   y-1, rgb24(0,0,0),          pszText);
-        LEDMatrixGFX::backgroundLayer.drawString(x,   y+1, rgb24(0,0,0),          pszText);
-        LEDMatrixGFX::backgroundLayer.drawString(x,   y,   rgb24(255,255,255),    pszText);
+        subscriberText.Update(str_sprintf("%ld", subscribers), gohufont11b, true);
+        subscriberText.Draw(LEDMatrixGFX::backgroundLayer, x, y, rgb24(255,255,255), rgb24(0,0,0));
     }
 
     // Extension override to serialize our settings on top of those from LEDStripEffect
@@ -57,11 +57,20 @@
 
 #ifndef PatternSwirl_H
 
+#include "deepframe.h"
+
 class PatternSwirl : public LEDStripEffect
 {
 private:
     const uint8_t borderWidth = 2;
 
+    // With the deep frame the blur isn't lossy, so a light fade stands in for the rounding that used to dim it
+
+    #if ENABLE_DEEP_FRAME
+        static constexpr uint16_t kDeepFade = 250;
+        std::unique_ptr<DeepFrame> _pDeepFrame;
+    #endif
+
 public:
     PatternSwirl() : LEDStripEffect(EFFECT_MATRIX_SWIRL, "Swirl")
     {
@@ -71,9 +80,34 @@ public:
     {
     }
 
+    #if ENABLE_DEEP_FRAME
+
+    bool AcquireState() override
+    {
+        _pDeepFrame = std::make_unique<DeepFrame>(MATRIX_WIDTH, MATRIX_HEIGHT);
+        return _pDeepFrame->IsValid();
+    }
+
+    void ReleaseState() override
+    {
+        _pDeepFrame.reset();
+    }
+
     void drawAt(int i, int j, CRGB color)
     {
-        auto graphics = g();
+        _pDeepFrame->Add(i, j - 1, color);
+        _pDeepFrame->Add(i, j + 1, color);
+        _pDeepFrame->Add(i - 1, j, color);
+        _pDeepFrame->Add(i + 1, j, color);
+        color.maximizeBrightness();
+        _pDeepFrame->Add(i, j, color);
+    }
+
+    #else
+
+    void drawAt(int i, int j, CRGB color)
+    {
+        auto& graphics = g();
 
         graphics->leds[graphics->xy(i, j - 1)] += color;
         graphics->leds[graphics->xy(i, j + 1)] += color;
@@ -83,16 +117,22 @@ public:
         graphics->leds[XY(i, j)] += color;
     }
 
+    #endif
+
     void Draw() override
     {
-        auto graphics = g();
+        auto& graphics = g();
         // Apply some blurring to whatever's already on the matrix
         // Note that we never actually clear the matrix, we just constantly
         // blur it repeatedly.  Since the blurring is 'lossy', there's
         // an automatic trend toward black -- by design.
 
         uint8_t blurAmount = beatsin8(2, 15, 255);
-        graphics->BlurFrame(blurAmount);
+        #if ENABLE_DEEP_FRAME
+            _pDeepFrame->FadeAndBlur(blurAmount, kDeepFade, 1);
+        #else
+            graphics->BlurFrame(blurAmount);
+        #endif
 
         // Use two out-of-sync sine waves
         uint8_t i = beatsin8(27, borderWidth, MATRIX_WIDTH - 1 - borderWidth);
@@ -102,7 +142,7 @@ public:
         uint8_t nj = (MATRIX_HEIGHT - 1) - j;
 
         // The color of each point shifts over time, each at a different speed.
-        uint16_t ms = millis();
+        uint16_t ms = g_Values.AppTime.FrameMillis();
 
         drawAt(i, j, graphics->ColorFromCurrentPalette(ms / 11));
         drawAt(i, j, graphics->ColorFromCurrentPalette(ms / 11));
@@ -111,6 +151,10 @@ public:
         drawAt(ni, nj, graphics->ColorFromCurrentPalette(ms / 17));
         drawAt(i, nj, graphics->ColorFromCurrentPalette(ms / 37));
         drawAt(ni, j, graphics->ColorFromCurrentPalette(ms / 41));
+
+        #if ENABLE_DEEP_FRAME
+            _pDeepFrame->Resolve(*graphics);
+        #endif
     }
 };
 
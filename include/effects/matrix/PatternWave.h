@@ -98,7 +98,7 @@ public:
 
     void Draw() override
     {
-        auto graphics = g();
+        auto& graphics = g();
 
         int n = 0;
 
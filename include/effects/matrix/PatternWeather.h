@@ -35,13 +35,13 @@
 
 #include <Arduino.h>
 #include <string.h>
-#include <HTTPClient.h>
 #include <UrlEncode.h>
 #include <ledstripeffect.h>
 #include <ledmatrixgfx.h>
 #include <ArduinoJson.h>
 #include "systemcontainer.h"
 #include <FontGfx_apple5x7.h>
+#include <atomic>
 #include <chrono>
 #include <thread>
 #include <map>
@@ -53,7 +53,7 @@ using namespace std::chrono;
 using namespace std::chrono_literals;
 
 #define WEATHER_INTERVAL_SECONDS 600s
-#define WEATHER_CHECK_WIFI_WAIT 5000
+#define WEATHER_CACHE_AGE (5 * 60000)                // Copies of the effect that update within this long of each other share a fetch
 
 extern const uint8_t brokenclouds_start[]           asm("_binary_assets_bmp_brokenclouds_jpg_start");
 extern const uint8_t brokenclouds_end[]             asm("_binary_assets_bmp_brokenclouds_jpg_end");
@@ -140,6 +140,7 @@ private:
     float  loTomorrow         = 0.0f;
 
     bool   dataReady          = false;
+    std::atomic<bool> updateSkipped { false };              // The last update came up with no WiFi, so try again sooner
     size_t readerIndex = std::numeric_limits<size_t>::max();
     system_clock::time_point latestUpdate = system_clock::from_time_t(0);
 
@@ -219,7 +220,6 @@ private:
      */
     bool updateCoordinates()
     {
-        HTTPClient http;
         String url;
 
         if (!HasLocationChanged())
@@ -236,25 +236,35 @@ private:
             url = "http://api.openweathermap.org/geo/1.0/direct"
                 "?q=" + urlEncode(configLocation) + "," + urlEncode(configCountryCode) + "&limit=1&appid=" + urlEncode(g_ptrSystem->DeviceConfig().GetOpenWeatherAPIKey());
 
-        http.begin(url);
-        int httpResponseCode = http.GET();
+        // Only the coordinates are kept of what comes back; the direct lookup returns an array of matches
 
-        if (httpResponseCode <= 0)
+        StaticJsonDocument<64> filter;
+        if (configLocationIsZip)
+        {
+            filter["lat"] = true;
+            filter["lon"] = true;
+        }
+        else
+        {
+            filter[0]["lat"] = true;
+            filter[0]["lon"] = true;
+        }
+
+        auto pResponse = g_ptrSystem->HTTPService().Get(url, WEATHER_CACHE_AGE, &filter, 512);
+
+        if (!pResponse)
         {
             debugE("Error fetching coordinates for location: %s", configLocation.c_str());
-            http.end();
             return false;
         }
 
-        AllocatedJsonDocument doc(4096);
-        deserializeJson(doc, http.getString());
+        AllocatedJsonDocument doc(512);
+        deserializeJson(doc, pResponse->Data(), pResponse->Size());
         JsonObject coordinates = configLocationIsZip ? doc.as<JsonObject>() : doc[0].as<JsonObject>();
 
         strLatitude = coordinates["lat"].as<String>();
         strLongitude = coordinates["lon"].as<String>();
 
-        http.end();
-
         strLocation = configLocation;
         strCountryCode = configCountryCode;
 
@@ -273,17 +283,24 @@ private:
      */
     bool getTomorrowTemps(float& highTemp, float& lowTemp)
     {
-        HTTPClient http;
         String url = "http://api.openweathermap.org/data/2.5/forecast"
             "?lat=" + strLatitude + "&lon=" + strLongitude + "&cnt=16&appid=" + urlEncode(g_ptrSystem->DeviceConfig().GetOpenWeatherAPIKey());
-        http.begin(url);
-        int httpResponseCode = http.GET();
 
-        if (httpResponseCode > 0)
+        // Of each 3 hour slot we only keep its time, temperatures and icon, which is what keeps the document small
+
+        StaticJsonDocument<192> filter;
+        JsonObject filterEntry = filter["list"].createNestedObject();
+        filterEntry["dt"] = true;
+        filterEntry["main"]["temp_max"] = true;
+        filterEntry["main"]["temp_min"] = true;
+        filterEntry["weather"][0]["icon"] = true;
+
+        auto pResponse = g_ptrSystem->HTTPService().Get(url, WEATHER_CACHE_AGE, &filter, 3072);
+
+        if (pResponse)
         {
-            // Needs to be this large to process all the returned JSON
-            AllocatedJsonDocument doc(10240);
-            deserializeJson(doc, http.getString());
+            AllocatedJsonDocument doc(3072);
+            deserializeJson(doc, pResponse->Data(), pResponse->Size());
             JsonArray list = doc["list"];
 
             // Get tomorrow's date
@@ -336,13 +353,11 @@ private:
 
             debugI("Got tomorrow's temps: Lo %d, Hi %d, Icon %s", (int)lowTemp, (int)highTemp, iconTomorrow.c_str());
 
-            http.end();
             return true;
         }
         else
         {
             debugE("Error fetching forecast data for location: %s in country: %s", strLocation.c_str(), strCountryCode.c_str());
-            http.end();
             return false;
         }
     }
@@ -357,17 +372,23 @@ private:
      */
     bool getWeatherData()
     {
-        HTTPClient http;
-
         String url = "http://api.openweathermap.org/data/2.5/weather"
             "?lat=" + strLatitude + "&lon=" + strLongitude + "&appid=" + urlEncode(g_ptrSystem->DeviceConfig().GetOpenWeatherAPIKey());
-        http.begin(url);
-        int httpResponseCode = http.GET();
-        if (httpResponseCode > 0)
+
+        StaticJsonDocument<192> filter;
+        filter["main"]["temp"] = true;
+        filter["main"]["temp_max"] = true;
+        filter["main"]["temp_min"] = true;
+        filter["weather"][0]["icon"] = true;
+        filter["name"] = true;
+
+        auto pResponse = g_ptrSystem->HTTPService().Get(url, WEATHER_CACHE_AGE, &filter, 512);
+        if (pResponse)
         {
             iconToday = "";
-            AllocatedJsonDocument jsonDoc(4096);
-            deserializeJson(jsonDoc, http.getString());
+
+            AllocatedJsonDocument jsonDoc(512);
+            deserializeJson(jsonDoc, pResponse->Data(), pResponse->Size());
 
             // Once we have a non-zero temp we can start displaying things
             if (0 < jsonDoc["main"]["temp"])
@@ -384,13 +405,11 @@ private:
             if (pszName)
                 strLocationName = pszName;
 
-            http.end();
             return true;
         }
         else
         {
             debugE("Error fetching Weather data for location: %s in country: %s", strLocation.c_str(), strCountryCode.c_str());
-            http.end();
             return false;
         }
     }
@@ -402,11 +421,15 @@ private:
      */
     void UpdateWeather()
     {
-        while(!WiFi.isConnected())
+        // The reader workers are shared, so rather than hold one until WiFi is back, Draw() is left to try again
+
+        if (!IsWiFiConnected())
         {
-            debugW("Delaying Weather update, waiting for WiFi...");
-            vTaskDelay(pdMS_TO_TICKS(WEATHER_CHECK_WIFI_WAIT));
+            debugW("Skipping Weather update, no WiFi");
+            updateSkipped = true;
+            return;
         }
+        updateSkipped = false;
 
         // Only try to update if we have an API Key
         if (!g_ptrSystem->DeviceConfig().GetOpenWeatherAPIKey().isEmpty())
@@ -498,9 +521,9 @@ public:
 
         auto secondsSinceLastUpdate = now - latestUpdate;
 
-        // If location and/or country have changed, trigger an update regardless of timer, but
-        // not more than once every half a minute
-        if (secondsSinceLastUpdate >= WEATHER_INTERVAL_SECONDS || (HasLocationChanged() && secondsSinceLastUpdate >= 30s))
+        // If location and/or country have changed, or the last update was skipped for want of WiFi, trigger an
+        // update regardless of timer, but not more than once every half a minute
+        if (secondsSinceLastUpdate >= WEATHER_INTERVAL_SECONDS || ((HasLocationChanged() || updateSkipped) && secondsSinceLastUpdate >= 30s))
         {
             latestUpdate = now;
 
@@ -0,0 +1,156 @@
+//+--------------------------------------------------------------------------
+//
+// File:        barrenderer.h
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+//
+// Description:
+//
+//    Draws the bars of the spectrum analyzer, touching only the rows
+//    that changed since the last frame
+//
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#include <vector>
+#include "globals.h"
+#include "gfxbase.h"
+
+// BarRenderer
+//
+// A row of solid bars, each with an optional cap row.  The column span of each bar is worked out once for the bar
+// count and size.  Each frame only the rows that changed hands are written: what a body grew into or gave back, where
+// a cap was and is now, and all of a bar whose color changed.  That relies on the pixels still holding the last
+// frame, so the caller asks for a full redraw whenever something else may have drawn over them.  A full redraw paints
+// every bar but leaves the space between and above them alone, so the caller clears or fades first.
+
+class BarRenderer
+{
+  public:
+
+    // How a bar should look this frame.  Top is the first row of the body, so the height is an empty bar, and Cap
+    // is the row of the cap, or -1 for none.
+
+    struct BarState
+    {
+        int16_t Top      = 0;
+        int16_t Cap      = -1;
+        CRGB    Color    = CRGB::Black;
+        CRGB    CapColor = CRGB::Black;
+    };
+
+  private:
+
+    struct Span
+    {
+        int16_t X;
+        int16_t Width;
+    };
+
+    std::vector<Span>     _spans;
+    std::vector<BarState> _drawn;                   // How each bar looked when it was last drawn
+    int                   _width  = 0;
+    int                   _height = 0;
+
+    static void FillRows(GFXBase & gfx, const Span & span, int yStart, int yEnd, CRGB color)
+    {
+        for (int y = yStart; y < yEnd; y++)
+            for (int x = span.X; x < span.X + span.Width; x++)
+                gfx.setPixel(x, y, color);
+    }
+
+  public:
+
+    // Configure
+    //
+    // Lays cBars bars of the same width out from the left edge; any columns left over aren't drawn.  Nothing is
+    // redone if the layout is the same as before.
+
+    void Configure(size_t cBars, int width, int height)
+    {
+        if (cBars == _spans.size() && width == _width && height == _height)
+            return;
+
+        _width  = width;
+        _height = height;
+
+        int barWidth = cBars ? width / cBars : 0;
+        _spans.resize(cBars);
+        for (size_t i = 0; i < cBars; i++)
+            _spans[i] = { (int16_t)(i * barWidth), (int16_t) barWidth };
+
+        _drawn.assign(cBars, BarState { (int16_t) height, -1, CRGB::Black, CRGB::Black });
+    }
+
+    size_t BarCount() const
+    {
+        return _spans.size();
+    }
+
+    int Height() const
+    {
+        return _height;
+    }
+
+    // Draw
+    //
+    // Brings the bars from how they were last drawn to the BarCount() states in pBars
+
+    void Draw(GFXBase & gfx, const BarState * pBars, bool bFullRedraw)
+    {
+        for (size_t i = 0; i < _spans.size(); i++)
+        {
+            const Span & span = _spans[i];
+            BarState & last = _drawn[i];
+            BarState bar = pBars[i];
+
+            bar.Top = std::clamp<int16_t>(bar.Top, 0, _height);
+            if (bar.Cap >= _height)
+                bar.Cap = -1;
+
+            if (bFullRedraw || bar.Color != last.Color)
+            {
+                FillRows(gfx, span, bar.Top, _height, bar.Color);
+            }
+            else if (bar.Top < last.Top)
+            {
+                FillRows(gfx, span, bar.Top, last.Top, bar.Color);
+            }
+
+            if (!bFullRedraw)
+            {
+                if (bar.Top > last.Top)
+                    FillRows(gfx, span, last.Top, bar.Top, CRGB::Black);
+
+                // Where the cap was goes back to whatever is under it now
+
+                if (last.Cap >= 0 && last.Cap != bar.Cap)
+                    FillRows(gfx, span, last.Cap, last.Cap + 1, last.Cap >= bar.Top ? bar.Color : CRGB::Black);
+            }
+
+            // The cap is one row, and may have been drawn over by the body, so it goes out every frame
+
+            if (bar.Cap >= 0)
+                FillRows(gfx, span, bar.Cap, bar.Cap + 1, bar.CapColor);
+
+            last = bar;
+        }
+    }
+};
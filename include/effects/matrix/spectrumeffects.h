@@ -32,6 +32,7 @@
 #pragma once
 
 #include "esp_attr.h"
+#include "effects/matrix/barrenderer.h"
 #include "effects/strip/musiceffect.h"
 #include "effects/strip/particles.h"
 #include "values.h"
@@ -79,17 +80,19 @@ class InsulatorSpectrumEffect : public LEDStripEffect, public BeatEffectBase, pu
 
     virtual void Draw() override
     {
-        auto peaks = g_Analyzer.GetPeakData();
+        auto audio = g_Analyzer.GetFrameAudioSnapshot();
+        auto & peaks = audio.Peaks;
 
         for (int band = 0; band < min(NUM_BANDS, NUM_FANS); band++)
         {
             CRGB color = ColorFromPalette(_Palette, ::map(band, 0, min(NUM_BANDS, NUM_FANS), 0, 255) + beatsin8(1) );
             color = color.fadeToBlackBy(255 - 255 * peaks[band]);
-            color = color.fadeToBlackBy((2.0 - g_Analyzer._VURatio) * 228);
+            color = color.fadeToBlackBy((2.0 - audio.VURatio) * 228);
             DrawRingPixels(0, FAN_SIZE * peaks[band], color, NUM_FANS-1-band, 0);
         }
 
         ProcessAudio();
+        _maxParticles = QualityScaled<size_t>(_cLEDs, _cLEDs / 4);
         ParticleSystem<SpinningPaletteRingParticle>::Render(_GFX);
 
         fadeAllChannelsToBlackBy(min(255.0,2000.0 * g_Values.AppTime.LastFrameTime()));
@@ -116,18 +119,39 @@ class VUMeter
 {
   protected:
 
+    // The colors along the VU row, looked up once for each palette and width rather than for every pixel.  The peak
+    // is drawn in the meter's own palette whatever the bars are drawn in.  The palettes have to be ones that don't
+    // change, as they're told apart by their address.
+
+    std::vector<CRGB>     _vuColors;
+    std::vector<CRGB>     _vuPeakColors;
+    const CRGBPalette16 * _pVUPalette     = nullptr;
+    const CRGBPalette16 * _pVUPeakPalette = nullptr;
+
+    void UpdateVUColors(int xHalf, const CRGBPalette16 & palette, const CRGBPalette16 & peakPalette)
+    {
+        if ((int) _vuColors.size() == xHalf && _pVUPalette == &palette && _pVUPeakPalette == &peakPalette)
+            return;
+
+        _vuColors.resize(xHalf);
+        _vuPeakColors.resize(xHalf);
+        for (int i = 0; i < xHalf; i++)
+        {
+            _vuColors[i]     = ColorFromPalette(palette,     i * (256 / xHalf));
+            _vuPeakColors[i] = ColorFromPalette(peakPalette, i * (256 / xHalf));
+        }
+        _pVUPalette     = &palette;
+        _pVUPeakPalette = &peakPalette;
+    }
+
     // DrawVUPixels
     //
-    // Draw i-th pixel in row y
+    // Draw i-th pixel out from the middle of row y, on both sides
 
-    void DrawVUPixels(std::shared_ptr<GFXBase> pGFXChannel, int i, int yVU, int fadeBy = 0, const CRGBPalette16 * pPalette = nullptr)
+    static void DrawVUPixels(GFXBase & gfx, int xHalf, int i, int yVU, CRGB color)
     {
-        if (g_Analyzer.MicMode() == PeakData::PCREMOTE)
-            pPalette = &vuPaletteBlue;
-
-        int xHalf = pGFXChannel->width()/2;
-        pGFXChannel->setPixel(xHalf-i-1, yVU, ColorFromPalette(pPalette ? *pPalette : vu_gpGreen,  i*(256/xHalf)).fadeToBlackBy(fadeBy));
-        pGFXChannel->setPixel(xHalf+i,   yVU, ColorFromPalette(pPalette ? *pPalette : vu_gpGreen, i*(256/xHalf)).fadeToBlackBy(fadeBy));
+        gfx.setPixel(xHalf-i-1, yVU, color);
+        gfx.setPixel(xHalf+i,   yVU, color);
     }
 
 
@@ -140,45 +164,44 @@ class VUMeter
 
   public:
 
-    inline void EraseVUMeter(std::shared_ptr<GFXBase> pGFXChannel, int start, int yVU) const
-    {
-        int xHalf = pGFXChannel->width()/2;
-        for (int i = start; i <= xHalf; i++)
-        {
-            pGFXChannel->setPixel(xHalf-i,   yVU, CRGB::Black);
-            pGFXChannel->setPixel(xHalf-1+i,   yVU, CRGB::Black);
-        }
-    }
+    // The whole row is written every frame, as when the meter is drawn over another effect that effect has just
+    // drawn the row underneath
 
     void DrawVUMeter(std::shared_ptr<GFXBase> pGFXChannel, int yVU, const CRGBPalette16 * pPalette = nullptr)
     {
         const int MAX_FADE = 256;
 
-        int xHalf = pGFXChannel->width()/2-1;
-        int bars  = g_Analyzer._VURatioFade / 2.0 * xHalf; // map(g_Analyzer._VU, 0, MAX_VU/8, 1, xHalf);
-        bars = min(bars, xHalf);
-
-        EraseVUMeter(pGFXChannel, bars, yVU);
+        int xHalf = pGFXChannel->width()/2;
+        int bars  = g_Analyzer.GetFrameAudioSnapshot().VURatioFade / 2.0 * (xHalf-1); // map(g_Analyzer._VU, 0, MAX_VU/8, 1, xHalf);
+        bars = min(bars, xHalf-1);
 
         if (bars >= iPeakVUy)
         {
-            msPeakVU = millis();
+            msPeakVU = g_Values.AppTime.FrameMillis();
             iPeakVUy = bars;
         }
-        else if (millis() - msPeakVU > MS_PER_SECOND / 2)
+        else if (g_Values.AppTime.FrameMillis() - msPeakVU > MS_PER_SECOND / 2)
         {
             iPeakVUy = 0;
         }
 
-        if (iPeakVUy > 1)
+        const CRGBPalette16 * pPeakPalette = &vuPaletteGreen;
+        if (g_Analyzer.MicMode() == PeakData::PCREMOTE)
+            pPalette = pPeakPalette = &vuPaletteBlue;
+        UpdateVUColors(xHalf, pPalette ? *pPalette : vuPaletteGreen, *pPeakPalette);
+
+        uint8_t fade = std::min<int>(255, MAX_FADE * (g_Values.AppTime.FrameMillis() - msPeakVU) / (float) MS_PER_SECOND * 2);
+
+        for (int i = 0; i < xHalf; i++)
         {
-            int fade = MAX_FADE * (millis() - msPeakVU) / (float) MS_PER_SECOND * 2;
-            DrawVUPixels(pGFXChannel, iPeakVUy,   yVU, fade);
-            DrawVUPixels(pGFXChannel, iPeakVUy-1, yVU, fade);
-        }
+            CRGB color = CRGB::Black;
+            if (i < bars)
+                color = _vuColors[i];
+            else if (iPeakVUy > 1 && (i == iPeakVUy || i == iPeakVUy - 1))
+                color = CRGB(_vuPeakColors[i]).fadeToBlackBy(fade);
 
-        for (int i = 0; i < bars; i++)
-            DrawVUPixels(pGFXChannel, i, yVU, i > bars ? 255 : 0, pPalette);
+            DrawVUPixels(*pGFXChannel, xHalf, i, yVU, color);
+        }
     }
 };
 
@@ -226,6 +249,15 @@ class SpectrumAnalyzerEffect : public LEDStripEffect, virtual public VUMeter
 
     bool                _bShowVU;
 
+    AudioSnapshot       _audio;                 // Taken once per frame so every bar comes from the same pass
+
+    BarRenderer                         _bars;
+    std::vector<BarRenderer::BarState>  _barStates;
+    bool                                _bRedrawAll        = true;      // Set when the pixels can't be trusted
+    uint32_t                            _lastFrameSequence = 0;
+    const CRGB *                        _pLastLeds         = nullptr;
+    bool                                _bLastVUVisible    = false;
+
     virtual size_t DesiredFramesPerSecond() const override
     {
         return 60;
@@ -236,14 +268,14 @@ class SpectrumAnalyzerEffect : public LEDStripEffect, virtual public VUMeter
         return _fadeRate != 0;
     }
 
-    // DrawBar
+    // MeasureBar
     //
-    // Draws the bar graph rectangle for a bar and then the white line on top of it.  Interpolates odd bars when you
-    // have twice as many bars as bands.
+    // Works out the bar graph rectangle for a bar and then the white line on top of it.  Interpolates odd bars when
+    // you have twice as many bars as bands.
 
-    void DrawBar(const uint8_t iBar, CRGB baseColor)
+    BarRenderer::BarState MeasureBar(const uint8_t iBar, CRGB baseColor)
     {
-        auto pGFXChannel = g();
+        auto& pGFXChannel = g();
         int value, value2;
 
         static_assert(!(NUM_BANDS & 1));     // We assume an even number of bars because we peek ahead from an odd one below
@@ -259,18 +291,18 @@ class SpectrumAnalyzerEffect : public LEDStripEffect, virtual public VUMeter
             // bar 16, for example, it will take all of bar 4 and none of bar 5.  For bar 17, it will take 3/4 of bar 4 and 1/4 of bar 5.
 
             int ib = iBar % barsPerBand;
-            value  = (g_Analyzer._peak1Decay[iBand] * (barsPerBand - ib) + g_Analyzer._peak1Decay[iNextBand] * (ib) ) / barsPerBand * (pGFXChannel->height() - 1);
-            value2 = (g_Analyzer._peak2Decay[iBand] * (barsPerBand - ib) + g_Analyzer._peak2Decay[iNextBand] * (ib) ) / barsPerBand *  pGFXChannel->height();
+            value  = (_audio.Peak1Decay[iBand] * (barsPerBand - ib) + _audio.Peak1Decay[iNextBand] * (ib) ) / barsPerBand * (pGFXChannel->height() - 1);
+            value2 = (_audio.Peak2Decay[iBand] * (barsPerBand - ib) + _audio.Peak2Decay[iNextBand] * (ib) ) / barsPerBand *  pGFXChannel->height();
         }
         else
         {
             // One to one case, just use the actual band value we mapped to
 
-            value  = g_Analyzer._peak1Decay[iBand] * (pGFXChannel->height() - 1);
-            value2 = g_Analyzer._peak2Decay[iBand] *  pGFXChannel->height();
+            value  = _audio.Peak1Decay[iBand] * (pGFXChannel->height() - 1);
+            value2 = _audio.Peak2Decay[iBand] *  pGFXChannel->height();
         }
 
-        debugV("Band: %d, Value: %f\n", iBar, g_Analyzer._peak1Decay[iBar] );
+        debugV("Band: %d, Value: %f\n", iBar, _audio.Peak1Decay[iBand] );
 
         if (value > pGFXChannel->height())
             value = pGFXChannel->height();
@@ -278,24 +310,21 @@ class SpectrumAnalyzerEffect : public LEDStripEffect, virtual public VUMeter
         if (value2 > pGFXChannel->height())
             value2 = pGFXChannel->height();
 
-        int barWidth  = pGFXChannel->width() / _numBars;
-        int xOffset   = iBar * barWidth;
-
         // The top of the bar is normally just matrix height less the value.  Here, however, we "enhance" the bar by pulsing it a bit with
         // the beat of the music.  We do this by taking the value and subtracting a fraction of itself, which makes the bar taller when the
         // beat is higher.  We also subtract a fraction of the VU fade, which makes the bar taller when the VU is higher.  The net effect is
         // that the bar is taller when the beat is higher, and the beat is higher when the VU is higher, so the bar is taller when the VU is
         // higher.
 
-        value *= g_Analyzer.BeatEnhance(BARBEAT_ENHANCE);
-        value2 *= g_Analyzer.BeatEnhance(BARBEAT_ENHANCE);
+        value *= _audio.BeatEnhance(BARBEAT_ENHANCE);
+        value2 *= _audio.BeatEnhance(BARBEAT_ENHANCE);
 
         int yOffset   = pGFXChannel->height() - value ;
         int yOffset2  = pGFXChannel->height() - value2 ;
 
-        for (int y = yOffset2; y < pGFXChannel->height(); y++)
-            for (int x = xOffset; x < xOffset + barWidth; x++)
-                g()->setPixel(x, y, baseColor);
+        BarRenderer::BarState bar;
+        bar.Top   = std::max(0, yOffset2);
+        bar.Color = baseColor;
 
         // We draw the highlight in white, but if its falling at a different rate than the bar itself,
         // it indicates a free-floating highlight, and those get faded out based on age
@@ -311,20 +340,67 @@ class SpectrumAnalyzerEffect : public LEDStripEffect, virtual public VUMeter
             {
                 const int PeakFadeTime_ms = 1000;
 
-                unsigned long msPeakAge = millis() - g_Analyzer._lastPeak1Time[iBand];
-                if (msPeakAge > PeakFadeTime_ms)
-                    msPeakAge = PeakFadeTime_ms;
+                // The peak can be stamped after the frame started, so a negative age is taken as none
+
+                long msPeakAge = std::clamp<long>((int32_t)(g_Values.AppTime.FrameMillis() - _audio.LastPeak1Time[iBand]), 0, PeakFadeTime_ms);
 
                 float agePercent = (float) msPeakAge / (float) MS_PER_SECOND;
                 uint8_t fadeAmount = std::min(255.0f, agePercent * 256);
                 colorHighlight.fadeToBlackBy(fadeAmount);
-                pGFXChannel->drawLine(xOffset, max(0, yOffset-1), xOffset + barWidth, max(0, yOffset-1), colorHighlight);
+                bar.Cap = max(0, yOffset-1);
             }
             else
             {
-                pGFXChannel->drawLine(xOffset, max(0, yOffset2-1), xOffset + barWidth, max(0, yOffset2-1), colorHighlight);
+                bar.Cap = max(0, yOffset2-1);
             }
+            bar.CapColor = colorHighlight;
         }
+
+        return bar;
+    }
+
+    // NeedsFullRedraw
+    //
+    // The bars are only redrawn where they changed if what we drew last frame is still there to change.  It isn't
+    // after a restart, when the frame in between came from somewhere else, when we're drawing somewhere else, when
+    // something else was drawn over ours, or when every pixel fades each frame anyway.
+
+    bool NeedsFullRedraw(const std::shared_ptr<GFXBase> & pGFXChannel)
+    {
+        auto& effectManager = g_ptrSystem->EffectManager();
+        bool bFull = _bRedrawAll || _fadeRate != 0;
+
+        uint32_t frameSequence = effectManager.FrameSequence();
+        bFull |= frameSequence != _lastFrameSequence + 1;
+        _lastFrameSequence = frameSequence;
+
+        bFull |= pGFXChannel->leds != _pLastLeds;
+        _pLastLeds = pGFXChannel->leds;
+
+        // The meter draws over the top row, so that row has to be put back once it's gone
+
+        #if SHOW_VU_METER
+            bool bVUVisible = effectManager.IsVUVisible();
+            bFull |= _bLastVUVisible && !bVUVisible;
+            _bLastVUVisible = bVUVisible;
+        #endif
+
+        #if ENABLE_EFFECT_LAYERS
+            bFull |= !effectManager.Layers().empty();
+        #endif
+
+        #if ENABLE_RENDER_ZONES
+            bFull |= !effectManager.Zones().empty();
+        #endif
+
+        // The matrix back buffer isn't copied forward unless an effect needs double buffering, so it holds an older frame
+
+        #if USE_HUB75
+            bFull = true;
+        #endif
+
+        _bRedrawAll = false;
+        return bFull;
     }
 
   public:
@@ -408,6 +484,8 @@ class SpectrumAnalyzerEffect : public LEDStripEffect, virtual public VUMeter
 
         g_Analyzer._peak1DecayRate = _peak1DecayRate;
         g_Analyzer._peak2DecayRate = _peak2DecayRate;
+
+        _bRedrawAll = true;
     }
 
     virtual void Draw() override
@@ -415,6 +493,8 @@ class SpectrumAnalyzerEffect : public LEDStripEffect, virtual public VUMeter
 
         auto pGFXChannel = _GFX[0];
 
+        _audio = g_Analyzer.GetFrameAudioSnapshot();
+
         if (_scrollSpeed > 0)
         {
             EVERY_N_MILLISECONDS(_scrollSpeed)
@@ -423,11 +503,23 @@ class SpectrumAnalyzerEffect : public LEDStripEffect, virtual public VUMeter
             }
         }
 
+        _bars.Configure(_numBars, pGFXChannel->width(), pGFXChannel->height());
+        _barStates.resize(_numBars);
+
+        bool bFullRedraw = NeedsFullRedraw(pGFXChannel);
         if (_fadeRate)
             fadeAllChannelsToBlackBy(_fadeRate);
-        else
+        else if (bFullRedraw)
             pGFXChannel->Clear();
 
+        // If global colors are set, we use them
+
+        auto& deviceConfig = g_ptrSystem->DeviceConfig();
+        std::optional<CRGBPalette16> globalPalette = {};
+
+        if (!_ignoreGlobalColor && deviceConfig.ApplyGlobalColors())
+            globalPalette = CRGBPalette16(deviceConfig.GlobalColor(), deviceConfig.SecondColor());
+
         for (int i = 0; i < _numBars; i++)
         {
             // We don't use the auto-cycling palette, but we'll use the paused palette if the user has asked for one
@@ -441,21 +533,16 @@ class SpectrumAnalyzerEffect : public LEDStripEffect, virtual public VUMeter
             {
                 // We don't use the color offset when the palette is paused
                 int q = ::map(i, 0, _numBars, 0, 240);
-                DrawBar(i, pGFXChannel->ColorFromCurrentPalette(q % 240, 255, _scrollSpeed > 0 ? LINEARBLEND : NOBLEND));
+                _barStates[i] = MeasureBar(i, pGFXChannel->ColorFromCurrentPalette(q % 240, 255, _scrollSpeed > 0 ? LINEARBLEND : NOBLEND));
             }
             else
             {
-                // If global colors are set, we use them
-                auto& deviceConfig = g_ptrSystem->DeviceConfig();
-                std::optional<CRGBPalette16> globalPalette = {};
-
-                if (!_ignoreGlobalColor && deviceConfig.ApplyGlobalColors())
-                    globalPalette = CRGBPalette16(deviceConfig.GlobalColor(), deviceConfig.SecondColor());
-
                 int q = ::map(i, 0, _numBars, 0, 255) + _colorOffset;
-                DrawBar(i, ColorFromPalette(globalPalette ? *globalPalette : _palette, (q) % 255, 255, _scrollSpeed > 0 ? LINEARBLEND : NOBLEND));
+                _barStates[i] = MeasureBar(i, ColorFromPalette(globalPalette ? *globalPalette : _palette, (q) % 255, 255, _scrollSpeed > 0 ? LINEARBLEND : NOBLEND));
             }
         }
+
+        _bars.Draw(*pGFXChannel, _barStates.data(), bFullRedraw);
     }
 };
 
@@ -522,7 +609,7 @@ class WaveformEffect : public LEDStripEffect
             auto index = (x1 * dx +_iColorOffset) % 256;
             if (y >= yTop && y <= yBottom )
             {
-                uint16_t ms = millis();
+                uint16_t ms = g_Values.AppTime.FrameMillis();
                 if (y < 2 || y > (MATRIX_HEIGHT - 2))
                     color  = CRGB::Red;
                 else
@@ -718,11 +805,13 @@ class SpectrumBarEffect : public LEDStripEffect, public BeatEffectBase
         EVERY_N_MILLISECONDS(100)
             offset += _scrollIncrement;
 
+        auto audio = g_Analyzer.GetFrameAudioSnapshot();
+
         for (int iBand = 0; iBand < NUM_BANDS; iBand++)
         {
             // Draw the spike
 
-            auto value =  g_Analyzer.BeatEnhance(SPECTRUMBARBEAT_ENHANCE) * g_Analyzer._peak1Decay[iBand];
+            auto value =  audio.BeatEnhance(SPECTRUMBARBEAT_ENHANCE) * audio.Peak1Decay[iBand];
             auto top    = std::max(0.0f, halfHeight - value * halfHeight);
             auto bottom = std::min(MATRIX_HEIGHT-1.0f, halfHeight + value * halfHeight + 1);
             auto x1     = halfWidth - ((iBand * 2 + offset) % halfWidth);
@@ -174,9 +174,10 @@ private:
             }
 
             float position = Height[i] * (_cLength - 1) / StartHeight;
-            setPixelsOnAllChannels(position, _cBallSize, Colors[i % ARRAYSIZE(ballColors)]);
+            const int32_t size = _cBallSize * GFXBase::kSubpixels;
+            setPixelSpanOnAllChannels(GFXBase::ToSubpixel(position), size, Colors[i % ARRAYSIZE(ballColors)]);
             if (_bMirrored)
-                setPixelsOnAllChannels(_cLength-1-position, _cBallSize, Colors[i % ARRAYSIZE(ballColors)], true);
+                setPixelSpanOnAllChannels(GFXBase::ToSubpixel(_cLength-1-position), size, Colors[i % ARRAYSIZE(ballColors)], true);
         }
     }
 };
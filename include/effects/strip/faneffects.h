@@ -36,6 +36,7 @@
 #include "effects.h"
 #include "paletteeffect.h"
 #include "soundanalyzer.h"
+#include "effects/strip/firekernel.h"
 
 // Simple definitions of what direction we're talking about
 
@@ -105,6 +106,7 @@ inline int16_t GetRingPixelPosition(float fPos, int16_t ringSize)
 //
 // Returns the sequential strip postion of a an LED on the fans based
 // on the index and direction specified, like 32nd most TopDown pixel.
+// The directional orders come from the FanLayout tables.
 
 inline int GetFanPixelOrder(int iPos, PixelOrder order = Sequential)
 {
@@ -128,16 +130,16 @@ inline int GetFanPixelOrder(int iPos, PixelOrder order = Sequential)
   switch (order)
   {
   case BottomUp:
-    return fanBase + ((GetRingPixelPosition(fanPos, RING_SIZE_0) + LED_FAN_OFFSET_BU) % FAN_SIZE);
+    return fanBase + FanLayout::OrderedPixel(FanLayout::Direction::BottomUp, fanPos);
 
   case TopDown:
-    return fanBase + ((GetRingPixelPosition(fanPos, RING_SIZE_0) + LED_FAN_OFFSET_TD) % FAN_SIZE);
+    return fanBase + FanLayout::OrderedPixel(FanLayout::Direction::TopDown, fanPos);
 
   case LeftRight:
-    return fanBase + ((GetRingPixelPosition(fanPos, RING_SIZE_0) + LED_FAN_OFFSET_LR) % FAN_SIZE);
+    return fanBase + FanLayout::OrderedPixel(FanLayout::Direction::LeftRight, fanPos);
 
   case RightLeft:
-    return fanBase + ((GetRingPixelPosition(fanPos, RING_SIZE_0) + LED_FAN_OFFSET_RL) % FAN_SIZE);
+    return fanBase + FanLayout::OrderedPixel(FanLayout::Direction::RightLeft, fanPos);
 
   case Reverse:
     return NUM_LEDS - 1 - fanPos;
@@ -170,7 +172,7 @@ inline void ClearFanPixels(float fPos, float count, PixelOrder order = Sequentia
 
 inline int GetRingSize(int iRing)
 {
-  return g_aRingSizeTable[iRing];
+  return FanLayout::RingSize(iRing);
 }
 
 // GetFanIndex
@@ -182,45 +184,6 @@ inline int GetFanIndex(float fPos)
   return fPos / FAN_SIZE;
 }
 
-// GetRingIndex
-//
-// Ggiven the index into NUM_LEDS or FAN_SIZE, returns the index of the ring this must be on
-
-inline int GetRingIndex(float fPos)
-{
-  fPos = fmod(fPos, FAN_SIZE);
-  int iRing = 0;
-  do
-  {
-    if (fPos < GetRingSize(iRing))
-    {
-      return iRing;
-    }
-    else
-    {
-      fPos -= GetRingSize(iRing);
-      iRing++;
-    }
-  } while (iRing < NUM_RINGS);
-  return iRing;
-}
-
-// GetRingPos
-//
-// Given the index into NUM_LEDS or FAN_SIZE, returns the index of the LED on the current ring
-
-inline int GetRingPos(float fPos)
-{
-  fPos = fmod(fPos, FAN_SIZE);
-  for (int iRing = 0; iRing < NUM_RINGS; iRing++)
-  {
-    if (fPos < GetRingSize(iRing))
-      return fPos;
-    fPos -= GetRingSize(iRing);
-  }
-  return 0;
-}
-
 // DrawFanPixels
 //
 // A fan is a ring set with a single ring
@@ -291,10 +254,7 @@ inline void DrawFanPixels(float fPos, float count, CRGB color, PixelOrder order
 inline void DrawRingPixels(float fPos, float count, CRGB color, int iInsulator, int iRing, bool bMerge = true)
 {
   // bPos will be the start of this ring (relative to NUM_LEDS)
-  int bPos = 0;
-  for (int i = 0; i < iRing; i++)
-    bPos += g_aRingSizeTable[i];
-  bPos += iInsulator * FAN_SIZE;
+  int bPos = FanLayout::RingPixel(iRing, 0) + iInsulator * FAN_SIZE;
 
   if (bPos + fPos + count > NUM_LEDS + 1) // +1 because we work in the 0..1.0 range when drawing
   {
@@ -357,7 +317,7 @@ inline void DrawRingPixels(float fPos, float count, CRGB color, int iInsulator,
 
 inline void FillRingPixels(CRGB color, int iInsulator, int iRing)
 {
-  DrawRingPixels(0, g_aRingSizeTable[iRing], color, iInsulator, iRing);
+  DrawRingPixels(0, GetRingSize(iRing), color, iInsulator, iRing);
 }
 
 class EmptyEffect : public LEDStripEffect
@@ -475,8 +435,6 @@ class CountEffect : public LEDStripEffect
         if (t >= OPEN_LEN)
           t -= OPEN_LEN;
       }
-
-      FastLED.show();
     }
   }
 };
@@ -959,6 +917,7 @@ protected:
   PixelOrder Order;
 
   std::unique_ptr<uint8_t[]> abHeat; // Heat table to map temp to color
+  HeatColorTable heatColors;
 
   // When diffusing the fire upwards, these control how much to blend in from the cells below (ie: downward neighbors)
   // You can tune these coefficients to control how quickly and smoothly the fire spreads
@@ -1065,22 +1024,15 @@ public:
 
     EVERY_N_MILLISECONDS(50)
     {
-      for (int i = 0; i < CellCount(); i++)
-      {
-        int coolingAmount = random(0, Cooling);
-        abHeat[i] = ::max(0.0, abHeat[i] - coolingAmount * (2.0 - g_Analyzer._VURatio));
-      }
+      // The quieter the music, the faster it cools
+      auto scale = (uint16_t) std::clamp((2.0 - g_Analyzer._VURatio) * 256, 0.0, 65535.0);
+      CoolHeat(Random(), abHeat.get(), CellCount(), Cooling, scale);
     }
 
     EVERY_N_MILLISECONDS(20)
     {
       // Next drift heat up and diffuse it a little bit
-      for (int i = 0; i < CellCount(); i++)
-        abHeat[i] = min(255, (abHeat[i] * BlendSelf +
-                              abHeat[(i + 1) % CellCount()] * BlendNeighbor1 +
-                              abHeat[(i + 2) % CellCount()] * BlendNeighbor2 +
-                              abHeat[(i + 3) % CellCount()] * BlendNeighbor3) /
-                                 BlendTotal);
+      DiffuseHeat<BlendSelf, BlendNeighbor1, BlendNeighbor2, BlendNeighbor3>(abHeat.get(), CellCount());
     }
 
     // Randomly ignite new sparks down in the flame kernel
@@ -1089,25 +1041,29 @@ public:
     {
       for (int i = 0; i < Sparks; i++)
       {
-        if (random(255) < Sparking / 4 + Sparking * (g_Analyzer._VURatio / 2.0) * 0.5)
+        if (Random().Range(0, 255) < Sparking / 4 + Sparking * (g_Analyzer._VURatio / 2.0) * 0.5)
         {
-          int y = CellCount() - 1 - random(SparkHeight * CellsPerLED);
-          abHeat[y] = abHeat[y] + random(50, 255); // Can roll over which actually looks good!
+          int y = CellCount() - 1 - Random().Below(SparkHeight * CellsPerLED);
+          abHeat[y] = abHeat[y] + Random().Range(50, 255); // Can roll over which actually looks good!
         }
       }
     }
 
     // Finally, convert heat to a color
 
+    heatColors.Update(0, [&](uint8_t temp) { return GetBlackBodyHeatColorByte(temp); });
+
     for (int i = 0; i < LEDCount; i++)
     {
       // uint8_t maxv = 0;
       // for (int iCell = 0; iCell < CellsPerLED; iCell++)
       //   maxv = max(maxv, heat[i * CellsPerLED + iCell]);
 
+      const CRGB& heatColor = heatColors[abHeat[i * CellsPerLED]];
+
       for (int iChannel = 0; iChannel < NUM_CHANNELS; iChannel++)
       {
-        CRGB color = GetBlackBodyHeatColorByte(abHeat[i * CellsPerLED]);
+        CRGB color = heatColor;
 
         // If multicolor, we shift the hue based on the channel
         if (bMulticolor)
@@ -1271,29 +1227,31 @@ protected:
     return CRGB(val, val * .30, val * .05);
   }
 
-  // Generate a vector of how bright each of the surrounding 8 LEDs on the unit circle should be
+  // Work out how bright each of the surrounding 8 LEDs on the unit circle should be.  They're in the draw task's
+  // scratch memory, so they only last for the frame, and there are none if it's run out.
 
-  std::vector<float> led_brightness(float wandering_x, float wandering_y)
+  const float * led_brightness(float wandering_x, float wandering_y)
   {
-    const float sqrt2 = std::sqrt(2);
+    constexpr float invSqrt2 = 0.70710678f;
 
-    const std::vector<std::pair<float, float>> unit_circle_coords = {
+    static constexpr std::pair<float, float> unit_circle_coords[] = {
         {1, 0},
-        { 1 / sqrt2,  1 / sqrt2},
+        { invSqrt2,  invSqrt2},
         {0, 1},
-        {-1 / sqrt2,  1 / sqrt2},
+        {-invSqrt2,  invSqrt2},
         {-1, 0},
-        {-1 / sqrt2, -1 / sqrt2},
+        {-invSqrt2, -invSqrt2},
         {0, -1},
-        { 1 / sqrt2, -1 / sqrt2}
+        { invSqrt2, -invSqrt2}
     };
 
-    std::vector<float> brightness_values;
+    float * brightness_values = g_DrawScratch.Allocate<float>(std::size(unit_circle_coords));
+    if (!brightness_values)
+        return nullptr;
 
-    for (const auto& coord : unit_circle_coords) {
-        float d = distance(wandering_x, wandering_y, coord.first, coord.second);
-        float brightness = std::max(1.0f - d, 0.0f);
-        brightness_values.push_back(brightness);
+    for (size_t i = 0; i < std::size(unit_circle_coords); i++) {
+        float d = distance(wandering_x, wandering_y, unit_circle_coords[i].first, unit_circle_coords[i].second);
+        brightness_values[i] = std::max(1.0f - d, 0.0f);
     }
 
     return brightness_values;
@@ -1376,7 +1334,7 @@ public:
     float yRatio = map(centerY, 0.0f, maxDeviation, -1.0f, 1.0f);
 
     auto brightness = led_brightness(xRatio, yRatio);
-    for (int i = 0; i < 8; i++)
+    for (int i = 0; brightness && i < 8; i++)
     {
       CRGB pixelColor = flameColor(255 * brightness[i]);
       pixelColor.fadeToBlackBy(255 * (3.0 - brightness[i]));
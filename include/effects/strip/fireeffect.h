@@ -35,14 +35,10 @@
 #include "musiceffect.h"
 #include "soundanalyzer.h"
 #include "systemcontainer.h"
+#include "effects/strip/firekernel.h"
 
 class FireEffect : public LEDStripEffect
 {
-    void construct()
-    {
-        heat.reset( psram_allocator<uint8_t>().allocate(CellCount()) );
-    }
-
   protected:
     int     LEDCount;           // Number of LEDs total
     int     CellsPerLED;
@@ -53,7 +49,8 @@ class FireEffect : public LEDStripEffect
     bool    bReversed;          // If reversed we draw from 0 outwards
     bool    bMirrored;          // If mirrored we split and duplicate the drawing
 
-    std::unique_ptr<uint8_t []> heat;
+    effect_unique_array<uint8_t> heat;
+    HeatColorTable heatColors;
 
     // When diffusing the fire upwards, these control how much to blend in from the cells below (ie: downward neighbors)
     // You can tune these coefficients to control how quickly and smoothly the fire spreads
@@ -69,6 +66,9 @@ class FireEffect : public LEDStripEffect
 
     int CellCount() const { return LEDCount * CellsPerLED; }
 
+    // Whatever GetBlackBodyHeatColor() depends on besides the temperature, so the color table is rebuilt when it changes
+    virtual uint32_t HeatColorKey() const { return 0; }
+
   public:
 
     FireEffect(const String & strName, int ledCount = NUM_LEDS, int cellsPerLED = 1, int cooling = 20, int sparking = 100, int sparks = 3, int sparkHeight = 4,  bool breversed = false, bool bmirrored = false)
@@ -84,8 +84,6 @@ class FireEffect : public LEDStripEffect
     {
         if (bMirrored)
             LEDCount = LEDCount / 2;
-
-        construct();
     }
 
     FireEffect(const JsonObjectConst& jsonObject)
@@ -99,7 +97,6 @@ class FireEffect : public LEDStripEffect
           bReversed(jsonObject[PTY_REVERSED]),
           bMirrored(jsonObject[PTY_MIRORRED])
     {
-        construct();
     }
 
     bool SerializeToJSON(JsonObject& jsonObject) override
@@ -127,6 +124,17 @@ class FireEffect : public LEDStripEffect
     {
     }
 
+    bool AcquireState() override
+    {
+        heat = make_unique_effect_array<uint8_t>(CellCount());
+        return heat != nullptr;
+    }
+
+    void ReleaseState() override
+    {
+        heat.reset();
+    }
+
     size_t DesiredFramesPerSecond() const override
     {
         return 45;
@@ -142,10 +150,10 @@ class FireEffect : public LEDStripEffect
     {
         for (int i = 0 ; i < Sparks * multiplier; i++)
         {
-            if (random(255) < Sparking)
+            if (Random().Range(0, 255) < Sparking)
             {
-                int y = CellCount() - 1 - random(SparkHeight * CellsPerLED);
-                heat[y] = random(200, 255);   // Can roll over which actually looks good!
+                int y = CellCount() - 1 - Random().Below(SparkHeight * CellsPerLED);
+                heat[y] = Random().Range(200, 255);   // Can roll over which actually looks good!
             }
         }
     }
@@ -156,22 +164,13 @@ class FireEffect : public LEDStripEffect
 
         EVERY_N_MILLISECONDS(50)
         {
-          for (int i = 0; i < CellCount(); i++)
-          {
-            int coolingAmount = random(0, Cooling);
-            heat[i] = ::max(0, heat[i] - coolingAmount);
-          }
+            CoolHeat(Random(), heat.get(), CellCount(), Cooling);
         }
 
         EVERY_N_MILLISECONDS(20)
         {
-          // Next drift heat up and diffuse it a little bit
-          for (int i = 0; i < CellCount(); i++)
-              heat[i] = std::min(255, (heat[i] * BlendSelf +
-                        heat[(i + 1) % CellCount()] * BlendNeighbor1 +
-                        heat[(i + 2) % CellCount()] * BlendNeighbor2 +
-                        heat[(i + 3) % CellCount()] * BlendNeighbor3)
-                        / BlendTotal);
+            // Next drift heat up and diffuse it a little bit
+            DiffuseHeat<BlendSelf, BlendNeighbor1, BlendNeighbor2, BlendNeighbor3>(heat.get(), CellCount());
         }
 
         // Randomly ignite new sparks down in the flame kernel
@@ -183,6 +182,15 @@ class FireEffect : public LEDStripEffect
 
         // Finally, convert heat to a color
 
+        heatColors.Update(HeatColorKey(), [&](uint8_t temp)
+        {
+            #if LANTERN
+                return CRGB(temp, temp * .45, temp * .08);
+            #else
+                return GetBlackBodyHeatColor(temp/(float)std::numeric_limits<uint8_t>::max());
+            #endif
+        });
+
         for (int i = 0; i < LEDCount; i++)
         {
             auto sum = 0;
@@ -190,11 +198,7 @@ class FireEffect : public LEDStripEffect
                 sum += heat[i*CellsPerLED + j];
             auto avg = sum / CellsPerLED;
 
-            #if LANTERN
-                CRGB color = CRGB(avg, avg * .45, avg * .08);
-            #else
-                CRGB color = GetBlackBodyHeatColor(avg/(float)std::numeric_limits<uint8_t>::max());
-            #endif
+            const CRGB& color = heatColors[avg];
 
             // If we're reversed, we work from the end back.  We don't reverse the bonus pixels
 
@@ -216,6 +220,16 @@ class PaletteFlameEffect : public FireEffect
         _effectNumber = EFFECT_STRIP_PALETTE_FLAME;
     }
 
+    uint32_t HeatColorKey() const override
+    {
+        auto& deviceConfig = g_ptrSystem->DeviceConfig();
+        if (!deviceConfig.ApplyGlobalColors() || _ignoreGlobalColor)
+            return 0;
+
+        const CRGB& color = deviceConfig.GlobalColor();
+        return 0x1000000 | (color.r << 16) | (color.g << 8) | color.b;
+    }
+
 public:
     PaletteFlameEffect(const String & strName,
                        const CRGBPalette16 &palette,
@@ -341,6 +355,9 @@ class ClassicFireEffect : public LEDStripEffect
     bool _Reversed;
     int  _Cooling;
 
+    effect_unique_array<uint8_t> _heat;
+    HeatColorTable _heatColors;
+
 public:
 
     ClassicFireEffect(bool mirrored = false, bool reversed = false, int cooling = 5)
@@ -375,6 +392,21 @@ public:
         return jsonObject.set(jsonDoc.as<JsonObjectConst>());
     }
 
+    bool AcquireState() override
+    {
+        _heat = make_unique_effect_array<uint8_t>(_cLEDs);
+        if (!_heat)
+            return false;
+
+        std::fill_n(_heat.get(), _cLEDs, 0);
+        return true;
+    }
+
+    void ReleaseState() override
+    {
+        _heat.reset();
+    }
+
     void Draw() override
     {
         Fire(_Cooling, 180, 5);
@@ -383,22 +415,11 @@ public:
 
     void Fire(int Cooling, int Sparking, int Sparks)
     {
-        static std::unique_ptr<uint8_t []> heat = make_unique_psram_array<uint8_t>(NUM_LEDS);
+        auto heat = _heat.get();
         setAllOnAllChannels(0,0,0);
 
         // Step 1.  Cool down every cell a little
-        for (int i = 0; i < _cLEDs; i++)
-        {
-            int cooldown = random_range(0, Cooling);
-            if (cooldown > heat[i])
-            {
-                heat[i] = 0;
-            }
-            else
-            {
-                heat[i] = heat[i] - cooldown;
-            }
-        }
+        CoolHeat(Random(), heat, _cLEDs, Cooling + 1);
 
         // Step 2.  Heat from each cell drifts 'up' and diffuses a little
         for (int k = _cLEDs - 1; k >= 3; k--)
@@ -409,17 +430,18 @@ public:
         // Step 3.  Randomly ignite new 'sparks' near the bottom
         for (int frame = 0; frame < Sparks; frame++)
         {
-            if (random(255) < Sparking)
+            if (Random().Range(0, 255) < Sparking)
             {
-                int y = random(5);
-                heat[y] = heat[y] + random(160, 255); // This randomly rolls over sometimes of course, and that's essential to the effect
+                int y = Random().Below(5);
+                heat[y] = heat[y] + Random().Range(160, 255); // This randomly rolls over sometimes of course, and that's essential to the effect
             }
         }
 
         // Step 4.  Convert heat to LED colors
+        _heatColors.Update(0, RampHeatColor);
         for (int j = 0; j < _cLEDs; j++)
         {
-            setPixelHeatColor(j, heat[j]);
+            setPixelWithMirror(j, _heatColors[heat[j]]);
         }
     }
 
@@ -442,7 +464,7 @@ public:
         }
     }
 
-    void setPixelHeatColor(int Pixel, uint8_t temperature)
+    static CRGB RampHeatColor(uint8_t temperature)
     {
         // Scale 'heat' down from 0-255 to 0-191
         uint8_t t192 = round((temperature / 255.0) * 191);
@@ -454,15 +476,15 @@ public:
         // figure out which third of the spectrum we're in:
         if (t192 > 0x80)
         { // hottest
-            setPixelWithMirror(Pixel, CRGB(255, 255, heatramp));
+            return CRGB(255, 255, heatramp);
         }
         else if (t192 > 0x40)
         { // middle
-            setPixelWithMirror(Pixel, CRGB(255, heatramp, 0));
+            return CRGB(255, heatramp, 0);
         }
         else
         { // coolest
-            setPixelWithMirror(Pixel, CRGB(heatramp, 0, 0));
+            return CRGB(heatramp, 0, 0);
         }
     }
 
@@ -544,9 +566,8 @@ public:
         return jsonObject.set(jsonDoc.as<JsonObjectConst>());
     }
 
-    bool Init(std::vector<std::shared_ptr<GFXBase>>& gfx) override
+    bool AcquireState() override
     {
-        LEDStripEffect::Init(gfx);
         _Temperatures = (float *)PreferPSRAMAlloc(sizeof(float) * _cLEDs);
         if (!_Temperatures)
         {
@@ -556,6 +577,12 @@ public:
         return true;
     }
 
+    void ReleaseState() override
+    {
+        free(_Temperatures);
+        _Temperatures = nullptr;
+    }
+
     ~SmoothFireEffect()
     {
         free(_Temperatures);
@@ -566,7 +593,7 @@ public:
         float deltaTime = (float)g_Values.AppTime.LastFrameTime();
         setAllOnAllChannels(0, 0, 0);
 
-        float cooldown = random_range(0.0f, _Cooling) * deltaTime;
+        float cooldown = Random().Range(0.0f, _Cooling) * deltaTime;
 
         for (int i = 0; i < _cLEDs; i++)
             if (cooldown > _Temperatures[i])
@@ -595,11 +622,11 @@ public:
         // Randomly ignite new 'sparks' near the bottom
         for (int frame = 0; frame < _Sparks; frame++)
         {
-            if (random_range(0.0f, 1.0f) < 0.70f)
+            if (Random().Float() < 0.70f)
             {
                 // NB: This randomly rolls over sometimes of course, and that's essential to the effect
-                int y = random_range(0, _SparkHeight);
-                _Temperatures[y] = (_Temperatures[y] + random_range(0.6f, 1.0f));
+                int y = Random().Range(0, _SparkHeight + 1);
+                _Temperatures[y] = (_Temperatures[y] + Random().Range(0.6f, 1.0f));
 
                 if (!_Turbo)
                     while (_Temperatures[y] > 1.0f)
@@ -630,11 +657,6 @@ public:
 
 class BaseFireEffect : public LEDStripEffect
 {
-    void construct()
-    {
-        heat = std::make_unique<uint8_t []>(CellCount);
-    }
-
   protected:
     int     Cooling;            // Rate at which the pixels cool off
     int     Sparks;             // How many sparks will be attempted each frame
@@ -646,7 +668,7 @@ class BaseFireEffect : public LEDStripEffect
     int     LEDCount;           // Number of LEDs total
     int     CellCount;          // How many heat cells to represent entire flame
 
-    std::unique_ptr<uint8_t []> heat;
+    effect_unique_array<uint8_t> heat;
 
     // When diffusing the fire upwards, these control how much to blend in from the cells below (ie: downward neighbors)
     // You can tune these coefficients to control how quickly and smoothly the fire spreads
@@ -671,8 +693,6 @@ class BaseFireEffect : public LEDStripEffect
     {
         LEDCount = bMirrored ? ledCount / 2 : ledCount;
         CellCount = LEDCount * cellsPerLED;
-
-        construct();
     }
 
     BaseFireEffect(const JsonObjectConst& jsonObject)
@@ -686,13 +706,27 @@ class BaseFireEffect : public LEDStripEffect
           LEDCount(jsonObject[PTY_LEDCOUNT]),
           CellCount(jsonObject["clc"])
     {
-        construct();
     }
 
     virtual ~BaseFireEffect()
     {
     }
 
+    bool AcquireState() override
+    {
+        heat = make_unique_effect_array<uint8_t>(CellCount);
+        if (!heat)
+            return false;
+
+        std::fill_n(heat.get(), CellCount, 0);
+        return true;
+    }
+
+    void ReleaseState() override
+    {
+        heat.reset();
+    }
+
     bool SerializeToJSON(JsonObject& jsonObject) override
     {
         StaticJsonDocument<LEDStripEffect::_jsonSize + 128> jsonDoc;
@@ -734,7 +768,7 @@ class BaseFireEffect : public LEDStripEffect
 
     void Draw() override
     {
-        FastLED.showColor(CRGB::Red);
+        fillSolidOnAllChannels(CRGB::Red);
         return;
         FastLED.clear(false);
         DrawFire();
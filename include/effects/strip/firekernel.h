@@ -0,0 +1,112 @@
+//+--------------------------------------------------------------------------
+//
+// File:        firekernel.h
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+//
+// Description:
+//
+//    The heat simulation the fire effects share: cooling, the drift of
+//    heat along the strip, and a table from heat to color
+//
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#include "globals.h"
+#include "effectrandom.h"
+
+// CoolHeat
+//
+// Takes a random amount below maxCooling off every cell, scaled by scale / 256 if given.  The amounts come from the
+// effect's own generator a block of cells at a time, two cells to a number.
+
+inline void CoolHeat(EffectRandom & random, uint8_t * heat, int count, int maxCooling, uint16_t scale = 256)
+{
+    constexpr int kBlock = 32;
+    uint16_t randoms[kBlock];
+
+    for (int start = 0; start < count; start += kBlock)
+    {
+        int cells = std::min(kBlock, count - start);
+        random.Fill(randoms, cells * sizeof(randoms[0]));
+
+        for (int i = 0; i < cells; i++)
+        {
+            int amount = (((uint32_t) randoms[i] * maxCooling) >> 16) * scale >> 8;
+            heat[start + i] = std::max(0, heat[start + i] - amount);
+        }
+    }
+}
+
+// DiffuseHeat
+//
+// Each cell becomes a weighted blend of itself and the three cells above it, done in place and wrapping around at
+// the end the way the fire effects always have.  Only the last three cells wrap, so the rest go without a modulo,
+// and with the weights fixed at compile time the blend is a few shifts and adds.
+
+template <uint8_t Self, uint8_t Neighbor1, uint8_t Neighbor2, uint8_t Neighbor3>
+inline void DiffuseHeat(uint8_t * heat, int count)
+{
+    constexpr uint Total = Self + Neighbor1 + Neighbor2 + Neighbor3;
+
+    auto blend = [](uint self, uint n1, uint n2, uint n3) -> uint8_t
+    {
+        return std::min<uint>(255, (self * Self + n1 * Neighbor1 + n2 * Neighbor2 + n3 * Neighbor3) / Total);
+    };
+
+    int i = 0;
+    for (; i < count - 3; i++)
+        heat[i] = blend(heat[i], heat[i + 1], heat[i + 2], heat[i + 3]);
+
+    for (; i < count; i++)
+        heat[i] = blend(heat[i], heat[(i + 1) % count], heat[(i + 2) % count], heat[(i + 3) % count]);
+}
+
+// HeatColorTable
+//
+// The color for each of the 256 heat levels, worked out once rather than for every pixel on every frame.  The key
+// says what the colors depend on, and the table is only rebuilt when it changes.
+
+class HeatColorTable
+{
+    CRGB     _colors[256];
+    uint32_t _key    = 0;
+    bool     _bValid = false;
+
+  public:
+
+    template <typename ColorOf>
+    void Update(uint32_t key, ColorOf colorOf)
+    {
+        if (_bValid && key == _key)
+            return;
+
+        for (int i = 0; i < 256; i++)
+            _colors[i] = colorOf((uint8_t) i);
+
+        _key    = key;
+        _bValid = true;
+    }
+
+    const CRGB & operator[](uint8_t heat) const
+    {
+        return _colors[heat];
+    }
+};
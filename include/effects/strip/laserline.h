@@ -58,10 +58,25 @@ public:
         return true;
     }
 
+    // The shot is a run of single pixel spans from the same fractional start, handed over a batch at a time
+
     virtual void Draw(std::shared_ptr<GFXBase> pGFX)
     {
-        for (float d = 0; d < _size && d + _position < NUM_LEDS; d++)
-            pGFX->setPixelsF(_position + d, 1.0, CHSV(_hue + d, 255, 255), true);
+        GFXBase::PixelSpan spans[16];
+        size_t count = 0;
+        const int32_t start = GFXBase::ToSubpixel(_position);
+
+        for (int d = 0; d < _size && d + _position < NUM_LEDS; d++)
+        {
+            spans[count++] = { start + d * GFXBase::kSubpixels, GFXBase::kSubpixels, CHSV(_hue + d, 255, 255) };
+            if (count == ARRAYSIZE(spans))
+            {
+                pGFX->setPixelSpans(spans, count, true);
+                count = 0;
+            }
+        }
+        if (count)
+            pGFX->setPixelSpans(spans, count, true);
     }
 };
 
@@ -33,11 +33,11 @@
 
 class MeteorChannel
 {
-    std::vector<float> hue;
-    std::vector<float> iPos;
-    std::vector<bool>  bLeft;
-    std::vector<float> speed;
-    std::vector<float> lastBeat;
+    effect_vector<float> hue;
+    effect_vector<float> iPos;
+    effect_vector<bool>  bLeft;
+    effect_vector<float> speed;
+    effect_vector<float> lastBeat;
 
 public:
 
@@ -94,14 +94,16 @@ public:
         hsv.val = 255;
         hsv.sat = 240;
 
-        for (int j = 0; j<pGFX->GetLEDCount(); j++)                         // fade brightness all LEDs one step
+        // Fade brightness all LEDs one step, in one pass over the buffer unless each pixel rolls for it
+
+        if (!meteorRandomDecay)
+            pGFX->fadeAllToBlackBy(meteorTrailDecay);
+        else
         {
-            if ((!meteorRandomDecay) || (random_range(0, 10)>2))            // BUGBUG Was 5 for everything before atomlight
-            {
-                CRGB c = pGFX->getPixel(j);
-                c.fadeToBlackBy(meteorTrailDecay);
-                pGFX->setPixel(j, c);
-            }
+            for (int j = 0; j<pGFX->GetLEDCount(); j++)
+                if (random_range(0, 10)>2)                                  // BUGBUG Was 5 for everything before atomlight
+                    pGFX->pixelUnchecked(j).fadeToBlackBy(meteorTrailDecay);
+            pGFX->MarkAllDirty();
         }
 
         for (int i = 0; i < meteorCount; i++)
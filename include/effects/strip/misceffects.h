@@ -65,6 +65,8 @@ class SimpleRainbowTestEffect : public LEDStripEffect
         debugV("SimpleRainbowTestEffect JSON constructor");
     }
 
+    EFFECT_CLONE_BY_COPY(SimpleRainbowTestEffect)
+
     bool SerializeToJSON(JsonObject& jsonObject) override
     {
         StaticJsonDocument<LEDStripEffect::_jsonSize> jsonDoc;
@@ -115,6 +117,8 @@ class RainbowTwinkleEffect : public LEDStripEffect
         debugV("RainbowFill JSON constructor");
     }
 
+    EFFECT_CLONE_BY_COPY(RainbowTwinkleEffect)
+
     bool SerializeToJSON(JsonObject& jsonObject) override
     {
         StaticJsonDocument<LEDStripEffect::_jsonSize> jsonDoc;
@@ -133,10 +137,10 @@ class RainbowTwinkleEffect : public LEDStripEffect
     void Draw() override
     {
         static float hue = 0.0f;
-        static unsigned long lastms = millis();
+        static unsigned long lastms = g_Values.AppTime.FrameMillis();
 
-        unsigned long msElapsed = millis() - lastms;
-        lastms = millis();
+        unsigned long msElapsed = g_Values.AppTime.FrameMillis() - lastms;
+        lastms = g_Values.AppTime.FrameMillis();
 
         hue += (float) msElapsed / _speedDivisor;
         hue = fmod(hue, 256.0f);
@@ -180,6 +184,8 @@ protected:
         debugV("RainbowFill JSON constructor");
     }
 
+    EFFECT_CLONE_BY_COPY(RainbowFillEffect)
+
     bool SerializeToJSON(JsonObject& jsonObject) override
     {
         StaticJsonDocument<LEDStripEffect::_jsonSize> jsonDoc;
@@ -198,10 +204,10 @@ protected:
     void Draw() override
     {
         static float hue = 0.0f;
-        static unsigned long lastms = millis();
+        static unsigned long lastms = g_Values.AppTime.FrameMillis();
 
-        unsigned long msElapsed = millis() - lastms;
-        lastms = millis();
+        unsigned long msElapsed = g_Values.AppTime.FrameMillis() - lastms;
+        lastms = g_Values.AppTime.FrameMillis();
 
         hue += (float) msElapsed / _speedDivisor;
         hue = fmod(hue, 256.0);
@@ -247,6 +253,8 @@ protected:
         debugV("Color Fill JSON constructor");
     }
 
+    EFFECT_CLONE_BY_COPY(ColorFillEffect)
+
     bool SerializeToJSON(JsonObject& jsonObject) override
     {
         StaticJsonDocument<LEDStripEffect::_jsonSize> jsonDoc;
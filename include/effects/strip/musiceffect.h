@@ -49,8 +49,17 @@
 class BeatEffectBase
 {
   protected:
+#if ENABLE_ONSET_DETECTION
+    static constexpr unsigned long kMaxBeatAgeMs = 250;     // Older beats than this went by while we weren't drawing
+    uint32_t _beatsSeen = 0;                                // How far into the analyzer's beats we've read
+  #if ENABLE_AUDIO_LATENCY
+    bool _bLeadBeats = false;                               // Set by effects that flash ahead for a steady tempo
+    uint32_t _msLeadBeat = 0;                               // When the last beat we flashed ahead for was due to be heard
+  #endif
+#else
     const int _maxSamples = 60;
     std::deque<float> _samples;
+#endif
     double _lastBeat = 0;
     float _minRange = 0;
     float _minElapsed = 0;
@@ -65,16 +74,111 @@ class BeatEffectBase
     }
 
     // When a beat is detected, this is called.  The 'bMajor' indicates whether this is a more important beat, which
-    // for now simply means it's been a minimum delay since the last beat.
+    // with onset detection means one driven by the bass, and is never set by the older VU based detector.
 
     virtual void HandleBeat(bool bMajor, float elapsed, float span) = 0;
 
     double SecondsSinceLastBeat()
     {
-      return g_Values.AppTime.CurrentTime() - _lastBeat;
+      return g_Values.AppTime.FrameSeconds() - _lastBeat;
     }
 
 
+#if ENABLE_ONSET_DETECTION
+
+    // BeatEffectBase::ProcessAudio
+    //
+    // The analyzer does the detecting, once per audio pass.  Here we just pick up any beats it found since our last
+    // look and call the virtual "HandleBeat" function for each that passes our own sensitivity.  The span handed on
+    // is the beat's strength over the detection threshold, capped to the 0-2 range the VU based detector used, so
+    // a _minRange above 1.0 asks for beats that clear the threshold by that much.
+
+    virtual void ProcessAudio()
+    {
+        auto audio = g_Analyzer.GetAudioSnapshot();
+
+        if (audio.BeatCount - _beatsSeen > AudioSnapshot::kBeatHistory)
+            _beatsSeen = audio.BeatCount - AudioSnapshot::kBeatHistory;
+
+        for (; _beatsSeen != audio.BeatCount; _beatsSeen++)
+        {
+            const auto & beat = audio.Beats[_beatsSeen % AudioSnapshot::kBeatHistory];
+            if ((int32_t)(g_Values.AppTime.FrameMillis() - beat.Timestamp) > (int32_t) kMaxBeatAgeMs)
+                continue;
+
+            #if ENABLE_AUDIO_LATENCY
+                if (_bLeadBeats && BeatWasLed(beat, audio.BeatInterval()))
+                    continue;
+            #endif
+
+            double elapsed = SecondsSinceLastBeat();
+            float span = std::min(2.0f, beat.Strength);
+            if (span < _minRange || elapsed < _minElapsed)
+                continue;
+
+            debugV("Beat: elapsed: %0.2lf, span: %0.2lf, major: %d\n", elapsed, span, beat.Major);
+
+            HandleBeat(beat.Major, elapsed, span);
+            _lastBeat = g_Values.AppTime.FrameSeconds();
+        }
+
+        #if ENABLE_AUDIO_LATENCY
+            if (_bLeadBeats)
+                LeadBeat(audio);
+        #endif
+    }
+
+#if ENABLE_AUDIO_LATENCY
+
+    // When a beat was heard, going by when it was found and how long the analyzer takes to find one
+
+    static uint32_t BeatHeardMillis(const BeatEvent & beat)
+    {
+        return beat.Timestamp - g_AudioLatency.CaptureToPublishMicros() / 1000;
+    }
+
+    // BeatEffectBase::LeadBeat
+    //
+    // With a steady tempo the next beat can be seen coming, so rather than flash a pipeline's worth late we flash
+    // for it once the frame being drawn would be seen as it's heard.  Only one beat is ever led ahead of the last
+    // real one, so a tempo that stops costs at most one flash.
+
+    void LeadBeat(const AudioSnapshot & audio)
+    {
+        uint32_t interval = audio.BeatInterval();
+        if (!interval)
+            return;
+
+        const auto & last = audio.Beats[(audio.BeatCount - 1) % AudioSnapshot::kBeatHistory];
+        uint32_t msDue = BeatHeardMillis(last) + interval;
+        if (msDue == _msLeadBeat)
+            return;
+
+        uint32_t msSeen = g_Values.AppTime.FrameMillis() + g_AudioLatency.DrawToLightMicros() / 1000;
+        if ((int32_t)(msSeen - msDue) < 0 || (int32_t)(msSeen - msDue) > (int32_t) kMaxBeatAgeMs)
+            return;
+
+        double elapsed = SecondsSinceLastBeat();
+        float span = std::min(2.0f, last.Strength);
+        if (span < _minRange || elapsed < _minElapsed)
+            return;
+
+        HandleBeat(last.Major, elapsed, span);
+        _lastBeat = g_Values.AppTime.FrameSeconds();
+        _msLeadBeat = msDue;
+    }
+
+    // Whether a beat just found is one we already flashed ahead for
+
+    bool BeatWasLed(const BeatEvent & beat, uint32_t interval) const
+    {
+        return _msLeadBeat && abs((int32_t)(BeatHeardMillis(beat) - _msLeadBeat)) < (int32_t) std::max<uint32_t>(interval / 4, 1);
+    }
+
+#endif
+
+#else
+
     // BeatEffectBase::Draw
     //
     // Doesn't actually "draw" anything, but rather it scans the audio VU to detect beats, and when it finds one,
@@ -110,11 +214,13 @@ class BeatEffectBase
               debugV("Beat: elapsed: %0.2lf, range: %0.2lf\n", elapsed, maximum - minimum);
 
               HandleBeat(false, elapsed, maximum - minimum);
-              _lastBeat = g_Values.AppTime.CurrentTime();
+              _lastBeat = g_Values.AppTime.FrameSeconds();
               _samples.clear();
             }
         }
     }
+
+#endif
 };
 
 // InsulatorColorBeatEffect
@@ -187,11 +293,17 @@ class SimpleColorBeat : public BeatEffectBase, public LEDStripEffect
     SimpleColorBeat(const String & strName)
       : BeatEffectBase(0.5, 0.25), LEDStripEffect(EFFECT_STRIP_SIMPLE_COLOR_BEAT, strName)
     {
+        #if ENABLE_ONSET_DETECTION && ENABLE_AUDIO_LATENCY
+            _bLeadBeats = true;
+        #endif
     }
 
     SimpleColorBeat(const JsonObjectConst& jsonObject)
       : BeatEffectBase(0.5, 0.25), LEDStripEffect(jsonObject)
     {
+        #if ENABLE_ONSET_DETECTION && ENABLE_AUDIO_LATENCY
+            _bLeadBeats = true;
+        #endif
     }
 };
 
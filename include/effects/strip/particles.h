@@ -24,7 +24,8 @@
 // Description:
 //
 //   Classes for moving and fading little render objects over time,
-//   used as a base for the star and insulator effects
+//   used as a base for the star and insulator effects, and the
+//   ParticlePool that keeps the particles themselves
 //
 // History:     Jul-7-2021         Davepl      Commented
 //
@@ -47,7 +48,7 @@ class Lifespan
 
   public:
 
-    Lifespan() :_birthTime(g_Values.AppTime.FrameStartTime())
+    Lifespan() :_birthTime(g_Values.AppTime.FrameSeconds())
     {
     }
 
@@ -56,7 +57,7 @@ class Lifespan
 
     double Age() const
     {
-        return g_Values.AppTime.FrameStartTime() - _birthTime;
+        return g_Values.AppTime.FrameSeconds() - _birthTime;
     }
 
     virtual double TotalLifetime() const = 0;
@@ -93,6 +94,54 @@ public:
     {
         _iPos += _velocity * g_Values.AppTime.LastFrameTime();
     }
+
+    float Velocity() const
+    {
+        return _velocity;
+    }
+};
+
+// ParticleLifecycle
+//
+// How long each stage of a particle's life lasts, and how faded it is at a given age
+
+struct ParticleLifecycle
+{
+    float Preignition = 0.0f;
+    float Ignition    = 0.5f;
+    float Hold        = 1.0f;
+    float Fade        = 1.5f;
+
+    float Total() const
+    {
+        return Preignition + Ignition + Hold + Fade;
+    }
+
+    bool IsIgniting(float age) const
+    {
+        return age >= Preignition && age < Preignition + Ignition;
+    }
+
+    // Same curve as FadingObject::FadeoutAmount: 0 is full brightness, 1 all faded out
+
+    float FadeoutAmount(float age) const
+    {
+        if (age < 0)
+            age = 0;
+
+        if (age < Preignition && Preignition != 0.0f)
+            return 1.0 - (age / Preignition);
+        age -= Preignition;
+        if (age < Ignition && Ignition != 0.0f)
+            return (age / Ignition);
+        age -= Ignition;
+        if (age < Hold)
+            return 0.0f;
+        if (age > Hold + Fade)
+            return 1.0f;
+        age -= Hold;
+        return (age / Fade);
+    }
 };
 
 // FadingObject
@@ -116,6 +165,11 @@ class FadingObject : public Lifespan
         return PreignitionTime() + IgnitionTime() + HoldTime() + FadeTime();
     }
 
+    ParticleLifecycle Lifecycle() const
+    {
+        return { PreignitionTime(), IgnitionTime(), HoldTime(), FadeTime() };
+    }
+
     virtual float FadeoutAmount() const
     {
         float age = Age();
@@ -173,6 +227,11 @@ class FadingColoredObject : public FadingObject
     {
     }
 
+    CRGB BaseColor() const
+    {
+        return _baseColor;
+    }
+
     virtual CRGB ObjectColor() const
     {
         if (Age() >= PreignitionTime() && Age() < IgnitionTime() + PreignitionTime())
@@ -237,6 +296,12 @@ class FadingPaletteObject : public FadingObject
     {
         return _colorIndex;
     }
+
+    // The color it has when it's neither igniting nor faded at all
+    CRGB BaseColor() const
+    {
+        return ColorFromPalette(_palette, _colorIndex, 255, _blendType);
+    }
 };
 
 
@@ -297,7 +362,8 @@ template <typename Type = DrawableParticle> class ParticleSystem
 {
   protected:
 
-    std::deque<Type> _allParticles;
+    effect_deque<Type> _allParticles;
+    size_t _maxParticles = 0;                   // Most kept at once, the oldest going first; 0 for one per LED
 
     // Once per frame we are called to update all particles, which includes aging out old ones
 
@@ -314,7 +380,8 @@ template <typename Type = DrawableParticle> class ParticleSystem
         while (_allParticles.size() > 0 && _allParticles.front().Age() >= _allParticles.front().TotalLifetime())
             _allParticles.pop_front();
 
-        while (_allParticles.size() > _gfx[0]->GetLEDCount())
+        size_t maxParticles = _maxParticles ? _maxParticles : _gfx[0]->GetLEDCount();
+        while (_allParticles.size() > maxParticles)
             _allParticles.pop_front();
 
         for(auto i = _allParticles.begin(); i != _allParticles.end(); i++)
@@ -322,80 +389,304 @@ template <typename Type = DrawableParticle> class ParticleSystem
     }
 };
 
-class RingParticle : public FadingColoredObject
+// ParticlePool
+//
+// A fixed number of particles, kept as one array per property rather than as objects, so a frame's worth of them is
+// aged, moved and drawn in a few tight loops over memory that's allocated once.  An age is kept rather than a birth
+// time, so nothing asks the clock per particle and the sums stay in the single precision the FPU has.
+//
+// Ring particles use the position for the ring and the group for the insulator they light, or -1 for all of them.
+
+class ParticlePool
 {
-  protected:
+  public:
+
+    // How a particle's color changes over its life
+    enum class ColorStyle : uint8_t
+    {
+        Palette,                // Flashes white while igniting, then fades its color (FadingPaletteObject)
+        Colored,                // Flashes white over its color while igniting, then fades it (FadingColoredObject)
+        HotWhite                // Cools from white through yellow and red as it fades
+    };
+
+  private:
 
-    int             _iInsulator;
-    int             _iRing;
-    float           _ignitionTime;
-    float           _fadeTime;
+    size_t _capacity = 0;
+    size_t _count    = 0;
+
+    effect_unique_array<float>             _position;
+    effect_unique_array<float>             _velocity;
+    effect_unique_array<float>             _age;
+    effect_unique_array<float>             _size;
+    effect_unique_array<CRGB>              _color;
+    effect_unique_array<ParticleLifecycle> _lifecycle;
+    effect_unique_array<int16_t>           _group;
 
   public:
 
-    RingParticle(int iInsulator, int iRing, CRGB color, float ignitionTime = 0.0f, float fadeTime = 1.0f)
-      :  FadingColoredObject(color),
-         _iInsulator(iInsulator),
-         _iRing(iRing),
-         _ignitionTime(ignitionTime),
-         _fadeTime(fadeTime)
+    bool Allocate(size_t capacity)
     {
-        assert(iRing <= NUM_RINGS);
-        assert(iInsulator < NUM_FANS);
-        debugV("Creating particle at insulator %d", iInsulator);
+        _count    = 0;
+        _capacity = capacity;
+
+        _position  = make_unique_effect_array<float>(capacity);
+        _velocity  = make_unique_effect_array<float>(capacity);
+        _age       = make_unique_effect_array<float>(capacity);
+        _size      = make_unique_effect_array<float>(capacity);
+        _color     = make_unique_effect_array<CRGB>(capacity);
+        _lifecycle = make_unique_effect_array<ParticleLifecycle>(capacity);
+        _group     = make_unique_effect_array<int16_t>(capacity);
+
+        if (!_position || !_velocity || !_age || !_size || !_color || !_lifecycle || !_group)
+        {
+            Release();
+            return false;
+        }
+        return true;
     }
 
-    virtual void Render(const std::vector<std::shared_ptr<GFXBase>>& _GFX)
+    void Release()
     {
-        debugV("Particle Render at insulator %d", _iInsulator);
+        _count = _capacity = 0;
+        _position.reset();
+        _velocity.reset();
+        _age.reset();
+        _size.reset();
+        _color.reset();
+        _lifecycle.reset();
+        _group.reset();
+    }
+
+    size_t Count() const
+    {
+        return _count;
+    }
+
+    bool IsFull() const
+    {
+        return _count >= _capacity;
+    }
+
+    // Spawn
+    //
+    // Adds a particle, or returns false if the pool is full, which drops the newest as the starry nights always
+    // have.  The ring effects, which aged out their oldest rings instead, call EvictOldest() first.
+
+    bool Spawn(float position, float velocity, float size, CRGB color, const ParticleLifecycle & lifecycle, int16_t group = 0)
+    {
+        if (IsFull())
+            return false;
+
+        _position[_count]  = position;
+        _velocity[_count]  = velocity;
+        _age[_count]       = 0.0f;
+        _size[_count]      = size;
+        _color[_count]     = color;
+        _lifecycle[_count] = lifecycle;
+        _group[_count]     = group;
+        _count++;
+        return true;
+    }
+
+    // EvictOldest
+    //
+    // Removes the particle that was spawned first, keeping the rest in order
+
+    void EvictOldest()
+    {
+        if (_count == 0)
+            return;
+
+        _count--;
+        memmove(_position.get(),  _position.get() + 1,  _count * sizeof(_position[0]));
+        memmove(_velocity.get(),  _velocity.get() + 1,  _count * sizeof(_velocity[0]));
+        memmove(_age.get(),       _age.get() + 1,       _count * sizeof(_age[0]));
+        memmove(_size.get(),      _size.get() + 1,      _count * sizeof(_size[0]));
+        memmove(_color.get(),     _color.get() + 1,     _count * sizeof(_color[0]));
+        memmove(_lifecycle.get(), _lifecycle.get() + 1, _count * sizeof(_lifecycle[0]));
+        memmove(_group.get(),     _group.get() + 1,     _count * sizeof(_group[0]));
+    }
+
+    // Advance
+    //
+    // Ages and moves every particle by the frame time
+
+    void Advance(float deltaTime)
+    {
+        for (size_t i = 0; i < _count; i++)
+        {
+            _age[i]      += deltaTime;
+            _position[i] += _velocity[i] * deltaTime;
+        }
+    }
+
+    // Cull
+    //
+    // Removes the particles that have lived out their lifecycle, keeping the rest in the order they were spawned in
 
-        if (_iInsulator < 0)    // -1 is a major beat, all insulators
+    void Cull()
+    {
+        size_t kept = 0;
+        for (size_t i = 0; i < _count; i++)
         {
-          CRGB c = ObjectColor();
+            if (_age[i] >= _lifecycle[i].Total())
+                continue;
 
-          //c.fadeToBlackBy(192);
+            if (kept != i)
+            {
+                _position[kept]  = _position[i];
+                _velocity[kept]  = _velocity[i];
+                _age[kept]       = _age[i];
+                _size[kept]      = _size[i];
+                _color[kept]     = _color[i];
+                _lifecycle[kept] = _lifecycle[i];
+                _group[kept]     = _group[i];
+            }
+            kept++;
+        }
+        _count = kept;
+    }
 
-          for (int i = 0; i < NUM_FANS; i++)
-          {
+    float Position(size_t i) const  { return _position[i]; }
+    float Size(size_t i)     const  { return _size[i];     }
+    int16_t Group(size_t i)  const  { return _group[i];    }
 
-            FillRingPixels(c, i, _iRing);
-          }
+    // Color
+    //
+    // The color of one particle at its current age
+
+    CRGB Color(size_t i, ColorStyle style) const
+    {
+        const auto & lifecycle = _lifecycle[i];
+        float age = _age[i];
+
+        if (lifecycle.IsIgniting(age))
+        {
+            CRGB c = CRGB::White;
+            if (style == ColorStyle::Palette)
+                fadeToBlackBy(&c, 1, 255 * lifecycle.FadeoutAmount(age));
+            else if (style == ColorStyle::Colored)
+            {
+                c.fadeToBlackBy(255 - ((age - lifecycle.Preignition) / lifecycle.Ignition * 255));
+                c += _color[i];
+            }
+            return c;
         }
-        else    // Individual ring for a minor beat
+
+        CRGB c = _color[i];
+
+        if (style == ColorStyle::HotWhite)
         {
-          FillRingPixels(ObjectColor(), _iInsulator, _iRing);
+            float fadeAge = age - lifecycle.Preignition - lifecycle.Ignition;
+            uint8_t temperature = 255 * (1.0 - (fadeAge / lifecycle.Fade));
+            uint8_t t192 = round((temperature / 255.0) * 191);
+            uint8_t heatramp = (t192 & 0x3F) << 2;
+
+            if (t192 > 0x80)
+                c = CRGB(255, 255, heatramp);
+            else if (t192 > 0x40)
+                c = CRGB(255, heatramp, 0);
+            else
+                c = CRGB(heatramp, 0, 0);
         }
+
+        fadeToBlackBy(&c, 1, 255 * lifecycle.FadeoutAmount(age));
+        return c;
     }
 
-    float PreignitionTime() const override         { return 0.0f;          }
-    float IgnitionTime()    const override         { return _ignitionTime; }
-    float HoldTime()        const override         { return 0.0f;          }
-    float FadeTime()        const override         { return _fadeTime;     }
+    // RenderStrip
+    //
+    // Draws each particle centered on its position, merged with what's already there
+
+    void RenderStrip(GFXBase & gfx, ColorStyle style) const
+    {
+        for (size_t i = 0; i < _count; i++)
+            gfx.setPixelsF(_position[i] - _size[i] / 2.0f, _size[i], Color(i, style), true);
+    }
+
+    // RenderRings
+    //
+    // Fills the ring each particle is on, on its insulator or on all of them
+
+    void RenderRings(ColorStyle style) const
+    {
+        for (size_t i = 0; i < _count; i++)
+        {
+            CRGB c = Color(i, style);
+            int iRing = (int) _position[i];
+
+            if (_group[i] < 0)
+                for (int iInsulator = 0; iInsulator < NUM_FANS; iInsulator++)
+                    FillRingPixels(c, iInsulator, iRing);
+            else
+                FillRingPixels(c, _group[i], iRing);
+        }
+    }
 };
 
+// RingParticleEffect
+//
+// What the beat effects that light whole rings share: a pool of ring particles that's aged and culled each frame,
+// with as many of them as there are pixels
+
+class RingParticleEffect
+{
+  protected:
+
+    ParticlePool _particles;
+
+    void LightRing(int iInsulator, int iRing, CRGB color, float ignitionTime, float fadeTime)
+    {
+        assert(iRing <= NUM_RINGS);
+        assert(iInsulator < NUM_FANS);
+        debugV("Creating particle at insulator %d", iInsulator);
+
+        // A new beat ages out the oldest ring, as it did before the pool, rather than being lost
+        if (_particles.IsFull())
+            _particles.EvictOldest();
+
+        _particles.Spawn(iRing, 0.0f, 1.0f, color, { 0.0f, ignitionTime, 0.0f, fadeTime }, iInsulator);
+    }
+
+    void RenderRings(ParticlePool::ColorStyle style)
+    {
+        _particles.Advance(g_Values.AppTime.LastFrameTime());
+        _particles.Cull();
+        _particles.RenderRings(style);
+    }
+};
 
 #if ENABLE_AUDIO
-class ColorBeatWithFlash : public BeatEffectBase, public ParticleSystem<RingParticle>, LEDStripEffect
+class ColorBeatWithFlash : public BeatEffectBase, public RingParticleEffect, LEDStripEffect
 {
     int _iLastInsulator = 0;
     CRGB _baseColor = CRGB::Black;
 
   public:
 
-    ColorBeatWithFlash(const String & strName) : BeatEffectBase(), ParticleSystem<RingParticle>(), LEDStripEffect(EFFECT_STRIP_COLOR_BEAT_WITH_FLASH, strName)
+    ColorBeatWithFlash(const String & strName) : BeatEffectBase(), RingParticleEffect(), LEDStripEffect(EFFECT_STRIP_COLOR_BEAT_WITH_FLASH, strName)
+    {
+    }
+
+    ColorBeatWithFlash(const JsonObjectConst& jsonObject) : BeatEffectBase(), RingParticleEffect(), LEDStripEffect(jsonObject)
     {
     }
 
-    ColorBeatWithFlash(const JsonObjectConst& jsonObject) : BeatEffectBase(), ParticleSystem<RingParticle>(), LEDStripEffect(jsonObject)
+    bool AcquireState() override
     {
+        return _particles.Allocate(_cLEDs);
+    }
+
+    void ReleaseState() override
+    {
+        _particles.Release();
     }
 
     virtual void LightInsulator(int iInsulator, int iRing, CRGB color, bool bMajor)
     {
       debugV("MusicalInsulatorEffect2 LightInsulator for Insulator %d", iInsulator);
 
-      RingParticle newparticle(iInsulator, iRing, color, !bMajor ? 0.05 : 0.0, 0.75);
-      _allParticles.push_back(newparticle);
+      LightRing(iInsulator, iRing, color, !bMajor ? 0.05 : 0.0, 0.75);
     }
 
     virtual void HandleBeat(bool bMajor, float elapsed, float span) override
@@ -426,11 +717,11 @@ class ColorBeatWithFlash : public BeatEffectBase, public ParticleSystem<RingPart
       _baseColor.fadeToBlackBy(8 * g_Analyzer._VURatio);
       setAllOnAllChannels(_baseColor.r, _baseColor.g, _baseColor.b);
       BeatEffectBase::ProcessAudio();
-      ParticleSystem<RingParticle>::Render(_GFX);
+      RenderRings(ParticlePool::ColorStyle::Colored);
     }
 };
 
-class ColorBeatOverRed : public LEDStripEffect, public BeatEffectBase, public ParticleSystem<RingParticle>
+class ColorBeatOverRed : public LEDStripEffect, public BeatEffectBase, public RingParticleEffect
 {
     int  _iLastInsulator = 0;
     CRGB _baseColor = CRGB::Black;
@@ -440,15 +731,25 @@ class ColorBeatOverRed : public LEDStripEffect, public BeatEffectBase, public Pa
     ColorBeatOverRed(const String & strName)
       : LEDStripEffect(EFFECT_STRIP_COLOR_BEAT_OVER_RED, strName),
         BeatEffectBase(1.75, 0.2),
-        ParticleSystem<RingParticle>()
+        RingParticleEffect()
     {
     }
 
     ColorBeatOverRed(const JsonObjectConst& jsonObject)
       : LEDStripEffect(jsonObject),
         BeatEffectBase(1.75, 0.2),
-        ParticleSystem<RingParticle>()
+        RingParticleEffect()
+    {
+    }
+
+    bool AcquireState() override
     {
+        return _particles.Allocate(_cLEDs);
+    }
+
+    void ReleaseState() override
+    {
+        _particles.Release();
     }
 
     virtual void HandleBeat(bool bMajor, float elapsed, float span) override
@@ -466,7 +767,7 @@ class ColorBeatOverRed : public LEDStripEffect, public BeatEffectBase, public Pa
         float fadetime = min(5.0, elapsed * 1.5);   // Cap it at 5 seconds so we don't get ultra-long beats resulting from delays
         float flashtime = 0;
 
-        _allParticles.push_back(RingParticle(iInsulator, 0, RandomSaturatedColor(), flashtime, fadetime));
+        LightRing(iInsulator, 0, RandomSaturatedColor(), flashtime, fadetime);
     }
 
     virtual void Draw() override
@@ -482,7 +783,7 @@ class ColorBeatOverRed : public LEDStripEffect, public BeatEffectBase, public Pa
 
       _baseColor = CRGB(500 * amount, 0, 0);
       setAllOnAllChannels(_baseColor.r, _baseColor.g, _baseColor.b);
-      ParticleSystem<RingParticle>::Render(_GFX);
+      RenderRings(ParticlePool::ColorStyle::Colored);
 
     }
 };
@@ -615,78 +916,6 @@ class SpinningPaletteRingParticle : public FadingObject
 };
 
 
-class HotWhiteRingParticle : public FadingObject
-{
-  protected:
-
-    int             _iInsulator;
-    int             _iRing;
-    float           _ignitionTime;
-    float           _fadeTime;
-
-  public:
-
-    HotWhiteRingParticle(int iInsulator, int iRing, float ignitionTime = 0.25f, float fadeTime = 1.0f)
-      :  _iInsulator(iInsulator),
-         _iRing(iRing),
-         _ignitionTime(ignitionTime),
-         _fadeTime(fadeTime)
-    {
-        assert(iRing <= NUM_RINGS);
-        assert(iInsulator < NUM_FANS);
-        debugV("Creating particle at insulator %d", iInsulator);
-    }
-
-    virtual void Render(const std::vector<std::shared_ptr<GFXBase>>& _GFX)
-    {
-        debugV("Particle Render at insulator %d", _iInsulator);
-
-        CRGB c = CRGB::White;
-
-        if (Age() >= PreignitionTime() && Age() < IgnitionTime() + PreignitionTime())
-        {
-            c = CRGB::White;
-            //c.fadeToBlackBy(255 - ((Age() - PreignitionTime()) / IgnitionTime() * 255));
-        }
-        else
-        {
-          float age = Age() - PreignitionTime() - IgnitionTime();
-
-          uint8_t temperature = 255 * (1.0 - (age/FadeTime()));
-          uint8_t t192 = round((temperature/255.0)*191);
-
-          // calculate ramp up from
-          uint8_t heatramp = t192 & 0x3F; // 0..63
-          heatramp <<= 2; // scale up to 0..252
-
-          if( t192 > 0x80)                      // hottest
-              c = CRGB(255, 255, heatramp);
-          else if( t192 > 0x40 )                // middle
-              c = CRGB( 255, heatramp, 0);
-          else                                  // coolest
-              c = CRGB( heatramp, 0, 0);
-          fadeToBlackBy(&c, 1, 255 * FadeoutAmount());
-        }
-
-        if (_iInsulator < 0)    // -1 is a major beat, all insulators
-        {
-            for (int i = 0; i < NUM_FANS; i++)
-            {
-              FillRingPixels(c, i, _iRing);
-            }
-        }
-        else    // Individual ring for a minor beat
-        {
-          FillRingPixels(c, _iInsulator, _iRing);
-        }
-    }
-
-    float PreignitionTime() const override         { return 0.0f;          }
-    float IgnitionTime()    const override         { return _ignitionTime; }
-    float HoldTime()        const override         { return 0.0f;          }
-    float FadeTime()        const override         { return _fadeTime;     }
-};
-
 #if ENABLE_AUDIO
 
 
@@ -778,6 +1007,7 @@ class MoltenGlassOnVioletBkgnd : public LEDStripEffect, public BeatEffectBase, p
       setAllOnAllChannels(_baseColor.r, _baseColor.g, _baseColor.b);
 
       BeatEffectBase::ProcessAudio();
+      _maxParticles = QualityScaled<size_t>(_cLEDs, _cLEDs / 4);
       ParticleSystem<SpinningPaletteRingParticle>::Render(_GFX);
     }
 };
@@ -869,6 +1099,7 @@ class NewMoltenGlassOnVioletBkgnd : public LEDStripEffect, public BeatEffectBase
       _baseColor.fadeToBlackBy((min(255.0, 1000.0 * g_Values.AppTime.LastFrameTime())));
       setAllOnAllChannels(_baseColor.r, _baseColor.g, _baseColor.b);
 
+      _maxParticles = QualityScaled<size_t>(_cLEDs, _cLEDs / 4);
       ParticleSystem<SpinningPaletteRingParticle>::Render(_GFX);
     }
 };
@@ -933,24 +1164,35 @@ class SparklySpinningMusicEffect : public LEDStripEffect, public BeatEffectBase,
       setAllOnAllChannels(_baseColor.r, _baseColor.g, _baseColor.b);
 
       BeatEffectBase::ProcessAudio();
+      _maxParticles = QualityScaled<size_t>(_cLEDs, _cLEDs / 4);
       ParticleSystem<SpinningPaletteRingParticle>::Render(_GFX);
       delay(20);
     }
 };
 
-class MusicalHotWhiteInsulatorEffect : public LEDStripEffect, public BeatEffectBase, public ParticleSystem<HotWhiteRingParticle>
+class MusicalHotWhiteInsulatorEffect : public LEDStripEffect, public BeatEffectBase, public RingParticleEffect
 {
     int  _iLastInsulator = 0;
     CRGB _baseColor      = CRGB::Black;
 
   public:
 
-    MusicalHotWhiteInsulatorEffect(const String & strName) : LEDStripEffect(EFFECT_STRIP_MUSICAL_HOT_WHITE_INSULATOR, strName), BeatEffectBase(), ParticleSystem<HotWhiteRingParticle>()
+    MusicalHotWhiteInsulatorEffect(const String & strName) : LEDStripEffect(EFFECT_STRIP_MUSICAL_HOT_WHITE_INSULATOR, strName), BeatEffectBase(), RingParticleEffect()
+    {
+    }
+
+    MusicalHotWhiteInsulatorEffect(const JsonObjectConst& jsonObject) : LEDStripEffect(jsonObject), BeatEffectBase(), RingParticleEffect()
+    {
+    }
+
+    bool AcquireState() override
     {
+        return _particles.Allocate(_cLEDs);
     }
 
-    MusicalHotWhiteInsulatorEffect(const JsonObjectConst& jsonObject) : LEDStripEffect(jsonObject), BeatEffectBase(), ParticleSystem<HotWhiteRingParticle>()
+    void ReleaseState() override
     {
+        _particles.Release();
     }
 
     virtual void HandleBeat(bool bMajor, float elapsed, float span) override
@@ -962,7 +1204,7 @@ class MusicalHotWhiteInsulatorEffect : public LEDStripEffect, public BeatEffectB
         } while (NUM_FANS > 3 && iInsulator == _iLastInsulator);
         _iLastInsulator = iInsulator;
 
-        _allParticles.push_back(HotWhiteRingParticle(iInsulator, 0, 0.25, 0.75));
+        LightRing(iInsulator, 0, CRGB::White, 0.25, 0.75);
     }
 
     virtual void Draw() override
@@ -979,7 +1221,7 @@ class MusicalHotWhiteInsulatorEffect : public LEDStripEffect, public BeatEffectB
       setAllOnAllChannels(0,0,0);
 
       BeatEffectBase::ProcessAudio();
-      ParticleSystem<HotWhiteRingParticle>::Render(_GFX);
+      RenderRings(ParticlePool::ColorStyle::HotWhite);
       delay(20);
     }
 };
@@ -270,7 +270,7 @@ class ColorCycleStar : public Star
 
     virtual CRGB Render(TBlendType blend)
     {
-        CRGB c = ColorFromPalette(_palette, millis() / 2048.0f, _brightness, blend);
+        CRGB c = ColorFromPalette(_palette, g_Values.AppTime.FrameMillis() / 2048.0f, _brightness, blend);
         fadeToBlackBy(&c, 1, 255 * FadeoutAmount());
         return c;
     }
@@ -413,12 +413,14 @@ template <typename ObjectType> class BeatStarterEffect : public BeatEffectBase
 
 // StarryNightEffect template
 //
-// Generates up to
+// Spawns stars of the given type across the strip, as many as the music and the probability call for.  The star
+// classes just describe a kind of star: one is built to pick the speed, color and lifecycle of each new star, and
+// the star itself lives in the ParticlePool from then on.
 
 template <typename StarType> class StarryNightEffect : public LEDStripEffect
 {
   protected:
-    std::deque<StarType>         _allParticles;
+    ParticlePool                 _particles;
     const CRGBPalette16         _palette;
     float                        _newStarProbability;
     float                        _starSize;
@@ -487,6 +489,16 @@ template <typename StarType> class StarryNightEffect : public LEDStripEffect
         return jsonObject.set(jsonDoc.as<JsonObjectConst>());
     }
 
+    bool AcquireState() override
+    {
+        return _particles.Allocate(std::max<size_t>(cMaxStars, _cLEDs));
+    }
+
+    void ReleaseState() override
+    {
+        _particles.Release();
+    }
+
     virtual float StarSize()
     {
         return _starSize;
@@ -512,12 +524,15 @@ template <typename StarType> class StarryNightEffect : public LEDStripEffect
 
             if (g_Analyzer._VU > 0)
             {
-                if (random_range(0.0, kProbabilitySpan) < g_Values.AppTime.LastFrameTime() * prob)
+                if (_particles.IsFull())
+                    break;
+
+                if (Random().Range(0.0f, (float) kProbabilitySpan) < g_Values.AppTime.LastFrameTime() * prob)
                 {
                     StarType newstar(_palette, _blendType, _maxSpeed * _musicFactor, _starSize);
                     // This always starts stars on even pixel boundaries so they look like the desired width if not moving
-                    newstar._iPos = (int) random_range(0U, _cLEDs-1-starWidth);
-                    _allParticles.push_back(newstar);
+                    float position = (int) Random().Below(_cLEDs-starWidth);
+                    _particles.Spawn(position, newstar.Velocity(), newstar._objectSize, newstar.BaseColor(), newstar.Lifecycle());
                 }
             }
         }
@@ -526,17 +541,14 @@ template <typename StarType> class StarryNightEffect : public LEDStripEffect
 
     virtual void Update()
     {
-        // Any particles that have lived their lifespan can be removed.  They should be found at the back of the array
-        while (_allParticles.size() > 0 && (_allParticles.front().Age() >= _allParticles.front().TotalLifetime()))
-            _allParticles.pop_front();
-
-        // If we've created too many stars, prune the newest first, before they get painted
-        while (_allParticles.size() > cMaxStars)
-            _allParticles.pop_back();
+        // The stars that have lived their lifespan can be removed.  The pool doesn't take more than it has room for,
+        // so there's never more to prune.
+        _particles.Cull();
     }
 
     void Draw() override
     {
+        _particles.Advance(g_Values.AppTime.LastFrameTime());
         CreateStars();
         Update();
 
@@ -550,14 +562,8 @@ template <typename StarType> class StarryNightEffect : public LEDStripEffect
             fadeAllChannelsToBlackBy(55 * (2.0 - g_Analyzer._VURatioFade));
         }
 
-        //Serial.printf("Stars: %d Deltatime: %lf\n", _allParticles.size(), g_AppTime.DeltaTime());
-        for(auto i = _allParticles.begin(); i != _allParticles.end(); i++)
-        {
-            i->UpdatePosition();
-            float fPos = i->_iPos;
-            CRGB c = i->ObjectColor();
-            g()->setPixelsF(fPos - i->_objectSize / 2.0, i->_objectSize, c, true);
-        }
+        //Serial.printf("Stars: %d Deltatime: %lf\n", _particles.Count(), g_AppTime.DeltaTime());
+        _particles.RenderStrip(*g(), ParticlePool::ColorStyle::Palette);
     }
 };
 
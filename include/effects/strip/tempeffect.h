@@ -139,7 +139,7 @@ class VUInsulatorsEffect : public LEDStripEffect
 
       if (iPeakVUy > 0)
       {
-        int fade = MAX_FADE * ((millis() - msPeakVU) / (float) MILLIS_PER_SECOND);
+        int fade = MAX_FADE * ((g_Values.AppTime.FrameMillis() - msPeakVU) / (float) MILLIS_PER_SECOND);
         fade = min(fade, MAX_FADE);
         DrawVUPixels(iPeakVUy, fade, vu_gpGreen);
       }
@@ -147,10 +147,10 @@ class VUInsulatorsEffect : public LEDStripEffect
       int bars = ::map(g_Analyzer._VU, g_Analyzer._MinVU, 150.0, 1, _cLEDs - 1);
       if (bars >= iPeakVUy)
       {
-        msPeakVU = millis();
+        msPeakVU = g_Values.AppTime.FrameMillis();
         iPeakVUy = bars;
       }
-      else if (millis() - msPeakVU > MILLIS_PER_SECOND * 1)
+      else if (g_Values.AppTime.FrameMillis() - msPeakVU > MILLIS_PER_SECOND * 1)
       {
         iPeakVUy = 0;
       }
@@ -226,14 +226,13 @@ const CRGBPalette16 USAColors_p =
 
 const CRGBPalette16 rainbowPalette(RainbowColors_p);
 
-extern DRAM_ATTR std::unique_ptr<EffectFactories> g_ptrEffectFactories;
-
 // Adds a default and JSON effect factory for a specific effect number and type.
 //   All parameters beyond effectNumber and effectType will be passed on to the default effect constructor.
+//   These are only used in the effect list in effects.cpp, which the compiler runs to fill in the factory tables.
 #define ADD_EFFECT(effectNumber, effectType, ...) \
-    g_ptrEffectFactories->AddEffect(effectNumber, \
-        []()                                 ->std::shared_ptr<LEDStripEffect> { return make_shared_psram<effectType>(__VA_ARGS__); }, \
-        [](const JsonObjectConst& jsonObject)->std::shared_ptr<LEDStripEffect> { return make_shared_psram<effectType>(jsonObject); }\
+    factories.AddEffect(effectNumber, \
+        []()                                 ->std::shared_ptr<LEDStripEffect> { return make_shared_effect<effectType>(__VA_ARGS__); }, \
+        [](const JsonObjectConst& jsonObject)->std::shared_ptr<LEDStripEffect> { return make_shared_effect<effectType>(jsonObject); }\
     )
 
 // Adds a default and JSON effect factory for a specific effect number/type.
@@ -248,8 +247,8 @@ std::shared_ptr<LEDStripEffect> CreateStarryNightEffectFromJSON(const JsonObject
 // Adds a default and JSON effect factory for a StarryNightEffect with a specific star type.
 //   All parameters beyond starType will be passed on to the default StarryNightEffect constructor for the indicated star type.
 #define ADD_STARRY_NIGHT_EFFECT(starType, ...) \
-    g_ptrEffectFactories->AddEffect(EFFECT_STRIP_STARRY_NIGHT, \
-        []()                                 ->std::shared_ptr<LEDStripEffect> { return make_shared_psram<StarryNightEffect<starType>>(__VA_ARGS__); }, \
+    factories.AddEffect(EFFECT_STRIP_STARRY_NIGHT, \
+        []()                                 ->std::shared_ptr<LEDStripEffect> { return make_shared_effect<StarryNightEffect<starType>>(__VA_ARGS__); }, \
         [](const JsonObjectConst& jsonObject)->std::shared_ptr<LEDStripEffect> { return CreateStarryNightEffectFromJSON(jsonObject); }\
     )
 
@@ -0,0 +1,163 @@
+//+--------------------------------------------------------------------------
+//
+// File:        effectsync.h
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+//
+// Description:
+//
+//    Keeps the local effects on several nodes in step.  One node, the
+//    leader, picks the effects as it always would, and sends what it's
+//    drawing to EFFECT_SYNC_GROUP every EFFECT_SYNC_INTERVAL ms:
+//
+//      uint32_t  magic         ascii "NDES"
+//      uint16_t  version       EFFECT_SYNC_VERSION
+//      uint16_t  effect        index of the effect in the effect list
+//      uint32_t  sequence      counts the packets
+//      uint32_t  seed          what the RNGs were seeded with as it started
+//      uint64_t  start         when it started, in microseconds since 1970
+//                              on the leader's clock
+//      int16_t   palette       palette index, or -1 for none
+//      uint16_t  bands         how many audio peaks follow, 0 without audio
+//      float     peaks[bands]
+//
+//    The leader sends a new effect as soon as it starts, and the
+//    followers start it when the leader's start time comes round on the
+//    synced clock, from the same seed.  They take the
+//    leader's palette and peaks, and run the frame times against the
+//    leader's clock, which with ENABLE_CLOCK_SYNC they sync to by trading
+//    timestamps with the leader.  The leader answers those on the clock
+//    sync port.  The effects are only the same on every node as far as
+//    they take their randomness and time from the RNGs and the app time:
+//    one that reads millis() or the hardware RNG itself drifts apart.
+//
+//    The list of effects has to be the same on every node, as only the
+//    index goes out.  A follower that hears nothing from the leader for
+//    EFFECT_SYNC_TIMEOUT ms goes back to picking its own.
+//
+//    With ENABLE_ESPNOW the same packets go over the ESP-NOW link instead
+//    (see espnowlink.h), and the sockets here aren't used.
+//
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <netinet/in.h>
+#include "globals.h"
+
+#if ENABLE_EFFECT_SYNC
+
+#if !ENABLE_WIFI
+    #error ENABLE_EFFECT_SYNC requires ENABLE_WIFI
+#endif
+
+#define EFFECT_SYNC_HEADER      (0x5345444E)                                    // ascii "NDES" as header
+#define EFFECT_SYNC_VERSION     1
+
+struct __attribute__((packed)) EffectSyncPacket
+{
+    uint32_t Magic;
+    uint16_t Version;
+    uint16_t EffectIndex;
+    uint32_t Sequence;
+    uint32_t Seed;
+    uint64_t StartMicros;
+    int16_t  PaletteIndex;
+    uint16_t BandCount;
+    float    Peaks[NUM_BANDS];                      // Only BandCount of them are sent
+};
+
+// EffectSync
+//
+// The leader's side sends the state and answers the clock sync requests; the follower's side takes the latest state
+// in and leaves it for the drawing thread, which is the only one that starts effects.
+
+class EffectSync
+{
+    int                _fd      = -1;               // Sends the state, or receives it on a follower
+    int                _fdClock = -1;               // Leader only: answers clock sync requests
+    struct sockaddr_in _group   = {};
+    uint32_t           _sequence = 0;
+    uint64_t           _sentStartMicros = 0;        // Leader only: the start time in the last state sent
+
+    // What the follower last heard, handed over to the drawing thread
+
+    std::mutex         _mutex;
+    EffectSyncPacket   _latest = {};
+    bool               _bHeard = false;             // There's a packet in _latest that the drawing thread hasn't seen
+    unsigned long      _msLastHeard = 0;
+
+    // What the drawing thread last started
+
+    uint32_t           _startedSeed    = 0;
+    uint64_t           _startedMicros  = 0;
+    int16_t            _startedPalette = -1;
+    EffectSyncPacket   _pending = {};               // An effect the leader started that's waiting for its start time
+    bool               _bPending = false;
+
+    void StartPending();
+
+    void SendState();
+    void AnswerClockSync();
+    bool ReceiveState();
+
+  public:
+
+    // BuildState and TakeState
+    //
+    // The leader's state as it goes out, returning how much of the packet to send, and a follower taking in a packet
+    // of cbPacket bytes from whichever way it came.  TakeState returns false if it isn't a state packet.
+
+    size_t BuildState(EffectSyncPacket & packet);
+    bool TakeState(const EffectSyncPacket & packet, size_t cbPacket);
+
+    std::atomic<uint32_t> _cSent     { 0 };
+    std::atomic<uint32_t> _cReceived { 0 };
+    std::atomic<uint32_t> _cStarted  { 0 };         // Effects a follower started because the leader did
+
+    ~EffectSync()
+    {
+        release();
+    }
+
+    void release();
+
+    // begin
+    //
+    // Opens the sockets, joining the group on a follower.  Returns false if they couldn't be opened.
+
+    bool begin();
+
+    // SyncLoop
+    //
+    // The leader sends its state and answers clock sync; a follower takes in the leader's state.  Returns when WiFi
+    // drops or a socket fails.
+
+    void SyncLoop();
+
+    // Called by the draw loop every frame, before the frame's time is taken.  On a follower it starts the effect the
+    // leader is on when that changes, on the first frame at or past the leader's start time, and sets the app time
+    // to the leader's clock.
+
+    void ApplyToFrame();
+};
+
+#endif
@@ -0,0 +1,183 @@
+//+--------------------------------------------------------------------------
+//
+// File:        effectworkers.h
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+// Description:
+//
+//    A few tasks, shared by every effect, that run the effects' background
+//    work from a queue
+//
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <Arduino.h>
+#include <freertos/event_groups.h>
+#include "globals.h"
+
+class LEDStripEffect;
+
+// EffectWorkerPool
+//
+// Effects queue their background work here rather than each starting a task of its own, so however many effects
+// are loaded, and however often they're copied, there are never more than EFFECT_WORKERS stacks for it.  Work is
+// run to completion, in the order it was queued, so anything that comes round again should queue itself anew or
+// be a network reader instead.
+
+class EffectWorkerPool
+{
+  public:
+
+    using Work = std::function<void(LEDStripEffect&)>;
+
+  private:
+
+    static_assert(EFFECT_WORKERS <= 24, "An event group only has 24 bits, one for each effect worker");
+
+    struct Job
+    {
+        LEDStripEffect * pEffect;
+        Work             work;
+        const char *     Name;
+    };
+
+    std::mutex         _mutex;
+    std::deque<Job>    _jobs;                               // Only touched with the mutex held, as is _running
+    LEDStripEffect *   _running[EFFECT_WORKERS] = {};       // The effect each worker is running work for, if any
+    SemaphoreHandle_t  _semQueued  = xSemaphoreCreateCounting(EFFECT_WORK_QUEUE_LENGTH, 0);
+    EventGroupHandle_t _evtIdle    = xEventGroupCreate();   // A bit for each worker, set while it's between jobs
+
+    static inline thread_local int t_worker = -1;           // The index of the calling worker, if it's one
+
+  public:
+
+    EffectWorkerPool()
+    {
+        xEventGroupSetBits(_evtIdle, (1 << EFFECT_WORKERS) - 1);
+    }
+
+    // Queue
+    //
+    // Returns false if the queue is full
+
+    bool Queue(Work work, LEDStripEffect * pEffect, const char * name)
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+
+        if (_jobs.size() >= EFFECT_WORK_QUEUE_LENGTH)
+        {
+            debugW("No room in the effect work queue for %s", name);
+            return false;
+        }
+
+        _jobs.push_back({ pEffect, std::move(work), name });
+        xSemaphoreGive(_semQueued);
+        return true;
+    }
+
+    // CancelAll
+    //
+    // Drops everything queued for the effect and waits for what's running for it to finish, so the effect can be
+    // destroyed once this returns.  Work that's running for the effect on the calling worker isn't waited for.
+
+    void CancelAll(LEDStripEffect * pEffect)
+    {
+        {
+            std::lock_guard<std::mutex> guard(_mutex);
+            _jobs.erase(std::remove_if(_jobs.begin(), _jobs.end(), [pEffect](const Job & job) { return job.pEffect == pEffect; }), _jobs.end());
+        }
+
+        // The workers are waited for one at a time, as one that finishes for this effect can take on another
+        // effect's job and clear its bit again before the next one is done.  Each sets its bit as it finishes,
+        // so this blocks rather than polls; should the bit have come and gone before the wait, it's only until
+        // that other job finishes.  Nothing more for the effect can start meanwhile, as its queue is gone and the
+        // effect is on its way out.
+        for (int i = 0; i < EFFECT_WORKERS; i++)
+        {
+            if (i == t_worker)
+                continue;
+
+            for (;;)
+            {
+                {
+                    std::lock_guard<std::mutex> guard(_mutex);
+                    if (_running[i] != pEffect)
+                        break;
+                }
+                xEventGroupWaitBits(_evtIdle, 1 << i, pdFALSE, pdTRUE, portMAX_DELAY);
+            }
+        }
+    }
+
+    size_t QueueDepth()
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        return _jobs.size();
+    }
+
+    // RunWorker
+    //
+    // The loop each of the worker tasks runs, as the index'th of them
+
+    void RunWorker(size_t index)
+    {
+        t_worker = index;
+
+        for (;;)
+        {
+            xSemaphoreTake(_semQueued, portMAX_DELAY);
+
+            Job job;
+            {
+                std::lock_guard<std::mutex> guard(_mutex);
+
+                // A job canceled before it started leaves its count behind in the semaphore
+                if (_jobs.empty())
+                    continue;
+
+                job = std::move(_jobs.front());
+                _jobs.pop_front();
+
+                _running[index] = job.pEffect;
+                xEventGroupClearBits(_evtIdle, 1 << index);
+            }
+
+            debugV("Effect worker %zu running %s", index, job.Name);
+            job.work(*job.pEffect);
+
+            std::lock_guard<std::mutex> guard(_mutex);
+            _running[index] = nullptr;
+            xEventGroupSetBits(_evtIdle, 1 << index);
+        }
+    }
+
+    static void WorkerEntry(void * pIndex);
+};
+
+extern EffectWorkerPool g_EffectWorkers;
+
+inline void EffectWorkerPool::WorkerEntry(void * pIndex)
+{
+    g_EffectWorkers.RunWorker((size_t) pIndex);
+}
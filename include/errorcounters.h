@@ -0,0 +1,105 @@
+//+--------------------------------------------------------------------------
+//
+// File:        errorcounters.h
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+// Description:
+//
+//    Counts the errors the drawing and display paths recover from, so
+//    they can carry on without throwing and still show up in /statistics
+//
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include "globals.h"
+
+enum class ErrorCounter : uint8_t
+{
+    PixelOutOfRange,            // A checked pixel accessor was given a pixel that isn't on the matrix or strip
+    HexRowOutOfRange,           // A hexagon row past the last one
+    InvalidCore,                // CPU usage asked for a core the chip doesn't have
+    InvalidInfoPage,            // The screen was asked for a page it doesn't have
+    MissingGIF,                 // An animated GIF effect's index isn't in the GIF map
+    Count
+};
+
+// ErrorCounters
+//
+// One counter per kind of error.  The counters stick at their maximum rather than wrap, and are constant
+// initialized, so they can be counted from anywhere from the first line of setup() on.
+
+class ErrorCounters
+{
+    std::atomic<uint32_t> _counts[(size_t) ErrorCounter::Count] = {};
+
+  public:
+
+    static const char * Name(ErrorCounter counter)
+    {
+        static const char * const names[] =
+        {
+            "PIXEL_OUT_OF_RANGE",
+            "HEX_ROW_OUT_OF_RANGE",
+            "INVALID_CORE",
+            "INVALID_INFO_PAGE",
+            "MISSING_GIF"
+        };
+        static_assert(sizeof(names) / sizeof(names[0]) == (size_t) ErrorCounter::Count, "Every error counter needs a name");
+
+        return names[(size_t) counter];
+    }
+
+    // Counts one error of the kind, and returns true if it's the first, so the caller can log that one
+    bool Count(ErrorCounter counter)
+    {
+        auto& count = _counts[(size_t) counter];
+        uint32_t current = count.load(std::memory_order_relaxed);
+
+        do
+        {
+            if (current == UINT32_MAX)
+                return false;
+        }
+        while (!count.compare_exchange_weak(current, current + 1, std::memory_order_relaxed));
+
+        return current == 0;
+    }
+
+    uint32_t Get(ErrorCounter counter) const
+    {
+        return _counts[(size_t) counter].load(std::memory_order_relaxed);
+    }
+};
+
+extern ErrorCounters g_ErrorCounters;
+
+// COUNT_ERROR
+//
+// Counts the error, and only formats and logs the message the first time it happens, so an error that repeats on
+// every pixel of every frame costs an increment rather than a string
+
+#define COUNT_ERROR(counter, ...)                       \
+    do                                                  \
+    {                                                   \
+        if (g_ErrorCounters.Count(counter))             \
+            debugW(__VA_ARGS__);                        \
+    } while (0)
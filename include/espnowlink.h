@@ -0,0 +1,203 @@
+//+--------------------------------------------------------------------------
+//
+// File:        espnowlink.h
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+//
+// Description:
+//
+//    Trades frames, effect state and audio with the other nodes directly
+//    over ESP-NOW, for installations with no access point to go through.
+//    Everything is broadcast, so no node has to know the others, and a
+//    node that isn't connected to an access point sits on ESPNOW_CHANNEL.
+//    A node connected to one is on the access point's channel instead, so
+//    either every node uses the same access point or none of them do.
+//
+//    Each message is cut into fragments that fit an ESP-NOW payload, each
+//    with this header in front:
+//
+//      uint32_t  magic         ascii "NDEN"
+//      uint8_t   kind          ESPNowKind
+//      uint8_t   fragment      index of this fragment in the message
+//      uint8_t   fragments     how many the message has
+//      uint8_t   reserved
+//      uint16_t  message       counts the sender's messages
+//      uint16_t  length        of the whole message
+//      int64_t   sent          sender's clock as it sent the fragment, in
+//                              microseconds since 1970
+//
+//    A Packet message is one packet as the socket server takes it, plain
+//    or "DAVE" compressed, and goes through ProcessIncomingData into the
+//    channel rings and the PCREMOTE audio, just as if it came over WiFi.
+//    Frames sent with ESPNOW_SEND_FRAMES go out as compressed deltas
+//    against the last frame sent, with a whole frame every so often.  A
+//    message missing a fragment is dropped whole.
+//
+//    Only the node the frames start from should send them, as a node that
+//    sent on what it was sent would have two of them sending to each other.
+//
+//    An EffectState message is an EffectSyncPacket from the effect sync
+//    leader.  With ENABLE_CLOCK_SYNC the followers set their clocks from
+//    the times those were sent, which over ESP-NOW is off by no more than
+//    the fraction of a millisecond they took to arrive.
+//
+//    Modem sleep misses broadcasts, so a node that's also connected to an
+//    access point should use the streaming radio profile.  One that has
+//    credentials for an access point it can't find scans for it, and is
+//    off the channel while it does.
+//
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <esp_now.h>
+#include <freertos/queue.h>
+#include "globals.h"
+
+#if ENABLE_ESPNOW
+
+#if !ENABLE_WIFI
+    #error ENABLE_ESPNOW requires ENABLE_WIFI, as it needs the radio
+#endif
+
+#define ESPNOW_HEADER           (0x4E45444E)                                    // ascii "NDEN" as header
+
+enum class ESPNowKind : uint8_t
+{
+    Packet      = 1,
+    EffectState = 2
+};
+
+struct __attribute__((packed)) ESPNowHeader
+{
+    uint32_t   Magic;
+    ESPNowKind Kind;
+    uint8_t    Fragment;
+    uint8_t    FragmentCount;
+    uint8_t    Reserved;
+    uint16_t   Message;
+    uint16_t   Length;
+    int64_t    SentMicros;
+};
+
+class Deflater;
+class PeakData;
+
+// ESPNowLink
+//
+// The WiFi task hands each fragment that comes in to the link task through a queue, as the receive callback mustn't
+// hold it up.  The link task puts the messages back together, dispatches them, and sends whatever this node has to
+// send.  Send() can be called from any task.
+
+class ESPNowLink
+{
+  public:
+
+    static constexpr size_t kMaxPayload = ESP_NOW_MAX_DATA_LEN - sizeof(ESPNowHeader);
+
+    static_assert(ESPNOW_MAX_MESSAGE <= 255 * kMaxPayload && ESPNOW_MAX_MESSAGE <= UINT16_MAX, "ESPNOW_MAX_MESSAGE is more than the fragments can carry");
+
+  private:
+
+    struct Fragment
+    {
+        uint8_t  Sender[ESP_NOW_ETH_ALEN];
+        uint8_t  Length;
+        uint8_t  Data[ESP_NOW_MAX_DATA_LEN];
+        int64_t  ReceivedMicros;                    // Our clock as it came in
+    };
+
+    QueueHandle_t               _queue = nullptr;
+    std::mutex                  _sendMutex;
+    uint16_t                    _message = 0;
+
+    // The message being put back together
+
+    std::unique_ptr<uint8_t []> _pMessage;
+    size_t                      _cbMessage = 0;
+    uint8_t                     _sender[ESP_NOW_ETH_ALEN] = {};
+    uint16_t                    _messageId = 0;
+    uint8_t                     _nextFragment = 0;  // 0 while there's none under way
+
+    std::unique_ptr<uint8_t []> _pSingle;           // A message that came in one fragment
+    std::unique_ptr<uint8_t []> _pExpanded;         // Where a compressed packet is expanded to
+
+    // The frames going out
+
+    #if ESPNOW_SEND_FRAMES
+        std::unique_ptr<Deflater>   _pDeflater;
+        unique_free_array<uint8_t> _pFrame;
+        unique_free_array<CRGB>    _pLastSent;
+        std::vector<uint8_t, psram_allocator<uint8_t>> _compressed;
+        size_t                      _lastLength = 0;
+        uint32_t                    _lastSequence = 0;
+        uint32_t                    _cSinceKeyframe = 0;
+        bool                        _bNeedKeyframe = true;
+        unsigned long               _msLastFrame = 0;
+    #endif
+
+    static void OnReceive(const uint8_t * pSender, const uint8_t * pData, int cbData);
+
+    void Receive(const Fragment & fragment);
+    void Dispatch(ESPNowKind kind, std::unique_ptr<uint8_t []> & pMessage, size_t cbMessage, int64_t sentMicros, int64_t receivedMicros);
+    void SendFrame();
+
+  public:
+
+    std::atomic<uint32_t> _cSent     { 0 };         // Messages
+    std::atomic<uint32_t> _cReceived { 0 };
+    std::atomic<uint32_t> _cDropped  { 0 };         // Fragments that didn't fit the queue, and messages missing one
+
+    ESPNowLink();
+    ~ESPNowLink();
+
+    // begin
+    //
+    // Brings up the radio if WiFi hasn't and starts ESP-NOW.  Returns false if it couldn't.
+
+    bool begin();
+
+    // Send
+    //
+    // Broadcasts a message, a fragment at a time.  Returns false if it's too big or the radio wouldn't take it.
+    // Without bWait it gives up rather than wait for another send to finish or for room in the radio.
+
+    bool Send(ESPNowKind kind, const uint8_t * pData, size_t cbData, bool bWait = true);
+
+    // SendPeaks
+    //
+    // The audio task's peaks, as a PEAKDATA packet stamped with our clock.  They're dropped if the link is busy
+    // sending a frame, as the audio task can't wait for that and there'll be new ones in a moment.
+
+    #if ENABLE_AUDIO
+        void SendPeaks(const PeakData & peaks);
+    #endif
+
+    // LinkLoop
+    //
+    // Runs on the link task for good
+
+    void LinkLoop();
+};
+
+#endif
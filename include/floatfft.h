@@ -0,0 +1,167 @@
+//+--------------------------------------------------------------------------
+//
+// File:        floatfft.h
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+//
+// Description:
+//
+//    The single precision FFT the sound analyzer runs each audio window
+//    through, kept apart from the I2S and ADC code so the host build can
+//    benchmark it
+//
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#include <cassert>
+#include <cmath>
+#include <stdexcept>
+#include <utility>
+#include "globals.h"
+#include "memoryplacement.h"
+
+#if ENABLE_FLOAT_FFT
+
+// FloatFFT
+//
+// In-place radix-2 FFT in single precision, which the ESP32 FPU does natively, unlike the doubles arduinoFFT
+// uses.  The Hamming window, twiddle factors and bit reversal order are worked out up front, and the tables
+// must live in internal RAM because every pass goes over each of them several times.  That's only 10 bytes a
+// sample, so they're never left to PSRAM.  They're allocated for MaxN and rebuilt by Configure for whatever size
+// is in use.
+
+template <size_t MaxN>
+class FloatFFT
+{
+    static_assert(MaxN >= 4 && (MaxN & (MaxN - 1)) == 0, "FFT size must be a power of two");
+
+    size_t     _n = MaxN;               // Size of the transform in use
+    float    * _pWindow;                // Hamming weight for each sample
+    float    * _pCos;                   // cos and sin of 2 pi k / n for the first n/2 values of k
+    float    * _pSin;
+    uint16_t * _pBitReverse;            // Where each sample goes before the butterflies
+
+  public:
+
+    FloatFFT()
+    {
+        _pWindow     = PlacedAlloc<float>(MaxN, Placement::Internal, "fft window");
+        _pCos        = PlacedAlloc<float>(MaxN / 2, Placement::Internal, "fft cos");
+        _pSin        = PlacedAlloc<float>(MaxN / 2, Placement::Internal, "fft sin");
+        _pBitReverse = PlacedAlloc<uint16_t>(MaxN, Placement::Internal, "fft bit reverse");
+
+        if (!_pWindow || !_pCos || !_pSin || !_pBitReverse)
+            throw std::runtime_error("Unable to allocate the FFT tables in internal RAM");
+
+        Configure(MaxN);
+    }
+
+    // Configure
+    //
+    // Switches to an n point transform, n being a power of two no bigger than MaxN
+
+    void Configure(size_t n)
+    {
+        assert(n >= 4 && n <= MaxN && (n & (n - 1)) == 0);
+        _n = n;
+
+        for (size_t i = 0; i < _n; i++)
+            _pWindow[i] = 0.54f - 0.46f * cosf(2.0f * (float) M_PI * i / (_n - 1));
+
+        for (size_t k = 0; k < _n / 2; k++)
+        {
+            _pCos[k] = cosf(2.0f * (float) M_PI * k / _n);
+            _pSin[k] = sinf(2.0f * (float) M_PI * k / _n);
+        }
+
+        const int bits = __builtin_ctz(_n);
+        for (size_t i = 0; i < _n; i++)
+        {
+            uint16_t reversed = 0;
+            for (int b = 0; b < bits; b++)
+                reversed |= ((i >> b) & 1) << (bits - 1 - b);
+            _pBitReverse[i] = reversed;
+        }
+    }
+
+    ~FloatFFT()
+    {
+        free(_pWindow);
+        free(_pCos);
+        free(_pSin);
+        free(_pBitReverse);
+    }
+
+    // Magnitudes
+    //
+    // Does what DCRemoval, Windowing, Compute and ComplexToMagnitude did: takes n real samples in pReal and leaves
+    // the magnitude of the first n/2 bins there.  pImaginary is scratch.
+
+    void Magnitudes(float * pReal, float * pImaginary) const
+    {
+        float mean = 0.0f;
+        for (size_t i = 0; i < _n; i++)
+            mean += pReal[i];
+        mean /= _n;
+
+        for (size_t i = 0; i < _n; i++)
+        {
+            pReal[i] = (pReal[i] - mean) * _pWindow[i];
+            pImaginary[i] = 0.0f;
+        }
+
+        for (size_t i = 0; i < _n; i++)
+        {
+            size_t j = _pBitReverse[i];
+            if (j > i)
+                std::swap(pReal[i], pReal[j]);
+        }
+
+        for (size_t size = 2; size <= _n; size <<= 1)
+        {
+            const size_t half = size / 2;
+            const size_t step = _n / size;
+
+            for (size_t start = 0; start < _n; start += size)
+            {
+                for (size_t k = 0; k < half; k++)
+                {
+                    const float c = _pCos[k * step];
+                    const float s = _pSin[k * step];
+                    const size_t even = start + k;
+                    const size_t odd  = even + half;
+
+                    const float tReal = c * pReal[odd] + s * pImaginary[odd];
+                    const float tImag = c * pImaginary[odd] - s * pReal[odd];
+
+                    pReal[odd]      = pReal[even] - tReal;
+                    pImaginary[odd] = pImaginary[even] - tImag;
+                    pReal[even]      += tReal;
+                    pImaginary[even] += tImag;
+                }
+            }
+        }
+
+        for (size_t i = 0; i < _n / 2; i++)
+            pReal[i] = sqrtf(pReal[i] * pReal[i] + pImaginary[i] * pImaginary[i]);
+    }
+};
+
+#endif
@@ -0,0 +1,533 @@
+//+--------------------------------------------------------------------------
+//
+// File:        frametiming.h
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+//
+// Description:
+//
+//    Cycle counter probes around the stages of the draw loop and socket
+//    task, feeding small fixed-size histograms served by /statistics, and
+//    a watch on the frames and lock waits that run far over, served by
+//    /stalls
+//
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+#include <esp_freertos_hooks.h>
+#include "globals.h"
+#include "tracing.h"
+
+// The stages we time.  Every task that records a stage is pinned to a core, so the per-core cycle counter is
+// good for each start/stop pair.  Producer tasks can both record the lock stage, and the odd lost count from
+// that is not worth guarding against.
+
+enum class FrameStage : uint8_t
+{
+    Frame,              // The whole draw loop pass, less the wait for the next frame
+    Prepare,            // GFXBase::PrepareFrame, including the matrix caption overlay
+    WiFiDraw,           // Pulling and drawing buffers that came in over WiFi
+    LocalDraw,          // Drawing the current effect
+    PostProcess,        // GFXBase::PostProcessFrame as a whole
+    PowerEstimate,      // Estimating power draw to limit brightness
+    Present,            // MatrixSwapBuffers or FastLED.show()
+    PresentWait,        // Draw loop waiting for the pipelined present to finish sending the last frame
+    SocketPacket,       // Handling a packet once its header has arrived
+    ProducerLock,       // Waiting on g_buffer_mutex to add frames
+    Count
+};
+
+inline const char * FrameStageName(FrameStage stage)
+{
+    static const char * const names[] = { "FRAME", "PREPARE", "WIFI_DRAW", "LOCAL_DRAW", "POST_PROCESS", "POWER_ESTIMATE", "PRESENT", "PRESENT_WAIT", "SOCKET_PACKET", "PRODUCER_LOCK" };
+    static_assert(sizeof(names) / sizeof(names[0]) == (size_t) FrameStage::Count, "Every stage needs a name");
+    return names[(size_t) stage];
+}
+
+#if ENABLE_FRAME_TIMING
+
+// StageHistogram
+//
+// Log-linear histogram of microsecond durations: four buckets per power of two, so a percentile read from it is
+// within about 20% of the real value.  Counts are halved when they get large, so it leans to recent history.
+
+class StageHistogram
+{
+    static constexpr size_t   kSubBuckets = 4;
+    static constexpr size_t   kOctaves    = 20;                 // Up to about a second
+    static constexpr size_t   kBuckets    = kSubBuckets * kOctaves;
+    static constexpr uint32_t kDecayAt    = 1 << 16;
+
+    uint32_t _buckets[kBuckets] = { 0 };
+    uint32_t _count             = 0;
+    uint32_t _max               = 0;
+
+    static size_t BucketFor(uint32_t us)
+    {
+        if (us < kSubBuckets)
+            return us;
+
+        size_t octave = 31 - __builtin_clz(us);                 // Position of the top bit, which is at least 2
+        size_t sub    = (us >> (octave - 2)) & (kSubBuckets - 1);
+        return std::min(kBuckets - 1, (octave - 1) * kSubBuckets + sub);
+    }
+
+    static uint32_t UpperBoundOf(size_t bucket)
+    {
+        if (bucket < kSubBuckets)
+            return bucket;
+
+        size_t octave = bucket / kSubBuckets + 1;
+        size_t sub    = bucket % kSubBuckets;
+        return ((kSubBuckets + sub + 1) << (octave - 2)) - 1;
+    }
+
+  public:
+
+    void Record(uint32_t us)
+    {
+        if (_count >= kDecayAt)
+        {
+            _count = 0;
+            for (auto& bucket : _buckets)
+                _count += (bucket >>= 1);
+        }
+        _buckets[BucketFor(us)]++;
+        _count++;
+        _max = std::max(_max, us);
+    }
+
+    uint32_t Count() const { return _count; }
+    uint32_t Max()   const { return _max;   }
+
+    // Percentile
+    //
+    // Upper edge of the bucket the given percentile (0-100) falls in
+
+    uint32_t Percentile(uint32_t percent) const
+    {
+        uint64_t target = ((uint64_t) _count * percent + 99) / 100;
+        uint64_t seen   = 0;
+
+        for (size_t i = 0; i < kBuckets; i++)
+        {
+            seen += _buckets[i];
+            if (seen >= target && seen > 0)
+                return std::min(UpperBoundOf(i), _max);
+        }
+        return _max;
+    }
+};
+
+// FrameTiming
+//
+// Holds a histogram for each stage
+
+class FrameTiming
+{
+    StageHistogram _stages[(size_t) FrameStage::Count];
+
+  public:
+
+    static const char * StageName(FrameStage stage)
+    {
+        return FrameStageName(stage);
+    }
+
+    void Record(FrameStage stage, uint32_t cycles)
+    {
+        _stages[(size_t) stage].Record(cycles / ESP.getCpuFreqMHz());
+    }
+
+    const StageHistogram & Stage(FrameStage stage) const
+    {
+        return _stages[(size_t) stage];
+    }
+};
+
+extern DRAM_ATTR FrameTiming g_FrameTiming;
+
+#endif
+
+#if ENABLE_STALL_WATCH
+
+// StallRecord
+//
+// One frame that took longer than STALL_THRESHOLD_MS, or one wait for the buffer mutex longer than
+// STALL_LOCK_THRESHOLD_MS
+
+struct StallRecord
+{
+    enum Kind : uint8_t { Frame, Lock };
+
+    Kind       Type;
+    uint32_t   Timestamp;                                   // millis() when it was over
+    uint32_t   Micros;                                      // How long the frame, or the wait for the lock, took
+    FrameStage Stage;                                       // The stage that took longest by itself, or the lock's stage
+    uint32_t   StageMicros;
+    uint32_t   Stages[(size_t) FrameStage::Count];          // What each stage took during the frame
+    char       Stalled[configMAX_TASK_NAME_LEN];            // The task that was held up
+    char       Culprit[configMAX_TASK_NAME_LEN];            // The task that ran most on the draw core, or last took the lock
+    uint32_t   CulpritTicks;                                // How many ticks of the frame the culprit ran for
+};
+
+// StallWatch
+//
+// The draw loop marks where each frame begins and ends, and the stage timers add up what the draw task spent in
+// each stage in between.  Every tick while a frame is under way, a tick hook on the draw core notes which task the
+// tick interrupted, if it wasn't the draw task or the idle task, which is how a task that took the core away shows up
+// even though nothing timed it.  The lock waits are timed by TimedLock, which also keeps the task that last took the
+// lock, so a long wait names who was holding it.  Only the frames and waits that go over are kept, in a small ring.
+
+class StallWatch
+{
+  public:
+
+    static constexpr size_t kHistory = STALL_HISTORY;
+
+  private:
+
+    static constexpr size_t kCompetitors = 4;
+
+    TaskHandle_t              _hDrawTask    = nullptr;
+    TaskHandle_t              _hIdle        = nullptr;
+    volatile bool             _bInFrame     = false;
+    int64_t                   _usFrameStart = 0;
+    uint32_t                  _stageMicros[(size_t) FrameStage::Count] = {};
+    volatile TaskHandle_t     _hCompetitors[kCompetitors] = {};
+    volatile uint32_t         _competitorTicks[kCompetitors] = {};
+    std::atomic<TaskHandle_t> _hLockHolder { nullptr };
+
+    mutable std::mutex        _mutex;
+    StallRecord               _history[kHistory] = {};
+    size_t                    _next  = 0;
+    uint32_t                  _count = 0;               // Every stall since boot, not just those still in the ring
+
+    static void IRAM_ATTR TickHook();
+
+    // OnTick
+    //
+    // Runs in the tick interrupt on the draw core, which is also where the draw task clears the slots, so the two
+    // never run at once.  Should more than kCompetitors tasks get in, the later ones go uncounted.
+
+    void IRAM_ATTR OnTick()
+    {
+        if (!_bInFrame)
+            return;
+
+        TaskHandle_t hTask = xTaskGetCurrentTaskHandleForCPU(xPortGetCoreID());
+        if (hTask == _hDrawTask || hTask == _hIdle)
+            return;
+
+        for (size_t i = 0; i < kCompetitors; i++)
+        {
+            if (_hCompetitors[i] == hTask)
+            {
+                _competitorTicks[i]++;
+                return;
+            }
+            if (!_hCompetitors[i])
+            {
+                _hCompetitors[i]    = hTask;
+                _competitorTicks[i] = 1;
+                return;
+            }
+        }
+    }
+
+    // CopyTaskName
+    //
+    // The handles were noted while their tasks ran, and any of them may since have been deleted, so the name is only
+    // copied from a task FreeRTOS still lists.  The scheduler stays suspended until it's copied so the task can't
+    // go in between.  Without the trace facility there's no list to check, and the name is left empty.
+
+    template <size_t N>
+    static void CopyTaskName(char (&name)[N], TaskHandle_t hTask)
+    {
+        if (!hTask)
+            return;
+
+        #if configUSE_TRACE_FACILITY
+            UBaseType_t cTasks = uxTaskGetNumberOfTasks() + 2;                  // Room for a couple started meanwhile
+            std::unique_ptr<TaskStatus_t[]> pStatus(new(std::nothrow) TaskStatus_t[cTasks]);
+            if (!pStatus)
+                return;
+
+            vTaskSuspendAll();
+            cTasks = uxTaskGetSystemState(pStatus.get(), cTasks, nullptr);
+            for (UBaseType_t i = 0; i < cTasks; i++)
+            {
+                if (pStatus[i].xHandle == hTask)
+                {
+                    strncpy(name, pStatus[i].pcTaskName, N - 1);
+                    break;
+                }
+            }
+            xTaskResumeAll();
+        #endif
+    }
+
+    // The time a stage took less that of the stages inside it, so the one that really took the time is the one named
+
+    uint32_t SelfMicros(FrameStage stage) const
+    {
+        uint32_t us = _stageMicros[(size_t) stage];
+
+        if (stage == FrameStage::PostProcess)
+        {
+            for (auto inner : { FrameStage::PowerEstimate, FrameStage::Present, FrameStage::PresentWait })
+                us -= std::min(us, _stageMicros[(size_t) inner]);
+        }
+        return us;
+    }
+
+    void Add(const StallRecord & record)
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        _history[_next] = record;
+        _next = (_next + 1) % kHistory;
+        _count++;
+    }
+
+  public:
+
+    // Called by the draw loop before and after each frame.  The first call is what tells us which task and core
+    // the draw loop is on.
+
+    void BeginFrame()
+    {
+        if (!_hDrawTask)
+        {
+            _hDrawTask = xTaskGetCurrentTaskHandle();
+            _hIdle     = xTaskGetIdleTaskHandleForCPU(xPortGetCoreID());
+            esp_register_freertos_tick_hook_for_cpu(TickHook, xPortGetCoreID());
+        }
+
+        for (size_t i = 0; i < kCompetitors; i++)
+        {
+            _hCompetitors[i]    = nullptr;
+            _competitorTicks[i] = 0;
+        }
+        std::fill(std::begin(_stageMicros), std::end(_stageMicros), 0);
+
+        _usFrameStart = esp_timer_get_time();
+        _bInFrame     = true;
+    }
+
+    void EndFrame()
+    {
+        _bInFrame = false;
+
+        uint32_t usFrame = esp_timer_get_time() - _usFrameStart;
+        if (usFrame < STALL_THRESHOLD_MS * 1000)
+            return;
+
+        StallRecord record = {};
+        record.Type      = StallRecord::Frame;
+        record.Timestamp = millis();
+        record.Micros    = usFrame;
+        std::copy(std::begin(_stageMicros), std::end(_stageMicros), std::begin(record.Stages));
+
+        // The frame stage holds all the others, so it's only named if none of them had any of the time
+
+        record.Stage = FrameStage::Frame;
+        for (size_t i = 0; i < (size_t) FrameStage::Count; i++)
+        {
+            auto stage = (FrameStage) i;
+            if (stage != FrameStage::Frame && SelfMicros(stage) > record.StageMicros)
+            {
+                record.Stage       = stage;
+                record.StageMicros = SelfMicros(stage);
+            }
+        }
+        if (record.Stage == FrameStage::Frame)
+            record.StageMicros = _stageMicros[(size_t) FrameStage::Frame];
+
+        size_t culprit = 0;
+        for (size_t i = 1; i < kCompetitors; i++)
+            if (_competitorTicks[i] > _competitorTicks[culprit])
+                culprit = i;
+
+        CopyTaskName(record.Stalled, _hDrawTask);
+        CopyTaskName(record.Culprit, _hCompetitors[culprit]);
+        record.CulpritTicks = _competitorTicks[culprit];
+
+        Add(record);
+    }
+
+    // Adds what a stage took to the frame's times, if it's the draw task's and a frame is under way
+
+    void RecordStage(FrameStage stage, uint32_t us)
+    {
+        if (_bInFrame && xTaskGetCurrentTaskHandle() == _hDrawTask)
+            _stageMicros[(size_t) stage] += us;
+    }
+
+    TaskHandle_t LockHolder() const
+    {
+        return _hLockHolder.load(std::memory_order_relaxed);
+    }
+
+    // Called once the lock is held.  The task that held it when the wait began is the one that took it last.
+
+    void LockTaken(FrameStage stage, int64_t usWaitStart, TaskHandle_t hHolder)
+    {
+        TaskHandle_t hTask = xTaskGetCurrentTaskHandle();
+        _hLockHolder.store(hTask, std::memory_order_relaxed);
+
+        uint32_t usWait = esp_timer_get_time() - usWaitStart;
+        if (usWait < STALL_LOCK_THRESHOLD_MS * 1000)
+            return;
+
+        StallRecord record = {};
+        record.Type        = StallRecord::Lock;
+        record.Timestamp   = millis();
+        record.Micros      = usWait;
+        record.Stage       = stage;
+        record.StageMicros = usWait;
+        CopyTaskName(record.Stalled, hTask);
+        CopyTaskName(record.Culprit, hHolder != hTask ? hHolder : nullptr);
+
+        Add(record);
+    }
+
+    // History
+    //
+    // The stalls still in the ring, oldest first, and how many there have been since boot
+
+    std::vector<StallRecord> History(uint32_t & count) const
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+
+        count = _count;
+        size_t kept = std::min<size_t>(_count, kHistory);
+
+        std::vector<StallRecord> history;
+        history.reserve(kept);
+        for (size_t i = 0; i < kept; i++)
+            history.push_back(_history[(_next + kHistory - kept + i) % kHistory]);
+        return history;
+    }
+};
+
+extern StallWatch g_StallWatch;
+
+inline void IRAM_ATTR StallWatch::TickHook()
+{
+    g_StallWatch.OnTick();
+}
+
+// LockWatch
+//
+// Times the wait for a lock from its construction to the end of the enclosing scope
+
+class LockWatch
+{
+    FrameStage   _stage;
+    int64_t      _usStart;
+    TaskHandle_t _hHolder;
+
+  public:
+
+    explicit LockWatch(FrameStage stage) : _stage(stage), _usStart(esp_timer_get_time()), _hHolder(g_StallWatch.LockHolder())
+    {
+    }
+
+    ~LockWatch()
+    {
+        g_StallWatch.LockTaken(_stage, _usStart, _hHolder);
+    }
+};
+
+#endif
+
+#if ENABLE_FRAME_TIMING || ENABLE_STALL_WATCH || ENABLE_TRACING
+
+// StageTimer
+//
+// Records the time from its construction to the end of the enclosing scope, and traces it as a span
+
+class StageTimer
+{
+    FrameStage _stage;
+    uint32_t   _start;
+
+    #if ENABLE_TRACING
+        TraceSpan _span;
+    #endif
+
+  public:
+
+    explicit StageTimer(FrameStage stage)
+      : _stage(stage),
+        _start(ESP.getCycleCount())
+        #if ENABLE_TRACING
+            , _span(FrameStageName(stage))
+        #endif
+    {
+    }
+
+    ~StageTimer()
+    {
+        [[maybe_unused]] uint32_t cycles = ESP.getCycleCount() - _start;
+
+        #if ENABLE_FRAME_TIMING
+            g_FrameTiming.Record(_stage, cycles);
+        #endif
+        #if ENABLE_STALL_WATCH
+            g_StallWatch.RecordStage(_stage, cycles / ESP.getCpuFreqMHz());
+        #endif
+    }
+};
+
+#define STAGE_TIMER_NAME2(line) _stageTimer##line
+#define STAGE_TIMER_NAME(line)  STAGE_TIMER_NAME2(line)
+#define TIME_STAGE(stage)       StageTimer STAGE_TIMER_NAME(__LINE__)(FrameStage::stage)
+
+#else
+
+#define TIME_STAGE(stage)
+
+#endif
+
+// TimedLock
+//
+// Locks a mutex, recording the wait for it as the given stage when timing is enabled.  The stall watch takes every
+// TimedLock to be on the buffer mutex, which for now is the only lock it's used for.
+
+template<typename M>
+inline std::unique_lock<M> TimedLock(M& mutex, FrameStage stage)
+{
+    #if ENABLE_FRAME_TIMING || ENABLE_TRACING
+        StageTimer timer(stage);
+    #endif
+    #if ENABLE_STALL_WATCH
+        LockWatch watch(stage);
+    #endif
+    (void) stage;
+    return std::unique_lock<M>(mutex);
+}
@@ -70,7 +70,13 @@
 #include "effects/matrix/Boid.h"
 #include "effects/matrix/Vector.h"
 #include "globals.h"
+#include "errorcounters.h"
+#include "effectmemory.h"
+#include "layoutgeometry.h"
+#include "parallelfor.h"
+#include "scratcharena.h"
 #include <memory>
+#include <utility>
 
 #if USE_HUB75
     #define USE_NOISE 1
@@ -130,6 +136,69 @@ protected:
     static const int _heatColorsPaletteIndex = 6;
     static const int _randomPaletteIndex = 9;
 
+    // The indexed frame, while any effect that's resident uses it: each pixel's palette index, then each pixel's
+    // level, both in leds order.  The table is the current palette expanded to 256 colors, and is rebuilt when that
+    // changes.
+
+    unique_free_array<uint8_t>   _pIndexedFrame;
+    unique_free_array<CRGB>      _pIndexedTable;
+    size_t                       _cIndexedUsers = 0;          // Leases on the frame, with the mutex held
+    std::mutex                   _indexedMutex;               // State can be brought in on the prepare task
+    CRGBPalette16                _indexedTablePalette;
+    TBlendType                   _indexedTableBlend = LINEARBLEND;
+    bool                         _bIndexedTableValid = false;
+
+    #if ENABLE_PALETTE_CACHE
+        // The current palette expanded to all 256 indexes for ColorFromCurrentPalette(): one table at full brightness,
+        // and one at whichever other brightness has lately been asked for enough times in a row to pay for building
+        // it.  Whatever changes the current palette bumps the generation, and a table is rebuilt when it's next read.
+
+        struct PaletteCache
+        {
+            CRGB     Full[256];
+            CRGB     Dimmed[256];
+            uint32_t FullGeneration   = 0;
+            uint32_t DimmedGeneration = 0;
+            uint8_t  DimmedBrightness = 0;
+            uint8_t  Candidate        = 0;              // The other brightness being asked for, and how many times in a row
+            uint8_t  CandidateRun     = 0;
+        };
+
+        uint32_t               _paletteGeneration    = 1;
+        mutable PaletteCache * _pPaletteCache        = nullptr;     // In internal RAM, allocated on first use
+        mutable bool           _bPaletteCacheFailed  = false;
+
+        const CRGB * ExpandPalette(uint8_t brightness) const;
+
+        const CRGB * ExpandedPalette(uint8_t brightness) const
+        {
+            if (_pPaletteCache)
+            {
+                if (brightness == 255 && _pPaletteCache->FullGeneration == _paletteGeneration)
+                    return _pPaletteCache->Full;
+                if (brightness == _pPaletteCache->DimmedBrightness && _pPaletteCache->DimmedGeneration == _paletteGeneration)
+                    return _pPaletteCache->Dimmed;
+            }
+            return ExpandPalette(brightness);
+        }
+    #endif
+
+    void PaletteChanged()
+    {
+        #if ENABLE_PALETTE_CACHE
+            if (++_paletteGeneration == 0)              // Zero is kept for tables that have never been built
+                _paletteGeneration = 1;
+        #endif
+    }
+
+    #if ENABLE_XY_LOOKUP_TABLE
+        uint16_t * _pXYTable     = nullptr;               // Pixel index for each x, y, in internal RAM
+        uint16_t   _xyTableWidth  = 0;
+        uint16_t   _xyTableHeight = 0;
+
+        bool AllocateXYTable(uint16_t width, uint16_t height);
+    #endif
+
 public:
     // Many of the Aurora effects need direct access to these from external classes
 
@@ -141,8 +210,29 @@ public:
 
     ~GFXBase() override
     {
+        #if ENABLE_XY_LOOKUP_TABLE
+            free(_pXYTable);
+        #endif
+        #if ENABLE_PALETTE_CACHE
+            free(_pPaletteCache);
+        #endif
     }
 
+    #if ENABLE_XY_LOOKUP_TABLE
+        // BuildXYTable
+        //
+        // Fills the lookup table from xy(), so call it once the object is fully constructed.  The hexagon maps
+        // coordinates beyond its nominal width and height, so the caller says how far the table should reach.
+
+        bool BuildXYTable(uint16_t width, uint16_t height);
+
+        // SetXYMap
+        //
+        // Replaces the lookup table with an arbitrary map, such as one loaded from the file system, laid out row by row
+
+        bool SetXYMap(const uint16_t * pMap, uint16_t width, uint16_t height);
+    #endif
+
     #if USE_NOISE
     Noise &GetNoise()
     {
@@ -150,7 +240,7 @@ public:
     }
     #endif
 
-    CRGBPalette16 &GetCurrentPalette()
+    const CRGBPalette16 &GetCurrentPalette() const
     {
         return _currentPalette;
     }
@@ -197,6 +287,119 @@ public:
         return CRGB(r, g, b);
     }
 
+    // ChannelSums
+    //
+    // Running totals of each color channel over a run of pixels, which is all a power estimate needs.  The same pass
+    // keeps a fingerprint of the pixels, so the output stage can tell a frame that's the same as the last one without
+    // walking it again.  Subtract() leaves the fingerprint alone, so it only means something for sums built up with
+    // Add() and AddCopy() from nothing.
+
+    struct ChannelSums
+    {
+        uint32_t r = 0, g = 0, b = 0;
+        uint32_t fingerprint = 2166136261u;
+
+        static uint32_t Fingerprint(uint32_t hash, uint32_t value)
+        {
+            return (hash ^ value) * 16777619u;
+        }
+
+        static uint32_t Fingerprint(uint32_t hash, const CRGB & pixel)
+        {
+            return Fingerprint(hash, pixel.r | (pixel.g << 8) | (pixel.b << 16));
+        }
+
+        void Add(const CRGB * pPixels, size_t count)
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                r += pPixels[i].r;
+                g += pPixels[i].g;
+                b += pPixels[i].b;
+                fingerprint = Fingerprint(fingerprint, pPixels[i]);
+            }
+        }
+
+        void Subtract(const CRGB * pPixels, size_t count)
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                r -= pPixels[i].r;
+                g -= pPixels[i].g;
+                b -= pPixels[i].b;
+            }
+        }
+
+        void Add(const ChannelSums & other)
+        {
+            r += other.r;
+            g += other.g;
+            b += other.b;
+            fingerprint = Fingerprint(fingerprint, other.fingerprint);
+        }
+
+        // Copies the pixels as it adds them up, so a frame that's being copied anyway needs no pass of its own
+        void AddCopy(CRGB * pDest, const CRGB * pPixels, size_t count)
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                const CRGB pixel = pPixels[i];
+                pDest[i] = pixel;
+                r += pixel.r;
+                g += pixel.g;
+                b += pixel.b;
+                fingerprint = Fingerprint(fingerprint, pixel);
+            }
+        }
+    };
+
+    // PowerModel
+    //
+    // What a display draws: a fixed load, a per-pixel load, and per channel the milliwatts for each step of
+    // brightness in 16.16 fixed point.  Strips and matrices share the estimate and only differ in the numbers.
+
+    struct PowerModel
+    {
+        uint32_t baseMilliwatts;
+        uint32_t pixelMilliwatts;
+        uint32_t red, green, blue;
+
+        uint32_t Milliwatts(const ChannelSums & sums, size_t cPixels) const
+        {
+            uint64_t channels = (uint64_t) sums.r * red + (uint64_t) sums.g * green + (uint64_t) sums.b * blue;
+            return baseMilliwatts + pixelMilliwatts * cPixels + (uint32_t) (channels >> 16);
+        }
+
+        uint32_t Milliwatts(const CRGB * pPixels, size_t cPixels) const
+        {
+            ChannelSums sums;
+            sums.Add(pPixels, cPixels);
+            return Milliwatts(sums, cPixels);
+        }
+
+        // What the pixels draw once they're sent out at the given scale.  The fixed and per-pixel loads don't
+        // scale, only the part that comes from the colors does.
+        uint32_t ScaledMilliwatts(const ChannelSums & sums, size_t cPixels, uint8_t scale) const
+        {
+            uint32_t fixed = Milliwatts(ChannelSums(), cPixels);
+            return fixed + (uint64_t) (Milliwatts(sums, cPixels) - fixed) * scale / 255;
+        }
+
+        // LimitScale
+        //
+        // The highest scale, up to the one given, at which pixels that draw the given milliwatts at full scale
+        // stay within the limit.  Used by every backend, so a limit means the same thing on strips and matrices.
+        uint8_t LimitScale(uint32_t milliwatts, size_t cPixels, uint8_t scale, uint32_t limitMilliwatts) const
+        {
+            uint32_t fixed = Milliwatts(ChannelSums(), cPixels);
+            if (limitMilliwatts <= fixed)
+                return 0;
+            if (milliwatts <= limitMilliwatts)
+                return scale;
+            return std::min<uint32_t>(scale, (uint64_t) (limitMilliwatts - fixed) * 255 / (milliwatts - fixed));
+        }
+    };
+
     static uint16_t to16bit(uint8_t r, uint8_t g, uint8_t b) // Convert RGB -> 16bit 5:6:5
     {
         return ((r / 8) << 11) | ((g / 4) << 5) | (b / 8);
@@ -214,18 +417,109 @@ public:
 
     virtual void Clear(CRGB color = CRGB::Black)
     {
+        MarkAllDirty();
         if (color == CRGB::Black)
             memset(leds, 0, sizeof(CRGB) * _width * _height);
         else
             fill_solid(leds, _width * _height, color);
     }
-    virtual bool isValidPixel(uint x, uint y) const
+    // DirtyRegion
+    //
+    // Bounding box of the pixels the drawing primitives have touched since it was last reset.  Anything that writes
+    // to leds[] directly goes around it, so it only describes the frame for effects that say they don't do that.
+
+    struct DirtyRegion
+    {
+        int16_t x0 = INT16_MAX, y0 = INT16_MAX;
+        int16_t x1 = -1,        y1 = -1;
+
+        bool IsEmpty() const
+        {
+            return x1 < x0 || y1 < y0;
+        }
+
+        void Add(int16_t left, int16_t top, int16_t right, int16_t bottom)
+        {
+            x0 = std::min(x0, left);
+            y0 = std::min(y0, top);
+            x1 = std::max(x1, right);
+            y1 = std::max(y1, bottom);
+        }
+
+        void Reset()
+        {
+            *this = DirtyRegion();
+        }
+    };
+
+protected:
+
+    #if ENABLE_DIRTY_TRACKING
+        DirtyRegion _dirtyRegion;
+    #endif
+
+    int _offscreenDepth = 0;
+
+public:
+
+    inline void MarkDirty(int16_t x, int16_t y)
+    {
+        #if ENABLE_DIRTY_TRACKING
+            _dirtyRegion.Add(x, y, x, y);
+        #endif
+    }
+
+    inline void MarkAllDirty()
+    {
+        #if ENABLE_DIRTY_TRACKING
+            _dirtyRegion.Add(0, 0, _width - 1, _height - 1);
+        #endif
+    }
+
+    #if ENABLE_DIRTY_TRACKING
+        const DirtyRegion & GetDirtyRegion() const
+        {
+            return _dirtyRegion;
+        }
+
+        void ResetDirtyRegion()
+        {
+            _dirtyRegion.Reset();
+        }
+    #endif
+
+    // PushRenderTarget and PopRenderTarget
+    //
+    // Point leds, and so every drawing primitive, at another buffer of GetLEDCount() pixels and back again.  Push
+    // returns the buffer it replaced, which is what to hand to the matching Pop.  RenderTargetScope pairs them up.
+
+    CRGB * PushRenderTarget(CRGB * pTarget)
+    {
+        _offscreenDepth++;
+        MarkAllDirty();
+        return std::exchange(leds, pTarget);
+    }
+
+    void PopRenderTarget(CRGB * pPrevious)
+    {
+        _offscreenDepth--;
+        leds = pPrevious;
+        MarkAllDirty();
+    }
+
+    // True while leds points at a render target rather than the device's own buffer
+    bool IsDrawingOffscreen() const
+    {
+        return _offscreenDepth > 0;
+    }
+
+    bool isValidPixel(uint x, uint y) const
     {
         // Check that the pixel location is within the matrix's bounds
         return x < _width && y < _height;
     }
 
-    virtual bool isValidPixel(uint n) const
+    bool isValidPixel(uint n) const
     {
         // Check that the pixel location is within the matrix's bounds
         return n < _width * _height;
@@ -262,95 +556,217 @@ public:
         }
     }
 
+    // The layout of the pixels is fixed for a given build, so the pixel accessors below work it out at compile
+    // time rather than going through the virtual xy().  Only the hexagon has a layout that needs the override.
+
+    enum class PixelLayout
+    {
+        RowMajor,           // HUB75 matrix, laid out in memory the same way as on the panel
+        Serpentine,         // Strip matrix in the boustrophedon layout described above
+        Custom              // Whatever the xy() override says
+    };
+
+    #if USE_HUB75
+        static constexpr PixelLayout kPixelLayout = PixelLayout::RowMajor;
+    #elif HEXAGON
+        static constexpr PixelLayout kPixelLayout = PixelLayout::Custom;
+    #else
+        static constexpr PixelLayout kPixelLayout = PixelLayout::Serpentine;
+    #endif
+
+    inline uint16_t fastXY(uint16_t x, uint16_t y) const
+    {
+        #if USE_HUB75
+            return y * MATRIX_WIDTH + x;
+        #else
+            #if ENABLE_XY_LOOKUP_TABLE
+                if (x < _xyTableWidth && y < _xyTableHeight)
+                    return _pXYTable[y * _xyTableWidth + x];
+            #endif
+
+            #if HEXAGON
+                return xy(x, y);
+            #else
+                return GFXBase::xy(x, y);               // Qualified, so it's a direct call to the serpentine math
+            #endif
+        #endif
+    }
+
     // This is an optimization that allows us to use direct math for the XY lookup when using the matrix, where
-    // it's a very simple layout.  Others may need to override this function.  Using a #define here allows
-    // us to avoid an extra virtual function call in the inner loop of the effects.
+    // it's a very simple layout.  Elsewhere it resolves through fastXY, which only makes a virtual call for layouts
+    // that really override xy().
 
     #if USE_HUB75
         #define XY(x, y) ((y) * MATRIX_WIDTH + (x))
     #else
-        #define XY(x, y) xy(x, y)
+        #define XY(x, y) fastXY(x, y)
     #endif
 
-    virtual CRGB getPixel(int16_t x, int16_t y) const
+    // Unchecked accessors for inner loops that already know their coordinates are on the matrix.  On a row major
+    // layout, the pixels of row y are the contiguous span starting at rowUnchecked(y).
+
+    inline CRGB & pixelUnchecked(uint16_t x, uint16_t y)
+    {
+        return leds[fastXY(x, y)];
+    }
+
+    inline const CRGB & pixelUnchecked(uint16_t x, uint16_t y) const
+    {
+        return leds[fastXY(x, y)];
+    }
+
+    inline CRGB & pixelUnchecked(uint16_t i)
+    {
+        return leds[i];
+    }
+
+    static constexpr bool hasRowSpans()
+    {
+        return kPixelLayout == PixelLayout::RowMajor;
+    }
+
+    inline CRGB * rowUnchecked(uint16_t y)              // Only meaningful when hasRowSpans() is true
+    {
+        return leds + y * _width;
+    }
+
+    // Bulk kernels for the streaming and scrolling primitives further down, over spans that are contiguous in memory.
+    // The spans are walked front to back, so dst may start one pixel after src and carry forward what it has just
+    // written, which is what streaming to the right does.
+
+    static void addAndScaleSpan(CRGB * dst, const CRGB * src, int count, uint8_t scale)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            dst[i] += src[i];
+            dst[i].nscale8(scale);
+        }
+    }
+
+    static void scaleSpan(CRGB * dst, int count, uint8_t scale)
+    {
+        for (int i = 0; i < count; i++)
+            dst[i].nscale8(scale);
+    }
+
+    static void moveSpan(CRGB * dst, const CRGB * src, int count)
+    {
+        if (count > 0)
+            memmove(dst, src, count * sizeof(CRGB));
+    }
+
+    // Copies the first half of the span over the second, back to front
+
+    static void mirrorSpan(CRGB * span, int count)
+    {
+        for (int i = 0, j = count - 1; i < j; i++, j--)
+            span[j] = span[i];
+    }
+
+    // The transpose works in square tiles of this many pixels a side, so the rows it reads down stay in the cache
+    static constexpr int kTransposeTile = 8;
+
+    CRGB getPixel(int16_t x, int16_t y) const
     {
         if (isValidPixel(x, y))
             return leds[XY(x, y)];
-        else
-            throw std::runtime_error(str_sprintf("Invalid index in getPixel: x=%d, y=%d, NUM_LEDS=%d", x, y, NUM_LEDS).c_str());
+
+        COUNT_ERROR(ErrorCounter::PixelOutOfRange, "Invalid getPixel request: x=%d, y=%d, NUM_LEDS=%d", x, y, NUM_LEDS);
+        return CRGB::Black;
     }
 
-    virtual CRGB getPixel(int16_t i) const
+    CRGB getPixel(int16_t i) const
     {
         if (isValidPixel(i))
             return leds[i];
-        else
-            throw std::runtime_error(str_sprintf("Invalid index in getPixel: i=%d, NUM_LEDS=%d", i, NUM_LEDS).c_str());
+
+        COUNT_ERROR(ErrorCounter::PixelOutOfRange, "Invalid getPixel request: i=%d, NUM_LEDS=%d", i, NUM_LEDS);
+        return CRGB::Black;
     }
 
-    virtual void addColor(int16_t i, CRGB c)
+    void addColor(int16_t i, CRGB c)
     {
         if (isValidPixel(i))
+        {
             leds[i] += c;
+            MarkAllDirty();                             // We don't know where a raw index lands on every layout
+        }
     }
 
-    virtual void drawPixel(int16_t x, int16_t y, CRGB color)
+    void drawPixel(int16_t x, int16_t y, CRGB color)
     {
         if (isValidPixel(x, y))
+        {
             leds[XY(x, y)] = color;
+            MarkDirty(x, y);
+        }
         else
-            debugE("Invalid drawPixel request: x=%d, y=%d, NUM_LEDS=%d", x, y, NUM_LEDS);
+            COUNT_ERROR(ErrorCounter::PixelOutOfRange, "Invalid drawPixel request: x=%d, y=%d, NUM_LEDS=%d", x, y, NUM_LEDS);
     }
 
     void drawPixel(int16_t x, int16_t y, uint16_t color) override
     {
         if (isValidPixel(x, y))
+        {
             leds[XY(x, y)] = from16Bit(color);
+            MarkDirty(x, y);
+        }
         else
-            debugE("Invalid drawPixel request: x=%d, y=%d, NUM_LEDS=%d", x, y, NUM_LEDS);
+            COUNT_ERROR(ErrorCounter::PixelOutOfRange, "Invalid drawPixel request: x=%d, y=%d, NUM_LEDS=%d", x, y, NUM_LEDS);
     }
 
-    virtual void fillLeds(std::unique_ptr<CRGB[]> &pLEDs)
+    virtual void fillLeds(const CRGB * pLEDs)
     {
         // A mesmerizer panel has the same layout as in memory, so we can memcpy.  Others may require transposition,
         // so we do it the "slow" way for other matrices in the default implementation
 
         for (int x = 0; x < _width; x++)
             for (int y = 0; y < _height; y++)
-                setPixel(x, y, pLEDs[y * _width + x]);
+                pixelUnchecked(x, y) = pLEDs[y * _width + x];
+
+        MarkAllDirty();
     }
 
-    virtual void setPixel(int16_t x, int16_t y, uint16_t color)
+    void setPixel(int16_t x, int16_t y, uint16_t color)
     {
         if (isValidPixel(x, y))
+        {
             leds[XY(x, y)] = from16Bit(color);
+            MarkDirty(x, y);
+        }
         else
-            debugE("Invalid setPixel request: x=%d, y=%d, NUM_LEDS=%d", x, y, NUM_LEDS);
+            COUNT_ERROR(ErrorCounter::PixelOutOfRange, "Invalid setPixel request: x=%d, y=%d, NUM_LEDS=%d", x, y, NUM_LEDS);
     }
 
     void setPixel(int16_t x, int16_t y, CRGB color)
     {
         if (isValidPixel(x, y))
+        {
             leds[XY(x, y)] = color;
+            MarkDirty(x, y);
+        }
         else
-            debugE("Invalid setPixel request: x=%d, y=%d, NUM_LEDS=%d", x, y, NUM_LEDS);
+            COUNT_ERROR(ErrorCounter::PixelOutOfRange, "Invalid setPixel request: x=%d, y=%d, NUM_LEDS=%d", x, y, NUM_LEDS);
     }
 
-    virtual void setPixel(int16_t x, int r, int g, int b)
+    void setPixel(int16_t x, int r, int g, int b)
     {
         if (isValidPixel(x))
             setPixel(x, CRGB(r, g, b));
         else
-            debugE("Invalid setPixel request: x=%d, NUM_LEDS=%d", x, NUM_LEDS);
+            COUNT_ERROR(ErrorCounter::PixelOutOfRange, "Invalid setPixel request: x=%d, NUM_LEDS=%d", x, NUM_LEDS);
 
     }
 
-    virtual void setPixel(int x, CRGB color)
+    void setPixel(int x, CRGB color)
     {
         if (isValidPixel(x))
+        {
             leds[x] = color;
+            MarkAllDirty();
+        }
         else
-            debugE("Invalid setPixel request: x=%d, NUM_LEDS=%d", x, NUM_LEDS);
+            COUNT_ERROR(ErrorCounter::PixelOutOfRange, "Invalid setPixel request: x=%d, NUM_LEDS=%d", x, NUM_LEDS);
     }
 
     // DrawSafeCircle
@@ -410,101 +826,186 @@ public:
 
     void setPixelsF(float fPos, float count, CRGB c, bool bMerge = false)
     {
-        float frac1 = fPos - floor(fPos);                 // eg:   3.25 becomes 0.25
-        float frac2 = fPos + count - floor(fPos + count); // eg:   3.25 + 1.5 yields 4.75 which becomes 0.75
+        setPixelSpan(ToSubpixel(fPos), ToSubpixel(count), c, bMerge);
+    }
 
-        /* Example:
+    // Subpixel spans
+    //
+    // The fixed point form of setPixelsF, which it's now built on.  Positions and lengths are in 1/256ths of a pixel,
+    // so the two partly covered end pixels get their share of the color from an integer multiply, and the pixels in
+    // between are filled or added to as a run.  The shares work out the same as the float math did for anything on a
+    // 1/256th boundary.  Effects that draw several spans a frame can hand them all over in one call.
 
-          Starting at 3.25, draw for 1.5:
-          We start at pixel 3.
-          We fill pixel with .75 worth of color
-          We advance to next pixel
+    static constexpr int     kSubpixelShift = 8;
+    static constexpr int32_t kSubpixels     = 1 << kSubpixelShift;
 
-          We fill one pixel and advance to next pixel
+    struct PixelSpan
+    {
+        int32_t Start;                                  // In subpixels
+        int32_t Length;
+        CRGB    Color;
+    };
 
-          We are now at pixel 5, frac2 = .75
-          We fill pixel with .75 worth of color
-        */
+    static int32_t ToSubpixel(float f)
+    {
+        return (int32_t) floorf(f * kSubpixels + 0.5f);
+    }
 
-        uint8_t fade1 = (uint8_t) ((std::max(frac1, 1.0f - count)) * 255); // Fraction is how far past pixel boundary we are (up to our total size) so larger fraction is more dimming
-        uint8_t fade2 = (uint8_t) ((1.0f - frac2) * 255);                   // Fraction is how far we are poking into this pixel, so larger fraction is less dimming
-        CRGB c1 = c;
-        CRGB c2 = c;
-        c1 = c1.fadeToBlackBy(fade1);
-        c2 = c2.fadeToBlackBy(fade2);
+    // The scale for a pixel the span covers this many subpixels of; the float version faded by the uncovered part
+    static uint8_t CoverageScale(int32_t covered)
+    {
+        return 255 - (((kSubpixels - covered) * 255) >> kSubpixelShift);
+    }
 
-        // These assignments use the + operator of CRGB to merge the colors when requested, and its pretty
-        // naive, just saturating each color element at 255, so the operator could be improved or replaced
-        // if needed...
+    void setPixelSpan(int32_t start, int32_t length, CRGB c, bool bMerge = false)
+    {
+        MarkAllDirty();
+        drawPixelSpan(start, length, PackPixel(c), bMerge);
+    }
 
-        float p = fPos;
-        if (p >= 0 && isValidPixel(p))
-            leds[(int)p] = bMerge ? leds[(int)p] + c1 : c1;
+    void setPixelSpans(const PixelSpan * pSpans, size_t count, bool bMerge = false)
+    {
+        MarkAllDirty();
+        for (size_t i = 0; i < count; i++)
+            drawPixelSpan(pSpans[i].Start, pSpans[i].Length, PackPixel(pSpans[i].Color), bMerge);
+    }
 
-        p = fPos + (1.0f - frac1);
-        count -= (1.0f - frac1);
+private:
 
-        // Middle (body) pixels
+    inline void blendSubpixel(int32_t i, uint32_t color, bool bMerge)
+    {
+        if (i >= 0 && isValidPixel(i))
+            leds[i] = UnpackPixel(bMerge ? AddPacked(PackPixel(leds[i]), color) : color);
+    }
+
+    void drawPixelSpan(int32_t start, int32_t length, uint32_t color, bool bMerge)
+    {
+        const int32_t ledCount = GetLEDCount();
+
+        // The first pixel is always drawn, even when the span covers none of it, as setPixelsF did
+
+        int32_t first     = start >> kSubpixelShift;                  // Rounds down for spans that start off the strip
+        int32_t firstPart = kSubpixels - (start & (kSubpixels - 1));
+        blendSubpixel(first, ScalePacked(color, FixedScale(CoverageScale(std::clamp<int32_t>(length, 0, firstPart)))), bMerge);
+
+        int32_t remaining = length - firstPart;
+        if (remaining <= 0)
+            return;
 
-        while (count >= 1)
+        // The pixels it covers completely, clipped to the strip, and then the partly covered one at the end
+
+        int32_t body    = first + 1;
+        int32_t bodyEnd = body + (remaining >> kSubpixelShift);
+        int32_t from    = std::max<int32_t>(body, 0);
+        int32_t to      = std::min<int32_t>(bodyEnd, ledCount);
+
+        if (bMerge)
         {
-            if (p >= 0 && isValidPixel(p))
-                leds[(int)p] = bMerge ? leds[(int)p] + c : c;
-            count--;
-            p++;
-        };
+            for (int32_t i = from; i < to; i++)
+                leds[i] = UnpackPixel(AddPacked(PackPixel(leds[i]), color));
+        }
+        else
+        {
+            const CRGB solid = UnpackPixel(color);
+            for (int32_t i = from; i < to; i++)
+                leds[i] = solid;
+        }
 
-        // Final pixel, if in bounds
-        if (count > 0)
-            if (p >= 0 && isValidPixel(p))
-                leds[(int)p] = bMerge ? leds[(int)p] + c2 : c2;
+        int32_t lastPart = remaining & (kSubpixels - 1);
+        if (lastPart)
+            blendSubpixel(bodyEnd, ScalePacked(color, FixedScale(CoverageScale(lastPart))), bMerge);
     }
 
-    void blurRows(CRGB *leds, uint16_t width, uint16_t height, uint16_t first, fract8 blur_amount)
+public:
+
+    // Packed pixel arithmetic
+    //
+    // A CRGB is held as 0x00BBGGRR in a 32-bit word so all three channels are scaled with two multiplies and added
+    // with a handful of logic ops.  The results match CRGB::nscale8 and CRGB::operator+= bit for bit.
+
+    static inline uint32_t PackPixel(const CRGB & c)
+    {
+        return c.r | (c.g << 8) | (c.b << 16);
+    }
+
+    static inline CRGB UnpackPixel(uint32_t w)
+    {
+        return CRGB(w & 0xFF, (w >> 8) & 0xFF, (w >> 16) & 0xFF);
+    }
+
+    static inline uint16_t FixedScale(uint8_t scale)        // The multiplier scale8 really uses
+    {
+        return scale + (FASTLED_SCALE8_FIXED ? 1 : 0);
+    }
+
+    static inline uint32_t ScalePacked(uint32_t w, uint16_t fixedScale)
+    {
+        return ((((w & 0x00FF00FF) * fixedScale) >> 8) & 0x00FF00FF)
+             | ((((w & 0x0000FF00) * fixedScale) >> 8) & 0x0000FF00);
+    }
+
+    static inline uint32_t ScaleBytes(uint32_t w, uint16_t fixedScale)   // All four bytes when they're not a pixel
+    {
+        return ((((w & 0x00FF00FF) * fixedScale) >> 8) & 0x00FF00FF)
+             | ((((w >> 8) & 0x00FF00FF) * fixedScale) & 0xFF00FF00);
+    }
+
+    static inline uint32_t AddPacked(uint32_t a, uint32_t b)  // Saturating add of each byte
     {
-        // blur rows same as columns, for irregular matrix
-        uint8_t keep = 255 - blur_amount;
-        uint8_t seep = blur_amount >> 1;
-        for (uint16_t row = 0; row < height; row++)
+        uint32_t sum   = ((a & 0x7F7F7F7F) + (b & 0x7F7F7F7F)) ^ ((a ^ b) & 0x80808080);
+        uint32_t carry = ((a & b) | ((a | b) & ~sum)) & 0x80808080;
+        return sum | ((carry << 1) - (carry >> 7));
+    }
+
+    // BlurLine
+    //
+    // A blur1d along whatever line of pixels indexOf walks, which lets rows and columns share the packed kernel
+
+    template <typename IndexFn>
+    static void BlurLine(CRGB * leds, uint16_t first, uint16_t length, fract8 blur_amount, IndexFn indexOf)
+    {
+        const uint16_t keep = FixedScale(255 - blur_amount);
+        const uint16_t seep = FixedScale(blur_amount >> 1);
+        uint32_t carryover = 0;
+
+        for (uint16_t i = first; i < length; i++)
         {
-            CRGB carryover = CRGB::Black;
-            for (uint16_t i = first; i < width; i++)
+            CRGB & pixel = leds[indexOf(i)];
+            uint32_t cur  = PackPixel(pixel);
+            uint32_t part = ScalePacked(cur, seep);
+            cur = AddPacked(ScalePacked(cur, keep), carryover);
+            if (i)
             {
-                CRGB cur = leds[XY(i, row)];
-                CRGB part = cur;
-                part.nscale8(seep);
-                cur.nscale8(keep);
-                cur += carryover;
-                if (i)
-                    leds[XY(i - 1, row)] += part;
-                leds[XY(i, row)] = cur;
-                carryover = part;
+                CRGB & previous = leds[indexOf(i - 1)];
+                previous = UnpackPixel(AddPacked(PackPixel(previous), part));
             }
+            pixel = UnpackPixel(cur);
+            carryover = part;
         }
     }
 
+    void blurRows(CRGB *leds, uint16_t width, uint16_t height, uint16_t first, fract8 blur_amount)
+    {
+        MarkAllDirty();
+
+        // blur rows same as columns, for irregular matrix.  Each row is its own, so they're shared between the cores.
+        g_ParallelFor.Run(height, [&](uint16_t begin, uint16_t end)
+        {
+            for (uint16_t row = begin; row < end; row++)
+                BlurLine(leds, first, width, blur_amount, [&](uint16_t i) { return XY(i, row); });
+        }, 4);
+    }
+
     // blurColumns: perform a blur1d on each column of a rectangular matrix
     void blurColumns(CRGB *leds, uint16_t width, uint16_t height, uint16_t first, fract8 blur_amount)
     {
-        // blur columns
-        uint8_t keep = 255 - blur_amount;
-        uint8_t seep = blur_amount >> 1;
-        for (uint16_t col = 0; col < width; ++col)
+        MarkAllDirty();
+
+        g_ParallelFor.Run(width, [&](uint16_t begin, uint16_t end)
         {
-            CRGB carryover = CRGB::Black;
-            for (uint16_t i = first; i < height; ++i)
-            {
-                CRGB cur = leds[XY(col, i)];
-                CRGB part = cur;
-                part.nscale8(seep);
-                cur.nscale8(keep);
-                cur += carryover;
-                if (i)
-                    leds[XY(col, i - 1)] += part;
-                leds[XY(col, i)] = cur;
-                carryover = part;
-            }
-        }
+            for (uint16_t col = begin; col < end; ++col)
+                BlurLine(leds, first, height, blur_amount, [&](uint16_t i) { return XY(col, i); });
+        }, 4);
     }
 
     void blur2d(CRGB *leds, uint16_t width, uint16_t firstColumn, uint16_t height, uint16_t firstRow, fract8 blur_amount)
@@ -524,6 +1025,12 @@ public:
         loadPalette(_paletteIndex + offset);
     }
 
+    // The palette loadPalette() last loaded, or -1 if none has been
+    int PaletteIndex() const
+    {
+        return _paletteIndex;
+    }
+
     void ChangePalettePeriodically()
     {
         if (_palettePaused)
@@ -586,7 +1093,11 @@ public:
 
         ChangePalettePeriodically();
         uint8_t maxChanges = 24;
-        nblendPaletteTowardPalette(_currentPalette, _targetPalette, maxChanges);
+        if (_currentPalette != _targetPalette)
+        {
+            nblendPaletteTowardPalette(_currentPalette, _targetPalette, maxChanges);
+            PaletteChanged();
+        }
     }
 
     void RandomPalette()
@@ -606,6 +1117,7 @@ public:
         _currentPalette = palette;
         _targetPalette = palette;
         _currentPaletteName = "Custom";
+        PaletteChanged();
     }
 
     void loadPalette(int index)
@@ -666,6 +1178,7 @@ public:
             break;
         }
         _currentPalette = _targetPalette;
+        PaletteChanged();
     }
 
     void setPalette(String paletteName)
@@ -770,22 +1283,78 @@ public:
         memset(p, 0, sizeof(p));
     }
 
-    // All the caleidoscope functions work directly within the screenbuffer (leds array).
-    // Draw whatever you like in the area x(0-15) and y (0-15) and then copy it arround.
+    // Symmetry operations the caleidoscope functions are built from.  On a row major layout they copy whole rows, or
+    // runs along them, rather than a pixel at a time through XY().
 
-    // rotates the first 16x16 quadrant 3 times onto a 32x32 (+90 degrees rotation for each one)
+    // MirrorLeftToRight - Copies the left half of each of the rows over the right half, reversed
 
-    void Caleidoscope1()
+    void MirrorLeftToRight(int fromY = 0, int toY = MATRIX_HEIGHT)
     {
-        for (int x = 0; x < ((_width + 1) / 2); x++)
+        for (int y = fromY; y < toY; y++)
         {
-            for (int y = 0; y < ((_height + 1) / 2); y++)
+            if constexpr (hasRowSpans())
+                mirrorSpan(rowUnchecked(y), _width);
+            else
+                for (int x = 0; x < _width / 2; x++)
+                    leds[XY(_width - 1 - x, y)] = leds[XY(x, y)];
+        }
+    }
+
+    // MirrorTopToBottom - Copies the top half of the rows over the bottom half, in reverse order
+
+    void MirrorTopToBottom()
+    {
+        for (int y = 0; y < _height / 2; y++)
+        {
+            if constexpr (hasRowSpans())
+                memcpy(rowUnchecked(_height - 1 - y), rowUnchecked(y), _width * sizeof(CRGB));
+            else
+                for (int x = 0; x < _width; x++)
+                    leds[XY(x, _height - 1 - y)] = leds[XY(x, y)];
+        }
+    }
+
+    // TransposeLowerToUpper - Copies the triangle below the diagonal of the square at the top left, with sides of the
+    // given size, over the triangle above it
+
+    void TransposeLowerToUpper(int size)
+    {
+        if constexpr (hasRowSpans())
+        {
+            // Tile by tile along the upper triangle, writing along the rows and reading down the columns of the tile
+            for (int tileY = 0; tileY < size; tileY += kTransposeTile)
             {
-                leds[XY(_width - 1 - x, y)] = leds[XY(x, y)];
-                leds[XY(_width - 1 - x, _height - 1 - y)] = leds[XY(x, y)];
-                leds[XY(x, _height - 1 - y)] = leds[XY(x, y)];
+                for (int tileX = tileY; tileX < size; tileX += kTransposeTile)
+                {
+                    const int endY = std::min(tileY + kTransposeTile, size);
+                    const int endX = std::min(tileX + kTransposeTile, size);
+
+                    for (int y = tileY; y < endY; y++)
+                    {
+                        CRGB * row = rowUnchecked(y);
+                        for (int x = std::max(tileX, y + 1); x < endX; x++)
+                            row[x] = rowUnchecked(x)[y];
+                    }
+                }
             }
         }
+        else
+        {
+            for (int x = 0; x < size; x++)
+                for (int y = 0; y < x; y++)
+                    leds[XY(x, y)] = leds[XY(y, x)];
+        }
+    }
+
+    // All the caleidoscope functions work directly within the screenbuffer (leds array).
+    // Draw whatever you like in the area x(0-15) and y (0-15) and then copy it arround.
+
+    // rotates the first 16x16 quadrant 3 times onto a 32x32 (+90 degrees rotation for each one)
+
+    void Caleidoscope1()
+    {
+        MirrorLeftToRight(0, (_height + 1) / 2);
+        MirrorTopToBottom();
     }
 
     // mirror the first 16x16 quadrant 3 times onto a 32x32
@@ -805,13 +1374,7 @@ public:
     // copy one diagonal triangle into the other one within a 16x16
     void Caleidoscope3()
     {
-        for (int x = 0; x < ((_width + 1) / 2); x++)
-        {
-            for (int y = 0; y <= x; y++)
-            {
-                leds[XY(x, y)] = leds[XY(y, x)];
-            }
-        }
+        TransposeLowerToUpper((_width + 1) / 2);
     }
 
     // copy one diagonal triangle into the other one within a 16x16 (90 degrees rotated compared to Caleidoscope3)
@@ -975,6 +1538,17 @@ public:
     // give it a linear tail to the right
     void StreamRight(uint8_t scale, int fromX = 0, int toX = MATRIX_WIDTH, int fromY = 0, int toY = MATRIX_HEIGHT)
     {
+        if constexpr (hasRowSpans())
+        {
+            for (int y = fromY; y < toY; y++)
+            {
+                CRGB * row = rowUnchecked(y);
+                addAndScaleSpan(row + fromX + 1, row + fromX, toX - fromX - 1, scale);
+                row[0].nscale8(scale);
+            }
+            return;
+        }
+
         for (int x = fromX + 1; x < toX; x++)
         {
             for (int y = fromY; y < toY; y++)
@@ -990,6 +1564,22 @@ public:
     // give it a linear tail to the left
     void StreamLeft(uint8_t scale, int fromX = MATRIX_WIDTH, int toX = 0, int fromY = 0, int toY = MATRIX_HEIGHT)
     {
+        // On rows, the last pixel has nothing to its right to take in, so it only fades
+
+        if constexpr (hasRowSpans())
+        {
+            int lastX = std::min<int>(fromX, _width - 1);
+            for (int y = fromY; y < toY; y++)
+            {
+                CRGB * row = rowUnchecked(y);
+                addAndScaleSpan(row + toX, row + toX + 1, lastX - toX, scale);
+                if (fromX >= _width)
+                    row[_width - 1].nscale8(scale);
+                row[0].nscale8(scale);
+            }
+            return;
+        }
+
         for (int x = toX; x < fromX; x++)
         {
             for (int y = fromY; y < toY; y++)
@@ -1005,6 +1595,14 @@ public:
     // give it a linear tail downwards
     void StreamDown(uint8_t scale)
     {
+        if constexpr (hasRowSpans())
+        {
+            for (int y = 1; y < _height; y++)
+                addAndScaleSpan(rowUnchecked(y), rowUnchecked(y - 1), _width, scale);
+            scaleSpan(rowUnchecked(0), _width, scale);
+            return;
+        }
+
         for (int x = 0; x < _width; x++)
         {
             for (int y = 1; y < _height; y++)
@@ -1020,6 +1618,14 @@ public:
     // give it a linear tail upwards
     void StreamUp(uint8_t scale)
     {
+        if constexpr (hasRowSpans())
+        {
+            for (int y = _height - 2; y >= 0; y--)
+                addAndScaleSpan(rowUnchecked(y), rowUnchecked(y + 1), _width, scale);
+            scaleSpan(rowUnchecked(_height - 1), _width, scale);
+            return;
+        }
+
         for (int x = 0; x < _width; x++)
         {
             for (int y = _height - 2; y >= 0; y--)
@@ -1035,12 +1641,21 @@ public:
     // give it a linear tail up and to the left
     void StreamUpAndLeft(uint8_t scale)
     {
-        for (int x = 0; x < _width - 1; x++)
+        if constexpr (hasRowSpans())
         {
-            for (int y = _height - 2; y >= 0; y--)
+            // Going down the rows, so each takes in the one below it before that has changed
+            for (int y = 0; y < _height - 1; y++)
+                addAndScaleSpan(rowUnchecked(y), rowUnchecked(y + 1) + 1, _width - 1, scale);
+        }
+        else
+        {
+            for (int x = 0; x < _width - 1; x++)
             {
-                leds[XY(x, y)] += leds[XY(x + 1, y + 1)];
-                leds[XY(x, y)].nscale8(scale);
+                for (int y = _height - 2; y >= 0; y--)
+                {
+                    leds[XY(x, y)] += leds[XY(x + 1, y + 1)];
+                    leds[XY(x, y)].nscale8(scale);
+                }
             }
         }
         for (int x = 0; x < _width; x++)
@@ -1053,12 +1668,29 @@ public:
 
     void StreamUpAndRight(uint8_t scale)
     {
-        for (int x = 0; x < _width - 1; x++)
+        if constexpr (hasRowSpans())
         {
+            // Going up the rows, so each takes in the one below it after that's been done, as the columns do.  The
+            // right column takes in without fading here; that's left to the fade below.
             for (int y = _height - 2; y >= 0; y--)
             {
-                leds[XY(x + 1, y)] += leds[XY(x, y + 1)];
-                leds[XY(x, y)].nscale8(scale);
+                CRGB * row = rowUnchecked(y);
+                const CRGB * below = rowUnchecked(y + 1);
+
+                row[0].nscale8(scale);
+                addAndScaleSpan(row + 1, below, _width - 2, scale);
+                row[_width - 1] += below[_width - 2];
+            }
+        }
+        else
+        {
+            for (int x = 0; x < _width - 1; x++)
+            {
+                for (int y = _height - 2; y >= 0; y--)
+                {
+                    leds[XY(x + 1, y)] += leds[XY(x, y + 1)];
+                    leds[XY(x, y)].nscale8(scale);
+                }
             }
         }
         // fade the bottom row
@@ -1074,6 +1706,12 @@ public:
 
     void MoveDown()
     {
+        if constexpr (hasRowSpans())
+        {
+            moveSpan(rowUnchecked(1), rowUnchecked(0), (_height - 1) * _width);
+            return;
+        }
+
         for (int y = _height - 1; y > 0; y--)
         {
             for (int x = 0; x < _width; x++)
@@ -1087,6 +1725,12 @@ public:
 
     void VerticalMoveFrom(int start, int end)
     {
+        if constexpr (hasRowSpans())
+        {
+            moveSpan(rowUnchecked(start + 1), rowUnchecked(start), (end - start) * _width);
+            return;
+        }
+
         for (int y = end; y > start; y--)
         {
             for (int x = 0; x < _width; x++)
@@ -1120,7 +1764,10 @@ public:
         for (;;)
         {
             if (isValidPixel(x0, y0))
+            {
                 leds[XY(x0, y0)] = bMerge ? leds[XY(x0, y0)] + color : color;
+                MarkDirty(x0, y0);
+            }
 
             if (x0 == x1 && y0 == y1)
                 break;
@@ -1157,20 +1804,187 @@ public:
         BresenhamLine(x0, y0, x1, y1, color);
     }
 
+    // DimAll
+    //
+    // Scales every channel the same way, so rather than go pixel by pixel we treat the buffer as plain bytes and
+    // do four at a time, with byte loops only for the odd ends that aren't word aligned
+
     void DimAll(uint8_t value)
     {
-        for (int i = 0; i < NUM_LEDS; i++)
-        {
-            // if ((leds[i].r != 255) || (leds[i].g != 255) || (leds[i].b != 255))           // Don't dim pure white
-            leds[i].nscale8(value);
-        }
+        MarkAllDirty();
+
+        const uint16_t fixedScale = FixedScale(value);
+        uint8_t * pBytes = (uint8_t *) leds;
+        uint8_t * pEnd   = pBytes + sizeof(CRGB) * NUM_LEDS;
+
+        for (; pBytes < pEnd && ((uintptr_t) pBytes & 3); pBytes++)
+            *pBytes = (*pBytes * fixedScale) >> 8;
+
+        for (; pBytes + 4 <= pEnd; pBytes += 4)
+            *(uint32_t *) pBytes = ScaleBytes(*(uint32_t *) pBytes, fixedScale);
+
+        for (; pBytes < pEnd; pBytes++)
+            *pBytes = (*pBytes * fixedScale) >> 8;
+    }
+
+    void fadeAllToBlackBy(uint8_t fade)
+    {
+        DimAll(255 - fade);
     }
 
     CRGB ColorFromCurrentPalette(uint8_t index = 0, uint8_t brightness = 255, TBlendType blendType = LINEARBLEND) const
     {
+        #if ENABLE_PALETTE_CACHE
+            if (const CRGB * pTable = ExpandedPalette(brightness))
+                return pTable[index];
+        #endif
+
         return ColorFromPalette(_currentPalette, index, brightness, _currentBlendType);
     }
 
+    // Indexed frame
+    //
+    // For effects whose every pixel is a color from the current palette at some level.  They draw palette indexes
+    // and levels with SetIndexedPixel() and fade with DimIndexed(), which touches one byte a pixel rather than three,
+    // and PresentIndexed() expands the whole frame into leds once the effect is done with it.  Since the colors come
+    // from the palette as it is when the frame is presented, what's already drawn follows the palette as it cycles,
+    // and a palette change costs 256 lookups rather than one a pixel.
+
+    // IndexedFrameLease
+    //
+    // An effect's hold on the indexed frame, which it takes with LeaseIndexedFrame() in AcquireState() and keeps as
+    // a member, so it's given back by ReleaseState() or, if the effect is deleted while it's resident, along with
+    // the effect.  The frame belongs to the GFXBase rather than to any one effect, and is freed once the last lease
+    // goes.  Each lease charges its holder's account for the frame while it's held, so no account is left paying
+    // for it after its effect is gone.
+
+    class IndexedFrameLease
+    {
+        GFXBase &             _gfx;
+        EffectMemoryAccount & _account;
+
+      public:
+
+        IndexedFrameLease(GFXBase & gfx, EffectMemoryAccount & account) : _gfx(gfx), _account(account)
+        {
+        }
+
+        ~IndexedFrameLease()
+        {
+            _gfx.ReleaseIndexedFrame(_account);
+        }
+
+        IndexedFrameLease(const IndexedFrameLease &) = delete;
+        IndexedFrameLease & operator=(const IndexedFrameLease &) = delete;
+    };
+
+    // Allocates the frame, cleared, for the first lease; returns nullptr if there wasn't the memory for it
+    std::unique_ptr<IndexedFrameLease> LeaseIndexedFrame(EffectMemoryAccount & account)
+    {
+        std::lock_guard<std::mutex> guard(_indexedMutex);
+
+        if (!_pIndexedFrame)
+        {
+            _pIndexedFrame.reset((uint8_t *) PreferPSRAMAlloc(_width * _height * 2));
+            _pIndexedTable.reset((CRGB *) PreferPSRAMAlloc(256 * sizeof(CRGB)));
+            if (!_pIndexedFrame || !_pIndexedTable)
+            {
+                _pIndexedFrame.reset();
+                _pIndexedTable.reset();
+                return nullptr;
+            }
+            _bIndexedTableValid = false;
+            ClearIndexed();
+        }
+
+        auto pLease = std::make_unique<IndexedFrameLease>(*this, account);
+        _cIndexedUsers++;
+        #if ENABLE_EFFECT_MEMORY_ACCOUNTING
+            account.Add(_pIndexedFrame.get(), _width * _height * 2);
+            account.Add(_pIndexedTable.get(), 256 * sizeof(CRGB));
+        #endif
+        return pLease;
+    }
+
+private:
+
+    void ReleaseIndexedFrame(EffectMemoryAccount & account)
+    {
+        std::lock_guard<std::mutex> guard(_indexedMutex);
+
+        #if ENABLE_EFFECT_MEMORY_ACCOUNTING
+            account.Remove(_pIndexedFrame.get(), _width * _height * 2);
+            account.Remove(_pIndexedTable.get(), 256 * sizeof(CRGB));
+        #endif
+
+        if (--_cIndexedUsers > 0)
+            return;
+
+        _pIndexedFrame.reset();
+        _pIndexedTable.reset();
+    }
+
+public:
+
+    void ClearIndexed()
+    {
+        memset(_pIndexedFrame.get(), 0, _width * _height * 2);
+    }
+
+    void SetIndexedPixel(int x, int y, uint8_t index, uint8_t level = 255)
+    {
+        if (!isValidPixel(x, y))
+            return;
+
+        uint16_t i = fastXY(x, y);
+        _pIndexedFrame[i] = index;
+        _pIndexedFrame[_width * _height + i] = level;
+    }
+
+    // Scales the level of every pixel, like DimAll() does the colors
+    void DimIndexed(uint8_t value)
+    {
+        const uint16_t fixedScale = FixedScale(value);
+        uint8_t * pLevel = _pIndexedFrame.get() + _width * _height;
+        uint8_t * pEnd   = pLevel + _width * _height;
+
+        for (; pLevel < pEnd && ((uintptr_t) pLevel & 3); pLevel++)
+            *pLevel = (*pLevel * fixedScale) >> 8;
+
+        for (; pLevel + 4 <= pEnd; pLevel += 4)
+            *(uint32_t *) pLevel = ScaleBytes(*(uint32_t *) pLevel, fixedScale);
+
+        for (; pLevel < pEnd; pLevel++)
+            *pLevel = (*pLevel * fixedScale) >> 8;
+    }
+
+    void PresentIndexed()
+    {
+        if (!_bIndexedTableValid || _indexedTablePalette != _currentPalette || _indexedTableBlend != _currentBlendType)
+        {
+            for (int i = 0; i < 256; i++)
+                _pIndexedTable[i] = ColorFromPalette(_currentPalette, i, 255, _currentBlendType);
+
+            _indexedTablePalette = _currentPalette;
+            _indexedTableBlend   = _currentBlendType;
+            _bIndexedTableValid  = true;
+        }
+
+        MarkAllDirty();
+
+        const size_t count = _width * _height;
+        const uint8_t * pIndex = _pIndexedFrame.get();
+        const uint8_t * pLevel = pIndex + count;
+
+        for (size_t i = 0; i < count; i++)
+        {
+            CRGB color = _pIndexedTable[pIndex[i]];
+            if (pLevel[i] != 255)
+                color.nscale8(pLevel[i]);
+            leds[i] = color;
+        }
+    }
+
     CRGB HsvToRgb(uint8_t h, uint8_t s, uint8_t v) const
     {
         CHSV hsv = CHSV(h, s, v);
@@ -1230,6 +2044,20 @@ public:
 
     virtual void MoveInwardX(int startY = 0, int endY = MATRIX_HEIGHT - 1)
     {
+        // On rows, the last pixel has nothing to its right to move in, so it stays as it is
+
+        if constexpr (hasRowSpans())
+        {
+            const int half = _width / 2;
+            for (int y = startY; y <= endY; y++)
+            {
+                CRGB * row = rowUnchecked(y);
+                moveSpan(row + 1, row, half);
+                moveSpan(row + half, row + half + 1, _width - half - 1);
+            }
+            return;
+        }
+
         for (int y = startY; y <= endY; y++)
         {
             for (int x = _width / 2; x > 0; x--)
@@ -1242,6 +2070,18 @@ public:
 
     virtual void MoveOutwardsX(int startY = 0, int endY = MATRIX_HEIGHT - 1)
     {
+        if constexpr (hasRowSpans())
+        {
+            const int count = _width / 2 - 1;
+            for (int y = startY; y <= endY; y++)
+            {
+                CRGB * row = rowUnchecked(y);
+                moveSpan(row, row + 1, count);
+                moveSpan(row + _width - count, row + _width - count - 1, count);
+            }
+            return;
+        }
+
         for (int y = startY; y <= endY; y++)
         {
             for (int x = 0; x < _width / 2 - 1; x++)
@@ -1256,6 +2096,23 @@ public:
 
     void MoveX(uint8_t delta)
     {
+        // The wrap copies from the part that's already moved, so a row is one move and one copy as long as the two don't
+        // overlap.  Bigger shifts go the long way round.
+
+        if constexpr (hasRowSpans())
+        {
+            if (delta * 2 <= _width)
+            {
+                for (int y = 0; y < _height; y++)
+                {
+                    CRGB * row = rowUnchecked(y);
+                    moveSpan(row, row + delta, _width - delta);
+                    moveSpan(row + _width - delta, row, delta);
+                }
+                return;
+            }
+        }
+
         for (int y = 0; y < _height; y++)
         {
             // First part
@@ -1271,6 +2128,24 @@ public:
 
     void MoveY(uint8_t delta)
     {
+        // Each pass puts the first row's original content at the bottom, so after delta passes the rows have moved up
+        // by delta and the ones that opened up at the bottom all hold the original first row
+
+        if constexpr (hasRowSpans())
+        {
+            const int moved = std::min<int>(delta, _height);
+            if (moved == 0)
+                return;
+
+            CRGB firstRow[MATRIX_WIDTH];
+            memcpy(firstRow, rowUnchecked(0), _width * sizeof(CRGB));
+
+            moveSpan(rowUnchecked(0), rowUnchecked(moved), (_height - moved) * _width);
+            for (int y = _height - moved; y < _height; y++)
+                memcpy(rowUnchecked(y), firstRow, _width * sizeof(CRGB));
+            return;
+        }
+
         CRGB tmp = 0;
         for (int x = 0; x < _width; x++)
         {
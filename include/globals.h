@@ -85,6 +85,13 @@
 
 #pragma once
 
+// The host build of the benchmarks in bench/ has none of the ESP32, LED or network libraries, and only compiles the
+// kernels that don't need them, so it takes its settings and stand-ins from there instead of from this file
+
+#if NATIVE_BUILD
+#include "native_globals.h"
+#else
+
 #include <inttypes.h>
 #include <iostream>
 #include <memory>
@@ -104,6 +111,20 @@
 
 //  See https://github.com/PlummersSoftwareLLC/NightDriverStrip/issues/515
 #define FASTLED_ESP32_FLASH_LOCK 1
+
+// With ENABLE_PARALLEL_LED_OUTPUT, FastLED clocks all the strip channels out at once through the I2S peripheral and
+// DMA rather than one RMT channel after another, so show() takes as long as the longest strand instead of all of
+// them together, and up to 16 channels can be driven.  It has to be decided before FastLED.h is included, so unlike
+// the other flags its default lives here.
+
+#ifndef ENABLE_PARALLEL_LED_OUTPUT
+#define ENABLE_PARALLEL_LED_OUTPUT 0
+#endif
+
+#if ENABLE_PARALLEL_LED_OUTPUT
+#define FASTLED_ESP32_I2S true
+#endif
+
 #define FASTLED_INTERNAL 1               // Suppresses build banners
 #include <FastLED.h>
 
@@ -187,7 +208,9 @@
 // Idle tasks in taskmgr run at IDLE_PRIORITY+1 so you want to be at least +2
 
 #define DRAWING_PRIORITY        tskIDLE_PRIORITY+8
+#define PRESENT_PRIORITY        tskIDLE_PRIORITY+8
 #define SOCKET_PRIORITY         tskIDLE_PRIORITY+7
+#define UDP_PRIORITY            tskIDLE_PRIORITY+7
 #define AUDIOSERIAL_PRIORITY    tskIDLE_PRIORITY+6      // If equal or lower than audio, will produce garbage on serial
 #define NET_PRIORITY            tskIDLE_PRIORITY+5
 #define AUDIO_PRIORITY          tskIDLE_PRIORITY+4
@@ -197,6 +220,16 @@
 #define DEBUG_PRIORITY          tskIDLE_PRIORITY+2
 #define JSONWRITER_PRIORITY     tskIDLE_PRIORITY+2
 #define COLORDATA_PRIORITY      tskIDLE_PRIORITY+2
+#define PREPARE_PRIORITY        tskIDLE_PRIORITY+2
+#define BOOT_PRIORITY           tskIDLE_PRIORITY+2
+#define OTA_PRIORITY            tskIDLE_PRIORITY+3
+#define NETREADER_PRIORITY      tskIDLE_PRIORITY+2
+#define PARALLEL_PRIORITY       tskIDLE_PRIORITY+3      // Below audio, as the draw loop does the rows itself if the worker can't
+#define SHOW_PRIORITY           tskIDLE_PRIORITY+5
+#define SHOW_RECORDER_PRIORITY  tskIDLE_PRIORITY+2
+#define EFFECT_SYNC_PRIORITY    tskIDLE_PRIORITY+3
+#define CLOCK_SYNC_PRIORITY     tskIDLE_PRIORITY+3
+#define ESPNOW_PRIORITY         tskIDLE_PRIORITY+3
 
 // If you experiment and mess these up, my go-to solution is to put Drawing on Core 0, and everything else on Core 1.
 // My current core layout is as follows, and as of today it's solid as of (7/16/21).
@@ -213,15 +246,45 @@
 // Drawing must be on Core 1 if using SmartMatrix unless you specify SMARTMATRIX_OPTIONS_ESP32_CALC_TASK_CORE_1
 
 #define DRAWING_CORE            1
+#define PRESENT_CORE            0
 #define NET_CORE                1
 #define AUDIO_CORE              0
 #define AUDIOSERIAL_CORE        1
 #define SCREEN_CORE             1
 #define DEBUG_CORE              1
 #define SOCKET_CORE             1
+#define UDP_CORE                1
 #define REMOTE_CORE             1
 #define JSONWRITER_CORE         0
 #define COLORDATA_CORE          1
+#define PREPARE_CORE            0
+#define BOOT_CORE               0
+#define OTA_CORE                0
+#define NETREADER_CORE          0
+#define PARALLEL_CORE           0
+#define SHOW_CORE               0
+#define SHOW_RECORDER_CORE      0
+#define EFFECT_SYNC_CORE        0
+#define CLOCK_SYNC_CORE         0
+#define ESPNOW_CORE             0
+
+// Task placement profiles
+//
+// The cores and priorities above are the default profile.  The others move the network, audio and helper tasks around
+// for a particular kind of installation, and are picked with the taskProfile device setting, which is applied as the
+// tasks are started and so takes effect after a reboot.  The drawing task stays where it is in all of them.  See
+// NightDriverTaskManager::Placement() for the layouts, and the TASKS list in /statistics for how a profile does.
+
+#define TASK_PROFILE_DEFAULT_LAYOUT     0       // The layout above
+#define TASK_PROFILE_STREAMING          1       // Pixel data comes in over WiFi: the socket and UDP tasks go next to the WiFi stack on core 0
+#define TASK_PROFILE_LOCAL_EFFECTS      2       // Effects drawn on the device: the network and helper tasks move off core 1
+#define TASK_PROFILE_AUDIO_HEAVY        3       // Audio reactive effects: the audio sampler gets core 0 and a higher priority
+#define TASK_PROFILE_MIN                TASK_PROFILE_DEFAULT_LAYOUT
+#define TASK_PROFILE_MAX                TASK_PROFILE_AUDIO_HEAVY
+
+#ifndef TASK_PROFILE_DEFAULT
+#define TASK_PROFILE_DEFAULT            TASK_PROFILE_DEFAULT_LAYOUT
+#endif
 
 #define FASTLED_INTERNAL            1   // Suppresses the compilation banner from FastLED
 #define __STDC_FORMAT_MACROS
@@ -1119,6 +1182,9 @@ extern RemoteDebug Debug;           // Let everyone in the project know about it
     #define SERIAL_PINRX    33
     #define SERIAL_PINTX    32
 #endif
+#ifndef AUDIOSERIAL_BAUD
+    #define AUDIOSERIAL_BAUD 2400                   // What PETRock reads the user port at
+#endif
 #endif
 
 #define STACK_SIZE (ESP_TASK_MAIN_STACK) // Stack size for each new thread
@@ -1134,6 +1200,10 @@ extern RemoteDebug Debug;           // Let everyone in the project know about it
 #define MIN_BUFFERS 3               // How many copies of LED buffers this board will keep at a minimum per strand
 #endif
 
+#if INCOMING_WIFI_ENABLED && MIN_BUFFERS < 3
+    #error The LEDBufferManager ring needs MIN_BUFFERS of at least 3 to hold any frames from the network
+#endif
+
 #ifndef MAX_BUFFERS
 #define MAX_BUFFERS (500)           // Just some reasonable guess, limiting it to 24 frames per second for 20 seconds
 #endif
@@ -1268,10 +1338,711 @@ extern RemoteDebug Debug;           // Let everyone in the project know about it
 #define TIME_BEFORE_LOCAL 5
 #endif
 
+#ifndef ENABLE_UDP_INGEST
+#define ENABLE_UDP_INGEST 0         // Also accept pixel data as UDP datagrams; define UDP_MULTICAST_GROUP to join a group
+#endif
+
+#ifndef ENABLE_DMX_INGEST
+#define ENABLE_DMX_INGEST 0         // Also accept pixel data as E1.31 (sACN) and Art-Net DMX universes; see dmxserver.h
+#endif
+
+#ifndef DMX_UNIVERSES_PER_CHANNEL
+#define DMX_UNIVERSES_PER_CHANNEL ((NUM_LEDS + 169) / 170)     // Enough universes of 170 RGB pixels to cover a channel
+#endif
+
+#ifndef DMX_SACN_START_UNIVERSE
+#define DMX_SACN_START_UNIVERSE 1   // The sACN universe that maps to the first pixel of channel 0
+#endif
+
+#ifndef DMX_ARTNET_START_UNIVERSE
+#define DMX_ARTNET_START_UNIVERSE 0 // The Art-Net port-address that maps to the first pixel of channel 0
+#endif
+
+#ifndef DMX_SACN_MULTICAST
+#define DMX_SACN_MULTICAST 1        // Join the sACN multicast group of each universe we map
+#endif
+
+#ifndef ENABLE_DDP_INGEST
+#define ENABLE_DDP_INGEST 0         // Also accept pixel data as DDP fragments, committed on the push flag; see ddpserver.h
+#endif
+
+#ifndef ENABLE_SHOW_PLAYBACK
+#define ENABLE_SHOW_PLAYBACK 0      // Play the pre-rendered show in the show partition, if there is one; see showplayer.h
+#endif
+
+#ifndef SHOW_PARTITION_LABEL
+#define SHOW_PARTITION_LABEL "show" // Data partition the show is written to
+#endif
+
+#ifndef SHOW_PLAYBACK_LEAD
+#define SHOW_PLAYBACK_LEAD 0.5      // Seconds of show frames kept in the rings ahead of when they're due
+#endif
+
+#ifndef ENABLE_SHOW_RECORDER
+#define ENABLE_SHOW_RECORDER 0      // Allow the incoming frames to be recorded to the show partition; see showrecorder.h
+#endif
+
+#ifndef SHOW_RECORD_QUEUE_LENGTH
+#define SHOW_RECORD_QUEUE_LENGTH 32 // Frames the recorder can fall behind by before it drops them
+#endif
+
+#ifndef SHOW_RECORD_KEYFRAME_INTERVAL
+#define SHOW_RECORD_KEYFRAME_INTERVAL 30    // Recorded frames per channel between keyframes; the rest are deltas
+#endif
+
+#ifndef SHOW_RECORD_HASH_BITS
+#define SHOW_RECORD_HASH_BITS 12    // Size of the recorder's match table, 4 bytes per entry
+#endif
+
+#ifndef ENABLE_ASSET_STORE
+#define ENABLE_ASSET_STORE 0        // GIFs, fonts and palettes uploaded to the asset partition; see assetstore.h
+#endif
+
+#ifndef ASSET_PARTITION_LABEL
+#define ASSET_PARTITION_LABEL "assets"  // Data partition the assets are kept in
+#endif
+
+// The zero-copy path fills the head slot of the ring outside of the buffer mutex, which is only safe when the
+// socket server is the sole producer, so it's off by default when UDP, DMX, DDP or a show is also feeding the ring
+
+#ifndef SOCKET_ZERO_COPY
+#define SOCKET_ZERO_COPY (!ENABLE_UDP_INGEST && !ENABLE_DMX_INGEST && !ENABLE_DDP_INGEST && !ENABLE_SHOW_PLAYBACK)    // Read single-channel pixel packets straight into the LEDBuffer ring
+#endif
+
+#ifndef SHARED_FRAME_POOL_SIZE
+#define SHARED_FRAME_POOL_SIZE (NUM_CHANNELS > 1 ? 8 : 0)  // Frames that packets for several channels share instead of a copy per ring
+#endif
+
+#ifndef ENABLE_PIPELINED_PRESENT
+#define ENABLE_PIPELINED_PRESENT 0              // Strips only: show() frame N on PRESENT_CORE while frame N+1 renders
+#endif
+
+#ifndef ENABLE_SKIP_UNCHANGED_FRAMES
+#define ENABLE_SKIP_UNCHANGED_FRAMES 1          // Strips only: don't send a frame that's the same as the last one sent
+#endif
+
+#ifndef UNCHANGED_FRAME_REFRESH_MS
+#define UNCHANGED_FRAME_REFRESH_MS 250          // ...but send it anyway this often, so a pixel that caught a glitch is put right
+#endif
+
+#ifndef ENABLE_FRAME_INTERPOLATION
+#define ENABLE_FRAME_INTERPOLATION 0            // Blend between the two wifi frames around "now" instead of holding each one
+#endif
+
+#ifndef FRAME_INTERPOLATION_MAX_GAP
+#define FRAME_INTERPOLATION_MAX_GAP 250         // Frames further apart than this many ms are shown as-is, not faded across
+#endif
+
+#ifndef ENABLE_JITTER_BUFFER
+#define ENABLE_JITTER_BUFFER 0                  // Shift wifi frame presentation to keep only as much buffered as jitter needs
+#endif
+
+#ifndef JITTER_MIN_LEAD
+#define JITTER_MIN_LEAD 0.05                    // Seconds of lead the jitter buffer always keeps on top of the measured jitter
+#endif
+
+#ifndef SOCKET_RCVBUF
+#define SOCKET_RCVBUF 0                         // Receive buffer size for incoming color data connections, 0 for lwIP's default
+#endif
+
+#ifndef SOCKET_STREAMING_RCVBUF
+#define SOCKET_STREAMING_RCVBUF 16384           // The least receive buffer asked for with the streaming WiFi radio profile
+#endif
+
+#ifndef SOCKET_RESPONSE_INTERVAL
+#define SOCKET_RESPONSE_INTERVAL 0              // Min ms between SocketResponse packets, 0 to answer every packet as before
+#endif
+
+#ifndef SOCKET_RESPONSE_STATS
+#define SOCKET_RESPONSE_STATS 0                 // Add the ingest counters to the SocketResponse, for samples/videoserver/benchmark.py
+#endif
+
+#ifndef SOCKET_RESPONSE_FEEDBACK
+#define SOCKET_RESPONSE_FEEDBACK 0              // Add when the last frame was presented and the render cost to the SocketResponse
+#endif
+
+#ifndef SOCKET_RESPONSE_LOW_WATER
+#define SOCKET_RESPONSE_LOW_WATER 25            // Buffer percent full below which a response goes out right away
+#endif
+
+#ifndef SOCKET_RESPONSE_HIGH_WATER
+#define SOCKET_RESPONSE_HIGH_WATER 75           // Buffer percent full above which a response goes out right away
+#endif
+
+// The JSON documents for settings, effects and web responses are the big allocations that come and go for as long
+// as the device is up, so a few blocks are set aside for them at boot.  Anything bigger, or beyond the blocks, uses
+// the heap.
+
+#ifndef JSON_POOL_BLOCK_SIZE
+  #if USE_PSRAM
+    #define JSON_POOL_BLOCK_SIZE 16384
+  #else
+    #define JSON_POOL_BLOCK_SIZE 4096
+  #endif
+#endif
+
+#ifndef JSON_POOL_BLOCKS
+#define JSON_POOL_BLOCKS 2                      // 0 for no pool; at most 32
+#endif
+
+#ifndef HEAP_TREND_INTERVAL
+#define HEAP_TREND_INTERVAL (60 * 60 * 1000)    // ms between the points of the largest free block trend
+#endif
+
+#ifndef HEAP_LOW_BLOCK_WARNING
+#define HEAP_LOW_BLOCK_WARNING 16384            // Largest free block, in bytes, below which we warn that the heap is breaking up
+#endif
+
+// Where the buffers on the hot paths go; see memoryplacement.h.  Boards with PSRAM that are short of internal RAM
+// can turn HOT_MEMORY_INTERNAL off, or raise the reserve, and /statistics shows where each buffer ended up.
+
+#ifndef HOT_MEMORY_INTERNAL
+#define HOT_MEMORY_INTERNAL 1                   // Put the buffers marked hot in internal RAM while there's room
+#endif
+
+#ifndef PLACEMENT_INTERNAL_RESERVE
+#define PLACEMENT_INTERNAL_RESERVE 49152        // Internal RAM that hot buffers must leave free for everything else
+#endif
+
+#ifndef DRAW_SCRATCH_SIZE
+#define DRAW_SCRATCH_SIZE 4096                  // Internal RAM the draw task hands out its per-frame buffers from
+#endif
+
+#ifndef ENABLE_PARALLEL_RENDER
+#define ENABLE_PARALLEL_RENDER 0                // Start a worker on PARALLEL_CORE that takes half the rows of the heaviest drawing loops
+#endif
+
+#ifndef ENABLE_TASK_STATS
+#define ENABLE_TASK_STATS 1                     // List the tasks with their stack headroom and CPU share in /statistics
+#endif
+
+#ifndef ENABLE_DEEP_FRAME
+#define ENABLE_DEEP_FRAME 0                     // Let the effects that support it draw in 16 bits a channel and dither down once a frame
+#endif
+
+#ifndef POWER_SUPPLY_CHANNELS
+#define POWER_SUPPLY_CHANNELS NUM_CHANNELS      // How many channels share each supply, for POWER_SUPPLY_LIMIT_MW
+#endif
+
+#ifndef ENABLE_SCREEN_PREVIEW
+#define ENABLE_SCREEN_PREVIEW 0                 // Add a page to the onboard screen that shows what's on the LEDs
+#endif
+
+#ifndef SCREEN_PREVIEW_FPS
+#define SCREEN_PREVIEW_FPS 10                   // Most frames a second the LED preview takes from the draw loop
+#endif
+
+#ifndef ENABLE_MATRIX_AUTOTUNE
+#define ENABLE_MATRIX_AUTOTUNE 0                // Lower the HUB75 refresh rate when effects can't keep up, and raise it back when they can
+#endif
+
+#ifndef MATRIX_MIN_REFRESH_RATE
+#define MATRIX_MIN_REFRESH_RATE 120             // Lowest refresh rate the tuning goes to, to keep the panels from flickering
+#endif
+
+#ifndef MATRIX_AUTOTUNE_INTERVAL
+#define MATRIX_AUTOTUNE_INTERVAL 1000           // Ms between refresh tuning steps; the CPU figures it uses update once a second
+#endif
+
+#ifndef MATRIX_PANEL_HEIGHT
+#define MATRIX_PANEL_HEIGHT 32                  // Rows on each HUB75 panel; a taller MATRIX_HEIGHT stacks rows of chained panels
+#endif
+
+// The panel type follows from the panel height for the usual half-height scan panels.  A build with some other scan
+// has to define both, and keep them in agreement.
+
+#ifndef MATRIX_PANEL_TYPE
+    #if MATRIX_PANEL_HEIGHT == 16
+        #define MATRIX_PANEL_TYPE SMARTMATRIX_HUB75_16ROW_MOD8SCAN     // SmartMatrix scan type of each HUB75 panel in the chain
+    #elif MATRIX_PANEL_HEIGHT == 32
+        #define MATRIX_PANEL_TYPE SMARTMATRIX_HUB75_32ROW_MOD16SCAN
+    #elif MATRIX_PANEL_HEIGHT == 64
+        #define MATRIX_PANEL_TYPE SMARTMATRIX_HUB75_64ROW_MOD32SCAN
+    #else
+        #error Define MATRIX_PANEL_TYPE for panels other than 16, 32 or 64 rows high
+    #endif
+#endif
+
+#ifndef MATRIX_PANEL_STACKING
+#define MATRIX_PANEL_STACKING SMARTMATRIX_OPTIONS_BOTTOM_TO_TOP_STACKING   // Or SMARTMATRIX_OPTIONS_C_SHAPE_STACKING for serpentine rows
+#endif
+
+#ifndef GIF_FRAME_CACHE
+#define GIF_FRAME_CACHE 1                       // Keep the decoded frames of each animated GIF and replay them from there
+#endif
+
+#ifndef GIF_FRAME_CACHE_BYTES
+#define GIF_FRAME_CACHE_BYTES (60 * 1024)       // Largest frame cache a GIF may have, at one byte a pixel; bigger ones decode each loop
+#endif
+
+#ifndef NOISE_FIELD_MAX_STEP
+#define NOISE_FIELD_MAX_STEP 4                  // Widest the noise field grid gets between samples, in pixels; 1 samples every pixel
+#endif
+
+#ifndef NOISE_FIELD_Z_SPAN
+#define NOISE_FIELD_Z_SPAN 4096                 // Distance in inoise16 z between the cached slices a noise field blends
+#endif
+
+#ifndef NOISE_FIELD_CACHE_ENTRIES
+#define NOISE_FIELD_CACHE_ENTRIES 2             // Noise fields kept at once, so layers and effects on the same lattice share
+#endif
+
+#ifndef FIELD_RENDER_SCALE
+#define FIELD_RENDER_SCALE 2                    // How many times smaller each way the smooth field effects draw before they're scaled up; 1 draws every pixel
+#endif
+
+#ifndef LIFE_BOARD_WIDTH
+#define LIFE_BOARD_WIDTH 0                      // Columns in the Life board, if more than the matrix; the view scrolls
+#endif
+
+#ifndef LIFE_BOARD_HEIGHT
+#define LIFE_BOARD_HEIGHT 0                     // Rows in the Life board, if more than the matrix
+#endif
+
+#ifndef ENABLE_MDNS
+#define ENABLE_MDNS 1                           // Advertise the socket, color and web services over mDNS/DNS-SD
+#endif
+
+#ifndef MDNS_TXT_INTERVAL
+#define MDNS_TXT_INTERVAL 10000                 // Ms between refreshes of the mDNS TXT records that change, like fps
+#endif
+
+#ifndef ENABLE_CLOCK_SYNC
+#define ENABLE_CLOCK_SYNC 0                     // Time frames against the sender's clock, by trading timestamps with it
+#endif
+
+#ifndef CLOCK_SYNC_INTERVAL
+#define CLOCK_SYNC_INTERVAL 2000                // Ms between clock sync exchanges with the sender
+#endif
+
+#ifndef CLOCK_SYNC_TIMEOUT
+#define CLOCK_SYNC_TIMEOUT 200                  // Ms an answer to a clock sync request may take and still count
+#endif
+
+#ifndef CLOCK_SYNC_SAMPLES
+#define CLOCK_SYNC_SAMPLES 16                   // Exchanges the offset and skew are fitted over
+#endif
+
+#ifndef CLOCK_SYNC_DELAY_SLACK
+#define CLOCK_SYNC_DELAY_SLACK 2000             // Us over the best round trip (plus half) an exchange may take and still count
+#endif
+
+#ifndef ENABLE_EFFECT_SYNC
+#define ENABLE_EFFECT_SYNC 0                    // Draw the same local effects as the other nodes in step; see effectsync.h
+#endif
+
+#ifndef EFFECT_SYNC_LEADER
+#define EFFECT_SYNC_LEADER 0                    // With ENABLE_EFFECT_SYNC, pick the effects and send them out rather than follow
+#endif
+
+#ifndef EFFECT_SYNC_GROUP
+#define EFFECT_SYNC_GROUP "239.78.68.83"        // Multicast group the leader sends its effect state to
+#endif
+
+#ifndef EFFECT_SYNC_INTERVAL
+#define EFFECT_SYNC_INTERVAL 50                 // Ms between the leader's effect state packets, which also carry the audio
+#endif
+
+#ifndef EFFECT_SYNC_CHANGE_POLL
+#define EFFECT_SYNC_CHANGE_POLL 5               // Ms between the leader's checks for a new effect, which it sends straight away
+#endif
+
+#ifndef EFFECT_SYNC_TIMEOUT
+#define EFFECT_SYNC_TIMEOUT 3000                // Ms without a state packet before a follower goes back to its own effects
+#endif
+
+#ifndef ENABLE_ESPNOW
+#define ENABLE_ESPNOW 0                         // Trade frames, effect state and audio with other nodes over ESP-NOW; see espnowlink.h
+#endif
+
+#ifndef ESPNOW_CHANNEL
+#define ESPNOW_CHANNEL 1                        // WiFi channel used while not connected to an access point; the same on every node
+#endif
+
+#ifndef ESPNOW_SEND_FRAMES
+#define ESPNOW_SEND_FRAMES 0                    // With ENABLE_ESPNOW, send what this node shows to the others
+#endif
+
+#ifndef ESPNOW_SEND_AUDIO
+#define ESPNOW_SEND_AUDIO 0                     // With ENABLE_ESPNOW, send the peaks from every audio pass to the others
+#endif
+
+#ifndef ESPNOW_FRAME_INTERVAL
+#define ESPNOW_FRAME_INTERVAL 50                // Least ms between frames sent, as broadcasts go out at the 1 Mbps base rate
+#endif
+
+#ifndef ESPNOW_KEYFRAME_INTERVAL
+#define ESPNOW_KEYFRAME_INTERVAL 20             // Frames sent as deltas between whole ones, which resync a node that missed one
+#endif
+
+#ifndef ESPNOW_MAX_MESSAGE
+#define ESPNOW_MAX_MESSAGE 8192                 // Largest message put together from fragments; bigger frames aren't sent
+#endif
+
+#ifndef ESPNOW_QUEUE_DEPTH
+#define ESPNOW_QUEUE_DEPTH 48                   // Fragments held between the WiFi task receiving them and the link task
+#endif
+
+#ifndef CLOCK_SYNC_MAX_SKEW
+#define CLOCK_SYNC_MAX_SKEW 0.0005              // Largest drift between clocks believed, as a fraction (500 ppm)
+#endif
+
+#ifndef UPDATE_PROGRESS_FPS
+#define UPDATE_PROGRESS_FPS 10                  // Rate the update progress bar is drawn at while an OTA update is flashed
+#endif
+
+#ifndef HTTP_MAX_CONNECTIONS
+#define HTTP_MAX_CONNECTIONS 2                  // Hosts the HTTPService keeps a connection open to
+#endif
+
+#ifndef HTTP_CACHE_ENTRIES
+#define HTTP_CACHE_ENTRIES 8                    // Responses the HTTPService keeps, by URL
+#endif
+
+#ifndef NETREADER_WORKERS
+#define NETREADER_WORKERS 2                     // Tasks that run the network readers, so that many can be waiting on a slow API at once
+#endif
+
+#ifndef EFFECT_WORKERS
+#define EFFECT_WORKERS 1                        // Tasks shared by every effect for its background work
+#endif
+
+#ifndef EFFECT_WORK_QUEUE_LENGTH
+#define EFFECT_WORK_QUEUE_LENGTH 8              // Effect work that can be waiting for a worker
+#endif
+
+#ifndef EVENT_BUS_SUBSCRIBERS
+#define EVENT_BUS_SUBSCRIBERS 4                 // Tasks that can subscribe to the task manager's events
+#endif
+
+#ifndef NETREADER_QUEUE_LENGTH
+#define NETREADER_QUEUE_LENGTH 8                // Readers that can be due and waiting for a worker
+#endif
+
+#ifndef NETREADER_TIMEOUT
+#define NETREADER_TIMEOUT 10000                 // Default time in ms a reader's requests may take
+#endif
+
+#ifndef ENABLE_FAST_BOOT
+#define ENABLE_FAST_BOOT 0                      // Start drawing before WiFi, the servers and the network tasks, which come up on a task of their own
+#endif
+
+#ifndef ENABLE_SPEC_RESPONSE_CACHE
+#define ENABLE_SPEC_RESPONSE_CACHE 0            // Keep the setting specs responses gzipped in PSRAM once built, and answer 304 to a matching ETag
+#endif
+
+#ifndef ENABLE_LIVE_STATE_SOCKET
+#define ENABLE_LIVE_STATE_SOCKET 0              // Push FPS, CPU, heap and the current effect to the web UI over a web socket at /ws
+#endif
+
+#ifndef LIVE_STATE_INTERVAL
+#define LIVE_STATE_INTERVAL 1000                // How often, in ms, what changed is pushed to the socket's clients
+#endif
+
+#ifndef ENABLE_LED_PREVIEW_SOCKET
+#define ENABLE_LED_PREVIEW_SOCKET 0             // Stream what the LEDs show to the web UI as binary frames over a web socket at /ws/leds
+#endif
+
+#ifndef LED_PREVIEW_MAX_FPS
+#define LED_PREVIEW_MAX_FPS 15                  // The most frames a second a preview client is sent, whatever it asks for
+#endif
+
+#ifndef ENABLE_METRICS
+#define ENABLE_METRICS 0                        // Serve counters, gauges and timing histograms as Prometheus text at /metrics
+#endif
+
+#ifndef ENABLE_METRICS_STATSD
+#define ENABLE_METRICS_STATSD 0                 // And push them to STATSD_HOST over UDP every STATSD_INTERVAL ms
+#endif
+
+#ifndef STATSD_HOST
+#define STATSD_HOST ""                          // Name or address of the StatsD server; nothing is pushed while it's empty
+#endif
+
+#ifndef STATSD_PORT
+#define STATSD_PORT 8125
+#endif
+
+#ifndef STATSD_INTERVAL
+#define STATSD_INTERVAL 10000
+#endif
+
+#ifndef STATSD_PREFIX
+#define STATSD_PREFIX "nightdriver"             // Goes ahead of the hostname and metric name
+#endif
+
+#ifndef USE_LITTLEFS
+#define USE_LITTLEFS 0                          // Keep files on LittleFS instead of SPIFFS; the partition is reformatted on first boot
+#endif
+
+#ifndef ENABLE_BINARY_CONFIG
+#define ENABLE_BINARY_CONFIG 0                  // Write the config files as MessagePack rather than JSON; both are always read
+#endif
+
+#ifndef ENABLE_EFFECT_STATE_RECORD
+#define ENABLE_EFFECT_STATE_RECORD 0            // Keep the current effect and enabled flags in a small binary record, so they don't rewrite the effects file
+#endif
+
+#ifndef ENABLE_EFFECT_MEMORY_ACCOUNTING
+#define ENABLE_EFFECT_MEMORY_ACCOUNTING 0       // Count what each effect allocates for its state, and put aside the ones over budget
+#endif
+
+#ifndef EFFECT_MEMORY_BUDGET
+#define EFFECT_MEMORY_BUDGET (64 * 1024)        // Bytes of state, DRAM and PSRAM together, an effect may hold; 0 for no limit
+#endif
+
+#ifndef ENABLE_EFFECT_REPLAY
+#define ENABLE_EFFECT_REPLAY 0                  // Offer /replay, which renders effects deterministically and reports frame CRCs and cycles
+#endif
+
+#ifndef REPLAY_DEFAULT_FRAMES
+#define REPLAY_DEFAULT_FRAMES 120               // Frames a replay runs for if the request doesn't say
+#endif
+
+#ifndef REPLAY_MAX_FRAMES
+#define REPLAY_MAX_FRAMES 600                   // Most frames a replay, or an audio recording for one, can run for
+#endif
+
+#ifndef ENABLE_PLAYLISTS
+#define ENABLE_PLAYLISTS 0                      // Let named playlists with their own durations, weights and shuffle drive the rotation
+#endif
+
+#ifndef PLAYLIST_SPACE_HEAVY_EFFECTS
+#define PLAYLIST_SPACE_HEAVY_EFFECTS 1          // Avoid scheduling two heavy effects back to back, to give a hot board a breather
+#endif
+
+#ifndef PLAYLIST_HEAVY_RATIO
+#define PLAYLIST_HEAVY_RATIO 0.5                // Share of its frame budget an effect must take on average to count as heavy
+#endif
+
+#ifndef ENABLE_EFFECT_LAYERS
+#define ENABLE_EFFECT_LAYERS 0                  // Let EffectManager draw a stack of cached effect layers over the current effect
+#endif
+
+#ifndef ENABLE_RENDER_ZONES
+#define ENABLE_RENDER_ZONES 0                   // Let sets of channels or matrix regions run effects of their own, each at its own rate
+#endif
+
+#ifndef EFFECT_LAYER_CLOCK
+#define EFFECT_LAYER_CLOCK 0                    // With effect layers on a matrix, put the clock over every effect
+#endif
+
+#ifndef ENABLE_EFFECT_PREPARE
+#define ENABLE_EFFECT_PREPARE 0                 // Run the next effect's Prepare() on a background task EFFECT_PREWARM_TIME ahead of a change
+#endif
+
+#ifndef ENABLE_LAZY_EFFECTS
+#define ENABLE_LAZY_EFFECTS 0                   // Init effects and acquire their state only when scheduled, and release it after
+#endif
+
+#ifndef EFFECT_PREWARM_TIME
+#define EFFECT_PREWARM_TIME 3000                // How many ms before a change the next effect is brought in or prepared
+#endif
+
+#ifndef ENABLE_CROSSFADE_COMPOSITOR
+#define ENABLE_CROSSFADE_COMPOSITOR 0           // Blend the outgoing and incoming effects during a change instead of fading through black
+#endif
+
+#ifndef CROSSFADE_MODE
+#define CROSSFADE_MODE -1                       // TransitionMode to use for every change, or -1 to take the next one each time
+#endif
+
+#ifndef CROSSFADE_INCOMING_DIVIDER
+#define CROSSFADE_INCOMING_DIVIDER 2            // When both effects won't fit the frame budget, the incoming one draws every Nth frame
+#endif
+
+#ifndef ENABLE_AUDIO_BENCHMARK
+#define ENABLE_AUDIO_BENCHMARK 0                // Feed the analyzer from a recorded fixture and print stage cycles and bands
+#endif
+
+#ifndef AUDIO_BENCHMARK_FIXTURE
+#define AUDIO_BENCHMARK_FIXTURE "/audiofixture.pcm" // File of 16-bit samples; a built-in test signal is used if missing
+#endif
+
+#ifndef AUDIO_BENCHMARK_REPORT_PASSES
+#define AUDIO_BENCHMARK_REPORT_PASSES 256       // Sampler passes per cycle count report
+#endif
+
+#ifndef AUDIO_MULTICAST_MASTER
+#define AUDIO_MULTICAST_MASTER 0                // Send this node's peaks and beats to UDP_MULTICAST_GROUP for the other nodes
+#endif
+
+#ifndef AUDIO_REMOTE_ONLY
+#define AUDIO_REMOTE_ONLY 0                     // Never sample a local mic, only use peaks and beats sent from elsewhere
+#endif
+
+#ifndef ENABLE_AUDIO_FEATURES
+#define ENABLE_AUDIO_FEATURES 1                 // Work out band envelopes, RMS, centroid and a spectrogram once per audio pass
+#endif
+
+#ifndef ENABLE_ONSET_DETECTION
+#define ENABLE_ONSET_DETECTION 1                // Detect beats once per audio pass from spectral flux and hand them to beat effects
+#endif
+
+#ifndef ONSET_THRESHOLD_SIGMAS
+#define ONSET_THRESHOLD_SIGMAS 1.5f             // Standard deviations above the running mean flux that make an onset
+#endif
+
+#ifndef ONSET_MIN_FLUX
+#define ONSET_MIN_FLUX 0.2f                     // Flux an onset needs regardless of the threshold, so silence doesn't trigger
+#endif
+
+#ifndef ONSET_MIN_INTERVAL_MS
+#define ONSET_MIN_INTERVAL_MS 100               // Shortest time between two onsets
+#endif
+
+#ifndef ENABLE_AUDIO_STREAMING
+#define ENABLE_AUDIO_STREAMING 0                // Stream I2S samples through a sliding window and analyze 50% overlapped hops
+#endif
+
+#ifndef ENABLE_AUDIO_LATENCY
+#define ENABLE_AUDIO_LATENCY 0                  // Measure audio-to-light latency and time the levels each frame draws to when it's seen
+#endif
+
+#ifndef AUDIO_LATENCY_TARGET_MS
+#define AUDIO_LATENCY_TARGET_MS 0               // How late the light may be behind the sound; 0 catches up as far as extrapolation allows
+#endif
+
+#ifndef AUDIO_EXTRAPOLATE_MAX_MS
+#define AUDIO_EXTRAPOLATE_MAX_MS 20             // Furthest past the newest audio pass the levels are carried ahead
+#endif
+
+#ifndef ENABLE_FLOAT_FFT
+#define ENABLE_FLOAT_FFT 1                      // Run the audio FFT in single precision from internal RAM instead of arduinoFFT doubles
+#endif
+
+#ifndef ENABLE_MATRIX_DITHER
+#define ENABLE_MATRIX_DITHER 0                  // Apply gamma and brightness to matrix pixels with temporal dithering, not panel brightness
+#endif
+
+#ifndef MATRIX_DITHER_GAMMA
+#define MATRIX_DITHER_GAMMA 2.2f                // Gamma the matrix output stage applies when dithering
+#endif
+
+#ifndef ENABLE_MATRIX_DIRECT_OUTPUT
+#define ENABLE_MATRIX_DIRECT_OUTPUT 0           // HUB75: pack frames into the DMA bit planes on PRESENT_CORE instead of the SmartMatrix calc task
+#endif
+
+#ifndef MATRIX_DIRECT_GAMMA
+#define MATRIX_DIRECT_GAMMA 2.2f                // Gamma the direct output packs the pixels with, unless the dither stage already applied it
+#endif
+
+#ifndef ENABLE_DIRTY_TRACKING
+#define ENABLE_DIRTY_TRACKING 0                 // Track what each frame changed so an unchanged matrix frame skips power estimate and swap
+#endif
+
+#ifndef ENABLE_XY_LOOKUP_TABLE
+#define ENABLE_XY_LOOKUP_TABLE 0                // Map x, y to pixel index through a table in internal RAM on strip builds
+#endif
+
+#ifndef ENABLE_PALETTE_CACHE
+#define ENABLE_PALETTE_CACHE 1                  // Look ColorFromCurrentPalette() up in the palette expanded to 256 colors in internal RAM
+#endif
+
+#ifndef PALETTE_CACHE_MIN_RUN
+#define PALETTE_CACHE_MIN_RUN 32                // Calls in a row at one brightness before it gets an expanded table of its own
+#endif
+
+#ifndef EFFECT_PROFILE_MIN_FRAMES
+#define EFFECT_PROFILE_MIN_FRAMES 60            // Frames an effect must draw before we judge whether it fits its frame budget
+#endif
+
+#ifndef EFFECT_PROFILE_BUDGET_RATIO
+#define EFFECT_PROFILE_BUDGET_RATIO 0.8         // Fraction of the frame time an effect's Draw() may use and still count as fitting
+#endif
+
+#ifndef ENABLE_EFFECT_QUALITY
+#define ENABLE_EFFECT_QUALITY 1                 // Lower the detail of effects that can't keep their frame rate, and raise it once they can
+#endif
+
+#ifndef EFFECT_QUALITY_MIN
+#define EFFECT_QUALITY_MIN 25                   // Lowest quality, out of 100, an effect is taken down to
+#endif
+
+#ifndef EFFECT_QUALITY_FRAMES
+#define EFFECT_QUALITY_FRAMES 30                // Frames the draw time is averaged over between changes to the quality
+#endif
+
+#ifndef EFFECT_PROFILE_SKIP_SLOW
+#define EFFECT_PROFILE_SKIP_SLOW 0              // Skip effects that don't fit their frame budget when moving to the next effect
+#endif
+
+#ifndef ENABLE_FRAME_TIMING
+#define ENABLE_FRAME_TIMING 0                   // Time each draw loop and socket stage and report percentiles in /statistics
+#endif
+
+#ifndef ENABLE_STALL_WATCH
+#define ENABLE_STALL_WATCH 0                    // Keep the frames and buffer mutex waits that run far over, and why, for /stalls
+#endif
+
+#ifndef ENABLE_GOVERNOR
+#define ENABLE_GOVERNOR 0                       // Lower the frame rate and CPU clock for heat, power and idle content
+#endif
+
+#ifndef GOVERNOR_INTERVAL_MS
+#define GOVERNOR_INTERVAL_MS 1000               // How often the governor looks at the temperature, power and load
+#endif
+
+#ifndef GOVERNOR_HOT_C
+#define GOVERNOR_HOT_C 75                       // Chip temperature at which the frame rate starts coming down
+#endif
+
+#ifndef GOVERNOR_COOL_C
+#define GOVERNOR_COOL_C 65                      // And below which it's given back
+#endif
+
+#ifndef GOVERNOR_POWER_LIMIT_W
+#define GOVERNOR_POWER_LIMIT_W 0                // LED power above which the frame rate comes down too, or 0 to ignore power
+#endif
+
+#ifndef GOVERNOR_MIN_FPS
+#define GOVERNOR_MIN_FPS 10                     // Lowest frame rate heat or power can bring us to
+#endif
+
+#ifndef GOVERNOR_STATIC_FPS
+#define GOVERNOR_STATIC_FPS 10                  // Frame rate while the frames aren't changing
+#endif
+
+#ifndef GOVERNOR_BOOST_MS
+#define GOVERNOR_BOOST_MS 3000                  // How long incoming frames or a beat hold full performance, as heat and power allow
+#endif
+
+#ifndef GOVERNOR_LIGHT_SLEEP
+#define GOVERNOR_LIGHT_SLEEP 0                  // With power management in the IDF build, light sleep between frames when idle
+#endif
+
+#ifndef STALL_THRESHOLD_MS
+#define STALL_THRESHOLD_MS 100                  // A frame that takes this long, less the wait for the next one, is a stall
+#endif
+
+#ifndef STALL_LOCK_THRESHOLD_MS
+#define STALL_LOCK_THRESHOLD_MS 20              // As is a wait this long for the buffer mutex
+#endif
+
+#ifndef STALL_HISTORY
+#define STALL_HISTORY 8                         // How many of the latest stalls are kept
+#endif
+
+#ifndef ENABLE_TRACING
+#define ENABLE_TRACING 0                        // Keep spans of the tasks' work for /trace, to view as a timeline in Perfetto
+#endif
+
+#ifndef TRACE_EVENTS
+#define TRACE_EVENTS 8192                       // Spans the trace ring holds, at 20 bytes each; best kept to boards with PSRAM
+#endif
+
+#ifndef SOCKET_STREAMING_INFLATE
+#define SOCKET_STREAMING_INFLATE 1              // Decompress packets as they arrive instead of buffering them first
+#endif
+
 #ifndef ENABLE_REMOTE
 #define ENABLE_REMOTE 0
 #endif
 
+#ifndef REMOTE_EDGE_DECODE
+#define REMOTE_EDGE_DECODE 1                    // Decode NEC remotes from the receiver's edges as they come in; 0 polls IRremoteESP8266 for its other protocols
+#endif
+
 #ifndef EFFECT_PERSISTENCE_CRITICAL
 #define EFFECT_PERSISTENCE_CRITICAL 0
 #endif
@@ -1297,6 +2068,12 @@ extern RemoteDebug Debug;           // Let everyone in the project know about it
 // #define POWER_LIMIT_MW 500*5                 // Define for your power draw limit. Example is a low 2500mA
                                                 // which may dim your LEDs quite a lot.
 
+// Builds that feed their channels from more than one supply can also hold each supply to its own limit.  Each
+// supply powers POWER_SUPPLY_CHANNELS channels in turn, starting with channel 0.
+
+// #define POWER_SUPPLY_LIMIT_MW 5000*5         // Define for the limit of each supply
+// #define POWER_SUPPLY_CHANNELS 2              // How many channels each supply powers; defaults to all of them
+
 // Display
 //
 // Enable USE_OLED or USE_TFT based on selected board definition
@@ -1420,6 +2197,17 @@ extern DRAM_ATTR const int g_aRingSizeTable[];
 #define M5STACKCORE2 0
 #endif
 
+// How many viewers the color data server takes at once, and how many packets each can have waiting before the
+// oldest are dropped
+
+#ifndef COLORDATA_MAX_CLIENTS
+#define COLORDATA_MAX_CLIENTS 4
+#endif
+
+#ifndef COLORDATA_CLIENT_QUEUE_DEPTH
+#define COLORDATA_CLIENT_QUEUE_DEPTH 2
+#endif
+
 #ifndef COLORDATA_SERVER_ENABLED
   #if ENABLE_WIFI
     #define COLORDATA_SERVER_ENABLED 1
@@ -1465,6 +2253,8 @@ extern DRAM_ATTR const int g_aRingSizeTable[];
 
 #define WIFI_COMMAND_PIXELDATA64 3             // Wifi command with color data and 64-bit clock vals
 #define WIFI_COMMAND_PEAKDATA    4             // Wifi command that delivers audio peaks
+#define WIFI_COMMAND_PIXELDELTA64 5            // Like PIXELDATA64, but colors are XORed against the previous frame
+#define WIFI_COMMAND_BEATDATA    6             // Wifi command that delivers a beat found by another node's analyzer
 
 // Final headers
 //
@@ -1628,7 +2418,11 @@ inline bool SetSocketBlockingEnabled(int fd, bool blocking)
 #include "ledstripeffect.h"                     // Defines base led effect classes
 #include "ntptimeclient.h"                      // setting the system clock from ntp
 #include "effectmanager.h"                      // For g_EffectManager
+#include "clocksync.h"                          // Frame timing against the sender's clock
 #include "ledbuffer.h"                          // Buffer manager for strip
+#include "frametiming.h"                        // Per-stage timing histograms
+#include "metrics.h"                            // Counters, gauges and histograms for Prometheus and StatsD
+#include "boottiming.h"                         // How long each stage of startup took
 #include "colordata.h"                          // color palettes
 
 #if USE_TFTSPI
@@ -1636,3 +2430,5 @@ inline bool SetSocketBlockingEnabled(int fd, bool blocking)
     #include <TFT_eSPI.h>
     #include <SPI.h>
 #endif
+
+#endif // NATIVE_BUILD
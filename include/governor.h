@@ -0,0 +1,125 @@
+//+--------------------------------------------------------------------------
+//
+// File:        governor.h
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+//
+// Description:
+//
+//    Brings the frame rate and CPU clock down when the chip runs hot,
+//    the LEDs draw too much, or the frames have stopped changing, and
+//    back up as soon as there's something to keep up with
+//
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#include <atomic>
+#include <iterator>
+#include "globals.h"
+
+#if ENABLE_GOVERNOR
+
+// Governor
+//
+// The draw loop calls Update() once a frame, and every GOVERNOR_INTERVAL_MS it looks at the chip temperature, the
+// LED power estimate, how busy the busier core was and how many frames went unsent for being unchanged.
+//
+// Heat and power take a quarter off the frame rate cap each interval they stay over, down to GOVERNOR_MIN_FPS, and
+// give it back the same way once they're under.  Frames that aren't changing are capped at GOVERNOR_STATIC_FPS.  The
+// CPU clock steps down the 240/160/80 MHz ladder while the busier core has time to spare, and up again when it
+// doesn't.  Boost(), which any task can call, lifts the static cap and puts the clock back to the top for
+// GOVERNOR_BOOST_MS.  Heat and power still hold: the frame rate cap stays, and so does the slower clock once the
+// chip has been hot, until it's cooled down past GOVERNOR_COOL_C.
+
+class Governor
+{
+    static constexpr uint32_t kFrequencies[] = { 240, 160, 80 };
+
+    std::atomic<uint32_t> _msBoostUntil { 0 };
+    std::atomic<bool>     _bBoostPending { false };
+
+    uint32_t _msLastCheck      = 0;
+    uint32_t _lastShown        = 0;
+    uint32_t _lastSkipped      = 0;
+    uint32_t _fpsCap           = 0;             // From heat and power; 0 for none
+    bool     _bStatic          = false;
+    bool     _bHeatLimited     = false;         // Hot lately, and not yet cooled down
+    size_t   _iFrequency       = 0;             // Into kFrequencies
+    uint32_t _mhzApplied       = 0;
+    bool     _bSleepApplied    = false;
+    float    _temperature      = 0.0f;
+
+    void Evaluate();
+    void Apply(bool bBoosted);
+
+  public:
+
+    // Full performance now, and for GOVERNOR_BOOST_MS, as far as heat and power allow.  Safe from any task; the draw
+    // loop applies it.
+
+    void Boost()
+    {
+        _msBoostUntil.store(millis() + GOVERNOR_BOOST_MS, std::memory_order_relaxed);
+        _bBoostPending.store(true, std::memory_order_release);
+    }
+
+    bool IsBoosted() const
+    {
+        return (int32_t)(_msBoostUntil.load(std::memory_order_relaxed) - millis()) > 0;
+    }
+
+    // Once a frame on the draw task
+    void Update();
+
+    // The frame rate to pace to, given the one the content asks for
+
+    size_t LimitFramesPerSecond(size_t fps) const
+    {
+        if (_fpsCap)
+            fps = std::min<size_t>(fps, _fpsCap);
+        if (_bStatic && !IsBoosted())
+            fps = std::min<size_t>(fps, GOVERNOR_STATIC_FPS);
+        return std::max<size_t>(1, fps);
+    }
+
+    uint32_t FrequencyMHz() const
+    {
+        return _mhzApplied;
+    }
+
+    uint32_t FramesPerSecondCap() const
+    {
+        return _fpsCap;
+    }
+
+    bool IsStatic() const
+    {
+        return _bStatic;
+    }
+
+    float Temperature() const
+    {
+        return _temperature;
+    }
+};
+
+extern Governor g_Governor;
+
+#endif
@@ -0,0 +1,133 @@
+//+--------------------------------------------------------------------------
+//
+// File:        httpservice.h
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+//
+// Description:
+//
+//    One place for effects to make their HTTP requests, so connections
+//    to a host are kept open between them and responses that are still
+//    fresh are shared rather than fetched again
+//
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "globals.h"
+#include "jsonserializer.h"
+
+#if ENABLE_WIFI
+
+#include <HTTPClient.h>
+#include <WiFi.h>
+
+// HTTPResponse
+//
+// What came back for a GET.  Responses are shared between everyone who asked for the same URL while it was fresh,
+// so they're never changed once they've been handed out.
+
+struct HTTPResponse
+{
+    int Code = 0;
+    std::vector<char, psram_allocator<char>> Body;
+
+    const char * Data() const
+    {
+        return Body.data();
+    }
+
+    size_t Size() const
+    {
+        return Body.size();
+    }
+
+    String ToString() const
+    {
+        return String(Body.data(), Body.size());
+    }
+};
+
+// HTTPService
+//
+// Keeps a connection open to each of the last few hosts it talked to, so a request doesn't have to start with a new
+// TCP connection.  Successful responses are kept for a while by URL: a request for one that's younger than the age
+// the caller allows is answered from the cache, and an older one is only fetched again if the server says it changed
+// (If-None-Match and If-Modified-Since).  Two effects asking for the same thing at once end up with one fetch.
+//
+// Requests block, so they belong on a NetworkReader, and their timeout is that of the reader making them.
+
+class HTTPService
+{
+    struct Connection
+    {
+        String      Origin;                         // Scheme, host and port, like "http://api.openweathermap.org:80"
+        String      ConnectedOrigin;                // What the client is actually connected to; only touched under Mutex
+        WiFiClient  Client;
+        HTTPClient  Http;
+        std::mutex  Mutex;                          // Held for the whole of a request
+        unsigned long LastUsedMs = 0;
+    };
+
+    struct CacheEntry
+    {
+        std::shared_ptr<const HTTPResponse> Response;
+        String ETag;
+        String LastModified;
+        unsigned long FetchedMs = 0;
+    };
+
+    std::mutex _mutex;                              // Guards the two collections, not the requests themselves
+    std::vector<std::unique_ptr<Connection>> _connections;
+    std::map<String, CacheEntry> _cache;
+
+    static String OriginOf(const String & url);
+
+    // The response cached for the URL, if it's no older than maxAgeMs
+    std::shared_ptr<const HTTPResponse> FreshResponse(const String & url, unsigned long maxAgeMs);
+
+    // The connection kept for the origin, or a new one in place of the one used least recently.  The connection is
+    // returned locked; if all of them are in use, a new one is returned that isn't kept.
+    std::unique_lock<std::mutex> AcquireConnection(const String & origin, Connection *& pConnection, std::unique_ptr<Connection> & pTemporary);
+
+    void Store(const String & url, CacheEntry entry);
+
+  public:
+
+    // Get
+    //
+    // Returns the response for the URL, from the cache if it was fetched less than maxAgeMs ago, or nullptr if it
+    // couldn't be fetched at all.  Only 2xx responses are cached; anything else is returned to the caller as it came.
+    //
+    // With a filter, a JSON body is parsed as it comes off the connection into a document of cbDocument bytes, and
+    // only what the filter keeps is held, as compact JSON.  That's what to use for big responses on boards without
+    // PSRAM, which couldn't hold the whole body.  A URL should always be asked for with the same filter, as the
+    // cache goes by URL alone.
+
+    std::shared_ptr<const HTTPResponse> Get(const String & url, unsigned long maxAgeMs = 0, const JsonDocument * pFilter = nullptr, size_t cbDocument = 0);
+
+    // Forget any cached response for the URL, so the next Get goes to the server
+    void Invalidate(const String & url);
+};
+
+#endif // ENABLE_WIFI
@@ -36,13 +36,14 @@
 #include "network.h"
 #include "hexdump.h"
 #include "globals.h"
+#include "storage.h"
 
 #define IMPROV_LOG_FILE             "/improv.log"
 
-// Define as 1 to enable Improv logging to SPIFFS, and add a URI to the on-board
+// Define as 1 to enable Improv logging to the file system, and add a URI to the on-board
 // webserver to be able to retrieve it. The URL to retrieve the log will be
 // http://<device_IP><IMPROV_LOG_FILE>, the latter being as defined just above.
-// Note that any log file that has been written to SPIFFS will be deleted as soon
+// Note that any log file that has been written to the file system will be deleted as soon
 // as the board is booted with ENABLE_IMPROV_LOGGING set to 0!
 #ifndef ENABLE_IMPROV_LOGGING
     #define ENABLE_IMPROV_LOGGING   0
@@ -80,7 +81,7 @@ public:
         this->device_name_ = name;
 
         #if !(ENABLE_IMPROV_LOGGING)
-            SPIFFS.remove(IMPROV_LOG_FILE);
+            FILESYSTEM.remove(IMPROV_LOG_FILE);
         #endif
 
         log_write("Finished Improv setup");
@@ -159,7 +160,7 @@ protected:
             constexpr int bufferSize = 256;
             char lineBuffer[bufferSize];
 
-            auto file = SPIFFS.open(IMPROV_LOG_FILE, FILE_APPEND);
+            auto file = FILESYSTEM.open(IMPROV_LOG_FILE, FILE_APPEND);
             va_list args;
 
             va_start(args, format);
@@ -174,7 +175,7 @@ protected:
 
         void log_write(std::vector<uint8_t>& data)
         {
-            auto file = SPIFFS.open(IMPROV_LOG_FILE, FILE_APPEND);
+            auto file = FILESYSTEM.open(IMPROV_LOG_FILE, FILE_APPEND);
 
             HexDump(file, data.data(), data.size());
 
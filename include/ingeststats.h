@@ -0,0 +1,131 @@
+//+--------------------------------------------------------------------------
+//
+// File:        ingeststats.h
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+//
+// Description:
+//
+//    Counts the frames that come in over the wire and what becomes of
+//    them, so a sender can measure how fast a node takes frames in and
+//    how long they wait before they're shown
+//
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <esp_timer.h>
+#include "clocksync.h"
+#include "metrics.h"
+
+// IngestStats
+//
+// All the counts run from boot and wrap, the times every 71 minutes, so a sender samples them and works from the differences.  That way any
+// number of senders, or a sender that reconnects, can measure without resetting anything on the node.
+
+class IngestStats
+{
+  public:
+
+    std::atomic<uint32_t> _cFrames      { 0 };      // Frames committed to a buffer ring
+    std::atomic<uint32_t> _cFull        { 0 };      // Frames dropped because their ring was full
+    std::atomic<uint32_t> _cStale       { 0 };      // Frames passed over by the draw loop because a newer one was due
+    std::atomic<uint32_t> _cPresented   { 0 };      // Frames the draw loop showed
+    std::atomic<uint32_t> _usDecode     { 0 };      // Time spent expanding and parsing packets into the rings
+    std::atomic<uint32_t> _usLatency    { 0 };      // Time the presented frames spent in the ring
+
+    // PresentedFrame
+    //
+    // The newest frame the draw loop showed: the time on it, and how long after that time it went out on the
+    // synced clock, negative if early.  A frame with no time on it is shown when it comes, so its delta is the
+    // time it spent queued instead.
+
+    struct PresentedFrame
+    {
+        double Timestamp = 0.0;
+        double Delta     = 0.0;
+    };
+
+  private:
+
+    mutable std::mutex _presentedMutex;
+    PresentedFrame     _presented;
+
+  public:
+
+    void FrameCommitted(bool bCommitted)
+    {
+        (bCommitted ? _cFrames : _cFull).fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void FramesStale(uint32_t count)
+    {
+        if (count)
+            _cStale.fetch_add(count, std::memory_order_relaxed);
+    }
+
+    void FramePresented(int64_t usQueued, uint64_t seconds, uint64_t micros)
+    {
+        int64_t usQueuedFor = esp_timer_get_time() - usQueued;
+
+        _cPresented.fetch_add(1, std::memory_order_relaxed);
+        _usLatency.fetch_add((uint32_t) usQueuedFor, std::memory_order_relaxed);
+
+        PresentedFrame presented;
+        presented.Timestamp = seconds + micros / (double) MICROS_PER_SECOND;
+        presented.Delta     = seconds ? SyncedTime() - presented.Timestamp : usQueuedFor / (double) MICROS_PER_SECOND;
+
+        std::lock_guard<std::mutex> guard(_presentedMutex);
+        _presented = presented;
+    }
+
+    PresentedFrame LastPresented() const
+    {
+        std::lock_guard<std::mutex> guard(_presentedMutex);
+        return _presented;
+    }
+
+    // DecodeTimer
+    //
+    // Adds the time from here to the end of the scope to the decode time
+
+    class DecodeTimer
+    {
+        IngestStats & _stats;
+        int64_t       _usStart;
+
+      public:
+
+        explicit DecodeTimer(IngestStats & stats) : _stats(stats), _usStart(esp_timer_get_time())
+        {
+        }
+
+        ~DecodeTimer()
+        {
+            auto usDecode = (uint32_t)(esp_timer_get_time() - _usStart);
+            _stats._usDecode.fetch_add(usDecode, std::memory_order_relaxed);
+            OBSERVE_METRIC(Decode, usDecode);
+        }
+    };
+};
+
+extern IngestStats g_IngestStats;
@@ -32,3 +32,7 @@
 
 #define JSON_BUFFER_BASE_SIZE 2048
 #define JSON_BUFFER_INCREMENT 2048
+#define JSON_STREAM_ELEMENT_SIZE 512
+#define JSON_BUFFER_SLACK 512                   // Added to a measured size, so a document that grows a little still fits
+#define JSON_MEASURE_MAX_SIZE (96 * 1024)       // Most we set aside for the pass that measures a document
+#define BINARY_CONFIG_VERSION 1                 // Bumped when the binary config format changes in a way old files can't be read
@@ -34,6 +34,7 @@
 #include <atomic>
 #include <ArduinoJson.h>
 #include "jsonbase.h"
+#include "memorypools.h"
 
 struct IJSONSerializable
 {
@@ -47,27 +48,50 @@ constexpr auto to_value(E e) noexcept
 	return static_cast<std::underlying_type_t<E>>(e);
 }
 
-#if USE_PSRAM
-    struct JsonPsramAllocator
-    {
-        void* allocate(size_t size) {
-            return ps_malloc(size);
-        }
+// JsonPoolAllocator
+//
+// Takes a block from the JSON pool when one's free and the document fits, and otherwise allocates from PSRAM if
+// we have it and the heap if not.
 
-        void deallocate(void* pointer) {
+struct JsonPoolAllocator
+{
+    #if USE_PSRAM
+        static void* heapAllocate(size_t size)              { return ps_malloc(size); }
+        static void* heapReallocate(void* ptr, size_t size) { return ps_realloc(ptr, size); }
+    #else
+        static void* heapAllocate(size_t size)              { return malloc(size); }
+        static void* heapReallocate(void* ptr, size_t size) { return realloc(ptr, size); }
+    #endif
+
+    void* allocate(size_t size) {
+        void* pointer = g_JsonPool.Allocate(size);
+        return pointer ? pointer : heapAllocate(size);
+    }
+
+    void deallocate(void* pointer) {
+        if (!g_JsonPool.Free(pointer))
             free(pointer);
-        }
+    }
 
-        void* reallocate(void* ptr, size_t new_size) {
-            return ps_realloc(ptr, new_size);
-        }
-    };
+    void* reallocate(void* ptr, size_t new_size) {
+        if (!g_JsonPool.Owns(ptr))
+            return heapReallocate(ptr, new_size);
+
+        // Shrinking leaves the document where it is; growing past the block moves it out to the heap
+        if (new_size <= g_JsonPool.BlockSize())
+            return ptr;
 
-    typedef BasicJsonDocument<JsonPsramAllocator> AllocatedJsonDocument;
+        void* pointer = heapAllocate(new_size);
+        if (pointer)
+        {
+            memcpy(pointer, ptr, g_JsonPool.BlockSize());
+            g_JsonPool.Free(ptr);
+        }
+        return pointer;
+    }
+};
 
-#else
-    typedef DynamicJsonDocument AllocatedJsonDocument;
-#endif
+typedef BasicJsonDocument<JsonPoolAllocator> AllocatedJsonDocument;
 
 namespace ArduinoJson
 {
@@ -130,7 +154,9 @@ bool LoadJSONFile(const String & fileName, size_t& bufferSize, std::unique_ptr<A
 bool SaveToJSONFile(const String & fileName, size_t& bufferSize, IJSONSerializable& object);
 bool RemoveJSONFile(const String & fileName);
 
-#define JSON_WRITER_DELAY 3000
+#define JSON_WRITER_DELAY        3000           // A writer runs once it hasn't been flagged for this long...
+#define JSON_WRITER_MAX_HOLD     30000          // ...or once it's been waiting this long, if it keeps being flagged...
+#define JSON_WRITER_MIN_INTERVAL 10000          // ...but never sooner than this after it last ran
 
 class JSONWriter
 {
@@ -139,10 +165,14 @@ class JSONWriter
 
   private:
 
-    // Writer function and flag combo
+    // Writer function and flag combo, with when it was flagged and when it last ran
     struct WriterEntry
     {
         std::atomic_bool flag = false;
+        std::atomic_ulong firstFlagMs = 0;      // When the flag went up, for the longest we'll hold the write back
+        std::atomic_ulong latestFlagMs = 0;     // When it was last flagged, for the debounce
+        unsigned long lastWriteMs = 0;
+        bool hasWritten = false;
         std::function<void()> writer;
 
         WriterEntry(std::function<void()> writer) :
@@ -151,13 +181,26 @@ class JSONWriter
 
         WriterEntry(WriterEntry&& entry) : WriterEntry(entry.writer)
         {}
+
+        // When a flagged writer should run: after the debounce or the most we'll hold it back, whichever's first,
+        // but no sooner than the minimum interval after its last run
+        unsigned long DueAt() const
+        {
+            unsigned long due = std::min(latestFlagMs.load() + JSON_WRITER_DELAY, firstFlagMs.load() + JSON_WRITER_MAX_HOLD);
+            if (hasWritten)
+                due = std::max(due, lastWriteMs + JSON_WRITER_MIN_INTERVAL);
+            return due;
+        }
     };
 
     std::vector<WriterEntry, psram_allocator<WriterEntry>> writers;
-    std::atomic_ulong        latestFlagMs;
     std::atomic_bool         flushRequested;
     std::atomic_bool         haltWrites;
 
+    std::atomic_ulong        writeCount = 0;
+    std::atomic_ulong        skippedWriteCount = 0;
+    std::atomic_ulong        bytesWritten = 0;
+
   public:
 
     // Add a writer to the collection. Returns the index of the added writer, for use with FlagWriter()
@@ -168,5 +211,21 @@ class JSONWriter
 
     // Flush pending writes now
     void FlushWrites(bool halt = false);
+
+    // Counted by SaveToJSONFile, for the statistics
+    void RecordWrite(size_t bytes)
+    {
+        writeCount++;
+        bytesWritten += bytes;
+    }
+
+    void RecordSkippedWrite()
+    {
+        skippedWriteCount++;
+    }
+
+    unsigned long WriteCount() const        { return writeCount; }
+    unsigned long SkippedWriteCount() const { return skippedWriteCount; }
+    unsigned long BytesWritten() const      { return bytesWritten; }
 };
 
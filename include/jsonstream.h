@@ -0,0 +1,161 @@
+//+--------------------------------------------------------------------------
+//
+// File:        jsonstream.h
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+//
+// Description:
+//
+//    Serializes a JSON array for a chunked web response one element at a
+//    time, so long lists go out without the whole document in memory
+//
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#include <functional>
+#include <ArduinoJson.h>
+#include "globals.h"
+#include "jsonbase.h"
+
+// JsonArrayStream
+//
+// Produces the text of a JSON array, wrapped in whatever comes before and after it, as the response asks for it.
+// Only the element being sent is ever serialized, into a document of a fixed size that's reused for each one.
+
+class JsonArrayStream
+{
+  public:
+
+    // Fills in the object for one element, and returns false if there's nothing (any more) at that index
+    using ElementWriter = std::function<bool(size_t index, JsonObject & object)>;
+
+  private:
+
+    enum class Part : uint8_t { Head, Elements, Tail, Done };
+
+    String _head;
+    String _tail;
+    size_t _count;
+    ElementWriter _writer;
+
+    DynamicJsonDocument _elementDoc;
+    String _pending;                                // Text of the current part, and how much of it has gone out
+    size_t _sent = 0;
+    size_t _nextElement = 0;
+    bool   _bFirstElement = true;
+    Part   _part = Part::Head;
+
+    // Moves on to the next piece of text to send, and returns false once there's none left
+
+    bool NextPiece()
+    {
+        _pending = "";
+        _sent = 0;
+
+        switch (_part)
+        {
+            case Part::Head:
+                _pending = _head;
+                _part = Part::Elements;
+                return true;
+
+            case Part::Elements:
+                while (_nextElement < _count)
+                {
+                    _elementDoc.clear();
+                    auto object = _elementDoc.to<JsonObject>();
+
+                    if (!_writer(_nextElement++, object))
+                        continue;
+
+                    if (_elementDoc.overflowed())
+                        debugE("JSON element buffer overflow while streaming - element incomplete!");
+
+                    if (!_bFirstElement)
+                        _pending = ",";
+                    _bFirstElement = false;
+
+                    serializeJson(_elementDoc, _pending);
+                    return true;
+                }
+                _part = Part::Tail;
+                [[fallthrough]];
+
+            case Part::Tail:
+                _pending = _tail;
+                _part = Part::Done;
+                return true;
+
+            default:
+                return false;
+        }
+    }
+
+  public:
+
+    JsonArrayStream(const String & head, size_t count, ElementWriter writer, const String & tail, size_t elementSize = JSON_STREAM_ELEMENT_SIZE)
+        : _head(head),
+          _tail(tail),
+          _count(count),
+          _writer(std::move(writer)),
+          _elementDoc(elementSize)
+    {
+    }
+
+    // JsonArrayStream::Fill
+    //
+    // Used as the filler for a chunked response: copies as much as fits into the buffer, and returns 0 when done
+
+    size_t Fill(uint8_t * buffer, size_t maxLen)
+    {
+        size_t written = 0;
+
+        while (written < maxLen)
+        {
+            if (_sent >= _pending.length() && !NextPiece())
+                break;
+
+            size_t length = std::min(maxLen - written, _pending.length() - _sent);
+            memcpy(buffer + written, _pending.c_str() + _sent, length);
+            written += length;
+            _sent += length;
+        }
+
+        return written;
+    }
+
+    // ObjectHead
+    //
+    // Turns a serialized object into the head of a stream that adds an array to it under the given key
+
+    static String ObjectHead(const JsonDocument & doc, const char * arrayKey)
+    {
+        String head;
+        serializeJson(doc, head);
+
+        head.remove(head.length() - 1);             // Take off the closing brace
+        if (head.length() > 1)
+            head += ",";
+        head += "\"";
+        head += arrayKey;
+        head += "\":[";
+        return head;
+    }
+};
@@ -0,0 +1,169 @@
+//+--------------------------------------------------------------------------
+//
+// File:        layerstack.h
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+//
+// Description:
+//
+//    A stack of effects drawn over the current one, like a clock over
+//    a generative background, each cached in a frame of its own
+//
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include "ledstripeffect.h"
+
+#if ENABLE_EFFECT_LAYERS
+
+// LayerBlend
+//
+// How a layer's pixels combine with what's under them.  Layers are drawn on black, so black is always see-through.
+
+enum class LayerBlend : uint8_t
+{
+    Add,                // Saturating sum
+    Alpha,              // Over, with the brightest channel of each pixel as its coverage
+    Screen              // Inverse of multiplying the inverses; brightens without clipping as hard as Add
+};
+
+// EffectLayer
+//
+// One effect in the stack, with the frame it last drew.  The frame is only redrawn when the update interval has
+// passed and the effect says it would look different, so a static layer costs one blend pass per frame.
+
+struct EffectLayer
+{
+    std::shared_ptr<LEDStripEffect> Effect;
+    uint8_t       Opacity          = 255;
+    LayerBlend    Blend            = LayerBlend::Alpha;
+    uint          UpdateInterval   = 0;             // Minimum ms between redraws, or 0 for every frame
+    RenderTarget  Frame;
+    unsigned long msLastDraw       = 0;
+    bool          bDrawn           = false;
+};
+
+class LayerStack
+{
+    std::vector<EffectLayer> _layers;
+
+    static void BlendFrame(GFXBase & gfx, const CRGB * pLayer, size_t cLEDs, uint8_t opacity, LayerBlend blend)
+    {
+        CRGB * pBase = gfx.leds;
+
+        for (size_t i = 0; i < cLEDs; i++)
+        {
+            CRGB layer = pLayer[i];
+            if (!layer)
+                continue;
+
+            uint8_t coverage = scale8(std::max({ layer.r, layer.g, layer.b }), opacity);
+            layer.nscale8(opacity);
+            CRGB & base = pBase[i];
+
+            switch (blend)
+            {
+                case LayerBlend::Add:
+                    base += layer;
+                    break;
+
+                case LayerBlend::Alpha:
+                    base.nscale8(255 - coverage);
+                    base += layer;
+                    break;
+
+                case LayerBlend::Screen:
+                    // Each channel only gets to close the gap to full, so this can't overflow
+                    base.r = qadd8(base.r, scale8(layer.r, 255 - base.r));
+                    base.g = qadd8(base.g, scale8(layer.g, 255 - base.g));
+                    base.b = qadd8(base.b, scale8(layer.b, 255 - base.b));
+                    break;
+            }
+        }
+    }
+
+public:
+
+    // Add
+    //
+    // Puts an effect on top of the stack.  The caller has brought the effect in and started it.
+
+    bool Add(const std::shared_ptr<LEDStripEffect> & effect, std::vector<std::shared_ptr<GFXBase>> & gfx,
+             uint8_t opacity = 255, LayerBlend blend = LayerBlend::Alpha, uint updateInterval = 0)
+    {
+        EffectLayer layer;
+        if (!layer.Frame.Allocate(gfx))
+            return false;
+
+        layer.Effect         = effect;
+        layer.Opacity        = opacity;
+        layer.Blend          = blend;
+        layer.UpdateInterval = updateInterval;
+
+        _layers.push_back(std::move(layer));
+        return true;
+    }
+
+    void Clear()
+    {
+        _layers.clear();
+    }
+
+    const std::vector<EffectLayer> & Layers() const
+    {
+        return _layers;
+    }
+
+    // Compose
+    //
+    // Redraws whichever layers are due, then blends every layer's frame over what's in leds, bottom to top
+
+    void Compose(std::vector<std::shared_ptr<GFXBase>> & gfx)
+    {
+        auto msNow = millis();
+
+        for (auto & layer : _layers)
+        {
+            if (layer.Opacity == 0)
+                continue;
+
+            bool bDue = !layer.bDrawn || msNow - layer.msLastDraw >= layer.UpdateInterval;
+            if (bDue && (!layer.bDrawn || layer.Effect->HasLayerChanged()))
+            {
+                auto usStart = micros();
+                layer.Effect->DrawInto(layer.Frame);
+                layer.Effect->RecordDraw(usStart, micros());
+                layer.msLastDraw = msNow;
+                layer.bDrawn     = true;
+            }
+
+            for (size_t i = 0; i < gfx.size(); i++)
+            {
+                BlendFrame(*gfx[i], layer.Frame.Frame(i), layer.Frame.FrameSize(i), layer.Opacity, layer.Blend);
+                gfx[i]->MarkAllDirty();
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,197 @@
+//+--------------------------------------------------------------------------
+//
+// File:        layoutgeometry.h
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+//
+// Description:
+//
+//    The rings and orders of the LEDs on the fans and hexagon the strip
+//    builds are wrapped into, as tables worked out by the compiler for the
+//    build so the effects that draw around them look positions up
+//
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include "globals.h"
+
+// FanLayout
+//
+// Every fan is the same run of FAN_SIZE LEDs split into NUM_RINGS concentric rings, outermost first, so the tables
+// cover one fan and the caller adds the fan's base.  The order tables give where the LED that's pos'th from the
+// bottom (or top, left or right) sits in the fan, working over the outer ring rather than around it.
+
+struct FanLayoutTables
+{
+    static constexpr size_t kDirections = 4;
+
+    int16_t     order[kDirections][FAN_SIZE];
+    uint16_t    ringStart[NUM_RINGS + 1];
+};
+
+constexpr FanLayoutTables BuildFanLayout()
+{
+    FanLayoutTables tables {};
+
+    constexpr int ringSizes[MAX_RINGS] = { RING_SIZE_0, RING_SIZE_1, RING_SIZE_2, RING_SIZE_3, RING_SIZE_4 };
+    static_assert(NUM_RINGS <= MAX_RINGS, "NUM_RINGS can't be more than MAX_RINGS");
+
+    for (int ring = 0; ring < NUM_RINGS; ring++)
+        tables.ringStart[ring + 1] = tables.ringStart[ring] + ringSizes[ring];
+
+    constexpr int offsets[FanLayoutTables::kDirections] = { LED_FAN_OFFSET_BU, LED_FAN_OFFSET_TD, LED_FAN_OFFSET_LR, LED_FAN_OFFSET_RL };
+
+    for (int pos = 0; pos < FAN_SIZE; pos++)
+    {
+        // Over the circle rather than around it: 0, 23, 1, 22, 2, 21... for a 24 LED ring
+
+        int across = (pos & 1) ? RING_SIZE_0 - 1 - pos / 2 : pos / 2;
+        for (size_t direction = 0; direction < FanLayoutTables::kDirections; direction++)
+            tables.order[direction][pos] = (across + offsets[direction]) % FAN_SIZE;
+    }
+
+    return tables;
+}
+
+inline constexpr FanLayoutTables g_FanLayoutTables = BuildFanLayout();
+
+class FanLayout
+{
+  public:
+
+    enum class Direction : uint8_t { BottomUp, TopDown, LeftRight, RightLeft };
+
+    static constexpr size_t RingCount()
+    {
+        return NUM_RINGS;
+    }
+
+    static constexpr size_t RingSize(size_t ring)
+    {
+        return g_FanLayoutTables.ringStart[ring + 1] - g_FanLayoutTables.ringStart[ring];
+    }
+
+    static constexpr uint16_t RingPixel(size_t ring, size_t n)
+    {
+        return g_FanLayoutTables.ringStart[ring] + n;
+    }
+
+    static constexpr int16_t OrderedPixel(Direction direction, size_t pos)
+    {
+        return g_FanLayoutTables.order[(size_t) direction][pos];
+    }
+};
+
+#if HEXAGON
+
+// HexLayout
+//
+// The hexagon is HEX_MAX_DIMENSION rows, growing from HEX_HALF_DIMENSION LEDs wide at the top to HEX_MAX_DIMENSION
+// in the middle and back, wired back and forth.  Its rings are the LEDs an indent in from each edge, and the ring
+// order table lists them ring by ring, in strip order within each.
+
+struct HexLayoutTables
+{
+    static constexpr size_t kRings = HEX_HALF_DIMENSION;
+
+    uint16_t    rowStart[HEX_MAX_DIMENSION];
+    uint8_t     rowWidth[HEX_MAX_DIMENSION];
+    uint16_t    ringStart[kRings + 1];
+    uint16_t    ringOrder[NUM_LEDS];
+};
+
+constexpr HexLayoutTables BuildHexLayout()
+{
+    HexLayoutTables tables {};
+
+    uint16_t start = 0;
+    for (int row = 0; row < HEX_MAX_DIMENSION; row++)
+    {
+        int width = row < HEX_HALF_DIMENSION ? HEX_HALF_DIMENSION + row : HEX_MAX_DIMENSION + HEX_HALF_DIMENSION - 1 - row;
+        tables.rowStart[row] = start;
+        tables.rowWidth[row] = width;
+        start += width;
+    }
+
+    // An LED's ring is how far in it is from the nearest edge, whether that's the top, bottom or an end of its row
+
+    uint8_t ringOf[NUM_LEDS] {};
+
+    for (int row = 0; row < HEX_MAX_DIMENSION; row++)
+    {
+        int width = tables.rowWidth[row];
+
+        for (int i = 0; i < width; i++)
+            ringOf[tables.rowStart[row] + i] = std::min(std::min(row, HEX_MAX_DIMENSION - 1 - row), std::min(i, width - 1 - i));
+    }
+
+    for (size_t ring = 0; ring < HexLayoutTables::kRings; ring++)
+    {
+        uint16_t count = tables.ringStart[ring];
+        for (uint16_t index = 0; index < NUM_LEDS; index++)
+            if (ringOf[index] == ring)
+                tables.ringOrder[count++] = index;
+        tables.ringStart[ring + 1] = count;
+    }
+
+    return tables;
+}
+
+inline constexpr HexLayoutTables g_HexLayoutTables = BuildHexLayout();
+
+static_assert(g_HexLayoutTables.rowStart[HEX_MAX_DIMENSION - 1] + g_HexLayoutTables.rowWidth[HEX_MAX_DIMENSION - 1] == NUM_LEDS,
+              "NUM_LEDS doesn't match the hexagon's HEX_MAX_DIMENSION and HEX_HALF_DIMENSION");
+
+class HexLayout
+{
+  public:
+
+    static constexpr size_t RingCount()
+    {
+        return HexLayoutTables::kRings;
+    }
+
+    static constexpr size_t RingSize(size_t ring)
+    {
+        return g_HexLayoutTables.ringStart[ring + 1] - g_HexLayoutTables.ringStart[ring];
+    }
+
+    static constexpr uint16_t RingPixel(size_t ring, size_t n)
+    {
+        return g_HexLayoutTables.ringOrder[g_HexLayoutTables.ringStart[ring] + n];
+    }
+
+    static constexpr uint16_t RowStart(size_t row)
+    {
+        return g_HexLayoutTables.rowStart[row];
+    }
+
+    // Rows past the bottom of the hexagon are zero wide rather than a read off the end of the table
+
+    static constexpr uint8_t RowWidth(size_t row)
+    {
+        return row < HEX_MAX_DIMENSION ? g_HexLayoutTables.rowWidth[row] : 0;
+    }
+};
+
+#endif
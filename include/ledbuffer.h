@@ -35,8 +35,14 @@
 
 #include <pixeltypes.h>
 #include <memory>
+#include <vector>
+#include <atomic>
 #include <iostream>
+#include <stdexcept>
 #include "values.h"
+#include "clocksync.h"
+#include "memoryplacement.h"
+#include "ingeststats.h"
 
 class LEDBuffer
 {
@@ -46,33 +52,120 @@ class LEDBuffer
 
   private:
 
-    std::unique_ptr<CRGB []> _leds;
+    CRGB *                   _leds;                 // The pixels of the frame: our own, or a shared frame's
+    CRGB *                   _pOwnLeds;             // View into the LEDBufferArena that owns our pixels
+    std::shared_ptr<CRGB>    _pSharedLeds;          // The SharedFramePool frame we show, if any
+    uint32_t                 _generation = 0;       // Bumped before each new frame is written; see Generation()
     uint32_t                 _pixelCount;
     uint64_t                 _timeStampMicroseconds;
     uint64_t                 _timeStampSeconds;
+    int64_t                  _usQueued = 0;         // When CommitNewBuffer put it in the ring
+
+    // BeginWrite
+    //
+    // Marks the frame as changing.  The buffers live in a vector, which an atomic member would make immovable, so the
+    // count is a plain integer that's only ever touched through the atomic builtins.
+
+    void BeginWrite()
+    {
+        __atomic_fetch_add(&_generation, 1, __ATOMIC_SEQ_CST);
+    }
+
+    // ReadFromWire
+    //
+    // Checks a PIXELDATA64 packet and takes its frame info, copying the colors to pDest unless that's nullptr
+
+    bool ReadFromWire(std::unique_ptr<uint8_t []> & payloadData, size_t payloadLength, CRGB * pDest)
+    {
+        if (payloadLength < 24)                 // Our header size
+        {
+            debugW("Not enough data received to process");
+            return false;
+        }
+
+        #if 0
+            debugV("========");
+            for (int i = 0; i < 24; i++)
+                debugV("%02x ", payloadData[i]);
+            debugV("========");
+        #endif
+
+        uint16_t command16 = WORDFromMemory(&payloadData[0]);
+        uint16_t channel16 = WORDFromMemory(&payloadData[2]);
+        uint32_t length32  = DWORDFromMemory(&payloadData[4]);
+        uint64_t seconds   = ULONGFromMemory(&payloadData[8]);
+        uint64_t micros    = ULONGFromMemory(&payloadData[16]);
+
+        //printf("UpdateFromWire -- Command: %u, Channel: %d, Length: %u, Seconds: %u, Micros: %u\n", command16, channel16, length32, seconds, micros);
+
+        const size_t cbHeader = sizeof(command16) + sizeof(channel16) + sizeof(length32) + sizeof(seconds) + sizeof(micros);
+
+        _timeStampSeconds      = seconds;
+        _timeStampMicroseconds = micros;
+        _pixelCount            = length32;
+
+        if (payloadLength < length32 * sizeof(CRGB) + cbHeader)
+        {
+            debugW("command16: %d   length32: %d,  payloadLength: %d\n", command16, length32, payloadLength);
+            debugW("Data size mismatch");
+            return false;
+        }
+        if (length32 > NUM_LEDS)
+        {
+            debugW("More data than we have LEDs\n");
+            return false;
+        }
+        debugV("PayloadLength: %d, command16: %d, Length32: %d", payloadLength, command16, length32);
+
+        if (pDest)
+        {
+            CRGB * pRGB = reinterpret_cast<CRGB *>(&payloadData[cbHeader]);
+            memcpy(pDest, pRGB, length32 * sizeof(CRGB));
+        }
+        debugV("seconds, micros: %llu.%llu", seconds, micros);
+        return true;
+    }
 
   public:
 
-    explicit LEDBuffer(std::shared_ptr<GFXBase> pStrand) :
+    LEDBuffer(std::shared_ptr<GFXBase> pStrand, CRGB * pLeds) :
                  _pStrand(pStrand),
+                 _leds(pLeds),
+                 _pOwnLeds(pLeds),
                  _pixelCount(0),
                  _timeStampMicroseconds(0),
                  _timeStampSeconds(0)
     {
-        _leds.reset(psram_allocator<CRGB>().allocate(NUM_LEDS));
     }
 
     ~LEDBuffer()
     {
     }
 
+    // Generation
+    //
+    // Changes whenever the producer starts on a new frame in this buffer, so a reader that isn't synchronized with the
+    // producer, like the show recorder, can copy the frame and then check that it didn't change underneath it
+
+    uint32_t Generation() const
+    {
+        return __atomic_load_n(&_generation, __ATOMIC_ACQUIRE);
+    }
+
     uint64_t Seconds()      const  { return _timeStampSeconds;      }
     uint64_t MicroSeconds() const  { return _timeStampMicroseconds; }
     uint32_t Length()       const  { return _pixelCount;            }
+    int64_t  QueuedMicros() const  { return _usQueued;              }
+
+    // Notes when the frame went into the ring, by esp_timer_get_time(), for the ingest latency
+    void MarkQueued()
+    {
+        _usQueued = esp_timer_get_time();
+    }
     
     double TimeTillDue() const  
     { 
-        return g_Values.AppTime.CurrentTime() - _timeStampSeconds - (_timeStampMicroseconds / (double) MICROS_PER_SECOND); 
+        return SyncedTime() - _timeStampSeconds - (_timeStampMicroseconds / (double) MICROS_PER_SECOND); 
     }
 
     bool IsBufferOlderThan(const timeval & tv) const
@@ -87,106 +180,421 @@ class LEDBuffer
         return false;
     }
 
+    // IsShared
+    //
+    // Whether the buffer shows a frame from the SharedFramePool rather than its own pixels
+
+    bool IsShared() const
+    {
+        return !!_pSharedLeds;
+    }
+
+    // Unshare
+    //
+    // Lets go of the shared frame, if any, and goes back to our own pixels.  Only called by the producer, on a buffer
+    // the draw loop isn't looking at.
+
+    void Unshare()
+    {
+        if (_pSharedLeds)
+        {
+            BeginWrite();
+            _pSharedLeds.reset();
+            _leds = _pOwnLeds;
+        }
+    }
+
+    // RawPixels
+    //
+    // Direct access to the color data, used by the socket server to read pixel payloads straight into the buffer.
+    // Shared frames are never written, so this hands out our own pixels.
+
+    uint8_t * RawPixels()
+    {
+        Unshare();
+        BeginWrite();
+        return reinterpret_cast<uint8_t *>(_leds);
+    }
+
+    // Pixels
+    //
+    // The color data, to read from, wherever it is
+
+    const uint8_t * Pixels() const
+    {
+        return reinterpret_cast<const uint8_t *>(_leds);
+    }
+
+    // SetFrameInfo
+    //
+    // Sets the pixel count and timestamp for a buffer whose color data was written via RawPixels()
+
+    bool SetFrameInfo(uint32_t pixelCount, uint64_t seconds, uint64_t micros)
+    {
+        BeginWrite();
+        if (pixelCount > NUM_LEDS)
+        {
+            debugW("More data than we have LEDs\n");
+            return false;
+        }
+
+        _pixelCount            = pixelCount;
+        _timeStampSeconds      = seconds;
+        _timeStampMicroseconds = micros;
+        return true;
+    }
+
     // UpdateFromWire
     //
     // Parse and deposit a WiFi packet into a buffer
 
     bool UpdateFromWire(std::unique_ptr<uint8_t []> & payloadData, size_t payloadLength)
     {
-        if (payloadLength < 24)                 // Our header size
+        Unshare();
+        BeginWrite();
+        return ReadFromWire(payloadData, payloadLength, _leds);
+    }
+
+    // ShareFromWire
+    //
+    // Like UpdateFromWire, but the buffer shows the shared frame instead of a copy of its own, for packets that go
+    // to several channels.  The first buffer to take the packet fills the frame, and the rest just point at it.
+
+    bool ShareFromWire(const std::shared_ptr<CRGB> & pFrame, bool bFillFrame, std::unique_ptr<uint8_t []> & payloadData, size_t payloadLength)
+    {
+        Unshare();
+        BeginWrite();
+        if (!ReadFromWire(payloadData, payloadLength, bFillFrame ? pFrame.get() : nullptr))
+            return false;
+
+        _pSharedLeds = pFrame;
+        _leds        = pFrame.get();
+        return true;
+    }
+
+    // UpdateFromWireDelta
+    //
+    // Like UpdateFromWire, but the colors in the packet are XORed with those of the base buffer to rebuild the
+    // frame.  The base may be this very buffer when the ring only has a single slot, which works out fine as
+    // each byte is only read before it is written.
+
+    bool UpdateFromWireDelta(const LEDBuffer & base, std::unique_ptr<uint8_t []> & payloadData, size_t payloadLength)
+    {
+        const size_t cbHeader = 24;             // Same header as WIFI_COMMAND_PIXELDATA64
+
+        if (payloadLength < cbHeader)
         {
             debugW("Not enough data received to process");
             return false;
         }
 
-        #if 0
-            debugV("========");
-            for (int i = 0; i < 24; i++)
-                debugV("%02x ", payloadData[i]);
-            debugV("========");
-        #endif
-
-        uint16_t command16 = WORDFromMemory(&payloadData[0]);
-        uint16_t channel16 = WORDFromMemory(&payloadData[2]);
         uint32_t length32  = DWORDFromMemory(&payloadData[4]);
         uint64_t seconds   = ULONGFromMemory(&payloadData[8]);
         uint64_t micros    = ULONGFromMemory(&payloadData[16]);
 
-        //printf("UpdateFromWire -- Command: %u, Channel: %d, Length: %u, Seconds: %u, Micros: %u\n", command16, channel16, length32, seconds, micros);
-
-        const size_t cbHeader = sizeof(command16) + sizeof(channel16) + sizeof(length32) + sizeof(seconds) + sizeof(micros);
-
-        _timeStampSeconds      = seconds;
-        _timeStampMicroseconds = micros;
-        _pixelCount            = length32;
-
         if (payloadLength < length32 * sizeof(CRGB) + cbHeader)
         {
-            debugW("command16: %d   length32: %d,  payloadLength: %d\n", command16, length32, payloadLength);
-            debugW("Data size mismatch");
+            debugW("Delta size mismatch, length32: %d,  payloadLength: %d\n", length32, payloadLength);
             return false;
         }
-        if (length32 > NUM_LEDS)
+        if (length32 > NUM_LEDS || length32 != base.Length())
         {
-            debugW("More data than we have LEDs\n");
+            debugW("Delta of %u pixels does not match base frame of %u\n", length32, base.Length());
             return false;
         }
-        debugV("PayloadLength: %d, command16: %d, Length32: %d", payloadLength, command16, length32);
 
-        CRGB * pRGB = reinterpret_cast<CRGB *>(&payloadData[cbHeader]);
+        // If the base is this buffer showing a shared frame, the XOR reads the shared frame and writes our own pixels
 
-        memcpy(_leds.get(), pRGB, length32 * sizeof(CRGB));
-        debugV("seconds, micros: %llu.%llu", seconds, micros);
-        debugV("Color0: %08x", (uint32_t) _leds[0]);
+        const uint8_t * pDelta = &payloadData[cbHeader];
+        const uint8_t * pBase  = base.Pixels();
+        uint8_t       * pDest  = RawPixels();
+
+        for (size_t i = 0; i < length32 * sizeof(CRGB); i++)
+            pDest[i] = pBase[i] ^ pDelta[i];
+
+        _timeStampSeconds      = seconds;
+        _timeStampMicroseconds = micros;
+        _pixelCount            = length32;
         return true;
     }
 
+    // DrawBufferBlended
+    //
+    // Draws this buffer blended amount/256 of the way towards the next one, using pScratch (NUM_LEDS in size) to
+    // hold the result.  Both buffers must hold the same number of pixels.
+
+    void DrawBufferBlended(const LEDBuffer & next, fract8 amount, std::unique_ptr<CRGB []> & pScratch)
+    {
+        blend(_leds, next._leds, pScratch.get(), _pixelCount, amount);
+        _pStrand->fillLeds(pScratch.get());
+    }
+
+    // DrawBuffer
+    //
+    // Only reads the buffer, as the producer may be looking at it at the same time as the base for a delta frame
+
     void DrawBuffer()
     {
-        _timeStampMicroseconds = 0;
-        _timeStampSeconds      = 0;
         _pStrand->fillLeds(_leds);
     }
 };
 
+// LEDBufferArena
+//
+// Backing store for all the LEDBuffers of one ring.  The buffer objects and their pixels each live in one
+// contiguous PSRAM block that is allocated once, rather than a shared_ptr and a pixel array per slot, which
+// made for hundreds of scattered allocations on big rings.  Consecutive frames are also adjacent in memory.
+
+class LEDBufferArena
+{
+    unique_free_array<CRGB>                            _pixels;
+    std::vector<LEDBuffer, psram_allocator<LEDBuffer>> _buffers;
+
+  public:
+
+    LEDBufferArena(uint32_t cBuffers, std::shared_ptr<GFXBase> pGFX)
+    {
+        // Each frame is copied in once and out once, front to back, so the ring is the one big buffer that's fine in PSRAM
+        _pixels.reset(PlacedAlloc<CRGB>(cBuffers * NUM_LEDS, Placement::Cold, "led ring"));
+        if (!_pixels)
+            throw std::runtime_error("Could not allocate all buffers");
+        _buffers.reserve(cBuffers);
+
+        for (uint32_t i = 0; i < cBuffers; i++)
+            _buffers.emplace_back(pGFX, &_pixels[i * NUM_LEDS]);
+    }
+
+    LEDBuffer & operator[](size_t index)
+    {
+        return _buffers[index];
+    }
+};
+
+// SharedFramePool
+//
+// A few frames that a packet sent to several channels is copied into once, for the buffers of all those channels to
+// show, rather than a copy in each ring.  A frame is free again once no buffer holds it, which is once each buffer
+// that showed it has been filled again or let go of it by ReleaseSharedFrames.  The frames are never written while
+// buffers hold them, and only the producer hands them out or lets go of them, so no lock is needed beyond the one
+// that keeps producers apart.
+
+class SharedFramePool
+{
+    unique_free_array<CRGB>             _pixels;
+    std::vector<std::shared_ptr<CRGB>>  _frames;        // Each with its own count of the buffers holding it, plus ours
+
+  public:
+
+    explicit SharedFramePool(size_t cFrames)
+    {
+        _pixels.reset(PlacedAlloc<CRGB>(cFrames * NUM_LEDS, Placement::Cold, "shared frames"));
+        if (!_pixels)
+            return;
+
+        // The pixels belong to the pool, so the frames don't delete anything when the last one goes
+
+        _frames.reserve(cFrames);
+        for (size_t i = 0; i < cFrames; i++)
+            _frames.emplace_back(&_pixels[i * NUM_LEDS], [](CRGB *) {});
+    }
+
+    size_t FrameCount() const
+    {
+        return _frames.size();
+    }
+
+    // Acquire
+    //
+    // A frame no buffer is showing, or nullptr if they're all in use
+
+    std::shared_ptr<CRGB> Acquire() const
+    {
+        for (auto & frame : _frames)
+            if (frame.use_count() == 1)
+                return frame;
+        return nullptr;
+    }
+};
+
+#if ENABLE_JITTER_BUFFER
+
+// JitterBuffer
+//
+// Watches how far ahead of our clock the frames arrive (their "lead") and works out a presentation offset for the
+// draw loop, so that we only hold as much lead as the network jitter calls for rather than whatever the sender
+// chose.  Jitter is the RFC 3550 style running mean of lead changes between frames, and drift between the
+// sender's clock and ours shows up as the mean lead walking off, which we measure over longer windows and feed
+// forward.  Note that a device running with an offset is no longer in lockstep with others showing the same
+// stream.  Updated by the producer only; the offset is read by the draw loop.
+
+class JitterBuffer
+{
+    static constexpr double kLeadMultiplier = 4.0;      // Target lead in multiples of the jitter, plus JITTER_MIN_LEAD
+    static constexpr double kMaxSlew        = 0.05;     // Max seconds of offset change per second, so motion doesn't jump
+    static constexpr double kDriftWindow    = 2.0;      // Seconds between drift measurements
+    static constexpr double kResetGap       = 2.0;      // A gap this long between frames means a new stream, start over
+
+    double             _leadMean    = 0.0;
+    double             _jitter      = 0.0;
+    double             _drift       = 0.0;
+    double             _lastLead    = 0.0;
+    double             _lastArrival = 0.0;
+    double             _driftLead   = 0.0;
+    double             _driftTime   = 0.0;
+    bool               _bPrimed     = false;
+    std::atomic<float> _offset      { 0.0f };
+
+  public:
+
+    double LeadMean()   const { return _leadMean; }
+    double Jitter()     const { return _jitter; }
+    double Drift()      const { return _drift; }
+    double TargetLead() const { return JITTER_MIN_LEAD + kLeadMultiplier * _jitter; }
+
+    // PresentationOffset
+    //
+    // Seconds to add to the clock when deciding which frame is due
+
+    double PresentationOffset() const
+    {
+        return _offset.load(std::memory_order_relaxed);
+    }
+
+    // FrameAdded
+    //
+    // Called by the producer with the timestamp of each frame it adds to the ring
+
+    void FrameAdded(double frameTime)
+    {
+        double now  = SyncedTime();
+        double lead = frameTime - now;
+
+        if (!_bPrimed || now - _lastArrival > kResetGap)
+        {
+            _leadMean  = _driftLead = _lastLead = lead;
+            _jitter    = _drift = 0.0;
+            _driftTime = _lastArrival = now;
+            _bPrimed   = true;
+            _offset.store(lead - TargetLead(), std::memory_order_relaxed);
+            return;
+        }
+
+        _jitter   += (std::abs(lead - _lastLead) - _jitter) / 16.0;
+        _leadMean += (lead - _leadMean) / 64.0;
+
+        if (now - _driftTime >= kDriftWindow)
+        {
+            _drift    += ((_leadMean - _driftLead) / (now - _driftTime) - _drift) / 4.0;
+            _driftLead = _leadMean;
+            _driftTime = now;
+        }
+
+        double elapsed = now - _lastArrival;
+        double offset  = PresentationOffset() + _drift * elapsed;
+        double maxStep = kMaxSlew * elapsed;
+        offset += std::clamp(_leadMean - TargetLead() - offset, -maxStep, maxStep);
+        _offset.store(offset, std::memory_order_relaxed);
+
+        _lastLead    = lead;
+        _lastArrival = now;
+    }
+};
+
+#endif
+
 // LEDBufferManager
 //
-// Manages a circular buffer of LEDBuffer objects.  The buffer itself is an array of shared_ptrs to
-// LEDBuffer objects.  The buffer is managed through a unique_ptr.  The LEDBuffer objects are managed
-// through shared_ptrs as they are also returned to callers.
+// Manages a circular buffer of LEDBuffer objects, which live in an LEDBufferArena.  Buffers are handed
+// out to callers as shared_ptrs that alias the arena, so they all share its one control block.
+//
+// The ring is single-producer, single-consumer and lock-free: only the network side (the producer) moves
+// the head index and only the draw loop (the consumer) moves the tail, so neither ever waits on the other.
+// The slots themselves never move after construction.  The producer fills the slot at the head, which the
+// consumer cannot see, and publishes it with CommitNewBuffer.  The slot just behind the tail is the one the
+// consumer was last handed and may still be drawing, so the producer treats it as occupied as well.  That
+// costs one buffer of depth compared to the old locked ring, on top of the slot kept empty to tell full
+// from empty, so a ring of n slots holds at most n - 2 frames waiting to be drawn.  A 2-slot ring would hold
+// none and drop every commit, which is why globals.h won't build one with incoming WiFi.  If more than one
+// task produces frames, they must still serialize among themselves, which is what g_buffer_mutex is now
+// used for.
 
 class LEDBufferManager
 {
-    std::unique_ptr<std::vector<std::shared_ptr<LEDBuffer>>> _ppBuffers;          // The circular array of buffer ptrs
-    std::shared_ptr<LEDBuffer> _pLastBufferAdded;   // Keeps track of the MRU buffer
-    size_t                                               _iNextBuffer;        // Head pointer index
-    size_t                                               _iLastBuffer;        // Tail pointer index
+    std::shared_ptr<LEDBufferArena>                      _pArena;             // Storage for the circular array of buffers
+    std::atomic<size_t>                                  _iNextBuffer;        // Head pointer index, moved by the producer
+    std::atomic<size_t>                                  _iLastBuffer;        // Tail pointer index, moved by the consumer
+    std::atomic<bool>                                    _bAnyBufferAdded;    // Whether the slot behind the head holds a frame
     uint32_t                                             _cBuffers;           // Number of buffers
-    float                                                _BufferAgeOldest = 0;
-    float                                                _BufferAgeNewest = 0;
+#if ENABLE_JITTER_BUFFER
+    std::unique_ptr<JitterBuffer>                        _pJitterBuffer;      // Presentation offset controller
+#endif
+
+    inline size_t Wrap(size_t i) const
+    {
+        return i % _cBuffers;
+    }
+
+    inline std::shared_ptr<LEDBuffer> Slot(size_t i) const
+    {
+        return std::shared_ptr<LEDBuffer>(_pArena, &(*_pArena)[i]);
+    }
 
   public:
 
     LEDBufferManager(uint32_t cBuffers, std::shared_ptr<GFXBase> pGFX)
-     : _ppBuffers(std::make_unique<std::vector<std::shared_ptr<LEDBuffer>>>()), // Create the circular array of ptrs
+     : _pArena(make_shared_psram<LEDBufferArena>(cBuffers, pGFX)),
        _iNextBuffer(0),
        _iLastBuffer(0),
+       _bAnyBufferAdded(false),
        _cBuffers(cBuffers)
     {
-        // The initializer creates a uniquely owned table of shared pointers.
-        // We exclusively can see the table, but the buffer objects it contains
-        // are returned back out to callers so they must be shared pointers.
+        #if ENABLE_JITTER_BUFFER
+            _pJitterBuffer = std::make_unique<JitterBuffer>();
+        #endif
+    }
+
+    // The atomics aren't movable, but the managers live in a vector that's only grown during setup, before
+    // either side of the ring is running, so a plain move of their values is fine there
+
+    LEDBufferManager(LEDBufferManager && other)
+     : _pArena(std::move(other._pArena)),
+       _iNextBuffer(other._iNextBuffer.load()),
+       _iLastBuffer(other._iLastBuffer.load()),
+       _bAnyBufferAdded(other._bAnyBufferAdded.load()),
+       _cBuffers(other._cBuffers)
+    {
+        #if ENABLE_JITTER_BUFFER
+            _pJitterBuffer = std::move(other._pJitterBuffer);
+        #endif
+    }
+
+    // PresentationOffset
+    //
+    // Seconds the consumer should add to the clock when deciding which frames are due, which is always zero
+    // unless the jitter buffer is enabled
 
-        for (int i = 0; i < _cBuffers; i++)
-            _ppBuffers->push_back(make_shared_psram<LEDBuffer>(pGFX));
+    double PresentationOffset() const
+    {
+        #if ENABLE_JITTER_BUFFER
+            return _pJitterBuffer->PresentationOffset();
+        #else
+            return 0.0;
+        #endif
     }
 
+    #if ENABLE_JITTER_BUFFER
+        const JitterBuffer & GetJitterBuffer() const
+        {
+            return *_pJitterBuffer;
+        }
+    #endif
+
     double AgeOfOldestBuffer()
     {
         if (false == IsEmpty())
         {
             auto pOldest = PeekOldestBuffer();
-            return (pOldest->Seconds() + pOldest->MicroSeconds() / MICROS_PER_SECOND) - g_Values.AppTime.CurrentTime();
+            return (pOldest->Seconds() + pOldest->MicroSeconds() / MICROS_PER_SECOND) - SyncedTime();
         }
         else
         {
@@ -199,7 +607,7 @@ class LEDBufferManager
         if (false == IsEmpty())
         {
             auto pNewest = PeekNewestBuffer();
-            return (pNewest->Seconds() + pNewest->MicroSeconds() / MICROS_PER_SECOND) - g_Values.AppTime.CurrentTime();
+            return (pNewest->Seconds() + pNewest->MicroSeconds() / MICROS_PER_SECOND) - SyncedTime();
         }
         else
         {
@@ -222,15 +630,27 @@ class LEDBufferManager
 
     size_t Depth() const
     {
-        if (_iNextBuffer < _iLastBuffer)
-            return (_iNextBuffer + _cBuffers - _iLastBuffer);
+        size_t iNext = _iNextBuffer.load(std::memory_order_acquire);
+        size_t iLast = _iLastBuffer.load(std::memory_order_acquire);
+
+        if (iNext < iLast)
+            return (iNext + _cBuffers - iLast);
         else
-            return _iNextBuffer - _iLastBuffer;
+            return iNext - iLast;
     }
 
     inline bool IsEmpty() const
     {
-        return _iNextBuffer == _iLastBuffer;
+        return _iNextBuffer.load(std::memory_order_acquire) == _iLastBuffer.load(std::memory_order_acquire);
+    }
+
+    // IsFull
+    //
+    // True when committing another buffer would hand the producer the slot the consumer may still be drawing
+
+    inline bool IsFull() const
+    {
+        return Wrap(_iNextBuffer.load(std::memory_order_relaxed) + 2) == _iLastBuffer.load(std::memory_order_acquire);
     }
 
     // PeekNewestBuffer
@@ -241,41 +661,90 @@ class LEDBufferManager
     {
         if (IsEmpty())
             return nullptr;
-        return _pLastBufferAdded;
+        return PeekLastBufferAdded();
     }
 
-    // GetNewBuffer
+    // PeekLastBufferAdded
     //
-    // Grabs the next buffer in the circle, advancing the tail pointer as well if we've
-    // 'caught up' to the head pointer, which effective throws away that buffer via reuse
+    // Like PeekNewestBuffer, but still returns the most recently added buffer after the draw loop has consumed it,
+    // which is what we need as the base for a delta frame.  nullptr until the first buffer is added.
 
-    std::shared_ptr<LEDBuffer> GetNewBuffer()
+    std::shared_ptr<LEDBuffer> PeekLastBufferAdded() const
     {
-        auto pResult = (*_ppBuffers)[_iNextBuffer++];
+        if (!_bAnyBufferAdded.load(std::memory_order_acquire))
+            return nullptr;
+        return Slot(Wrap(_iNextBuffer.load(std::memory_order_acquire) + _cBuffers - 1));
+    }
 
-        if (IsEmpty())
-            _iLastBuffer++;
+    // ReserveNewBuffer
+    //
+    // Returns the buffer at the head of the ring for the producer to fill.  The consumer can't see it until
+    // CommitNewBuffer publishes it, so it can be filled without holding any lock.
 
-        _iLastBuffer %= _cBuffers;
-        _iNextBuffer %= _cBuffers;
+    std::shared_ptr<LEDBuffer> ReserveNewBuffer() const
+    {
+        return Slot(_iNextBuffer.load(std::memory_order_relaxed));
+    }
 
-        _pLastBufferAdded = pResult;
+    // ReleaseSharedFrames
+    //
+    // Lets go of the shared frames held by slots the consumer is done with, so the SharedFramePool can hand them out
+    // again.  Those are the ones from the head up to two behind the tail; the tail may move on while we look, which
+    // only frees more.  Called by the producer.
 
-        return pResult;
+    void ReleaseSharedFrames()
+    {
+        size_t iNext  = _iNextBuffer.load(std::memory_order_relaxed);
+        size_t cFree  = _cBuffers - 1 - Depth();
+
+        for (size_t i = 0; i < cFree; i++)
+            (*_pArena)[Wrap(iNext + i)].Unshare();
+    }
+
+    // CommitNewBuffer
+    //
+    // Publishes the buffer returned by ReserveNewBuffer.  The producer can't take the oldest frame away from the
+    // consumer the way the locked ring used to, so when the ring is full the new frame is dropped instead, and
+    // false is returned.  The reserved slot stays reserved and will simply be filled again next time.
+
+    bool CommitNewBuffer()
+    {
+        if (IsFull())
+        {
+            debugV("Buffer ring full, dropping frame");
+            g_IngestStats.FrameCommitted(false);
+            return false;
+        }
+
+        auto & newBuffer = (*_pArena)[_iNextBuffer.load(std::memory_order_relaxed)];
+        newBuffer.MarkQueued();
+        g_IngestStats.FrameCommitted(true);
+
+        #if ENABLE_JITTER_BUFFER
+            // Frames without a timestamp are drawn as soon as they arrive, so they tell us nothing about the lead
+
+            if (newBuffer.Seconds() != 0)
+                _pJitterBuffer->FrameAdded(newBuffer.Seconds() + newBuffer.MicroSeconds() / (double) MICROS_PER_SECOND);
+        #endif
+
+        _iNextBuffer.store(Wrap(_iNextBuffer.load(std::memory_order_relaxed) + 1), std::memory_order_release);
+        _bAnyBufferAdded.store(true, std::memory_order_release);
+        return true;
     }
 
     // GetOldestBuffer
     //
-    // Return a pointer to the very oldest buffer, or nullptr if empty
+    // Return a pointer to the very oldest buffer, or nullptr if empty.  The buffer belongs to the consumer until
+    // its next call to GetOldestBuffer, so it can be drawn without any lock held.
 
     std::shared_ptr<LEDBuffer> GetOldestBuffer()
     {
         if (IsEmpty())
             return nullptr;
 
-        auto pResult = (*_ppBuffers)[_iLastBuffer];
-        _iLastBuffer++;
-        _iLastBuffer %= _cBuffers;
+        size_t iLast = _iLastBuffer.load(std::memory_order_relaxed);
+        auto pResult = Slot(iLast);
+        _iLastBuffer.store(Wrap(iLast + 1), std::memory_order_release);
 
         return pResult;
     }
@@ -289,15 +758,15 @@ class LEDBufferManager
         if (IsEmpty())
             return nullptr;
 
-        return (*_ppBuffers)[_iLastBuffer];
+        return Slot(_iLastBuffer.load(std::memory_order_acquire));
     }
 
     const std::shared_ptr<LEDBuffer> operator[](size_t index) const
     {
         if (IsEmpty())
             return nullptr;
-        size_t i = (_iLastBuffer + index) % _cBuffers;
-        return (*_ppBuffers)[i];
+        size_t i = Wrap(_iLastBuffer.load(std::memory_order_acquire) + index);
+        return Slot(i);
     }
 };
 
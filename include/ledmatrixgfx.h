@@ -51,14 +51,35 @@ protected:
     const float captionFadeInTime = 500;
     const float captionFadeOutTime = 1000;
 
+    #if ENABLE_DIRTY_TRACKING
+        CRGB * _pLastFrame     = nullptr;                                           // Copy of the last frame we swapped forward
+        int    _lastPowerDraw  = 0;                                                 // EstimatePowerDraw() of that frame
+        ChannelSums _lastFrameSums;                                                 // Channel totals over _pLastFrame
+
+        bool   FrameHasDamage(bool bTrustDirtyRegion);
+    #endif
+
+    #if ENABLE_MATRIX_DITHER
+        void   ApplyOutputStage(uint8_t brightness);                                // Gamma, brightness and dither on the way to the panel
+        void   RestoreCleanFrame();
+    #endif
+
 public:
     typedef RGB_TYPE(COLOR_DEPTH) SM_RGB;
-    static const uint8_t kMatrixWidth = MATRIX_WIDTH;                                   // known working: 32, 64, 96, 128
-    static const uint8_t kMatrixHeight = MATRIX_HEIGHT;                                 // known working: 16, 32, 48, 64
+
+    // The canvas is the whole chain of panels.  SmartMatrix splits a chain into rows of MATRIX_PANEL_HEIGHT and puts
+    // each row of panels in its place (flipping every other one with C-shape stacking) as it fills the refresh
+    // buffers, so the effects draw into one linear canvas and the panel layout costs them nothing per pixel.
+
+    static const uint16_t kMatrixWidth = MATRIX_WIDTH;                                  // known working: 32, 64, 96, 128
+    static const uint16_t kMatrixHeight = MATRIX_HEIGHT;                                // known working: 16, 32, 48, 64
     static const uint8_t kRefreshDepth = COLOR_DEPTH;                                   // known working: 24, 36, 48
     static const uint8_t kDmaBufferRows = 4;                                            // known working: 2-4, use 2 to save memory, more to keep from dropping frames and automatically lowering refresh rate
-    static const uint8_t kPanelType = SMARTMATRIX_HUB75_32ROW_MOD16SCAN;                // use SMARTMATRIX_HUB75_16ROW_MOD8SCAN for common 16x32 panels
-    static const uint8_t kMatrixOptions = (SMARTMATRIX_OPTIONS_BOTTOM_TO_TOP_STACKING   /* | SMARTMATRIX_OPTIONS_ESP32_CALC_TASK_CORE_1 */); // see http://docs.pixelmatix.com/SmartMatrix for options
+    static const uint8_t kPanelType = MATRIX_PANEL_TYPE;                                // use SMARTMATRIX_HUB75_16ROW_MOD8SCAN for common 16x32 panels
+    static const uint8_t kMatrixOptions = (MATRIX_PANEL_STACKING                        /* | SMARTMATRIX_OPTIONS_ESP32_CALC_TASK_CORE_1 */); // see http://docs.pixelmatix.com/SmartMatrix for options
+
+    static_assert(kMatrixHeight % MATRIX_PANEL_HEIGHT == 0, "MATRIX_HEIGHT must be a whole number of rows of panels");
+    static_assert((uint32_t) kMatrixWidth * kMatrixHeight <= 65536, "The canvas has to fit the 16 bit XY index");
     static const uint8_t kBackgroundLayerOptions = (SM_BACKGROUND_OPTIONS_NONE);
     static const uint8_t kDefaultBrightness = 255; // full (100%) brightness
     static const rgb24   defaultBackgroundColor;
@@ -74,6 +95,9 @@ public:
 
     ~LEDMatrixGFX()
     {
+        #if ENABLE_DIRTY_TRACKING
+            free(_pLastFrame);
+        #endif
     }
 
     static void InitializeHardware(std::vector<std::shared_ptr<GFXBase>>& devices)
@@ -90,7 +114,11 @@ public:
         // We don't need color correction on the title layer, but we want it on the main background
 
         titleLayer.enableColorCorrection(false);
-        backgroundLayer.enableColorCorrection(true);
+        #if ENABLE_MATRIX_DITHER
+            backgroundLayer.enableColorCorrection(false);                           // The output stage does the gamma instead
+        #else
+            backgroundLayer.enableColorCorrection(true);
+        #endif
 
         // Starting an effect might need to draw, so we need to set the leds up before doing so
         std::static_pointer_cast<LEDMatrixGFX>(devices[0])->setLeds(GetMatrixBackBuffer());
@@ -98,30 +126,30 @@ public:
 
     void SetBrightness(byte amount)
     {
-        matrix.setBrightness(amount);
+        #if ENABLE_MATRIX_DIRECT_OUTPUT
+            SetDirectBrightness(amount);                                            // Goes into the bit planes as they're packed
+        #else
+            matrix.setBrightness(amount);
+        #endif
     }
 
+    // Experimentally derived: 1500mW for the board, and 4.10, 0.82 and 1.75mW for a pixel's red, green and blue at full
+
+    static constexpr PowerModel kPowerModel = { 1500, 0, (uint32_t)(4.10 * 65536 / 255), (uint32_t)(0.82 * 65536 / 255), (uint32_t)(1.75 * 65536 / 255) };
+
     // EstimatePowerDraw
     //
-    // Estimate the total power load for the board and matrix by walking the pixels and adding our previously measured
-    // power draw per pixel based on what color and brightness each pixel is
+    // Estimate the total power load for the board and matrix from how much of each color the pixels hold.  With
+    // dirty tracking, the sums are kept up to date as damaged rows are copied, so this doesn't walk the frame at all.
 
     int EstimatePowerDraw()
     {
-        constexpr auto kBaseLoad       = 1500;          // Experimentally derived values
-        constexpr auto mwPerPixelRed   = 4.10f;
-        constexpr auto mwPerPixelGreen = 0.82f;
-        constexpr auto mwPerPixelBlue  = 1.75f;
+        #if ENABLE_DIRTY_TRACKING
+            if (_pLastFrame)
+                return kPowerModel.Milliwatts(_lastFrameSums, NUM_LEDS);
+        #endif
 
-        float totalPower = kBaseLoad;
-        for (int i = 0; i < NUM_LEDS; i++)
-        {
-            const auto pixel = leds[i];
-            totalPower += pixel.r * mwPerPixelRed   / 255.0f;
-            totalPower += pixel.g * mwPerPixelGreen / 255.0f;
-            totalPower += pixel.b * mwPerPixelBlue  / 255.0f;
-        }
-        return (int) totalPower;
+        return kPowerModel.Milliwatts(leds, NUM_LEDS);
     }
 
     uint16_t xy(uint16_t x, uint16_t y) const override
@@ -143,29 +171,36 @@ public:
         leds = pLeds;
     }
 
-    void fillLeds(std::unique_ptr<CRGB []> & pLEDs) override
+    void fillLeds(const CRGB * pLEDs) override
     {
         // A mesmerizer panel has the same layout as in memory, so we can memcpy.
 
-        memcpy(leds, pLEDs.get(), sizeof(CRGB) * GetLEDCount());
+        memcpy(leds, pLEDs, sizeof(CRGB) * GetLEDCount());
+        MarkAllDirty();
     }
 
     void Clear(CRGB color = CRGB::Black) override
     {
+        MarkAllDirty();
+
         // NB: We directly clear the backbuffer because otherwise effects would start with a snapshot of the effect
         //     before them on the next buffer swap.  So we clear the backbuffer and then the leds, which point to
         //     the current front buffer.  TLDR:  We clear both the front and back buffers to avoid flicker between effects.
 
+        //     An effect drawing into a render target has no business with the panel's buffers, so then it's just leds.
+
         if (color == CRGB::Black)
         {
-            memset((void *) backgroundLayer.backBuffer(), 0, sizeof(LEDMatrixGFX::SM_RGB) * _width * _height);
+            if (!IsDrawingOffscreen())
+                memset((void *) backgroundLayer.backBuffer(), 0, sizeof(LEDMatrixGFX::SM_RGB) * _width * _height);
             memset((void *) leds, 0, sizeof(CRGB) * _width * _height);
         }
         else
         {
             for (int i = 0; i < NUM_LEDS; i++)
             {
-                backgroundLayer.backBuffer()[i] = rgb24(color.r, color.g, color.b);
+                if (!IsDrawingOffscreen())
+                    backgroundLayer.backBuffer()[i] = rgb24(color.r, color.g, color.b);
                 leds[i] = color;
             }
         }
@@ -252,5 +287,10 @@ public:
     static void StartMatrix();
     static CRGB *GetMatrixBackBuffer();
     static void MatrixSwapBuffers(bool bSwapBackground);
+
+    #if ENABLE_MATRIX_DIRECT_OUTPUT
+        static void SetDirectBrightness(uint8_t brightness);
+        static bool DirectFrameNeeded();                                            // True if the last frame handed over is out of date
+    #endif
 };
 #endif
\ No newline at end of file
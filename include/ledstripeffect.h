@@ -35,6 +35,12 @@
 #include "types.h"
 #include "gfxbase.h"
 #include "ledmatrixgfx.h"
+#include "rendertarget.h"
+#include "effectmemory.h"
+#include "effectrandom.h"
+#include "effectworkers.h"
+#include "lowresfield.h"
+#include <atomic>
 #include <memory>
 #include <list>
 #include <stdlib.h>
@@ -46,6 +52,15 @@
     if (SetIfSelected(settingName, propertyName, property, value)) \
         return true
 
+// This one goes in the class of an effect whose members are all settings, or state it's fine for a copy to start
+// from, so there are no pointers or buffers that the copy would end up sharing.  It gives the effect a Clone() that
+// copies it in one allocation, rather than through JSON.
+#define EFFECT_CLONE_BY_COPY(effectType) \
+    std::shared_ptr<LEDStripEffect> Clone() const override \
+    { \
+        return make_shared_effect<effectType>(*this); \
+    }
+
 // LEDStripEffect
 //
 // Base class for an LED strip effect.  At a minimum they must draw themselves and provide a unique name.
@@ -65,6 +80,36 @@ class LEDStripEffect : public IJSONSerializable
     bool   _coreEffect = false;
     static std::vector<SettingSpec, psram_allocator<SettingSpec>> _baseSettingSpecs;
 
+    // Render cost profile, kept as exponential averages so they follow the effect's recent behavior
+
+    float         _msDrawAverage = 0.0f;            // Time spent in Draw()
+    float         _fpsAverage    = 0.0f;            // Rate at which Draw() is actually being called
+    unsigned long _usLastDraw    = 0;
+    uint32_t      _profileFrames = 0;
+    bool          _overBudget    = false;
+    uint8_t       _quality       = 100;             // Level of detail out of 100, which the EffectManager adjusts
+
+    unsigned long _usLastStep    = 0;               // Simulation time Step() has been run up to
+
+    // The prepare task and the drawing thread can both bring the state in, so these are read across tasks
+
+    std::atomic<bool> _initialized { false };       // Init() has run
+    std::atomic<bool> _resident    { false };       // AcquireState() has run and ReleaseState() hasn't since
+
+    enum PrepareState : uint8_t
+    {
+        PrepareIdle,                                // Prepare() hasn't run for the next Start()
+        PrepareQueued,                              // Handed to the prepare task
+        PrepareRunning,
+        PrepareDone                                 // Ran ahead, so the next Start() can go straight in
+    };
+
+    std::atomic<uint8_t> _prepareState = PrepareIdle;
+
+    EffectMemoryAccount _memory;                    // What the effect's state takes, when ENABLE_EFFECT_MEMORY_ACCOUNTING counts it
+    EffectRandom        _random { esp_random() };   // The effect's own random numbers, reseeded as it starts
+    LowResField         _field;                     // What the effect draws into if it has a FieldScale()
+
   protected:
 
     size_t _cLEDs = 0;
@@ -201,6 +246,8 @@ class LEDStripEffect : public IJSONSerializable
     LEDStripEffect(int effectNumber, const String & strName) :
         _effectNumber(effectNumber)
     {
+        ChargeConstructionTo(_memory);
+
         if (!strName.isEmpty())
             _friendlyName = strName;
     }
@@ -209,6 +256,8 @@ class LEDStripEffect : public IJSONSerializable
         : _effectNumber(jsonObject[PTY_EFFECTNR]),
           _friendlyName(jsonObject["fn"].as<String>())
     {
+        ChargeConstructionTo(_memory);
+
         if (jsonObject.containsKey("es"))
             _enabled = jsonObject["es"].as<int>() == 1;
         if (jsonObject.containsKey("mt"))
@@ -224,8 +273,36 @@ class LEDStripEffect : public IJSONSerializable
             _maximumEffectTime = 0;
     }
 
+    // Copies only what the effect is set to, never what it's drawing; see Clone()
+
+    LEDStripEffect(const LEDStripEffect & other)
+        : IJSONSerializable(other),
+          _effectNumber(other._effectNumber),
+          _friendlyName(other._friendlyName),
+          _enabled(other._enabled),
+          _maximumEffectTime(other._maximumEffectTime)
+    {
+        ChargeConstructionTo(_memory);
+    }
+
+    LEDStripEffect & operator=(const LEDStripEffect &) = delete;
+
+    // Clone
+    //
+    // A new, not yet initialized, effect with the same settings as this one.  Effects whose members are all plain
+    // settings say so with EFFECT_CLONE_BY_COPY, which makes this a single allocation; for the rest it returns
+    // nullptr, and the EffectManager copies them through their JSON instead.
+
+    virtual std::shared_ptr<LEDStripEffect> Clone() const
+    {
+        return nullptr;
+    }
+
     virtual ~LEDStripEffect()
     {
+        // Background work mustn't outlive the effect it's for.  Effects whose work uses their own members should
+        // cancel it in their own destructor too, as by the time we get here those are gone.
+        g_EffectWorkers.CancelAll(this);
     }
 
     virtual bool Init(std::vector<std::shared_ptr<GFXBase>>& gfx)
@@ -241,27 +318,241 @@ class LEDStripEffect : public IJSONSerializable
         return true;
     }
 
+    // AcquireState and ReleaseState
+    //
+    // Optional pair for effects that keep large buffers.  AcquireState() runs after Init() and before the effect is
+    // first scheduled.  With ENABLE_LAZY_EFFECTS, the EffectManager calls ReleaseState() once it has switched away,
+    // and AcquireState() again before the effect next comes around, so whatever one allocates the other must free.
+
+    virtual bool AcquireState() { return true; }
+    virtual void ReleaseState() {}
+
+    // FieldScale
+    //
+    // Effects that draw a smooth field, where each pixel costs a lot to work out but differs little from the ones
+    // around it, can return how many times smaller each way they'd like to draw it.  They then draw into Field()
+    // instead of the matrix, and each frame is scaled up to the matrix after Draw(), over whatever was there.  0, the
+    // default, draws straight to the matrix.
+
+    virtual uint8_t FieldScale() const { return 0; }
+
+    LowResField & Field()
+    {
+        return _field;
+    }
+
+    // EnsureResident
+    //
+    // Runs Init() the first time and AcquireState() whenever the state isn't there, so the effect is ready to Start()
+
+    bool EnsureResident(std::vector<std::shared_ptr<GFXBase>>& gfx)
+    {
+        EFFECT_MEMORY_SCOPE(_memory);
+
+        if (!_initialized)
+        {
+            if (!Init(gfx))
+                return false;
+            _initialized = true;
+        }
+
+        if (!_resident)
+        {
+            if (FieldScale() && !_field.Allocate(_GFX[0]->width(), _GFX[0]->height(), FieldScale()))
+                return false;
+
+            _resident = AcquireState();
+            if (!_resident)
+                _field.Release();
+        }
+
+        return _resident;
+    }
+
+    void Evict()
+    {
+        if (_resident)
+        {
+            debugV("Releasing state of %s", _friendlyName.c_str());
+            ReleaseState();
+            _field.Release();
+            _resident = false;
+
+            uint8_t state = PrepareDone;
+            _prepareState.compare_exchange_strong(state, PrepareIdle);
+        }
+    }
+
+    bool IsResident() const
+    {
+        return _resident;
+    }
+
+    // Prepare
+    //
+    // Optional setup that takes a while but doesn't draw, like seeding a world.  It runs once before every Start(),
+    // and with ENABLE_EFFECT_PREPARE the EffectManager tries to run it ahead of the change on a low priority task on
+    // the other core, so it can't assume it's on the drawing thread.
+
+    virtual void Prepare() {}
+
+    // Called by the EffectManager on the drawing thread to hand the effect to the prepare task.  False if it's
+    // already been handed over or prepared.
+
+    bool QueuePrepare()
+    {
+        uint8_t state = PrepareIdle;
+        return _prepareState.compare_exchange_strong(state, PrepareQueued);
+    }
+
+    // PrepareAhead
+    //
+    // Called on the prepare task.  Brings the state in and runs Prepare() unless Start() got there first.
+
+    void PrepareAhead(std::vector<std::shared_ptr<GFXBase>>& gfx)
+    {
+        uint8_t state = PrepareQueued;
+        if (!_prepareState.compare_exchange_strong(state, PrepareRunning))
+            return;
+
+        EFFECT_MEMORY_SCOPE(_memory);
+        bool bResident = EnsureResident(gfx);
+        if (bResident)
+            Prepare();
+
+        _prepareState = bResident ? PrepareDone : PrepareIdle;
+    }
+
+    // EnsurePrepared
+    //
+    // Called just before Start().  Uses the work the prepare task did if it's done, waits for it if it's underway,
+    // and otherwise brings the state in and runs Prepare() right here.
+
+    bool EnsurePrepared(std::vector<std::shared_ptr<GFXBase>>& gfx)
+    {
+        uint8_t state = _prepareState.load();
+
+        for (;;)
+        {
+            if (state == PrepareRunning)
+            {
+                delay(1);
+                state = _prepareState.load();
+                continue;
+            }
+
+            if (state == PrepareDone && _resident)
+            {
+                _prepareState = PrepareIdle;
+                return true;
+            }
+
+            if (_prepareState.compare_exchange_weak(state, PrepareRunning))
+                break;
+        }
+
+        EFFECT_MEMORY_SCOPE(_memory);
+        bool bResident = EnsureResident(gfx);
+        if (bResident)
+            Prepare();
+
+        _prepareState = PrepareIdle;
+        return bResident;
+    }
+
     virtual void Start() {}                                         // Optional method called when time to clean/init the effect
+
+    // When the effect is a layer, whether its next frame would look any different from the one it drew last.  The
+    // layer stack reuses the cached frame when it wouldn't.
+
+    virtual bool HasLayerChanged() const
+    {
+        return true;
+    }
     virtual void Draw() = 0;                                        // Your effect must implement these
 
-    std::shared_ptr<GFXBase> g(size_t channel = 0) const
+    // Returned by reference, so the many calls an effect makes each frame don't each touch the reference count
+    const std::shared_ptr<GFXBase> & g(size_t channel = 0) const
     {
         return _GFX[channel];
     }
 
-    // mg is a shortcut for MATRIX projects to retrieve a pointer to the specialized LEDMatrixGFX type
+    // StepsPerSecond and Step
+    //
+    // An effect that runs a simulation can advance it by a fixed timestep at a rate of its own rather than once per
+    // Draw().  Its speed then doesn't follow the frame rate, a heavy simulation can step less often than the frame
+    // is drawn, and Draw() only has to render the current state.
+
+    virtual float StepsPerSecond() const                    // Zero means the effect advances in Draw() itself
+    {
+        return 0.0f;
+    }
+
+    virtual void Step(float dt) {}
+
+    // DrawFrame
+    //
+    // What the EffectManager calls for every frame.  Runs as many Step()s as have come due since the last frame, up
+    // to a few so a slow frame can't snowball, and then Draw().
+
+    void DrawFrame()
+    {
+        EFFECT_MEMORY_SCOPE(_memory);
+        float stepsPerSecond = StepsPerSecond();
+
+        if (stepsPerSecond > 0.0f)
+        {
+            constexpr int kMaxStepsPerFrame = 4;
+
+            const unsigned long usStep = MICROS_PER_SECOND / stepsPerSecond;
+            const unsigned long usNow  = micros();
+
+            // After a long gap, like having been switched out, we take one step rather than catching up
+
+            if (_usLastStep == 0 || usNow - _usLastStep > MICROS_PER_SECOND)
+                _usLastStep = usNow - usStep;
+
+            for (int i = 0; i < kMaxStepsPerFrame && usNow - _usLastStep >= usStep; i++)
+            {
+                Step(usStep / (float) MICROS_PER_SECOND);
+                _usLastStep += usStep;
+            }
+
+            if (usNow - _usLastStep >= usStep)
+                _usLastStep = usNow;                        // Drop what we couldn't keep up with
+        }
+
+        Draw();
+
+        if (FieldScale())
+            _field.UpscaleTo(*g());
+    }
+
+    // DrawInto
+    //
+    // Draws a frame into a render target instead of the devices.  For effects that fade or blur what they drew
+    // last, the history they work from is whatever the target holds.
+
+    void DrawInto(const RenderTarget & target)
+    {
+        RenderTargetScope scope(_GFX, target);
+        DrawFrame();
+    }
+
+    // mg is a shortcut for MATRIX projects to retrieve a pointer to the specialized LEDMatrixGFX type.  The effect
+    // holds the device for as long as it lives, so these don't need to share ownership of it.
 
     #if USE_HUB75
-      std::shared_ptr<LEDMatrixGFX> mg(size_t channel = 0)
+      LEDMatrixGFX * mg(size_t channel = 0) const
       {
-        return std::static_pointer_cast<LEDMatrixGFX>(_GFX[channel]);
+        return static_cast<LEDMatrixGFX *>(_GFX[channel].get());
       }
     #endif
 
     #if HEXAGON
-      std::shared_ptr<HexagonGFX> hg(size_t channel = 0)
+      HexagonGFX * hg(size_t channel = 0) const
       {
-        return std::static_pointer_cast<HexagonGFX>(_GFX[channel]);
+        return static_cast<HexagonGFX *>(_GFX[channel].get());
       }
     #endif
 
@@ -285,6 +576,111 @@ class LEDStripEffect : public IJSONSerializable
         return 30;
     }
 
+    // RecordDraw
+    //
+    // Called by the EffectManager around every Draw() to keep the render cost profile up to date.  A long gap
+    // between draws means the effect was switched out, so rather than average that in we start a new interval.
+
+    void RecordDraw(unsigned long usStart, unsigned long usEnd)
+    {
+        constexpr auto kWeight = 1.0f / 32;
+        constexpr auto kMaxGap = MICROS_PER_SECOND;
+
+        float msDraw = (usEnd - usStart) / 1000.0f;
+        _msDrawAverage = _profileFrames == 0 ? msDraw : _msDrawAverage + kWeight * (msDraw - _msDrawAverage);
+
+        unsigned long usGap = usStart - _usLastDraw;
+        if (_usLastDraw != 0 && usGap > 0 && usGap < kMaxGap)
+        {
+            float fps = (float) MICROS_PER_SECOND / usGap;
+            _fpsAverage = _fpsAverage == 0.0f ? fps : _fpsAverage + kWeight * (fps - _fpsAverage);
+        }
+        _usLastDraw = usStart;
+        _profileFrames++;
+
+        // Once we've seen enough frames to trust the average, note whether the effect fits its frame budget
+
+        if (_profileFrames >= EFFECT_PROFILE_MIN_FRAMES)
+        {
+            bool overBudget = _msDrawAverage > EFFECT_PROFILE_BUDGET_RATIO * MILLIS_PER_SECOND / std::max<size_t>(1, DesiredFramesPerSecond());
+            if (overBudget && !_overBudget)
+                debugW("%s takes %.1fms per frame and can't reach its %zu fps", FriendlyName().c_str(), _msDrawAverage, DesiredFramesPerSecond());
+            _overBudget = overBudget;
+        }
+    }
+
+    float AverageDrawMilliseconds() const
+    {
+        return _msDrawAverage;
+    }
+
+    float AverageFramesPerSecond() const
+    {
+        return _fpsAverage;
+    }
+
+    bool IsOverBudget() const                               // True if Draw() alone takes longer than the effect's frame time allows
+    {
+        return _overBudget;
+    }
+
+    // Quality and SetQuality
+    //
+    // How much detail the effect should draw, out of 100.  Effects with work they can shed, like particle counts or
+    // blur passes, map it to their own amounts with QualityScaled().  With ENABLE_EFFECT_QUALITY the EffectManager
+    // lowers it while the effect can't keep its frame rate and raises it again when there's time to spare, so the
+    // effect draws less rather than dropping frames.  Effects that don't look at it are unaffected.
+
+    uint8_t Quality() const
+    {
+        return _quality;
+    }
+
+    void SetQuality(uint8_t quality)
+    {
+        _quality = std::min<uint8_t>(quality, 100);
+    }
+
+    // An amount between lowest at quality 0 and full at 100
+    template <typename T>
+    T QualityScaled(T full, T lowest) const
+    {
+        return lowest + (T) ((full - lowest) * _quality / 100);
+    }
+
+    // The memory the effect's state has taken through the effect allocators.  Once it's gone over its budget, the
+    // EffectManager stops scheduling it.
+
+    EffectMemoryAccount & MemoryAccount()
+    {
+        return _memory;
+    }
+
+    const EffectMemoryAccount & MemoryAccount() const
+    {
+        return _memory;
+    }
+
+    bool IsOverMemoryBudget() const
+    {
+        return _memory.Exceeded;
+    }
+
+    // The effect's random number generator.  Effects that draw random numbers per pixel or per particle should take
+    // them from here rather than from random(), which is slower and is shared with everything else that runs.  The
+    // EffectManager and the replay harness seed it as the effect starts, so a run can be repeated, and nodes that
+    // follow one another's effects draw the same numbers.
+
+    EffectRandom & Random()
+    {
+        return _random;
+    }
+
+    void SeedRandom(uint32_t seed)
+    {
+        _random.Seed(seed);
+    }
+
     virtual size_t MaximumEffectTime() const                // For splash screens and similar, a max display time for the effect
     {
         return _maximumEffectTime;
@@ -311,6 +707,16 @@ class LEDStripEffect : public IJSONSerializable
         return true;
     }
 
+    // DrawsOnlyWithPrimitives
+    //
+    // An effect that only changes pixels through the GFXBase drawing functions, and never through leds[] or the
+    // matrix layers directly, can return true so post-processing can trust the dirty region those functions keep.
+
+    virtual bool DrawsOnlyWithPrimitives() const
+    {
+        return false;
+    }
+
     // RandomRainbowColor
     //
     // Returns a random color of the rainbow
@@ -491,6 +897,16 @@ class LEDStripEffect : public IJSONSerializable
             device->setPixelsF(fPos, count, c, bMerge);
     }
 
+    // setPixelSpanOnAllChannels
+    //
+    // The same in subpixels (see GFXBase::PixelSpan), so the position is only converted once for all the channels
+
+    void setPixelSpanOnAllChannels(int32_t start, int32_t length, CRGB c, bool bMerge = false) const
+    {
+        for (auto& device : _GFX)
+            device->setPixelSpan(start, length, c, bMerge);
+    }
+
     // SerializeToJSON
     //
     // Serialize this effects paramters to a JSON document
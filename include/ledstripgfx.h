@@ -33,13 +33,40 @@
 #pragma once
 #include "gfxbase.h"
 
+#if ENABLE_PIPELINED_PRESENT && USE_HUB75
+    #error ENABLE_PIPELINED_PRESENT is for LED strips, HUB75 matrices already present from their own back buffer
+#endif
+
+// RMT has 8 channels to drive strips with.  FastLED's I2S driver does all of them in parallel and takes up to 16
+// (our channel masks are 16 bits), but only the original ESP32 has the I2S parallel mode it's built on.
+
+#if ENABLE_PARALLEL_LED_OUTPUT
+    #if !CONFIG_IDF_TARGET_ESP32
+        #error ENABLE_PARALLEL_LED_OUTPUT uses FastLED's I2S driver, which is only available on the original ESP32
+    #endif
+    #define MAX_STRIP_CHANNELS 16
+#else
+    #define MAX_STRIP_CHANNELS 8
+#endif
+
 // LEDStripGFX
 //
 // A derivation of GFXBase that adds LED-strip-specific functionality
 
 class LEDStripGFX : public GFXBase
 {
+public:
+
+    // FastLED's WS2812B figures: 5mW for every pixel, and 80, 55 and 75mW at full red, green and blue, per 256 steps
+
+    static constexpr PowerModel kPowerModel = { 0, 5, 80 << 8, 55 << 8, 75 << 8 };
+
 protected:
+
+    #if ENABLE_PIPELINED_PRESENT
+        CRGB * _presentLeds = nullptr;      // Copy of the last frame, which the present task sends to the strip
+    #endif
+
     static void AddLEDsToFastLED(std::vector<std::shared_ptr<GFXBase>>& devices)
     {
         // Macro to add LEDs to a channel
@@ -86,9 +113,41 @@ protected:
             ADD_CHANNEL(7);
         #endif
 
-        #ifdef POWER_LIMIT_MW
-            set_max_power_in_milliwatts(POWER_LIMIT_MW);                // Set brightness limit
+        // Only the parallel output gets this far
+
+        #if NUM_CHANNELS >= 9
+            ADD_CHANNEL(8);
         #endif
+
+        #if NUM_CHANNELS >= 10
+            ADD_CHANNEL(9);
+        #endif
+
+        #if NUM_CHANNELS >= 11
+            ADD_CHANNEL(10);
+        #endif
+
+        #if NUM_CHANNELS >= 12
+            ADD_CHANNEL(11);
+        #endif
+
+        #if NUM_CHANNELS >= 13
+            ADD_CHANNEL(12);
+        #endif
+
+        #if NUM_CHANNELS >= 14
+            ADD_CHANNEL(13);
+        #endif
+
+        #if NUM_CHANNELS >= 15
+            ADD_CHANNEL(14);
+        #endif
+
+        #if NUM_CHANNELS >= 16
+            ADD_CHANNEL(15);
+        #endif
+
+        // POWER_LIMIT_MW is applied by ShowFrame() along with the brightness, so FastLED isn't given a limit of its own
     }
 
 public:
@@ -99,25 +158,46 @@ public:
         leds = static_cast<CRGB *>(calloc(w * h, sizeof(CRGB)));
         if(!leds)
             throw std::runtime_error("Unable to allocate LEDs in LEDStripGFX");
+
+        #if ENABLE_PIPELINED_PRESENT
+            _presentLeds = static_cast<CRGB *>(calloc(w * h, sizeof(CRGB)));
+            if(!_presentLeds)
+                throw std::runtime_error("Unable to allocate present LEDs in LEDStripGFX");
+        #endif
     }
 
     ~LEDStripGFX() override
     {
         free(leds);
         leds = nullptr;
+
+        #if ENABLE_PIPELINED_PRESENT
+            free(_presentLeds);
+            _presentLeds = nullptr;
+        #endif
     }
 
+    #if ENABLE_PIPELINED_PRESENT
+        CRGB * PresentLeds()
+        {
+            return _presentLeds;
+        }
+    #endif
+
     static void InitializeHardware(std::vector<std::shared_ptr<GFXBase>>& devices)
     {
-        // We don't support more than 8 parallel channels
-        #if NUM_CHANNELS > 8
-            #error The maximum value of NUM_CHANNELS (number of parallel channels) is 8
+        #if NUM_CHANNELS > MAX_STRIP_CHANNELS
+            #error The maximum value of NUM_CHANNELS (number of parallel channels) is 8, or 16 with ENABLE_PARALLEL_LED_OUTPUT
         #endif
 
         for (int i = 0; i < NUM_CHANNELS; i++)
         {
             debugW("Allocating LEDStripGFX for channel %d", i);
             devices.push_back(make_shared_psram<LEDStripGFX>(MATRIX_WIDTH, MATRIX_HEIGHT));
+
+            #if ENABLE_XY_LOOKUP_TABLE
+                devices.back()->BuildXYTable(MATRIX_WIDTH, MATRIX_HEIGHT);
+            #endif
         }
 
         AddLEDsToFastLED(devices);
@@ -148,15 +228,18 @@ class HexagonGFX : public LEDStripGFX
 
     static void InitializeHardware(std::vector<std::shared_ptr<GFXBase>>& devices)
     {
-        // We don't support more than 8 parallel channels
-        #if NUM_CHANNELS > 8
-            #error The maximum value of NUM_CHANNELS (number of parallel channels) is 8
+        #if NUM_CHANNELS > MAX_STRIP_CHANNELS
+            #error The maximum value of NUM_CHANNELS (number of parallel channels) is 8, or 16 with ENABLE_PARALLEL_LED_OUTPUT
         #endif
 
         for (int i = 0; i < NUM_CHANNELS; i++)
         {
             debugW("Allocating HexagonGFX for channel %d", i);
             devices.push_back(make_shared_psram<HexagonGFX>(NUM_LEDS));
+
+            #if ENABLE_XY_LOOKUP_TABLE
+                devices.back()->BuildXYTable(HEX_MAX_DIMENSION, HEX_MAX_DIMENSION);
+            #endif
         }
 
         AddLEDsToFastLED(devices);
@@ -169,23 +252,16 @@ class HexagonGFX : public LEDStripGFX
             // Invalid row
             return -1;
         }
-        else if (row < HEX_HALF_DIMENSION)
-        {
-            // For the top half, we use the formula for the sum of an arithmetic series.  It's ok to stare.
-            return (row * (row + HEX_MAX_DIMENSION)) / 2;
-        }
         else if (row < HEX_MAX_DIMENSION)
         {
-            // For the bottom half, we adjust our row number to start from 1 again (d = row - 9)
-            // Then work our way back up from the end.  ChatGPT couldn't solve the series so I decided to
-            // just work backwards from the end using the same formula as the top half, and it works.
-            int d = HEX_MAX_DIMENSION - row;
-            return NUM_LEDS - (d * (d + HEX_MAX_DIMENSION)) / 2;
+            // The rows' starts are added up once, at compile time, in HexLayout
+            return HexLayout::RowStart(row);
         }
         else
         {
             // Invalid row
-            throw std::runtime_error(str_sprintf("Tried to get index of row %d in the hexagon.", row).c_str());
+            COUNT_ERROR(ErrorCounter::HexRowOutOfRange, "Tried to get index of row %d in the hexagon.", row);
+            return -1;
         }
     }
 
@@ -193,16 +269,15 @@ class HexagonGFX : public LEDStripGFX
     // Function to calculate the width of a specified row on an LED display.
     virtual int getRowWidth(int row) const
     {
-        if (row < HEX_HALF_DIMENSION)
-        {
-            // For the top half, the width simply increases from 10 to 19.
-            return HEX_HALF_DIMENSION + row;
-        }
-        else
+        if (row < 0 || row >= HEX_MAX_DIMENSION)
         {
-            // For the bottom half, the width decreases from 19 back to 10.
-            return HEX_MAX_DIMENSION + HEX_HALF_DIMENSION - 1 - row;
+            // Invalid row
+            COUNT_ERROR(ErrorCounter::HexRowOutOfRange, "Tried to get width of row %d in the hexagon.", row);
+            return 0;
         }
+
+        // The width increases from 10 to 19 down to the middle row, and decreases back to 10 below it
+        return HexLayout::RowWidth(row);
     }
 
 
@@ -228,26 +303,16 @@ class HexagonGFX : public LEDStripGFX
 
     // filHexRing
     //
-    // Fills a ring around the hexagon, inset by the indent specified and in the color provided
+    // Fills a ring around the hexagon, inset by the indent specified and in the color provided.  The LEDs of each
+    // ring are listed in the layout tables, so it's a walk down the list.
 
     virtual void fillHexRing(uint16_t indent, CRGB color)
     {
-        for (int i = indent; i < getRowWidth(indent)-indent; ++i)
-            setPixel(getStartIndexOfRow(indent) + i, color);
-
-        // Iterate over all rows
-        for (int row = indent; row < HEX_MAX_DIMENSION - indent; ++row)
-        {
-            // Get the start index of the current row
-            int startIndex = getStartIndexOfRow(row);
-
-            setPixel(startIndex + indent, color);                           // first pixel
-            setPixel(startIndex + getRowWidth(row) - 1 - indent, color);    // last pixel
-        }
-
-        for (int i = indent; i < getRowWidth(HEX_MAX_DIMENSION-indent-1)-indent; ++i)
-            setPixel(getStartIndexOfRow(HEX_MAX_DIMENSION-indent-1) + i, color);
+        if (indent >= HexLayout::RingCount())
+            return;
 
+        for (size_t n = 0; n < HexLayout::RingSize(indent); n++)
+            setPixel(HexLayout::RingPixel(indent, n), color);
     }
 };
 
@@ -31,8 +31,12 @@
 //---------------------------------------------------------------------------
 
 #pragma once
+#include <deque>
 #include "effectmanager.h"
+#include "deflate.h"
 #define COLOR_DATA_PACKET_HEADER 0x434C5244
+#define COLOR_STREAM_REQUEST_HEADER 0x434C5251      // "CLRQ"
+#define COLOR_STREAM_PACKET_HEADER  0x434C5253      // "CLRS"
 
 // Be careful of structure packing rules when adding elements to this structure
 // The client will be expecting the data to be packed in a certain way (tight).
@@ -47,6 +51,41 @@ typedef struct
     CRGB      colors[NUM_LEDS];  // Array of LED_COUNT CRGB values
 } ColorDataPacket;
 
+// Stream mode
+//
+// A client can ask for a leaner stream by sending a ColorStreamRequest, at any time after it connects.  Until it
+// does, it gets a ColorDataPacket for every frame, as it always has.  In stream mode every frame it gets is a
+// ColorStreamHeader, followed by payloadSize bytes that hold width * height CRGB values, row by row.  Each of those
+// may be XORed with the pixel in the frame sent before (Delta), and the lot then run-length encoded (RLE: a count
+// of 1 to 255 followed by the color it repeats) or deflated without a zlib or gzip wrapper (Deflate).
+
+enum ColorStreamFlags : uint8_t
+{
+    ColorStreamRLE      = 0x01,
+    ColorStreamDeflate  = 0x02,                     // Wins if RLE is asked for too
+    ColorStreamDelta    = 0x04
+};
+
+typedef struct __attribute__((packed))
+{
+    uint32_t  header;                               // COLOR_STREAM_REQUEST_HEADER
+    uint8_t   flags;                                // The ColorStreamFlags wanted
+    uint8_t   maxFPS;                               // 0 for every frame that's drawn
+    uint8_t   downscale;                            // Each side is divided by this, averaging the pixels; 0 or 1 for full size
+    uint8_t   reserved;
+} ColorStreamRequest;
+
+typedef struct __attribute__((packed))
+{
+    uint32_t  header;                               // COLOR_STREAM_PACKET_HEADER
+    uint32_t  sequence;                             // Counts the frames sent on this connection
+    uint16_t  width;
+    uint16_t  height;
+    uint8_t   flags;                                // How this frame is encoded; only has Delta when it's relative to the last
+    uint8_t   reserved[3];
+    uint32_t  payloadSize;
+} ColorStreamHeader;
+
 // LEDViewer
 //
 // LEDViewer is a class that listens on a TCP port for a connection a client
@@ -154,25 +193,472 @@ public:
             close(new_socket);
             return -1;
         }
+        SetSocketBlockingEnabled(new_socket, false);   // Clients are sent to without waiting, so one can't hold up another
         Serial.println("Accepted new ColorData Client!");
         return new_socket;
     }
+};
+
+// ColorStreamSettings
+//
+// What a client asked for, as far as building its packets goes.  Clients that ask for the same are sent the very
+// same packets, so each frame is only encoded once for all of them.
+
+struct ColorStreamSettings
+{
+    bool      bStreaming  = false;                  // False for the plain ColorDataPacket
+    uint8_t   Flags       = 0;
+    uint8_t   MaxFPS      = 0;
+    uint8_t   Downscale   = 1;
+
+    // The settings a stream request asks for
+    static ColorStreamSettings FromRequest(const ColorStreamRequest & request)
+    {
+        ColorStreamSettings settings;
+        settings.bStreaming = true;
+        settings.Flags      = request.flags;
+        settings.MaxFPS     = request.maxFPS;
+        settings.Downscale  = std::clamp<uint8_t>(request.downscale, 1, 16);
+        return settings;
+    }
+
+    bool operator==(const ColorStreamSettings & other) const
+    {
+        return bStreaming == other.bStreaming && Flags == other.Flags && MaxFPS == other.MaxFPS && Downscale == other.Downscale;
+    }
+};
+
+using ColorPacket = std::vector<uint8_t, psram_allocator<uint8_t>>;
+
+// ColorFrameEncoder
+//
+// Builds the packets for one set of settings.  A delta only means something to a client that got every frame from
+// the same encoder before it, so the encoder decides when a frame is due, and a client that missed one is sent a
+// key frame instead.  Packets are shared with the clients sending them, and reused once they've all let go.
+
+class ColorFrameEncoder
+{
+    static constexpr size_t kPoolSize = COLORDATA_CLIENT_QUEUE_DEPTH * 2 + 2;
+
+    ColorStreamSettings _settings;
+    uint32_t      _sequence     = 0;
+    unsigned long _msLastFrame  = 0;
+
+    std::vector<CRGB, psram_allocator<CRGB>>  _frame;
+    std::vector<CRGB, psram_allocator<CRGB>>  _previous;
+    std::vector<CRGB, psram_allocator<CRGB>>  _delta;
+    std::unique_ptr<Deflater>                 _pDeflater;
+    std::vector<std::shared_ptr<ColorPacket>> _pool;
+
+    std::shared_ptr<const ColorPacket> _pKeyPacket;    // For the current frame, built when first asked for
+    std::shared_ptr<const ColorPacket> _pDeltaPacket;
+    uint16_t _width  = 0;
+    uint16_t _height = 0;
+
+    static void RunLengthEncode(const CRGB * pPixels, size_t count, ColorPacket & out)
+    {
+        for (size_t i = 0; i < count; )
+        {
+            size_t run = 1;
+            while (i + run < count && run < 255 && pPixels[i + run] == pPixels[i])
+                run++;
+
+            out.push_back(run);
+            out.push_back(pPixels[i].r);
+            out.push_back(pPixels[i].g);
+            out.push_back(pPixels[i].b);
+            i += run;
+        }
+    }
+
+    // A packet no client holds any more, or a new one if they're all still on their way out
+    std::shared_ptr<ColorPacket> AcquirePacket()
+    {
+        for (auto& pPacket : _pool)
+            if (pPacket.use_count() == 1)
+                return pPacket;
+
+        auto pPacket = std::make_shared<ColorPacket>();
+        if (_pool.size() < kPoolSize)
+            _pool.push_back(pPacket);
+        return pPacket;
+    }
+
+    // Takes the pixels at the size the client asked for, averaging each block when scaling down.  A side shorter
+    // than the scale is scaled by its length instead, so a strip one pixel high stays one pixel high and no block
+    // reaches past the edge.
+    void CaptureFrame(const GFXBase & gfx)
+    {
+        const int scaleX = std::clamp<int>(_settings.Downscale, 1, gfx.width());
+        const int scaleY = std::clamp<int>(_settings.Downscale, 1, gfx.height());
+        const int blockSize = scaleX * scaleY;
+
+        _width  = gfx.width() / scaleX;
+        _height = gfx.height() / scaleY;
+        _frame.resize(_width * _height);
+
+        for (uint16_t y = 0; y < _height; y++)
+        {
+            for (uint16_t x = 0; x < _width; x++)
+            {
+                int r = 0, g = 0, b = 0;
+                for (int dy = 0; dy < scaleY; dy++)
+                {
+                    for (int dx = 0; dx < scaleX; dx++)
+                    {
+                        const CRGB& pixel = gfx.pixelUnchecked(x * scaleX + dx, y * scaleY + dy);
+                        r += pixel.r;
+                        g += pixel.g;
+                        b += pixel.b;
+                    }
+                }
+                _frame[y * _width + x] = CRGB(r / blockSize, g / blockSize, b / blockSize);
+            }
+        }
+    }
+
+    std::shared_ptr<const ColorPacket> BuildLegacyPacket(const GFXBase & gfx)
+    {
+        auto pPacket = AcquirePacket();
+        pPacket->resize(sizeof(ColorDataPacket));
+
+        auto pData = (ColorDataPacket *) pPacket->data();
+        pData->header = COLOR_DATA_PACKET_HEADER;
+        pData->width  = gfx.width();
+        pData->height = gfx.height();
+        memcpy(pData->colors, gfx.leds, sizeof(CRGB) * NUM_LEDS);
+        return pPacket;
+    }
 
-    bool SendPacket(int socket, void * pData, size_t cbSize)
+    std::shared_ptr<const ColorPacket> BuildStreamPacket(const CRGB * pPixels, bool bDelta)
     {
-        // Send data to the emulator's virtual serial port
+        const size_t count = _frame.size();
+
+        ColorStreamHeader header = {};
+        header.header   = COLOR_STREAM_PACKET_HEADER;
+        header.sequence = _sequence;
+        header.width    = _width;
+        header.height   = _height;
 
-        const byte * pb = (byte *)pData;
-        debugV("Sending Packet:  %02X, %02X, %02X, %02X, %02X, %02X, %02X, %02X, %02X, %02X, %02X, %02X,...",
-                                pb[0], pb[1], pb[2], pb[3], pb[4], pb[5], pb[6], pb[7], pb[8], pb[9], pb[10], pb[11]);
+        auto pPacket = AcquirePacket();
+        pPacket->resize(sizeof(header));
 
-        if (cbSize != write(socket, pData, cbSize))
+        if (_settings.Flags & ColorStreamDeflate)
         {
-            debugW("Could not write to color data socket\n");
+            _pDeflater->Deflate((const uint8_t *) pPixels, count * sizeof(CRGB), *pPacket);
+            header.flags = ColorStreamDeflate;
+        }
+        else if (_settings.Flags & ColorStreamRLE)
+        {
+            RunLengthEncode(pPixels, count, *pPacket);
+            header.flags = ColorStreamRLE;
+        }
+        else
+        {
+            pPacket->insert(pPacket->end(), (const uint8_t *) pPixels, (const uint8_t *) (pPixels + count));
+        }
+
+        if (bDelta)
+            header.flags |= ColorStreamDelta;
+        header.payloadSize = pPacket->size() - sizeof(header);
+        memcpy(pPacket->data(), &header, sizeof(header));
+        return pPacket;
+    }
+
+  public:
+
+    explicit ColorFrameEncoder(const ColorStreamSettings & settings) : _settings(settings)
+    {
+        if (_settings.Flags & ColorStreamDeflate)
+            _pDeflater = std::make_unique<Deflater>();
+    }
+
+    const ColorStreamSettings & Settings() const
+    {
+        return _settings;
+    }
+
+    bool UsesDeltas() const
+    {
+        return _settings.bStreaming && (_settings.Flags & ColorStreamDelta);
+    }
+
+    // NextFrame
+    //
+    // Takes the frame that was just drawn, if one is due at the rate the clients asked for.  Returns false if not,
+    // in which case its clients skip this one.
+
+    bool NextFrame(const GFXBase & gfx)
+    {
+        if (_settings.MaxFPS && millis() - _msLastFrame < 1000 / _settings.MaxFPS)
             return false;
+        _msLastFrame = millis();
+
+        _pKeyPacket.reset();
+        _pDeltaPacket.reset();
+
+        if (!_settings.bStreaming)
+        {
+            _pKeyPacket = BuildLegacyPacket(gfx);
+            return true;
         }
+
+        _previous.swap(_frame);                     // What went out last time is what a delta goes against
+        _sequence++;
+        CaptureFrame(gfx);
         return true;
     }
+
+    // The current frame, whole or as a delta.  A delta is the XOR with the frame before, so whatever didn't change
+    // comes out as zeroes that pack down well.
+
+    std::shared_ptr<const ColorPacket> Packet(bool bDelta)
+    {
+        bDelta = bDelta && UsesDeltas() && _previous.size() == _frame.size();
+
+        if (!bDelta)
+        {
+            if (!_pKeyPacket)
+                _pKeyPacket = BuildStreamPacket(_frame.data(), false);
+            return _pKeyPacket;
+        }
+
+        if (!_pDeltaPacket)
+        {
+            _delta.resize(_frame.size());
+            for (size_t i = 0; i < _frame.size(); i++)
+                _delta[i] = CRGB(_frame[i].r ^ _previous[i].r, _frame[i].g ^ _previous[i].g, _frame[i].b ^ _previous[i].b);
+            _pDeltaPacket = BuildStreamPacket(_delta.data(), true);
+        }
+        return _pDeltaPacket;
+    }
 };
 
+// ColorEncoderSet
+//
+// One encoder for each distinct set of settings the clients asked for, so each frame is encoded once for all the
+// clients that want it in that form, however they're connected
+
+class ColorEncoderSet
+{
+    std::vector<std::shared_ptr<ColorFrameEncoder>> _encoders;
 
+  public:
+
+    std::shared_ptr<ColorFrameEncoder> EncoderFor(const ColorStreamSettings & settings)
+    {
+        for (auto& pEncoder : _encoders)
+            if (pEncoder->Settings() == settings)
+                return pEncoder;
+
+        return _encoders.emplace_back(std::make_shared<ColorFrameEncoder>(settings));
+    }
+
+    // Lets go of the encoders only the set holds on to, which have no clients left
+    void Prune()
+    {
+        _encoders.erase(std::remove_if(_encoders.begin(), _encoders.end(), [](auto& pEncoder) { return pEncoder.use_count() == 1; }),
+                        _encoders.end());
+    }
+
+    auto begin() { return _encoders.begin(); }
+    auto end()   { return _encoders.end(); }
+};
+
+// ColorDataClient
+//
+// One viewer's connection.  Packets wait in a short queue and go out as fast as the socket takes them without ever
+// blocking.  When the queue is full the oldest are dropped, and a client that gets deltas is sent a key frame next.
+
+class ColorDataClient
+{
+    int _socket;
+    ColorStreamSettings _settings;
+
+    ColorStreamRequest _request;                    // Requests can come in over more than one read
+    size_t             _cbRequest = 0;
+
+    std::deque<std::shared_ptr<const ColorPacket>> _queue;
+    size_t _cbSent = 0;                             // Of the packet at the front, which has to go out whole once begun
+
+  public:
+
+    std::shared_ptr<ColorFrameEncoder> pEncoder;
+    bool bNeedsKeyFrame = true;
+
+    explicit ColorDataClient(int socket) : _socket(socket)
+    {
+    }
+
+    ~ColorDataClient()
+    {
+        close(_socket);
+    }
+
+    ColorDataClient(const ColorDataClient &) = delete;
+    ColorDataClient & operator=(const ColorDataClient &) = delete;
+
+    const ColorStreamSettings & Settings() const
+    {
+        return _settings;
+    }
+
+    // ReadRequest
+    //
+    // Picks up a stream request if the client sent one, without waiting for it.  Returns false if the connection
+    // was closed.  Anything that isn't a request is skipped, up to where one might start.
+
+    bool ReadRequest()
+    {
+        auto cbRead = recv(_socket, (uint8_t *) &_request + _cbRequest, sizeof(_request) - _cbRequest, MSG_DONTWAIT);
+        if (cbRead == 0)
+            return false;
+        if (cbRead < 0)
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+
+        _cbRequest += cbRead;
+        if (_cbRequest < sizeof(_request))
+            return true;
+        _cbRequest = 0;
+
+        if (_request.header != COLOR_STREAM_REQUEST_HEADER)
+        {
+            // Keep from the first byte on that could begin a header, so a request after the junk is still found
+
+            const uint32_t header = COLOR_STREAM_REQUEST_HEADER;
+            auto pBytes = (uint8_t *) &_request;
+            size_t skip = 1;
+            while (skip < sizeof(_request) && memcmp(pBytes + skip, &header, std::min(sizeof(header), sizeof(_request) - skip)))
+                skip++;
+
+            memmove(pBytes, pBytes + skip, sizeof(_request) - skip);
+            _cbRequest = sizeof(_request) - skip;
+            debugV("Skipped %zu unexpected bytes on color data socket", skip);
+            return true;
+        }
+
+        _settings = ColorStreamSettings::FromRequest(_request);
+
+        pEncoder.reset();                           // So it's matched up with an encoder for the new settings
+        bNeedsKeyFrame = true;
+
+        debugI("Color data client asked for flags %02X, %u fps, downscale %u", _settings.Flags, _settings.MaxFPS, _settings.Downscale);
+        return true;
+    }
+
+    void Enqueue(std::shared_ptr<const ColorPacket> pPacket, bool bDelta)
+    {
+        if (_queue.size() >= COLORDATA_CLIENT_QUEUE_DEPTH)
+        {
+            // Drop the oldest, but never one that's partly out already.  Any deltas after a dropped packet are no
+            // good to the client either, so those go too, and it gets a key frame next.
+
+            size_t keep = _cbSent > 0 ? 1 : 0;
+            bool bDeltas = pEncoder && pEncoder->UsesDeltas();
+
+            if (_queue.size() > keep)
+                _queue.erase(_queue.begin() + keep, bDeltas ? _queue.end() : _queue.begin() + keep + 1);
+
+            if (bDeltas)
+                bNeedsKeyFrame = true;
+            if (_queue.size() >= COLORDATA_CLIENT_QUEUE_DEPTH || (bDeltas && bDelta))
+                return;
+        }
+
+        _queue.push_back(std::move(pPacket));
+        if (!bDelta)
+            bNeedsKeyFrame = false;
+    }
+
+    // Pump
+    //
+    // Sends as much of the queue as the socket will take right now.  Returns false if the connection failed.
+
+    bool Pump()
+    {
+        while (!_queue.empty())
+        {
+            auto& packet = *_queue.front();
+            auto cbWritten = send(_socket, packet.data() + _cbSent, packet.size() - _cbSent, MSG_DONTWAIT);
+            if (cbWritten < 0)
+                return errno == EAGAIN || errno == EWOULDBLOCK;
+
+            _cbSent += cbWritten;
+            if (_cbSent < packet.size())
+                return true;
+
+            _queue.pop_front();
+            _cbSent = 0;
+        }
+        return true;
+    }
+};
+
+// ColorDataFanOut
+//
+// All the viewers connected to the color data server.  Each frame is encoded once per distinct set of settings, and
+// handed to every client that wants it in that form.  Nothing here blocks, so a slow viewer only ever holds up itself.
+
+class ColorDataFanOut
+{
+    std::vector<std::unique_ptr<ColorDataClient>> _clients;
+    ColorEncoderSet                               _encoders;
+
+  public:
+
+    bool HasClients() const
+    {
+        return !_clients.empty();
+    }
+
+    void AcceptClients(LEDViewer & viewer)
+    {
+        while (_clients.size() < COLORDATA_MAX_CLIENTS)
+        {
+            int socket = viewer.CheckForConnection();
+            if (socket < 0)
+                break;
+
+            _clients.push_back(std::make_unique<ColorDataClient>(socket));
+        }
+    }
+
+    // Reads what the clients sent and sends them what's queued, and lets go of the ones whose connection failed
+    void Service()
+    {
+        auto failed = std::remove_if(_clients.begin(), _clients.end(), [](auto& pClient)
+        {
+            return !pClient->ReadRequest() || !pClient->Pump();
+        });
+        if (failed != _clients.end())
+        {
+            debugW("Closing %d color data connection(s)", (int)(_clients.end() - failed));
+            _clients.erase(failed, _clients.end());
+        }
+
+        _encoders.Prune();
+    }
+
+    // Encodes the frame that was just drawn for whichever clients are due one, and queues it for them
+    void SendFrame(const GFXBase & gfx)
+    {
+        for (auto& pClient : _clients)
+            if (!pClient->pEncoder)
+                pClient->pEncoder = _encoders.EncoderFor(pClient->Settings());
+
+        for (auto& pEncoder : _encoders)
+        {
+            if (!pEncoder->NextFrame(gfx))
+                continue;
+
+            for (auto& pClient : _clients)
+            {
+                if (pClient->pEncoder != pEncoder)
+                    continue;
+
+                bool bDelta = !pClient->bNeedsKeyFrame && pEncoder->UsesDeltas();
+                pClient->Enqueue(pEncoder->Packet(bDelta), bDelta);
+            }
+        }
+    }
+};
@@ -0,0 +1,186 @@
+//+--------------------------------------------------------------------------
+//
+// File:        lowresfield.h
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+//
+// Description:
+//
+//    A canvas smaller than the matrix for the effects that draw smooth
+//    fields, like noise, plasma and metaballs, where working out every
+//    pixel costs a lot and shows little the neighbours didn't.  The effect
+//    draws its field a fraction of the size each way, and it's scaled up
+//    to the matrix with a bilinear filter in fixed point, which takes a
+//    few adds and shifts a pixel instead of the effect's own math.
+//
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include "globals.h"
+#include "effectmemory.h"
+#include "gfxbase.h"
+
+// LowResField
+//
+// Field pixels are kept row by row.  Each one stands for the middle of a Scale() by Scale() block of the matrix, and
+// MatrixX() and MatrixY() say where that is, so an effect can work out its field in matrix coordinates and look the
+// same at any scale.  Which two field pixels each matrix column and row falls between, and how far along, is worked
+// out once when the field is allocated, so the upscale is only lookups and lerps.
+
+class LowResField
+{
+    effect_unique_array<CRGB>     _pixels;
+    effect_unique_array<uint16_t> _sourceX;         // For each matrix column, the field column at or before its middle
+    effect_unique_array<uint8_t>  _weightX;         // And how far its middle is towards the next one, out of 256
+    effect_unique_array<uint16_t> _sourceY;
+    effect_unique_array<uint8_t>  _weightY;
+
+    uint16_t _width        = 0;
+    uint16_t _height       = 0;
+    uint16_t _matrixWidth  = 0;
+    uint16_t _matrixHeight = 0;
+    uint8_t  _scale        = 1;
+
+    static void BuildTaps(uint16_t matrixSize, uint16_t fieldSize, uint8_t scale, uint16_t * pSource, uint8_t * pWeight)
+    {
+        for (uint16_t i = 0; i < matrixSize; i++)
+        {
+            // Where matrix pixel i is in field pixels, in 8.8, going by where MatrixX() and MatrixY() worked each
+            // field pixel out.  Before the first of those or after the last there's nothing to lerp towards.
+
+            int32_t position = ((i - scale / 2) * 256) / scale;
+            position = std::clamp<int32_t>(position, 0, (fieldSize - 1) * 256);
+
+            pSource[i] = position >> 8;
+            pWeight[i] = position & 0xFF;
+        }
+    }
+
+    static inline uint8_t Lerp(uint8_t a, uint8_t b, uint8_t weight)
+    {
+        return a + (((b - a) * weight) >> 8);
+    }
+
+    static inline CRGB Lerp(const CRGB & a, const CRGB & b, uint8_t weight)
+    {
+        return CRGB(Lerp(a.r, b.r, weight), Lerp(a.g, b.g, weight), Lerp(a.b, b.b, weight));
+    }
+
+  public:
+
+    // Allocate
+    //
+    // Sizes the field for a matrix, returning false if there wasn't the memory for it
+
+    bool Allocate(uint16_t matrixWidth, uint16_t matrixHeight, uint8_t scale)
+    {
+        _scale        = std::max<uint8_t>(scale, 1);
+        _matrixWidth  = matrixWidth;
+        _matrixHeight = matrixHeight;
+        _width        = (matrixWidth + _scale - 1) / _scale;
+        _height       = (matrixHeight + _scale - 1) / _scale;
+
+        _pixels  = make_unique_effect_array<CRGB>(_width * _height);
+        _sourceX = make_unique_effect_array<uint16_t>(_matrixWidth);
+        _weightX = make_unique_effect_array<uint8_t>(_matrixWidth);
+        _sourceY = make_unique_effect_array<uint16_t>(_matrixHeight);
+        _weightY = make_unique_effect_array<uint8_t>(_matrixHeight);
+
+        if (!_pixels || !_sourceX || !_weightX || !_sourceY || !_weightY)
+        {
+            Release();
+            return false;
+        }
+
+        Clear();
+        BuildTaps(_matrixWidth, _width, _scale, _sourceX.get(), _weightX.get());
+        BuildTaps(_matrixHeight, _height, _scale, _sourceY.get(), _weightY.get());
+        return true;
+    }
+
+    void Release()
+    {
+        _pixels.reset();
+        _sourceX.reset();
+        _weightX.reset();
+        _sourceY.reset();
+        _weightY.reset();
+        _width = _height = 0;
+    }
+
+    bool IsAllocated() const
+    {
+        return _pixels != nullptr;
+    }
+
+    uint16_t Width() const  { return _width; }
+    uint16_t Height() const { return _height; }
+    uint8_t  Scale() const  { return _scale; }
+
+    // Where on the matrix the middle of field pixel x or y is
+    uint16_t MatrixX(uint16_t x) const { return std::min<uint16_t>(x * _scale + _scale / 2, _matrixWidth - 1); }
+    uint16_t MatrixY(uint16_t y) const { return std::min<uint16_t>(y * _scale + _scale / 2, _matrixHeight - 1); }
+
+    CRGB & At(uint16_t x, uint16_t y)
+    {
+        return _pixels[y * _width + x];
+    }
+
+    void Clear()
+    {
+        std::fill(_pixels.get(), _pixels.get() + _width * _height, CRGB::Black);
+    }
+
+    // UpscaleTo
+    //
+    // Fills every pixel of the matrix from the field
+
+    void UpscaleTo(GFXBase & gfx) const
+    {
+        if (!IsAllocated())
+            return;
+
+        if (_scale == 1)
+        {
+            for (uint16_t y = 0; y < _matrixHeight; y++)
+                for (uint16_t x = 0; x < _matrixWidth; x++)
+                    gfx.pixelUnchecked(x, y) = _pixels[y * _width + x];
+            return;
+        }
+
+        for (uint16_t y = 0; y < _matrixHeight; y++)
+        {
+            const CRGB * pTop    = &_pixels[_sourceY[y] * _width];
+            const CRGB * pBottom = _sourceY[y] + 1 < _height ? pTop + _width : pTop;
+            const uint8_t weightY = _weightY[y];
+
+            for (uint16_t x = 0; x < _matrixWidth; x++)
+            {
+                const uint16_t left  = _sourceX[x];
+                const uint16_t right = left + 1 < _width ? left + 1 : left;
+                const uint8_t weightX = _weightX[x];
+
+                gfx.pixelUnchecked(x, y) = Lerp(Lerp(pTop[left], pTop[right], weightX),
+                                                Lerp(pBottom[left], pBottom[right], weightX), weightY);
+            }
+        }
+    }
+};
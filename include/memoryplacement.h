@@ -0,0 +1,145 @@
+//+--------------------------------------------------------------------------
+//
+// File:        memoryplacement.h
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+// Description:
+//
+//    Puts the buffers on the hot paths in internal RAM and the rest in
+//    PSRAM, as far as the build allows, and keeps a note of where each
+//    one ended up
+//
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstring>
+#include <mutex>
+#include <vector>
+#include <esp_heap_caps.h>
+#include <soc/soc_memory_layout.h>
+#include "globals.h"
+
+// Placement
+//
+// Hot buffers are gone through every frame, packet or audio window, at random or in more than one pass, and run
+// several times faster from internal RAM.  Cold ones are big, or only streamed through once, and leave the
+// internal RAM to the hot ones.  Internal ones are small tables that a hot loop can't afford to read from PSRAM at
+// all, so they get internal RAM or nothing.
+
+enum class Placement : uint8_t
+{
+    Hot,
+    Cold,
+    Internal
+};
+
+// MemoryPlacementReport
+//
+// The buffers that went through PlacedAlloc, what they asked for and where they landed.  A buffer that's allocated
+// again under the same name, as the socket buffers are on every reconnect, replaces its entry.  Nothing here needs
+// a constructor to run, so the globals that allocate while they're being constructed can be recorded too.
+
+class MemoryPlacementReport
+{
+  public:
+
+    struct Entry
+    {
+        const char * Name;
+        size_t       Bytes;
+        Placement    Wanted;
+        bool         bInternal;
+    };
+
+    static constexpr size_t kMaxEntries = 32;
+
+  private:
+
+    mutable std::mutex  _mutex;
+    Entry               _entries[kMaxEntries] = {};
+    size_t              _cEntries = 0;
+
+  public:
+
+    void Record(const char * name, void * p, size_t bytes, Placement wanted)
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+
+        size_t index = 0;
+        while (index < _cEntries && strcmp(_entries[index].Name, name) != 0)
+            index++;
+
+        if (index == kMaxEntries)
+            return;
+
+        _entries[index] = { name, bytes, wanted, !esp_ptr_external_ram(p) };
+        _cEntries = std::max(_cEntries, index + 1);
+    }
+
+    // The entries as they are now, for the report
+    std::vector<Entry> Entries() const
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        return std::vector<Entry>(_entries, _entries + _cEntries);
+    }
+};
+
+extern MemoryPlacementReport g_MemoryPlacement;
+
+// PlacedAlloc
+//
+// Allocates a buffer for the given placement, and returns nullptr if there's no room for it anywhere.  With
+// HOT_MEMORY_INTERNAL, hot buffers go to internal RAM for as long as that leaves PLACEMENT_INTERNAL_RESERVE of it
+// free, and to PSRAM after that.  Cold buffers go to PSRAM when there is any.  Internal buffers go to internal
+// RAM whatever the setting and reserve, and are nullptr rather than PSRAM when it's full.  Free any with free().
+
+inline void * PlacedAlloc(size_t bytes, Placement placement, const char * name)
+{
+    void * p = nullptr;
+    constexpr uint32_t kInternal = MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT;
+
+    if (placement == Placement::Internal)
+    {
+        p = heap_caps_malloc(bytes, kInternal);
+        if (p)
+            g_MemoryPlacement.Record(name, p, bytes, placement);
+        return p;
+    }
+
+    #if HOT_MEMORY_INTERNAL
+        if (placement == Placement::Hot && heap_caps_get_free_size(kInternal) >= bytes + PLACEMENT_INTERNAL_RESERVE)
+            p = heap_caps_malloc(bytes, kInternal);
+    #endif
+
+    if (!p)
+        p = psramInit() ? ps_malloc(bytes) : malloc(bytes);
+    if (!p)
+        p = malloc(bytes);
+
+    if (p)
+        g_MemoryPlacement.Record(name, p, bytes, placement);
+    return p;
+}
+
+template <typename T>
+T * PlacedAlloc(size_t count, Placement placement, const char * name)
+{
+    return static_cast<T *>(PlacedAlloc(count * sizeof(T), placement, name));
+}
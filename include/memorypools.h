@@ -0,0 +1,238 @@
+//+--------------------------------------------------------------------------
+//
+// File:        memorypools.h
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+// Description:
+//
+//    Blocks set aside at boot for the big allocations that come and go,
+//    and a watch on how broken up the heap gets over days of uptime
+//
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <Arduino.h>
+#include "globals.h"
+#include "types.h"
+
+// MemoryPool
+//
+// A fixed number of same size blocks, taken in one piece before anything else has had a chance to break up the
+// heap.  Requests that fit in a block and find one free get it; the rest go to the heap as they did before, and
+// are counted as misses so the pool can be sized from /statistics.  Blocks are claimed and given back with a
+// compare-and-swap on a bit mask, so any task can use the pool.
+
+class MemoryPool
+{
+    static constexpr size_t kMaxBlocks = 32;
+
+    const char *          _name;
+    size_t                _blockSize;
+    size_t                _cBlocks;
+    uint8_t *             _pBlocks  = nullptr;
+    std::atomic<uint32_t> _inUse    { 0 };
+    std::atomic<size_t>   _peak     { 0 };
+    std::atomic<uint32_t> _hits     { 0 };
+    std::atomic<uint32_t> _misses   { 0 };
+
+  public:
+
+    MemoryPool(const char * name, size_t blockSize, size_t cBlocks)
+        : _name(name),
+          _blockSize((blockSize + 3) & ~3),
+          _cBlocks(std::min(cBlocks, kMaxBlocks))
+    {
+    }
+
+    ~MemoryPool()
+    {
+        free(_pBlocks);
+    }
+
+    MemoryPool(const MemoryPool &) = delete;
+    MemoryPool & operator=(const MemoryPool &) = delete;
+
+    // Reserve
+    //
+    // Takes the blocks.  Called once, early in setup(); until then every request is a miss.
+
+    bool Reserve()
+    {
+        if (_pBlocks || _cBlocks == 0)
+            return true;
+
+        _pBlocks = (uint8_t *) PreferPSRAMAlloc(_blockSize * _cBlocks);
+        if (!_pBlocks)
+        {
+            debugW("Could not reserve %zu blocks of %zu bytes for the %s pool", _cBlocks, _blockSize, _name);
+            _cBlocks = 0;
+            return false;
+        }
+        return true;
+    }
+
+    // A free block if the request fits in one, or nullptr
+    void * Allocate(size_t bytes)
+    {
+        if (_pBlocks && bytes <= _blockSize)
+        {
+            uint32_t inUse = _inUse;
+            const uint32_t all = _cBlocks == 32 ? UINT32_MAX : (1u << _cBlocks) - 1;
+
+            while (inUse != all)
+            {
+                uint32_t bit = ~inUse & (inUse + 1);            // Lowest free block
+                if (_inUse.compare_exchange_weak(inUse, inUse | bit))
+                {
+                    size_t cInUse = __builtin_popcount(inUse | bit);
+                    for (size_t peak = _peak; cInUse > peak && !_peak.compare_exchange_weak(peak, cInUse); )
+                        ;
+                    _hits++;
+                    return _pBlocks + __builtin_ctz(bit) * _blockSize;
+                }
+            }
+        }
+
+        _misses++;
+        return nullptr;
+    }
+
+    bool Owns(const void * p) const
+    {
+        return _pBlocks && p >= _pBlocks && p < _pBlocks + _blockSize * _cBlocks;
+    }
+
+    // Gives the block back, or returns false if it didn't come from this pool
+    bool Free(void * p)
+    {
+        if (!Owns(p))
+            return false;
+
+        _inUse &= ~(1u << (((uint8_t *) p - _pBlocks) / _blockSize));
+        return true;
+    }
+
+    const char * Name() const       { return _name; }
+    size_t BlockSize() const        { return _blockSize; }
+    size_t BlockCount() const       { return _cBlocks; }
+    size_t InUse() const            { return __builtin_popcount(_inUse.load()); }
+    size_t PeakInUse() const        { return _peak; }
+    uint32_t Hits() const           { return _hits; }
+    uint32_t Misses() const         { return _misses; }
+};
+
+// The pool JSON documents are allocated from
+extern MemoryPool g_JsonPool;
+
+// HeapMonitor
+//
+// Sampled every few seconds from loop().  Keeps the largest free block of the internal heap, the lowest it's been,
+// and a point every HEAP_TREND_INTERVAL for the last day or so, so a heap that's slowly breaking up shows as a
+// falling trend well before the large allocations start failing.
+
+class HeapMonitor
+{
+    static constexpr size_t kTrendPoints = 24;
+
+    mutable std::mutex _mutex;
+    uint32_t      _trend[kTrendPoints]  = {};
+    size_t        _cTrendPoints         = 0;
+    size_t        _iNextPoint           = 0;
+    unsigned long _msLastPoint          = 0;
+    uint32_t      _freeHeap             = 0;
+    uint32_t      _largestBlock         = 0;
+    uint32_t      _lowestLargestBlock   = UINT32_MAX;
+    bool          _bWarned              = false;
+
+  public:
+
+    void Sample()
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+
+        _freeHeap           = ESP.getFreeHeap();
+        _largestBlock       = ESP.getMaxAllocHeap();
+        _lowestLargestBlock = std::min(_lowestLargestBlock, _largestBlock);
+
+        if (_cTrendPoints == 0 || millis() - _msLastPoint >= HEAP_TREND_INTERVAL)
+        {
+            _trend[_iNextPoint] = _largestBlock;
+            _iNextPoint = (_iNextPoint + 1) % kTrendPoints;
+            _cTrendPoints = std::min(_cTrendPoints + 1, kTrendPoints);
+            _msLastPoint = millis();
+        }
+
+        // Say so once when the largest block gets low, and again only after it's recovered
+
+        if (!_bWarned && _largestBlock < HEAP_LOW_BLOCK_WARNING)
+            debugW("Largest free heap block is down to %u bytes of %u free", _largestBlock, _freeHeap);
+        _bWarned = _largestBlock < HEAP_LOW_BLOCK_WARNING;
+    }
+
+    uint32_t LargestBlock() const
+    {
+        return _largestBlock;
+    }
+
+    uint32_t LowestLargestBlock() const
+    {
+        return _lowestLargestBlock == UINT32_MAX ? 0 : _lowestLargestBlock;
+    }
+
+    // How much of the free heap can't be had in one piece
+    int FragmentationPercent() const
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        return _freeHeap ? 100 - (int)(100ull * _largestBlock / _freeHeap) : 0;
+    }
+
+    // TrendBytesPerHour
+    //
+    // The slope of a least squares line through the trend points, or 0 until there are enough of them to mean much
+
+    float TrendBytesPerHour() const
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+
+        if (_cTrendPoints < 3)
+            return 0.0f;
+
+        // Oldest point first, at x = 0
+
+        size_t iFirst = _cTrendPoints < kTrendPoints ? 0 : _iNextPoint;
+        double n = _cTrendPoints, sumX = 0, sumY = 0, sumXY = 0, sumXX = 0;
+
+        for (size_t i = 0; i < _cTrendPoints; i++)
+        {
+            double y = _trend[(iFirst + i) % kTrendPoints];
+            sumX  += i;
+            sumY  += y;
+            sumXY += i * y;
+            sumXX += (double) i * i;
+        }
+
+        double slopePerPoint = (n * sumXY - sumX * sumY) / (n * sumXX - sumX * sumX);
+        return slopePerPoint * (3600000.0 / HEAP_TREND_INTERVAL);
+    }
+};
+
+extern HeapMonitor g_HeapMonitor;
@@ -0,0 +1,178 @@
+//+--------------------------------------------------------------------------
+//
+// File:        metrics.h
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+//
+// Description:
+//
+//    Counters, gauges and histograms for monitoring a fleet of nodes,
+//    served as Prometheus text at /metrics and optionally pushed to a
+//    StatsD server over UDP
+//
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <esp_timer.h>
+#include "globals.h"
+
+// The durations we keep histograms of.  The counters and gauges are the ones the subsystems already keep, like the
+// ingest counts and the frame rate, and are read as the metrics are written out, so nothing is counted twice.
+
+enum class MetricHistogram : uint8_t
+{
+    Frame,              // A frame from the start of drawing it to sent out
+    Decode,             // Expanding and parsing a packet that came in over the wire
+    FFT,                // One pass of the audio FFT
+    Count
+};
+
+#if ENABLE_METRICS
+
+// FixedHistogram
+//
+// Counts of microsecond durations in fixed buckets, which are what Prometheus histograms are made of, so a scraper
+// can add them up across nodes.  Everything is a relaxed atomic, so any task can observe without a lock.  The sum is
+// 64 bits of microseconds, as 32 would wrap after 71 minutes of drawing and read as a reset to a Prometheus rate().
+
+class FixedHistogram
+{
+  public:
+
+    static constexpr uint32_t kBounds[] = { 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000 };
+    static constexpr size_t   kBuckets  = sizeof(kBounds) / sizeof(kBounds[0]) + 1;     // The last is everything longer
+
+  private:
+
+    std::atomic<uint32_t> _buckets[kBuckets] = {};
+    std::atomic<uint32_t> _count { 0 };
+    std::atomic<uint64_t> _sum   { 0 };
+
+  public:
+
+    void Observe(uint32_t us)
+    {
+        size_t bucket = 0;
+        while (bucket < kBuckets - 1 && us > kBounds[bucket])
+            bucket++;
+
+        _buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+        _count.fetch_add(1, std::memory_order_relaxed);
+        _sum.fetch_add(us, std::memory_order_relaxed);
+    }
+
+    uint32_t Bucket(size_t bucket) const { return _buckets[bucket].load(std::memory_order_relaxed); }
+    uint32_t Count() const               { return _count.load(std::memory_order_relaxed); }
+    uint64_t Sum() const                 { return _sum.load(std::memory_order_relaxed); }
+};
+
+// Metrics
+//
+// Holds the histograms, and is constant initialized so they can be observed from the first line of setup() on
+
+class Metrics
+{
+    FixedHistogram _histograms[(size_t) MetricHistogram::Count];
+
+  public:
+
+    static const char * Name(MetricHistogram histogram)
+    {
+        static const char * const names[] = { "frame", "decode", "fft" };
+        static_assert(sizeof(names) / sizeof(names[0]) == (size_t) MetricHistogram::Count, "Every histogram needs a name");
+        return names[(size_t) histogram];
+    }
+
+    static const char * Help(MetricHistogram histogram)
+    {
+        static const char * const help[] =
+        {
+            "Time from starting a frame to sending it out",
+            "Time spent expanding and parsing a frame packet",
+            "Time taken by one pass of the audio FFT"
+        };
+        static_assert(sizeof(help) / sizeof(help[0]) == (size_t) MetricHistogram::Count, "Every histogram needs help text");
+        return help[(size_t) histogram];
+    }
+
+    void Observe(MetricHistogram histogram, uint32_t us)
+    {
+        _histograms[(size_t) histogram].Observe(us);
+    }
+
+    const FixedHistogram & Histogram(MetricHistogram histogram) const
+    {
+        return _histograms[(size_t) histogram];
+    }
+};
+
+extern Metrics g_Metrics;
+
+// MetricTimer
+//
+// Observes the time from its construction to the end of the enclosing scope
+
+class MetricTimer
+{
+    MetricHistogram _histogram;
+    int64_t         _usStart;
+
+  public:
+
+    explicit MetricTimer(MetricHistogram histogram) : _histogram(histogram), _usStart(esp_timer_get_time())
+    {
+    }
+
+    ~MetricTimer()
+    {
+        g_Metrics.Observe(_histogram, (uint32_t)(esp_timer_get_time() - _usStart));
+    }
+};
+
+#define METRIC_TIMER_NAME2(line) _metricTimer##line
+#define METRIC_TIMER_NAME(line)  METRIC_TIMER_NAME2(line)
+#define TIME_METRIC(histogram)   MetricTimer METRIC_TIMER_NAME(__LINE__)(MetricHistogram::histogram)
+#define OBSERVE_METRIC(histogram, us) g_Metrics.Observe(MetricHistogram::histogram, us)
+
+// WritePrometheusMetrics
+//
+// Writes every metric in the Prometheus text format, for the /metrics endpoint
+
+void WritePrometheusMetrics(Print & out);
+
+#if ENABLE_METRICS_STATSD
+
+// PushStatsDMetrics
+//
+// Sends the gauges, and what the counters and histograms gained since the last push, to STATSD_HOST.  Registered
+// as a network reader to run every STATSD_INTERVAL.
+
+void PushStatsDMetrics();
+
+#endif
+
+#else
+
+#define TIME_METRIC(histogram)
+#define OBSERVE_METRIC(histogram, us)
+
+#endif
@@ -27,6 +27,8 @@
 //---------------------------------------------------------------------------
 #pragma once
 
+#include <deque>
+#include <mutex>
 #include "types.h"
 
 #if INCOMING_WIFI_ENABLED
@@ -41,6 +43,12 @@
     {
       ColorServer  = 12000,
       IncomingWiFi  = 49152,
+      IncomingUDP   = 49153,
+      ClockSync     = 49154,
+      EffectSync    = 49155,
+      SACN          = 5568,
+      ArtNet        = 6454,
+      DDP           = 4048,
       VICESocketServer = 25232,
       Webserver  = 80
     };
@@ -57,7 +65,19 @@
 
     WiFiConnectResult ConnectToWiFi(const String& ssid, const String& password);
     WiFiConnectResult ConnectToWiFi(const String* ssid, const String* password);
+    unsigned long WiFiRetryDueMs();
+
+    // Whether WiFi is up, as last reported by its events, and a wait until it is.  The wait returns false if it
+    // timed out first.
+    bool IsWiFiConnected();
+    bool WaitForWiFi(TickType_t ticksToWait = portMAX_DELAY);
+
+    // The DeviceConfig radio profile in effect on the current connection, or -1 if there is none
+    int GetAppliedRadioProfile();
     void UpdateNTPTime();
+
+    // Refreshes the mDNS TXT records that change while we run
+    void UpdateMDNSRecords();
     void SetupOTA(const String & strHostname);
     bool ReadWiFiConfig(String& WiFi_ssid, String& WiFi_password);
     bool WriteWiFiConfig(const String& WiFi_ssid, const String& WiFi_password);
@@ -127,11 +147,16 @@
     // Allows functions to be registered that are called at regular intervals and/or on request, in the
     // background. As the name of the class implies, this is intended to be used to execute network
     // requests, like for effects that require data from RESTful APIs.
+    //
+    // The network task keeps the reads that are coming up in a heap ordered by when they're due, and
+    // hands each one to a small pool of worker tasks on NETREADER_CORE when its time comes.  A slow
+    // request then only holds up its own worker, not WiFi reconnects, OTA or the other readers.
 
     class NetworkReader
     {
-      // We allow the main network task entry point function to access private members
+      // We allow the main network task entry point function and the workers to access private members
       friend void IRAM_ATTR NetworkHandlingLoopEntry(void *);
+      friend void IRAM_ATTR NetworkReaderTaskEntry(void *);
 
     private:
 
@@ -143,38 +168,74 @@
           std::atomic_ulong lastReadMs;
           std::atomic_bool flag = false;
           std::atomic_bool canceled = false;
+          unsigned long timeoutMs;
 
-          ReaderEntry(std::function<void()> reader, unsigned long interval) :
-              reader(reader),
-              readInterval(interval)
-          {}
+          // These are only touched with the mutex held
+          bool scheduled = false;                   // Has a read in the heap, due at dueMs
+          unsigned long dueMs = 0;
+          bool running = false;                     // With a worker, since startedMs
+          unsigned long startedMs = 0;
 
-          ReaderEntry(std::function<void()> reader, unsigned long interval, unsigned long lastReadMs, bool flag, bool canceled) :
+          ReaderEntry(std::function<void()> reader, unsigned long interval, unsigned long timeoutMs) :
               reader(reader),
               readInterval(interval),
-              lastReadMs(lastReadMs),
-              flag(flag),
-              canceled(canceled)
+              timeoutMs(timeoutMs)
           {}
+      };
 
-          ReaderEntry(ReaderEntry&& entry) : ReaderEntry(entry.reader, entry.readInterval, entry.lastReadMs, entry.flag, entry.canceled)
-          {}
+      // A read, or a check that one finished in time, coming up in the schedule
+      struct ScheduledRead
+      {
+          unsigned long dueMs;
+          size_t index;
+          bool bTimeoutCheck;
       };
 
-      std::vector<ReaderEntry, psram_allocator<ReaderEntry>> readers;
+      // Orders the heap soonest first, in a way that holds up when millis() wraps
+      static bool LaterThan(const ScheduledRead & a, const ScheduledRead & b)
+      {
+          return (long)(a.dueMs - b.dueMs) > 0;
+      }
+
+      // A deque, so the entries the workers are using stay put when more are added
+      std::deque<ReaderEntry, psram_allocator<ReaderEntry>> readers;
+      std::vector<ScheduledRead> schedule;
+      std::mutex readerMutex;
+      QueueHandle_t workQueue;                      // Indexes of the readers that are due, for the workers
+
+      static thread_local unsigned long currentTimeoutMs;
+
+      // Puts a read for the reader in the schedule, unless an earlier one is there already. Requires the mutex.
+      void ScheduleRead(size_t index, unsigned long dueMs);
+
+      // Hands the readers that are due to the workers, and returns how long until the next one is
+      unsigned long DispatchDueReaders();
+
+      // Runs one reader on the calling worker, and schedules its next read
+      void RunReader(size_t index);
 
     public:
 
+      NetworkReader();
+
       // Add a reader to the collection. Returns the index of the added reader, for use with FlagReader().
       //   Note that if an interval (in ms) is specified, the reader will run for the first time after
-      //   the interval has passed, unless "true" is passed to the last parameter.
-      size_t RegisterReader(std::function<void()> reader, unsigned long interval = 0, bool flag = false);
+      //   the interval has passed, unless "true" is passed to the last parameter. The timeout is how long
+      //   the reader's requests may take; see ReaderTimeout().
+      size_t RegisterReader(std::function<void()> reader, unsigned long interval = 0, bool flag = false,
+                            unsigned long timeoutMs = NETREADER_TIMEOUT);
 
       // Flag a reader for invocation and wake up the task that calls them
       void FlagReader(size_t index);
 
       // Cancel a reader. After this, it will no longer be invoked.
       void CancelReader(size_t index);
+
+      // The timeout of the reader that's running on the calling task, for it to pass on to its HTTPClient
+      static unsigned long ReaderTimeout()
+      {
+          return currentTimeoutMs;
+      }
   };
 
 #endif
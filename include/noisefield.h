@@ -0,0 +1,200 @@
+//+--------------------------------------------------------------------------
+//
+// File:        noisefield.h
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+//
+// Description:
+//
+//    A cache of Perlin noise fields for the matrix effects.  Each field is
+//    sampled on a coarse grid and filled in between, moves through z by
+//    blending two cached slices, and moves in x and y by scrolling the
+//    grid, so few inoise calls are made a frame
+//
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#include <memory>
+#include <FastLED.h>
+#include "globals.h"
+
+enum class NoiseDepth : uint8_t
+{
+    Eight,                  // inoise8, where a lattice cell is 256 units wide
+    Sixteen                 // inoise16, where it's 65536
+};
+
+// NoiseLattice
+//
+// Where the pixels of a field fall in noise space: pixel i, j samples X + i * StepX, Y + j * StepY.  Effects move
+// the origin about from frame to frame, so a cached field is found by the rest of the lattice and follows the origin
+// wherever it goes.
+
+struct NoiseLattice
+{
+    NoiseDepth Depth  = NoiseDepth::Sixteen;
+    uint32_t   X      = 0;
+    uint32_t   Y      = 0;
+    uint32_t   StepX  = 0;
+    uint32_t   StepY  = 0;
+    uint16_t   Width  = 0;
+    uint16_t   Height = 0;
+
+    // Whether the two lattices differ only in where they start
+    bool SameShape(const NoiseLattice & other) const
+    {
+        return Depth == other.Depth && StepX == other.StepX && StepY == other.StepY
+            && Width == other.Width && Height == other.Height;
+    }
+
+    // Noise for one point, scaled to 16 bits either way
+    uint16_t Sample(uint32_t x, uint32_t y, uint32_t z) const
+    {
+        if (Depth == NoiseDepth::Eight)
+            return inoise8((uint16_t) x, (uint16_t) y, (uint16_t) z) << 8;
+        return inoise16(x, y, z);
+    }
+};
+
+// NoiseFieldCache
+//
+// Perlin noise is smooth over a lattice cell, so when the pixels are only a small part of a cell apart it's
+// sampled every 2nd or 4th pixel and the rest is filled in bilinearly.  In z the field is kept at two slices
+// NOISE_FIELD_Z_SPAN apart and blended between them; as z moves past the far slice only one new slice is sampled.
+//
+// The grid sits on multiples of its own spacing in noise space rather than on the origin, with a spare column and
+// row, and the pixels are filled in from wherever the origin falls within its first cell.  When the origin moves,
+// the grid scrolls by whole cells and only the columns and rows that come into view are sampled.  A grid that
+// samples every pixel has nothing to fill in from, so it stays on the origin and only scrolls when the origin moves
+// by whole pixels.  Only the drawing task uses it, so there's no locking.
+
+class NoiseFieldCache
+{
+  public:
+
+    struct Field
+    {
+        NoiseLattice Lattice;
+        uint8_t      Shift     = 0;                      // The grid samples every 1 << Shift pixels
+        uint16_t     Columns   = 0;
+        uint16_t     Rows      = 0;
+        uint32_t     GridX     = 0;                      // Where the grid's first sample is in noise space
+        uint32_t     GridY     = 0;
+        uint32_t     CellX     = 0;                      // How far apart its samples are
+        uint32_t     CellY     = 0;
+        uint32_t     Z0        = 0;                      // Where Slice0 was sampled; Slice1 is a span beyond it
+        bool         bPair     = false;                  // Slice1 has been sampled
+        uint32_t     BlendZ    = 0;                      // What Blend holds, when bBlend
+        bool         bBlend    = false;
+        uint32_t     LastUse   = 0;
+        const uint16_t * pGrid = nullptr;                // The coarse grid for the z last asked for
+
+        unique_free_array<uint16_t> Slice0;
+        unique_free_array<uint16_t> Slice1;
+        unique_free_array<uint16_t> Blend;
+    };
+
+  private:
+
+    Field    _fields[NOISE_FIELD_CACHE_ENTRIES];
+    uint32_t _useCount = 0;
+
+    void SampleSlice(const Field & field, uint16_t * pSlice, uint32_t z);
+    void ScrollSlice(const Field & field, uint16_t * pSlice, int32_t dx, int32_t dy, uint32_t z);
+    uint32_t ZSpan(NoiseDepth depth) const;
+
+    // Where the grid for an origin starts, on a multiple of the cell, or on the origin itself for a grid of pixels
+    static uint32_t GridOrigin(uint32_t origin, uint32_t cell, uint8_t shift)
+    {
+        return shift && cell ? origin - origin % cell : origin;
+    }
+
+    // Moves the field's grid to the lattice's origin, keeping the samples it can
+    void Translate(Field & field, const NoiseLattice & lattice, uint32_t zMask);
+
+    // Finds (or makes) the field for the lattice and brings its grid to z.  Returns nullptr if the field doesn't
+    // fit in the cache, and the caller should sample it directly.
+    const Field * Prepare(const NoiseLattice & lattice, uint32_t z);
+
+  public:
+
+    // NoiseFieldCache::Fill
+    //
+    // Calls put(i, j, value) for every pixel of the lattice with the 16-bit noise there at z; for NoiseDepth::Eight
+    // the value is the inoise8 result in the top byte.
+
+    template <typename Put>
+    void Fill(const NoiseLattice & lattice, uint32_t z, Put && put)
+    {
+        const Field * pField = Prepare(lattice, z);
+
+        if (!pField)
+        {
+            for (uint16_t j = 0; j < lattice.Height; j++)
+                for (uint16_t i = 0; i < lattice.Width; i++)
+                    put(i, j, lattice.Sample(lattice.X + lattice.StepX * i, lattice.Y + lattice.StepY * j, z));
+            return;
+        }
+
+        const uint16_t * pGrid = pField->pGrid;
+        const uint8_t shift = pField->Shift;
+        const uint16_t columns = pField->Columns;
+
+        if (shift == 0)
+        {
+            for (uint16_t j = 0; j < lattice.Height; j++)
+                for (uint16_t i = 0; i < lattice.Width; i++)
+                    put(i, j, pGrid[j * columns + i]);
+            return;
+        }
+
+        // Positions in the grid are in cells with kFractionBits below the point, starting from where the origin
+        // falls in the first cell
+
+        constexpr int kFractionBits = 12;
+        constexpr int32_t kFractionMask = (1 << kFractionBits) - 1;
+
+        const uint32_t x0 = pField->CellX ? (uint32_t)(((uint64_t)(lattice.X - pField->GridX) << kFractionBits) / pField->CellX) : 0;
+        const uint32_t y0 = pField->CellY ? (uint32_t)(((uint64_t)(lattice.Y - pField->GridY) << kFractionBits) / pField->CellY) : 0;
+
+        for (uint16_t j = 0; j < lattice.Height; j++)
+        {
+            const uint32_t y = y0 + ((uint32_t) j << (kFractionBits - shift));
+            const int32_t fy = y & kFractionMask;
+            const uint16_t * pTop = pGrid + (y >> kFractionBits) * columns;
+            const uint16_t * pBottom = fy ? pTop + columns : pTop;
+
+            for (uint16_t i = 0; i < lattice.Width; i++)
+            {
+                const uint32_t x = x0 + ((uint32_t) i << (kFractionBits - shift));
+                const uint16_t c = x >> kFractionBits;
+                const int32_t fx = x & kFractionMask;
+                const uint16_t c1 = fx ? c + 1 : c;
+
+                int32_t top    = ((pTop[c] << kFractionBits) + (pTop[c1] - pTop[c]) * fx) >> kFractionBits;
+                int32_t bottom = ((pBottom[c] << kFractionBits) + (pBottom[c1] - pBottom[c]) * fx) >> kFractionBits;
+
+                put(i, j, (uint16_t)(top + (((bottom - top) * fy) >> kFractionBits)));
+            }
+        }
+    }
+};
+
+extern NoiseFieldCache g_NoiseFields;
@@ -0,0 +1,186 @@
+//+--------------------------------------------------------------------------
+//
+// File:        parallelfor.h
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+//
+// Description:
+//
+//    Splits a loop over rows between the task that runs it and a worker
+//    on the other core, so the heaviest effects and kernels can use both
+//
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#include <atomic>
+#include <type_traits>
+#include "globals.h"
+
+// ParallelFor
+//
+// Run() hands the worker the back half of the rows and starts on the front half itself.  Each side takes a grain of
+// rows at a time off the front of its own range, and the side that runs out takes the back half of what the other
+// has left, so neither waits while there's work.  The ranges are packed into one word each and only change through
+// compare and swap, which is all the locking there is; the worker is woken with a task notification.
+//
+// If the worker's core is busy with something more important, the caller ends up doing every row and only stops
+// to wait if the worker had already started.  There is one worker, so a Run() while another is going, or one from
+// inside the loop body, just runs its rows on the spot.
+//
+// The loop body must only write to its own rows, and mustn't use the RNG or mark pixels dirty, as those aren't
+// safe from two cores at once.
+
+class ParallelFor
+{
+    using Thunk = void (*)(void * pContext, uint16_t begin, uint16_t end);
+
+    enum : uint8_t { kIdle, kClaimed, kPosted, kWorking, kDone };
+
+    std::atomic<uint32_t> _ranges[2] = {};                                  // begin << 16 | end, caller's then worker's
+    std::atomic<uint8_t>  _state     { kIdle };
+    Thunk                 _thunk     = nullptr;
+    void *                _pContext  = nullptr;
+    uint16_t              _grain     = 1;
+    TaskHandle_t          _hWorker   = nullptr;
+    SemaphoreHandle_t     _semDone   = xSemaphoreCreateBinary();
+
+    static constexpr uint32_t Pack(uint16_t begin, uint16_t end)
+    {
+        return (uint32_t) begin << 16 | end;
+    }
+
+    // Takes up to a grain of rows off the front of our own range
+    bool TakeFront(std::atomic<uint32_t> & range, uint16_t & begin, uint16_t & end)
+    {
+        uint32_t packed = range.load();
+        for (;;)
+        {
+            begin = packed >> 16;
+            uint16_t last = packed & 0xFFFF;
+            if (begin >= last)
+                return false;
+
+            end = std::min<uint32_t>(last, begin + _grain);
+            if (range.compare_exchange_weak(packed, Pack(end, last)))
+                return true;
+        }
+    }
+
+    // Moves the back half of the other side's range, or its last row, into our own, which has run out
+    bool Steal(std::atomic<uint32_t> & victim, std::atomic<uint32_t> & range)
+    {
+        uint32_t packed = victim.load();
+        for (;;)
+        {
+            uint16_t begin = packed >> 16, end = packed & 0xFFFF;
+            if (begin >= end)
+                return false;
+
+            uint16_t mid = begin + (end - begin) / 2;
+            if (victim.compare_exchange_weak(packed, Pack(begin, mid)))
+            {
+                range = Pack(mid, end);
+                return true;
+            }
+        }
+    }
+
+    void Work(size_t side)
+    {
+        uint16_t begin, end;
+        for (;;)
+        {
+            if (TakeFront(_ranges[side], begin, end))
+                _thunk(_pContext, begin, end);
+            else if (!Steal(_ranges[1 - side], _ranges[side]))
+                return;
+        }
+    }
+
+  public:
+
+    // Whether a Run() is going, from the time it claims the worker until it's done with it
+    bool IsRunning() const
+    {
+        return _state.load(std::memory_order_acquire) != kIdle;
+    }
+
+    // Run
+    //
+    // Calls fn(begin, end) over row ranges that together cover 0 to count, from both cores, and returns once all of
+    // them are done
+
+    template <typename Fn>
+    void Run(uint16_t count, Fn && fn, uint16_t grain = 1)
+    {
+        uint8_t idle = kIdle;
+        if (!_hWorker || count < 2 || xTaskGetCurrentTaskHandle() == _hWorker || !_state.compare_exchange_strong(idle, kClaimed))
+        {
+            fn(0, count);
+            return;
+        }
+
+        // The job is claimed in a state the worker won't pick up, and only posted once it's all filled in
+
+        _thunk    = [](void * pContext, uint16_t begin, uint16_t end) { (*static_cast<std::remove_reference_t<Fn> *>(pContext))(begin, end); };
+        _pContext = (void *) &fn;
+        _grain    = std::max<uint16_t>(1, grain);
+        _ranges[0] = Pack(0, count / 2);
+        _ranges[1] = Pack(count / 2, count);
+        _state    = kPosted;
+        xTaskNotifyGive(_hWorker);
+
+        Work(0);
+
+        // If the worker never got to it we take the job back; otherwise it's on its last rows, and we wait for them
+
+        uint8_t posted = kPosted;
+        if (!_state.compare_exchange_strong(posted, kIdle))
+        {
+            xSemaphoreTake(_semDone, portMAX_DELAY);
+            _state = kIdle;
+        }
+    }
+
+    // WorkerEntry
+    //
+    // The worker task, which NightDriverTaskManager starts on PARALLEL_CORE
+
+    static void WorkerEntry(void * pThis)
+    {
+        auto pParallel = static_cast<ParallelFor *>(pThis);
+        pParallel->_hWorker = xTaskGetCurrentTaskHandle();
+
+        for (;;)
+        {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+            uint8_t posted = kPosted;
+            if (!pParallel->_state.compare_exchange_strong(posted, kWorking))
+                continue;                                                   // Taken back before we woke
+
+            pParallel->Work(1);
+            pParallel->_state = kDone;
+            xSemaphoreGive(pParallel->_semDone);
+        }
+    }
+};
+
+extern ParallelFor g_ParallelFor;
@@ -0,0 +1,478 @@
+//+--------------------------------------------------------------------------
+//
+// File:        playlist.h
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+//
+// Description:
+//
+//    Named playlists of effects, each entry with its own duration and
+//    shuffle weight, and the scheduler that picks what plays next
+//
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+#include "ledstripeffect.h"
+
+#if ENABLE_PLAYLISTS
+
+#define PLAYLISTS_CONFIG_FILE "/playlists.cfg"
+
+// PlaylistEntry
+//
+// An effect by its index in the EffectManager's list.  Entries are played whether or not the effect is enabled,
+// since putting it in the playlist says it should be.
+
+struct PlaylistEntry
+{
+    uint16_t EffectIndex = 0;
+    uint16_t Seconds     = 0;                   // How long it plays, or 0 for the EffectManager's interval
+    uint8_t  Weight      = 1;                   // Relative odds of being picked when shuffling
+};
+
+struct Playlist
+{
+    String Name;
+    bool   Shuffle = false;
+    std::vector<PlaylistEntry> Entries;
+};
+
+// PlaylistScheduler
+//
+// Holds the playlists and walks the active one.  The entry after the current one is always picked ahead of time,
+// so the EffectManager can get it ready before the change.  Playlists are switched from the web server while the
+// drawing thread walks them, so everything goes through the mutex and a switch is seen whole or not at all.
+//
+// The playlists are persisted on their own, in compact form:
+//
+//   { "act": "Evening", "pls": [ { "n": "Evening", "s": 1, "e": [ [ index, seconds, weight ], ... ] }, ... ] }
+
+class PlaylistScheduler : public IJSONSerializable
+{
+    std::vector<Playlist> _playlists;
+    std::vector<uint16_t> _order;               // Play order of the active playlist's entries, when not shuffling
+    int    _active   = -1;                      // Index into _playlists, or -1 to fall back to the effect list
+    String _savedActive;                        // Name of the playlist that was active when we were last saved
+    size_t _position = 0;                       // Playing entry, an index into _order
+    size_t _next     = 0;                       // Entry that plays after it
+    mutable std::mutex _mutex;
+
+    // An effect that takes a good part of its frame budget.  Ones that haven't been drawn yet count as light.
+
+    static bool IsHeavy(const LEDStripEffect & effect)
+    {
+        return effect.AverageDrawMilliseconds() > PLAYLIST_HEAVY_RATIO * MILLIS_PER_SECOND / std::max<size_t>(1, effect.DesiredFramesPerSecond());
+    }
+
+    const PlaylistEntry & EntryAt(size_t position) const
+    {
+        const auto & playlist = _playlists[_active];
+        return playlist.Entries[playlist.Shuffle ? position : _order[position]];
+    }
+
+    bool IsHeavyAt(size_t position, const std::vector<std::shared_ptr<LEDStripEffect>> & effects) const
+    {
+        auto index = EntryAt(position).EffectIndex;
+        return index < effects.size() && IsHeavy(*effects[index]);
+    }
+
+    // ChooseNext
+    //
+    // Picks the entry to follow the current one.  With PLAYLIST_SPACE_HEAVY_EFFECTS, a heavy effect isn't followed by
+    // another heavy one if there's a light one to put in between; in order, that light one swaps places with the
+    // heavy one it jumps ahead of.
+
+    void ChooseNext(const std::vector<std::shared_ptr<LEDStripEffect>> & effects)
+    {
+        const auto & playlist = _playlists[_active];
+        const size_t count = playlist.Entries.size();
+
+        #if PLAYLIST_SPACE_HEAVY_EFFECTS
+            const bool bAfterHeavy = IsHeavyAt(_position, effects);
+        #else
+            const bool bAfterHeavy = false;
+        #endif
+
+        if (count < 2)
+        {
+            _next = 0;
+            return;
+        }
+
+        if (!playlist.Shuffle)
+        {
+            _next = (_position + 1) % count;
+            if (!bAfterHeavy || !IsHeavyAt(_next, effects))
+                return;
+
+            for (size_t i = (_next + 1) % count; i != _position; i = (i + 1) % count)
+            {
+                if (!IsHeavyAt(i, effects))
+                {
+                    std::swap(_order[_next], _order[i]);
+                    return;
+                }
+            }
+            return;
+        }
+
+        // Weighted pick among the other entries, leaving out heavy ones after a heavy one unless that's all there is
+
+        for (bool bSpacing : { bAfterHeavy, false })
+        {
+            uint32_t totalWeight = 0;
+            for (size_t i = 0; i < count; i++)
+                if (i != _position && !(bSpacing && IsHeavyAt(i, effects)))
+                    totalWeight += playlist.Entries[i].Weight;
+
+            if (totalWeight == 0)
+                continue;
+
+            uint32_t pick = random(totalWeight);
+            for (size_t i = 0; i < count; i++)
+            {
+                if (i == _position || (bSpacing && IsHeavyAt(i, effects)))
+                    continue;
+
+                auto weight = playlist.Entries[i].Weight;
+                if (pick < weight)
+                {
+                    _next = i;
+                    return;
+                }
+                pick -= weight;
+            }
+        }
+
+        _next = (_position + 1) % count;                    // Every weight is zero
+    }
+
+    int FindPlaylist(const String & name) const
+    {
+        for (size_t i = 0; i < _playlists.size(); i++)
+            if (_playlists[i].Name == name)
+                return i;
+        return -1;
+    }
+
+    void ResetOrder()
+    {
+        _order.clear();
+        _position = 0;
+        _next     = 0;
+
+        if (_active < 0)
+            return;
+
+        for (size_t i = 0; i < _playlists[_active].Entries.size(); i++)
+            _order.push_back(i);
+        _next = _order.size() > 1 ? 1 : 0;
+    }
+
+    // Applies a change of effect indices to every entry, dropping the entries the remap returns nullopt for.  The
+    // active playlist carries on from the entry that's playing, or the one that took its place if it was dropped.
+
+    template<typename TRemap>
+    void RemapEffects(TRemap remap)
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+
+        constexpr size_t kDropped = std::numeric_limits<size_t>::max();
+        std::vector<size_t> newEntryIndex;
+        size_t playing = 0, following = 0;
+
+        if (_active >= 0)
+        {
+            bool bShuffle = _playlists[_active].Shuffle;
+            playing   = bShuffle ? _position : _order[_position];
+            following = bShuffle ? _next : _order[_next];
+        }
+
+        for (int p = 0; p < (int) _playlists.size(); p++)
+        {
+            auto & entries = _playlists[p].Entries;
+            size_t kept = 0;
+
+            if (p == _active)
+                newEntryIndex.assign(entries.size(), kDropped);
+
+            for (size_t i = 0; i < entries.size(); i++)
+            {
+                auto index = remap(entries[i].EffectIndex);
+                if (!index)
+                    continue;
+
+                if (p == _active)
+                    newEntryIndex[i] = kept;
+                entries[kept] = entries[i];
+                entries[kept++].EffectIndex = *index;
+            }
+            entries.resize(kept);
+        }
+
+        if (_active >= 0 && _playlists[_active].Entries.empty())
+            _active = -1;
+        ResetOrder();
+
+        if (_active < 0)
+            return;
+
+        // ResetOrder() leaves the play order matching the entries, so positions and entry indexes are the same
+
+        const size_t count = _playlists[_active].Entries.size();
+        auto carriedOver = [&](size_t entry)
+        {
+            for (size_t i = entry; i < newEntryIndex.size(); i++)
+                if (newEntryIndex[i] != kDropped)
+                    return newEntryIndex[i];
+            return (size_t) 0;
+        };
+
+        _position = carriedOver(playing);
+        _next     = carriedOver(following);
+        if (_next == _position && count > 1)
+            _next = (_position + 1) % count;
+    }
+
+public:
+
+    bool IsActive() const
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        return _active >= 0;
+    }
+
+    String ActiveName() const
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        return _active >= 0 ? _playlists[_active].Name : String();
+    }
+
+    String SavedActiveName() const
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        return _savedActive;
+    }
+
+    std::vector<Playlist> Playlists() const
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        return _playlists;
+    }
+
+    // SetPlaylist
+    //
+    // Adds a playlist, or replaces the one with the same name.  Entries for effects that don't exist are dropped.
+    // If it's the active one, it starts over from its first entry.
+
+    bool SetPlaylist(Playlist playlist, size_t effectCount)
+    {
+        auto & entries = playlist.Entries;
+        entries.erase(std::remove_if(entries.begin(), entries.end(), [effectCount](const auto & entry)
+            { return entry.EffectIndex >= effectCount; }), entries.end());
+
+        if (playlist.Name.isEmpty() || entries.empty())
+            return false;
+
+        std::lock_guard<std::mutex> guard(_mutex);
+
+        int i = FindPlaylist(playlist.Name);
+        if (i < 0)
+            _playlists.push_back(std::move(playlist));
+        else
+            _playlists[i] = std::move(playlist);
+
+        if (i >= 0 && i == _active)
+            ResetOrder();
+        return true;
+    }
+
+    bool DeletePlaylist(const String & name)
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+
+        int i = FindPlaylist(name);
+        if (i < 0)
+            return false;
+
+        _playlists.erase(_playlists.begin() + i);
+        if (_active == i)
+            _active = -1;
+        else if (_active > i)
+            _active--;
+
+        ResetOrder();
+        return true;
+    }
+
+    // Activate
+    //
+    // Makes the named playlist drive the rotation and returns the effect it starts on.  An empty name goes back to
+    // walking the effect list.
+
+    std::optional<size_t> Activate(const String & name, const std::vector<std::shared_ptr<LEDStripEffect>> & effects)
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+
+        _active = name.isEmpty() ? -1 : FindPlaylist(name);
+        ResetOrder();
+
+        if (_active < 0)
+            return std::nullopt;
+
+        if (_playlists[_active].Shuffle)
+            _position = random(_playlists[_active].Entries.size());
+        ChooseNext(effects);
+        return EntryAt(_position).EffectIndex;
+    }
+
+    // The effect that'll play after the current one, without moving there
+    std::optional<size_t> PeekNextEffect() const
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        return _active >= 0 ? std::optional<size_t>(EntryAt(_next).EffectIndex) : std::nullopt;
+    }
+
+    // Moves to the entry picked ahead of time and picks the one after it
+    std::optional<size_t> Advance(const std::vector<std::shared_ptr<LEDStripEffect>> & effects)
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        if (_active < 0)
+            return std::nullopt;
+
+        _position = _next;
+        ChooseNext(effects);
+        return EntryAt(_position).EffectIndex;
+    }
+
+    // Steps back through the play order.  When shuffling there's no history, so this just goes to the entry above.
+    std::optional<size_t> Retreat(const std::vector<std::shared_ptr<LEDStripEffect>> & effects)
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        if (_active < 0)
+            return std::nullopt;
+
+        const size_t count = _playlists[_active].Entries.size();
+        _position = (_position + count - 1) % count;
+        ChooseNext(effects);
+        return EntryAt(_position).EffectIndex;
+    }
+
+    // How long the current entry plays for, if it has a duration of its own
+    std::optional<uint> CurrentInterval() const
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        if (_active < 0 || EntryAt(_position).Seconds == 0)
+            return std::nullopt;
+
+        return EntryAt(_position).Seconds * MILLIS_PER_SECOND;
+    }
+
+    // Keep the entries pointing at the same effects when the EffectManager moves or deletes one
+
+    void EffectMoved(size_t from, size_t to)
+    {
+        RemapEffects([from, to](size_t i) -> std::optional<size_t>
+        {
+            if (i == from)
+                return to;
+            if (from < to && i > from && i <= to)
+                return i - 1;
+            if (from > to && i >= to && i < from)
+                return i + 1;
+            return i;
+        });
+    }
+
+    void EffectDeleted(size_t index)
+    {
+        RemapEffects([index](size_t i) -> std::optional<size_t>
+        {
+            if (i == index)
+                return std::nullopt;
+            return i > index ? i - 1 : i;
+        });
+    }
+
+    bool SerializeToJSON(JsonObject& jsonObject) override
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+
+        if (_active >= 0)
+            jsonObject["act"] = _playlists[_active].Name;
+
+        // Running out of room anywhere returns false, which has SaveToJSONFile grow the buffer and try again
+
+        JsonArray playlistsArray = jsonObject.createNestedArray("pls");
+        for (const auto & playlist : _playlists)
+        {
+            JsonObject playlistObject = playlistsArray.createNestedObject();
+            if (playlistObject.isNull())
+                return false;
+
+            playlistObject["n"] = playlist.Name;
+            playlistObject["s"] = playlist.Shuffle ? 1 : 0;
+
+            JsonArray entriesArray = playlistObject.createNestedArray("e");
+            for (const auto & entry : playlist.Entries)
+            {
+                JsonArray entryArray = entriesArray.createNestedArray();
+                if (!entryArray.add(entry.EffectIndex) || !entryArray.add(entry.Seconds) || !entryArray.add(entry.Weight))
+                    return false;
+            }
+        }
+
+        return !playlistsArray.isNull();
+    }
+
+    // Loads the playlists, leaving them inactive; the EffectManager activates the saved one once its effects are in
+
+    bool DeserializeFromJSON(const JsonObjectConst& jsonObject) override
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+
+        _playlists.clear();
+        _active = -1;
+        _savedActive = jsonObject["act"].as<String>();
+
+        for (JsonObjectConst playlistObject : jsonObject["pls"].as<JsonArrayConst>())
+        {
+            Playlist playlist;
+            playlist.Name    = playlistObject["n"].as<String>();
+            playlist.Shuffle = playlistObject["s"].as<int>() != 0;
+
+            for (JsonArrayConst entryArray : playlistObject["e"].as<JsonArrayConst>())
+                playlist.Entries.push_back({ entryArray[0].as<uint16_t>(), entryArray[1].as<uint16_t>(), entryArray[2] | (uint8_t) 1 });
+
+            _playlists.push_back(std::move(playlist));
+        }
+
+        ResetOrder();
+        return true;
+    }
+};
+
+#endif
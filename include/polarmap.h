@@ -0,0 +1,96 @@
+//+--------------------------------------------------------------------------
+//
+// File:        polarmap.h
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+//
+// Description:
+//
+//    The angle and distance of every pixel from the middle of the matrix,
+//    and a table of inverse distances, worked out once and shared by the
+//    radial effects so they draw from lookups
+//
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include "globals.h"
+
+// PolarMap
+//
+// Pixel x, y sits at x - MATRIX_WIDTH / 2, y - MATRIX_HEIGHT / 2 from the middle.  Angles run 0-255 around the
+// circle the way the effects have always worked them out, as 128 * atan2(y, x) / PI, and radii are kept in 8.8 fixed
+// point so they can be scaled without losing the fraction first.
+//
+// The tables are built by Prepare(), which the effects call from AcquireState(), so it can run on the prepare task
+// and the drawing task at once.  They're built aside and only put in place, under the mutex, once they're filled
+// in, and they're never freed after that, so anything that has seen Prepare() return true can read them from any
+// task without a lock.
+
+class PolarMap
+{
+    std::unique_ptr<uint8_t[]>  _angle;
+    std::unique_ptr<uint16_t[]> _radius;
+    std::unique_ptr<uint16_t[]> _inverseDistance;
+    std::atomic<bool>           _bReady { false };
+    std::mutex                  _mutex;
+
+    static size_t Index(uint x, uint y)
+    {
+        return y * MATRIX_WIDTH + x;
+    }
+
+  public:
+
+    static constexpr int CenterX = MATRIX_WIDTH / 2;
+    static constexpr int CenterY = MATRIX_HEIGHT / 2;
+
+    // Builds the tables if they aren't already; returns false if there wasn't the memory for them
+    bool Prepare();
+
+    uint8_t Angle(uint x, uint y) const
+    {
+        return _angle[Index(x, y)];
+    }
+
+    // Distance from the middle in whole pixels
+    uint8_t Radius(uint x, uint y) const
+    {
+        return _radius[Index(x, y)] >> 8;
+    }
+
+    // Distance from the middle times scale, as if the scaling were done before the fraction was dropped
+    uint8_t Radius(uint x, uint y, uint8_t scale) const
+    {
+        return (_radius[Index(x, y)] * scale) >> 8;
+    }
+
+    // 32768 / sqrt16(dx * dx + dy * dy + 1), rounded up, for |dx| < MATRIX_WIDTH and |dy| < MATRIX_HEIGHT.  The
+    // rounding makes (n * InverseDistance(dx, dy)) >> 15 come out the same as dividing n by the distance, for n < 256
+    // and distances under 195 pixels.
+    uint16_t InverseDistance(int dx, int dy) const
+    {
+        return _inverseDistance[Index(abs(dx), abs(dy))];
+    }
+};
+
+extern PolarMap g_PolarMap;
@@ -30,10 +30,13 @@
 
 #pragma once
 #if ENABLE_REMOTE
+#if !REMOTE_EDGE_DECODE
 #include <IRremoteESP8266.h>
 #include <IRrecv.h>
 #include <IRutils.h>
+#endif
 #include <limits>
+#include <esp_timer.h>
 
 
 #define key24  true
@@ -147,31 +150,105 @@ RemoteColorCodes[] =
     { IR_B12,  CRGB(255, 000, 255), 224 }
 };
 
+#if REMOTE_EDGE_DECODE
+
+// NECDecoder
+//
+// Turns the marks and spaces an IR receiver sees into NEC codes: a 9ms mark and a 4.5ms space, then 32 bits that
+// are each a 560us mark and a space of 560us for a 0 or 1690us for a 1, and a closing mark.  A held key sends a 9ms
+// mark, a 2.25ms space and a closing mark, which comes out as 0xFFFFFFFF, as IRremoteESP8266 reports it.  The bits
+// are shifted in as they arrive, so the codes match the ones IRremoteESP8266 gives for the same keys.
+
+class NECDecoder
+{
+    enum class State : uint8_t
+    {
+        Idle,
+        Header,             // Had the 9ms mark
+        Bits,               // Had the 4.5ms space, and is taking bits
+        Stop,               // Had all 32 bits, and wants the closing mark
+        RepeatStop          // Had the 2.25ms space of a repeat, and wants the closing mark
+    };
+
+    State    _state = State::Idle;
+    uint8_t  _cBits = 0;
+    uint32_t _code  = 0;
+
+  public:
+
+    // Mark returns true, with the code, when its mark completes one
+    bool Mark(uint32_t us, uint32_t & code);
+    void Space(uint32_t us);
+};
+
+#endif
+
+// RemoteControl
+//
+// With REMOTE_EDGE_DECODE, an interrupt on the receiver's pin times each edge and decodes the code as it comes in,
+// then queues it for the remote task, which otherwise sleeps.  Without it, the task polls IRremoteESP8266, which
+// can decode the other protocols it was built with.
+
 class RemoteControl
 {
   private:
+
+#if REMOTE_EDGE_DECODE
+    static constexpr UBaseType_t kCodeQueueDepth = 8;
+
+    QueueHandle_t    _codes = nullptr;
+    NECDecoder       _decoder;
+    volatile int64_t _lastEdge = 0;
+
+    static void IRAM_ATTR OnEdge(void * pv);
+#else
     IRrecv _IR_Receive;
+#endif
 
   public:
 
+#if REMOTE_EDGE_DECODE
+    RemoteControl() = default;
+#else
     RemoteControl() : _IR_Receive(IR_REMOTE_PIN)
     {
     }
+#endif
 
     bool begin()
     {
         debugW("Remote Control Decoding Started");
-        _IR_Receive.enableIRIn();
+        #if REMOTE_EDGE_DECODE
+            if (!_codes)
+                _codes = xQueueCreate(kCodeQueueDepth, sizeof(uint32_t));
+            if (!_codes)
+                return false;
+
+            pinMode(IR_REMOTE_PIN, INPUT);
+            _lastEdge = esp_timer_get_time();
+            attachInterruptArg(digitalPinToInterrupt(IR_REMOTE_PIN), OnEdge, this, CHANGE);
+        #else
+            _IR_Receive.enableIRIn();
+        #endif
         return true;
     }
 
     void end()
     {
         debugW("Remote Control Decoding Stopped");
-        _IR_Receive.disableIRIn();
+        #if REMOTE_EDGE_DECODE
+            detachInterrupt(digitalPinToInterrupt(IR_REMOTE_PIN));
+        #else
+            _IR_Receive.disableIRIn();
+        #endif
     }
 
-    void handle();
+    // Waits for the next code from the remote.  Decoding edges, that's until a key is pressed; polling, it returns
+    // false right away if nothing has come in.
+    bool ReceiveCode(uint & code);
+
+    // Acts on a code, which may be a repeat from a held key
+    void HandleCode(uint code);
 };
 
 #endif
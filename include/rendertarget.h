@@ -0,0 +1,171 @@
+//+--------------------------------------------------------------------------
+//
+// File:        rendertarget.h
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+//
+// Description:
+//
+//    Off-screen frames that effects can be pointed at instead of the
+//    device buffers, for cross-fades, layers and thumbnails
+//
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include <esp_heap_caps.h>
+#include "gfxbase.h"
+#include "types.h"
+
+// RenderTarget
+//
+// A frame for every channel, the same size as that channel's leds.  The frames go in internal RAM when there's
+// room, since drawing there is quicker than into PSRAM or the buffers the display DMA reads, and in PSRAM if not.
+
+class RenderTarget
+{
+    struct FrameDeleter
+    {
+        void operator()(CRGB * p) const
+        {
+            heap_caps_free(p);
+        }
+    };
+
+    std::vector<std::unique_ptr<CRGB, FrameDeleter>> _frames;
+    std::vector<size_t> _frameSizes;
+
+public:
+
+    // Allocate
+    //
+    // Makes sure there's a frame for each of the devices, keeping the ones that are already the right size.  New
+    // frames start out black.
+
+    bool Allocate(const std::vector<std::shared_ptr<GFXBase>> & gfx)
+    {
+        _frames.resize(gfx.size());
+        _frameSizes.resize(gfx.size(), 0);
+
+        for (size_t i = 0; i < gfx.size(); i++)
+        {
+            size_t cLEDs = gfx[i]->GetLEDCount();
+            if (_frames[i] && _frameSizes[i] == cLEDs)
+                continue;
+
+            auto pFrame = (CRGB *) heap_caps_malloc(sizeof(CRGB) * cLEDs, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+            if (!pFrame)
+                pFrame = (CRGB *) PreferPSRAMAlloc(sizeof(CRGB) * cLEDs);
+            if (!pFrame)
+            {
+                debugW("Could not allocate a %zu pixel render target", cLEDs);
+                Release();
+                return false;
+            }
+
+            std::fill_n(pFrame, cLEDs, CRGB::Black);
+            _frames[i].reset(pFrame);
+            _frameSizes[i] = cLEDs;
+        }
+        return true;
+    }
+
+    void Release()
+    {
+        _frames.clear();
+        _frameSizes.clear();
+    }
+
+    bool IsAllocated() const
+    {
+        return !_frames.empty();
+    }
+
+    size_t ChannelCount() const
+    {
+        return _frames.size();
+    }
+
+    CRGB * Frame(size_t channel) const
+    {
+        return _frames[channel].get();
+    }
+
+    size_t FrameSize(size_t channel) const
+    {
+        return _frameSizes[channel];
+    }
+
+    void Clear(CRGB color = CRGB::Black)
+    {
+        for (size_t i = 0; i < _frames.size(); i++)
+            std::fill_n(_frames[i].get(), _frameSizes[i], color);
+    }
+
+    // Take a copy of what the devices are showing
+    void CopyFrom(const std::vector<std::shared_ptr<GFXBase>> & gfx)
+    {
+        for (size_t i = 0; i < _frames.size(); i++)
+            std::copy_n(gfx[i]->leds, _frameSizes[i], _frames[i].get());
+    }
+
+    // Put the frames onto the devices
+    void CopyTo(const std::vector<std::shared_ptr<GFXBase>> & gfx) const
+    {
+        for (size_t i = 0; i < _frames.size(); i++)
+        {
+            std::copy_n(_frames[i].get(), _frameSizes[i], gfx[i]->leds);
+            gfx[i]->MarkAllDirty();
+        }
+    }
+};
+
+// RenderTargetScope
+//
+// Points every device's leds at its frame in the render target for as long as the scope lasts
+
+class RenderTargetScope
+{
+    const std::vector<std::shared_ptr<GFXBase>> & _gfx;
+    std::vector<CRGB *> _previous;
+
+public:
+
+    RenderTargetScope(const std::vector<std::shared_ptr<GFXBase>> & gfx, const RenderTarget & target)
+        : _gfx(gfx),
+          _previous(gfx.size())
+    {
+        assert(target.ChannelCount() == gfx.size());
+
+        for (size_t i = 0; i < _gfx.size(); i++)
+            _previous[i] = _gfx[i]->PushRenderTarget(target.Frame(i));
+    }
+
+    ~RenderTargetScope()
+    {
+        for (size_t i = 0; i < _gfx.size(); i++)
+            _gfx[i]->PopRenderTarget(_previous[i]);
+    }
+
+    RenderTargetScope(const RenderTargetScope &) = delete;
+    RenderTargetScope & operator=(const RenderTargetScope &) = delete;
+};
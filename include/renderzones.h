@@ -0,0 +1,207 @@
+//+--------------------------------------------------------------------------
+//
+// File:        renderzones.h
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+//
+//
+// Description:
+//
+//    Render zones: sets of channels, or regions of the matrix, that each
+//    run effects of their own at their own frame rate instead of the
+//    current effect
+//
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include "ledstripeffect.h"
+#include "rendertarget.h"
+
+#if ENABLE_RENDER_ZONES
+
+// ZoneRegion
+//
+// A rectangle of the matrix, in the coordinates of the zone's channels.  An empty one means the whole channels.
+
+struct ZoneRegion
+{
+    int16_t X      = 0;
+    int16_t Y      = 0;
+    int16_t Width  = 0;
+    int16_t Height = 0;
+
+    bool IsEmpty() const
+    {
+        return Width <= 0 || Height <= 0;
+    }
+};
+
+// RenderZone
+//
+// The zone's effects are set up with only the zone's channels, so an effect on two channels of eight draws two.
+// Each draws into the zone's own frame, which is put onto the devices every frame whether it was redrawn or not,
+// so a zone that's not due costs a copy rather than a draw.  The effects take turns every EffectInterval ms.
+
+struct RenderZone
+{
+    uint32_t      ChannelMask      = 1;             // One bit per channel, from channel 0 up
+    ZoneRegion    Region;
+    uint          FramesPerSecond  = 0;             // How often the frame is redrawn, or 0 for every frame
+    uint          EffectInterval   = 0;             // How long each effect runs, or 0 to stay on the first
+
+    std::vector<std::shared_ptr<LEDStripEffect>> Effects;
+    size_t        iCurrentEffect   = 0;
+
+    std::vector<std::shared_ptr<GFXBase>> Gfx;     // The zone's channels
+    RenderTarget  Frame;
+    unsigned long msLastDraw       = 0;
+    unsigned long msEffectStart    = 0;
+    bool          bStarted         = false;
+
+    LEDStripEffect & CurrentEffect() const
+    {
+        return *Effects[iCurrentEffect];
+    }
+};
+
+class ZoneStack
+{
+    std::vector<RenderZone> _zones;
+
+    // Puts the zone's frame onto its channels, or only its region of them
+
+    static void ComposeZone(RenderZone & zone)
+    {
+        for (size_t i = 0; i < zone.Gfx.size(); i++)
+        {
+            GFXBase & gfx = *zone.Gfx[i];
+            const CRGB * pFrame = zone.Frame.Frame(i);
+
+            if (zone.Region.IsEmpty())
+            {
+                std::copy_n(pFrame, zone.Frame.FrameSize(i), gfx.leds);
+            }
+            else
+            {
+                int xEnd = std::min<int>(zone.Region.X + zone.Region.Width,  gfx.width());
+                int yEnd = std::min<int>(zone.Region.Y + zone.Region.Height, gfx.height());
+
+                for (int y = std::max<int>(0, zone.Region.Y); y < yEnd; y++)
+                    for (int x = std::max<int>(0, zone.Region.X); x < xEnd; x++)
+                    {
+                        uint16_t index = gfx.fastXY(x, y);
+                        gfx.leds[index] = pFrame[index];
+                    }
+            }
+            gfx.MarkAllDirty();
+        }
+    }
+
+    static bool StartEffect(RenderZone & zone)
+    {
+        auto & effect = zone.CurrentEffect();
+        if (!effect.EnsurePrepared(zone.Gfx))
+        {
+            debugW("Could not bring in %s for its zone", effect.FriendlyName().c_str());
+            return false;
+        }
+
+        effect.Start();
+        zone.msEffectStart = millis();
+        zone.bStarted      = true;
+        return true;
+    }
+
+public:
+
+    // Add
+    //
+    // Sets a zone up on the channels in its mask and starts its first effect.  Fails if none of the channels exist,
+    // the zone has no effects, or there's no room for its frame.
+
+    bool Add(RenderZone zone, const std::vector<std::shared_ptr<GFXBase>> & gfx)
+    {
+        zone.Gfx.clear();
+        for (size_t i = 0; i < gfx.size() && i < 32; i++)
+            if (zone.ChannelMask & (1u << i))
+                zone.Gfx.push_back(gfx[i]);
+
+        if (zone.Gfx.empty() || zone.Effects.empty())
+            return false;
+
+        if (!zone.Frame.Allocate(zone.Gfx))
+            return false;
+
+        zone.iCurrentEffect = 0;
+        if (!StartEffect(zone))
+            return false;
+
+        _zones.push_back(std::move(zone));
+        return true;
+    }
+
+    void Clear()
+    {
+        _zones.clear();
+    }
+
+    const std::vector<RenderZone> & Zones() const
+    {
+        return _zones;
+    }
+
+    // Compose
+    //
+    // Moves each zone on to its next effect when its interval is up, redraws the zones that are due, and puts every
+    // zone's frame over what the current effect drew, in the order they were added
+
+    void Compose()
+    {
+        auto msNow = millis();
+
+        for (auto & zone : _zones)
+        {
+            if (zone.EffectInterval && zone.Effects.size() > 1 && msNow - zone.msEffectStart >= zone.EffectInterval)
+            {
+                zone.iCurrentEffect = (zone.iCurrentEffect + 1) % zone.Effects.size();
+                zone.bStarted = false;
+            }
+
+            if (!zone.bStarted && !StartEffect(zone))
+                continue;
+
+            bool bDue = zone.msLastDraw == 0 || zone.FramesPerSecond == 0 || msNow - zone.msLastDraw >= MILLIS_PER_SECOND / zone.FramesPerSecond;
+            if (bDue)
+            {
+                auto usStart = micros();
+                zone.CurrentEffect().DrawInto(zone.Frame);
+                zone.CurrentEffect().RecordDraw(usStart, micros());
+                zone.msLastDraw = msNow;
+            }
+
+            ComposeZone(zone);
+        }
+    }
+};
+
+#endif
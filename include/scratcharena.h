@@ -0,0 +1,173 @@
+//+--------------------------------------------------------------------------
+//
+// File:        scratcharena.h
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+// Description:
+//
+//    A block of hot memory that a task hands out its short lived
+//    buffers from, and empties again once the frame or packet is done
+//
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include "globals.h"
+#include "memoryplacement.h"
+
+// ScratchArena
+//
+// Allocations just move a pointer along, and there's no freeing them one at a time: the owner calls Reset() when
+// whatever it was doing is done, and everything goes at once.  An arena belongs to a single task, so there's no
+// locking, and what comes out of it is raw memory that's never constructed or destroyed.  Allocate returns nullptr
+// once the arena is full, and the caller falls back to what it did before there was one.
+//
+// The block itself is a hot PlacedAlloc made on the first Allocate, not in the constructor, so a global arena does
+// nothing during static init and one that's never used never takes any memory.  Release() hands it back until the
+// next Allocate.
+
+class ScratchArena
+{
+    const char * _name;
+    size_t       _capacity;
+    uint8_t *    _pBase     = nullptr;
+    size_t       _size      = 0;
+    size_t       _used      = 0;
+    size_t       _highWater = 0;
+    bool         _bWarned   = false;
+
+    bool EnsureBlock()
+    {
+        if (_pBase)
+            return true;
+
+        _pBase = (uint8_t *) PlacedAlloc(_capacity, Placement::Hot, _name);
+        if (!_pBase)
+        {
+            if (!_bWarned)
+                debugW("Could not allocate %zu bytes of %s memory", _capacity, _name);
+            _bWarned = true;
+            return false;
+        }
+
+        _size = _capacity;
+        _used = 0;
+        return true;
+    }
+
+  public:
+
+    ScratchArena(size_t size, const char * name)
+        : _name(name),
+          _capacity(size)
+    {
+    }
+
+    ~ScratchArena()
+    {
+        free(_pBase);
+    }
+
+    ScratchArena(const ScratchArena &) = delete;
+    ScratchArena & operator=(const ScratchArena &) = delete;
+
+    void * Allocate(size_t bytes, size_t alignment = alignof(std::max_align_t))
+    {
+        if (!EnsureBlock())
+            return nullptr;
+
+        // Aligned by address, as the heap only promises four bytes for the block itself
+        uintptr_t base = (uintptr_t) _pBase;
+        size_t start = ((base + _used + alignment - 1) & ~(uintptr_t)(alignment - 1)) - base;
+        if (start + bytes > _size)
+            return nullptr;
+
+        _used = start + bytes;
+        _highWater = std::max(_highWater, _used);
+        return _pBase + start;
+    }
+
+    template<typename T>
+    T * Allocate(size_t count = 1)
+    {
+        static_assert(std::is_trivially_destructible_v<T>, "Nothing allocated from a ScratchArena is ever destroyed");
+        return static_cast<T *>(Allocate(count * sizeof(T), alignof(T)));
+    }
+
+    // What's been handed out so far, for a ScratchScope to go back to
+    size_t Mark() const
+    {
+        return _used;
+    }
+
+    void Rewind(size_t mark)
+    {
+        _used = std::min(_used, mark);
+    }
+
+    void Reset()
+    {
+        _used = 0;
+    }
+
+    // Frees the block, along with everything that was allocated from it
+    void Release()
+    {
+        free(_pBase);
+        _pBase = nullptr;
+        _size  = 0;
+        _used  = 0;
+    }
+
+    size_t Size() const      { return _size; }
+    size_t Used() const      { return _used; }
+    size_t HighWater() const { return _highWater; }
+};
+
+// ScratchScope
+//
+// Gives back everything allocated from the arena while it was in scope, so a helper can use the arena without
+// the owner having to wait for the end of the frame or packet.
+
+class ScratchScope
+{
+    ScratchArena & _arena;
+    size_t         _mark;
+
+  public:
+
+    explicit ScratchScope(ScratchArena & arena) : _arena(arena), _mark(arena.Mark())
+    {
+    }
+
+    ~ScratchScope()
+    {
+        _arena.Rewind(_mark);
+    }
+
+    ScratchScope(const ScratchScope &) = delete;
+    ScratchScope & operator=(const ScratchScope &) = delete;
+};
+
+// The draw task's arena, emptied before every frame.  Only effects and the code they call, which all run on the draw
+// task, may use it.
+extern ScratchArena g_DrawScratch;
@@ -36,6 +36,11 @@
 #include <mutex>
 #include "gfxbase.h"
 
+#if ENABLE_SCREEN_PREVIEW
+    // Called by the draw loop after each frame; takes a copy of it for the screen's LED preview page when one is due
+    void CaptureScreenPreview();
+#endif
+
 class Screen : public GFXBase
 {
 public:
@@ -55,6 +60,26 @@ public:
     {
     }
 
+    // RetainsContent
+    //
+    // Whether what was drawn stays on the display from one frame to the next.  Those that build every frame from
+    // scratch in a buffer of their own say no, so the status pages know to draw all of it every time.
+
+    virtual bool RetainsContent() const
+    {
+        return true;
+    }
+
+    // PushRect
+    //
+    // Sends a block of RGB565 pixels to the display.  Drivers that can send it in one transfer override this; the
+    // default goes through drawRGBBitmap(), which costs what drawing the pixels one by one would have.
+
+    virtual void PushRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t * pPixels)
+    {
+        drawRGBBitmap(x, y, pPixels, w, h);
+    }
+
     // Define the drawable area for the spectrum to render into the status area
 
     const int BottomMargin = 12;
@@ -151,6 +176,14 @@ public:
         {
             M5.Lcd.fillScreen(color);
         }
+
+        virtual void PushRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t * pPixels) override
+        {
+            bool bSwap = M5.Lcd.getSwapBytes();
+            M5.Lcd.setSwapBytes(true);                  // Our pixels are RGB565 in the CPU's byte order
+            M5.Lcd.pushImage(x, y, w, h, pPixels);
+            M5.Lcd.setSwapBytes(bSwap);
+        }
     };
 #endif
 
@@ -193,6 +226,14 @@ public:
         {
             tft.fillScreen(color);
         }
+
+        virtual void PushRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t * pPixels) override
+        {
+            bool bSwap = tft.getSwapBytes();
+            tft.setSwapBytes(true);                     // Our pixels are RGB565 in the CPU's byte order
+            tft.pushImage(x, y, w, h, pPixels);
+            tft.setSwapBytes(bSwap);
+        }
     };
 #endif
 
@@ -227,6 +268,12 @@ public:
         {
             oled.sendBuffer();
         }
+
+        virtual bool RetainsContent() const override
+        {
+            return false;                               // StartFrame() clears the buffer
+        }
+
         virtual void drawPixel(int16_t x, int16_t y, uint16_t color) override
         {
             oled.setDrawColor(color == BLACK16 ? 0  : 1);
@@ -431,6 +478,14 @@ public:
         {
             lgfx::LGFX_Device::fillScreen(color);
         }
+
+        virtual void PushRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t * pPixels) override
+        {
+            bool bSwap = lgfx::LGFX_Device::getSwapBytes();
+            lgfx::LGFX_Device::setSwapBytes(true);      // Our pixels are RGB565 in the CPU's byte order
+            lgfx::LGFX_Device::pushImage(x, y, w, h, pPixels);
+            lgfx::LGFX_Device::setSwapBytes(bSwap);
+        }
     };
 #endif
 
@@ -474,5 +529,10 @@ public:
             pLCD->fillRect(x, y, w, h, color);
         }
 
+        virtual void PushRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t * pPixels) override
+        {
+            pLCD->drawRGBBitmap(x, y, pPixels, w, h);   // Adafruit_SPITFT sends this as one window
+        }
+
     };
 #endif
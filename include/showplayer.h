@@ -0,0 +1,131 @@
+//+--------------------------------------------------------------------------
+//
+// File:        showplayer.h
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+// Description:
+//
+//    Plays a show of pre-rendered frames from a data partition, for
+//    installations that run the same show every night and would rather
+//    not keep a PC streaming it to them.
+//
+//    The partition (SHOW_PARTITION_LABEL) is memory mapped, and holds a
+//    ShowFileHeader followed by the frames.  Each frame is a ShowFrame
+//    record and then a zlib stream that expands to a PIXELDATA64 packet
+//    (a keyframe) or a PIXELDELTA64 packet (XORed against the frame before
+//    it on the same channels), exactly as the socket server would get
+//    them.  The player gives each packet its time in the show, anchored
+//    to the clock, and hands it to ProcessIncomingData, so the frames
+//    take the same path into the LEDBuffer rings and out to the strips
+//    as frames from a sender.  The show loops when it reaches its end.
+//
+//    tools/build_show.py turns raw RGB frames into a show, and parttool
+//    writes it to the partition.
+//
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#include <memory>
+#include <esp_partition.h>
+
+#include "globals.h"
+
+#if ENABLE_SHOW_PLAYBACK
+
+#if !INCOMING_WIFI_ENABLED
+    #error ENABLE_SHOW_PLAYBACK requires INCOMING_WIFI_ENABLED
+#endif
+
+#define SHOW_FILE_MAGIC     0x5753444E      // "NDSW", little-endian like everything else in the file
+#define SHOW_FILE_VERSION   1
+
+// ShowFileHeader
+//
+// The start of the partition.  All fields are little-endian.
+
+struct __attribute__((packed)) ShowFileHeader
+{
+    uint32_t Magic;                         // SHOW_FILE_MAGIC
+    uint16_t Version;                       // SHOW_FILE_VERSION
+    uint16_t Reserved;
+    uint32_t FrameCount;
+    uint64_t DurationMicros;                // Length of one pass through the show, which is when it starts again
+};
+
+// ShowFrame
+//
+// Comes before each frame's zlib stream; the next record follows straight after the stream
+
+struct __attribute__((packed)) ShowFrame
+{
+    uint64_t OffsetMicros;                  // When the frame is shown, from the start of the show
+    uint32_t CompressedSize;                // Bytes of zlib stream that follow
+    uint32_t ExpandedSize;                  // Bytes of the packet they expand to, header included
+};
+
+// ShowPlayer
+//
+// Walks the mapped show a frame at a time, keeping SHOW_PLAYBACK_LEAD seconds of frames in the rings ahead of the
+// draw loop so it can show each one on its very frame time.  A ring that can't hold that much holds the player up
+// instead, and a frame that still doesn't fit by the time it's due is dropped, along with the deltas after it on
+// its channels, as they'd be applied to the wrong frame, until the next keyframe.
+
+class ShowPlayer
+{
+    const uint8_t *             _pShow    = nullptr;        // The mapped partition
+    size_t                      _cbShow   = 0;
+    esp_partition_mmap_handle_t _hMapping = 0;
+    std::unique_ptr<uint8_t []> _pPacket;                   // Space for one expanded packet, plus one for uzlib
+    uint16_t                    _brokenChannels = 0;        // Channels waiting for a keyframe after a dropped frame
+
+    const ShowFileHeader & Header() const
+    {
+        return *reinterpret_cast<const ShowFileHeader *>(_pShow);
+    }
+
+    bool PlayFrame(const ShowFrame & frame, const uint8_t * pStream, double showStart);
+    bool AnyRingFull(uint16_t channel16) const;
+
+  public:
+
+    uint32_t _cFrames  = 0;                                 // Frames handed to the rings
+    uint32_t _cErrors  = 0;                                 // Frames that wouldn't expand or weren't taken
+    uint32_t _cPasses  = 0;                                 // Times through the whole show
+
+    ~ShowPlayer()
+    {
+        if (_pShow)
+            esp_partition_munmap(_hMapping);
+    }
+
+    // begin
+    //
+    // Maps the show partition and checks it holds a show, returning false if there's none to play
+
+    bool begin();
+
+    // PlaybackLoop
+    //
+    // Plays the show over and over, and only returns if it turns out to be damaged
+
+    void PlaybackLoop();
+};
+
+#endif
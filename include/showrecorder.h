@@ -0,0 +1,170 @@
+//+--------------------------------------------------------------------------
+//
+// File:        showrecorder.h
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+// Description:
+//
+//    Records the frames that come in over the network to the show
+//    partition, in the format ShowPlayer plays (see showplayer.h), so a
+//    show can be captured once from the streaming rig and then played
+//    on standalone units.
+//
+//    The producers only tell the recorder which ring slot they just
+//    committed, which costs no copy at all.  A low priority writer task
+//    copies the frame out of the slot later, checks the slot's generation
+//    to make sure the producer didn't start on another frame in it
+//    meanwhile, compresses it as a keyframe or a delta and writes it to
+//    flash a sector at a time.  Frames the writer can't keep up with are
+//    counted and left out rather than holding up the producers.
+//
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <esp_partition.h>
+#include <freertos/queue.h>
+
+#include "globals.h"
+#include "ledbuffer.h"
+
+#if ENABLE_SHOW_RECORDER
+
+#if ENABLE_SHOW_PLAYBACK
+    #error ENABLE_SHOW_RECORDER and ENABLE_SHOW_PLAYBACK both use the show partition, so build one or the other
+#endif
+
+extern "C"
+{
+    #include "uzlib/src/uzlib.h"
+}
+
+// ShowRecorder
+//
+// Start() and Stop() come from the web server, Tee() from the producers and everything else runs on the writer task
+
+class ShowRecorder
+{
+    static constexpr size_t kSectorSize = 4096;
+
+    // What a producer hands over for each frame: the slot, and its generation once the frame was committed
+    struct TeeEntry
+    {
+        const LEDBuffer * pBuffer;
+        uint32_t          generation;
+        uint8_t           iChannel;
+        int64_t           arrivalMicros;            // Clock time it came in, for frames without a timestamp of their own
+    };
+
+    enum class Command : uint8_t { None, Start, Stop };
+
+    QueueHandle_t               _queue    = nullptr;
+    std::atomic<bool>           _bRecording { false };
+    std::atomic<Command>        _command  { Command::None };
+
+    const esp_partition_t *     _pPartition = nullptr;
+    unique_free_array<uint8_t>  _pFirstSector;              // Held back until Stop(), as it starts with the header
+    unique_free_array<uint8_t>  _pSector;                   // The sector being filled
+    unique_free_array<uint8_t>  _pPacket;                   // The packet being built for the current frame
+    unique_free_array<CRGB>     _pPrevious;                 // The last frame of each channel, for the deltas
+    uint32_t                    _cChannelFrames[NUM_CHANNELS] = {};
+    uint32_t                    _channelLength[NUM_CHANNELS] = {};     // Pixels in each channel's previous frame
+    unique_free_array<uzlib_hash_entry_t> _pHashTable;
+    struct uzlib_comp           _comp = {};
+
+    size_t                      _offset         = 0;        // Where the next byte goes in the partition
+    int64_t                     _startMicros    = -1;       // Timestamp of the first frame, which the offsets count from
+    uint64_t                    _lastOffset     = 0;
+    uint64_t                    _lastGap        = 0;        // Between the last two distinct frame times, for the duration
+    bool                        _bFull          = false;    // Ran out of partition, by which time every sector is written
+
+    bool Append(const void * pData, size_t cbData);
+    bool FlushSector(size_t iSector, const uint8_t * pSector);
+    size_t Compress(const uint8_t * pData, size_t cbData);
+    void Begin();
+    void Finish();
+    void RecordFrame(const TeeEntry & entry);
+
+  public:
+
+    std::atomic<uint32_t> _cFrames  { 0 };                 // Frames written to flash this recording
+    std::atomic<uint32_t> _cDropped { 0 };                 // Frames the writer missed, or that didn't fit
+    std::atomic<size_t>   _cbWritten { 0 };
+
+    ShowRecorder()
+    {
+        _queue = xQueueCreate(SHOW_RECORD_QUEUE_LENGTH, sizeof(TeeEntry));
+    }
+
+    bool IsRecording() const
+    {
+        return _bRecording;
+    }
+
+    size_t Capacity() const
+    {
+        return _pPartition ? _pPartition->size : 0;
+    }
+
+    // Start and Stop
+    //
+    // Ask the writer to begin a new recording over whatever show is there, and to finish it.  Start() returns false
+    // if there is no show partition to record to.
+
+    bool Start();
+    void Stop();
+
+    // Tee
+    //
+    // Called by a producer right after it commits a frame to the channel's ring
+
+    void Tee(size_t iChannel, const LEDBuffer & buffer)
+    {
+        if (!_bRecording.load(std::memory_order_relaxed))
+            return;
+
+        TeeEntry entry = { &buffer, buffer.Generation(), (uint8_t) iChannel, (int64_t) (SyncedTime() * MICROS_PER_SECOND) };
+        if (xQueueSend(_queue, &entry, 0) != pdTRUE)
+            _cDropped++;
+    }
+
+    // TeeNewest
+    //
+    // Tees the frame the channel's ring was last given
+
+    void TeeNewest(size_t iChannel, const LEDBufferManager & bufferManager)
+    {
+        if (!_bRecording.load(std::memory_order_relaxed))
+            return;
+
+        auto pBuffer = bufferManager.PeekLastBufferAdded();
+        if (pBuffer)
+            Tee(iChannel, *pBuffer);
+    }
+
+    // WriterLoop
+    //
+    // Runs on the writer task, and never returns
+
+    void WriterLoop();
+};
+
+#endif
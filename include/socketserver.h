@@ -34,11 +34,15 @@
 #include <sys/socket.h>
 #include <stdlib.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <string.h>
 #include <memory>
 #include <iostream>
+#include <esp_heap_caps.h>
 
 #include "ledbuffer.h"
+#include "memoryplacement.h"
+#include "scratcharena.h"
 
 extern "C"
 {
@@ -55,13 +59,24 @@ extern "C"
 #define MAXIMUM_PACKET_SIZE (STANDARD_DATA_HEADER_SIZE + LED_DATA_SIZE * NUM_LEDS) // Header plus 24 bits per actual LED
 #define COMPRESSED_HEADER (0x44415645)                                              // asci "DAVE" as header
 
+// Streaming decompression keeps its back-reference window in a ring rather than in the output buffer.  An offset can
+// never reach further back than the start of the packet, so the ring never needs to be larger than a packet.
+
+#define SOCKET_INFLATE_DICT_SIZE    std::min<size_t>(32768, MAXIMUM_PACKET_SIZE)
+#define SOCKET_INFLATE_CHUNK_SIZE   512                                             // Compressed bytes read from the socket at a time
+#define SOCKET_READAHEAD_SIZE       2048                                            // Internal RAM read-ahead in front of the socket
+
 bool ProcessIncomingData(std::unique_ptr<uint8_t []> & payloadData, size_t payloadLength);
 
 #if INCOMING_WIFI_ENABLED
 
 // SocketResponse
 //
-// Response data sent back to server ever time we receive a packet
+// Response data sent back to server ever time we receive a packet.  The optional blocks go after the fixed part, in
+// the order of their bits, so a sender that doesn't know them can read size bytes and ignore the rest.
+
+#define SOCKET_RESPONSE_HAS_STATS     0x0001
+#define SOCKET_RESPONSE_HAS_FEEDBACK  0x0002
 struct SocketResponse
 {
     uint32_t    size;              // 4
@@ -75,6 +90,24 @@ struct SocketResponse
     uint32_t    bufferPos;         // 4
     uint32_t    fpsDrawing;        // 4
     uint32_t    watts;             // 4
+    uint32_t    radioProfile;      // 4  The WiFi radio profile, so the sender can pace itself; see RADIO_PROFILE_*
+    uint32_t    extensions;        // 4  Which of the blocks below follow, as SOCKET_RESPONSE_HAS_* bits; 0 before there were any
+#if SOCKET_RESPONSE_STATS
+    // The IngestStats counters, which run from boot and wrap; a sender that doesn't know them goes by size
+    uint32_t    framesReceived;    // 4
+    uint32_t    framesFull;        // 4  Dropped because the ring was full
+    uint32_t    framesStale;       // 4  Passed over because a newer frame was due
+    uint32_t    framesPresented;   // 4
+    uint32_t    decodeMicros;      // 4  Total spent expanding and parsing
+    uint32_t    latencyMicros;     // 4  Total the presented frames spent queued
+#endif
+#if SOCKET_RESPONSE_FEEDBACK
+    // The newest frame WiFiDraw presented, so a sender can pace itself on when its frames really go out
+    double      presentedTimestamp; // 8  The time that was on it
+    double      presentedDelta;    // 8  When it went out less that time, on our clock; queued time if untimed
+    uint32_t    frameMicros;       // 4  What the last frame took to render and send out
+    uint32_t    reserved2;         // 4  Keeps the size a multiple of 8
+#endif
 };
 
 static_assert(sizeof(double) == 8);             // SocketResponse on wire uses 8 byte floats
@@ -85,7 +118,7 @@ static_assert(sizeof(float)  == 4);             // PeakData on wire uses 4 byte
 // floats land on byte multiples of 8, otherwise you'll get packing bytes inserted.  Welcome to my world! Once upon
 // a time, I ported about a billion lines of x86 'pragma_pack(1)' code to the MIPS (davepl)!
 
-static_assert( sizeof(SocketResponse) == 64, "SocketResponse struct size is not what is expected - check alignment and float size" );
+static_assert( sizeof(SocketResponse) == 72 + (SOCKET_RESPONSE_STATS ? 24 : 0) + (SOCKET_RESPONSE_FEEDBACK ? 24 : 0), "SocketResponse struct size is not what is expected - check alignment and float size" );
 
 // SocketServer
 //
@@ -101,6 +134,15 @@ private:
     struct sockaddr_in          _address;
     std::unique_ptr<uint8_t []> _pBuffer;
     std::unique_ptr<uint8_t []> _abOutputBuffer;
+    std::unique_ptr<uint8_t []> _abInflateDict;
+    std::unique_ptr<uint8_t []> _abReadAhead;
+    #if USE_PSRAM && !SOCKET_STREAMING_INFLATE
+        ScratchArena            _scratch { MAXIMUM_PACKET_SIZE + 1, "socket scratch" };    // One packet's temporaries, +1 for uzlib
+    #endif
+    size_t                      _iReadAhead;
+    size_t                      _cbReadAhead;
+    unsigned long               _msLastResponse;
+    int                         _lastResponseZone;
 
 public:
 
@@ -110,15 +152,27 @@ public:
         _port(port),
         _numLeds(numLeds),
         _server_fd(-1),
+        _iReadAhead(0),
+        _cbReadAhead(0),
+        _msLastResponse(0),
+        _lastResponseZone(-1),
         _cbReceived(0)
     {
-        _abOutputBuffer.reset( psram_allocator<uint8_t>().allocate(MAXIMUM_PACKET_SIZE+1) );        // +1 for uzlib one byte overreach bug
+        _abOutputBuffer.reset( PlacedAlloc<uint8_t>(MAXIMUM_PACKET_SIZE+1, Placement::Hot, "socket output") );   // +1 for uzlib one byte overreach bug
+        _abReadAhead.reset( (uint8_t *) heap_caps_malloc(SOCKET_READAHEAD_SIZE, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT) );
+        #if SOCKET_STREAMING_INFLATE
+            // The dictionary is hit on every back-reference, so it stays in internal RAM even on PSRAM boards
+            _abInflateDict.reset( (uint8_t *) heap_caps_malloc(SOCKET_INFLATE_DICT_SIZE, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT) );
+        #endif
         memset(&_address, 0, sizeof(_address));
     }
 
     void release()
     {
         _pBuffer.reset();
+        #if USE_PSRAM && !SOCKET_STREAMING_INFLATE
+            _scratch.Release();
+        #endif
         if (_server_fd >= 0)
         {
             close(_server_fd);
@@ -128,7 +182,7 @@ public:
 
     bool begin()
     {
-        _pBuffer.reset( psram_allocator<uint8_t>().allocate(MAXIMUM_PACKET_SIZE) );
+        _pBuffer.reset( PlacedAlloc<uint8_t>(MAXIMUM_PACKET_SIZE, Placement::Cold, "socket receive") );
         _cbReceived = 0;
 
         // Creating socket file descriptor
@@ -177,6 +231,67 @@ public:
         _cbReceived = 0;
     }
 
+    // ShouldSendResponse
+    //
+    // With SOCKET_RESPONSE_INTERVAL at zero, every packet gets a SocketResponse like it always has.  Otherwise one goes
+    // out every SOCKET_RESPONSE_INTERVAL ms, or right away when the buffer depth moves across the low or high water
+    // mark, since that's when the sender actually needs to speed up or back off.
+
+    bool ShouldSendResponse(const LEDBufferManager & bufferManager)
+    {
+        #if SOCKET_RESPONSE_INTERVAL == 0
+            return true;
+        #else
+            size_t percentFull = bufferManager.Depth() * 100 / bufferManager.BufferCount();
+            int zone = percentFull < SOCKET_RESPONSE_LOW_WATER ? 0 : percentFull > SOCKET_RESPONSE_HIGH_WATER ? 2 : 1;
+            unsigned long now = millis();
+
+            if (zone == _lastResponseZone && now - _msLastResponse < SOCKET_RESPONSE_INTERVAL)
+                return false;
+
+            _lastResponseZone = zone;
+            _msLastResponse   = now;
+            return true;
+        #endif
+    }
+
+    // ResetReadAhead
+    //
+    // Throws away anything read ahead from the socket, for when the connection is closed or replaced
+
+    void ResetReadAhead()
+    {
+        _iReadAhead  = 0;
+        _cbReadAhead = 0;
+    }
+
+    // ReadSocket
+    //
+    // read() with a read-ahead buffer in front of it.  Small reads such as packet headers pull in as much as the
+    // socket has ready, so the start of the body (or the whole of the packets that follow it) doesn't need another
+    // trip into lwIP.  Reads at least as big as the buffer go straight to the destination once it's drained.
+
+    int ReadSocket(int socket, uint8_t * pDest, size_t cbMax)
+    {
+        if (_iReadAhead == _cbReadAhead)
+        {
+            if (!_abReadAhead || cbMax >= SOCKET_READAHEAD_SIZE)
+                return read(socket, pDest, cbMax);
+
+            int cbRead = read(socket, _abReadAhead.get(), SOCKET_READAHEAD_SIZE);
+            if (cbRead <= 0)
+                return cbRead;
+
+            _iReadAhead  = 0;
+            _cbReadAhead = cbRead;
+        }
+
+        size_t cbCopy = std::min(cbMax, _cbReadAhead - _iReadAhead);
+        memcpy(pDest, &_abReadAhead[_iReadAhead], cbCopy);
+        _iReadAhead += cbCopy;
+        return cbCopy;
+    }
+
     // ReadUntilNBytesReceived
     //
     // Read from the socket until the buffer contains at least cbNeeded bytes
@@ -204,7 +319,7 @@ public:
 
             // Read data from the socket until we have _bcNeeded bytes in the buffer
 
-            int cbRead = read(socket, (uint8_t *) _pBuffer.get() + _cbReceived, cbNeeded - _cbReceived);
+            int cbRead = ReadSocket(socket, (uint8_t *) _pBuffer.get() + _cbReceived, cbNeeded - _cbReceived);
 
             // Restore the old state
 
@@ -221,6 +336,39 @@ public:
         return true;
     }
 
+    // ReadIntoBuffer
+    //
+    // Read exactly cbNeeded bytes from the socket into an arbitrary destination, bypassing _pBuffer
+
+    bool ReadIntoBuffer(int socket, uint8_t * pDest, size_t cbNeeded)
+    {
+        size_t cbDone = 0;
+        while (cbDone < cbNeeded)
+        {
+            int cbRead = ReadSocket(socket, pDest + cbDone, cbNeeded - cbDone);
+            if (cbRead <= 0)
+            {
+                debugW("ERROR: %d bytes read in ReadIntoBuffer trying to read %d\n", cbRead, cbNeeded - cbDone);
+                return false;
+            }
+            cbDone += cbRead;
+        }
+        return true;
+    }
+
+    // ReceivePixelDataInPlace
+    //
+    // Zero-copy receive path for single-channel pixel packets.  Once the header has been parsed, the color data
+    // is read straight from the socket into the next free LEDBuffer slot of the channel's buffer manager.
+
+    bool ReceivePixelDataInPlace(int socket, size_t iChannel, uint32_t pixelCount, uint64_t seconds, uint64_t micros);
+
+    // ReceiveCompressedPacket
+    //
+    // Decompresses a compressed packet as it is read from the socket rather than after buffering all of it
+
+    bool ReceiveCompressedPacket(int socket, uint32_t compressedSize, uint32_t expandedSize);
+
     // ProcessIncomingConnectionsLoop
     //
     // Socket server main ProcessIncomingConnectionsLoop - accepts new connections and reads from them, dispatching
@@ -232,8 +380,10 @@ public:
     //
     // Use unzlib to decompress a memory buffer
 
-    bool DecompressBuffer(const uint8_t * pBuffer, size_t cBuffer, uint8_t * pOutput, size_t expectedOutputSize) const
+    static bool DecompressBuffer(const uint8_t * pBuffer, size_t cBuffer, uint8_t * pOutput, size_t expectedOutputSize)
     {
+        IngestStats::DecodeTimer timer(g_IngestStats);
+
         debugV("Compressed Data: %02X %02X %02X %02X...", pBuffer[0], pBuffer[1], pBuffer[2], pBuffer[3]);
 
         struct uzlib_uncomp d = { 0 };
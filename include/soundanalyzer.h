@@ -33,9 +33,21 @@
 
 #pragma once
 
-#include <arduinoFFT.h>
+#if !ENABLE_FLOAT_FFT
+    #include <arduinoFFT.h>
+#endif
+#include <atomic>
+#include <mutex>
 #include <driver/i2s.h>
 #include <driver/adc.h>
+#include "memoryplacement.h"
+#include "floatfft.h"
+#include "audiolatency.h"
+#include "deviceconfig.h"
+#include "governor.h"
+#if ENABLE_AUDIO_BENCHMARK
+    #include "storage.h"
+#endif
 // #include <driver/adc_deprecated.h>
 
 #define SUPERSAMPLES 1                                    // How many supersamples to take
@@ -104,16 +116,29 @@ void IRAM_ATTR AudioSerialTaskEntry(void *);
 #define VUDAMPENMIN 1 // How slowly VU min creeps up to test noise floor
 #define VUDAMPENMAX 1 // How slowly VU max drops down to test noise ceiling
 
+#ifndef ENVELOPE_ATTACK_MS
+    #define ENVELOPE_ATTACK_MS 10              // Time constant for a band envelope rising to meet its level
+#endif
+
+#ifndef ENVELOPE_RELEASE_MS
+    #define ENVELOPE_RELEASE_MS 300            // Time constant for a band envelope falling back
+#endif
+
+#ifndef SPECTROGRAM_INTERVAL_MS
+    #define SPECTROGRAM_INTERVAL_MS 50         // How much time each spectrogram row covers
+#endif
+
 // PeakData
 //
-// Keeps track of a set of peaks for a sample pass
+// Keeps track of a set of peaks for a sample pass.  The levels are kept as floats, which is all the precision a
+// 0-1 band level needs, and is also what arrives on the wire in WIFI_COMMAND_PEAKDATA.
 
 class PeakData
 {
 
 public:
 
-    double _Level[NUM_BANDS];
+    float _Level[NUM_BANDS];
 
 public:
     typedef enum
@@ -130,19 +155,30 @@ public:
             i = 0.0f;
     }
 
-    PeakData(double *pDoubles)
+    PeakData(const double *pDoubles)
     {
         SetData(pDoubles);
     }
 
-    PeakData &operator=(const PeakData &other)
+    PeakData(const PeakData &other) = default;
+    PeakData &operator=(const PeakData &other) = default;
+
+    // FromWire
+    //
+    // Builds a PeakData from the NUM_BANDS little endian floats that follow the header of a WIFI_COMMAND_PEAKDATA
+    // packet.  That's already our own layout, so it's a straight copy, and memcpy copes with the bands not being
+    // aligned in the packet buffer.
+
+    static PeakData FromWire(const uint8_t * pBands)
     {
-        for (int i = 0; i < NUM_BANDS; i++)
-            _Level[i] = other._Level[i];
-        return *this;
+        static_assert(sizeof(_Level) == NUM_BANDS * sizeof(float), "PeakData must match the wire layout");
+
+        PeakData peaks;
+        memcpy(peaks._Level, pBands, sizeof(peaks._Level));
+        return peaks;
     }
 
-    const float operator[](std::size_t n) const
+    float operator[](std::size_t n) const
     {
         return _Level[n];
     }
@@ -185,22 +221,159 @@ public:
     }
 };
 
+// BeatEvent
+//
+// An onset found by the analyzer's spectral flux detector
+
+struct BeatEvent
+{
+    unsigned long Timestamp = 0;                            // millis() when the onset was detected
+    float         Strength  = 0.0;                          // Flux over the threshold, so 1.0 only just cleared it
+    bool          Major     = false;                        // Most of the flux came from the bass bands
+};
+
+// AudioFeatures
+//
+// Derived measures of the music that the analyzer works out once per pass, so the effects don't each redo them
+// per frame.  Everything is normalized to 0-1.
+
+struct AudioFeatures
+{
+    static constexpr size_t kSpectrogramRows = 16;
+
+    float   Envelope[NUM_BANDS]  = {0};                     // Each band through a fast attack, slow release follower
+    float   RMS                  = 0.0;                     // Loudness of the raw samples, relative to full scale
+    float   Centroid             = 0.0;                     // Where the energy sits, from 0 for the lowest band to 1 for the highest
+    uint8_t Spectrogram[kSpectrogramRows][NUM_BANDS] = {};  // Loudest level of each band per SPECTROGRAM_INTERVAL_MS, 0-255
+    uint8_t SpectrogramHead      = 0;                       // Row holding the newest (still filling) interval
+
+    // Row n intervals back, 0 being the newest
+
+    const uint8_t * SpectrogramRow(size_t age) const
+    {
+        return Spectrogram[(SpectrogramHead + kSpectrogramRows - (age % kSpectrogramRows)) % kSpectrogramRows];
+    }
+};
+
+// AudioSnapshot
+//
+// Everything the effects read about the music for a frame, captured together at the end of each sampler pass so
+// that a band set never mixes two passes and always goes with the VU it was measured alongside.
+
+struct AudioSnapshot
+{
+    PeakData      Peaks;                                    // Raw peaks from the pass
+    float         Peak1Decay[NUM_BANDS]    = {0};           // Peaks decayed at _peak1DecayRate
+    float         Peak2Decay[NUM_BANDS]    = {0};           // Peaks decayed at _peak2DecayRate
+    unsigned long LastPeak1Time[NUM_BANDS] = {0};           // When each band last set a new Peak1Decay high
+    float         VU                       = 0.0;
+    float         PeakVU                   = MAX_VU;
+    float         MinVU                    = 0.0;
+    float         VURatio                  = 1.0;
+    float         VURatioFade              = 1.0;
+
+    // The last few beats, as a ring that every subscriber reads at its own pace.  Beat n lives in Beats[n % kBeatHistory]
+    // and BeatCount is the number of beats detected so far.
+
+    static constexpr size_t kBeatHistory = 8;
+    BeatEvent     Beats[kBeatHistory];
+    uint32_t      BeatCount                = 0;
+
+    AudioFeatures Features;
+
+    int64_t       CaptureMicros            = 0;             // When the middle of the pass's samples was heard, by esp_timer
+
+    // BeatInterval
+    //
+    // The time between the last few beats if they've come steadily, or 0 if there's no tempo to go on
+
+    uint32_t BeatInterval() const
+    {
+        constexpr uint32_t kIntervals = 3;
+        if (BeatCount <= kIntervals)
+            return 0;
+
+        uint32_t shortest = UINT32_MAX, longest = 0, total = 0;
+        for (uint32_t i = 0; i < kIntervals; i++)
+        {
+            uint32_t interval = Beats[(BeatCount - 1 - i) % kBeatHistory].Timestamp - Beats[(BeatCount - 2 - i) % kBeatHistory].Timestamp;
+            shortest = std::min(shortest, interval);
+            longest  = std::max(longest, interval);
+            total   += interval;
+        }
+
+        return shortest && longest * 4 < shortest * 5 ? total / kIntervals : 0;
+    }
+
+    // Same as SoundAnalyzer::BeatEnhance, but against the VU captured here
+
+    float BeatEnhance(float amt) const
+    {
+        return ((1.0 - amt) + (VURatioFade / 2.0) * amt);
+    }
+};
+
 // SoundAnalyzer
 //
 // The SoundAnalyzer class uses I2S to read samples from the microphone and then runs an FFT on the
 // results to generate the peaks in each band, as well as tracking an overall VU and VU ratio, the
 // latter being the ratio of the current VU to the trailing min and max VU.
 
+// AudioProfile
+//
+// How the analyzer trades latency and CPU for frequency resolution.  The profile is a DeviceConfig setting, so it
+// can be tuned per installation; the sample rate stays put because the I2S setup and the band table are built for it.
+
+struct AudioProfile
+{
+    const char * Name;
+    int          WindowSamples;                             // FFT size, a power of two no bigger than kMaxWindowSamples
+    int          LowestFrequency;                           // Bins below this don't feed any band
+};
+
 class SoundAnalyzer : public AudioVariables
 {
-    static const size_t MAX_SAMPLES = 256;
+  public:
+
+    static constexpr size_t kMaxWindowSamples = 512;        // Buffers and FFT tables are sized for the largest profile
+
+    static constexpr AudioProfile kProfiles[] =
+    {
+        { "Low latency",    128, 80 },                      // Under half the FFT work and half the wait for a window
+        { "Balanced",       256, 40 },                      // What the analyzer always used to do
+        { "High res bass",  512, 20 },                      // Twice the bins for the low bands, at twice the latency
+    };
+    static constexpr int kProfileCount   = sizeof(kProfiles) / sizeof(kProfiles[0]);
+
+    static_assert(AUDIO_PROFILE_MIN == 0 && AUDIO_PROFILE_MAX == kProfileCount - 1, "The device config's audio profile range doesn't match kProfiles");
+
+  private:
+
     std::unique_ptr<uint16_t[]> ptrSampleBuffer;
 
+    int _profile         = AUDIO_PROFILE_DEFAULT;
+    int _windowSamples   = kProfiles[AUDIO_PROFILE_DEFAULT].WindowSamples;
+    int _lowestFrequency = kProfiles[AUDIO_PROFILE_DEFAULT].LowestFrequency;
+
+    // When streaming, each pass reads only half a window of new samples and slides the window along, so the FFT sees
+    // 50% overlapped windows at twice the rate.  The DMA buffers are then a hop of the default profile long, with
+    // enough of them queued that the I2S driver keeps filling one while we analyze the last.
+
+    int _hopSamples      = _windowSamples / 2;
+
+    #if ENABLE_AUDIO_STREAMING
+        static constexpr int kDmaBufferLength = kProfiles[AUDIO_PROFILE_DEFAULT].WindowSamples / 2;
+        static constexpr int kDmaBufferCount  = 4;
+        bool _bStreamStarted = false;
+    #else
+        static constexpr int kDmaBufferLength = kProfiles[AUDIO_PROFILE_DEFAULT].WindowSamples;
+        static constexpr int kDmaBufferCount  = 2;
+    #endif
+
     // I'm old enough I can only hear up to about 12K, but feel free to adjust.  Remember from
     // school that you need to sample at double the frequency you want to process, so 24000 is 12K
 
     static const size_t SAMPLING_FREQUENCY = 20000;
-    static const size_t LOWEST_FREQ = 40;
     static const size_t HIGHEST_FREQ = SAMPLING_FREQUENCY / 2;
 
     static const size_t _sampling_period_us = PERIOD_FROM_FREQ(SAMPLING_FREQUENCY);
@@ -213,6 +386,24 @@ class SoundAnalyzer : public AudioVariables
 
     PeakData::MicrophoneType _MicMode = PeakData::M5;
 
+    // Worked out once from the band cutoffs so the peak pass doesn't have to
+
+    int8_t   _binBand[kMaxWindowSamples / 2];               // Band each FFT bin feeds, or -1 if it's below _lowestFrequency
+    int      _bandHits[NUM_BANDS];                          // How many bins feed each band
+    float    _bandScale[NUM_BANDS];                         // Mic scalar over the hit count, for averaging each band
+    PeakData::MicrophoneType _bandScaleMic;                 // Mic the scales were last worked out for
+
+    // UpdateBandScales
+    //
+    // Folds the current mic's band scalars into the per-band averaging reciprocals
+
+    void UpdateBandScales()
+    {
+        for (int i = 0; i < NUM_BANDS; i++)
+            _bandScale[i] = PeakData::GetBandScalar(_MicMode, i) / std::max(1, _bandHits[i]);
+        _bandScaleMic = _MicMode;
+    }
+
     // GetBandIndex
     //
     // Given a frequency, returns the index of the band that frequency belongs to
@@ -233,13 +424,20 @@ class SoundAnalyzer : public AudioVariables
     
     float GetBucketFrequency(int bin_index)
     {
-        float bin_width = SAMPLING_FREQUENCY / (MAX_SAMPLES / 2);
+        float bin_width = SAMPLING_FREQUENCY / (_windowSamples / 2);
         float frequency = bin_width * bin_index;
         return frequency;
     }
 
-    double * _vReal;
-    double * _vImaginary;
+    #if ENABLE_FLOAT_FFT
+        typedef float FFTValue;
+        FloatFFT<kMaxWindowSamples> _FFT;
+    #else
+        typedef double FFTValue;
+    #endif
+
+    FFTValue * _vReal;
+    FFTValue * _vImaginary;
 
     // SampleBuffer::Reset
     //
@@ -247,7 +445,7 @@ class SoundAnalyzer : public AudioVariables
 
     void Reset()
     {
-        for (int i = 0; i < MAX_SAMPLES; i++)
+        for (int i = 0; i < _windowSamples; i++)
         {
             _vReal[i] = 0.0;
             _vImaginary[i] = 0.0f;
@@ -258,22 +456,190 @@ class SoundAnalyzer : public AudioVariables
 
     // SampleBuffer::FFT
     //
-    // Run the FFT on the sample buffer.  When done the first two buckets are VU data and only the first MAX_SAMPLES/2
+    // Run the FFT on the sample buffer.  When done the first two buckets are VU data and only the first _windowSamples/2
     // are valid.  For each bucket afterwards you can call BucketFrequency to find out what freq corresponds to what bucket
 
     void FFT()
     {
-        arduinoFFT _FFT(_vReal, _vImaginary, MAX_SAMPLES, SAMPLING_FREQUENCY);
-        _FFT.DCRemoval();
-        _FFT.Windowing(FFT_WIN_TYP_HAMMING, FFT_FORWARD);
-        _FFT.Compute(FFT_FORWARD);
-        _FFT.ComplexToMagnitude();
-        _FFT.MajorPeak();
+        #if ENABLE_FLOAT_FFT
+            _FFT.Magnitudes(_vReal, _vImaginary);
+        #else
+            arduinoFFT _FFT(_vReal, _vImaginary, _windowSamples, SAMPLING_FREQUENCY);
+            _FFT.DCRemoval();
+            _FFT.Windowing(FFT_WIN_TYP_HAMMING, FFT_FORWARD);
+            _FFT.Compute(FFT_FORWARD);
+            _FFT.ComplexToMagnitude();
+        #endif
     }
 
+    #if ENABLE_AUDIO_BENCHMARK
+
+    // Benchmark mode
+    //
+    // Samples come from a fixture instead of the mic, so that a run is repeatable and two builds can be compared.
+    // Every pass during the first time through the fixture prints its bands, which can be diffed against a baseline
+    // run, and every AUDIO_BENCHMARK_REPORT_PASSES passes each stage's average and worst cycle counts are printed.
+
+    enum BenchmarkStage { BenchFill, BenchFFT, BenchPeaks, BenchFeatures, BenchOnsets, BenchStageCount };
+
+    std::unique_ptr<uint16_t[]> _fixture;
+    size_t   _cFixture            = 0;
+    size_t   _fixturePos          = 0;
+    bool     _bFixtureWrapped     = false;
+    uint32_t _benchPass           = 0;
+    uint32_t _benchStart          = 0;
+    uint64_t _benchCycles[BenchStageCount] = {0};
+    uint32_t _benchMax[BenchStageCount]    = {0};
+
+    void BenchmarkBegin()
+    {
+        _benchStart = ESP.getCycleCount();
+    }
+
+    void BenchmarkEnd(BenchmarkStage stage)
+    {
+        uint32_t cycles = ESP.getCycleCount() - _benchStart;
+        _benchCycles[stage] += cycles;
+        _benchMax[stage] = std::max(_benchMax[stage], cycles);
+    }
+
+    // LoadFixture
+    //
+    // Reads the fixture from the file system as raw 16-bit little endian samples at SAMPLING_FREQUENCY.  Without one we make
+    // two seconds of a fixed test signal: three tones, a decaying 60Hz kick twice a second, and a little noise from
+    // a seeded generator, all sitting on the ADC's midpoint like the mic does.
+
+    void LoadFixture()
+    {
+        File file = FILESYSTEM.open(AUDIO_BENCHMARK_FIXTURE);
+        if (file && file.size() >= kMaxWindowSamples * sizeof(uint16_t))
+        {
+            _cFixture = file.size() / sizeof(uint16_t);
+            _fixture  = make_unique_psram_array<uint16_t>(_cFixture);
+            file.read((uint8_t *)_fixture.get(), _cFixture * sizeof(uint16_t));
+            file.close();
+            debugI("Audio benchmark using %zu samples from %s", _cFixture, AUDIO_BENCHMARK_FIXTURE);
+            return;
+        }
+
+        _cFixture = SAMPLING_FREQUENCY * 2;
+        _fixture  = make_unique_psram_array<uint16_t>(_cFixture);
+
+        uint32_t seed = 12345;
+        for (size_t i = 0; i < _cFixture; i++)
+        {
+            float t    = (float) i / SAMPLING_FREQUENCY;
+            float beat = fmodf(t, 0.5f);
+            float v    = 0.25f * sinf(2 * PI * 110 * t)
+                       + 0.15f * sinf(2 * PI * 880 * t)
+                       + 0.10f * sinf(2 * PI * 3520 * t)
+                       + 0.40f * expf(-beat * 30) * sinf(2 * PI * 60 * beat);
+
+            seed = seed * 1664525 + 1013904223;
+            v += 0.05f * ((seed >> 16) / 32768.0f - 1.0f);
+
+            _fixture[i] = std::clamp((int)(MAX_VU + v * MAX_VU * 0.5f), 0, MAX_ANALOG_IN - 1);
+        }
+        debugI("Audio benchmark using the built-in test signal");
+    }
+
+    // FillBufferI2S
+    //
+    // Stands in for the mic read, taking the next window (or hop, when streaming) from the fixture
+
+    void FillBufferI2S()
+    {
+        if (!_fixture)
+            LoadFixture();
+
+        #if ENABLE_AUDIO_STREAMING
+            size_t cNew = _hopSamples;
+            memmove(ptrSampleBuffer.get(), ptrSampleBuffer.get() + _hopSamples, (_windowSamples - _hopSamples) * sizeof(ptrSampleBuffer[0]));
+        #else
+            size_t cNew = _windowSamples;
+        #endif
+
+        for (size_t i = _windowSamples - cNew; i < _windowSamples; i++)
+        {
+            ptrSampleBuffer[i] = _fixture[_fixturePos];
+            if (++_fixturePos == _cFixture)
+            {
+                _fixturePos = 0;
+                _bFixtureWrapped = true;
+            }
+        }
+
+        for (int i = 0; i < _windowSamples; i++)
+            _vReal[i] = ptrSampleBuffer[i];
+    }
+
+    // BenchmarkReport
+    //
+    // Lines start with AUDIOBENCH so they can be grepped out of the serial log.  B lines are a pass's bands and C
+    // lines are a stage's average and max cycles over the last report interval.
+
+    void BenchmarkReport()
+    {
+        if (!_bFixtureWrapped)
+        {
+            Serial.printf("AUDIOBENCH,B,%u", _benchPass);
+            for (int i = 0; i < NUM_BANDS; i++)
+                Serial.printf(",%0.4f", _Peaks[i]);
+            Serial.printf(",%0.2f\n", _VU);
+        }
+
+        if (++_benchPass % AUDIO_BENCHMARK_REPORT_PASSES == 0)
+        {
+            static const char * const kStageNames[BenchStageCount] = { "Fill", "FFT", "Peaks", "Features", "Onsets" };
+
+            for (int i = 0; i < BenchStageCount; i++)
+            {
+                Serial.printf("AUDIOBENCH,C,%s,%llu,%u\n", kStageNames[i], _benchCycles[i] / AUDIO_BENCHMARK_REPORT_PASSES, _benchMax[i]);
+                _benchCycles[i] = 0;
+                _benchMax[i] = 0;
+            }
+        }
+    }
+
+    #elif ENABLE_AUDIO_STREAMING
+
+    // FillBufferI2S
+    //
+    // Slides the sample window along by a hop and reads the new samples into its end.  The ADC is left running
+    // from the first read on so the DMA buffers keep filling between passes.
+
+    void FillBufferI2S()
+    {
+        const auto bytesExpected = _hopSamples * sizeof(ptrSampleBuffer[0]);
+        uint16_t * pNewSamples = ptrSampleBuffer.get() + (_windowSamples - _hopSamples);
+
+        memmove(ptrSampleBuffer.get(), ptrSampleBuffer.get() + _hopSamples, (_windowSamples - _hopSamples) * sizeof(ptrSampleBuffer[0]));
+
+        size_t bytesRead = 0;
+
+        #if M5STICKC || M5STICKCPLUS || M5STACKCORE2 || ELECROW
+            ESP_ERROR_CHECK(i2s_read(I2S_NUM_0, (void *) pNewSamples, bytesExpected, &bytesRead, (100 / portTICK_RATE_MS)));
+        #else
+            if (!_bStreamStarted)
+            {
+                ESP_ERROR_CHECK(i2s_adc_enable(EXAMPLE_I2S_NUM));
+                _bStreamStarted = true;
+            }
+            ESP_ERROR_CHECK(i2s_read(EXAMPLE_I2S_NUM, (void *) pNewSamples, bytesExpected, &bytesRead, (100 / portTICK_RATE_MS)));
+        #endif
+
+        if (bytesRead != bytesExpected)
+            debugW("Could only read %u bytes of %u in FillBufferI2S()\n", bytesRead, bytesExpected);
+
+        for (int i = 0; i < _windowSamples; i++)
+            _vReal[i] = ptrSampleBuffer[i];
+    }
+
+    #else
+
     void FillBufferI2S()
     {
-        constexpr auto bytesExpected = MAX_SAMPLES * sizeof(ptrSampleBuffer[0]);
+        const auto bytesExpected = _windowSamples * sizeof(ptrSampleBuffer[0]);
 
         size_t bytesRead = 0;
 
@@ -291,10 +657,22 @@ class SoundAnalyzer : public AudioVariables
             return;
         }
 
-        for (int i = 0; i < MAX_SAMPLES; i++)
+        for (int i = 0; i < _windowSamples; i++)
             _vReal[i] = ptrSampleBuffer[i];
     }
 
+    #endif
+
+    // Stage timing for benchmark mode, which vanishes otherwise
+
+    #if ENABLE_AUDIO_BENCHMARK
+        #define AUDIO_BENCHMARK_BEGIN()         BenchmarkBegin()
+        #define AUDIO_BENCHMARK_END(stage)      BenchmarkEnd(stage)
+    #else
+        #define AUDIO_BENCHMARK_BEGIN()
+        #define AUDIO_BENCHMARK_END(stage)
+    #endif
+
     // UpdateVU
     //
     // This function is responsible for updating the Volume Unit (VU) values: the current VU (_VU),
@@ -349,34 +727,31 @@ class SoundAnalyzer : public AudioVariables
 
         double averageSum = 0.0f;
 
-        int hitCount[NUM_BANDS] = {0};
         for (int i = 0; i < NUM_BANDS; i++)
             _vPeaks[i] = 0.0f;
 
-        for (int i = 2; i < MAX_SAMPLES / 2; i++)
+        // Track the average and total up each band, using the bin to band map that CalculateBandCutoffs built
+
+        for (int i = 2; i < _windowSamples / 2; i++)
         {
-            int freq = GetBucketFrequency(i-2);
-            if (freq >= LOWEST_FREQ)
+            int iBand = _binBand[i];
+            if (iBand >= 0)
             {
-                // Track the average and the peak value
-
                 averageSum += _vReal[i];
-
-                // If it's above the noise floor, figure out which band this belongs to and
-                // if it's a new peak for that band, record that fact
-
-                int iBand = GetBandIndex(freq);
                 _vPeaks[iBand] += _vReal[i];
-                hitCount[iBand]++;
             }
         }
 
+        // The mic can change as we go, so make sure its scalars are the ones folded in
+
+        if (_bandScaleMic != _MicMode)
+            UpdateBandScales();
+
         // Noise gate - if the signal in this band is below a threshold we define, then we say there's no energy in this band
 
         for (int i = 0; i < NUM_BANDS; i++)
         {
-            _vPeaks[i] /= std::max(1, hitCount[i]);                       // max to avoid div by zero error
-            _vPeaks[i] *= PeakData::GetBandScalar(_MicMode, i);
+            _vPeaks[i] *= _bandScale[i];                                  // Average and apply the mic's band scalar in one step
             if (_vPeaks[i] < NOISE_CUTOFF)
                 _vPeaks[i] = 0.0f;
         }
@@ -408,13 +783,19 @@ class SoundAnalyzer : public AudioVariables
         allBandsPeak = std::max((double)NOISE_FLOOR, allBandsPeak);
         debugV("All Bands Peak: %f", allBandsPeak);
 
+        #if ENABLE_ONSET_DETECTION
+            // The onset detector wants the absolute levels, log compressed so a change is judged relative to the level
+            for (int i = 0; i < NUM_BANDS; i++)
+                _onsetLevel[i] = log1pf(_vPeaks[i] / std::max((double)NOISE_FLOOR, 1.0));
+        #endif
+
         // Normalize all the bands relative to allBandsPeak
         for (int i = 0; i < NUM_BANDS; i++)
             _vPeaks[i] /= allBandsPeak;
 
         // We'll use the average as the gVU.  I assume the average of the samples tracks sound pressure level, but don't really know...
 
-        float newval = averageSum / (MAX_SAMPLES / 2 - 2);
+        float newval = averageSum / (_windowSamples / 2 - 2);
         debugV("AverageSum : %f", averageSum);
         debugV("Newval     : %f", newval);
 
@@ -422,8 +803,7 @@ class SoundAnalyzer : public AudioVariables
 
         EVERY_N_MILLISECONDS(100)
         {
-            auto peaks = GetPeakData();
-            debugV("Audio Data -- Sum: %0.2f, _MinVU: %f0.2, _PeakVU: %f0.2, _VU: %f, Peak0: %f, Peak1: %f, Peak2: %f, Peak3: %f", averageSum, _MinVU, _PeakVU, _VU, peaks[0], peaks[1], peaks[2], peaks[3]);
+            debugV("Audio Data -- Sum: %0.2f, _MinVU: %f0.2, _PeakVU: %f0.2, _VU: %f, Peak0: %f, Peak1: %f, Peak2: %f, Peak3: %f", averageSum, _MinVU, _PeakVU, _VU, _vPeaks[0], _vPeaks[1], _vPeaks[2], _vPeaks[3]);
         }
 
         return PeakData(_vPeaks);
@@ -449,7 +829,7 @@ class SoundAnalyzer : public AudioVariables
             // and ending with a frequency of 12.5 kHz. The spacing ratio r is calculated as the 11th root of the ratio of the maximum
             // frequency to the minimum frequency, and each upper frequency is calculated as f1 * r^(i+1).
 
-            float f1 = LOWEST_FREQ;
+            float f1 = _lowestFrequency;
             float f2 = HIGHEST_FREQ;
             float r = pow(f2 / f1, 1.0 / (NUM_BANDS - 1));
             for (int i = 0; i < NUM_BANDS; i++)
@@ -458,24 +838,219 @@ class SoundAnalyzer : public AudioVariables
                 debugV("BAND %d: %d\n", i, _cutOffsBand[i]);
             }
         }
+
+        // Now that the cutoffs are known, work out which band each bin lands in and how many land in each band
+
+        for (int i = 0; i < NUM_BANDS; i++)
+            _bandHits[i] = 0;
+
+        for (int i = 0; i < _windowSamples / 2; i++)
+        {
+            int freq = GetBucketFrequency(i - 2);
+            if (i < 2 || freq < _lowestFrequency)
+            {
+                _binBand[i] = -1;
+                continue;
+            }
+            _binBand[i] = GetBandIndex(freq);
+            _bandHits[_binBand[i]]++;
+        }
+
+        UpdateBandScales();
     }
 
-public:
+    PeakData _Peaks;                    // The peak data for the last sample pass, owned by the audio task
+
+    // Remote peaks arrive on the network task.  They're parked here and picked up by the next sampler pass, so that
+    // the audio task stays the only writer of everything it publishes.
 
-    PeakData _Peaks;                    // The peak data for the last sample pass
+    PeakData   _remotePeaks;
+    int64_t    _remoteCaptureMicros = 0;
+    std::mutex _remotePeaksMutex;
+
+    int64_t    _captureMicros = 0;      // When the samples of the last pass were heard
+
+    // Beats found by another node's analyzer arrive the same way.  Once a sender has shown it sends beats, we take
+    // its beats in place of our own detection until its peaks stop coming, so the whole installation flashes together.
+
+    static constexpr size_t kRemoteBeatQueue = 4;
+    BeatEvent  _remoteBeats[kRemoteBeatQueue];
+    size_t     _cRemoteBeats  = 0;
+    bool       _bRemoteBeats  = false;
+
+    // The snapshot is written only by the audio task and read by the effects as they draw on the other core.  Readers
+    // copy it under a sequence count and retry if a write overlapped, so drawing never blocks on audio.
+
+    AudioSnapshot         _snapshot;
+    std::atomic<uint32_t> _snapshotSequence { 0 };          // Odd while _snapshot is being written
+
+#if ENABLE_EFFECT_REPLAY
+    std::atomic<const AudioSnapshot *> _pReplaySnapshot { nullptr };  // Played back in place of the live one
+    std::atomic<TaskHandle_t>          _replayTask { nullptr };       // The task drawing the replay, the only one that sees it
+#endif
+
+#if ENABLE_AUDIO_LATENCY
+    // The levels of the last few passes and when each was heard, kept with the snapshot so a frame can be given the
+    // levels for when it will be seen rather than for when the newest pass was heard
+
+    struct TimedLevels
+    {
+        int64_t  CaptureMicros = 0;
+        PeakData Peaks;
+        float    VU = 0.0f;
+    };
+
+    static constexpr size_t kLevelHistory = 8;
+    TimedLevels _levels[kLevelHistory];
+    uint32_t    _cLevels = 0;           // Passes kept so far; pass n is in _levels[n % kLevelHistory]
+#endif
+
+#if ENABLE_AUDIO_FEATURES
+
+    AudioFeatures _features;                                // Built up by the audio task, published with the snapshot
+    unsigned long _msLastFeatures       = 0;
+    unsigned long _msSpectrogramRow     = 0;
+
+    // ComputeRMS
+    //
+    // Loudness of the samples just read, with the DC offset the ADC sits at taken out.  Has to run before the FFT,
+    // which works in place.
+
+    void ComputeRMS()
+    {
+        FFTValue sum = 0, sumSquares = 0;
+        for (int i = 0; i < _windowSamples; i++)
+        {
+            sum += _vReal[i];
+            sumSquares += _vReal[i] * _vReal[i];
+        }
+
+        FFTValue mean = sum / _windowSamples;
+        FFTValue variance = std::max((FFTValue) 0, sumSquares / _windowSamples - mean * mean);
+        _features.RMS = std::min(1.0f, (float) sqrt(variance) / (float) MAX_VU);
+    }
+
+    // UpdateFeatures
+    //
+    // Runs the band envelopes, centroid and spectrogram forward from the peaks of this pass.  The envelope
+    // coefficients come from the actual time since the last pass, so they hold whatever rate the sampler runs at.
+
+    void UpdateFeatures()
+    {
+        auto now = millis();
+        float dt = std::min(now - _msLastFeatures, 1000UL);
+        _msLastFeatures = now;
+
+        float attack  = 1.0f - expf(-dt / ENVELOPE_ATTACK_MS);
+        float release = 1.0f - expf(-dt / ENVELOPE_RELEASE_MS);
+
+        float weighted = 0.0f, total = 0.0f;
+
+        if (now - _msSpectrogramRow >= SPECTROGRAM_INTERVAL_MS)
+        {
+            _msSpectrogramRow = now;
+            _features.SpectrogramHead = (_features.SpectrogramHead + 1) % AudioFeatures::kSpectrogramRows;
+            std::fill(std::begin(_features.Spectrogram[_features.SpectrogramHead]), std::end(_features.Spectrogram[_features.SpectrogramHead]), 0);
+        }
+        auto row = _features.Spectrogram[_features.SpectrogramHead];
+
+        for (int i = 0; i < NUM_BANDS; i++)
+        {
+            float level = std::min(1.0f, _Peaks[i]);
+            float & envelope = _features.Envelope[i];
+            envelope += (level > envelope ? attack : release) * (level - envelope);
+
+            weighted += level * i;
+            total += level;
+
+            row[i] = std::max(row[i], (uint8_t)(level * 255));
+        }
+
+        _features.Centroid = total > 0.0f ? weighted / (total * (NUM_BANDS - 1)) : 0.0f;
+    }
+
+#endif
+
+#if ENABLE_ONSET_DETECTION
+
+    // Onset detection state, all owned by the audio task
+
+    float         _onsetLevel[NUM_BANDS]    = {0};          // Compressed band levels from this pass
+    float         _onsetPrevious[NUM_BANDS] = {0};          // ...and from the pass before
+    float         _fluxMean                 = 0.0f;         // Running mean and variance of the flux
+    float         _fluxVariance             = 0.0f;
+    unsigned long _msLastOnset              = 0;
+    BeatEvent     _beats[AudioSnapshot::kBeatHistory];
+    uint32_t      _beatCount                = 0;
+
+    // DetectOnsets
+    //
+    // Spectral flux is how much the bands rose since the last pass, summed over the bands, with falls ignored.  An
+    // onset is a pass whose flux stands out from the running statistics of recent passes, so the threshold follows
+    // the music instead of being a fixed level.  The bass bands count double because that's where the beat is.
+
+    void DetectOnsets()
+    {
+        constexpr float kFluxAlpha = 1.0f / 64.0f;          // Roughly a second of history at the sampling rate
+        constexpr int   kBassBands = NUM_BANDS / 4;
+
+        float flux = 0.0f;
+        float bassFlux = 0.0f;
+
+        for (int i = 0; i < NUM_BANDS; i++)
+        {
+            float rise = _onsetLevel[i] - _onsetPrevious[i];
+            _onsetPrevious[i] = _onsetLevel[i];
+            if (rise <= 0.0f)
+                continue;
+
+            if (i < kBassBands)
+            {
+                bassFlux += rise * 2.0f;
+                flux += rise * 2.0f;
+            }
+            else
+            {
+                flux += rise;
+            }
+        }
+
+        float threshold = std::max(_fluxMean + ONSET_THRESHOLD_SIGMAS * sqrtf(_fluxVariance), ONSET_MIN_FLUX);
+        auto now = millis();
+
+        if (flux > threshold && now - _msLastOnset >= ONSET_MIN_INTERVAL_MS)
+        {
+            auto & beat = _beats[_beatCount % AudioSnapshot::kBeatHistory];
+            beat.Timestamp = now;
+            beat.Strength  = flux / threshold;
+            beat.Major     = bassFlux * 2.0f > flux;
+            _beatCount++;
+            _msLastOnset = now;
+
+            debugV("Onset: flux %0.2f, threshold %0.2f, major %d", flux, threshold, beat.Major);
+        }
+
+        float delta = flux - _fluxMean;
+        _fluxMean += kFluxAlpha * delta;
+        _fluxVariance = (1.0f - kFluxAlpha) * (_fluxVariance + kFluxAlpha * delta * delta);
+    }
+
+#endif
+
+public:
 
     SoundAnalyzer()
     {
-        ptrSampleBuffer = make_unique_psram_array<uint16_t>(MAX_SAMPLES);
-        _vReal      = (double *)PreferPSRAMAlloc(MAX_SAMPLES * sizeof(_vReal[0]));
-        _vImaginary = (double *)PreferPSRAMAlloc(MAX_SAMPLES * sizeof(_vImaginary[0]));
-        _vPeaks     = (double *)PreferPSRAMAlloc(NUM_BANDS  * sizeof(_vPeaks[0]));
+        ptrSampleBuffer = make_unique_psram_array<uint16_t>(kMaxWindowSamples);
+        _vReal      = PlacedAlloc<FFTValue>(kMaxWindowSamples, Placement::Hot, "fft real");
+        _vImaginary = PlacedAlloc<FFTValue>(kMaxWindowSamples, Placement::Hot, "fft imaginary");
+        _vPeaks     = PlacedAlloc<double>(NUM_BANDS, Placement::Hot, "audio peaks");
 
         _oldVU = 0.0f;
         _oldPeakVU = 0.0f;
         _oldMinVU = 0.0f;
 
-        CalculateBandCutoffs(LOWEST_FREQ, SAMPLING_FREQUENCY / 2.0);
+        ApplyProfile();
         Reset();
     }
 
@@ -518,8 +1093,8 @@ public:
             .channel_format = I2S_CHANNEL_FMT_ONLY_RIGHT,  // Set the channel format.
             .communication_format = I2S_COMM_FORMAT_STAND_I2S,  // Set the format of the communication.
             .intr_alloc_flags = ESP_INTR_FLAG_LEVEL1,  // Set the interrupt flag.
-            .dma_buf_count = 2,        // DMA buffer count.
-            .dma_buf_len = 256,        // DMA buffer length.
+            .dma_buf_count = kDmaBufferCount,  // DMA buffer count.
+            .dma_buf_len = kDmaBufferLength,   // DMA buffer length.
         };
 
         err += i2s_driver_install(Speak_I2S_NUMBER, &i2s_config, 0, NULL);
@@ -543,8 +1118,8 @@ public:
             .channel_format = I2S_CHANNEL_FMT_ALL_RIGHT,
             .communication_format = I2S_COMM_FORMAT_STAND_I2S, // Set the format of the communication.
             .intr_alloc_flags = ESP_INTR_FLAG_LEVEL1,
-            .dma_buf_count = 2,
-            .dma_buf_len = 256,
+            .dma_buf_count = kDmaBufferCount,
+            .dma_buf_len = kDmaBufferLength,
         };
 
         i2s_pin_config_t pin_config;
@@ -568,8 +1143,8 @@ public:
                 .channel_format = I2S_CHANNEL_FMT_ONLY_LEFT,
                 .communication_format = I2S_COMM_FORMAT_STAND_I2S,
                 .intr_alloc_flags = ESP_INTR_FLAG_LEVEL1,
-                .dma_buf_count = 2,
-                .dma_buf_len = (int) MAX_SAMPLES,
+                .dma_buf_count = kDmaBufferCount,
+                .dma_buf_len = kDmaBufferLength,
                 .use_apll = false
             };
 
@@ -590,13 +1165,13 @@ public:
         i2s_config_t i2s_config;
         i2s_config.mode = (i2s_mode_t)(I2S_MODE_MASTER | I2S_MODE_RX | I2S_MODE_ADC_BUILT_IN);
         i2s_config.sample_rate = SAMPLING_FREQUENCY;
-        i2s_config.dma_buf_len = MAX_SAMPLES;
+        i2s_config.dma_buf_len = kDmaBufferLength;
         i2s_config.bits_per_sample = I2S_BITS_PER_SAMPLE_16BIT;
         i2s_config.channel_format = I2S_CHANNEL_FMT_ONLY_LEFT;
         i2s_config.use_apll = false;
         i2s_config.communication_format = I2S_COMM_FORMAT_STAND_I2S;
         i2s_config.intr_alloc_flags = ESP_INTR_FLAG_LEVEL1;
-        i2s_config.dma_buf_count = 2;
+        i2s_config.dma_buf_count = kDmaBufferCount;
 
         ESP_ERROR_CHECK(adc1_config_width(ADC_WIDTH_BIT_12));
         ESP_ERROR_CHECK(adc1_config_channel_atten(ADC1_CHANNEL_0, ADC_ATTEN_DB_0));
@@ -608,13 +1183,13 @@ public:
         i2s_config_t i2s_config;
         i2s_config.mode = (i2s_mode_t)(I2S_MODE_MASTER | I2S_MODE_RX | I2S_MODE_ADC_BUILT_IN);
         i2s_config.sample_rate = SAMPLING_FREQUENCY;
-        i2s_config.dma_buf_len = MAX_SAMPLES;
+        i2s_config.dma_buf_len = kDmaBufferLength;
         i2s_config.bits_per_sample = I2S_BITS_PER_SAMPLE_16BIT;
         i2s_config.channel_format = I2S_CHANNEL_FMT_ONLY_LEFT;
         i2s_config.use_apll = false,
         i2s_config.communication_format = I2S_COMM_FORMAT_STAND_I2S;
         i2s_config.intr_alloc_flags = ESP_INTR_FLAG_LEVEL1;
-        i2s_config.dma_buf_count = 2;
+        i2s_config.dma_buf_count = kDmaBufferCount;
 
         ESP_ERROR_CHECK(adc1_config_width(ADC_WIDTH_BIT_12));
         ESP_ERROR_CHECK(adc1_config_channel_atten(ADC1_CHANNEL_0, ADC_ATTEN_DB_0));
@@ -631,9 +1206,54 @@ public:
         return _MicMode;
     }
 
+    int GetProfile() const
+    {
+        return _profile;
+    }
+
+    // SetProfile
+    //
+    // Switches to another of kProfiles.  This rebuilds the FFT tables and band map out from under the sampler pass,
+    // so it's only to be called from the audio task between passes.
+
+    void SetProfile(int profile)
+    {
+        profile = std::clamp(profile, 0, kProfileCount - 1);
+        if (profile == _profile)
+            return;
+
+        _profile = profile;
+        ApplyProfile();
+        debugI("Audio profile is now %s", kProfiles[_profile].Name);
+    }
+
+private:
+
+    void ApplyProfile()
+    {
+        _windowSamples   = kProfiles[_profile].WindowSamples;
+        _hopSamples      = _windowSamples / 2;
+        _lowestFrequency = kProfiles[_profile].LowestFrequency;
+
+        #if ENABLE_FLOAT_FFT
+            _FFT.Configure(_windowSamples);
+        #endif
+
+        // A sliding window from the old size is no use at the new one
+
+        std::fill(ptrSampleBuffer.get(), ptrSampleBuffer.get() + kMaxWindowSamples, 0);
+
+        CalculateBandCutoffs(_lowestFrequency, SAMPLING_FREQUENCY / 2.0);
+    }
+
+private:
+
     unsigned long _lastPeak1Time[NUM_BANDS] = {0};
     float _peak1Decay[NUM_BANDS] = {0};
     float _peak2Decay[NUM_BANDS] = {0};
+
+public:
+
     float _peak1DecayRate = 1.25f;
     float _peak2DecayRate = 1.25f;
 
@@ -682,17 +1302,188 @@ public:
         }
     }
 
+    // PublishSnapshot
+    //
+    // Called by the audio task once the peaks, their decay and the VU are all up to date for this pass
+
+    void PublishSnapshot()
+    {
+        // A beat is something to keep up with, so the governor gives back full performance for it
+
+        #if ENABLE_GOVERNOR && ENABLE_ONSET_DETECTION
+            if (_beatCount != _snapshot.BeatCount)
+                g_Governor.Boost();
+        #endif
+
+        _snapshotSequence.fetch_add(1, std::memory_order_acq_rel);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        _snapshot.Peaks = _Peaks;
+        std::copy(std::begin(_peak1Decay), std::end(_peak1Decay), _snapshot.Peak1Decay);
+        std::copy(std::begin(_peak2Decay), std::end(_peak2Decay), _snapshot.Peak2Decay);
+        std::copy(std::begin(_lastPeak1Time), std::end(_lastPeak1Time), _snapshot.LastPeak1Time);
+        _snapshot.VU          = _VU;
+        _snapshot.PeakVU      = _PeakVU;
+        _snapshot.MinVU       = _MinVU;
+        _snapshot.VURatio     = _VURatio;
+        _snapshot.VURatioFade = _VURatioFade;
+        #if ENABLE_ONSET_DETECTION
+            std::copy(std::begin(_beats), std::end(_beats), _snapshot.Beats);
+            _snapshot.BeatCount = _beatCount;
+        #endif
+        #if ENABLE_AUDIO_FEATURES
+            _snapshot.Features = _features;
+        #endif
+        _snapshot.CaptureMicros = _captureMicros;
+        #if ENABLE_AUDIO_LATENCY
+            _levels[_cLevels++ % kLevelHistory] = { _captureMicros, _Peaks, _VU };
+        #endif
+
+        std::atomic_thread_fence(std::memory_order_release);
+        _snapshotSequence.fetch_add(1, std::memory_order_release);
+
+        #if ENABLE_AUDIO_LATENCY
+            g_AudioLatency.AudioPublished(_captureMicros);
+        #endif
+    }
+
+    // GetAudioSnapshot
+    //
+    // A consistent copy of the last pass, safe to take from any task.  Effects that use more than one band or pair
+    // the bands with the VU should take one of these per frame rather than reading the analyzer piecemeal.
+
+    inline AudioSnapshot GetAudioSnapshot() const
+    {
+        #if ENABLE_EFFECT_REPLAY
+            if (auto pReplay = ReplaySnapshot())
+                return *pReplay;
+        #endif
+
+        AudioSnapshot snapshot;
+        uint32_t before, after;
+
+        do
+        {
+            before = _snapshotSequence.load(std::memory_order_acquire);
+            snapshot = _snapshot;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            after = _snapshotSequence.load(std::memory_order_relaxed);
+        } while ((before & 1) || before != after);
+
+        return snapshot;
+    }
+
+    // GetFrameAudioSnapshot
+    //
+    // The same, but with the bands and VU for when the frame being drawn will be seen.  The levels of the passes
+    // either side of that moment are blended, and past the newest pass the last two are carried ahead, up to
+    // AUDIO_EXTRAPOLATE_MAX_MS.  The decays, beats and features stay those of the newest pass.  Meant for the draw
+    // task; without ENABLE_AUDIO_LATENCY it's just GetAudioSnapshot.
+
+    inline AudioSnapshot GetFrameAudioSnapshot() const
+    {
+        #if ENABLE_AUDIO_LATENCY
+            #if ENABLE_EFFECT_REPLAY
+                if (auto pReplay = ReplaySnapshot())
+                    return *pReplay;
+            #endif
+
+            AudioSnapshot snapshot;
+            TimedLevels levels[kLevelHistory];
+            uint32_t cLevels;
+            uint32_t before, after;
+
+            do
+            {
+                before = _snapshotSequence.load(std::memory_order_acquire);
+                snapshot = _snapshot;
+                std::copy(std::begin(_levels), std::end(_levels), levels);
+                cLevels = _cLevels;
+                std::atomic_thread_fence(std::memory_order_acquire);
+                after = _snapshotSequence.load(std::memory_order_relaxed);
+            } while ((before & 1) || before != after);
+
+            if (cLevels < 2)
+                return snapshot;
+
+            int64_t target = g_AudioLatency.PresentationMicros() - AUDIO_LATENCY_TARGET_MS * 1000;
+            uint32_t cKept = std::min<uint32_t>(cLevels, kLevelHistory);
+
+            // Find the two passes to work from: the newest one heard before the target and the one after it, or the
+            // newest two if the target is past them all
+
+            uint32_t newer = cLevels - 1;
+            while (newer > cLevels - cKept + 1 && levels[(newer - 1) % kLevelHistory].CaptureMicros > target)
+                newer--;
+
+            const TimedLevels & a = levels[(newer - 1) % kLevelHistory];
+            const TimedLevels & b = levels[newer % kLevelHistory];
+            int64_t span = b.CaptureMicros - a.CaptureMicros;
+            if (span <= 0 || !a.CaptureMicros)
+                return snapshot;
+
+            target = std::min<int64_t>(target, levels[(cLevels - 1) % kLevelHistory].CaptureMicros + AUDIO_EXTRAPOLATE_MAX_MS * 1000);
+            float f = std::clamp((float)(target - a.CaptureMicros) / span, 0.0f, 2.0f);
+
+            for (int i = 0; i < NUM_BANDS; i++)
+                snapshot.Peaks._Level[i] = std::max(0.0f, a.Peaks[i] + (b.Peaks[i] - a.Peaks[i]) * f);
+            snapshot.VU = std::max(0.0f, a.VU + (b.VU - a.VU) * f);
+            return snapshot;
+        #else
+            return GetAudioSnapshot();
+        #endif
+    }
+
     inline PeakData GetPeakData() const
     {
-        return _Peaks;
+        return GetAudioSnapshot().Peaks;
     }
 
-    inline void SetPeakData(const PeakData &peaks)
+    #if ENABLE_EFFECT_REPLAY
+        // The replay harness points this at the audio for the frame it's drawing, and back at nullptr when it's done.
+        // Only the task that set it gets the replayed audio, so what's sent on to other nodes stays the live audio.
+
+        inline void SetReplaySnapshot(const AudioSnapshot * pSnapshot)
+        {
+            _replayTask.store(pSnapshot ? xTaskGetCurrentTaskHandle() : nullptr, std::memory_order_relaxed);
+            _pReplaySnapshot.store(pSnapshot, std::memory_order_release);
+        }
+
+        inline const AudioSnapshot * ReplaySnapshot() const
+        {
+            auto pReplay = _pReplaySnapshot.load(std::memory_order_acquire);
+            if (!pReplay || _replayTask.load(std::memory_order_relaxed) != xTaskGetCurrentTaskHandle())
+                return nullptr;
+            return pReplay;
+        }
+    #endif
+
+    // The capture time is when the sender heard the peaks, if it says, so the remote path gets the same compensation
+
+    inline void SetPeakData(const PeakData &peaks, int64_t captureMicros = esp_timer_get_time())
     {
         debugV("Manually setting peaks!");
         Serial.print(" #");
+
+        std::lock_guard<std::mutex> guard(_remotePeaksMutex);
+        _remotePeaks = peaks;
+        _remoteCaptureMicros = captureMicros;
         _msLastRemote = millis();
-        _Peaks = peaks;
+    }
+
+    inline void SetRemoteBeat(float strength, bool bMajor)
+    {
+        debugV("Remote beat, strength %0.2f", strength);
+
+        std::lock_guard<std::mutex> guard(_remotePeaksMutex);
+        if (_cRemoteBeats < kRemoteBeatQueue)
+        {
+            auto & beat = _remoteBeats[_cRemoteBeats++];
+            beat.Timestamp = millis();
+            beat.Strength  = strength;
+            beat.Major     = bMajor;
+        }
+        _bRemoteBeats = true;
     }
 
     //
@@ -701,21 +1492,76 @@ public:
 
     inline void RunSamplerPass()
     {
+        TRACE_SPAN("AUDIO_PASS");
+
+        [[maybe_unused]] bool bRemoteBeats = false;
+
         if (millis() - _msLastRemote > AUDIO_PEAK_REMOTE_TIMEOUT)
         {
-            #if M5STICKC || M5STICKCPLUS || M5STACKCORE2
-                _MicMode = PeakData::M5;
+            {
+                std::lock_guard<std::mutex> guard(_remotePeaksMutex);
+                _bRemoteBeats = false;
+                _cRemoteBeats = 0;
+            }
+
+            #if AUDIO_REMOTE_ONLY
+
+                // No mic to fall back on, so with nothing coming in it's silence
+
+                _MicMode = PeakData::PCREMOTE;
+                _Peaks = PeakData();
+                _captureMicros = esp_timer_get_time();
+                UpdateVU(0.0f);
+                #if ENABLE_AUDIO_FEATURES
+                    _features.RMS = 0.0f;
+                #endif
+                #if ENABLE_ONSET_DETECTION
+                    std::fill(std::begin(_onsetLevel), std::end(_onsetLevel), 0.0f);
+                #endif
+
             #else
-                _MicMode = PeakData::MESMERIZERMIC;
-            #endif
 
-            Reset();
-            FillBufferI2S();
-            FFT();
-            _Peaks = ProcessPeaks();
+                #if M5STICKC || M5STICKCPLUS || M5STACKCORE2
+                    _MicMode = PeakData::M5;
+                #else
+                    _MicMode = PeakData::MESMERIZERMIC;
+                #endif
+
+                Reset();
+                AUDIO_BENCHMARK_BEGIN();
+                FillBufferI2S();
+                AUDIO_BENCHMARK_END(BenchFill);
+                _captureMicros = esp_timer_get_time() - (int64_t) _windowSamples * MICROS_PER_SECOND / (2 * SAMPLING_FREQUENCY);
+                #if ENABLE_AUDIO_FEATURES
+                    ComputeRMS();
+                #endif
+                AUDIO_BENCHMARK_BEGIN();
+                {
+                    TIME_METRIC(FFT);
+                    FFT();
+                }
+                AUDIO_BENCHMARK_END(BenchFFT);
+                AUDIO_BENCHMARK_BEGIN();
+                _Peaks = ProcessPeaks();
+                AUDIO_BENCHMARK_END(BenchPeaks);
+
+            #endif
         }
         else
         {
+            {
+                std::lock_guard<std::mutex> guard(_remotePeaksMutex);
+                _Peaks = _remotePeaks;
+                _captureMicros = _remoteCaptureMicros;
+
+                bRemoteBeats = _bRemoteBeats;
+                #if ENABLE_ONSET_DETECTION
+                    for (size_t i = 0; i < _cRemoteBeats; i++)
+                        _beats[_beatCount++ % AudioSnapshot::kBeatHistory] = _remoteBeats[i];
+                #endif
+                _cRemoteBeats = 0;
+            }
+
             // Calculate a total VU from the band data
             float sum = 0.0f;
             for (int i = 0; i < NUM_BANDS; i++)
@@ -724,7 +1570,39 @@ public:
             // Scale it so that its not always in the top red
             _MicMode = PeakData::PCREMOTE;
             UpdateVU(sum / NUM_BANDS);
+
+            // Remote peaks come already normalized, which the adaptive threshold copes with
+
+            #if ENABLE_ONSET_DETECTION
+                for (int i = 0; i < NUM_BANDS; i++)
+                    _onsetLevel[i] = log1pf(_Peaks[i]);
+            #endif
+
+            // There are no samples to measure, so the RMS comes from the bands
+
+            #if ENABLE_AUDIO_FEATURES
+                float sumSquares = 0.0f;
+                for (int i = 0; i < NUM_BANDS; i++)
+                    sumSquares += _Peaks[i] * _Peaks[i];
+                _features.RMS = std::min(1.0f, sqrtf(sumSquares / NUM_BANDS));
+            #endif
         }
+
+        AUDIO_BENCHMARK_BEGIN();
+        #if ENABLE_AUDIO_FEATURES
+            UpdateFeatures();
+        #endif
+        AUDIO_BENCHMARK_END(BenchFeatures);
+        AUDIO_BENCHMARK_BEGIN();
+        #if ENABLE_ONSET_DETECTION
+            if (!bRemoteBeats)
+                DetectOnsets();
+        #endif
+        AUDIO_BENCHMARK_END(BenchOnsets);
+
+        #if ENABLE_AUDIO_BENCHMARK
+            BenchmarkReport();
+        #endif
     }
 };
 #endif
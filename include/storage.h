@@ -0,0 +1,57 @@
+//+--------------------------------------------------------------------------
+//
+// File:        storage.h
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+//
+// Description:
+//
+//    The file system the config and other files live on, which is either
+//    SPIFFS or LittleFS on the same partition, and writes to it that a
+//    power cut can't leave half done
+//
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#include <FS.h>
+#include "globals.h"
+
+#if USE_LITTLEFS
+    #include <LittleFS.h>
+    #define FILESYSTEM LittleFS
+#else
+    #include <SPIFFS.h>
+    #define FILESYSTEM SPIFFS
+#endif
+
+#define STORAGE_PARTITION_LABEL "storage"       // As named in the partition tables under config
+#define ATOMIC_WRITE_SUFFIX     ".tmp"
+
+// Mounts the file system, formatting it if it can't be mounted
+bool BeginFileSystem();
+
+// WriteFileAtomically
+//
+// Writes the whole of a file to a temporary one next to it, and then puts that in its place.  Either the old or
+// the new contents are there afterwards, whenever the power goes.
+bool WriteFileAtomically(const String & fileName, const uint8_t * pData, size_t length);
+
+// Finishes or drops a write to the file that was cut short, so the file is there and whole.  Call before reading it.
+void RecoverInterruptedWrite(const String & fileName);
@@ -34,9 +34,18 @@
 #include "taskmgr.h"
 #include "jsonserializer.h"
 #include "network.h"
+#include "httpservice.h"
 #include "deviceconfig.h"
 #include "screen.h"
 #include "socketserver.h"
+#include "udpserver.h"
+#include "dmxserver.h"
+#include "ddpserver.h"
+#include "showplayer.h"
+#include "showrecorder.h"
+#include "assetstore.h"
+#include "effectsync.h"
+#include "espnowlink.h"
 #include "remotecontrol.h"
 #include "webserver.h"
 #include "types.h"
@@ -123,13 +132,14 @@
 class SystemContainer
 {
   private:
-    // Helper method that checks if a pointer is initialized. Throws a runtime error if not.
+    // Helper method that checks if a pointer is initialized. Throws a runtime error if not.  The getters are called
+    // many times a frame, so the name stays a plain string until it's needed.
     template<typename Tp>
-    inline void CheckPointer(const std::unique_ptr<Tp>& pointer, const String& name) const
+    inline void CheckPointer(const std::unique_ptr<Tp>& pointer, const char * name) const
     {
-        if (!pointer)
+        if (__builtin_expect(!pointer, false))
         {
-            debugE("Calling getter for %s with pointer uninitialized!", name.c_str());
+            debugE("Calling getter for %s with pointer uninitialized!", name);
             delay(1000);
             throw std::runtime_error("Calling SystemContainer getter with uninitialized pointer!");
         }
@@ -159,12 +169,28 @@ class SystemContainer
 
         #if USE_PSRAM
             uint32_t memtouse = ESP.getFreePsram() - RESERVE_MEMORY;
+            uint32_t maxblock = ESP.getMaxAllocPsram();
         #else
             uint32_t memtouse = ESP.getFreeHeap() - RESERVE_MEMORY;
+            uint32_t maxblock = ESP.getMaxAllocHeap();
+        #endif
+
+        // Each device gets one LEDBufferArena, which holds its pixels in a single block and its buffer objects in
+        // another, so this is the whole cost per buffer.  Since the pixels must be contiguous, the largest free
+        // block limits us as well as the total, and it's checked again for each device as the blocks are taken.
+
+        // Packets for several channels share a frame from a small pool, which is set aside before the rings take the rest
+
+        #if SHARED_FRAME_POOL_SIZE
+            if (SC_MEMBER(Devices)->size() > 1)
+            {
+                SC_MEMBER(SharedFrames) = std::make_unique<SharedFramePool>(SHARED_FRAME_POOL_SIZE);
+                memtouse -= std::min<uint32_t>(memtouse, SC_MEMBER(SharedFrames)->FrameCount() * NUM_LEDS * sizeof(CRGB));
+            }
         #endif
 
         uint32_t memtoalloc = (SC_MEMBER(Devices)->size() * (sizeof(LEDBuffer) + NUM_LEDS * sizeof(CRGB)));
-        uint32_t cBuffers = memtouse / memtoalloc;
+        uint32_t cBuffers = std::min(memtouse / memtoalloc, maxblock / (uint32_t)(NUM_LEDS * sizeof(CRGB)));
 
         if (cBuffers < MIN_BUFFERS)
         {
@@ -182,13 +208,33 @@ class SystemContainer
         SC_MEMBER(BufferManagers) = make_unique_psram<std::vector<LEDBufferManager, psram_allocator<LEDBufferManager>>>();
 
         for (auto& device : *SC_MEMBER(Devices))
+        {
+            #if USE_PSRAM
+                maxblock = ESP.getMaxAllocPsram();
+            #else
+                maxblock = ESP.getMaxAllocHeap();
+            #endif
+
+            if (maxblock < cBuffers * NUM_LEDS * sizeof(CRGB))
+            {
+                debugI("Not enough contiguous memory for the buffers of channel %zu\n", SC_MEMBER(BufferManagers)->size());
+                throw std::runtime_error("Could not allocate all buffers");
+            }
+
             SC_MEMBER(BufferManagers)->emplace_back(cBuffers, device);
+        }
 
         return *SC_MEMBER(BufferManagers);
     }
 
     SC_GETTERS_FOR(BufferManagers, std::vector<LEDBufferManager, psram_allocator<LEDBufferManager>>)
 
+    // -------------------------------------------------------------
+    // SharedFrames, which SetupBufferManagers creates when there's more than one channel
+
+    SC_DECLARE(SharedFrames, SharedFramePool)
+    SC_GETTERS_FOR(SharedFrames, SharedFramePool)
+
     // -------------------------------------------------------------
     // EffectManager
 
@@ -236,7 +282,7 @@ class SystemContainer
             SC_MEMBER(TaskManager)->StartJSONWriterThread();
         }
 
-        // Create and load device config from SPIFFS if possible
+        // Create and load device config from the file system if possible
         if (!SC_MEMBER(DeviceConfig))
             SC_MEMBER(DeviceConfig) = make_unique_psram<::DeviceConfig>();
     }
@@ -251,6 +297,13 @@ class SystemContainer
         SC_SIMPLE_PROPERTY(NetworkReader, NetworkReader)
     #endif
 
+    // -------------------------------------------------------------
+    // HTTPService
+
+    #if ENABLE_WIFI
+        SC_SIMPLE_PROPERTY(HTTPService, HTTPService)
+    #endif
+
     // -------------------------------------------------------------
     // WebServer
 
@@ -265,6 +318,62 @@ class SystemContainer
         SC_FORWARDING_PROPERTY(SocketServer, SocketServer)
     #endif
 
+    // -------------------------------------------------------------
+    // UDPServer
+
+    #if ENABLE_UDP_INGEST
+        SC_FORWARDING_PROPERTY(UDPServer, UDPServer)
+    #endif
+
+    // -------------------------------------------------------------
+    // DMXServer
+
+    #if ENABLE_DMX_INGEST
+        SC_SIMPLE_PROPERTY(DMXServer, DMXServer)
+    #endif
+
+    // -------------------------------------------------------------
+    // DDPServer
+
+    #if ENABLE_DDP_INGEST
+        SC_SIMPLE_PROPERTY(DDPServer, DDPServer)
+    #endif
+
+    // -------------------------------------------------------------
+    // ShowPlayer
+
+    #if ENABLE_SHOW_PLAYBACK
+        SC_SIMPLE_PROPERTY(ShowPlayer, ShowPlayer)
+    #endif
+
+    // -------------------------------------------------------------
+    // ShowRecorder
+
+    #if ENABLE_SHOW_RECORDER
+        SC_SIMPLE_PROPERTY(ShowRecorder, ShowRecorder)
+    #endif
+
+    // -------------------------------------------------------------
+    // AssetStore
+
+    #if ENABLE_ASSET_STORE
+        SC_SIMPLE_PROPERTY(AssetStore, AssetStore)
+    #endif
+
+    // -------------------------------------------------------------
+    // EffectSync
+
+    #if ENABLE_EFFECT_SYNC
+        SC_SIMPLE_PROPERTY(EffectSync, EffectSync)
+    #endif
+
+    // -------------------------------------------------------------
+    // ESPNowLink
+
+    #if ENABLE_ESPNOW
+        SC_SIMPLE_PROPERTY(ESPNowLink, ESPNowLink)
+    #endif
+
     // -------------------------------------------------------------
     // RemoteControl
 
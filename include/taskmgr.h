@@ -22,19 +22,10 @@
 //
 // Description:
 //
-//    Keeps track of CPU idle time and other stats.  Basic premise here
-//    is that it creates an idle task on each core that burn any cycles they
-//    can get.  They run at 1 above the system's own idle task priority so as
-//    to not timeslice with them.
-//
-//    Since this totally starves those system idle tasks, the watchdog must
-//    be turned off for them, which we do in begin().  We then turn the
-//    watchdog on for our own idle tasks, and feed the watchdog in
-//    ProcessIdleTime as we consume all available idle time.
-//
-//    BUGBUG(davepl): I think this means that vTaskDelete is never called
-//                    since it was handled by the idle tasks.
-//
+//    Keeps track of CPU idle time and other stats.  Each core's tick
+//    interrupt samples whether the system idle task is what's running, so
+//    nothing has to burn the idle time to measure it, and the idle tasks
+//    are left to sleep the cores and clean up after deleted tasks.
 //
 // History:     Jul-12-2018         Davepl      Created
 //              Apr-29-2019         Davepl      Adapted from BigBlueLCD project
@@ -43,117 +34,124 @@
 
 #pragma once
 
+#include <atomic>
 #include <Arduino.h>
+#include <freertos/event_groups.h>
+#include <esp_freertos_hooks.h>
 #include <esp_task_wdt.h>
+#include "errorcounters.h"
 #include "ledstripeffect.h"
 
-// Stack size for the taskmgr's idle threads
+// Stack sizes for the tasks we start
 #define DEFAULT_STACK_SIZE 2048+512
 
-#define IDLE_STACK_SIZE    2048
 #define DRAWING_STACK_SIZE 4096
 #define AUDIO_STACK_SIZE   4096
 #define JSON_STACK_SIZE    4096
 #define SOCKET_STACK_SIZE  4096
+#define UDP_STACK_SIZE     4096
+#define DMX_STACK_SIZE     4096
+#define DDP_STACK_SIZE     4096
+#define SHOW_STACK_SIZE    4096
+#define SHOW_RECORDER_STACK_SIZE 4096
+#define EFFECT_SYNC_STACK_SIZE 4096
+#define CLOCK_SYNC_STACK_SIZE  3072
+#define ESPNOW_STACK_SIZE  4096
+#define PRESENT_STACK_SIZE 4096
+#define PARALLEL_STACK_SIZE 4096
 #define NET_STACK_SIZE     8192
 #define DEBUG_STACK_SIZE   8192                 // Needs a lot of stack for output if UpdateClockFromWeb is called from debugger
 #define REMOTE_STACK_SIZE  4096
+#define PREPARE_STACK_SIZE 4096
+#define BOOT_STACK_SIZE    8192                 // Sets up WiFi, Improv and the web server
+#define OTA_STACK_SIZE     8192
+#define NETREADER_STACK_SIZE 8192               // HTTP requests and the JSON they return
+#define EFFECT_WORKER_STACK_SIZE 4096           // Shared by the background work of every effect
 
-class IdleTask
-{
-  private:
-
-    float _idleRatio = 0;
-    unsigned long _lastMeasurement;
-
-    const int kMillisPerLoop = 1;
-    const int kMillisPerCalc = 1000;
+// CPUMeter
+//
+// Every FreeRTOS tick, on each core, looks at which task the tick interrupted and counts it as idle if it was the
+// system's own idle task.  Each second's count gives that core's idle share to within a tick, for no more than the
+// cost of the tick interrupt, and the idle tasks go on sleeping the cores between interrupts as they normally would.
+// It runs in the interrupt, where the FPU isn't available, so it keeps to integers.
 
-    unsigned long counter = 0;
+class CPUMeter
+{
+    static constexpr uint32_t kTicksPerCalc = configTICK_RATE_HZ;             // One second of ticks
 
-  public:
+    static inline TaskHandle_t      _hIdle[portNUM_PROCESSORS]        = {};
+    static inline volatile uint32_t _ticks[portNUM_PROCESSORS]        = {};
+    static inline volatile uint32_t _idleTicks[portNUM_PROCESSORS]    = {};
+    static inline volatile uint32_t _idlePermille[portNUM_PROCESSORS] = {};
 
-    void ProcessIdleTime()
+    static void IRAM_ATTR TickHook()
     {
-        _lastMeasurement = millis();
-        counter = 0;
+        auto core = xPortGetCoreID();
 
-        // We need to whack the watchdog so we delay in smalle bites until we've used up all the time
+        if (xTaskGetCurrentTaskHandleForCPU(core) == _hIdle[core])
+            _idleTicks[core]++;
 
-        while (true)
+        if (++_ticks[core] >= kTicksPerCalc)
         {
-            int delta = millis() - _lastMeasurement;
-            if (delta >= kMillisPerCalc)
-            {
-                //Serial.printf("Core %u Spent %lu in delay during a window of %d for a ratio of %f\n",
-                //  xPortGetCoreID(), counter, delta, (float)counter/delta);
-                _idleRatio = ((float) counter  / delta);
-                _lastMeasurement = millis();
-                counter = 0;
-            }
-            else
-            {
-                esp_task_wdt_reset();
-                delayMicroseconds(kMillisPerLoop*1000);
-                counter += kMillisPerLoop;
-            }
+            _idlePermille[core] = _idleTicks[core] * 1000 / _ticks[core];
+            _ticks[core] = 0;
+            _idleTicks[core] = 0;
         }
     }
 
-    IdleTask() : _lastMeasurement(millis())
+  public:
+
+    static void begin()
     {
+        for (int core = 0; core < portNUM_PROCESSORS; core++)
+        {
+            _hIdle[core] = xTaskGetIdleTaskHandleForCPU(core);
+            _idlePermille[core] = 1000;
+            esp_register_freertos_tick_hook_for_cpu(TickHook, core);
+        }
     }
 
     // GetCPUUsage
     //
-    // Returns 100 less the amount of idle time that we were able to squander.
+    // Returns 100 less the share of the last second the core spent in its idle task
 
-    float GetCPUUsage() const
+    static float GetCPUUsage(int core)
     {
-        // If the measurement failed to even get a chance to run, this core is maxed and there was no idle time
-
-        if (millis() - _lastMeasurement > kMillisPerCalc)
-            return 100.0f;
-
-        // Otherwise, whatever cycles we were able to burn in the idle loop counts as "would have been idle" time
-        return 100.0f-100*_idleRatio;
+        return 100.0f - _idlePermille[core] / 10.0f;
     }
+};
 
-    // Stub entry point for calling into it without a THIS pointer
+// TaskStats
+//
+// One task's entry in the task list.  The CPU share is of one core's time since boot, and only known when FreeRTOS
+// is built with configGENERATE_RUN_TIME_STATS; otherwise it's left negative.
 
-    static void IdleTaskEntry(void * that)
-    {
-        IdleTask * pTask = (IdleTask *)that;
-        pTask->ProcessIdleTime();
-    }
+struct TaskStats
+{
+    String   Name;
+    int      Core;                              // -1 if it can run on either
+    uint     Priority;
+    uint32_t StackFree;                         // The least stack the task has had left, in bytes
+    float    CPUPercent = -1.0f;
 };
 
 // TaskManager
 //
-// TaskManager runs two tasks at just over idle priority that do nothing but try to burn CPU, and they
-// keep track of how much they can burn.   It's assumed that everything else runs at a higher priority
-// and thus they "starve" the idle tasks when doing work.
+// Measures how busy each core is, and lists the tasks that are running
 
 class TaskManager
 {
-    TaskHandle_t _hIdle0 = nullptr;
-    TaskHandle_t _hIdle1 = nullptr;
-
-    IdleTask _taskIdle0;
-    IdleTask _taskIdle1;
-
 public:
 
     float GetCPUUsagePercent(int iCore = -1) const
     {
         if (iCore < 0)
-            return (_taskIdle0.GetCPUUsage() + _taskIdle1.GetCPUUsage()) / 2;
-        else if (iCore == 0)
-            return _taskIdle0.GetCPUUsage();
-        else if (iCore == 1)
-            return _taskIdle1.GetCPUUsage();
-        else
-            throw new std::runtime_error("Invalid core passed to GetCPUUsagePercentCPU");
+            return (CPUMeter::GetCPUUsage(0) + CPUMeter::GetCPUUsage(1)) / 2;
+        else if (iCore < portNUM_PROCESSORS)
+            return CPUMeter::GetCPUUsage(iCore);
+
+        COUNT_ERROR(ErrorCounter::InvalidCore, "Invalid core %d passed to GetCPUUsagePercent", iCore);
+        return 0.0f;
     }
 
     TaskManager()
@@ -172,27 +170,100 @@ public:
         }
     }
 
-    void begin()
+    // GetTaskStats
+    //
+    // A snapshot of every task's core, priority, stack headroom and, where FreeRTOS keeps it, share of the CPU
+
+    std::vector<TaskStats> GetTaskStats() const
     {
-        Serial.printf("Replacing Idle Tasks with TaskManager...\n");
-        // The idle tasks get created with a priority just ABOVE idle so that they steal idle time but nothing else.  They then
-        // measure how much time is "wasted" at that lower priority and deem it to have been free CPU
+        std::vector<TaskStats> stats;
+
+        #if configUSE_TRACE_FACILITY
+            UBaseType_t cTasks = uxTaskGetNumberOfTasks();
+            std::unique_ptr<TaskStatus_t[]> pStatus(new(std::nothrow) TaskStatus_t[cTasks]);
+            if (!pStatus)
+                return stats;
+
+            uint32_t totalRunTime = 0;
+            cTasks = uxTaskGetSystemState(pStatus.get(), cTasks, &totalRunTime);
+            stats.reserve(cTasks);
+
+            for (UBaseType_t i = 0; i < cTasks; i++)
+            {
+                const auto& status = pStatus[i];
+                TaskStats task;
+                task.Name      = status.pcTaskName;
+                task.Core      = xTaskGetAffinity(status.xHandle) == tskNO_AFFINITY ? -1 : (int) xTaskGetAffinity(status.xHandle);
+                task.Priority  = status.uxCurrentPriority;
+                task.StackFree = status.usStackHighWaterMark;               // The ESP32 port counts stack in bytes
+
+                #if configGENERATE_RUN_TIME_STATS
+                    if (totalRunTime > 0)
+                        task.CPUPercent = 100.0f * status.ulRunTimeCounter / totalRunTime;
+                #endif
+
+                stats.push_back(std::move(task));
+            }
+        #endif
 
-        xTaskCreatePinnedToCore(_taskIdle0.IdleTaskEntry, "Idle0", IDLE_STACK_SIZE, &_taskIdle0, tskIDLE_PRIORITY + 1, &_hIdle0, 0);
-        xTaskCreatePinnedToCore(_taskIdle1.IdleTaskEntry, "Idle1", IDLE_STACK_SIZE, &_taskIdle1, tskIDLE_PRIORITY + 1, &_hIdle1, 1);
+        return stats;
+    }
 
-        // We need to turn off the watchdogs because our idle measurement tasks burn all of the idle time just
-        // to see how much there is (it's how they measure free CPU).  Thus, we starve the system's normal idle tasks
-        // and have to feed the watchdog on our own.
+    void begin()
+    {
+        CPUMeter::begin();
+
+        // The idle tasks have always been off the watchdog here, and a heavy effect can keep a core busy for longer
+        // than its timeout, so they stay off it
 
         esp_task_wdt_delete(xTaskGetIdleTaskHandleForCPU(0));
         esp_task_wdt_delete(xTaskGetIdleTaskHandleForCPU(1));
-        esp_task_wdt_add(_hIdle0);
-        esp_task_wdt_add(_hIdle1);
     }
 
 };
 
+// SystemEvent
+//
+// What the task manager's event bus delivers.  Each is a bit of a task notification value, so a task can wait for
+// several at once; WiFiUp is also a state that's kept, for the tasks that want to wait until it holds.
+
+enum class SystemEvent : uint32_t
+{
+    FrameDrawn     = BIT0,              // The draw loop has put a new frame out
+    WiFiUp         = BIT1,              // WiFi has an IP address
+    ConfigChanged  = BIT2,              // A setting was changed and is due to be written out
+    AudioPass      = BIT3               // The analyzer has published the peaks and VU from another pass
+};
+
+constexpr uint32_t operator|(SystemEvent a, SystemEvent b)
+{
+    return (uint32_t) a | (uint32_t) b;
+}
+
+// TaskRole and TaskPlacement
+//
+// The tasks whose core and priority depend on the task profile, and where a profile puts one of them
+
+enum class TaskRole : uint8_t
+{
+    Socket,
+    UDP,
+    Network,                            // The network task and the effect workers, which have always run alongside it
+    NetworkReader,
+    ColorData,
+    Audio,
+    AudioSerial,
+    EffectPrepare,
+    Parallel,
+    Count
+};
+
+struct TaskPlacement
+{
+    BaseType_t  Core;
+    UBaseType_t Priority;
+};
+
 // NightDriverTaskManager
 //
 // A superclass of the base TaskManager that knows how to start and track the tasks specific to this project
@@ -200,78 +271,211 @@ public:
 void IRAM_ATTR ScreenUpdateLoopEntry(void *);
 void IRAM_ATTR AudioSerialTaskEntry(void *);
 void IRAM_ATTR DrawLoopTaskEntry(void *);
+void IRAM_ATTR PresentTaskEntry(void *);
 void IRAM_ATTR AudioSamplerTaskEntry(void *);
 void IRAM_ATTR NetworkHandlingLoopEntry(void *);
 void IRAM_ATTR DebugLoopTaskEntry(void *);
 void IRAM_ATTR SocketServerTaskEntry(void *);
+void IRAM_ATTR UDPServerTaskEntry(void *);
+void IRAM_ATTR DMXServerTaskEntry(void *);
+void IRAM_ATTR DDPServerTaskEntry(void *);
+void IRAM_ATTR ShowPlaybackTaskEntry(void *);
+void IRAM_ATTR ShowRecorderTaskEntry(void *);
+void IRAM_ATTR EffectSyncTaskEntry(void *);
+void IRAM_ATTR ClockSyncTaskEntry(void *);
+void IRAM_ATTR ESPNowTaskEntry(void *);
 void IRAM_ATTR RemoteLoopEntry(void *);
 void IRAM_ATTR JSONWriterTaskEntry(void *);
 void IRAM_ATTR ColorDataTaskEntry(void *);
+void IRAM_ATTR EffectPrepareTaskEntry(void *);
+void BootTaskEntry(void *);
+void IRAM_ATTR OTATaskEntry(void *);
+void IRAM_ATTR NetworkReaderTaskEntry(void *);
 
 #define DELETE_TASK(handle) if (handle != nullptr) vTaskDelete(handle)
 
 class NightDriverTaskManager : public TaskManager
 {
-public:
-
-    using EffectTaskFunction = std::function<void(LEDStripEffect&)>;
-
 private:
 
-    struct EffectTaskParams
-    {
-        EffectTaskFunction function;
-        LEDStripEffect* pEffect;
-
-        EffectTaskParams(EffectTaskFunction function, LEDStripEffect* pEffect)
-          : function(function),
-            pEffect(pEffect)
-        {}
-    };
-
     TaskHandle_t _taskScreen        = nullptr;
     TaskHandle_t _taskNetwork       = nullptr;
     TaskHandle_t _taskDraw          = nullptr;
+    TaskHandle_t _taskPresent       = nullptr;
     TaskHandle_t _taskDebug         = nullptr;
     TaskHandle_t _taskAudio         = nullptr;
     TaskHandle_t _taskRemote        = nullptr;
     TaskHandle_t _taskSocket        = nullptr;
+    TaskHandle_t _taskUDP           = nullptr;
+    TaskHandle_t _taskDMX           = nullptr;
+    TaskHandle_t _taskDDP           = nullptr;
+    TaskHandle_t _taskShow          = nullptr;
+    TaskHandle_t _taskShowRecorder  = nullptr;
+    TaskHandle_t _taskEffectSync    = nullptr;
+    TaskHandle_t _taskClockSync     = nullptr;
+    TaskHandle_t _taskESPNow        = nullptr;
     TaskHandle_t _taskSerial        = nullptr;
     TaskHandle_t _taskColorData     = nullptr;
     TaskHandle_t _taskJSONWriter    = nullptr;
+    TaskHandle_t _taskEffectPrepare = nullptr;
+    TaskHandle_t _taskBoot          = nullptr;
+    TaskHandle_t _taskOTA           = nullptr;
+    TaskHandle_t _taskParallel      = nullptr;
+
+    std::vector<TaskHandle_t> _vEffectWorkerTasks;
+    std::vector<TaskHandle_t> _vNetworkReaderTasks;
+    std::once_flag _effectWorkersStarted;
+    int _taskProfile = TASK_PROFILE_DEFAULT;
+    std::atomic<bool> _bNonEssentialPaused { false };
+
+    // The event bus.  Tasks that subscribe are sent the events they asked for as bits of their task notification
+    // value, so they can't also be woken with xTaskNotifyGive.  Entries are only ever added, and each is filled in
+    // before the count takes it in, so posting doesn't need the lock.
+
+    struct EventSubscriber
+    {
+        TaskHandle_t          Task = nullptr;
+        std::atomic<uint32_t> Mask { 0 };
+    };
 
-    std::vector<TaskHandle_t> _vEffectTasks;
+    EventSubscriber       _subscribers[EVENT_BUS_SUBSCRIBERS];
+    std::atomic<size_t>   _cSubscribers { 0 };
+    std::mutex            _subscribeMutex;
+    EventGroupHandle_t    _hEventStates = xEventGroupCreate();
 
-    static void EffectTaskEntry(void *pVoid)
+    // The core and priority each role gets in each profile, in TaskRole order.  Tasks already running keep their
+    //   placement, which is why a new profile only takes effect after a reboot.
+
+    static TaskPlacement ProfilePlacement(int profile, TaskRole role)
     {
-        EffectTaskParams *pTaskParams = (EffectTaskParams *)pVoid;
+        static constexpr TaskPlacement placements[][(size_t) TaskRole::Count] =
+        {
+            // TASK_PROFILE_DEFAULT_LAYOUT
+            {
+                { SOCKET_CORE,      SOCKET_PRIORITY },
+                { UDP_CORE,         UDP_PRIORITY },
+                { NET_CORE,         NET_PRIORITY },
+                { NETREADER_CORE,   NETREADER_PRIORITY },
+                { COLORDATA_CORE,   COLORDATA_PRIORITY },
+                { AUDIO_CORE,       AUDIO_PRIORITY },
+                { AUDIOSERIAL_CORE, AUDIOSERIAL_PRIORITY },
+                { PREPARE_CORE,     PREPARE_PRIORITY },
+                { PARALLEL_CORE,    PARALLEL_PRIORITY }
+            },
+            // TASK_PROFILE_STREAMING: packets are taken apart on the core lwIP runs on, and drawing has core 1
+            {
+                { 0,                SOCKET_PRIORITY },
+                { 0,                UDP_PRIORITY },
+                { NET_CORE,         NET_PRIORITY },
+                { NETREADER_CORE,   NETREADER_PRIORITY },
+                { 0,                COLORDATA_PRIORITY },
+                { AUDIO_CORE,       AUDIO_PRIORITY },
+                { AUDIOSERIAL_CORE, AUDIOSERIAL_PRIORITY },
+                { PREPARE_CORE,     PREPARE_PRIORITY },
+                { PARALLEL_CORE,    PARALLEL_PRIORITY }
+            },
+            // TASK_PROFILE_LOCAL_EFFECTS: core 1 is left to drawing, and the parallel worker gets ahead of the network
+            {
+                { 0,                SOCKET_PRIORITY },
+                { 0,                UDP_PRIORITY },
+                { 0,                NET_PRIORITY },
+                { 0,                NETREADER_PRIORITY },
+                { 0,                COLORDATA_PRIORITY },
+                { AUDIO_CORE,       AUDIO_PRIORITY },
+                { AUDIOSERIAL_CORE, AUDIOSERIAL_PRIORITY },
+                { 0,                PREPARE_PRIORITY },
+                { 0,                tskIDLE_PRIORITY+6 }
+            },
+            // TASK_PROFILE_AUDIO_HEAVY: the sampler is only behind drawing and the sockets, and the background work
+            //   leaves core 0 to it.  Audio serial has to stay above audio.
+            {
+                { SOCKET_CORE,      SOCKET_PRIORITY },
+                { UDP_CORE,         UDP_PRIORITY },
+                { NET_CORE,         NET_PRIORITY },
+                { 1,                NETREADER_PRIORITY },
+                { COLORDATA_CORE,   COLORDATA_PRIORITY },
+                { 0,                tskIDLE_PRIORITY+6 },
+                { AUDIOSERIAL_CORE, tskIDLE_PRIORITY+7 },
+                { 1,                PREPARE_PRIORITY },
+                { PARALLEL_CORE,    PARALLEL_PRIORITY }
+            }
+        };
 
-        EffectTaskFunction function = pTaskParams->function;
-        LEDStripEffect* pEffect = pTaskParams->pEffect;
+        static_assert(sizeof(placements) / sizeof(placements[0]) == TASK_PROFILE_MAX + 1, "Every task profile needs its placements");
 
-        // Delete the params object before we invoke the actual function; they tend to run indefinitely
-        delete pTaskParams;
+        return placements[std::clamp(profile, TASK_PROFILE_MIN, TASK_PROFILE_MAX)][(size_t) role];
+    }
 
-        function(*pEffect);
+    // The effect workers are only started once there's work for them, as most effects never have any
+    void StartEffectWorkerThreads()
+    {
+        Serial.print( str_sprintf(">> Launching Effect Worker Threads.  Mem: %u, LargestBlk: %u, PSRAM Free: %u/%u, ", ESP.getFreeHeap(),ESP.getMaxAllocHeap(), ESP.getFreePsram(), ESP.getPsramSize()) );
+        for (size_t i = 0; i < EFFECT_WORKERS; i++)
+        {
+            TaskHandle_t task = nullptr;
+            xTaskCreatePinnedToCore(EffectWorkerPool::WorkerEntry, str_sprintf("Effect Worker %zu", i).c_str(), EFFECT_WORKER_STACK_SIZE, (void *) i, Placement(TaskRole::Network).Priority, &task, Placement(TaskRole::Network).Core);
+            _vEffectWorkerTasks.push_back(task);
+        }
+        CheckHeap();
     }
 
 public:
 
+    // SetTaskProfile
+    //
+    // Picks the TASK_PROFILE_* the tasks are placed by from here on.  Set from the device config before the tasks
+    // that depend on it are started.
+
+    void SetTaskProfile(int profile)
+    {
+        _taskProfile = std::clamp(profile, TASK_PROFILE_MIN, TASK_PROFILE_MAX);
+    }
+
+    int GetTaskProfile() const
+    {
+        return _taskProfile;
+    }
+
+    static const char * TaskProfileName(int profile)
+    {
+        static const char * const names[] = { "default", "streaming", "local-effects", "audio-heavy" };
+        return names[std::clamp(profile, TASK_PROFILE_MIN, TASK_PROFILE_MAX)];
+    }
+
+    TaskPlacement Placement(TaskRole role) const
+    {
+        return ProfilePlacement(_taskProfile, role);
+    }
+
     ~NightDriverTaskManager()
     {
-        for (auto& task : _vEffectTasks)
+        for (auto& task : _vEffectWorkerTasks)
+            vTaskDelete(task);
+        for (auto& task : _vNetworkReaderTasks)
             vTaskDelete(task);
 
         DELETE_TASK(_taskDraw);
+        DELETE_TASK(_taskPresent);
         DELETE_TASK(_taskScreen);
         DELETE_TASK(_taskRemote);
         DELETE_TASK(_taskSerial);
         DELETE_TASK(_taskColorData);
         DELETE_TASK(_taskAudio);
         DELETE_TASK(_taskSocket);
+        DELETE_TASK(_taskUDP);
+        DELETE_TASK(_taskDMX);
+        DELETE_TASK(_taskDDP);
+        DELETE_TASK(_taskShow);
+        DELETE_TASK(_taskShowRecorder);
+        DELETE_TASK(_taskEffectSync);
+        DELETE_TASK(_taskClockSync);
+        DELETE_TASK(_taskESPNow);
         DELETE_TASK(_taskNetwork);
         DELETE_TASK(_taskJSONWriter);
+        DELETE_TASK(_taskEffectPrepare);
         DELETE_TASK(_taskDebug);
+        DELETE_TASK(_taskOTA);
+        DELETE_TASK(_taskParallel);
     }
 
     void StartScreenThread()
@@ -287,7 +491,8 @@ public:
     {
         #if ENABLE_AUDIOSERIAL
             Serial.print( str_sprintf(">> Launching Serial Thread.  Mem: %u, LargestBlk: %u, PSRAM Free: %u/%u, ", ESP.getFreeHeap(),ESP.getMaxAllocHeap(), ESP.getFreePsram(), ESP.getPsramSize()) );
-            xTaskCreatePinnedToCore(AudioSerialTaskEntry, "Audio Serial Loop", DEFAULT_STACK_SIZE, nullptr, AUDIOSERIAL_PRIORITY, &_taskSerial, AUDIOSERIAL_CORE);
+            auto placement = Placement(TaskRole::AudioSerial);
+            xTaskCreatePinnedToCore(AudioSerialTaskEntry, "Audio Serial Loop", DEFAULT_STACK_SIZE, nullptr, placement.Priority, &_taskSerial, placement.Core);
             CheckHeap();
         #endif
     }
@@ -296,7 +501,8 @@ public:
     {
         #if COLORDATA_SERVER_ENABLED
             Serial.print( str_sprintf(">> Launching ColorData Thread.  Mem: %u, LargestBlk: %u, PSRAM Free: %u/%u, ", ESP.getFreeHeap(),ESP.getMaxAllocHeap(), ESP.getFreePsram(), ESP.getPsramSize()) );
-            xTaskCreatePinnedToCore(ColorDataTaskEntry, "ColorData Loop", DEFAULT_STACK_SIZE, nullptr, COLORDATA_PRIORITY, &_taskColorData, COLORDATA_CORE);
+            auto placement = Placement(TaskRole::ColorData);
+            xTaskCreatePinnedToCore(ColorDataTaskEntry, "ColorData Loop", DEFAULT_STACK_SIZE, nullptr, placement.Priority, &_taskColorData, placement.Core);
             CheckHeap();
         #endif
     }
@@ -308,11 +514,52 @@ public:
         CheckHeap();        
     }
 
+    void StartPresentThread()
+    {
+        #if ENABLE_PIPELINED_PRESENT || (USE_HUB75 && ENABLE_MATRIX_DIRECT_OUTPUT)
+            Serial.print( str_sprintf(">> Launching Present Thread.  Mem: %u, LargestBlk: %u, PSRAM Free: %u/%u, ", ESP.getFreeHeap(),ESP.getMaxAllocHeap(), ESP.getFreePsram(), ESP.getPsramSize()) );
+            xTaskCreatePinnedToCore(PresentTaskEntry, "Present Loop", PRESENT_STACK_SIZE, nullptr, PRESENT_PRIORITY, &_taskPresent, PRESENT_CORE);
+            CheckHeap();
+        #endif
+    }
+
+    // The worker that g_ParallelFor hands the other half of the rows to
+    void StartParallelThread()
+    {
+        #if ENABLE_PARALLEL_RENDER
+            Serial.print( str_sprintf(">> Launching Parallel Thread.  Mem: %u, LargestBlk: %u, PSRAM Free: %u/%u, ", ESP.getFreeHeap(),ESP.getMaxAllocHeap(), ESP.getFreePsram(), ESP.getPsramSize()) );
+            auto placement = Placement(TaskRole::Parallel);
+            xTaskCreatePinnedToCore(ParallelFor::WorkerEntry, "Parallel Worker", PARALLEL_STACK_SIZE, &g_ParallelFor, placement.Priority, &_taskParallel, placement.Core);
+            CheckHeap();
+        #endif
+    }
+
+    void StartEffectPrepareThread()
+    {
+        #if ENABLE_EFFECT_PREPARE
+            Serial.print( str_sprintf(">> Launching Effect Prepare Thread.  Mem: %u, LargestBlk: %u, PSRAM Free: %u/%u, ", ESP.getFreeHeap(),ESP.getMaxAllocHeap(), ESP.getFreePsram(), ESP.getPsramSize()) );
+            auto placement = Placement(TaskRole::EffectPrepare);
+            xTaskCreatePinnedToCore(EffectPrepareTaskEntry, "Effect Prepare Loop", PREPARE_STACK_SIZE, nullptr, placement.Priority, &_taskEffectPrepare, placement.Core);
+            CheckHeap();
+        #endif
+    }
+
+    // The rest of startup, when ENABLE_FAST_BOOT has it run alongside the drawing.  The task ends when it's done.
+    void StartBootThread()
+    {
+        #if ENABLE_FAST_BOOT
+            Serial.print( str_sprintf(">> Launching Boot Thread.  Mem: %u, LargestBlk: %u, PSRAM Free: %u/%u, ", ESP.getFreeHeap(),ESP.getMaxAllocHeap(), ESP.getFreePsram(), ESP.getPsramSize()) );
+            xTaskCreatePinnedToCore(BootTaskEntry, "Boot", BOOT_STACK_SIZE, nullptr, BOOT_PRIORITY, &_taskBoot, BOOT_CORE);
+            CheckHeap();
+        #endif
+    }
+
     void StartAudioThread()
     {
         #if ENABLE_AUDIO
             Serial.print( str_sprintf(">> Launching Audio Thread.  Mem: %u, LargestBlk: %u, PSRAM Free: %u/%u, ", ESP.getFreeHeap(),ESP.getMaxAllocHeap(), ESP.getFreePsram(), ESP.getPsramSize()) );
-            xTaskCreatePinnedToCore(AudioSamplerTaskEntry, "Audio Sampler Loop", AUDIO_STACK_SIZE, nullptr, AUDIO_PRIORITY, &_taskAudio, AUDIO_CORE);
+            auto placement = Placement(TaskRole::Audio);
+            xTaskCreatePinnedToCore(AudioSamplerTaskEntry, "Audio Sampler Loop", AUDIO_STACK_SIZE, nullptr, placement.Priority, &_taskAudio, placement.Core);
             CheckHeap();
         #endif
     }
@@ -321,11 +568,61 @@ public:
     {
         #if ENABLE_WIFI
             Serial.print( str_sprintf(">> Launching Network Thread.  Mem: %u, LargestBlk: %u, PSRAM Free: %u/%u, ", ESP.getFreeHeap(),ESP.getMaxAllocHeap(), ESP.getFreePsram(), ESP.getPsramSize()) );
-            xTaskCreatePinnedToCore(NetworkHandlingLoopEntry, "NetworkHandlingLoop", NET_STACK_SIZE, nullptr, NET_PRIORITY, &_taskNetwork, NET_CORE);
+            auto placement = Placement(TaskRole::Network);
+            xTaskCreatePinnedToCore(NetworkHandlingLoopEntry, "NetworkHandlingLoop", NET_STACK_SIZE, nullptr, placement.Priority, &_taskNetwork, placement.Core);
             CheckHeap();
         #endif
     }
 
+    // The workers that run the NetworkReader's readers, so a slow one doesn't hold up the network task
+    void StartNetworkReaderThreads()
+    {
+        #if ENABLE_WIFI
+            Serial.print( str_sprintf(">> Launching Network Reader Threads.  Mem: %u, LargestBlk: %u, PSRAM Free: %u/%u, ", ESP.getFreeHeap(),ESP.getMaxAllocHeap(), ESP.getFreePsram(), ESP.getPsramSize()) );
+            auto placement = Placement(TaskRole::NetworkReader);
+            for (int i = 0; i < NETREADER_WORKERS; i++)
+            {
+                TaskHandle_t task = nullptr;
+                xTaskCreatePinnedToCore(NetworkReaderTaskEntry, str_sprintf("Network Reader %d", i).c_str(), NETREADER_STACK_SIZE, nullptr, placement.Priority, &task, placement.Core);
+                _vNetworkReaderTasks.push_back(task);
+            }
+            CheckHeap();
+        #endif
+    }
+
+    // Takes OTA updates on core 0, so the draw loop on core 1 can keep going while one is flashed
+    void StartOTAThread()
+    {
+        #if ENABLE_OTA
+            Serial.print( str_sprintf(">> Launching OTA Thread.  Mem: %u, LargestBlk: %u, PSRAM Free: %u/%u, ", ESP.getFreeHeap(),ESP.getMaxAllocHeap(), ESP.getFreePsram(), ESP.getPsramSize()) );
+            xTaskCreatePinnedToCore(OTATaskEntry, "OTA Loop", OTA_STACK_SIZE, nullptr, OTA_PRIORITY, &_taskOTA, OTA_CORE);
+            CheckHeap();
+        #endif
+    }
+
+    // SuspendNonEssentialTasks
+    //
+    // Parks the tasks the device can do without while an OTA update is flashed, so it gets the CPU and the display
+    // keeps up.  They're resumed if the update fails; if it succeeds we reboot anyway.  The tasks aren't suspended
+    // outright, as that could stop one holding a lock or halfway through publishing the audio snapshot; instead
+    // each waits in WaitWhileNonEssentialPaused() at the top of its loop, where it holds neither.
+
+    void SuspendNonEssentialTasks()
+    {
+        _bNonEssentialPaused = true;
+    }
+
+    void ResumeNonEssentialTasks()
+    {
+        _bNonEssentialPaused = false;
+    }
+
+    void WaitWhileNonEssentialPaused() const
+    {
+        while (_bNonEssentialPaused.load())
+            delay(50);
+    }
+
     void StartDebugThread()
     {
         #if ENABLE_WIFI
@@ -339,7 +636,89 @@ public:
     {
         #if INCOMING_WIFI_ENABLED
             Serial.print( str_sprintf(">> Launching Socket Thread.  Mem: %u, LargestBlk: %u, PSRAM Free: %u/%u, ", ESP.getFreeHeap(),ESP.getMaxAllocHeap(), ESP.getFreePsram(), ESP.getPsramSize()) );
-            xTaskCreatePinnedToCore(SocketServerTaskEntry, "Socket Server Loop", SOCKET_STACK_SIZE, nullptr, SOCKET_PRIORITY, &_taskSocket, SOCKET_CORE);
+            auto placement = Placement(TaskRole::Socket);
+            xTaskCreatePinnedToCore(SocketServerTaskEntry, "Socket Server Loop", SOCKET_STACK_SIZE, nullptr, placement.Priority, &_taskSocket, placement.Core);
+            CheckHeap();
+        #endif
+    }
+
+    void StartUDPThread()
+    {
+        #if ENABLE_UDP_INGEST
+            Serial.print( str_sprintf(">> Launching UDP Thread.  Mem: %u, LargestBlk: %u, PSRAM Free: %u/%u, ", ESP.getFreeHeap(),ESP.getMaxAllocHeap(), ESP.getFreePsram(), ESP.getPsramSize()) );
+            auto placement = Placement(TaskRole::UDP);
+            xTaskCreatePinnedToCore(UDPServerTaskEntry, "UDP Server Loop", UDP_STACK_SIZE, nullptr, placement.Priority, &_taskUDP, placement.Core);
+            CheckHeap();
+        #endif
+    }
+
+    // Takes the sACN and Art-Net ports, and is placed like the UDP task as it does the same job for other protocols
+    void StartDMXThread()
+    {
+        #if ENABLE_DMX_INGEST
+            Serial.print( str_sprintf(">> Launching DMX Thread.  Mem: %u, LargestBlk: %u, PSRAM Free: %u/%u, ", ESP.getFreeHeap(),ESP.getMaxAllocHeap(), ESP.getFreePsram(), ESP.getPsramSize()) );
+            auto placement = Placement(TaskRole::UDP);
+            xTaskCreatePinnedToCore(DMXServerTaskEntry, "DMX Server Loop", DMX_STACK_SIZE, nullptr, placement.Priority, &_taskDMX, placement.Core);
+            CheckHeap();
+        #endif
+    }
+
+    // Takes the DDP port, and is placed like the UDP task for the same reason as the DMX one
+    void StartDDPThread()
+    {
+        #if ENABLE_DDP_INGEST
+            Serial.print( str_sprintf(">> Launching DDP Thread.  Mem: %u, LargestBlk: %u, PSRAM Free: %u/%u, ", ESP.getFreeHeap(),ESP.getMaxAllocHeap(), ESP.getFreePsram(), ESP.getPsramSize()) );
+            auto placement = Placement(TaskRole::UDP);
+            xTaskCreatePinnedToCore(DDPServerTaskEntry, "DDP Server Loop", DDP_STACK_SIZE, nullptr, placement.Priority, &_taskDDP, placement.Core);
+            CheckHeap();
+        #endif
+    }
+
+    void StartShowThread()
+    {
+        #if ENABLE_SHOW_PLAYBACK
+            Serial.print( str_sprintf(">> Launching Show Thread.  Mem: %u, LargestBlk: %u, PSRAM Free: %u/%u, ", ESP.getFreeHeap(),ESP.getMaxAllocHeap(), ESP.getFreePsram(), ESP.getPsramSize()) );
+            xTaskCreatePinnedToCore(ShowPlaybackTaskEntry, "Show Playback Loop", SHOW_STACK_SIZE, nullptr, SHOW_PRIORITY, &_taskShow, SHOW_CORE);
+            CheckHeap();
+        #endif
+    }
+
+    void StartShowRecorderThread()
+    {
+        #if ENABLE_SHOW_RECORDER
+            Serial.print( str_sprintf(">> Launching Show Recorder Thread.  Mem: %u, LargestBlk: %u, PSRAM Free: %u/%u, ", ESP.getFreeHeap(),ESP.getMaxAllocHeap(), ESP.getFreePsram(), ESP.getPsramSize()) );
+            xTaskCreatePinnedToCore(ShowRecorderTaskEntry, "Show Recorder Loop", SHOW_RECORDER_STACK_SIZE, nullptr, SHOW_RECORDER_PRIORITY, &_taskShowRecorder, SHOW_RECORDER_CORE);
+            CheckHeap();
+        #endif
+    }
+
+    void StartEffectSyncThread()
+    {
+        // Over ESP-NOW the effect state goes out with the rest of the link's traffic instead
+
+        #if ENABLE_EFFECT_SYNC && !ENABLE_ESPNOW
+            Serial.print( str_sprintf(">> Launching Effect Sync Thread.  Mem: %u, LargestBlk: %u, PSRAM Free: %u/%u, ", ESP.getFreeHeap(),ESP.getMaxAllocHeap(), ESP.getFreePsram(), ESP.getPsramSize()) );
+            xTaskCreatePinnedToCore(EffectSyncTaskEntry, "Effect Sync Loop", EFFECT_SYNC_STACK_SIZE, nullptr, EFFECT_SYNC_PRIORITY, &_taskEffectSync, EFFECT_SYNC_CORE);
+            CheckHeap();
+        #endif
+    }
+
+    // Stamps the answers to the clock sync requests the NetworkReader sends, as they come in
+
+    void StartClockSyncThread()
+    {
+        #if ENABLE_CLOCK_SYNC && ENABLE_WIFI
+            Serial.print( str_sprintf(">> Launching Clock Sync Thread.  Mem: %u, LargestBlk: %u, PSRAM Free: %u/%u, ", ESP.getFreeHeap(),ESP.getMaxAllocHeap(), ESP.getFreePsram(), ESP.getPsramSize()) );
+            xTaskCreatePinnedToCore(ClockSyncTaskEntry, "Clock Sync Loop", CLOCK_SYNC_STACK_SIZE, nullptr, CLOCK_SYNC_PRIORITY, &_taskClockSync, CLOCK_SYNC_CORE);
+            CheckHeap();
+        #endif
+    }
+
+    void StartESPNowThread()
+    {
+        #if ENABLE_ESPNOW
+            Serial.print( str_sprintf(">> Launching ESP-NOW Thread.  Mem: %u, LargestBlk: %u, PSRAM Free: %u/%u, ", ESP.getFreeHeap(),ESP.getMaxAllocHeap(), ESP.getFreePsram(), ESP.getPsramSize()) );
+            xTaskCreatePinnedToCore(ESPNowTaskEntry, "ESP-NOW Loop", ESPNOW_STACK_SIZE, nullptr, ESPNOW_PRIORITY, &_taskESPNow, ESPNOW_CORE);
             CheckHeap();
         #endif
     }
@@ -370,6 +749,24 @@ public:
         xTaskNotifyGive(_taskJSONWriter);
     }
 
+    void NotifyPresentThread()
+    {
+        if (_taskPresent == nullptr)
+            return;
+
+        // Hand the frame the draw loop just copied over to the present task
+        xTaskNotifyGive(_taskPresent);
+    }
+
+    void NotifyEffectPrepareThread()
+    {
+        if (_taskEffectPrepare == nullptr)
+            return;
+
+        // Wake up the prepare task; the EffectManager holds the effect it should get ready
+        xTaskNotifyGive(_taskEffectPrepare);
+    }
+
     void NotifyNetworkThread()
     {
         if (_taskNetwork == nullptr)
@@ -380,25 +777,97 @@ public:
         xTaskNotifyGive(_taskNetwork);
     }
 
-    // Effect threads run with NET priority and on the NET core by default. It seems a sensible choice
-    //   because effect threads tend to pull things from the Internet that they want to show
-    TaskHandle_t StartEffectThread(EffectTaskFunction function, LEDStripEffect* pEffect, const char* name, UBaseType_t priority = NET_PRIORITY, BaseType_t core = NET_CORE)
+    // Hands background work for an effect to the shared effect workers, which run with NET priority and on the NET
+    //   core. It seems a sensible choice because effect work tends to pull things from the Internet that it wants to
+    //   show. Returns false if the queue is full. The effect's destructor waits for its work to finish.
+    bool QueueEffectWork(EffectWorkerPool::Work work, LEDStripEffect* pEffect, const char* name)
+    {
+        std::call_once(_effectWorkersStarted, [this] { StartEffectWorkerThreads(); });
+        return g_EffectWorkers.Queue(std::move(work), pEffect, name);
+    }
+
+    // SubscribeToEvents
+    //
+    // Has the events in the mask sent to the calling task, which picks them up with WaitForEvents().  Subscribing
+    // again replaces the mask.  Returns false if the bus has no room for another task.
+
+    bool SubscribeToEvents(uint32_t mask)
+    {
+        std::lock_guard<std::mutex> guard(_subscribeMutex);
+        auto task = xTaskGetCurrentTaskHandle();
+
+        for (size_t i = 0; i < _cSubscribers; i++)
+        {
+            if (_subscribers[i].Task == task)
+            {
+                _subscribers[i].Mask = mask;
+                return true;
+            }
+        }
+
+        if (_cSubscribers >= EVENT_BUS_SUBSCRIBERS)
+        {
+            debugE("No room on the event bus for %s", pcTaskGetTaskName(task));
+            return false;
+        }
+
+        auto& entry = _subscribers[_cSubscribers];
+        entry.Task = task;
+        entry.Mask = mask;
+        _cSubscribers++;
+        return true;
+    }
+
+    // PostEvent
+    //
+    // Sends the event to every task that subscribed to it.  Events that arrive while a task is busy are merged into
+    // its notification value, so it sees each kind at most once per wait however many were posted.
+
+    void PostEvent(SystemEvent event)
+    {
+        size_t cSubscribers = _cSubscribers;
+        for (size_t i = 0; i < cSubscribers; i++)
+            if (_subscribers[i].Mask & (uint32_t) event)
+                xTaskNotify(_subscribers[i].Task, (uint32_t) event, eSetBits);
+    }
+
+    // WaitForEvents
+    //
+    // Blocks the calling task until one of the events it subscribed to is posted or the timeout passes, and returns
+    // the events that came in, or 0 on a timeout
+
+    static uint32_t WaitForEvents(TickType_t ticksToWait)
     {
-        // We use a raw pointer here just to cross the thread/task boundary. The EffectTaskEntry method
-        //   deletes the object as soon as it can.
-        EffectTaskParams* pTaskParams = new EffectTaskParams(function, pEffect);
-        TaskHandle_t effectTask = nullptr;
+        uint32_t events = 0;
+        xTaskNotifyWait(0, UINT32_MAX, &events, ticksToWait);
+        return events;
+    }
 
-        Serial.print( str_sprintf(">> Launching %s Effect Thread.  Mem: %u, LargestBlk: %u, PSRAM Free: %u/%u, ", name, ESP.getFreeHeap(),ESP.getMaxAllocHeap(), ESP.getFreePsram(), ESP.getPsramSize()) );
+    // SetEventState
+    //
+    // Events that are also states (like WiFiUp) are kept in an event group, so a task can check or wait for one.
+    // Setting the state posts the event as well.
 
-        if (xTaskCreatePinnedToCore(EffectTaskEntry, name, DEFAULT_STACK_SIZE, pTaskParams, priority, &effectTask, core) == pdPASS)
-            _vEffectTasks.push_back(effectTask);
+    void SetEventState(SystemEvent event, bool bSet)
+    {
+        if (bSet)
+        {
+            xEventGroupSetBits(_hEventStates, (uint32_t) event);
+            PostEvent(event);
+        }
         else
-            // Clean up the task params object if the thread was not actually created
-            delete pTaskParams;
+        {
+            xEventGroupClearBits(_hEventStates, (uint32_t) event);
+        }
+    }
 
-        CheckHeap();
+    bool IsEventStateSet(SystemEvent event) const
+    {
+        return xEventGroupGetBits(_hEventStates) & (uint32_t) event;
+    }
 
-        return effectTask;
+    bool WaitForEventState(SystemEvent event, TickType_t ticksToWait) const
+    {
+        return xEventGroupWaitBits(_hEventStates, (uint32_t) event, pdFALSE, pdTRUE, ticksToWait) & (uint32_t) event;
     }
 };
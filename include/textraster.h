@@ -0,0 +1,158 @@
+//+--------------------------------------------------------------------------
+//
+// File:        textraster.h
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+//
+// Description:
+//
+//    Keeps the pixels of a string in one of the SmartMatrix fonts, with
+//    its drop shadow, so text that doesn't change is drawn without going
+//    back through the font on every frame
+//
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#if USE_HUB75
+
+#include <vector>
+#include <SmartMatrix.h>
+#include "globals.h"
+
+// TextRaster
+//
+// Update() works out which pixels the string lights, and which the shadow does, but only when the text, font or
+// shadow has changed since the last time.  Draw() then just sets those pixels.  The shadow is the text moved one
+// pixel left, right, up and down, as the captions have always drawn it, less the pixels the text itself covers, so
+// each pixel is set once rather than up to five times.
+
+class TextRaster
+{
+    struct Dot
+    {
+        int16_t x;
+        int16_t y;
+    };
+
+    String           _text;
+    fontChoices      _font = font3x5;
+    bool             _bShadow = false;
+    bool             _bRasterized = false;
+    int              _width = 0;
+    int              _height = 0;
+    std::vector<Dot> _ink;
+    std::vector<Dot> _shadow;
+
+    void Rasterize()
+    {
+        const bitmap_font * pFont = fontLookup(_font);
+
+        _width  = _text.length() * pFont->Width;
+        _height = pFont->Height;
+        _ink.clear();
+        _shadow.clear();
+
+        // One pixel of margin all round, so the shadow can go outside the text's own box
+
+        const int stride = _width + 2;
+        std::vector<uint8_t> covered(stride * (_height + 2), 0);
+
+        for (size_t i = 0; i < _text.length(); i++)
+        {
+            for (int y = 0; y < _height; y++)
+            {
+                for (int x = 0; x < pFont->Width; x++)
+                {
+                    if (!getBitmapFontPixelAtXY(_text[i], x, y, pFont))
+                        continue;
+
+                    int16_t dotX = i * pFont->Width + x;
+                    _ink.push_back({ dotX, (int16_t) y });
+                    covered[(y + 1) * stride + dotX + 1] = 1;
+                }
+            }
+        }
+
+        if (!_bShadow)
+            return;
+
+        static constexpr int8_t kOffsets[4][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+
+        for (const auto & dot : _ink)
+        {
+            for (const auto & offset : kOffsets)
+            {
+                int x = dot.x + offset[0];
+                int y = dot.y + offset[1];
+                auto & cell = covered[(y + 1) * stride + x + 1];
+                if (!cell)
+                {
+                    cell = 1;
+                    _shadow.push_back({ (int16_t) x, (int16_t) y });
+                }
+            }
+        }
+    }
+
+  public:
+
+    // Returns true if the pixels had to be worked out again, which is when anything that shows it needs redrawing
+
+    bool Update(const String & text, fontChoices font, bool bShadow = false)
+    {
+        if (_bRasterized && font == _font && bShadow == _bShadow && text == _text)
+            return false;
+
+        _text        = text;
+        _font        = font;
+        _bShadow     = bShadow;
+        _bRasterized = true;
+        Rasterize();
+        return true;
+    }
+
+    // The size of the text itself, without the shadow around it
+    int Width() const
+    {
+        return _width;
+    }
+
+    int Height() const
+    {
+        return _height;
+    }
+
+    // Draw
+    //
+    // Sets the pixels on a SmartMatrix layer with the text's top left corner at x, y.  The layer clips what falls
+    // off its edges, like drawString() does.
+
+    template <typename TLayer, typename TColor>
+    void Draw(TLayer & layer, int x, int y, const TColor & color, const TColor & shadowColor = TColor()) const
+    {
+        for (const auto & dot : _shadow)
+            layer.drawPixel(x + dot.x, y + dot.y, shadowColor);
+
+        for (const auto & dot : _ink)
+            layer.drawPixel(x + dot.x, y + dot.y, color);
+    }
+};
+
+#endif
@@ -0,0 +1,222 @@
+//+--------------------------------------------------------------------------
+//
+// File:        tracing.h
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+//
+// Description:
+//
+//    Spans of time the tasks spend on their work, kept in a ring and
+//    served by /trace as Chrome trace events, which Perfetto and
+//    chrome://tracing show on a timeline per core and task
+//
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#include <atomic>
+#include <cstring>
+#include <new>
+#include <esp_timer.h>
+#include "globals.h"
+#include "memoryplacement.h"
+
+#if ENABLE_TRACING
+
+// TraceEvent
+//
+// One span, as it's handed to the exporter
+
+struct TraceEvent
+{
+    const char * Name;
+    uint32_t     Start;                 // Microseconds since boot; wraps after 71 minutes
+    uint32_t     Duration;
+    uint8_t      Task;                  // Index into the tracer's task names
+    uint8_t      Core;                  // Where the span ended
+};
+
+// Tracer
+//
+// A ring of TRACE_EVENTS spans in PSRAM.  Any task can add one without a lock: it takes a ticket, which says which
+// slot to use, and marks the slot with the ticket once it's written.  A reader copies a slot and then checks the mark
+// again, so a slot that was being written or taken over while it was read is skipped rather than sent half done.
+// Names must be string literals, or something else that lives for good, as only the pointer is kept.
+//
+// Tasks are kept by their index in a small table of names, copied in the first time each task adds a span, so the
+// export never needs a task that may have been deleted since.
+
+class Tracer
+{
+  public:
+
+    static constexpr size_t kMaxTasks = 32;
+
+  private:
+
+    struct Slot
+    {
+        std::atomic<uint32_t> Sequence;         // The ticket that wrote it, plus one; 0 while it's being written
+        TraceEvent            Event;
+    };
+
+    Slot *                    _pSlots = nullptr;
+    std::atomic<uint32_t>     _nextTicket { 0 };
+    std::atomic<uint32_t>     _cPauses { 0 };
+
+    std::atomic<TaskHandle_t> _tasks[kMaxTasks] = {};
+    char                      _taskNames[kMaxTasks][configMAX_TASK_NAME_LEN] = {};
+    std::atomic<uint32_t>     _cTasks { 0 };
+
+    // Only the task itself ever adds its own entry, so two tasks can claim slots at once but never the same task
+    // twice.  A task that's made after the table is full shares the last entry.
+
+    uint8_t TaskIndex()
+    {
+        TaskHandle_t hTask = xTaskGetCurrentTaskHandle();
+        uint32_t cTasks = std::min<uint32_t>(_cTasks.load(std::memory_order_acquire), kMaxTasks);
+
+        for (uint32_t i = 0; i < cTasks; i++)
+            if (_tasks[i].load(std::memory_order_acquire) == hTask)
+                return i;
+
+        uint32_t index = _cTasks.fetch_add(1, std::memory_order_acq_rel);
+        if (index >= kMaxTasks)
+            return kMaxTasks - 1;
+
+        strncpy(_taskNames[index], pcTaskGetTaskName(hTask), configMAX_TASK_NAME_LEN - 1);
+        _tasks[index].store(hTask, std::memory_order_release);
+        return index;
+    }
+
+  public:
+
+    // Allocates the ring; until it's called, spans are dropped
+
+    void begin()
+    {
+        if (_pSlots)
+            return;
+
+        _pSlots = static_cast<Slot *>(PlacedAlloc(sizeof(Slot) * TRACE_EVENTS, Placement::Cold, "trace"));
+        if (!_pSlots)
+        {
+            debugE("No room for the trace ring");
+            return;
+        }
+
+        for (size_t i = 0; i < TRACE_EVENTS; i++)
+            new (&_pSlots[i]) Slot { { 0 }, {} };
+    }
+
+    void Record(const char * name, uint32_t start, uint32_t duration)
+    {
+        if (!_pSlots || _cPauses.load(std::memory_order_relaxed))
+            return;
+
+        uint32_t ticket = _nextTicket.fetch_add(1, std::memory_order_relaxed);
+        Slot & slot = _pSlots[ticket % TRACE_EVENTS];
+
+        slot.Sequence.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.Event = { name, start, duration, TaskIndex(), (uint8_t) xPortGetCoreID() };
+        slot.Sequence.store(ticket + 1, std::memory_order_release);
+    }
+
+    // Stops spans being added while the ring is sent, which takes long enough that the oldest spans would otherwise
+    // be written over before they went out
+
+    void Pause()
+    {
+        _cPauses.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void Resume()
+    {
+        _cPauses.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    // The tickets of the spans still in the ring, from the oldest up to, but not including, the last
+
+    void Window(uint32_t & first, uint32_t & last) const
+    {
+        last  = _nextTicket.load(std::memory_order_acquire);
+        first = last > TRACE_EVENTS ? last - TRACE_EVENTS : 0;
+    }
+
+    // Copies out the span with the given ticket, and returns false if it's been written over or isn't done yet
+
+    bool Read(uint32_t ticket, TraceEvent & event) const
+    {
+        if (!_pSlots)
+            return false;
+
+        const Slot & slot = _pSlots[ticket % TRACE_EVENTS];
+        if (slot.Sequence.load(std::memory_order_acquire) != ticket + 1)
+            return false;
+
+        event = slot.Event;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return slot.Sequence.load(std::memory_order_relaxed) == ticket + 1;
+    }
+
+    size_t TaskCount() const
+    {
+        return std::min<uint32_t>(_cTasks.load(std::memory_order_acquire), kMaxTasks);
+    }
+
+    // The name of a task by its index, or nullptr if it's still being added
+    const char * TaskName(size_t index) const
+    {
+        return _tasks[index].load(std::memory_order_acquire) ? _taskNames[index] : nullptr;
+    }
+};
+
+extern Tracer g_Tracer;
+
+// TraceSpan
+//
+// Adds a span from its construction to the end of the enclosing scope
+
+class TraceSpan
+{
+    const char * _name;
+    uint32_t     _start;
+
+  public:
+
+    explicit TraceSpan(const char * name) : _name(name), _start((uint32_t) esp_timer_get_time())
+    {
+    }
+
+    ~TraceSpan()
+    {
+        g_Tracer.Record(_name, _start, (uint32_t) esp_timer_get_time() - _start);
+    }
+};
+
+#define TRACE_SPAN_NAME2(line) _traceSpan##line
+#define TRACE_SPAN_NAME(line)  TRACE_SPAN_NAME2(line)
+#define TRACE_SPAN(name)       TraceSpan TRACE_SPAN_NAME(__LINE__)(name)
+
+#else
+
+#define TRACE_SPAN(name)
+
+#endif
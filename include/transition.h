@@ -0,0 +1,240 @@
+//+--------------------------------------------------------------------------
+//
+// File:        transition.h
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+//
+// Description:
+//
+//    Composites the outgoing and incoming effects during an effect change,
+//    so one blends or wipes into the other rather than fading through black
+//
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include "ledstripeffect.h"
+
+#if ENABLE_CROSSFADE_COMPOSITOR
+
+// TransitionMode
+//
+// How the incoming effect replaces the outgoing one.  Every mode is a per pixel weight for the incoming frame.
+
+enum class TransitionMode : uint8_t
+{
+    CrossFade,          // Every pixel blends at the same rate
+    Dissolve,           // Pixels switch over in a scattered order, each with a short blend of its own
+    Wipe,               // A soft edge sweeps from left to right
+    Iris,               // A soft ring opens from the middle
+    Count
+};
+
+// TransitionCompositor
+//
+// While a transition runs, each effect draws into an offscreen frame of its own for every channel, which keeps the
+// history that effects fading or blurring their last frame rely on.  The two frames are then blended into leds
+// with an 8 bit fixed point weight.  When the pair doesn't fit the frame budget, the incoming effect only draws
+// every CROSSFADE_INCOMING_DIVIDER frames and its last frame is blended in between.
+
+class TransitionCompositor
+{
+    RenderTarget _outgoingFrames;
+    RenderTarget _incomingFrames;
+    std::shared_ptr<LEDStripEffect> _outgoing;
+    TransitionMode _mode = TransitionMode::CrossFade;
+    unsigned long _msStart = 0;
+    uint _frameCount = 0;
+    uint _transitionCount = 0;
+
+    // Ramp
+    //
+    // Weight, from 0 to 256, of a pixel at pos along a sweep of range with a soft edge of the given width, in the
+    // same units.  Progress is 0 to 256, and at 256 every pixel in the range has reached full weight.
+
+    static inline int Ramp(int progress, int pos, int range, int edge)
+    {
+        return std::clamp((progress * (range + edge) - (pos << 8)) / edge, 0, 256);
+    }
+
+    static inline CRGB Mix(const CRGB & from, const CRGB & to, int weight)
+    {
+        return CRGB(from.r + (((to.r - from.r) * weight) >> 8),
+                    from.g + (((to.g - from.g) * weight) >> 8),
+                    from.b + (((to.b - from.b) * weight) >> 8));
+    }
+
+    // Where a pixel index falls in the dissolve order.  A multiplicative hash scatters neighbors well enough.
+
+    static inline int DissolveRank(uint32_t i)
+    {
+        return (i * 2654435761u) >> 24;
+    }
+
+    static void DrawInto(LEDStripEffect & effect, const RenderTarget & target)
+    {
+        auto usStart = micros();
+        effect.DrawInto(target);
+        effect.RecordDraw(usStart, micros());
+    }
+
+    void Blend(GFXBase & gfx, size_t channel, int progress) const
+    {
+        const CRGB * pOut = _outgoingFrames.Frame(channel);
+        const CRGB * pIn  = _incomingFrames.Frame(channel);
+        const size_t cLEDs = _outgoingFrames.FrameSize(channel);
+        const int width   = gfx.width();
+        const int height  = gfx.height();
+
+        switch (_mode)
+        {
+            case TransitionMode::CrossFade:
+            {
+                for (size_t i = 0; i < cLEDs; i++)
+                    gfx.leds[i] = Mix(pOut[i], pIn[i], progress);
+                break;
+            }
+
+            case TransitionMode::Dissolve:
+            {
+                constexpr int kEdge = 64;
+                for (size_t i = 0; i < cLEDs; i++)
+                    gfx.leds[i] = Mix(pOut[i], pIn[i], Ramp(progress, DissolveRank(i), 256, kEdge));
+                break;
+            }
+
+            case TransitionMode::Wipe:
+            {
+                const int edge = width / 8 + 1;
+                for (int x = 0; x < width; x++)
+                {
+                    int weight = Ramp(progress, x, width, edge);
+                    for (int y = 0; y < height; y++)
+                    {
+                        uint16_t i = gfx.fastXY(x, y);
+                        gfx.leds[i] = Mix(pOut[i], pIn[i], weight);
+                    }
+                }
+                break;
+            }
+
+            case TransitionMode::Iris:
+            {
+                // Distances are in half pixels from the center, with the usual octagon estimate of the hypotenuse
+
+                auto distance = [](int dx, int dy) { return std::max(dx, dy) + std::min(dx, dy) / 2; };
+                const int range = distance(width - 1, height - 1) + 1;
+                const int edge = range / 8 + 1;
+
+                for (int y = 0; y < height; y++)
+                {
+                    for (int x = 0; x < width; x++)
+                    {
+                        uint16_t i = gfx.fastXY(x, y);
+                        int d = distance(abs(2 * x - (width - 1)), abs(2 * y - (height - 1)));
+                        gfx.leds[i] = Mix(pOut[i], pIn[i], Ramp(progress, d, range, edge));
+                    }
+                }
+                break;
+            }
+
+            default:
+                break;
+        }
+    }
+
+public:
+
+    bool IsActive() const
+    {
+        return _outgoing != nullptr;
+    }
+
+    // Begin
+    //
+    // Called as the incoming effect is about to start, while leds still hold the last frame of the outgoing one
+
+    void Begin(const std::shared_ptr<LEDStripEffect> & outgoing, std::vector<std::shared_ptr<GFXBase>> & gfx)
+    {
+        if (!_outgoingFrames.Allocate(gfx) || !_incomingFrames.Allocate(gfx))
+        {
+            _outgoing.reset();                                      // Without the frames, we just cut over
+            return;
+        }
+
+        _outgoingFrames.CopyFrom(gfx);
+
+        #if CROSSFADE_MODE >= 0
+            _mode = (TransitionMode) CROSSFADE_MODE;
+        #else
+            _mode = (TransitionMode) (_transitionCount++ % (uint) TransitionMode::Count);
+        #endif
+
+        _outgoing   = outgoing;
+        _msStart    = millis();
+        _frameCount = 0;
+    }
+
+    // Called once the incoming effect's Start() has run, so it picks up from whatever that did to leds
+
+    void SeedIncoming(std::vector<std::shared_ptr<GFXBase>> & gfx)
+    {
+        _incomingFrames.CopyFrom(gfx);
+    }
+
+    // Render
+    //
+    // Draws both effects and blends them into leds.  Once the transition has run its course, this puts the incoming
+    // effect's own frame back into leds and returns false, so the caller should draw it there from then on.
+
+    bool Render(LEDStripEffect & incoming, std::vector<std::shared_ptr<GFXBase>> & gfx)
+    {
+        auto msElapsed = millis() - _msStart;
+
+        if (msElapsed >= EFFECT_CROSS_FADE_TIME || _outgoing.get() == &incoming)
+        {
+            _incomingFrames.CopyTo(gfx);
+            _outgoing.reset();
+            _frameCount = 0;
+            return false;
+        }
+
+        DrawInto(*_outgoing, _outgoingFrames);
+
+        float msBudget = EFFECT_PROFILE_BUDGET_RATIO * MILLIS_PER_SECOND / std::max<size_t>(1, incoming.DesiredFramesPerSecond());
+        bool  bFits    = _outgoing->AverageDrawMilliseconds() + incoming.AverageDrawMilliseconds() <= msBudget;
+
+        if (bFits || _frameCount % CROSSFADE_INCOMING_DIVIDER == 0)
+            DrawInto(incoming, _incomingFrames);
+        _frameCount++;
+
+        int progress = msElapsed * 256 / EFFECT_CROSS_FADE_TIME;
+        for (size_t i = 0; i < gfx.size(); i++)
+        {
+            Blend(*gfx[i], i, progress);
+            gfx[i]->MarkAllDirty();
+        }
+        return true;
+    }
+};
+
+#endif
@@ -30,10 +30,15 @@
 
 #pragma once
 
+#include <algorithm>
+#include <cmath>
 #include <cstddef>
 #include <cstdint>
+#include <memory>
+#include <new>
 #include <sys/time.h>
 #include <optional>
+#include <esp_timer.h>
 #include <WString.h>
 
 #ifndef MICROS_PER_SECOND
@@ -43,6 +48,11 @@
 // AppTime
 //
 // A class that keeps track of the clock, how long the last frame took, calculating FPS, etc.
+//
+// Besides the wall clock time the frame started at, which is what network timestamps are compared against, each
+// frame is stamped once from the monotonic microsecond timer.  Effects should draw against that stamp rather than
+// reading millis() or the time of day themselves: it costs nothing to read, every effect in the frame sees the
+// same time, it never steps when the clock is set, and under a fixed step it moves on exactly like the frames do.
 
 class CAppTime
 {
@@ -50,9 +60,27 @@ class CAppTime
 
     double _lastFrame = CurrentTime();
     double _deltaTime = 1.0;
+    double _fixedStep = 0.0;
+    double _clockOffset = 0.0;
+
+    int64_t  _frameMicros = esp_timer_get_time();       // Monotonic time the frame started at
+    int64_t  _fixedStepMicros = 0;
+    double   _frameSeconds = 0.0;                       // The same, and the frame's length, in the forms effects use
+    uint32_t _frameSecondsFixed = 0;
+    uint32_t _frameDeltaFixed = 0;
+
+    void StampFrame(int64_t micros, int64_t deltaMicros)
+    {
+        _frameMicros       = micros;
+        _frameSeconds      = micros / (double)MICROS_PER_SECOND;
+        _frameSecondsFixed = (uint32_t)((micros << kFixedShift) / MICROS_PER_SECOND);
+        _frameDeltaFixed   = (uint32_t)((deltaMicros << kFixedShift) / MICROS_PER_SECOND);
+    }
 
   public:
 
+    static constexpr int kFixedShift = 16;              // The fixed point times are in 16.16 seconds
+
     // NewFrame
     //
     // Call this at the start of every frame or udpate, and it'll figure out and keep track of how
@@ -60,17 +88,25 @@ class CAppTime
 
     void NewFrame()
     {
-        timeval tv;
-        gettimeofday(&tv, nullptr);
-        double current = CurrentTime();
-        _deltaTime = current - _lastFrame;
+        // With a fixed step set, time moves on by exactly that much every frame, whatever the clock says
+
+        if (_fixedStep > 0.0)
+        {
+            _deltaTime = _fixedStep;
+            _lastFrame += _fixedStep;
+            StampFrame(_frameMicros + _fixedStepMicros, _fixedStepMicros);
+            return;
+        }
 
-        // Cap the delta time at one full second
+        // The delta comes from the monotonic timer, so setting the clock or changing the clock offset can't run it
+        // backwards or stretch it.  It's still capped at one full second.
 
-        if (_deltaTime > 1.0)
-            _deltaTime = 1.0;
+        int64_t now = esp_timer_get_time();
+        int64_t delta = std::min<int64_t>(std::max<int64_t>(now - _frameMicros, 0), MICROS_PER_SECOND);
 
-        _lastFrame = current;
+        StampFrame(now, delta);
+        _deltaTime = delta / (double)MICROS_PER_SECOND;
+        _lastFrame = CurrentTime() + _clockOffset;
     }
 
     CAppTime() : _lastFrame(CurrentTime())
@@ -83,6 +119,71 @@ class CAppTime
         return _lastFrame;
     }
 
+    // FrameMicros, FrameMillis and FrameSeconds
+    //
+    // The monotonic time the frame started at.  FrameMillis() counts like millis() does, so it can be compared with
+    // the millis() values the audio code stamps things with.
+
+    int64_t FrameMicros() const
+    {
+        return _frameMicros;
+    }
+
+    uint32_t FrameMillis() const
+    {
+        return (uint32_t)(_frameMicros / 1000);
+    }
+
+    double FrameSeconds() const
+    {
+        return _frameSeconds;
+    }
+
+    // FrameSecondsFixed and FrameDeltaFixed
+    //
+    // The frame's start and length in 16.16 fixed point seconds, for effects that keep their phases in integers.  The
+    // start wraps every 65536 seconds, so only differences and phases should be taken from it.
+
+    uint32_t FrameSecondsFixed() const
+    {
+        return _frameSecondsFixed;
+    }
+
+    uint32_t FrameDeltaFixed() const
+    {
+        return _frameDeltaFixed;
+    }
+
+    // SetFixedStep
+    //
+    // Makes NewFrame() advance by step seconds from startTime instead of following the clock, so that a replay
+    // sees the same times on every run.  A step of 0 goes back to the clock.
+
+    void SetFixedStep(double step, double startTime = 0.0)
+    {
+        _fixedStep = step;
+        _fixedStepMicros = step > 0.0 ? llround(step * MICROS_PER_SECOND) : 0;
+        _lastFrame = step > 0.0 ? startTime : CurrentTime() + _clockOffset;
+        _deltaTime = step > 0.0 ? step : 1.0;
+
+        // The monotonic stamp starts from the same time, so it and the frame start time move on together
+
+        if (step > 0.0)
+            StampFrame(llround(startTime * MICROS_PER_SECOND), _fixedStepMicros);
+        else
+            StampFrame(esp_timer_get_time(), MICROS_PER_SECOND);
+    }
+
+    // SetClockOffset
+    //
+    // Runs the frame times this many seconds ahead of our own clock, so a node that follows another one's effects
+    // can draw them against the other node's clock.  Anything that reads the clock itself doesn't see it.
+
+    void SetClockOffset(double offset)
+    {
+        _clockOffset = offset;
+    }
+
     static double CurrentTime()
     {
         timeval tv;
@@ -92,7 +193,7 @@ class CAppTime
 
     double FrameElapsedTime() const
     {
-        return FrameStartTime() - CurrentTime();
+        return FrameStartTime() - CurrentTime() - _clockOffset;
     }
 
     static double TimeFromTimeval(const timeval & tv)
@@ -287,6 +388,8 @@ public:
     pointer allocate(size_type n, const void * hint = 0)
     {
         void * pmem = PreferPSRAMAlloc(n*sizeof(T));
+        if (!pmem)
+            throw std::bad_alloc();
         return static_cast<pointer>(pmem) ;
     }
 
@@ -336,15 +439,32 @@ std::unique_ptr<T> make_unique_psram(Args&&... args)
     return std::unique_ptr<T>(ptr);
 }
 
+// Returns nullptr rather than throwing when there's no room, as the callers check for that
+
 template<typename T>
 std::unique_ptr<T[]> make_unique_psram_array(size_t size)
 {
-    psram_allocator<T> allocator;
-    T* ptr = allocator.allocate(size);
+    T* ptr = static_cast<T *>(PreferPSRAMAlloc(size * sizeof(T)));
     // No need to call construct since arrays don't have constructors
     return std::unique_ptr<T[]>(ptr);
 }
 
+// unique_free_array
+//
+// For the arrays that come from malloc, psram_allocator or PlacedAlloc, which have to go back with free() rather
+// than delete[]
+
+struct free_deleter
+{
+    void operator()(void * p) const
+    {
+        free(p);
+    }
+};
+
+template <typename T>
+using unique_free_array = std::unique_ptr<T[], free_deleter>;
+
 // make_shared_psram
 //
 // Same as std::make_shared except allocates preferentially from the PSRAM pool
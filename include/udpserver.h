@@ -0,0 +1,170 @@
+//+--------------------------------------------------------------------------
+//
+// File:        udpserver.h
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+//
+//
+// Description:
+//
+//    Receives LED data over UDP, optionally joined to a multicast group, so
+//    that one sender can push a frame to every node with a single transmit.
+//
+//    Each datagram carries one packet in the same format as the TCP socket
+//    server (PIXELDATA64, PEAKDATA, BEATDATA or a "DAVE" compressed packet),
+//    preceded by a small header with a per-channel sequence number:
+//
+//      uint32_t  magic         ascii "NDUP"
+//      uint32_t  sequence      incremented by the sender for every frame it
+//                              sends to a channel
+//
+//    Datagrams that arrive late or out of order are dropped rather than
+//    being put in the buffer ring.  Packets must fit in a single datagram,
+//    so large frames should be sent compressed.
+//
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <memory>
+
+#include "socketserver.h"
+
+#define UDP_PIXEL_HEADER        (0x5055444E)                                    // ascii "NDUP" as header
+#define UDP_PIXEL_HEADER_SIZE   8                                               // Magic plus 32-bit sequence number
+
+#if ENABLE_UDP_INGEST
+
+#if !INCOMING_WIFI_ENABLED
+    #error ENABLE_UDP_INGEST requires INCOMING_WIFI_ENABLED
+#endif
+
+#define UDP_SEQUENCE_RESYNC     256                                             // A sequence this far behind means the sender restarted
+
+// UDPServer
+//
+// Listens for LED data datagrams and puts them into the LEDBufferManager ring
+
+class UDPServer
+{
+private:
+
+    int                         _port;
+    int                         _fd;
+    std::unique_ptr<uint8_t []> _pBuffer;
+    std::unique_ptr<uint8_t []> _abOutputBuffer;
+    uint32_t                    _lastSequence[NUM_CHANNELS] = { 0 };
+    bool                        _bHaveSequence[NUM_CHANNELS] = { false };
+
+    bool IsCurrentSequence(uint16_t channelMask, uint32_t sequence);
+    bool ProcessDatagram(uint32_t sequence, size_t cbPacket);
+
+public:
+
+    uint32_t                    _cReceived = 0;
+    uint32_t                    _cDropped  = 0;
+
+    explicit UDPServer(int port) :
+        _port(port),
+        _fd(-1)
+    {
+        _pBuffer.reset( PlacedAlloc<uint8_t>(MAXIMUM_PACKET_SIZE, Placement::Cold, "udp receive") );
+        _abOutputBuffer.reset( PlacedAlloc<uint8_t>(MAXIMUM_PACKET_SIZE+1, Placement::Hot, "udp output") );      // +1 for uzlib one byte overreach bug
+    }
+
+    void release()
+    {
+        if (_fd >= 0)
+        {
+            close(_fd);
+            _fd = -1;
+        }
+    }
+
+    bool begin()
+    {
+        if ((_fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+        {
+            debugW("UDP socket error\n");
+            return false;
+        }
+
+        int opt = 1;
+        if (setsockopt(_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)))
+        {
+            perror("setsockopt udp");
+            release();
+            return false;
+        }
+
+        // Time out once a second so the loop notices when WiFi has gone away
+
+        struct timeval to;
+        to.tv_sec = 1;
+        to.tv_usec = 0;
+        if (setsockopt(_fd, SOL_SOCKET, SO_RCVTIMEO, &to, sizeof(to)) < 0)
+        {
+            debugW("Unable to set read timeout on UDP socket!");
+            release();
+            return false;
+        }
+
+        struct sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = INADDR_ANY;
+        address.sin_port = htons( _port );
+
+        if (bind(_fd, (struct sockaddr *)&address, sizeof(address)) < 0)
+        {
+            perror("bind failed for udp\n");
+            release();
+            return false;
+        }
+
+        #ifdef UDP_MULTICAST_GROUP
+            struct ip_mreq mreq;
+            mreq.imr_multiaddr.s_addr = inet_addr(UDP_MULTICAST_GROUP);
+            mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+            if (setsockopt(_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0)
+            {
+                debugW("Unable to join multicast group %s", UDP_MULTICAST_GROUP);
+                release();
+                return false;
+            }
+            debugI("Joined multicast group %s for UDP pixel data", UDP_MULTICAST_GROUP);
+        #endif
+
+        // Start over with sequence tracking, as the sender may well have restarted while we were away
+
+        memset(_bHaveSequence, 0, sizeof(_bHaveSequence));
+        return true;
+    }
+
+    // ProcessIncomingDatagramsLoop
+    //
+    // Receives datagrams until the socket fails or WiFi drops, dispatching each one into the buffer ring
+
+    void ProcessIncomingDatagramsLoop();
+};
+
+#endif
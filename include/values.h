@@ -42,8 +42,14 @@ struct Values
     float Brite;
     uint32_t Watts;
     uint32_t FPS = 0;                                                       // Our global framerate
+    uint32_t MissedFrames = 0;                                              // Local frames that finished after their deadline
+    uint32_t FrameMicros = 0;                                               // What the last frame drawn took, from start to sent out
+    uint32_t FramesShown = 0;                                               // Frames sent out to the LEDs
+    uint32_t FramesSkipped = 0;                                             // Frames not sent, as they were the same as the last one
     bool UpdateStarted = false;                                             // Has an OTA update started?
+    uint8_t UpdateProgress = 0;                                             // How far along it is, in percent
     uint8_t Fader = 255;
+    int8_t WiFiRSSI = 0;                                                    // Cached once a second by the network task, as WiFi.RSSI() isn't free
 #if USE_HUB75
     int MatrixPowerMilliwatts = 0;                                         // Matrix power draw in mw
     uint8_t MatrixScaledBrightness = 255;                                  // 0-255 scaled brightness to stay in limit
@@ -41,8 +41,7 @@
 
 #include <map>
 #include <WiFi.h>
-#include <FS.h>
-#include <SPIFFS.h>
+#include "storage.h"
 #include <AsyncTCP.h>
 #include <ESPAsyncWebServer.h>
 #include <Arduino.h>
@@ -52,8 +51,14 @@
 #include "deviceconfig.h"
 #include "effects.h"
 #include "jsonbase.h"
+#include "jsonstream.h"
 #include "network.h"
 
+#if ENABLE_LED_PREVIEW_SOCKET
+    #include <mutex>
+    #include "ledviewer.h"
+#endif
+
 class CWebServer
 {
   private:
@@ -99,9 +104,74 @@ class CWebServer
     static std::vector<std::reference_wrapper<SettingSpec>> deviceSettingSpecs;
     static const std::map<String, ValueValidator> settingValidators;
 
+    #if ENABLE_SPEC_RESPONSE_CACHE
+
+        // CachedResponse
+        //
+        // A JSON response that's been built once and kept gzipped, with the ETag that identifies its content
+
+        struct CachedResponse
+        {
+            std::vector<uint8_t, psram_allocator<uint8_t>> Body;
+            String ETag;
+        };
+
+        // Keyed by the effect the specs belong to, or nullptr for the device's own, and emptied when the effect list changes
+        static std::map<const LEDStripEffect *, std::shared_ptr<const CachedResponse>> specResponseCache;
+        static uint32_t specResponseCacheVersion;
+    #endif
+
     AsyncWebServer _server;
     StaticStatistics _staticStats;
 
+    #if ENABLE_LIVE_STATE_SOCKET
+
+        // LiveState
+        //
+        // The figures pushed over the live state socket, as last sent, so that only what changed goes out next time
+
+        struct LiveState
+        {
+            uint32_t FPS        = 0;
+            int      CPU        = -1;
+            int      CPUCore0   = -1;
+            int      CPUCore1   = -1;
+            uint32_t Heap       = 0;
+            uint32_t HeapMin    = 0;
+            uint32_t PSRAM      = 0;
+            size_t   Effect     = SIZE_MAX;
+            uint     Interval   = 0;
+            bool     Eternal    = false;
+        };
+
+        AsyncWebSocket _liveSocket;
+        LiveState _lastLiveState;
+        std::atomic_bool _bLiveStateFull = true;        // Set when a client connects, so it gets everything next time
+    #endif
+
+    #if ENABLE_LED_PREVIEW_SOCKET
+
+        // PreviewClient
+        //
+        // A browser watching the LEDs, by its web socket client id.  Frames are encoded by the color data server's
+        // encoders, once for every client that asked for the same form.
+
+        struct PreviewClient
+        {
+            ColorStreamSettings                Settings;
+            std::shared_ptr<ColorFrameEncoder> pEncoder;
+            bool                               bNeedsKeyFrame = true;
+        };
+
+        AsyncWebSocket _previewSocket;
+        std::map<uint32_t, PreviewClient> _previewClients;
+        ColorEncoderSet _previewEncoders;
+        std::mutex _previewMutex;                       // The socket's events come in on the async TCP task
+        uint32_t _lastPreviewFrame = 0;
+
+        void OnPreviewEvent(AsyncWebSocketClient * pClient, AwsEventType type, void * pArg, uint8_t * pData, size_t length);
+    #endif
+
     // Helper functions/templates
 
     // Convert param value to a specific type and forward it to a setter function that expects that type as an argument
@@ -154,7 +224,13 @@ class CWebServer
 
     static bool IsPostParamTrue(AsyncWebServerRequest * pRequest, const String & paramName);
     static const std::vector<std::reference_wrapper<SettingSpec>> & LoadDeviceSettingSpecs();
-    static void SendSettingSpecsResponse(AsyncWebServerRequest * pRequest, const std::vector<std::reference_wrapper<SettingSpec>> & settingSpecs);
+    static void SendJsonStream(AsyncWebServerRequest * pRequest, std::shared_ptr<JsonArrayStream> pStream);
+    #if ENABLE_SPEC_RESPONSE_CACHE
+        static std::shared_ptr<const CachedResponse> BuildCachedResponse(JsonArrayStream & stream);
+        static void SendCachedResponse(AsyncWebServerRequest * pRequest, const LEDStripEffect * pKey, std::shared_ptr<JsonArrayStream> pStream);
+    #endif
+    static void SendSettingSpecsResponse(AsyncWebServerRequest * pRequest, const std::vector<std::reference_wrapper<SettingSpec>> & settingSpecs,
+                                         std::shared_ptr<LEDStripEffect> owner = nullptr);
     static void SetSettingsIfPresent(AsyncWebServerRequest * pRequest);
     static long GetEffectIndexFromParam(AsyncWebServerRequest * pRequest, bool post = false);
     static bool CheckAndGetSettingsEffect(AsyncWebServerRequest * pRequest, std::shared_ptr<LEDStripEffect> & effect, bool post = false);
@@ -163,6 +239,7 @@ class CWebServer
 
     // Endpoint member functions
 
+    static void GetEffectsConfig(AsyncWebServerRequest * pRequest);
     static void GetEffectListText(AsyncWebServerRequest * pRequest);
     static void GetSettingSpecs(AsyncWebServerRequest * pRequest);
     static void GetSettings(AsyncWebServerRequest * pRequest);
@@ -176,11 +253,50 @@ class CWebServer
     static void EnableEffect(AsyncWebServerRequest * pRequest);
     static void DisableEffect(AsyncWebServerRequest * pRequest);
     static void MoveEffect(AsyncWebServerRequest * pRequest);
+    static void ApplyEffectBatch(AsyncWebServerRequest * pRequest);
     static void CopyEffect(AsyncWebServerRequest * pRequest);
     static void DeleteEffect(AsyncWebServerRequest * pRequest);
     static void NextEffect(AsyncWebServerRequest * pRequest);
     static void PreviousEffect(AsyncWebServerRequest * pRequest);
 
+    #if ENABLE_EFFECT_REPLAY
+        static void GetReplayReport(AsyncWebServerRequest * pRequest);
+        static void StartReplay(AsyncWebServerRequest * pRequest);
+        static void RecordReplayAudio(AsyncWebServerRequest * pRequest);
+    #endif
+
+    #if ENABLE_SHOW_RECORDER
+        static void GetShowRecording(AsyncWebServerRequest * pRequest);
+        static void SetShowRecording(AsyncWebServerRequest * pRequest);
+    #endif
+
+    #if ENABLE_ASSET_STORE
+        static void GetAssets(AsyncWebServerRequest * pRequest);
+        static void ReceiveAssetBody(AsyncWebServerRequest * pRequest, uint8_t * pData, size_t length, size_t index, size_t total);
+        static void UploadAsset(AsyncWebServerRequest * pRequest);
+        static void DeleteAsset(AsyncWebServerRequest * pRequest);
+        static void ClearAssets(AsyncWebServerRequest * pRequest);
+    #endif
+
+    #if ENABLE_METRICS
+        static void GetMetrics(AsyncWebServerRequest * pRequest);
+    #endif
+
+    #if ENABLE_STALL_WATCH
+        static void GetStalls(AsyncWebServerRequest * pRequest);
+    #endif
+
+    #if ENABLE_TRACING
+        static void GetTrace(AsyncWebServerRequest * pRequest);
+    #endif
+
+    #if ENABLE_PLAYLISTS
+        static void GetPlaylists(AsyncWebServerRequest * pRequest);
+        static void SetPlaylist(AsyncWebServerRequest * pRequest);
+        static void ActivatePlaylist(AsyncWebServerRequest * pRequest);
+        static void DeletePlaylist(AsyncWebServerRequest * pRequest);
+    #endif
+
     // Not static because it uses member _staticStats
     void GetStatistics(AsyncWebServerRequest * pRequest);
 
@@ -204,10 +320,26 @@ class CWebServer
 
     CWebServer()
         : _server(NetworkPort::Webserver), _staticStats()
+        #if ENABLE_LIVE_STATE_SOCKET
+            , _liveSocket("/ws")
+        #endif
+        #if ENABLE_LED_PREVIEW_SOCKET
+            , _previewSocket("/ws/leds")
+        #endif
     {}
 
     // begin - register page load handlers and start serving pages
     void begin();
+
+    #if ENABLE_LIVE_STATE_SOCKET
+        // Sends what changed since last time to every client of the live state socket, as one message
+        void PushLiveState();
+    #endif
+
+    #if ENABLE_LED_PREVIEW_SOCKET
+        // Encodes the frame last drawn for the preview clients that are due one, and sends it to them
+        void PushLEDPreview();
+    #endif
 };
 
 // Set value in lambda using a forwarding function. Always returns true
@@ -0,0 +1,105 @@
+//+--------------------------------------------------------------------------
+//
+// File:        workslice.h
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+//
+// Description:
+//
+//    Helpers for effects that build something before they can animate it,
+//    so the building happens a little at a time between frames
+//
+//---------------------------------------------------------------------------
+
+#pragma once
+
+#include <Arduino.h>
+#include <utility>
+
+// WorkSlice
+//
+// Runs a job one step at a time for up to a fixed number of microseconds per call, so a job that would stall a frame
+// is spread over as many as it needs.  A step is the job's to define, and should be short next to the budget.
+
+class WorkSlice
+{
+    uint32_t _budgetMicros;
+
+  public:
+
+    explicit WorkSlice(uint32_t budgetMicros) : _budgetMicros(budgetMicros)
+    {
+    }
+
+    // Calls step() until it returns false, meaning the job is done, or the time is up.  It's always called at least
+    // once, so the job moves along however long the steps take.  Returns true if the job is done.
+
+    template <typename Step>
+    bool Run(Step step) const
+    {
+        auto usStart = micros();
+
+        do
+        {
+            if (!step())
+                return true;
+        }
+        while (micros() - usStart < _budgetMicros);
+
+        return false;
+    }
+};
+
+// DoubleBuffer
+//
+// A front copy that's being drawn and a back copy that's being built.  Once the back one is finished it's marked
+// ready, and Swap() makes it the front as soon as the effect has shown all it wants to of the current one.
+
+template <typename T>
+class DoubleBuffer
+{
+    T    _buffers[2];
+    int  _front       = 0;
+    bool _bBackReady  = false;
+
+  public:
+
+    T & Front()                 { return _buffers[_front]; }
+    const T & Front() const     { return _buffers[_front]; }
+    T & Back()                  { return _buffers[1 - _front]; }
+
+    bool BackReady() const      { return _bBackReady; }
+    void SetBackReady()         { _bBackReady = true; }
+
+    // Brings the finished back copy to the front, and returns false if it isn't finished yet
+    bool Swap()
+    {
+        if (!_bBackReady)
+            return false;
+
+        _front = 1 - _front;
+        _bBackReady = false;
+        return true;
+    }
+
+    void Reset()
+    {
+        _bBackReady = false;
+    }
+};
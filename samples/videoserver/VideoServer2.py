@@ -18,6 +18,7 @@
 import cv2                          # python3 -m pip install opencv-python
 from pytube import YouTube          # python3 -m pip install pytube
 import sys
+import select
 import socket
 import time
 import struct
@@ -33,6 +34,79 @@ URL = "https://youtu.be/WPdCT0l6vGs"
 ESP32_WIFI_ADDRESS = '192.168.8.127'
 PORT = 49152
 WIFI_COMMAND_PIXELDATA64 = 3
+RESPONSE_HAS_STATS = 0x0001
+RESPONSE_HAS_FEEDBACK = 0x0002
+
+# Pacer
+#
+# Reads the SocketResponse packets the node sends back and works out how long to wait before the next frame, and
+# how hard to compress it, so the node's buffer ring stays about half full.  A node built with
+# SOCKET_RESPONSE_FEEDBACK also says when our last frame really went out against the time we put on it; if that's
+# late, the frames are timed a little further ahead from then on.
+
+class Pacer:
+
+    def __init__(self):
+        self.reset()
+
+    # Forgets what the last connection told us, including any response it was halfway through sending
+
+    def reset(self):
+        self.pending = b''
+        self.buffer_size = 0
+        self.buffer_pos = 0
+        self.late = 0.0
+        self.level = 6
+
+    # Returns False once the socket has failed or been closed by the node, so the caller can reconnect
+
+    def poll(self, sock):
+        try:
+            while select.select([sock], [], [], 0)[0]:
+                data = sock.recv(4096)
+                if not data:
+                    return False
+                self.pending += data
+        except (socket.error, ValueError):
+            return False
+
+        while len(self.pending) >= 4:
+            size = struct.unpack_from('<I', self.pending)[0]
+            if size < 4:
+                self.pending = b''                      # Not a response we can step over, so drop what's left
+                break
+            if len(self.pending) < size:
+                break
+            self.parse(self.pending[:size])
+            self.pending = self.pending[size:]
+        return True
+
+    def parse(self, response):
+        self.buffer_size, self.buffer_pos = struct.unpack_from('<II', response, 48)
+        extensions = struct.unpack_from('<I', response, 68)[0]
+        offset = 72 + (24 if extensions & RESPONSE_HAS_STATS else 0)
+        if extensions & RESPONSE_HAS_FEEDBACK and len(response) >= offset + 16:
+            timestamp, delta = struct.unpack_from('<dd', response, offset)
+            if timestamp > 0:
+                self.late = max(0.0, delta) / 10        # A little at a time, as the frames already sent are late too
+
+    # Waits longer than a frame while the ring is more than half full and shorter while it's less, and spends more
+    # effort on compression while it runs low, as that's when the frames aren't getting there fast enough
+
+    def next_delay(self, fps):
+        period = 1.0 / fps
+        if self.buffer_size == 0:
+            return period
+        target = self.buffer_size / 2
+        error = (self.buffer_pos - target) / target
+        self.level = 9 if error < -0.5 else 6 if error < 0 else 1
+        return min(2 * period, max(period / 4, period * (1 + error / 2)))
+
+    # How much later to time the frames, which is taken up as it's handed out
+
+    def take_late(self):
+        late, self.late = self.late, 0.0
+        return late
 
 # download_video
 #
@@ -67,12 +141,14 @@ def send_video_data(stream):
         sys.exit("Could not open video")
 
     sock = None
+    pacer = Pacer()
     future = datetime.datetime.now() + datetime.timedelta(seconds=FUTURE_DELAY)
 
     while True:
         # Connect to the socket if not already connected
         if sock is None:
             sock = connect_to_socket()
+            pacer.reset()
 
         # Read and process a frame
         ret, frame = cap.read()
@@ -83,8 +159,14 @@ def send_video_data(stream):
         resized = cv2.resize(rgb_frame, (MATRIX_WIDTH, MATRIX_HEIGHT))
         pixels = bytes(resized)
 
-        # Advance timestamp by one frame's worth of time as we send each packet
-        future += datetime.timedelta(seconds = 1.0 / stream.fps)
+        # Advance timestamp by one frame's worth of time as we send each packet, plus however late the node says
+        # our frames are going out
+        if not pacer.poll(sock):
+            print("Socket closed!")
+            sock.close()
+            sock = None
+            continue
+        future += datetime.timedelta(seconds = 1.0 / stream.fps + pacer.take_late())
         seconds = int(future.timestamp())
         microseconds = future.microsecond
 
@@ -93,7 +175,7 @@ def send_video_data(stream):
         header = build_header(seconds, microseconds, int(len(pixels) / 3))
         complete_packet = header + pixels
 
-        compressed_packet = compress_packet(complete_packet)
+        compressed_packet = compress_packet(complete_packet, pacer.level)
 
         try:
             sock.send(compressed_packet)
@@ -102,7 +184,7 @@ def send_video_data(stream):
             sock.close()
             sock = None
 
-        time.sleep(1.0 / stream.fps / 2)
+        time.sleep(pacer.next_delay(stream.fps))
 
 # build_header
 #
@@ -122,8 +204,8 @@ def build_header(seconds, microseconds, length32):
 # Use zlib to lzcompress the packet and return it wrapped in the little header that indicates its 
 # going to be a compressed packet
 
-def compress_packet(complete_packet):
-    compressed_data = zlib.compress(complete_packet)
+def compress_packet(complete_packet, level = 6):
+    compressed_data = zlib.compress(complete_packet, level)
     expandedSizeData = len(complete_packet).to_bytes(4, byteorder='little')
     compressedSizeData = len(compressed_data).to_bytes(4, byteorder='little')
     reservedData = (0x12345678).to_bytes(4, byteorder='little')
@@ -0,0 +1,262 @@
+##+--------------------------------------------------------------------------
+##
+## benchmark - (c) 2023 Dave Plummer.  All Rights Reserved.
+##
+## File:        benchmark.py - Measures how fast NightDriverStrip takes frames in
+##
+## Description:
+##
+##    Sends synthetic frames to a NightDriverStrip node at a rising rate,
+##    for each frame size, both compressed and not, and reads the node's
+##    ingest counters back out of the SocketResponse packets.  For every
+##    step it reports the rate the node took frames in at, how many it
+##    dropped, how long it spent decoding them and how long they waited
+##    in the ring before they were shown, which together make the
+##    throughput and latency curve for the build it's running.
+##
+##    The node has to be built with SOCKET_RESPONSE_STATS=1 for the
+##    counters; without them only the send side is reported.
+##
+##    python3 benchmark.py 192.168.1.50 --env demo --csv results.csv
+##
+##    Runs against other builds append to the same CSV, one row per step,
+##    labelled with --env, so the curves can be plotted side by side.
+##
+##---------------------------------------------------------------------------
+
+import argparse
+import csv
+import math
+import os
+import socket
+import struct
+import threading
+import time
+import zlib
+
+# Constants
+
+PORT = 49152
+WIFI_COMMAND_PIXELDATA64 = 3
+COMPRESSED_HEADER = 0x44415645                  # ascii "DAVE"
+
+RESPONSE_BASE = struct.Struct('<IIdddddIIIIII')             # The 72 bytes every SocketResponse has
+RESPONSE_STATS = struct.Struct('<IIIIII')                   # The ingest counters that follow with SOCKET_RESPONSE_STATS
+RESPONSE_FEEDBACK = struct.Struct('<ddII')                  # The presentation feedback that follows with SOCKET_RESPONSE_FEEDBACK
+RESPONSE_HAS_STATS = 0x0001
+RESPONSE_HAS_FEEDBACK = 0x0002
+
+# ResponseReader
+#
+# Drains the SocketResponse packets the node sends back on a thread of its own, keeping the latest one, so the
+# sender never stalls on a full receive window
+
+class ResponseReader(threading.Thread):
+
+    def __init__(self, sock):
+        super().__init__(daemon=True)
+        self.sock = sock
+        self.lock = threading.Lock()
+        self.latest = None
+        self.count = 0
+
+    def read_exactly(self, n):
+        data = b''
+        while len(data) < n:
+            chunk = self.sock.recv(n - len(data))
+            if not chunk:
+                raise ConnectionError("Node closed the connection")
+            data += chunk
+        return data
+
+    def run(self):
+        try:
+            while True:
+                size = struct.unpack('<I', self.read_exactly(4))[0]
+                body = self.read_exactly(size - 4)
+                response = parse_response(struct.pack('<I', size) + body)
+                with self.lock:
+                    self.latest = response
+                    self.count += 1
+        except (OSError, ConnectionError):
+            pass
+
+    def snapshot(self):
+        with self.lock:
+            return self.latest
+
+# parse_response
+#
+# Turns a SocketResponse into a dict, with the ingest counters and presentation feedback when the node sent them.
+# The extensions word says which of those follow the fixed part, in the order of their bits.
+
+def parse_response(data):
+    fields = RESPONSE_BASE.unpack_from(data)
+    extensions = fields[12]
+    response = {
+        'flashVersion': fields[1],
+        'bufferSize':   fields[7],
+        'bufferPos':    fields[8],
+        'fpsDrawing':   fields[9],
+    }
+    offset = RESPONSE_BASE.size
+    if extensions & RESPONSE_HAS_STATS and len(data) >= offset + RESPONSE_STATS.size:
+        stats = RESPONSE_STATS.unpack_from(data, offset)
+        response.update(zip(('framesReceived', 'framesFull', 'framesStale', 'framesPresented', 'decodeMicros', 'latencyMicros'), stats))
+        offset += RESPONSE_STATS.size
+    if extensions & RESPONSE_HAS_FEEDBACK and len(data) >= offset + RESPONSE_FEEDBACK.size:
+        feedback = RESPONSE_FEEDBACK.unpack_from(data, offset)
+        response.update(zip(('presentedTimestamp', 'presentedDelta', 'frameMicros'), feedback[:3]))
+    return response
+
+# make_frame
+#
+# One frame of the pattern: a moving gradient, which compresses about as well as a real effect does, or noise,
+# which doesn't compress at all
+
+def make_frame(pixels, frame, pattern):
+    if pattern == 'noise':
+        return os.urandom(pixels * 3)
+    out = bytearray(pixels * 3)
+    for i in range(pixels):
+        hue = (i * 4 + frame * 3) & 0xFF
+        out[i * 3]     = hue
+        out[i * 3 + 1] = (255 - hue)
+        out[i * 3 + 2] = int(127 + 127 * math.sin((i + frame) / 16.0))
+    return bytes(out)
+
+# make_packet
+#
+# A PIXELDATA64 packet for channel 0, and its compressed form if asked for.  With a lead of zero the timestamp is
+# zero too, which the node shows as soon as it can, so the latency is purely the time spent in the ring.
+
+def make_packet(pixels, lead):
+    if lead > 0:
+        due = time.time() + lead
+        seconds, micros = int(due), int((due % 1) * 1000000)
+    else:
+        seconds, micros = 0, 0
+    return struct.pack('<HHIQQ', WIFI_COMMAND_PIXELDATA64, 1, len(pixels) // 3, seconds, micros) + pixels
+
+def compress_packet(packet):
+    data = zlib.compress(packet)
+    return struct.pack('<IIII', COMPRESSED_HEADER, len(data), len(packet), 0x12345678) + data
+
+# counter_delta
+#
+# The counters wrap at 32 bits, so differences are taken modulo that
+
+def counter_delta(before, after, key):
+    if before is None or after is None or key not in before or key not in after:
+        return None
+    return (after[key] - before[key]) & 0xFFFFFFFF
+
+# run_step
+#
+# Sends frames at one rate for the given time and returns what happened
+
+def run_step(sock, reader, pixels, compressed, rate, duration, pattern, lead):
+    frames = [make_frame(pixels, i, pattern) for i in range(16)]
+
+    time.sleep(0.5)                                         # Let the last step's frames drain before we take the counters
+    before = reader.snapshot()
+    wire_bytes = 0
+    sent = 0
+
+    start = time.perf_counter()
+    next_send = start
+    while time.perf_counter() - start < duration:
+        packet = make_packet(frames[sent % len(frames)], lead)
+        if compressed:
+            packet = compress_packet(packet)
+        sock.sendall(packet)
+        wire_bytes += len(packet)
+        sent += 1
+
+        next_send += 1.0 / rate
+        delay = next_send - time.perf_counter()
+        if delay > 0:
+            time.sleep(delay)
+        else:
+            next_send = time.perf_counter()                 # Can't keep up, so send flat out rather than in bursts
+    elapsed = time.perf_counter() - start
+
+    time.sleep(max(0.5, lead + 0.5))                        # Give the node time to show, and count, the last of them
+    after = reader.snapshot()
+
+    received  = counter_delta(before, after, 'framesReceived')
+    presented = counter_delta(before, after, 'framesPresented')
+    decode    = counter_delta(before, after, 'decodeMicros')
+    latency   = counter_delta(before, after, 'latencyMicros')
+
+    return {
+        'pixels':        pixels,
+        'compressed':    int(compressed),
+        'target_fps':    rate,
+        'sent_fps':      round(sent / elapsed, 1),
+        'wire_kbps':     round(wire_bytes * 8 / elapsed / 1000, 1),
+        'received_fps':  round(received / elapsed, 1) if received is not None else '',
+        'full':          counter_delta(before, after, 'framesFull') if received is not None else '',
+        'stale':         counter_delta(before, after, 'framesStale') if received is not None else '',
+        'decode_us':     round(decode / received) if received else '',
+        'latency_ms':    round(latency / presented / 1000, 2) if presented else '',
+        'fps_drawing':   after['fpsDrawing'] if after else '',
+    }
+
+def main():
+    parser = argparse.ArgumentParser(description="Measure the ingest throughput and latency of a NightDriverStrip node")
+    parser.add_argument('host', help="Address of the node")
+    parser.add_argument('--port', type=int, default=PORT)
+    parser.add_argument('--env', default='unknown', help="Build environment the node runs, to label the results with")
+    parser.add_argument('--sizes', default='144,1024,2048', help="Comma separated frame sizes, in pixels")
+    parser.add_argument('--rates', default='10,20,30,45,60,90,120', help="Comma separated frame rates to step through")
+    parser.add_argument('--duration', type=float, default=5.0, help="Seconds to send for at each rate")
+    parser.add_argument('--compression', choices=('both', 'on', 'off'), default='both')
+    parser.add_argument('--pattern', choices=('gradient', 'noise'), default='gradient')
+    parser.add_argument('--lead', type=float, default=0.0, help="Seconds ahead to timestamp the frames, 0 to show them on arrival")
+    parser.add_argument('--csv', help="CSV file to append the results to")
+    args = parser.parse_args()
+
+    sizes = [int(s) for s in args.sizes.split(',')]
+    rates = [float(r) for r in args.rates.split(',')]
+    modes = {'both': (False, True), 'on': (True,), 'off': (False,)}[args.compression]
+
+    sock = socket.create_connection((args.host, args.port))
+    sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+    reader = ResponseReader(sock)
+    reader.start()
+
+    # One frame first, so there's a response to take the counters from before the first step
+
+    sock.sendall(make_packet(make_frame(sizes[0], 0, args.pattern), args.lead))
+    deadline = time.time() + 2.0
+    while reader.snapshot() is None and time.time() < deadline:
+        time.sleep(0.05)
+
+    results = []
+    columns = ('pixels', 'compressed', 'target_fps', 'sent_fps', 'wire_kbps', 'received_fps', 'full', 'stale', 'decode_us', 'latency_ms', 'fps_drawing')
+    print(' '.join('%12s' % c for c in columns))
+
+    for pixels in sizes:
+        for compressed in modes:
+            for rate in rates:
+                result = run_step(sock, reader, pixels, compressed, rate, args.duration, args.pattern, args.lead)
+                results.append(result)
+                print(' '.join('%12s' % result[c] for c in columns))
+
+    if reader.snapshot() and 'framesReceived' not in reader.snapshot():
+        print("The node doesn't send its ingest counters; build it with SOCKET_RESPONSE_STATS=1 for the device side")
+
+    if args.csv:
+        fresh = not os.path.exists(args.csv)
+        with open(args.csv, 'a', newline='') as f:
+            writer = csv.DictWriter(f, fieldnames=('env',) + columns)
+            if fresh:
+                writer.writeheader()
+            for result in results:
+                writer.writerow(dict(result, env=args.env))
+
+    sock.close()
+
+if __name__ == '__main__':
+    main()
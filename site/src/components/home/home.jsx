@@ -6,6 +6,7 @@ import getTheme from '../../theme/theme';
 import NotificationPanel from './notifications/notifications';
 import StatsPanel from './statistics/stats';
 import DesignerPanel from './designer/designer';
+import PreviewPanel from './preview/preview';
 import PropTypes from 'prop-types';
 import ConfigDialog from './config/configDialog';
 import {EffectsContext} from '../../context/effectsContext';
@@ -33,6 +34,7 @@ const AppPannel = (props) => {
     const [drawerOpened, setDrawerOpened] = useState(config && config.drawerOpened !== undefined ? config.drawerOpened : false);
     const [stats, setStats] = useState(config && config.stats !== undefined ? config.stats : true);
     const [designer, setDesigner] = useState(config && config.designer !== undefined ? config.designer : true);
+    const [preview, setPreview] = useState(config && config.preview !== undefined ? config.preview : false);
     const [settings, setSettings] = useState(false);
     const [deviceControlOpen, setDeviceControlOpen] = useState(false);
     const [notifications, setNotifications] = useState([]);
@@ -43,8 +45,9 @@ const AppPannel = (props) => {
         localStorage.setItem('config', JSON.stringify({
             stats,
             designer,
+            preview,
         }));
-    }, [stats, designer]);
+    }, [stats, designer, preview]);
 
     const addNotification = (level,type,target,notification) => {
         setNotifications(prevNotifs => {
@@ -92,6 +95,7 @@ const AppPannel = (props) => {
                 [
                     {caption:"Home", flag: designer, setter: setDesigner, icon: "home"},
                     {caption:"Statistics", flag: stats, setter: setStats, icon: "area_chart"},
+                    {caption:"Live Preview", flag: preview, setter: setPreview, icon: "live_tv"},
                 ].map(item => 
                     <ListItem key={item.icon}>
                         <ListItemIcon><IconButton onClick={() => item.setter && item.setter(prevValue => !prevValue)}>
@@ -122,6 +126,7 @@ const AppPannel = (props) => {
             sx={{...classes.content,
                 p: 10,
                 pl: drawerOpened ? 30: 10}}>
+            <PreviewPanel open={preview}/>
             <StatsPanel open={stats} addNotification={addNotification}/> 
             <DesignerPanel open={designer} addNotification={addNotification}/>
         </Box>
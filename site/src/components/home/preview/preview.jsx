@@ -0,0 +1,50 @@
+import {useEffect, useRef, useState} from 'react';
+import {Box, Typography} from '@mui/material';
+import PropTypes from 'prop-types';
+import { watchLEDs } from '../../../util/ledpreview';
+import previewStyle from './style';
+
+// Shows what the LEDs show, blown up with the pixels kept square.  Devices built without the preview socket
+// never send a frame, so the panel stays empty for them.
+
+const PreviewPanel = ({open}) => {
+    const canvas = useRef(undefined);
+    const [size, setSize] = useState(undefined);
+
+    useEffect(() => {
+        if (!open) {
+            return;
+        }
+
+        return watchLEDs(({width, height, pixels}) => {
+            if (!canvas.current) {
+                return;
+            }
+
+            canvas.current.width = width;
+            canvas.current.height = height;
+            setSize(prev => prev && prev.width === width && prev.height === height ? prev : {width, height});
+
+            const image = new ImageData(width, height);
+            for (let i = 0, j = 0; i < pixels.length; i += 3, j += 4) {
+                image.data[j] = pixels[i];
+                image.data[j + 1] = pixels[i + 1];
+                image.data[j + 2] = pixels[i + 2];
+                image.data[j + 3] = 255;
+            }
+            canvas.current.getContext("2d").putImageData(image, 0, 0);
+        });
+    }, [open]);
+
+    const hidden = open ? {} : previewStyle.hidden;
+    return <Box sx={{...previewStyle.root, ...hidden}}>
+        <Typography variant="h6">Live Preview</Typography>
+        <canvas ref={canvas} style={{...previewStyle.canvas, aspectRatio: size ? `${size.width} / ${size.height}` : undefined}}/>
+    </Box>;
+};
+
+PreviewPanel.propTypes = {
+    open: PropTypes.bool.isRequired
+};
+
+export default PreviewPanel;
@@ -0,0 +1,20 @@
+const previewStyle = {
+    root: {
+        display: "flex",
+        flexDirection: "column",
+        alignItems: "flex-start",
+        rowGap: "10px",
+        paddingBottom: "10px"
+    },
+    canvas: {
+        width: "100%",
+        maxWidth: "1024px",
+        imageRendering: "pixelated",
+        backgroundColor: "black"
+    },
+    hidden: {
+        display: "none"
+    }
+};
+
+export default previewStyle;
@@ -7,6 +7,22 @@ import StaticStatsPanel from './static/static';
 import AreaStat from './areachart/areachart';
 import BarStat from './barchart/barchart';
 import PropTypes from 'prop-types';
+import { subscribeLiveState, isLiveStateConnected } from '../../../util/livestate';
+
+// The names the live state socket uses for the figures it sends, and what /statistics calls them
+const liveStateFields = {
+    fps: "LED_FPS",
+    cpu: "CPU_USED",
+    c0: "CPU_USED_CORE0",
+    c1: "CPU_USED_CORE1",
+    heap: "HEAP_FREE",
+    heapMin: "HEAP_MIN",
+    psram: "PSRAM_FREE"
+};
+
+const mergeLiveState = (stats, live) => Object.entries(liveStateFields)
+    .filter(([liveField]) => live[liveField] !== undefined)
+    .reduce((merged, [liveField, statsField]) => {merged[statsField] = live[liveField]; return merged;}, {...stats});
 
 /**
  * 
@@ -103,87 +119,94 @@ const StatsPanel = ({open, addNotification }) => {
         .then(resp => resp.json())
         .then(stats => {
             setAbortControler(undefined);
-            return {
-                CPU:{
-                    CPU: {
-                        stat:{
-                            CORE0: stats.CPU_USED_CORE0,
-                            CORE1: stats.CPU_USED_CORE1,
-                            IDLE: ((200.0 - stats.CPU_USED_CORE0 - stats.CPU_USED_CORE1)/200)*100.0,
-                            USED: stats.CPU_USED
-                        },
-                        idleField: "IDLE",
-                        ignored: ["USED"],
-                        headerFields: ["USED"]
-                    }
-                },
-                Memory: {
-                    HEAP:{
-                        stat:{
-                            USED:stats.HEAP_SIZE-stats.HEAP_FREE,
-                            FREE:stats.HEAP_FREE,
-                            MIN:stats.HEAP_MIN,
-                            SIZE: stats.HEAP_SIZE
-                        },
-                        idleField: "FREE",
-                        headerFields: ["SIZE","MIN"],
-                        ignored:["SIZE","MIN"]
+            return stats;
+        });
+
+    // While the live state socket is connected, it keeps the fast changing figures up to date between fetches
+    useEffect(() => subscribeLiveState(live => setStatistics(prev => prev && mergeLiveState(prev, live))), []);
+
+    const buildStatistics = (stats) => {
+        return {
+            CPU:{
+                CPU: {
+                    stat:{
+                        CORE0: stats.CPU_USED_CORE0,
+                        CORE1: stats.CPU_USED_CORE1,
+                        IDLE: ((200.0 - stats.CPU_USED_CORE0 - stats.CPU_USED_CORE1)/200)*100.0,
+                        USED: stats.CPU_USED
                     },
-                    DMA: {
-                        stat:{
-                            USED: stats.DMA_SIZE - stats.DMA_FREE,
-                            FREE: stats.DMA_FREE,
-                            MIN: stats.DMA_MIN,
-                            SIZE: stats.DMA_SIZE
-                        },
-                        idleField: "FREE",
-                        headerFields: ["SIZE","MIN"],
-                        ignored:["SIZE","MIN"]
+                    idleField: "IDLE",
+                    ignored: ["USED"],
+                    headerFields: ["USED"]
+                }
+            },
+            Memory: {
+                HEAP:{
+                    stat:{
+                        USED:stats.HEAP_SIZE-stats.HEAP_FREE,
+                        FREE:stats.HEAP_FREE,
+                        MIN:stats.HEAP_MIN,
+                        SIZE: stats.HEAP_SIZE
                     },
-                    PSRAM: {
-                        stat:{
-                            USED: stats.PSRAM_SIZE - stats.PSRAM_FREE,
-                            FREE: stats.PSRAM_FREE,
-                            MIN: stats.PSRAM_MIN,
-                            SIZE: stats.PSRAM_SIZE
-                        },
-                        idleField: "FREE",
-                        headerFields: ["SIZE","MIN"],
-                        ignored:["SIZE","MIN"]
+                    idleField: "FREE",
+                    headerFields: ["SIZE","MIN"],
+                    ignored:["SIZE","MIN"]
+                },
+                DMA: {
+                    stat:{
+                        USED: stats.DMA_SIZE - stats.DMA_FREE,
+                        FREE: stats.DMA_FREE,
+                        MIN: stats.DMA_MIN,
+                        SIZE: stats.DMA_SIZE
                     },
+                    idleField: "FREE",
+                    headerFields: ["SIZE","MIN"],
+                    ignored:["SIZE","MIN"]
                 },
-                NightDriver: {
-                    FPS:{
-                        stat:{
-                            LED:stats.LED_FPS,
-                            SERIAL:stats.SERIAL_FPS,
-                            AUDIO:stats.AUDIO_FPS
-                        }
+                PSRAM: {
+                    stat:{
+                        USED: stats.PSRAM_SIZE - stats.PSRAM_FREE,
+                        FREE: stats.PSRAM_FREE,
+                        MIN: stats.PSRAM_MIN,
+                        SIZE: stats.PSRAM_SIZE
                     },
+                    idleField: "FREE",
+                    headerFields: ["SIZE","MIN"],
+                    ignored:["SIZE","MIN"]
+                },
+            },
+            NightDriver: {
+                FPS:{
+                    stat:{
+                        LED:stats.LED_FPS,
+                        SERIAL:stats.SERIAL_FPS,
+                        AUDIO:stats.AUDIO_FPS
+                    }
                 },
-                Package: {
-                    CHIP: {
-                        stat:{
-                            MODEL: stats.CHIP_MODEL,
-                            CORES: stats.CHIP_CORES,
-                            SPEED: stats.CHIP_SPEED,
-                            PROG_SIZE: stats.PROG_SIZE
-                        },
-                        static: true,
-                        headerFields: ["MODEL"]
+            },
+            Package: {
+                CHIP: {
+                    stat:{
+                        MODEL: stats.CHIP_MODEL,
+                        CORES: stats.CHIP_CORES,
+                        SPEED: stats.CHIP_SPEED,
+                        PROG_SIZE: stats.PROG_SIZE
                     },
-                    CODE: {
-                        stat:{
-                            SIZE: stats.CODE_SIZE,
-                            FREE: stats.CODE_FREE,
-                            FLASH_SIZE: stats.FLASH_SIZE
-                        },
-                        static: true,
-                        headerFields: ["SIZE"]
+                    static: true,
+                    headerFields: ["MODEL"]
+                },
+                CODE: {
+                    stat:{
+                        SIZE: stats.CODE_SIZE,
+                        FREE: stats.CODE_FREE,
+                        FLASH_SIZE: stats.FLASH_SIZE
                     },
+                    static: true,
+                    headerFields: ["SIZE"]
                 },
-            };
-        });
+            },
+        };
+    };
 
     useEffect(() => {
         if (abortControler) {
@@ -194,9 +217,11 @@ const StatsPanel = ({open, addNotification }) => {
             const aborter = new AbortController();
             setAbortControler(aborter);
 
-            getStats(aborter)
-                .then(setStatistics)
-                .catch(err => addNotification("Error","Service","Get Statistics",err));
+            if (!statistics || !isLiveStateConnected()) {
+                getStats(aborter)
+                    .then(setStatistics)
+                    .catch(err => addNotification("Error","Service","Get Statistics",err));
+            }
 
             if (timer) {
                 clearTimeout(timer);
@@ -235,7 +260,7 @@ const StatsPanel = ({open, addNotification }) => {
             setOpen={setSettingsOpen}
 
         />}
-        {Object.entries(statistics).map(category => {
+        {Object.entries(buildStatistics(statistics)).map(category => {
             const cat0 = category[0];
             const isOpen = openedCategories[cat0];
             const summarySx = isOpen ? {} : statsStyle.summaryStats; 
@@ -1,6 +1,7 @@
 import { createContext, useEffect, useState } from "react";
 import httpPrefix from "../espaddr";
 import PropTypes from 'prop-types';
+import { subscribeLiveState, isLiveStateConnected } from "../util/livestate";
 
 const EffectsContext = createContext(undefined);
 const effectsEndpoint = `${httpPrefix !== undefined ? httpPrefix : ""}/effects`;
@@ -28,6 +29,9 @@ const EffectsProvider = ({ children }) => {
             }
         };
         const timer = setInterval(() => {
+            if (isLiveStateConnected()) {
+                return;
+            }
             const controller = new AbortController();
             getDataFromDevice({signal: controller.signal});
         }, refreshInterval);
@@ -36,10 +40,18 @@ const EffectsProvider = ({ children }) => {
             clearInterval(timer);
         };
     },[effectTrigger]);
+
+    // The live state socket says when the effect changes, so there's no need to guess when the interval runs out
+    useEffect(() => subscribeLiveState(live => {
+        live.rem !== undefined && setRemainingInterval(live.rem);
+        live.ivl !== undefined && setActiveInterval(live.ivl);
+        live.eter !== undefined && setPinnedEffect(live.eter);
+        live.eff !== undefined && setActiveEffect(live.eff);
+    }), []);
     
     useEffect(() => {
         setCurrentEffect(activeEffect);
-        if (!pinnedEffect) {
+        if (!pinnedEffect && !isLiveStateConnected()) {
             const timer = setTimeout(() => {
                 // Timer expired, trigger a resync. 
                 setEffectTrigger(s => !s);
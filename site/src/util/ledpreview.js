@@ -0,0 +1,88 @@
+import httpPrefix from '../espaddr';
+
+// The device streams what its LEDs show over a web socket, in the color data server's stream format: a 20 byte
+// header, then the pixels as RGB triples, row by row.  The pixels may be XORed with those of the frame before
+// (delta) and then run-length encoded as a count and the color it repeats.  The stream can be deflated too, but
+// we ask for run-length encoded deltas when we connect, and a deflated frame is one we can't use.
+
+const socketUrl = () => httpPrefix !== undefined
+    ? `${httpPrefix.replace(/^http/, "ws")}/ws/leds`
+    : `${window.location.protocol === "https:" ? "wss" : "ws"}://${window.location.host}/ws/leds`;
+
+const streamRequestHeader = 0x434C5251;     // "CLRQ"
+const streamPacketHeader = 0x434C5253;      // "CLRS"
+const flagRLE = 0x01;
+const flagDeflate = 0x02;
+const flagDelta = 0x04;
+
+// A ColorStreamRequest for run-length encoded deltas, at as many frames as the device sends and at full size
+const streamRequest = () => {
+    const request = new DataView(new ArrayBuffer(8));
+    request.setUint32(0, streamRequestHeader, true);
+    request.setUint8(4, flagRLE | flagDelta);
+    return request.buffer;
+};
+
+// Turns a packet into a frame, or undefined if it's not one we can use
+const decodeFrame = (buffer, previous) => {
+    const view = new DataView(buffer);
+    if (buffer.byteLength < 20 || view.getUint32(0, true) !== streamPacketHeader) {
+        return undefined;
+    }
+
+    const width = view.getUint16(8, true);
+    const height = view.getUint16(10, true);
+    const flags = view.getUint8(12);
+    if (flags & flagDeflate) {
+        return undefined;
+    }
+
+    const payload = new Uint8Array(buffer, 20, Math.min(view.getUint32(16, true), buffer.byteLength - 20));
+    const pixels = new Uint8Array(width * height * 3);
+
+    if (flags & flagRLE) {
+        let offset = 0;
+        for (let i = 0; i + 3 < payload.length && offset < pixels.length; i += 4) {
+            for (let run = 0; run < payload[i] && offset < pixels.length; run++) {
+                pixels[offset++] = payload[i + 1];
+                pixels[offset++] = payload[i + 2];
+                pixels[offset++] = payload[i + 3];
+            }
+        }
+    } else {
+        pixels.set(payload.subarray(0, pixels.length));
+    }
+
+    if (flags & flagDelta) {
+        if (!previous || previous.width !== width || previous.height !== height) {
+            return undefined;
+        }
+        for (let i = 0; i < pixels.length; i++) {
+            pixels[i] ^= previous.pixels[i];
+        }
+    }
+
+    return {width, height, pixels};
+};
+
+// Connects and hands each frame to the listener.  Returns what closes the connection again.
+const watchLEDs = (listener) => {
+    const socket = new WebSocket(socketUrl());
+    let frame = undefined;
+
+    socket.binaryType = "arraybuffer";
+    socket.onopen = () => socket.send(streamRequest());
+    socket.onmessage = (event) => {
+        const next = decodeFrame(event.data, frame);
+        if (next) {
+            frame = next;
+            listener(frame);
+        } else {
+            frame = undefined;      // So no delta is applied to a frame we missed, until a key frame comes along
+        }
+    };
+
+    return () => socket.close();
+};
+
+export { watchLEDs };
@@ -0,0 +1,56 @@
+import httpPrefix from '../espaddr';
+
+// The device pushes the state that changes all the time over a web socket, as only what changed since the last
+// message.  One socket is shared by everything on the page, and each listener gets the whole state put together.
+
+const socketUrl = () => httpPrefix !== undefined
+    ? `${httpPrefix.replace(/^http/, "ws")}/ws`
+    : `${window.location.protocol === "https:" ? "wss" : "ws"}://${window.location.host}/ws`;
+
+const liveState = {};
+const listeners = new Set();
+let socket = undefined;
+let connected = false;
+let everConnected = false;
+let retryTimer = undefined;
+
+const connect = () => {
+    retryTimer = undefined;
+    socket = new WebSocket(socketUrl());
+
+    socket.onopen = () => {
+        connected = true;
+        everConnected = true;
+    };
+
+    socket.onmessage = (event) => {
+        Object.assign(liveState, JSON.parse(event.data));
+        listeners.forEach(listener => listener({...liveState}));
+    };
+
+    // A device built without the socket never accepts the connection, and then we leave it to polling
+    socket.onclose = () => {
+        connected = false;
+        socket = undefined;
+        if (everConnected && listeners.size) {
+            retryTimer = setTimeout(connect, 5000);
+        }
+    };
+};
+
+const subscribeLiveState = (listener) => {
+    listeners.add(listener);
+    if (!socket && !retryTimer) {
+        connect();
+    }
+    return () => {
+        listeners.delete(listener);
+        if (!listeners.size && socket) {
+            socket.close();
+        }
+    };
+};
+
+const isLiveStateConnected = () => connected;
+
+export { subscribeLiveState, isLiveStateConnected };
@@ -0,0 +1,477 @@
+//+--------------------------------------------------------------------------
+//
+// File:        assetstore.cpp
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+//
+// Description:
+//
+//    The asset partition's index, uploads and lookups
+//
+//---------------------------------------------------------------------------
+
+#include "globals.h"
+#include "systemcontainer.h"
+#include "assetstore.h"
+
+#if ENABLE_ASSET_STORE
+
+extern "C"
+{
+    #include "uzlib/src/uzlib.h"
+}
+
+AssetStore::~AssetStore()
+{
+    if (_pAssets)
+        esp_partition_munmap(_hMapping);
+    free(_pIndex);
+    free(_pSpare);
+}
+
+bool AssetStore::begin()
+{
+    _pPartition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, ASSET_PARTITION_LABEL);
+    if (!_pPartition || _pPartition->size < 3 * kSectorSize)
+    {
+        debugW("No %s partition, so there are no assets", ASSET_PARTITION_LABEL);
+        _pPartition = nullptr;
+        return false;
+    }
+
+    _pIndex = PlacedAlloc<AssetIndex>(1, Placement::Cold, "asset index");
+    _pSpare = PlacedAlloc<AssetIndex>(1, Placement::Cold, "asset index spare");
+    if (!_pIndex || !_pSpare)
+    {
+        debugE("No memory for the asset index");
+        return false;
+    }
+
+    const void * pMapped = nullptr;
+    if (esp_partition_mmap(_pPartition, 0, _pPartition->size, ESP_PARTITION_MMAP_DATA, &pMapped, &_hMapping) != ESP_OK)
+    {
+        debugW("Could not map the %s partition", ASSET_PARTITION_LABEL);
+        return false;
+    }
+
+    // Take whichever index sector is good and newer.  Generations are compared by their difference so the count
+    // can wrap.
+
+    const AssetIndex * pCurrent = nullptr;
+    for (size_t i = 0; i < 2; i++)
+    {
+        auto pCandidate = reinterpret_cast<const AssetIndex *>(static_cast<const uint8_t *>(pMapped) + i * kSectorSize);
+        const auto & header = pCandidate->Header;
+
+        if (header.Magic != ASSET_INDEX_MAGIC || header.Version != ASSET_INDEX_VERSION || header.Count > kMaxAssets
+            || IndexCRC(*pCandidate) != header.CRC)
+            continue;
+
+        if (!pCurrent || (int32_t)(header.Generation - pCurrent->Header.Generation) > 0)
+        {
+            pCurrent = pCandidate;
+            _iIndexSector = i;
+        }
+    }
+
+    if (pCurrent)
+        memcpy(_pIndex, pCurrent, sizeof(AssetIndex));
+    else
+    {
+        memset(_pIndex, 0, sizeof(AssetIndex));
+        _pIndex->Header.Magic   = ASSET_INDEX_MAGIC;
+        _pIndex->Header.Version = ASSET_INDEX_VERSION;
+        _iIndexSector = 1;                                  // So the first index is written to the first sector
+    }
+
+    // New assets go in the sector after the last one in use, as what's left of that sector may hold the bytes of
+    // assets that have been deleted
+
+    size_t dataEnd = 2 * kSectorSize;
+    for (size_t i = 0; i < _pIndex->Header.Count; i++)
+        dataEnd = std::max<size_t>(dataEnd, _pIndex->Entries[i].Offset + _pIndex->Entries[i].Length);
+
+    _dataEnd   = (dataEnd + kSectorSize - 1) / kSectorSize * kSectorSize;
+    _erasedEnd = _dataEnd;
+    _pAssets   = static_cast<const uint8_t *>(pMapped);
+
+    debugI("%u assets in the %s partition, %zu bytes free", _pIndex->Header.Count, ASSET_PARTITION_LABEL, FreeSpace());
+    return true;
+}
+
+uint32_t AssetStore::IndexCRC(const AssetIndex & index)
+{
+    size_t cbCovered = sizeof(AssetIndexHeader) - offsetof(AssetIndexHeader, Generation) + index.Header.Count * sizeof(AssetEntry);
+    return uzlib_crc32(&index.Header.Generation, cbCovered, 0xffffffff);
+}
+
+// FindEntry
+//
+// Looks an asset up in the current index.  The caller holds the index lock, or is the one writer.
+
+const AssetEntry * AssetStore::FindEntry(uint16_t id) const
+{
+    for (size_t i = 0; i < _pIndex->Header.Count; i++)
+        if (_pIndex->Entries[i].Id == id)
+            return &_pIndex->Entries[i];
+
+    return nullptr;
+}
+
+void AssetStore::RemoveEntry(AssetIndex & index, uint16_t id)
+{
+    size_t cKept = 0;
+    for (size_t i = 0; i < index.Header.Count; i++)
+        if (index.Entries[i].Id != id)
+            index.Entries[cKept++] = index.Entries[i];
+
+    index.Header.Count = cKept;
+}
+
+// UpdateIndex
+//
+// Edits a copy of the index and writes it over the older of the two index sectors, and only then makes it the
+// current one.  A reset partway through leaves the old index, which is still good, as the newest.  The caller holds
+// the write lock, so nothing else swaps the index meanwhile and it can be read without the index lock.
+
+bool AssetStore::UpdateIndex(const std::function<void(AssetIndex &)> & edit)
+{
+    memcpy(_pSpare, _pIndex, sizeof(AssetIndex));
+    edit(*_pSpare);
+
+    _pSpare->Header.Generation = _pIndex->Header.Generation + 1;
+    _pSpare->Header.CRC        = IndexCRC(*_pSpare);
+
+    size_t iSector = 1 - _iIndexSector;
+    if (esp_partition_erase_range(_pPartition, iSector * kSectorSize, kSectorSize) != ESP_OK
+        || esp_partition_write(_pPartition, iSector * kSectorSize, _pSpare, kSectorSize) != ESP_OK)
+    {
+        debugW("Could not write the asset index");
+        return false;
+    }
+
+    std::lock_guard<std::mutex> guard(_indexMutex);
+    std::swap(_pIndex, _pSpare);
+    _iIndexSector = iSector;
+    return true;
+}
+
+size_t AssetStore::FreeSpace() const
+{
+    std::lock_guard<std::mutex> guard(_indexMutex);
+    return Capacity() - std::min(Capacity(), _dataEnd);
+}
+
+std::vector<AssetEntry> AssetStore::Entries() const
+{
+    std::lock_guard<std::mutex> guard(_indexMutex);
+    if (!_pIndex)
+        return {};
+
+    return std::vector<AssetEntry>(_pIndex->Entries, _pIndex->Entries + _pIndex->Header.Count);
+}
+
+std::optional<AssetEntry> AssetStore::Find(uint16_t id, AssetType type) const
+{
+    std::lock_guard<std::mutex> guard(_indexMutex);
+    if (!_pAssets)
+        return std::nullopt;
+
+    auto pEntry = FindEntry(id);
+    if (!pEntry || pEntry->Type != type)
+        return std::nullopt;
+
+    return *pEntry;
+}
+
+std::optional<GFXfont> AssetStore::Font(uint16_t id) const
+{
+    auto entry = Find(id, AssetType::Font);
+    if (!entry)
+        return std::nullopt;
+
+    FontAssetHeader header;
+    memcpy(&header, Data(*entry), sizeof(header));          // The header isn't aligned for its fields
+
+    GFXfont font;
+    font.bitmap   = const_cast<uint8_t *>(Data(*entry) + header.BitmapOffset);
+    font.glyph    = reinterpret_cast<GFXglyph *>(const_cast<uint8_t *>(Data(*entry) + header.GlyphOffset));
+    font.first    = header.First;
+    font.last     = header.Last;
+    font.yAdvance = header.YAdvance;
+    return font;
+}
+
+std::optional<CRGBPalette16> AssetStore::Palette(uint16_t id) const
+{
+    auto entry = Find(id, AssetType::Palette);
+    if (!entry)
+        return std::nullopt;
+
+    CRGBPalette16 palette;
+    palette.loadDynamicGradientPalette(Data(*entry));
+    return palette;
+}
+
+// Validate
+//
+// Checks a freshly uploaded asset is what its type says, so the consumers can take it as it is
+
+bool AssetStore::Validate(const AssetEntry & entry, String & error) const
+{
+    const uint8_t * pData = Data(entry);
+
+    switch (entry.Type)
+    {
+        case AssetType::GIF:
+        {
+            if (entry.Length < 10 || memcmp(pData, "GIF", 3) != 0)
+            {
+                error = "Not a GIF file";
+                return false;
+            }
+
+            uint16_t width  = pData[6] | pData[7] << 8;
+            uint16_t height = pData[8] | pData[9] << 8;
+            if (width > MATRIX_WIDTH || height > MATRIX_HEIGHT)
+            {
+                error = str_sprintf("The GIF is %ux%u, which is larger than the %ux%u matrix", width, height, (unsigned) MATRIX_WIDTH, (unsigned) MATRIX_HEIGHT);
+                return false;
+            }
+            return true;
+        }
+
+        case AssetType::Font:
+        {
+            FontAssetHeader header;
+            if (entry.Length < sizeof(header))
+            {
+                error = "Too short for a font";
+                return false;
+            }
+            memcpy(&header, pData, sizeof(header));
+
+            size_t cGlyphs = header.Last >= header.First ? header.Last - header.First + 1 : 0;
+            if (!cGlyphs || header.GlyphOffset % 2 || header.GlyphOffset + cGlyphs * sizeof(GFXglyph) > entry.Length
+                || header.BitmapOffset > entry.Length)
+            {
+                error = "The font's glyphs aren't where its header says";
+                return false;
+            }
+
+            // Every glyph's bitmap has to be in the asset too, or drawing it would read whatever comes after
+
+            auto pGlyphs = reinterpret_cast<const GFXglyph *>(pData + header.GlyphOffset);
+            for (size_t i = 0; i < cGlyphs; i++)
+            {
+                size_t cbBitmap = (pGlyphs[i].width * pGlyphs[i].height + 7) / 8;
+                if (header.BitmapOffset + pGlyphs[i].bitmapOffset + cbBitmap > entry.Length)
+                {
+                    error = str_sprintf("The bitmap of glyph %zu runs past the end of the font", header.First + i);
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        case AssetType::Palette:
+        {
+            // FastLED reads entries until it gets to index 255, so the last one has to be it
+
+            if (entry.Length < 8 || entry.Length % 4 || pData[0] != 0 || pData[entry.Length - 4] != 255)
+            {
+                error = "Not a gradient palette running from index 0 to 255";
+                return false;
+            }
+
+            for (size_t i = 4; i < entry.Length; i += 4)
+            {
+                if (pData[i - 4] == 255 || pData[i] < pData[i - 4])
+                {
+                    error = "The palette's indexes have to go up to 255 and stop there";
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        default:
+            error = "Unknown asset type";
+            return false;
+    }
+}
+
+bool AssetStore::BeginUpload(uint16_t id, AssetType type, const String & name, uint32_t param, size_t length, String & error)
+{
+    std::lock_guard<std::mutex> writeGuard(_writeMutex);
+
+    if (!_pAssets)
+    {
+        error = "There's no " ASSET_PARTITION_LABEL " partition";
+        return false;
+    }
+    if (type == AssetType::None)
+    {
+        error = "Unknown asset type";
+        return false;
+    }
+    if (length == 0)
+    {
+        error = "The asset is empty";
+        return false;
+    }
+
+    std::lock_guard<std::mutex> indexGuard(_indexMutex);
+
+    if (!FindEntry(id) && _pIndex->Header.Count >= kMaxAssets)
+    {
+        error = str_sprintf("There's only room for %zu assets", kMaxAssets);
+        return false;
+    }
+
+    // Assets are kept on 4-byte boundaries, which is as aligned as anything in a font or GIF needs to be
+
+    size_t offset = (_dataEnd + 3) & ~3;
+    if (offset + length > Capacity())
+    {
+        error = str_sprintf("Only %zu bytes are free", Capacity() - std::min(Capacity(), offset));
+        return false;
+    }
+
+    // The space is taken here and now, so an upload that's cut short never has its sectors handed out again
+
+    _dataEnd = offset + length;
+
+    _upload = {};
+    _upload.Id     = id;
+    _upload.Type   = type;
+    _upload.Offset = offset;
+    _upload.Length = length;
+    _upload.Param  = param;
+    strncpy(_upload.Name, name.c_str(), sizeof(_upload.Name) - 1);
+
+    _cbUploaded    = 0;
+    _bUploadFailed = false;
+    return true;
+}
+
+void AssetStore::WriteUpload(const uint8_t * pData, size_t cbData)
+{
+    std::lock_guard<std::mutex> guard(_writeMutex);
+
+    if (!_upload.Length || _bUploadFailed)
+        return;
+
+    cbData = std::min(cbData, _upload.Length - _cbUploaded);
+    size_t offset = _upload.Offset + _cbUploaded;
+
+    // Everything past _erasedEnd is sector aligned and unused, so a sector is erased the first time we get to it
+
+    while (_erasedEnd < offset + cbData)
+    {
+        if (esp_partition_erase_range(_pPartition, _erasedEnd, kSectorSize) != ESP_OK)
+        {
+            debugW("Could not erase the asset partition at %zu", _erasedEnd);
+            _bUploadFailed = true;
+            return;
+        }
+        _erasedEnd += kSectorSize;
+    }
+
+    if (esp_partition_write(_pPartition, offset, pData, cbData) != ESP_OK)
+    {
+        debugW("Could not write the asset partition at %zu", offset);
+        _bUploadFailed = true;
+        return;
+    }
+
+    _cbUploaded += cbData;
+}
+
+std::optional<AssetEntry> AssetStore::FinishUpload(String & error)
+{
+    std::lock_guard<std::mutex> guard(_writeMutex);
+
+    AssetEntry entry = _upload;
+    _upload = {};
+
+    if (!entry.Length)
+        error = "No upload is in progress";
+    else if (_bUploadFailed)
+        error = "Could not write the asset to flash";
+    else if (_cbUploaded != entry.Length)
+        error = "The upload was cut short";
+    else if (Validate(entry, error))
+    {
+        if (UpdateIndex([&](AssetIndex & index)
+            {
+                RemoveEntry(index, entry.Id);
+                index.Entries[index.Header.Count++] = entry;
+            }))
+        {
+            debugI("Added %s asset %u, %u bytes", TypeName(entry.Type), entry.Id, entry.Length);
+            return entry;
+        }
+        error = "Could not write the asset index";
+    }
+
+    return std::nullopt;
+}
+
+bool AssetStore::Remove(uint16_t id)
+{
+    std::lock_guard<std::mutex> guard(_writeMutex);
+
+    if (!_pAssets || !FindEntry(id))
+        return false;
+
+    return UpdateIndex([id](AssetIndex & index) { RemoveEntry(index, id); });
+}
+
+bool AssetStore::Clear()
+{
+    std::lock_guard<std::mutex> guard(_writeMutex);
+
+    if (!_pAssets)
+        return false;
+
+    return UpdateIndex([](AssetIndex & index) { index.Header.Count = 0; });
+}
+
+const char * AssetStore::TypeName(AssetType type)
+{
+    switch (type)
+    {
+        case AssetType::GIF:     return "gif";
+        case AssetType::Font:    return "font";
+        case AssetType::Palette: return "palette";
+        default:                 return "none";
+    }
+}
+
+AssetType AssetStore::TypeFromName(const String & name)
+{
+    for (auto type : { AssetType::GIF, AssetType::Font, AssetType::Palette })
+        if (name.equalsIgnoreCase(TypeName(type)))
+            return type;
+
+    return AssetType::None;
+}
+
+#endif
@@ -35,11 +35,133 @@
 
 #include <esp_task_wdt.h>
 #include "soundanalyzer.h"
+#include "systemcontainer.h"
 
 #if ENABLE_VICE_SERVER
 #include "network.h"
 #endif
 
+#if AUDIO_MULTICAST_MASTER
+
+#include <sys/time.h>
+#include "network.h"
+#include "udpserver.h"
+
+#if !ENABLE_WIFI || !defined(UDP_MULTICAST_GROUP)
+    #error AUDIO_MULTICAST_MASTER requires ENABLE_WIFI and a UDP_MULTICAST_GROUP to send to
+#endif
+
+// AudioMulticaster
+//
+// Sends the peaks from every sampler pass, and any beats found, to UDP_MULTICAST_GROUP as UDP ingest datagrams.
+// The other nodes in the room join the group with ENABLE_UDP_INGEST and take them through the same PCREMOTE path
+// as peaks from a PC, so with AUDIO_REMOTE_ONLY they never need to sample or FFT anything themselves.
+
+class AudioMulticaster
+{
+    int                _fd        = -1;
+    uint32_t           _sequence  = 0;
+    uint32_t           _beatsSent = 0;
+    struct sockaddr_in _group;
+
+    // Lays down the UDP ingest header and the standard packet header, returning where the payload goes
+
+    uint8_t * WriteHeaders(uint8_t * pPacket, uint16_t command16, uint16_t word16, uint32_t length32)
+    {
+        struct timeval tv;
+        gettimeofday(&tv, nullptr);
+        uint64_t seconds = tv.tv_sec;
+        uint64_t micros  = tv.tv_usec;
+        uint32_t magic   = UDP_PIXEL_HEADER;
+        uint32_t sequence = _sequence++;
+
+        memcpy(pPacket,      &magic,     sizeof(magic));
+        memcpy(pPacket + 4,  &sequence,  sizeof(sequence));
+
+        uint8_t * pHeader = pPacket + UDP_PIXEL_HEADER_SIZE;
+        memcpy(pHeader,      &command16, sizeof(command16));
+        memcpy(pHeader + 2,  &word16,    sizeof(word16));
+        memcpy(pHeader + 4,  &length32,  sizeof(length32));
+        memcpy(pHeader + 8,  &seconds,   sizeof(seconds));
+        memcpy(pHeader + 16, &micros,    sizeof(micros));
+
+        return pHeader + STANDARD_DATA_HEADER_SIZE;
+    }
+
+    void Send(const uint8_t * pPacket, size_t cbPacket)
+    {
+        if (sendto(_fd, pPacket, cbPacket, 0, (struct sockaddr *)&_group, sizeof(_group)) < 0)
+            debugV("Error %d sending audio multicast", errno);
+    }
+
+    bool EnsureSocket()
+    {
+        if (!WiFi.isConnected())
+        {
+            if (_fd >= 0)
+            {
+                close(_fd);
+                _fd = -1;
+            }
+            return false;
+        }
+
+        if (_fd >= 0)
+            return true;
+
+        if ((_fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+        {
+            debugW("Unable to create audio multicast socket");
+            return false;
+        }
+
+        // If this node also ingests from the group, it mustn't hear its own audio and go to PCREMOTE on it
+
+        uint8_t loop = 0;
+        if (setsockopt(_fd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)) < 0)
+            debugW("Unable to turn off multicast loopback for audio");
+
+        memset(&_group, 0, sizeof(_group));
+        _group.sin_family      = AF_INET;
+        _group.sin_addr.s_addr = inet_addr(UDP_MULTICAST_GROUP);
+        _group.sin_port        = htons(NetworkPort::IncomingUDP);
+
+        debugI("Sending audio to multicast group %s", UDP_MULTICAST_GROUP);
+        return true;
+    }
+
+  public:
+
+    void Broadcast(const AudioSnapshot & audio)
+    {
+        if (!EnsureSocket())
+            return;
+
+        uint8_t abPacket[UDP_PIXEL_HEADER_SIZE + STANDARD_DATA_HEADER_SIZE + NUM_BANDS * sizeof(float)];
+
+        uint8_t * pBands = WriteHeaders(abPacket, WIFI_COMMAND_PEAKDATA, NUM_BANDS, NUM_BANDS * sizeof(float));
+        memcpy(pBands, audio.Peaks._Level, NUM_BANDS * sizeof(float));
+        Send(abPacket, sizeof(abPacket));
+
+        // Beats go out as they're found; any that are already old aren't worth sending
+
+        if (audio.BeatCount - _beatsSent > AudioSnapshot::kBeatHistory)
+            _beatsSent = audio.BeatCount - AudioSnapshot::kBeatHistory;
+
+        for (; _beatsSent != audio.BeatCount; _beatsSent++)
+        {
+            const auto & beat = audio.Beats[_beatsSent % AudioSnapshot::kBeatHistory];
+            uint8_t * pStrength = WriteHeaders(abPacket, WIFI_COMMAND_BEATDATA, beat.Major ? 1 : 0, sizeof(float));
+            memcpy(pStrength, &beat.Strength, sizeof(float));
+            Send(abPacket, UDP_PIXEL_HEADER_SIZE + STANDARD_DATA_HEADER_SIZE + sizeof(float));
+        }
+    }
+};
+
+static AudioMulticaster l_AudioMulticaster;
+
+#endif
+
 // AudioSamplerTaskEntry
 // A background task that samples audio, computes the VU, stores it for effect use, etc.
 
@@ -47,15 +169,24 @@ void IRAM_ATTR AudioSamplerTaskEntry(void *)
 {
     debugI(">>> Sampler Task Started");
 
-    // Enable microphone input
-    pinMode(INPUT_PIN, INPUT);
+    // Enable microphone input, unless all our audio comes from elsewhere
 
-    g_Analyzer.SampleBufferInitI2S();
+    #if !AUDIO_REMOTE_ONLY
+        pinMode(INPUT_PIN, INPUT);
+
+        g_Analyzer.SampleBufferInitI2S();
+    #endif
 
     for (;;)
     {
+        g_ptrSystem->TaskManager().WaitWhileNonEssentialPaused();
+
         uint64_t lastFrame = millis();
 
+        // Pick up a change of analysis profile between passes, where it's safe to rebuild the analyzer's tables
+
+        g_Analyzer.SetProfile(g_ptrSystem->DeviceConfig().GetAudioProfile());
+
         g_Analyzer.RunSamplerPass();
         g_Analyzer.UpdatePeakData();
         g_Analyzer.DecayPeaks();
@@ -80,11 +211,24 @@ void IRAM_ATTR AudioSamplerTaskEntry(void *)
 
         debugV("VURatio: %f\n", g_Analyzer._VURatio);
 
+        // Hand the whole pass to the effects at once
+
+        g_Analyzer.PublishSnapshot();
+        g_ptrSystem->TaskManager().PostEvent(SystemEvent::AudioPass);
+
+        #if AUDIO_MULTICAST_MASTER
+            l_AudioMulticaster.Broadcast(g_Analyzer.GetAudioSnapshot());
+        #endif
+
+        #if ENABLE_ESPNOW && ESPNOW_SEND_AUDIO
+            g_ptrSystem->ESPNowLink().SendPeaks(g_Analyzer.GetAudioSnapshot().Peaks);
+        #endif
+
         // Delay enough time to yield 60fps max
         // We wait a minimum even if busy so we don't Bogart the CPU
 
         unsigned long elapsed = millis() - lastFrame;
-        constexpr auto kMaxFPS = 60;
+        constexpr auto kMaxFPS = ENABLE_AUDIO_STREAMING ? 200 : 60;                 // Streaming is paced by the samples arriving
         const auto targetDelay = PERIOD_FROM_FREQ(kMaxFPS) * MILLIS_PER_SECOND / MICROS_PER_SECOND;
         delay(max(1.0, targetDelay - elapsed));
 
@@ -101,35 +245,49 @@ void IRAM_ATTR AudioSamplerTaskEntry(void *)
 // language.
 //
 // To support this, when enabled, this task repeatedly sends out copies of the latest data peaks, scaled to 20, which is
-// the max height of the PET/C64 spectrum bar.  This should manage around 24 fps at 2400baud.
+// the max height of the PET/C64 spectrum bar.  At 2400baud the link carries about 21 frames a second, so the task
+// waits for each new pass from the analyzer and sends the newest one whenever the link has room for another,
+// which coalesces the passes that came in between.  Nothing it sends ever waits, so a slow link or client only
+// ever costs frames, never time.
 //
 // The VICESocketServer acts as a server that sends serial data to the socket on the emulator machine to emulate serial data.
 
 #include <fcntl.h>
 
+struct SerialData
+{
+    uint8_t header[1];          // 'DP' in the high and low nibbles
+    uint8_t vu;                 // VU meter, 0-31
+    uint8_t peaks[8];           // 16 4-bit values representing the band peaks, 0-31 (constrained to 0-19)
+    uint8_t tail;               // (0x0D)
+};
+
 class VICESocketServer
 {
 private:
     int _port;
     int _server_fd;
     struct sockaddr_in _address;
-    std::unique_ptr<uint8_t[]> _pBuffer;
-    std::unique_ptr<uint8_t[]> _abOutputBuffer;
 
-    const int BUFFER_SIZE = 255;
+    // The frame on its way to the client.  One that's partly out is finished before the next goes, so the client
+    // always sees whole frames; one that hasn't started is replaced by anything newer.
+
+    SerialData    _pending;
+    size_t        _cbSent      = 0;
+    bool          _bPending    = false;
+    unsigned long _msLastSent  = 0;
+
+    static constexpr unsigned long kStallTimeoutMs = 5000;    // A client that takes nothing for this long is dropped
 
 public:
     VICESocketServer(int port) : _port(port),
                                  _server_fd(0)
     {
-        _abOutputBuffer = std::make_unique<uint8_t[]>(BUFFER_SIZE);
         memset(&_address, 0, sizeof(_address));
     }
 
     void release()
     {
-        _pBuffer.release();
-
         if (_server_fd)
         {
             close(_server_fd);
@@ -139,8 +297,6 @@ public:
 
     bool begin()
     {
-        _pBuffer = std::make_unique<uint8_t[]>(BUFFER_SIZE);
-
         // Creating socket file descriptor
 
         if ((_server_fd = socket(AF_INET, SOCK_STREAM, 0)) == 0)
@@ -176,57 +332,92 @@ public:
         int new_socket = -1;
         // Accept a new incoming connnection
         int addrlen = sizeof(_address);
-        struct timeval to;
-        to.tv_sec = 1;
-        to.tv_usec = 0;
         if ((new_socket = accept(_server_fd, (struct sockaddr *)&_address, (socklen_t *)&addrlen)) < 0)
         {
             return -1;
         }
-        if (setsockopt(new_socket, SOL_SOCKET, SO_SNDTIMEO, &to, sizeof(to)) < 0)
-        {
-            debugW("Unable to set send timeout on socket!");
-            close(new_socket);
-            return false;
-        }
-        if (setsockopt(new_socket, SOL_SOCKET, SO_RCVTIMEO, &to, sizeof(to)) < 0)
-        {
-            debugW("Unable to set receive timeout on socket!");
-            close(new_socket);
-            return false;
-        }
+        SetSocketBlockingEnabled(new_socket, false);   // Frames are sent without waiting, so a stalled client can't hold up the task
         Serial.println("Accepted new VICE Client!");
+
+        _bPending   = false;
+        _cbSent     = 0;
+        _msLastSent = millis();
         return new_socket;
     }
 
-    bool SendPacketToVICE(int socket, void *pData, size_t cbSize)
+    // SendPacketToVICE
+    //
+    // Sends the emulator's virtual serial port as much of the newest frame as the socket takes right now.  Returns
+    // false if the connection failed or the client has stopped taking frames.
+
+    bool SendPacketToVICE(int socket, const SerialData & data)
     {
-        // Send data to the emulator's virtual serial port
+        if (_cbSent == 0)
+        {
+            _pending  = data;
+            _bPending = true;
+        }
 
-        if (cbSize != write(socket, pData, cbSize))
+        while (_bPending)
         {
-            debugW("Could not write to socket\n");
-            return false;
+            auto cbWritten = send(socket, (const uint8_t *) &_pending + _cbSent, sizeof(_pending) - _cbSent, MSG_DONTWAIT);
+            if (cbWritten < 0)
+            {
+                if (errno != EAGAIN && errno != EWOULDBLOCK)
+                {
+                    debugW("Could not write to socket\n");
+                    return false;
+                }
+                return millis() - _msLastSent < kStallTimeoutMs;
+            }
+
+            _msLastSent = millis();
+            _cbSent += cbWritten;
+            if (_cbSent == sizeof(_pending))
+            {
+                _cbSent   = 0;
+                _bPending = false;
+            }
         }
         return true;
     }
 };
 
-struct SerialData
+// BuildSerialData
+//
+// The PETRock frame for an audio snapshot
+
+static SerialData BuildSerialData(const AudioSnapshot & audio)
 {
-    uint8_t header[1];          // 'DP' in the high and low nibbles
-    uint8_t vu;                 // VU meter, 0-31
-    uint8_t peaks[8];           // 16 4-bit values representing the band peaks, 0-31 (constrained to 0-19)
-    uint8_t tail;               // (0x0D)
-};
+    SerialData data;
+
+    const int MAXPET = 16; // Highest value that the PET can display in a bar
+
+    data.header[0] = ((3 << 4) + 15);
+
+    // Change the 0-2 range of the VURatioFade to 0-16 for the PET
+    data.vu = (byte)((audio.VURatioFade / 2.0f) * (float)MAXPET);
+
+    // We treat 0 as a NUL terminator and so we don't want to send it in-band.  Since a band has to be 2 before
+    // it is displayed, this has no effect on the display
+
+    for (int i = 0; i < 8; i++)
+    {
+        int iBand = map(i, 0, 7, 0, NUM_BANDS - 2);
+        uint8_t low = audio.Peak2Decay[iBand] * MAXPET;
+        uint8_t high = audio.Peak2Decay[iBand + 1] * MAXPET;
+        data.peaks[i] = (high << 4) + low;
+    }
+
+    data.tail = 00;
+    return data;
+}
 
 void IRAM_ATTR AudioSerialTaskEntry(void *)
 {
     //  SoftwareSerial Serial64(SERIAL_PINRX, SERIAL_PINTX);
     debugI(">>> Sampler Task Started");
 
-    SoundAnalyzer Analyzer;
-
 #if ENABLE_VICE_SERVER
     VICESocketServer socketServer(NetworkPort::VICESocketServer);
     if (!socketServer.begin())
@@ -239,40 +430,37 @@ void IRAM_ATTR AudioSerialTaskEntry(void *)
     }
 #endif
 
-    Serial2.begin(2400, SERIAL_8N1, SERIAL_PINRX, SERIAL_PINTX);
+    Serial2.begin(AUDIOSERIAL_BAUD, SERIAL_8N1, SERIAL_PINRX, SERIAL_PINTX);
     debugI("    Opened Serial2 on pins %d,%d\n", SERIAL_PINRX, SERIAL_PINTX);
 
+    // How long a frame takes on the wire, at ten bits a byte for 8N1; the VICE client gets frames at the same pace
+
+    constexpr auto kFrameMicros = sizeof(SerialData) * 10 * MICROS_PER_SECOND / AUDIOSERIAL_BAUD;
+    int64_t lastSent = 0;
+
+    g_ptrSystem->TaskManager().SubscribeToEvents((uint32_t) SystemEvent::AudioPass);
+
     int socket = -1;
 
     for (;;)
     {
-        unsigned long startTime = millis();
-
-        SerialData data;
+        // Wake up for each new pass, or now and then if the audio has stopped, so the link keeps getting frames
 
-        const int MAXPET = 16; // Highest value that the PET can display in a bar
+        NightDriverTaskManager::WaitForEvents(pdMS_TO_TICKS(100));
 
-        data.header[0] = ((3 << 4) + 15);
+        int64_t now = esp_timer_get_time();
+        if (now - lastSent < (int64_t) kFrameMicros)
+            continue;
+        lastSent = now;
 
-        // Change the 0-2 range of the VURatioFade to 0-16 for the PET
-        data.vu = (byte)((g_Analyzer._VURatioFade / 2.0f) * (float)MAXPET);
+        SerialData data = BuildSerialData(g_Analyzer.GetAudioSnapshot());
 
-        // We treat 0 as a NUL terminator and so we don't want to send it in-band.  Since a band has to be 2 before
-        // it is displayed, this has no effect on the display
+        // Only write as much as fits without waiting; if the link hasn't caught up, this frame is dropped and the
+        // next one goes when there's room
 
-        for (int i = 0; i < 8; i++)
-        {
-            int iBand = map(i, 0, 7, 0, NUM_BANDS - 2);
-            uint8_t low = g_Analyzer._peak2Decay[iBand] * MAXPET;
-            uint8_t high = g_Analyzer._peak2Decay[iBand + 1] * MAXPET;
-            data.peaks[i] = (high << 4) + low;
-        }
-
-        data.tail = 00;
-        if (Serial2.availableForWrite())
+        if (Serial2.availableForWrite() >= (int) sizeof(data))
         {
             Serial2.write((uint8_t *)&data, sizeof(data));
-            // Serial2.flush(true);
             static int lastFrame = millis();
             g_Analyzer._serialFPS = FPS(lastFrame, millis());
             lastFrame = millis();
@@ -300,7 +488,7 @@ void IRAM_ATTR AudioSerialTaskEntry(void *)
 
         if (socket >= 0)
         {
-            if (!socketServer.SendPacketToVICE(socket, (uint8_t *)&data, sizeof(data)))
+            if (!socketServer.SendPacketToVICE(socket, data))
             {
                 // If anything goes wrong, we close the socket so it can accept new incoming attempts
                 debugI("Error on socket, so closing");
@@ -309,14 +497,6 @@ void IRAM_ATTR AudioSerialTaskEntry(void *)
             }
         }
 #endif
-
-        auto targetFPS = 480.0 / sizeof(data);
-        auto targetElapsed = 1.0 / targetFPS * 1000;
-        auto elapsed = millis() - startTime;
-        if (targetElapsed > elapsed)
-            delay(targetElapsed - elapsed);
-        else
-            delay(1);
     }
 }
 
@@ -0,0 +1,198 @@
+//+--------------------------------------------------------------------------
+//
+// File:        clocksync.cpp
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+//
+// Description:
+//
+//    Implementation of the ClockSync declared in clocksync.h
+//
+//---------------------------------------------------------------------------
+
+#include "globals.h"
+
+#if ENABLE_CLOCK_SYNC && ENABLE_WIFI
+
+#include <algorithm>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "clocksync.h"
+#include "network.h"
+
+ClockSync g_ClockSync;
+
+void ClockSync::AddSample(const Sample & sample)
+{
+    std::lock_guard<std::mutex> guard(_mutex);
+
+    _samples[_iNext] = sample;
+    _iNext = (_iNext + 1) % CLOCK_SYNC_SAMPLES;
+    _cSamples = std::min<size_t>(_cSamples + 1, CLOCK_SYNC_SAMPLES);
+
+    // Only the exchanges that got through about as fast as the best one count
+
+    int64_t bestDelay = INT64_MAX;
+    for (size_t i = 0; i < _cSamples; i++)
+        bestDelay = std::min(bestDelay, _samples[i].DelayUs);
+    int64_t maxDelay = bestDelay + bestDelay / 2 + CLOCK_SYNC_DELAY_SLACK;
+
+    // Least squares line through their offsets, relative to the newest sample so the numbers stay small
+
+    int64_t base = sample.LocalUs;
+    double n = 0, sumX = 0, sumY = 0, sumXX = 0, sumXY = 0;
+
+    for (size_t i = 0; i < _cSamples; i++)
+    {
+        if (_samples[i].DelayUs > maxDelay)
+            continue;
+
+        double x = (double)(_samples[i].LocalUs - base);
+        double y = (double) _samples[i].OffsetUs;
+        n++;
+        sumX  += x;
+        sumY  += y;
+        sumXX += x * x;
+        sumXY += x * y;
+    }
+
+    double denominator = n * sumXX - sumX * sumX;
+
+    // With too few points, or all of them at once, there's no slope to speak of yet, so we keep the one we had
+
+    double skew = (n >= 4 && denominator > 0.0) ? (n * sumXY - sumX * sumY) / denominator : _skew;
+    skew = std::clamp(skew, -CLOCK_SYNC_MAX_SKEW, CLOCK_SYNC_MAX_SKEW);
+
+    _baseUs   = base;
+    _offsetUs = (sumY - skew * sumX) / n;
+    _skew     = skew;
+    _bSynced  = true;
+}
+
+int64_t ClockSync::BestDelayMicros() const
+{
+    std::lock_guard<std::mutex> guard(_mutex);
+
+    int64_t bestDelay = 0;
+    for (size_t i = 0; i < _cSamples; i++)
+        if (i == 0 || _samples[i].DelayUs < bestDelay)
+            bestDelay = _samples[i].DelayUs;
+    return bestDelay;
+}
+
+bool ClockSync::Exchange()
+{
+    uint32_t reference;
+    uint32_t sequence;
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        reference = _reference;
+        sequence = ++_sequence;
+    }
+
+    int fd = _socket;
+    if (reference == 0 || fd < 0 || !IsWiFiConnected())
+        return false;
+
+    sockaddr_in address = {};
+    address.sin_family      = AF_INET;
+    address.sin_port        = htons(NetworkPort::ClockSync);
+    address.sin_addr.s_addr = reference;
+
+    ClockSyncPacket request = {};
+    request.magic    = htonl(CLOCK_SYNC_HEADER);
+    request.sequence = htonl(sequence);
+    request.t1       = ClockSyncByteOrder(LocalMicros());
+
+    return sendto(fd, &request, sizeof(request), 0, (sockaddr *) &address, sizeof(address)) == sizeof(request);
+}
+
+void ClockSync::ReceiveLoop()
+{
+    int fd;
+    for (;;)
+    {
+        WaitForWiFi();
+
+        // Bound to a port of its own, so the answers can be waited for before the first request goes out
+
+        sockaddr_in address = {};
+        address.sin_family      = AF_INET;
+        address.sin_addr.s_addr = INADDR_ANY;
+
+        fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if (fd >= 0 && bind(fd, (sockaddr *) &address, sizeof(address)) == 0)
+            break;
+
+        debugW("Unable to open clock sync socket");
+        if (fd >= 0)
+            close(fd);
+        delay(1000);
+    }
+    _socket = fd;
+
+    for (;;)
+    {
+        ClockSyncPacket reply;
+        ssize_t cb = recv(fd, &reply, sizeof(reply), 0);
+        int64_t t4 = LocalMicros();
+
+        if (cb < 0)
+        {
+            delay(100);
+            continue;
+        }
+
+        if (cb != sizeof(reply) || ntohl(reply.magic) != CLOCK_SYNC_HEADER)
+            continue;
+
+        {
+            std::lock_guard<std::mutex> guard(_mutex);
+            if (ntohl(reply.sequence) != _sequence)
+                continue;
+        }
+
+        int64_t t1 = ClockSyncByteOrder(reply.t1), t2 = ClockSyncByteOrder(reply.t2), t3 = ClockSyncByteOrder(reply.t3);
+        if (t4 - t1 > CLOCK_SYNC_TIMEOUT * 1000)
+            continue;
+
+        Sample sample;
+        sample.LocalUs  = t1 + (t4 - t1) / 2;
+        sample.OffsetUs = ((t2 - t1) + (t3 - t4)) / 2;
+        sample.DelayUs  = (t4 - t1) - (t3 - t2);
+
+        if (sample.DelayUs < 0)
+            continue;
+
+        AddSample(sample);
+        debugV("Clock sync: offset %.0f us, skew %.2f ppm, delay %lld us", OffsetMicros(), SkewPPM(), (long long) BestDelayMicros());
+    }
+}
+
+// ClockSyncTaskEntry
+//
+// Takes in the answers to our clock sync requests
+
+void IRAM_ATTR ClockSyncTaskEntry(void *)
+{
+    g_ClockSync.ReceiveLoop();
+}
+
+#endif
@@ -0,0 +1,279 @@
+//+--------------------------------------------------------------------------
+//
+// File:        ddpserver.cpp
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+// Description:
+//
+//    DDP ingest of LED data
+//
+//---------------------------------------------------------------------------
+
+#include "globals.h"
+#include "systemcontainer.h"
+
+#if ENABLE_DDP_INGEST
+
+extern DRAM_ATTR std::mutex g_buffer_mutex;
+
+static constexpr size_t kFrameBytes = NUM_LEDS * sizeof(CRGB);
+
+// The header's fields aren't aligned, so they're put together a byte at a time
+
+static inline uint16_t BigEndianWord(const uint8_t * p)
+{
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static inline uint32_t BigEndianDWord(const uint8_t * p)
+{
+    return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+}
+
+bool DDPServer::begin()
+{
+    if ((_fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+    {
+        debugW("DDP socket error\n");
+        return false;
+    }
+
+    int opt = 1;
+    if (setsockopt(_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)))
+    {
+        perror("setsockopt ddp");
+        release();
+        return false;
+    }
+
+    // Time out once a second so the loop notices when WiFi has gone away
+
+    struct timeval to;
+    to.tv_sec = 1;
+    to.tv_usec = 0;
+    if (setsockopt(_fd, SOL_SOCKET, SO_RCVTIMEO, &to, sizeof(to)) < 0)
+    {
+        debugW("Unable to set read timeout on DDP socket!");
+        release();
+        return false;
+    }
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = INADDR_ANY;
+    address.sin_port = htons( NetworkPort::DDP );
+
+    if (bind(_fd, (struct sockaddr *)&address, sizeof(address)) < 0)
+    {
+        perror("bind failed for ddp\n");
+        release();
+        return false;
+    }
+
+    return true;
+}
+
+// TimecodeToTimestamp
+//
+// A DDP timecode is the low 16 bits of the sender's seconds and 16 bits of fraction.  Our clock follows the
+// sender's closely enough that the full time is the one nearest to now with those low bits.
+
+void DDPServer::TimecodeToTimestamp(uint32_t timecode, uint64_t & seconds, uint64_t & micros)
+{
+    uint64_t now = (uint64_t) SyncedTime();
+
+    seconds = (now & ~0xFFFFull) | (timecode >> 16);
+    if (seconds + 0x8000 < now)
+        seconds += 0x10000;
+    else if (seconds > now + 0x8000)
+        seconds -= 0x10000;
+
+    micros = ((timecode & 0xFFFF) * (uint64_t) MICROS_PER_SECOND) >> 16;
+}
+
+// PendingFrame
+//
+// The frame being put together for the channel, reserving the head of its ring if it hasn't been yet.  Called with
+// g_buffer_mutex held.
+
+DDPServer::ChannelFrame & DDPServer::PendingFrame(size_t iChannel)
+{
+    auto & frame = _frames[iChannel];
+    if (!frame.pBuffer)
+        frame.pBuffer = g_ptrSystem->BufferManagers()[iChannel].ReserveNewBuffer();
+    return frame;
+}
+
+// CommitChannel
+//
+// Publishes the frame put together for the channel.  The pixels no fragment reached are filled from the frame
+// before, or with black if there is none, so nothing stale from further back in the ring shows.  Called with
+// g_buffer_mutex held.
+
+void DDPServer::CommitChannel(size_t iChannel)
+{
+    auto & frame = _frames[iChannel];
+    if (!frame.pBuffer)
+        return;
+
+    auto & bufferManager = g_ptrSystem->BufferManagers()[iChannel];
+    auto pLast = bufferManager.PeekLastBufferAdded();
+    const size_t cPixels = frame.cbExtent / sizeof(CRGB);
+
+    // With a ring of one the frame before is this very buffer, and its pixels are already in place
+
+    if (pLast != frame.pBuffer)
+    {
+        for (size_t iPixel = 0; iPixel < cPixels; iPixel++)
+        {
+            if (frame.received[iPixel])
+                continue;
+
+            uint8_t * pDest = frame.pBuffer->RawPixels() + iPixel * sizeof(CRGB);
+            if (pLast && iPixel < pLast->Length())
+                memcpy(pDest, pLast->Pixels() + iPixel * sizeof(CRGB), sizeof(CRGB));
+            else
+                memset(pDest, 0, sizeof(CRGB));
+        }
+    }
+
+    if (frame.pBuffer->SetFrameInfo(cPixels, frame.seconds, frame.micros) && bufferManager.CommitNewBuffer())
+        _cFrames++;
+    else
+        _cDropped++;
+
+    frame = ChannelFrame();
+}
+
+// Discard
+//
+// Takes a datagram we don't want off the socket
+
+void DDPServer::Discard()
+{
+    uint8_t abHeader[DDP_HEADER_SIZE];
+    recv(_fd, abHeader, sizeof(abHeader), 0);
+    _cDropped++;
+}
+
+// ReceiveFragment
+//
+// The header is peeked at first, so that the pixels can then be received straight into the frame at their offset.
+// A fragment for every channel lands in the first one and is copied to the rest from there.
+
+void DDPServer::ReceiveFragment()
+{
+    uint8_t abHeader[DDP_HEADER_SIZE + DDP_TIMECODE_SIZE];
+
+    int cbPeek = recv(_fd, abHeader, sizeof(abHeader), MSG_PEEK);
+    if (cbPeek < 0)
+    {
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            debugW("Error %d receiving DDP datagram", errno);
+        return;
+    }
+
+    _cReceived++;
+
+    const uint8_t flags    = abHeader[0];
+    const size_t  cbHeader = DDP_HEADER_SIZE + ((flags & DDP_FLAG_TIMECODE) ? DDP_TIMECODE_SIZE : 0);
+    const uint8_t id       = abHeader[3];
+    const size_t  cChannels = g_ptrSystem->BufferManagers().size();
+
+    // Queries, replies and stored settings are for the sender's other devices, and we only show pixels
+
+    if ((size_t) cbPeek < cbHeader
+        || (flags & DDP_FLAG_VERSION_MASK) != DDP_FLAG_VERSION_1
+        || (flags & (DDP_FLAG_QUERY | DDP_FLAG_REPLY | DDP_FLAG_STORAGE))
+        || (id != DDP_ID_ALL && (id < DDP_ID_DISPLAY || id - DDP_ID_DISPLAY >= cChannels)))
+    {
+        Discard();
+        return;
+    }
+
+    const size_t iFirst   = id == DDP_ID_ALL ? 0 : id - DDP_ID_DISPLAY;
+    const size_t iLast    = id == DDP_ID_ALL ? cChannels - 1 : iFirst;
+    const size_t offset   = BigEndianDWord(&abHeader[4]);
+    const size_t cbData   = BigEndianWord(&abHeader[8]);
+    const size_t cbRoom   = offset < kFrameBytes ? std::min(cbData, kFrameBytes - offset) : 0;
+
+    auto guard = TimedLock(g_buffer_mutex, FrameStage::ProducerLock);
+    auto & first = PendingFrame(iFirst);
+
+    struct iovec iov[2];
+    iov[0].iov_base = abHeader;
+    iov[0].iov_len  = cbHeader;
+    iov[1].iov_base = first.pBuffer->RawPixels() + std::min(offset, kFrameBytes);
+    iov[1].iov_len  = cbRoom;
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov    = iov;
+    msg.msg_iovlen = cbRoom ? 2 : 1;
+
+    int cbRead = recvmsg(_fd, &msg, 0);
+    if (cbRead < (int) cbHeader)
+    {
+        _cDropped++;
+        return;
+    }
+
+    size_t cbReceived = std::min<size_t>(cbRead - cbHeader, cbRoom);
+
+    uint64_t seconds = 0, micros = 0;
+    if (flags & DDP_FLAG_TIMECODE)
+        TimecodeToTimestamp(BigEndianDWord(&abHeader[DDP_HEADER_SIZE]), seconds, micros);
+
+    for (size_t iChannel = iFirst; iChannel <= iLast; iChannel++)
+    {
+        auto & frame = PendingFrame(iChannel);
+
+        if (iChannel != iFirst && cbReceived)
+            memcpy(frame.pBuffer->RawPixels() + offset, first.pBuffer->Pixels() + offset, cbReceived);
+
+        if (cbReceived)
+        {
+            frame.cbExtent = std::max(frame.cbExtent, offset + cbReceived);
+
+            // A pixel any of whose bytes came in counts, as one split across two fragments is never whole in either
+            for (size_t iPixel = offset / sizeof(CRGB); iPixel < (offset + cbReceived + sizeof(CRGB) - 1) / sizeof(CRGB); iPixel++)
+                frame.received.set(iPixel);
+        }
+
+        if (flags & DDP_FLAG_TIMECODE)
+        {
+            frame.seconds = seconds;
+            frame.micros  = micros;
+        }
+
+        // A push with nothing received since the last one has no frame to show
+
+        if ((flags & DDP_FLAG_PUSH) && frame.cbExtent)
+            CommitChannel(iChannel);
+    }
+}
+
+void DDPServer::ProcessIncomingFragmentsLoop()
+{
+    while (WiFi.isConnected())
+        ReceiveFragment();
+}
+
+#endif
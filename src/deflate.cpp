@@ -0,0 +1,59 @@
+//+--------------------------------------------------------------------------
+//
+// File:        deflate.cpp
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+//
+// Description:
+//
+//    Implementation of the Deflater declared in deflate.h
+//
+//---------------------------------------------------------------------------
+
+#include "globals.h"
+#include "deflate.h"
+
+extern "C"
+{
+    #include "uzlib/src/uzlib.h"
+    #include "uzlib/src/defl_static.h"
+}
+
+void Deflater::Deflate(const uint8_t * pData, size_t length, std::vector<uint8_t, psram_allocator<uint8_t>> & out)
+{
+    // The table points into the data from the last call, which could well be gone, so it starts out empty each time
+
+    std::fill(_hashTable.begin(), _hashTable.end(), nullptr);
+
+    uzlib_comp comp = {};
+    comp.hash_table     = _hashTable.data();
+    comp.hash_bits      = kHashBits;
+    comp.dict_size      = 32768;
+    comp.out.outbuf     = _pOutput;
+    comp.out.outsize    = _cbOutput;
+
+    zlib_start_block(&comp.out);
+    uzlib_compress(&comp, pData, length);
+    zlib_finish_block(&comp.out);
+
+    _pOutput  = comp.out.outbuf;
+    _cbOutput = comp.out.outsize;
+
+    out.insert(out.end(), _pOutput, _pOutput + comp.out.outlen);
+}
@@ -0,0 +1,403 @@
+//+--------------------------------------------------------------------------
+//
+// File:        dmxserver.cpp
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+// Description:
+//
+//    E1.31 (sACN) and Art-Net ingest of LED data
+//
+//---------------------------------------------------------------------------
+
+#include "globals.h"
+#include "systemcontainer.h"
+
+#if ENABLE_DMX_INGEST
+
+#include <sys/select.h>
+
+extern DRAM_ATTR std::mutex g_buffer_mutex;
+
+// Both protocols put their multi-byte fields in network order, apart from the Art-Net opcode
+
+static inline uint16_t BigEndianWord(const uint8_t * p)
+{
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static inline uint32_t BigEndianDWord(const uint8_t * p)
+{
+    return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+}
+
+// E1.31 packet layout, from ANSI E1.31-2018 section 4
+
+static constexpr uint8_t  kACNPacketIdentifier[12]      = { 'A', 'S', 'C', '-', 'E', '1', '.', '1', '7', 0, 0, 0 };
+static constexpr uint32_t VECTOR_ROOT_E131_DATA         = 0x00000004;
+static constexpr uint32_t VECTOR_ROOT_E131_EXTENDED     = 0x00000008;
+static constexpr uint32_t VECTOR_E131_DATA_PACKET       = 0x00000002;
+static constexpr uint32_t VECTOR_E131_EXTENDED_SYNC     = 0x00000001;
+static constexpr uint8_t  SACN_OPTION_PREVIEW           = 0x80;
+static constexpr uint8_t  SACN_OPTION_TERMINATED        = 0x40;
+static constexpr size_t   SACN_SYNC_PACKET_SIZE         = 49;
+static constexpr size_t   SACN_DATA_OFFSET              = 126;      // After the DMX start code
+
+// Art-Net packet layout, from the Art-Net 4 specification
+
+static constexpr uint8_t  kArtNetID[8]                  = { 'A', 'r', 't', '-', 'N', 'e', 't', 0 };
+static constexpr uint16_t ARTNET_OP_DMX                 = 0x5000;
+static constexpr uint16_t ARTNET_OP_SYNC                = 0x5200;
+static constexpr size_t   ARTNET_DATA_OFFSET            = 18;
+
+// A sender that stops sending syncs is back to having each frame committed as it completes after this long
+static constexpr unsigned long kSyncTimeoutMs           = 4000;
+
+// OpenSocket
+//
+// Binds a datagram socket to the port on every interface, with a one second timeout so the loop notices WiFi going
+
+bool DMXServer::OpenSocket(int & fd, int port)
+{
+    if ((fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+    {
+        debugW("DMX socket error\n");
+        return false;
+    }
+
+    int opt = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)))
+    {
+        perror("setsockopt dmx");
+        return false;
+    }
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = INADDR_ANY;
+    address.sin_port = htons( port );
+
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0)
+    {
+        perror("bind failed for dmx\n");
+        return false;
+    }
+
+    return true;
+}
+
+// JoinSACNGroups
+//
+// sACN senders multicast each universe to 239.255.<universe high byte>.<universe low byte>.  lwIP only has room
+// for a handful of groups, so universes past that still work, but only when they're sent to us directly.
+
+void DMXServer::JoinSACNGroups()
+{
+    #if DMX_SACN_MULTICAST
+        size_t cUniverses = g_ptrSystem->BufferManagers().size() * DMX_UNIVERSES_PER_CHANNEL;
+
+        for (size_t i = 0; i < cUniverses; i++)
+        {
+            uint16_t universe = DMX_SACN_START_UNIVERSE + i;
+
+            struct ip_mreq mreq;
+            mreq.imr_multiaddr.s_addr = htonl(0xEFFF0000 | universe);
+            mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+            if (setsockopt(_fdSACN, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0)
+            {
+                debugW("Unable to join the sACN multicast group for universe %u and up", universe);
+                return;
+            }
+        }
+        debugI("Joined the sACN multicast groups for %zu universes", cUniverses);
+    #endif
+}
+
+bool DMXServer::begin()
+{
+    if (!OpenSocket(_fdSACN, NetworkPort::SACN) || !OpenSocket(_fdArtNet, NetworkPort::ArtNet))
+    {
+        release();
+        return false;
+    }
+
+    JoinSACNGroups();
+
+    // Start over with sequence tracking and syncs, as the sender may well have restarted while we were away
+
+    memset(_bHaveSequence, 0, sizeof(_bHaveSequence));
+    _lastSyncMs = 0;
+    return true;
+}
+
+// SyncActive
+//
+// Whether frames wait for a sync packet to be committed
+
+bool DMXServer::SyncActive() const
+{
+    return _lastSyncMs != 0 && millis() - _lastSyncMs < kSyncTimeoutMs;
+}
+
+// IsCurrentSequence
+//
+// Both protocols count a sequence number per universe.  One a little behind the last is a packet that arrived late
+// and is dropped; anything else, including a big jump back from a sender that restarted, is taken.
+
+bool DMXServer::IsCurrentSequence(size_t iUniverse, uint8_t sequence)
+{
+    if (_bHaveSequence[iUniverse])
+    {
+        int8_t delta = (int8_t)(sequence - _lastSequence[iUniverse]);
+        if (delta <= 0 && delta > -DMX_SEQUENCE_WINDOW)
+            return false;
+    }
+
+    _lastSequence[iUniverse]  = sequence;
+    _bHaveSequence[iUniverse] = true;
+    return true;
+}
+
+// UniverseReceived
+//
+// Copies a universe's pixels into the frame for its channel, committing the frame first if it already has this
+// universe, and after if it now has them all and there's no sync to wait for
+
+void DMXServer::UniverseReceived(size_t iUniverse, int sequence, const uint8_t * pData, size_t cbData, bool bWaitForSync)
+{
+    auto & bufferManagers = g_ptrSystem->BufferManagers();
+    size_t iChannel = iUniverse / DMX_UNIVERSES_PER_CHANNEL;
+    size_t iSlot    = iUniverse % DMX_UNIVERSES_PER_CHANNEL;
+
+    if (iUniverse >= kUniverses || iChannel >= bufferManagers.size())
+    {
+        _cDropped++;
+        return;
+    }
+
+    if (sequence >= 0 && !IsCurrentSequence(iUniverse, sequence))
+    {
+        debugV("Dropping late DMX universe %zu with sequence %u", iUniverse, sequence);
+        _cDropped++;
+        return;
+    }
+
+    size_t firstPixel = iSlot * DMX_PIXELS_PER_UNIVERSE;
+    if (firstPixel >= NUM_LEDS)
+        return;
+
+    size_t cPixels = std::min<size_t>({ cbData / sizeof(CRGB), DMX_PIXELS_PER_UNIVERSE, NUM_LEDS - firstPixel });
+    uint32_t bit   = 1u << iSlot;
+    auto & frame   = _frames[iChannel];
+
+    auto guard = TimedLock(g_buffer_mutex, FrameStage::ProducerLock);
+
+    if (frame.received & bit)
+        CommitChannel(iChannel);
+
+    if (!frame.pBuffer)
+        frame.pBuffer = bufferManagers[iChannel].ReserveNewBuffer();
+
+    // DMX slots are R, G, B in turn, which is how a CRGB is laid out
+
+    memcpy(frame.pBuffer->RawPixels() + firstPixel * sizeof(CRGB), pData, cPixels * sizeof(CRGB));
+    frame.received |= bit;
+
+    if (!bWaitForSync && frame.received == kAllUniverses)
+        CommitChannel(iChannel);
+}
+
+// CommitChannel
+//
+// Publishes the frame put together for the channel.  The universes that didn't make it are filled from the frame
+// before, or with black if there is none, so nothing stale from further back in the ring shows.  Called with
+// g_buffer_mutex held.
+
+void DMXServer::CommitChannel(size_t iChannel)
+{
+    auto & frame = _frames[iChannel];
+    if (!frame.pBuffer)
+        return;
+
+    auto & bufferManager = g_ptrSystem->BufferManagers()[iChannel];
+    auto pLast = bufferManager.PeekLastBufferAdded();
+
+    // With a ring of one the frame before is this very buffer, and its pixels are already in place
+
+    if (pLast != frame.pBuffer)
+    {
+        for (size_t iSlot = 0; iSlot < kSlotsInUse && frame.received != kAllUniverses; iSlot++)
+        {
+            if (frame.received & (1u << iSlot))
+                continue;
+
+            size_t firstPixel = iSlot * DMX_PIXELS_PER_UNIVERSE;
+            size_t cbPixels   = std::min<size_t>(DMX_PIXELS_PER_UNIVERSE, NUM_LEDS - firstPixel) * sizeof(CRGB);
+            uint8_t * pDest   = frame.pBuffer->RawPixels() + firstPixel * sizeof(CRGB);
+
+            if (pLast && pLast->Length() == NUM_LEDS)
+                memcpy(pDest, pLast->Pixels() + firstPixel * sizeof(CRGB), cbPixels);
+            else
+                memset(pDest, 0, cbPixels);
+        }
+    }
+
+    frame.pBuffer->SetFrameInfo(NUM_LEDS, 0, 0);
+    if (bufferManager.CommitNewBuffer())
+        _cFrames++;
+    else
+        _cDropped++;
+
+    frame = ChannelFrame();
+}
+
+void DMXServer::CommitAllChannels()
+{
+    auto guard = TimedLock(g_buffer_mutex, FrameStage::ProducerLock);
+
+    for (size_t iChannel = 0; iChannel < NUM_CHANNELS; iChannel++)
+        CommitChannel(iChannel);
+}
+
+// ProcessSACN
+//
+// Handles an E1.31 data or sync packet.  Preview data is meant for visualizers rather than fixtures, so it's
+// ignored, and other vectors (like universe discovery) aren't for us.
+
+void DMXServer::ProcessSACN(size_t cbPacket)
+{
+    const uint8_t * p = _abPacket;
+
+    if (cbPacket < SACN_SYNC_PACKET_SIZE || memcmp(&p[4], kACNPacketIdentifier, sizeof(kACNPacketIdentifier)) != 0)
+    {
+        _cDropped++;
+        return;
+    }
+
+    uint32_t rootVector    = BigEndianDWord(&p[18]);
+    uint32_t framingVector = BigEndianDWord(&p[40]);
+
+    if (rootVector == VECTOR_ROOT_E131_EXTENDED && framingVector == VECTOR_E131_EXTENDED_SYNC)
+    {
+        _lastSyncMs = std::max(1UL, millis());
+        CommitAllChannels();
+        return;
+    }
+
+    if (rootVector != VECTOR_ROOT_E131_DATA || framingVector != VECTOR_E131_DATA_PACKET || cbPacket < SACN_DATA_OFFSET)
+        return;
+
+    uint16_t syncAddress = BigEndianWord(&p[109]);
+    uint8_t  sequence    = p[111];
+    uint8_t  options     = p[112];
+    uint16_t universe    = BigEndianWord(&p[113]);
+    uint16_t cSlots      = BigEndianWord(&p[123]);           // Counts the start code as well
+    uint8_t  startCode   = p[125];
+
+    if (startCode != 0 || (options & (SACN_OPTION_PREVIEW | SACN_OPTION_TERMINATED)) || universe < DMX_SACN_START_UNIVERSE || cSlots == 0)
+        return;
+
+    size_t cbData = std::min<size_t>(cSlots - 1, cbPacket - SACN_DATA_OFFSET);
+
+    UniverseReceived(universe - DMX_SACN_START_UNIVERSE, sequence, &p[SACN_DATA_OFFSET], cbData, syncAddress != 0 && SyncActive());
+}
+
+// ProcessArtNet
+//
+// Handles an ArtDmx or ArtSync packet.  We don't answer ArtPoll, so controllers need to be told our address.
+
+void DMXServer::ProcessArtNet(size_t cbPacket)
+{
+    const uint8_t * p = _abPacket;
+
+    if (cbPacket < 12 || memcmp(p, kArtNetID, sizeof(kArtNetID)) != 0)
+    {
+        _cDropped++;
+        return;
+    }
+
+    uint16_t opCode = WORDFromMemory(&p[8]);
+
+    if (opCode == ARTNET_OP_SYNC)
+    {
+        _lastSyncMs = std::max(1UL, millis());
+        CommitAllChannels();
+        return;
+    }
+
+    if (opCode != ARTNET_OP_DMX || cbPacket < ARTNET_DATA_OFFSET)
+        return;
+
+    uint8_t  sequence = p[12];
+    uint16_t universe = (uint16_t)(p[15] & 0x7F) << 8 | p[14];  // Net, then Sub-Net and Universe
+    uint16_t cbData   = BigEndianWord(&p[16]);
+
+    if (universe < DMX_ARTNET_START_UNIVERSE)
+        return;
+
+    // Art-Net senders that don't count their packets send sequence 0
+
+    UniverseReceived(universe - DMX_ARTNET_START_UNIVERSE, sequence == 0 ? -1 : sequence, &p[ARTNET_DATA_OFFSET], std::min<size_t>(cbData, cbPacket - ARTNET_DATA_OFFSET), SyncActive());
+}
+
+void DMXServer::ProcessIncomingPacketsLoop()
+{
+    while (WiFi.isConnected())
+    {
+        fd_set readSet;
+        FD_ZERO(&readSet);
+        FD_SET(_fdSACN, &readSet);
+        FD_SET(_fdArtNet, &readSet);
+
+        struct timeval to;
+        to.tv_sec = 1;
+        to.tv_usec = 0;
+
+        int cReady = select(std::max(_fdSACN, _fdArtNet) + 1, &readSet, nullptr, nullptr, &to);
+        if (cReady < 0)
+        {
+            debugW("Error %d waiting for DMX packets", errno);
+            return;
+        }
+
+        for (int fd : { _fdSACN, _fdArtNet })
+        {
+            if (!FD_ISSET(fd, &readSet))
+                continue;
+
+            int cbRead = recv(fd, _abPacket, sizeof(_abPacket), 0);
+            if (cbRead < 0)
+            {
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    continue;
+
+                debugW("Error %d receiving DMX packet", errno);
+                return;
+            }
+
+            _cReceived++;
+            if (fd == _fdSACN)
+                ProcessSACN(cbRead);
+            else
+                ProcessArtNet(cbRead);
+        }
+    }
+}
+
+#endif
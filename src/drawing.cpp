@@ -34,33 +34,141 @@
 #include "globals.h"
 #include "effects/matrix/spectrumeffects.h"
 #include "systemcontainer.h"
+#include "effectreplay.h"
+#include "governor.h"
 
 static DRAM_ATTR CRGB l_SinglePixel = CRGB::Blue;
 static DRAM_ATTR uint64_t l_usLastWifiDraw = 0;
 
-// The g_buffer_mutex is a global mutex used to protect access while adding or removing frames
-// from the led buffer.
-
-extern DRAM_ATTR std::mutex g_buffer_mutex;
-
 extern const CRGBPalette16 vuPaletteGreen;
 
 std::shared_ptr<LEDStripEffect> GetSpectrumAnalyzer(CRGB color);    // Defined in effectmanager.cpp
 
+#if ENABLE_FRAME_INTERPOLATION
+
+// The buffer each channel is blending away from.  It's the last one pulled from the ring, and the ring keeps that
+// slot away from the producer until the next pull, so we can keep drawing from it for as many frames as we need.
+
+static std::shared_ptr<LEDBuffer> l_apBlendFrom[NUM_CHANNELS];
+static bool                       l_abBlendFromShown[NUM_CHANNELS];
+static std::unique_ptr<CRGB []>   l_pBlendLeds;
+
+// InterpolatedDraw
+//
+// Pulls frames out of the ring as they come due, like WiFiDraw, but rather than holding each one until the next is
+// due, it blends the last due frame towards the upcoming one by how far "now" is between their timestamps.  This
+// lets the draw loop run at full rate while the sender stays at its own frame rate.  Returns pixels drawn.
+
+static uint16_t InterpolatedDraw(LEDBufferManager & bufferManager, size_t iChannel, const timeval & tv)
+{
+    auto & pFrom = l_apBlendFrom[iChannel];
+
+    while (!bufferManager.IsEmpty() && bufferManager.PeekOldestBuffer()->IsBufferOlderThan(tv))
+    {
+        pFrom = bufferManager.GetOldestBuffer();
+        l_abBlendFromShown[iChannel] = false;
+    }
+
+    if (!pFrom)
+        return 0;
+
+    auto pTo = bufferManager.PeekOldestBuffer();
+
+    int64_t usFrom = pFrom->Seconds() * MICROS_PER_SECOND + pFrom->MicroSeconds();
+    int64_t usTo   = pTo ? pTo->Seconds() * MICROS_PER_SECOND + pTo->MicroSeconds() : usFrom;
+    int64_t usNow  = (int64_t) tv.tv_sec * MICROS_PER_SECOND + tv.tv_usec;
+    int64_t usSpan = usTo - usFrom;
+
+    // With nothing sensible to blend towards we just show the frame once, like WiFiDraw would
+
+    if (!pTo || pTo->Length() != pFrom->Length() || usSpan <= 0 || usSpan > FRAME_INTERPOLATION_MAX_GAP * 1000LL)
+    {
+        if (l_abBlendFromShown[iChannel])
+            return 0;
+
+        l_abBlendFromShown[iChannel] = true;
+        pFrom->DrawBuffer();
+        return pFrom->Length();
+    }
+
+    if (!l_pBlendLeds)
+        l_pBlendLeds = make_unique_psram_array<CRGB>(NUM_LEDS);
+
+    // Without the memory to blend into, the frame is shown as it is
+
+    l_abBlendFromShown[iChannel] = true;
+    if (!l_pBlendLeds)
+    {
+        pFrom->DrawBuffer();
+        return pFrom->Length();
+    }
+
+    fract8 amount = std::clamp<int64_t>((usNow - usFrom) * 256 / usSpan, 0, 255);
+    pFrom->DrawBufferBlended(*pTo, amount, l_pBlendLeds);
+    return pFrom->Length();
+}
+
+#endif
+
+// DrawUpdateProgress
+//
+// Stands in for the effects while an OTA update is flashed: a bar across every device that fills up as the update
+// goes, with a pulsing leading edge so it's plain the device is still alive.  Returns pixels drawn.
+
+static uint16_t DrawUpdateProgress()
+{
+    uint8_t progress = g_Values.UpdateProgress;
+
+    for (auto& device : g_ptrSystem->Devices())
+    {
+        int width = device->width();
+        int done  = width * progress / 100;
+
+        device->fillRectangle(0, 0, width, device->height(), CRGB::Black);
+        device->fillRectangle(0, 0, done, device->height(), CRGB::Purple);
+        if (done < width)
+            device->fillRectangle(done, 0, done + 1, device->height(), CRGB(CRGB::Purple).nscale8_video(beatsin8(60, 32, 255)));
+    }
+
+    return NUM_LEDS;
+}
+
 // WiFiDraw
 //
 // Draws from WiFi color data if available, returns pixels drawn this frame
 
 uint16_t WiFiDraw()
 {
-    std::lock_guard<std::mutex> guard(g_buffer_mutex);
+    // The draw loop is the only consumer of the buffer rings, which are lock-free, so no mutex is needed here
 
     uint16_t pixelsDrawn = 0;
-    for (auto& bufferManager : g_ptrSystem->BufferManagers())
+    auto& bufferManagers = g_ptrSystem->BufferManagers();
+    for (size_t iChannel = 0; iChannel < bufferManagers.size(); iChannel++)
     {
+        auto& bufferManager = bufferManagers[iChannel];
+
+        timeval tv = SyncedTimeval();
 
-        timeval tv;
-        gettimeofday(&tv, nullptr);
+        // With the jitter buffer on, frames are presented relative to a shifted clock
+
+        #if ENABLE_JITTER_BUFFER
+            int64_t usShifted = (int64_t) tv.tv_sec * MICROS_PER_SECOND + tv.tv_usec + (int64_t) (bufferManager.PresentationOffset() * MICROS_PER_SECOND);
+            tv.tv_sec  = usShifted / MICROS_PER_SECOND;
+            tv.tv_usec = usShifted % MICROS_PER_SECOND;
+        #endif
+
+        #if ENABLE_FRAME_INTERPOLATION
+            if (NTPTimeClient::HasClockBeenSet() && iChannel < NUM_CHANNELS)
+            {
+                uint16_t pixelsBlended = InterpolatedDraw(bufferManager, iChannel, tv);
+                if (pixelsBlended > 0)
+                {
+                    l_usLastWifiDraw = micros();
+                    pixelsDrawn += pixelsBlended;
+                }
+                continue;
+            }
+        #endif
 
         // Pull buffers out of the queue.
 
@@ -77,12 +185,18 @@ uint16_t WiFiDraw()
                 // written as 'while' it will pull frames until it gets one that is current.
                 // Chew through ALL frames older than now, ignoring all but the last of them
 
+                uint32_t cPulled = 0;
                 while (!bufferManager.IsEmpty() && bufferManager.PeekOldestBuffer()->IsBufferOlderThan(tv))
+                {
                     pBuffer = bufferManager.GetOldestBuffer();
+                    cPulled++;
+                }
+                g_IngestStats.FramesStale(cPulled > 1 ? cPulled - 1 : 0);
             }
 
             if (pBuffer)
             {
+                g_IngestStats.FramePresented(pBuffer->QueuedMicros(), pBuffer->Seconds(), pBuffer->MicroSeconds());
                 l_usLastWifiDraw = micros();
                 debugV("Calling LEDBuffer::Draw from wire with %d/%d pixels.", pixelsDrawn, NUM_LEDS);
                 pBuffer->DrawBuffer();
@@ -143,6 +257,21 @@ uint16_t LocalDraw()
     return 0;
 }
 
+// TargetFramesPerSecond
+//
+// What the current effect asks for, less whatever the governor is holding it to
+
+static size_t TargetFramesPerSecond()
+{
+    size_t fps = std::max<size_t>(1, g_ptrSystem->EffectManager().GetCurrentEffect().DesiredFramesPerSecond());
+
+    #if ENABLE_GOVERNOR
+        fps = g_Governor.LimitFramesPerSecond(fps);
+    #endif
+
+    return fps;
+}
+
 // CalcDelayUntilNextFrame
 //
 // Returns the amount of time to wait patiently until it's time to draw the next frame, up to one second max
@@ -157,11 +286,17 @@ int CalcDelayUntilNextFrame(double frameStartTime, uint16_t localPixelsDrawn, ui
 
     if (localPixelsDrawn > 0)
     {
-        const double minimumFrameTime = 1.0 / g_ptrSystem->EffectManager().GetCurrentEffect().DesiredFramesPerSecond();
+        const double minimumFrameTime = 1.0 / TargetFramesPerSecond();
         double elapsed = g_Values.AppTime.CurrentTime() - frameStartTime;
         if (elapsed < minimumFrameTime)
             g_Values.FreeDrawTime = std::clamp(minimumFrameTime - elapsed, 0.0, 1.0);
     }
+    else if (wifiPixelsDrawn > 0 && ENABLE_FRAME_INTERPOLATION && NTPTimeClient::HasClockBeenSet())
+    {
+        // Blending between frames wants every pass we can give it, so don't sleep until the next frame is due
+
+        g_Values.FreeDrawTime = kMinDelay;
+    }
     else if (wifiPixelsDrawn > 0)
     {
         // Look through all the channels to see how far away the next wifi frame is times for.  We can then delay
@@ -175,7 +310,7 @@ int CalcDelayUntilNextFrame(double frameStartTime, uint16_t localPixelsDrawn, ui
             auto pOldest = bufferManager.PeekOldestBuffer();
             if (pOldest)
             {
-                t = std::min(t, pOldest->TimeTillDue());
+                t = std::min(t, pOldest->TimeTillDue() + bufferManager.PresentationOffset());
                 bFoundFrame = true;
             }
         }
@@ -192,6 +327,38 @@ int CalcDelayUntilNextFrame(double frameStartTime, uint16_t localPixelsDrawn, ui
 #endif
 }
 
+// WaitForNextFrame
+//
+// Local effects are paced on absolute deadlines one DesiredFramesPerSecond() period apart, so variance in render cost
+// doesn't build up as drift the way sleeping a relative amount after each frame does.  Wifi frames, and passes where
+// nothing was drawn, still wait for as long as CalcDelayUntilNextFrame says.  Either way we block for at least one
+// tick, so the lower priority socket and audio tasks get their time even when an effect can't keep up.
+
+void WaitForNextFrame(uint16_t localPixelsDrawn, int relativeDelayMs)
+{
+    static TickType_t lastWake = xTaskGetTickCount();
+
+    if (localPixelsDrawn > 0)
+    {
+        const size_t fps = TargetFramesPerSecond();
+        const TickType_t period = std::max<TickType_t>(1, pdMS_TO_TICKS(MILLIS_PER_SECOND / fps));
+
+        if (xTaskGetTickCount() - lastWake < period)
+        {
+            vTaskDelayUntil(&lastWake, period);
+            return;
+        }
+
+        // We blew the deadline, so count it and start over from now rather than rushing to catch up
+
+        g_Values.MissedFrames++;
+        relativeDelayMs = 0;
+    }
+
+    vTaskDelay(std::max<TickType_t>(1, pdMS_TO_TICKS(relativeDelayMs)));
+    lastWake = xTaskGetTickCount();
+}
+
 // ShowOnboardLED
 //
 // If the board has an onboard LED, this will update it to show some activity from the draw
@@ -251,9 +418,13 @@ void IRAM_ATTR DrawLoopTaskEntry(void *)
 
     PrepareOnboardPixel();
 
-    // Start the effect
+    // Start the effect.  The effect and task managers live as long as we do, so they're looked up once rather
+    // than every frame
+
+    auto& effectManager = g_ptrSystem->EffectManager();
+    auto& taskManager   = g_ptrSystem->TaskManager();
 
-    g_ptrSystem->EffectManager().StartEffect();
+    effectManager.StartEffect();
 
     // Run the draw loop
 
@@ -261,50 +432,114 @@ void IRAM_ATTR DrawLoopTaskEntry(void *)
 
     for (;;)
     {
+        // Replays borrow the drawing thread, and the app time, between our frames
+
+        #if ENABLE_EFFECT_REPLAY
+            RunPendingEffectReplay();
+        #endif
+
+        // A follower starts the leader's effects and takes its clock before the frame's time is taken
+
+        #if ENABLE_EFFECT_SYNC
+            g_ptrSystem->EffectSync().ApplyToFrame();
+        #endif
+
+        #if ENABLE_STALL_WATCH
+            g_StallWatch.BeginFrame();
+        #endif
+
         g_Values.AppTime.NewFrame();
+        g_DrawScratch.Reset();
+
+        #if ENABLE_AUDIO && ENABLE_AUDIO_LATENCY
+            g_AudioLatency.FrameStarted(g_Values.AppTime.FrameMicros());
+        #endif
 
         uint16_t localPixelsDrawn   = 0;
         uint16_t wifiPixelsDrawn    = 0;
         double frameStartTime       = g_Values.AppTime.FrameStartTime();
+        unsigned long usFrameStart  = micros();
 
-        auto graphics = g_ptrSystem->EffectManager().GetBaseGraphics();
+        auto& graphics = effectManager.GetBaseGraphics();
 
-        graphics->PrepareFrame();
+        {
+            TIME_STAGE(Frame);
 
-        if (WiFi.isConnected())
-            wifiPixelsDrawn = WiFiDraw();
+            {
+                TIME_STAGE(Prepare);
+                graphics->PrepareFrame();
+            }
 
-        // If we didn't draw now, and it's been a while since we did, and we have at least one local effect, then draw the local effect instead
+            // A show from flash, or frames over ESP-NOW, feed the rings with or without WiFi
 
-        if (wifiPixelsDrawn == 0)
-            localPixelsDrawn = LocalDraw();
+            if ((ENABLE_SHOW_PLAYBACK || ENABLE_ESPNOW || WiFi.isConnected()) && !g_Values.UpdateStarted)
+            {
+                TIME_STAGE(WiFiDraw);
+                wifiPixelsDrawn = WiFiDraw();
+            }
 
-        // If we drew any pixels by any method, we'll call that a frame and track it for FPS purposes.  We also notify the
-        // color data thread that a new frame is available and can be transmitted to clients
+            // If we didn't draw now, and it's been a while since we did, and we have at least one local effect, then draw the local effect instead
 
-        if (wifiPixelsDrawn + localPixelsDrawn > 0)
-        {
-            // If the module has onboard LEDs, we support a couple of different types, and we set it to be the same as whatever
-            // is on LED #0 of Channel #0.
+            if (g_Values.UpdateStarted)
+            {
+                TIME_STAGE(LocalDraw);
+                localPixelsDrawn = DrawUpdateProgress();
+            }
+            else if (wifiPixelsDrawn == 0)
+            {
+                TIME_STAGE(LocalDraw);
+                localPixelsDrawn = LocalDraw();
+            }
 
-            ShowOnboardPixel();
-            ShowOnboardRGBLED();
+            // If we drew any pixels by any method, we'll call that a frame and track it for FPS purposes.  We also notify the
+            // color data thread that a new frame is available and can be transmitted to clients
 
-            g_Values.FPS = FastLED.getFPS();
-            g_ptrSystem->EffectManager().SetNewFrameAvailable(true);
+            if (wifiPixelsDrawn + localPixelsDrawn > 0)
+            {
+                // If the module has onboard LEDs, we support a couple of different types, and we set it to be the same as whatever
+                // is on LED #0 of Channel #0.
+
+                ShowOnboardPixel();
+                ShowOnboardRGBLED();
+
+                #if USE_SCREEN && ENABLE_SCREEN_PREVIEW
+                    CaptureScreenPreview();
+                #endif
+
+                g_Values.FPS = FastLED.getFPS();
+                effectManager.NewFrameDrawn();
+                taskManager.PostEvent(SystemEvent::FrameDrawn);
+            }
+
+            TIME_STAGE(PostProcess);
+            graphics->PostProcessFrame(localPixelsDrawn, wifiPixelsDrawn);
         }
 
-        graphics->PostProcessFrame(localPixelsDrawn, wifiPixelsDrawn);
+        #if ENABLE_STALL_WATCH
+            g_StallWatch.EndFrame();
+        #endif
+
+        if (wifiPixelsDrawn + localPixelsDrawn > 0)
+        {
+            g_Values.FrameMicros = micros() - usFrameStart;
+            OBSERVE_METRIC(Frame, g_Values.FrameMicros);
+        }
 
-        // Delay at least 2ms and not more than 1s until next frame is due
+        // Frames coming in over the network want everything we've got, and the governor takes its readings between
+        // frames
 
-        constexpr auto minimumDelay = 5;
-        delay( std::max(minimumDelay, CalcDelayUntilNextFrame(frameStartTime, localPixelsDrawn, wifiPixelsDrawn) ));
+        #if ENABLE_GOVERNOR
+            if (wifiPixelsDrawn > 0)
+                g_Governor.Boost();
+            g_Governor.Update();
+        #endif
 
-        // Once an OTA flash update has started, we don't want to hog the CPU or it goes quite slowly,
-        // so we'll slow down to share the CPU a bit once the update has begun
+        // Sleep until the next frame is due, which is never more than 1s away.  Once an OTA flash update has started,
+        // the progress bar goes out at a low, steady rate instead, which leaves the CPU to the update.
 
         if (g_Values.UpdateStarted)
-            delay(500);
+            delay(1000 / UPDATE_PROGRESS_FPS);
+        else
+            WaitForNextFrame(localPixelsDrawn, CalcDelayUntilNextFrame(frameStartTime, localPixelsDrawn, wifiPixelsDrawn));
     }
 }
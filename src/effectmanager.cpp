@@ -27,21 +27,30 @@
 // History:     Sep-26-2023         Rbergen     Extracted from effects.cpp
 //---------------------------------------------------------------------------
 
-#include <FS.h>
-#include <SPIFFS.h>
+#include "storage.h"
 
 #include "globals.h"
 #include "systemcontainer.h"
 
 #include "effects/strip/misceffects.h"
+#include "effects/matrix/PatternClock.h"
+
+#if ENABLE_EFFECT_STATE_RECORD
+    extern "C"
+    {
+        #include "uzlib/src/uzlib.h"
+    }
+#endif
 
 // Variables we need further down
 
-extern DRAM_ATTR std::unique_ptr<EffectFactories> g_ptrEffectFactories;
-extern std::map<int, JSONEffectFactory> g_JsonStarryNightEffectFactories;
 DRAM_ATTR size_t g_EffectsManagerJSONBufferSize = 0;
 static DRAM_ATTR size_t l_EffectsManagerJSONWriterIndex = std::numeric_limits<size_t>::max();
 static DRAM_ATTR size_t l_CurrentEffectWriterIndex = std::numeric_limits<size_t>::max();
+#if ENABLE_PLAYLISTS
+    static DRAM_ATTR size_t l_PlaylistsJSONBufferSize = 0;
+    static DRAM_ATTR size_t l_PlaylistsWriterIndex = std::numeric_limits<size_t>::max();
+#endif
 
 //
 // EffectManager initialization functions
@@ -53,16 +62,16 @@ static DRAM_ATTR size_t l_CurrentEffectWriterIndex = std::numeric_limits<size_t>
     {
         debugW("InitSplashEffectManager");
 
-        g_ptrSystem->SetupEffectManager(make_shared_psram<SplashLogoEffect>(), g_ptrSystem->Devices());
+        g_ptrSystem->SetupEffectManager(make_shared_effect<SplashLogoEffect>(), g_ptrSystem->Devices());
     }
 
 #endif
 
 // Declare these here just so InitEffectsManager can refer to them. They're defined elsewhere or further down.
 
-void LoadEffectFactories();
 std::optional<JsonObjectConst> LoadEffectsJSONFile(std::unique_ptr<AllocatedJsonDocument>& pJsonDoc);
 void WriteCurrentEffectIndexFile();
+void WriteEffectStateFile();
 
 // InitEffectsManager
 //
@@ -71,14 +80,25 @@ void InitEffectsManager()
 {
     debugW("InitEffectsManager...");
 
-    LoadEffectFactories();
-
     l_EffectsManagerJSONWriterIndex = g_ptrSystem->JSONWriter().RegisterWriter([]()
     {
-        if (!SaveToJSONFile(EFFECTS_CONFIG_FILE, g_EffectsManagerJSONBufferSize, g_ptrSystem->EffectManager()) && EFFECT_PERSISTENCE_CRITICAL)
+        auto& effectManager = g_ptrSystem->EffectManager();
+        effectManager.NewConfigGeneration();
+
+        if (!SaveToJSONFile(EFFECTS_CONFIG_FILE, g_EffectsManagerJSONBufferSize, effectManager) && EFFECT_PERSISTENCE_CRITICAL)
             throw std::runtime_error("Effects serialization failed");
+
+        // The state record names the generation it goes with, so it has to follow the effects file
+        #if ENABLE_EFFECT_STATE_RECORD
+            WriteEffectStateFile();
+        #endif
     });
-    l_CurrentEffectWriterIndex = g_ptrSystem->JSONWriter().RegisterWriter(WriteCurrentEffectIndexFile);
+
+    #if ENABLE_EFFECT_STATE_RECORD
+        l_CurrentEffectWriterIndex = g_ptrSystem->JSONWriter().RegisterWriter(WriteEffectStateFile);
+    #else
+        l_CurrentEffectWriterIndex = g_ptrSystem->JSONWriter().RegisterWriter(WriteCurrentEffectIndexFile);
+    #endif
 
     std::unique_ptr<AllocatedJsonDocument> pJsonDoc;
     auto jsonObject = LoadEffectsJSONFile(pJsonDoc);
@@ -104,13 +124,58 @@ void InitEffectsManager()
             g_ptrSystem->SetupEffectManager(g_ptrSystem->Devices());
     }
 
+    #if ENABLE_PLAYLISTS
+        l_PlaylistsWriterIndex = g_ptrSystem->JSONWriter().RegisterWriter([]()
+        {
+            SaveToJSONFile(PLAYLISTS_CONFIG_FILE, l_PlaylistsJSONBufferSize, g_ptrSystem->EffectManager().Scheduler());
+        });
+
+        // The playlists are kept apart from the effects, so switching between them doesn't rewrite the effects file
+        if (LoadJSONFile(PLAYLISTS_CONFIG_FILE, l_PlaylistsJSONBufferSize, pJsonDoc))
+        {
+            g_ptrSystem->EffectManager().LoadPlaylists(pJsonDoc->as<JsonObjectConst>());
+            pJsonDoc->clear();
+        }
+    #endif
+
     if (false == g_ptrSystem->EffectManager().Init())
         throw std::runtime_error("Could not initialize effect manager");
 
-    // We won't need the default factories anymore, so swipe them from memory
-    g_ptrEffectFactories->ClearDefaultFactories();
+    #if ENABLE_EFFECT_LAYERS && EFFECT_LAYER_CLOCK && USE_HUB75
+        if (!g_ptrSystem->EffectManager().AddLayer(make_shared_effect<PatternClock>(), 255, LayerBlend::Alpha))
+            debugW("Could not add the clock layer");
+    #endif
 }
 
+// NotifyEffectPrepareThread
+//
+// Lets the EffectManager wake the prepare task without needing the system container in its header
+
+void NotifyEffectPrepareThread()
+{
+    g_ptrSystem->TaskManager().NotifyEffectPrepareThread();
+}
+
+#if ENABLE_EFFECT_PREPARE
+
+// EffectPrepareTaskEntry
+//
+// Runs the Prepare() of the next effect in the rotation when the EffectManager asks for it, at low priority on
+// the core the drawing isn't on
+
+void IRAM_ATTR EffectPrepareTaskEntry(void *)
+{
+    for (;;)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        if (g_ptrSystem->HasEffectManager())
+            g_ptrSystem->EffectManager().RunPendingPrepare();
+    }
+}
+
+#endif
+
 //
 // EffectManager member function definitions
 //
@@ -122,9 +187,82 @@ void EffectManager::SaveCurrentEffectIndex()
         g_ptrSystem->JSONWriter().FlagWriter(l_CurrentEffectWriterIndex);
 }
 
+#if ENABLE_EFFECT_STATE_RECORD
+
+// EffectStateHeader
+//
+// The start of the state record, which is followed by one enabled bit per effect.  The record is only used if its
+// generation matches that of the effects file, so one written against a different order of effects is ignored.
+
+struct EffectStateHeader
+{
+    static constexpr uint32_t kMagic = 0x54534645;      // "EFST"
+
+    uint32_t Magic;
+    uint32_t CRC;                                       // Over everything that follows it, to catch a torn write
+    uint32_t Generation;
+    uint32_t CurrentIndex;
+    uint32_t EffectCount;
+};
+
+// ReadEffectState
+//
+// Applies the enabled flags from the state record, and returns true if it also set the current effect index
+
+bool EffectManager::ReadEffectState(size_t& index)
+{
+    File file = FILESYSTEM.open(EFFECT_STATE_FILE);
+    if (!file)
+        return false;
+
+    EffectStateHeader header;
+    std::vector<uint8_t> enabledBits;
+    bool bValid = file.read((uint8_t *) &header, sizeof(header)) == sizeof(header)
+               && header.Magic == EffectStateHeader::kMagic
+               && header.Generation == _configGeneration
+               && header.EffectCount <= EffectCount();
+
+    if (bValid)
+    {
+        enabledBits.resize((header.EffectCount + 7) / 8);
+        bValid = file.read(enabledBits.data(), enabledBits.size()) == enabledBits.size();
+    }
+    file.close();
+
+    if (bValid)
+    {
+        auto crc = uzlib_crc32(&header.Generation, sizeof(header) - offsetof(EffectStateHeader, Generation), 0xffffffff);
+        bValid = uzlib_crc32(enabledBits.data(), enabledBits.size(), crc) == header.CRC;
+    }
+
+    if (!bValid)
+    {
+        debugW("Ignoring stale or damaged %s", EFFECT_STATE_FILE);
+        return false;
+    }
+
+    // Effects added since the record was written come after the ones it covers, and keep what the effects file says
+
+    for (size_t i = 0; i < header.EffectCount; i++)
+    {
+        if (enabledBits[i / 8] & (1 << (i % 8)))
+            EnableEffect(i, true);
+        else
+            DisableEffect(i, true);
+    }
+
+    if (!g_ptrSystem->DeviceConfig().RememberCurrentEffect())
+        return false;
+
+    index = header.CurrentIndex;
+    return true;
+}
+
+#endif
+
 bool EffectManager::ReadCurrentEffectIndex(size_t& index)
 {
-    File file = SPIFFS.open(CURRENT_EFFECT_CONFIG_FILE);
+    File file = FILESYSTEM.open(CURRENT_EFFECT_CONFIG_FILE);
     bool readIndex = false;
 
     if (file)
@@ -153,29 +291,28 @@ void EffectManager::LoadJSONAndMissingEffects(const JsonArrayConst& effectsArray
     std::set<int> loadedEffectNumbers;
 
     // Create effects from JSON objects, using the respective factories in g_EffectFactories
-    auto& jsonFactories = g_ptrEffectFactories->GetJSONFactories();
-
     for (auto effectObject : effectsArray)
     {
         int effectNumber = effectObject[PTY_EFFECTNR];
-        auto factoryEntry = jsonFactories.find(effectNumber);
+        auto pFactory = g_EffectFactories.FindJSONFactory(effectNumber);
 
-        if (factoryEntry == jsonFactories.end())
+        if (!pFactory)
             continue;
 
-        auto pEffect = factoryEntry->second(effectObject);
+        auto pEffect = (*pFactory)(effectObject);
         if (pEffect)
         {
             if (effectObject[PTY_COREEFFECT].as<int>())
                 pEffect->MarkAsCoreEffect();
 
             _vEffects.push_back(pEffect);
+            _effectListVersion++;
             loadedEffectNumbers.insert(effectNumber);
         }
     }
 
     // Now add missing effects from the default factory list
-    auto &defaultFactories = g_ptrEffectFactories->GetDefaultFactories();
+    auto defaultFactories = g_EffectFactories.GetDefaultFactories();
 
     // We iterate manually, so we can use where we are as the starting point for a later inner loop
     for (auto iter = defaultFactories.begin(); iter != defaultFactories.end(); iter++)
@@ -201,6 +338,96 @@ void EffectManager::LoadJSONAndMissingEffects(const JsonArrayConst& effectsArray
     }
 }
 
+#if ENABLE_RENDER_ZONES
+
+// LoadZones
+//
+// Each zone is "chm", its channel mask; "rgn", an optional [x, y, width, height] of those channels; "fps", how often
+// it's redrawn; "ivl", how long each of its effects runs; and "efs", its effects, serialized as in the main list.
+// The zones are only set up in Init(), once the effects they go over are ready.
+
+void EffectManager::LoadZones(const JsonArrayConst& zonesArray)
+{
+    _zones.Clear();
+    _loadedZones.clear();
+
+    if (zonesArray.isNull())
+        return;
+
+    for (auto zoneObject : zonesArray)
+    {
+        RenderZone zone;
+        zone.ChannelMask     = zoneObject["chm"] | 1u;
+        zone.FramesPerSecond = zoneObject["fps"] | 0u;
+        zone.EffectInterval  = zoneObject["ivl"] | 0u;
+
+        JsonArrayConst region = zoneObject["rgn"].as<JsonArrayConst>();
+        if (region.size() == 4)
+            zone.Region = { region[0].as<int16_t>(), region[1].as<int16_t>(), region[2].as<int16_t>(), region[3].as<int16_t>() };
+
+        for (auto effectObject : zoneObject["efs"].as<JsonArrayConst>())
+        {
+            int effectNumber = effectObject[PTY_EFFECTNR];
+            auto pFactory = g_EffectFactories.FindJSONFactory(effectNumber);
+            if (!pFactory)
+                continue;
+
+            auto pEffect = (*pFactory)(effectObject);
+            if (pEffect)
+                zone.Effects.push_back(pEffect);
+        }
+
+        if (zone.Effects.empty())
+        {
+            debugW("Skipping a render zone with no effects we know");
+            continue;
+        }
+
+        _loadedZones.push_back(std::move(zone));
+    }
+}
+
+bool EffectManager::SerializeZones(JsonArray& zonesArray) const
+{
+    auto serializeZone = [&](const RenderZone & zone)
+    {
+        JsonObject zoneObject = zonesArray.createNestedObject();
+        zoneObject["chm"] = zone.ChannelMask;
+        zoneObject["fps"] = zone.FramesPerSecond;
+        zoneObject["ivl"] = zone.EffectInterval;
+
+        if (!zone.Region.IsEmpty())
+        {
+            JsonArray region = zoneObject.createNestedArray("rgn");
+            region.add(zone.Region.X);
+            region.add(zone.Region.Y);
+            region.add(zone.Region.Width);
+            region.add(zone.Region.Height);
+        }
+
+        JsonArray effectsArray = zoneObject.createNestedArray("efs");
+        for (auto & effect : zone.Effects)
+        {
+            JsonObject effectObject = effectsArray.createNestedObject();
+            if (!effect->SerializeToJSON(effectObject))
+                return false;
+        }
+        return true;
+    };
+
+    for (auto & zone : _zones.Zones())
+        if (!serializeZone(zone))
+            return false;
+
+    for (auto & zone : _loadedZones)
+        if (!serializeZone(zone))
+            return false;
+
+    return true;
+}
+
+#endif
+
 std::shared_ptr<LEDStripEffect> EffectManager::CopyEffect(size_t index)
 {
     if (index >= _vEffects.size())
@@ -213,23 +440,32 @@ std::shared_ptr<LEDStripEffect> EffectManager::CopyEffect(size_t index)
 
     auto& sourceEffect = _vEffects[index];
 
-    auto jsonEffectFactories = g_ptrEffectFactories->GetJSONFactories();
-    auto factoryEntry = jsonEffectFactories.find(sourceEffect->EffectNumber());
+    // Effects that can copy themselves do so directly; the rest are serialized and built again by their JSON factory
 
-    if (factoryEntry == jsonEffectFactories.end())
-        return nullptr;
+    auto copiedEffect = sourceEffect->Clone();
 
-    std::unique_ptr<AllocatedJsonDocument> ptrJsonDoc = nullptr;
+    if (!copiedEffect)
+    {
+        auto pFactory = g_EffectFactories.FindJSONFactory(sourceEffect->EffectNumber());
+        if (!pFactory)
+            return nullptr;
 
-    assert(SerializeWithBufferSize(ptrJsonDoc, jsonBufferSize,
-        [&sourceEffect](JsonObject &jsonObject) { return sourceEffect->SerializeToJSON(jsonObject); }));
+        std::unique_ptr<AllocatedJsonDocument> ptrJsonDoc = nullptr;
 
-    auto copiedEffect = factoryEntry->second(ptrJsonDoc->as<JsonObjectConst>());
+        if (!SerializeWithBufferSize(ptrJsonDoc, jsonBufferSize,
+                [&sourceEffect](JsonObject &jsonObject) { return sourceEffect->SerializeToJSON(jsonObject); }))
+        {
+            debugW("Could not serialize effect %zu for CopyEffect", index);
+            return nullptr;
+        }
 
-    ptrJsonDoc->clear();
+        copiedEffect = (*pFactory)(ptrJsonDoc->as<JsonObjectConst>());
 
-    if (!copiedEffect)
-        return nullptr;
+        ptrJsonDoc->clear();
+
+        if (!copiedEffect)
+            return nullptr;
+    }
 
     copiedEffect->SetEnabled(false);
 
@@ -247,18 +483,45 @@ void SaveEffectManagerConfig()
     g_ptrSystem->JSONWriter().FlagWriter(l_EffectsManagerJSONWriterIndex);
 }
 
+void SaveEffectState()
+{
+    // Without the state record, the enabled flags only live in the effects file
+    #if ENABLE_EFFECT_STATE_RECORD
+        g_ptrSystem->JSONWriter().FlagWriter(l_CurrentEffectWriterIndex);
+    #else
+        SaveEffectManagerConfig();
+    #endif
+}
+
 void RemoveEffectManagerConfig()
 {
     RemoveJSONFile(EFFECTS_CONFIG_FILE);
     // We take the liberty of also removing the file with the current effect config index
-    SPIFFS.remove(CURRENT_EFFECT_CONFIG_FILE);
+    FILESYSTEM.remove(CURRENT_EFFECT_CONFIG_FILE);
+    #if ENABLE_EFFECT_STATE_RECORD
+        FILESYSTEM.remove(EFFECT_STATE_FILE);
+    #endif
+    // The playlists refer to effects by index, so they go with the effects
+    #if ENABLE_PLAYLISTS
+        RemoveJSONFile(PLAYLISTS_CONFIG_FILE);
+    #endif
 }
 
+#if ENABLE_PLAYLISTS
+
+void SavePlaylistsConfig()
+{
+    // Default value for writer index is max value for size_t, so nothing will happen if writer has not yet been registered
+    g_ptrSystem->JSONWriter().FlagWriter(l_PlaylistsWriterIndex);
+}
+
+#endif
+
 void WriteCurrentEffectIndexFile()
 {
-    SPIFFS.remove(CURRENT_EFFECT_CONFIG_FILE);
+    FILESYSTEM.remove(CURRENT_EFFECT_CONFIG_FILE);
 
-    File file = SPIFFS.open(CURRENT_EFFECT_CONFIG_FILE, FILE_WRITE);
+    File file = FILESYSTEM.open(CURRENT_EFFECT_CONFIG_FILE, FILE_WRITE);
 
     if (!file)
     {
@@ -275,21 +538,62 @@ void WriteCurrentEffectIndexFile()
     if (bytesWritten == 0)
     {
         debugE("Unable to write to file %s!", CURRENT_EFFECT_CONFIG_FILE);
-        SPIFFS.remove(CURRENT_EFFECT_CONFIG_FILE);
+        FILESYSTEM.remove(CURRENT_EFFECT_CONFIG_FILE);
     }
 }
 
-// Helper function to create a StarryNightEffect from JSON.
-//   It picks the actual effect factory from g_JsonStarryNightEffectFactories based on the star type number in the JSON blob.
-std::shared_ptr<LEDStripEffect> CreateStarryNightEffectFromJSON(const JsonObjectConst& jsonObject)
+#if ENABLE_EFFECT_STATE_RECORD
+
+// WriteEffectStateFile
+//
+// Writes the current effect index and the enabled flags over the record that's there, rather than removing and
+// recreating the file, so a click through the effects costs a few dozen bytes of flash and no serializing
+
+void WriteEffectStateFile()
 {
-    auto entry = g_JsonStarryNightEffectFactories.find(jsonObject[PTY_STARTYPENR]);
+    auto& effectManager = g_ptrSystem->EffectManager();
+    const auto& effects = effectManager.EffectsList();
+
+    std::vector<uint8_t> record(sizeof(EffectStateHeader) + (effects.size() + 7) / 8, 0);
+    auto pHeader = (EffectStateHeader *) record.data();
+    auto pEnabledBits = record.data() + sizeof(EffectStateHeader);
+
+    for (size_t i = 0; i < effects.size(); i++)
+        if (effects[i]->IsEnabled())
+            pEnabledBits[i / 8] |= 1 << (i % 8);
+
+    pHeader->Magic        = EffectStateHeader::kMagic;
+    pHeader->Generation   = effectManager.ConfigGeneration();
+    pHeader->CurrentIndex = effectManager.GetCurrentEffectIndex();
+    pHeader->EffectCount  = effects.size();
+    pHeader->CRC          = uzlib_crc32(&pHeader->Generation, record.size() - offsetof(EffectStateHeader, Generation), 0xffffffff);
+
+    // Anything past the end of a shorter record is left over from a longer one, and the count says to ignore it
+    File file = FILESYSTEM.exists(EFFECT_STATE_FILE) ? FILESYSTEM.open(EFFECT_STATE_FILE, "r+") : FILESYSTEM.open(EFFECT_STATE_FILE, FILE_WRITE);
+
+    if (!file)
+    {
+        debugE("Unable to open file %s for writing!", EFFECT_STATE_FILE);
+        return;
+    }
+
+    auto bytesWritten = file.write(record.data(), record.size());
+    file.close();
 
-    return entry != g_JsonStarryNightEffectFactories.end()
-        ? entry->second(jsonObject)
-        : nullptr;
+    if (bytesWritten != record.size())
+    {
+        debugE("Unable to write to file %s!", EFFECT_STATE_FILE);
+        FILESYSTEM.remove(EFFECT_STATE_FILE);
+        return;
+    }
+
+    // The record takes over from the old index file
+    if (FILESYSTEM.exists(CURRENT_EFFECT_CONFIG_FILE))
+        FILESYSTEM.remove(CURRENT_EFFECT_CONFIG_FILE);
 }
 
+#endif
+
 //
 // Other helper functions
 //
@@ -306,8 +610,8 @@ std::shared_ptr<LEDStripEffect> GetSpectrumAnalyzer(CRGB color)
 {
     CHSV hueColor = rgb2hsv_approximate(color);
     CRGB color2 = CRGB(CHSV(hueColor.hue + 64, 255, 255));
-    auto object = make_shared_psram<SpectrumAnalyzerEffect>("Spectrum Clr", 24, CRGBPalette16(color, color2), true);
-    if (object->Init(g_ptrSystem->Devices()))
+    auto object = make_shared_effect<SpectrumAnalyzerEffect>("Spectrum Clr", 24, CRGBPalette16(color, color2), true);
+    if (object->EnsureResident(g_ptrSystem->Devices()))
         return object;
     throw std::runtime_error("Could not initialize new spectrum analyzer, one color version!");
 }
@@ -318,21 +622,45 @@ std::shared_ptr<LEDStripEffect> GetSpectrumAnalyzer(CRGB color)
 
 bool EffectManager::Init()
 {
-    for (int i = 0; i < _vEffects.size(); i++)
-    {
-        debugV("About to init effect %s", _vEffects[i]->FriendlyName().c_str());
-        if (false == _vEffects[i]->Init(_gfx))
+    #if ENABLE_LAZY_EFFECTS
+        // The others stay as their settings until they're about to be scheduled, so only the first one comes in now
+        if (false == GetCurrentEffect().EnsureResident(_gfx))
         {
-            debugW("Could not initialize effect: %s\n", _vEffects[i]->FriendlyName().c_str());
+            debugW("Could not initialize effect: %s\n", GetCurrentEffectName().c_str());
             return false;
         }
-        debugV("Loaded Effect: %s", _vEffects[i]->FriendlyName().c_str());
-    }
+    #else
+        for (int i = 0; i < _vEffects.size(); i++)
+        {
+            debugV("About to init effect %s", _vEffects[i]->FriendlyName().c_str());
+            if (false == _vEffects[i]->EnsureResident(_gfx))
+            {
+                debugW("Could not initialize effect: %s\n", _vEffects[i]->FriendlyName().c_str());
+                return false;
+            }
+            debugV("Loaded Effect: %s", _vEffects[i]->FriendlyName().c_str());
+        }
+    #endif
     debugV("First Effect: %s", GetCurrentEffectName().c_str());
 
     if (g_ptrSystem->DeviceConfig().ApplyGlobalColors())
         ApplyGlobalPaletteColors();
 
+    #if ENABLE_RENDER_ZONES
+        // Zones that can't be set up stay loaded, so they're still saved with the config rather than lost
+
+        std::vector<RenderZone> failedZones;
+        for (auto & zone : _loadedZones)
+        {
+            if (!_zones.Add(zone, _gfx))
+            {
+                debugW("Could not set up a render zone on channels 0x%x", zone.ChannelMask);
+                failedZones.push_back(std::move(zone));
+            }
+        }
+        _loadedZones = std::move(failedZones);
+    #endif
+
     return true;
 }
 
@@ -0,0 +1,326 @@
+//+--------------------------------------------------------------------------
+//
+// File:        effectreplay.cpp
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+//
+// Description:
+//
+//    The effect replay harness.  Requests come in from the web server
+//    and are run on the drawing thread, one effect per frame.
+//
+//---------------------------------------------------------------------------
+
+#include "globals.h"
+
+#if ENABLE_EFFECT_REPLAY
+
+#include <mutex>
+#include "effectreplay.h"
+#include "rendertarget.h"
+#include "systemcontainer.h"
+
+extern "C"
+{
+    #include "uzlib/src/uzlib.h"
+}
+
+// The request, the report and the recording are shared with the web server, so they all go through the mutex
+
+static std::mutex l_ReplayMutex;
+
+static ReplayReport l_ReplayReport;
+static std::vector<size_t> l_ReplayQueue;               // Effects still to replay for the pending report
+
+static std::vector<PeakData, psram_allocator<PeakData>> l_RecordedPeaks;
+static uint l_cPeaksToRecord = 0;
+
+bool QueueEffectReplay(std::optional<size_t> effectIndex, uint frames, uint32_t seed)
+{
+    std::lock_guard<std::mutex> guard(l_ReplayMutex);
+
+    if (l_ReplayReport.Pending)
+        return false;
+
+    auto effectCount = g_ptrSystem->EffectManager().EffectCount();
+    if (effectIndex && *effectIndex >= effectCount)
+        return false;
+
+    l_ReplayReport = ReplayReport();
+    l_ReplayReport.Pending       = true;
+    l_ReplayReport.Frames        = std::clamp<uint>(frames, 1, REPLAY_MAX_FRAMES);
+    l_ReplayReport.Seed          = seed;
+    l_ReplayReport.RecordedAudio = !l_RecordedPeaks.empty() && l_cPeaksToRecord == 0;
+
+    l_ReplayQueue.clear();
+    if (effectIndex)
+        l_ReplayQueue.push_back(*effectIndex);
+    else
+        for (size_t i = effectCount; i > 0; i--)        // Back to front, so we can pop them off in order
+            l_ReplayQueue.push_back(i - 1);
+
+    return true;
+}
+
+bool QueueReplayAudioRecording(uint frames)
+{
+    #if ENABLE_AUDIO
+        std::lock_guard<std::mutex> guard(l_ReplayMutex);
+
+        if (l_ReplayReport.Pending)
+            return false;
+
+        l_RecordedPeaks.clear();
+        l_RecordedPeaks.reserve(std::min<uint>(frames, REPLAY_MAX_FRAMES));
+        l_cPeaksToRecord = std::min<uint>(frames, REPLAY_MAX_FRAMES);
+        return true;
+    #else
+        return false;
+    #endif
+}
+
+ReplayReport GetEffectReplayReport()
+{
+    std::lock_guard<std::mutex> guard(l_ReplayMutex);
+    return l_ReplayReport;
+}
+
+#if ENABLE_AUDIO
+
+// ReplayAudio
+//
+// Builds the audio an effect sees on each frame of a replay: the recording when there is one, and otherwise a
+// steady 120 bpm track with a kick in the low bands, a snare in the mids on the off beat and hats up top.
+
+class ReplayAudio
+{
+    AudioSnapshot _snapshot;
+    bool _bRecorded;
+
+    static PeakData TrackPeaks(double t)
+    {
+        constexpr double kBeatsPerSecond = 2.0;
+
+        double beat  = t * kBeatsPerSecond;
+        double phase = beat - floor(beat);
+        bool   bBack = ((long) beat) & 1;
+
+        double kick  = exp(-phase * 8.0);
+        double snare = bBack ? exp(-phase * 5.0) : 0.0;
+        double hat   = exp(-fmod(phase * 2.0, 1.0) * 12.0) * 0.6;
+
+        double levels[NUM_BANDS];
+        for (int i = 0; i < NUM_BANDS; i++)
+        {
+            double pos = (double) i / std::max(1, NUM_BANDS - 1);
+            levels[i]  = kick * std::max(0.0, 1.0 - pos * 4.0)
+                       + snare * std::max(0.0, 1.0 - fabs(pos - 0.45) * 4.0)
+                       + hat * std::max(0.0, pos * 3.0 - 2.0)
+                       + 0.05;
+            levels[i]  = std::min(1.0, levels[i]);
+        }
+        return PeakData(levels);
+    }
+
+  public:
+
+    explicit ReplayAudio(bool bRecorded) : _bRecorded(bRecorded)
+    {
+    }
+
+    const AudioSnapshot & Frame(uint frame, double dt)
+    {
+        auto peaks = _bRecorded ? l_RecordedPeaks[frame % l_RecordedPeaks.size()] : TrackPeaks(frame * dt);
+        auto msNow = (unsigned long)(frame * dt * MILLIS_PER_SECOND);
+
+        float sum = 0.0f;
+        for (int i = 0; i < NUM_BANDS; i++)
+        {
+            sum += peaks[i];
+
+            _snapshot.Peak1Decay[i] = std::max(0.0f, _snapshot.Peak1Decay[i] - (float)(1.25 * dt));
+            _snapshot.Peak2Decay[i] = std::max(0.0f, _snapshot.Peak2Decay[i] - (float)(1.25 * dt));
+            if (peaks[i] > _snapshot.Peak1Decay[i])
+            {
+                _snapshot.Peak1Decay[i]    = peaks[i];
+                _snapshot.LastPeak1Time[i] = msNow;
+            }
+            _snapshot.Peak2Decay[i] = std::max(_snapshot.Peak2Decay[i], peaks[i]);
+        }
+
+        // A beat whenever the low band jumps, which on the built in track is every kick
+
+        if (peaks[0] > 0.8f && _snapshot.Peaks[0] <= 0.8f)
+        {
+            auto & beat = _snapshot.Beats[_snapshot.BeatCount++ % AudioSnapshot::kBeatHistory];
+            beat.Timestamp = msNow;
+            beat.Strength  = peaks[0];
+            beat.Major     = true;
+        }
+
+        _snapshot.Peaks       = peaks;
+        _snapshot.VU          = sum / NUM_BANDS;
+        _snapshot.PeakVU      = std::max(_snapshot.PeakVU * 0.99f, _snapshot.VU);
+        _snapshot.MinVU       = 0.0f;
+        _snapshot.VURatio     = _snapshot.PeakVU > 0.0f ? _snapshot.VU / _snapshot.PeakVU : 0.0f;
+        _snapshot.VURatioFade = (_snapshot.VURatioFade * 4 + _snapshot.VURatio) / 5;
+        return _snapshot;
+    }
+};
+
+#endif
+
+// ReplayEffect
+//
+// Renders frames of a fresh copy of the effect into an off-screen target, starting from the seed and time zero.
+// Returns false if the effect couldn't be copied or brought in.
+
+static bool ReplayEffect(size_t index, uint frames, uint32_t seed, [[maybe_unused]] bool bRecordedAudio, bool bKeepFrames, ReplayResult & result)
+{
+    auto& effectManager = g_ptrSystem->EffectManager();
+    auto& devices = g_ptrSystem->Devices();
+
+    RenderTarget target;
+    auto effect = effectManager.CopyEffect(index);
+
+    if (!target.Allocate(devices) || !effect || !effect->EnsurePrepared(devices))
+        return false;
+
+    const double fps = std::max<size_t>(1, effect->DesiredFramesPerSecond());
+    const double dt  = 1.0 / fps;
+
+    randomSeed(seed);
+    random16_set_seed(seed);
+    effect->SeedRandom(seed);
+    g_Values.AppTime.SetFixedStep(dt);
+
+    #if ENABLE_AUDIO
+        ReplayAudio audio(bRecordedAudio);
+    #endif
+
+    result.EffectIndex = index;
+    result.Name        = effect->FriendlyName();
+    result.SequenceCRC = 0xffffffff;
+    result.MinCycles   = std::numeric_limits<uint32_t>::max();
+    if (bKeepFrames)
+        result.Frames.reserve(frames);
+
+    {
+        RenderTargetScope scope(devices, target);
+        effect->Start();
+
+        double stepsDue = 0.0;
+
+        for (uint frame = 0; frame < frames; frame++)
+        {
+            #if ENABLE_AUDIO
+                g_Analyzer.SetReplaySnapshot(&audio.Frame(frame, dt));
+            #endif
+            g_Values.AppTime.NewFrame();
+
+            uint32_t start = ESP.getCycleCount();
+
+            // Steps come due at the effect's own rate against the fixed frame time, rather than against micros()
+
+            stepsDue += effect->StepsPerSecond() * dt;
+            for (; stepsDue >= 1.0; stepsDue -= 1.0)
+                effect->Step(1.0f / effect->StepsPerSecond());
+            effect->Draw();
+
+            uint32_t cycles = ESP.getCycleCount() - start;
+
+            uint32_t crc = 0xffffffff;
+            for (size_t i = 0; i < target.ChannelCount(); i++)
+                crc = uzlib_crc32(target.Frame(i), target.FrameSize(i) * sizeof(CRGB), crc);
+
+            result.SequenceCRC  = uzlib_crc32(&crc, sizeof(crc), result.SequenceCRC);
+            result.MinCycles    = std::min(result.MinCycles, cycles);
+            result.MaxCycles    = std::max(result.MaxCycles, cycles);
+            result.TotalCycles += cycles;
+            if (bKeepFrames)
+                result.Frames.push_back({ crc, cycles });
+
+            vTaskDelay(1);                              // Let the lower priority tasks in; the timing above doesn't include it
+        }
+    }
+
+    #if ENABLE_AUDIO
+        g_Analyzer.SetReplaySnapshot(nullptr);
+    #endif
+    g_Values.AppTime.SetFixedStep(0.0);
+    randomSeed(esp_random());                           // So the live effects don't all get the same sequence after this
+    random16_set_seed(esp_random());
+
+    return true;
+}
+
+void RunPendingEffectReplay()
+{
+    size_t index;
+    uint frames;
+    uint32_t seed;
+    bool bRecordedAudio, bKeepFrames;
+
+    {
+        std::lock_guard<std::mutex> guard(l_ReplayMutex);
+
+        #if ENABLE_AUDIO
+            if (l_cPeaksToRecord > 0)
+            {
+                l_RecordedPeaks.push_back(g_Analyzer.GetPeakData());
+                l_cPeaksToRecord--;
+            }
+        #endif
+
+        if (!l_ReplayReport.Pending)
+            return;
+
+        if (l_ReplayQueue.empty())
+        {
+            l_ReplayReport.Pending = false;
+            return;
+        }
+
+        index          = l_ReplayQueue.back();
+        frames         = l_ReplayReport.Frames;
+        seed           = l_ReplayReport.Seed;
+        bRecordedAudio = l_ReplayReport.RecordedAudio;
+        bKeepFrames    = l_ReplayReport.Results.empty() && l_ReplayQueue.size() == 1;
+        l_ReplayQueue.pop_back();
+    }
+
+    // Each effect runs twice from the same start, and only counts as deterministic if both runs drew the same
+
+    ReplayResult result, rerun;
+    if (!ReplayEffect(index, frames, seed, bRecordedAudio, bKeepFrames, result)
+        || !ReplayEffect(index, frames, seed, bRecordedAudio, false, rerun))
+    {
+        debugW("Could not replay effect %zu", index);
+        return;
+    }
+
+    result.Deterministic = result.SequenceCRC == rerun.SequenceCRC;
+    debugI("Replayed %s: %u frames, %llu cycles, CRC %08lx%s", result.Name.c_str(), frames, (unsigned long long) result.TotalCycles,
+           (unsigned long) result.SequenceCRC, result.Deterministic ? "" : " (not deterministic)");
+
+    std::lock_guard<std::mutex> guard(l_ReplayMutex);
+    l_ReplayReport.Results.push_back(std::move(result));
+}
+
+#endif
@@ -120,38 +120,46 @@
 #endif
 
 // Effect factories for the StarryNightEffect - one per star type
-std::map<int, JSONEffectFactory> g_JsonStarryNightEffectFactories =
+static constexpr EffectFactories::NumberedJSONFactory l_JsonStarryNightEffectFactories[] =
 {
     { EFFECT_STAR,
-        [](const JsonObjectConst& jsonObject)->std::shared_ptr<LEDStripEffect> { return make_shared_psram<StarryNightEffect<Star>>(jsonObject); } },
+        [](const JsonObjectConst& jsonObject)->std::shared_ptr<LEDStripEffect> { return make_shared_effect<StarryNightEffect<Star>>(jsonObject); } },
     { EFFECT_STAR_BUBBLY,
-        [](const JsonObjectConst& jsonObject)->std::shared_ptr<LEDStripEffect> { return make_shared_psram<StarryNightEffect<BubblyStar>>(jsonObject); } },
+        [](const JsonObjectConst& jsonObject)->std::shared_ptr<LEDStripEffect> { return make_shared_effect<StarryNightEffect<BubblyStar>>(jsonObject); } },
     { EFFECT_STAR_HOT_WHITE,
-        [](const JsonObjectConst& jsonObject)->std::shared_ptr<LEDStripEffect>  { return make_shared_psram<StarryNightEffect<HotWhiteStar>>(jsonObject); } },
+        [](const JsonObjectConst& jsonObject)->std::shared_ptr<LEDStripEffect>  { return make_shared_effect<StarryNightEffect<HotWhiteStar>>(jsonObject); } },
     { EFFECT_STAR_LONG_LIFE_SPARKLE,
-        [](const JsonObjectConst& jsonObject)->std::shared_ptr<LEDStripEffect>  { return make_shared_psram<StarryNightEffect<LongLifeSparkleStar>>(jsonObject); } },
+        [](const JsonObjectConst& jsonObject)->std::shared_ptr<LEDStripEffect>  { return make_shared_effect<StarryNightEffect<LongLifeSparkleStar>>(jsonObject); } },
 
 #if ENABLE_AUDIO
     { EFFECT_STAR_MUSIC,
-        [](const JsonObjectConst& jsonObject)->std::shared_ptr<LEDStripEffect>  { return make_shared_psram<StarryNightEffect<MusicStar>>(jsonObject); } },
+        [](const JsonObjectConst& jsonObject)->std::shared_ptr<LEDStripEffect>  { return make_shared_effect<StarryNightEffect<MusicStar>>(jsonObject); } },
 #endif
 
     { EFFECT_STAR_QUIET,
-        [](const JsonObjectConst& jsonObject)->std::shared_ptr<LEDStripEffect>  { return make_shared_psram<StarryNightEffect<QuietStar>>(jsonObject); } },
+        [](const JsonObjectConst& jsonObject)->std::shared_ptr<LEDStripEffect>  { return make_shared_effect<StarryNightEffect<QuietStar>>(jsonObject); } },
 };
 
-// Default and JSON factory functions + decoration for effects
-DRAM_ATTR std::unique_ptr<EffectFactories> g_ptrEffectFactories = nullptr;
-
-// This function sets up the effect factories for the effects for whatever project is being built. The ADD_EFFECT macro variations
-//   are provided and used for convenience.
-void LoadEffectFactories()
+// Helper function to create a StarryNightEffect from JSON.
+//   It picks the actual effect factory from l_JsonStarryNightEffectFactories based on the star type number in the JSON blob.
+std::shared_ptr<LEDStripEffect> CreateStarryNightEffectFromJSON(const JsonObjectConst& jsonObject)
 {
-    // Check if the factories have already been loaded
-    if (g_ptrEffectFactories)
-        return;
+    int starType = jsonObject[PTY_STARTYPENR];
 
-    g_ptrEffectFactories = make_unique_psram<EffectFactories>();
+    for (auto& entry : l_JsonStarryNightEffectFactories)
+        if (entry.EffectNumber == starType)
+            return entry.Factory(jsonObject);
+
+    return nullptr;
+}
+
+// This function holds the effects for whatever project is being built. The ADD_EFFECT macro variations are provided and used
+//   for convenience. It's only ever run by the compiler, once with a Counter to count the effects and once more with a Table
+//   of that size to fill in, so the factory tables end up as constants in flash and boot does no work to set them up.
+template <typename TFactories>
+constexpr TFactories BuildEffectFactories()
+{
+    TFactories factories;
 
     // The EFFECT_SET_VERSION macro defines the "effect set version" for a project. This version
     // is persisted to JSON with the effect objects, and compared to it when the effects JSON file
@@ -490,12 +498,19 @@ void LoadEffectFactories()
         #define EFFECT_SET_VERSION  1
     #endif
 
-    // If this assert fires, you have not defined any effects in the table above.  If adding a new config, you need to
-    // add the list of effects in this table as shown for the various other existing configs.  You MUST have at least
-    // one effect even if it's the Status effect.
-    assert(!g_ptrEffectFactories->IsEmpty());
+    return factories;
 }
 
+// If this assert fires, you have not defined any effects in the table above.  If adding a new config, you need to
+// add the list of effects in this table as shown for the various other existing configs.  You MUST have at least
+// one effect even if it's the Status effect.
+static constexpr size_t l_cEffectFactories = BuildEffectFactories<EffectFactories::Counter>().DefaultCount;
+static_assert(l_cEffectFactories > 0, "No effects are defined for this project");
+
+// Default and JSON factory functions + decoration for effects
+static constexpr auto l_EffectFactoryTable = BuildEffectFactories<EffectFactories::Table<l_cEffectFactories>>();
+const EffectFactories g_EffectFactories(l_EffectFactoryTable);
+
 extern DRAM_ATTR size_t g_EffectsManagerJSONBufferSize;
 
 // Load the effects JSON file and check if it's appropriate to use
@@ -534,7 +549,7 @@ void EffectManager::LoadDefaultEffects()
 {
     _effectSetVersion = EFFECT_SET_VERSION;
 
-    for (const auto &numberedFactory : g_ptrEffectFactories->GetDefaultFactories())
+    for (const auto &numberedFactory : g_EffectFactories.GetDefaultFactories())
         ProduceAndLoadDefaultEffect(numberedFactory);
 
     SetInterval(DEFAULT_EFFECT_INTERVAL, true);
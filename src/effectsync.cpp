@@ -0,0 +1,413 @@
+//+--------------------------------------------------------------------------
+//
+// File:        effectsync.cpp
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+//
+// Description:
+//
+//    The leader and follower sides of effect sync; see effectsync.h
+//
+//---------------------------------------------------------------------------
+
+#include "globals.h"
+
+#if ENABLE_EFFECT_SYNC
+
+#include <stddef.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include "effectsync.h"
+#include "clocksync.h"
+#include "network.h"
+#include "systemcontainer.h"
+#include "soundanalyzer.h"
+
+void EffectSync::release()
+{
+    if (_fd >= 0)
+    {
+        close(_fd);
+        _fd = -1;
+    }
+    if (_fdClock >= 0)
+    {
+        close(_fdClock);
+        _fdClock = -1;
+    }
+}
+
+bool EffectSync::begin()
+{
+    if ((_fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+    {
+        debugW("Unable to create effect sync socket");
+        return false;
+    }
+
+    int opt = 1;
+    setsockopt(_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    struct sockaddr_in address = {};
+    address.sin_family      = AF_INET;
+    address.sin_addr.s_addr = INADDR_ANY;
+
+    #if EFFECT_SYNC_LEADER
+
+        _group.sin_family      = AF_INET;
+        _group.sin_addr.s_addr = inet_addr(EFFECT_SYNC_GROUP);
+        _group.sin_port        = htons(NetworkPort::EffectSync);
+
+        // The followers sync their clocks to ours, so we answer them on the clock sync port
+
+        if ((_fdClock = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+        {
+            debugW("Unable to create clock sync socket");
+            release();
+            return false;
+        }
+        setsockopt(_fdClock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+        address.sin_port = htons(NetworkPort::ClockSync);
+        if (bind(_fdClock, (struct sockaddr *)&address, sizeof(address)) < 0)
+        {
+            debugW("Unable to bind the clock sync port");
+            release();
+            return false;
+        }
+
+        debugI("Sending effect state to multicast group %s", EFFECT_SYNC_GROUP);
+
+    #else
+
+        // Time out once a second so the loop notices when WiFi has gone away
+
+        struct timeval to;
+        to.tv_sec  = 1;
+        to.tv_usec = 0;
+        setsockopt(_fd, SOL_SOCKET, SO_RCVTIMEO, &to, sizeof(to));
+
+        address.sin_port = htons(NetworkPort::EffectSync);
+        if (bind(_fd, (struct sockaddr *)&address, sizeof(address)) < 0)
+        {
+            debugW("Unable to bind the effect sync port");
+            release();
+            return false;
+        }
+
+        struct ip_mreq mreq;
+        mreq.imr_multiaddr.s_addr = inet_addr(EFFECT_SYNC_GROUP);
+        mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+        if (setsockopt(_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0)
+        {
+            debugW("Unable to join multicast group %s", EFFECT_SYNC_GROUP);
+            release();
+            return false;
+        }
+
+        debugI("Joined multicast group %s for effect state", EFFECT_SYNC_GROUP);
+
+    #endif
+
+    return true;
+}
+
+// EffectSync::BuildState
+//
+// The leader's effect, as the drawing thread last started it, and the audio it's drawing to
+
+size_t EffectSync::BuildState(EffectSyncPacket & packet)
+{
+    auto & effectManager = g_ptrSystem->EffectManager();
+
+    packet = {};
+    packet.Magic        = EFFECT_SYNC_HEADER;
+    packet.Version      = EFFECT_SYNC_VERSION;
+    packet.EffectIndex  = effectManager.GetCurrentEffectIndex();
+    packet.Sequence     = _sequence++;
+    packet.Seed         = effectManager.GetEffectSeed();
+    packet.StartMicros  = effectManager.GetEffectStartMicros();
+    packet.PaletteIndex = effectManager.g()->PaletteIndex();
+
+    size_t cbPacket = offsetof(EffectSyncPacket, Peaks);
+
+    #if ENABLE_AUDIO
+        auto peaks = g_Analyzer.GetPeakData();
+        packet.BandCount = NUM_BANDS;
+        memcpy((uint8_t *) &packet + cbPacket, peaks._Level, sizeof(peaks._Level));
+        cbPacket = sizeof(packet);
+    #endif
+
+    return cbPacket;
+}
+
+void EffectSync::SendState()
+{
+    EffectSyncPacket packet;
+    size_t cbPacket = BuildState(packet);
+
+    if (sendto(_fd, &packet, cbPacket, 0, (struct sockaddr *)&_group, sizeof(_group)) < 0)
+        debugV("Error %d sending effect state", errno);
+    else
+        _cSent++;
+
+    _sentStartMicros = packet.StartMicros;
+}
+
+// EffectSync::AnswerClockSync
+//
+// Stamps a follower's clock sync request with when we got it and when we answered, on the clock our start times are on
+
+void EffectSync::AnswerClockSync()
+{
+    ClockSyncPacket request;
+    struct sockaddr_in from;
+    socklen_t cbFrom = sizeof(from);
+
+    ssize_t cb = recvfrom(_fdClock, &request, sizeof(request), MSG_DONTWAIT, (struct sockaddr *)&from, &cbFrom);
+    int64_t t2 = SyncedMicros();
+
+    if (cb != sizeof(request) || ntohl(request.magic) != CLOCK_SYNC_HEADER)
+        return;
+
+    request.t2 = ClockSyncByteOrder(t2);
+    request.t3 = ClockSyncByteOrder(SyncedMicros());
+    sendto(_fdClock, &request, sizeof(request), 0, (struct sockaddr *)&from, cbFrom);
+}
+
+// EffectSync::ReceiveState
+//
+// Takes in one state packet, or times out.  Returns false if the socket has failed.
+
+bool EffectSync::ReceiveState()
+{
+    EffectSyncPacket packet;
+    struct sockaddr_in from;
+    socklen_t cbFrom = sizeof(from);
+
+    ssize_t cb = recvfrom(_fd, &packet, sizeof(packet), 0, (struct sockaddr *)&from, &cbFrom);
+    if (cb < 0)
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+
+    #if ENABLE_CLOCK_SYNC
+        if (TakeState(packet, cb))
+            g_ClockSync.SetReference(from.sin_addr.s_addr);     // The leader's start times are on its clock
+    #else
+        TakeState(packet, cb);
+    #endif
+
+    return true;
+}
+
+// EffectSync::TakeState
+//
+// Leaves the packet for the drawing thread
+
+bool EffectSync::TakeState(const EffectSyncPacket & packet, size_t cbPacket)
+{
+    if (cbPacket < offsetof(EffectSyncPacket, Peaks) || packet.Magic != EFFECT_SYNC_HEADER || packet.Version != EFFECT_SYNC_VERSION)
+        return false;
+
+    std::lock_guard<std::mutex> guard(_mutex);
+    _latest = {};
+    memcpy(&_latest, &packet, std::min(cbPacket, sizeof(_latest)));
+
+    // Peaks that didn't all arrive, or that are for a different number of bands, are left out
+
+    if (_latest.BandCount != NUM_BANDS || cbPacket < sizeof(_latest))
+        _latest.BandCount = 0;
+
+    _bHeard      = true;
+    _msLastHeard = std::max(1UL, millis());
+    _cReceived++;
+    return true;
+}
+
+void EffectSync::SyncLoop()
+{
+    #if EFFECT_SYNC_LEADER
+        unsigned long msLastSent = millis() - EFFECT_SYNC_INTERVAL;
+    #endif
+
+    while (IsWiFiConnected())
+    {
+        #if EFFECT_SYNC_LEADER
+
+            unsigned long msSinceSent = millis() - msLastSent;
+            if (msSinceSent >= EFFECT_SYNC_INTERVAL)
+            {
+                SendState();
+                msLastSent += std::max<unsigned long>(EFFECT_SYNC_INTERVAL, msSinceSent - msSinceSent % EFFECT_SYNC_INTERVAL);
+                continue;
+            }
+
+            // A new effect goes out as soon as it starts, so the followers aren't left up to an interval behind
+
+            if (g_ptrSystem->EffectManager().GetEffectStartMicros() != _sentStartMicros)
+            {
+                SendState();
+                continue;
+            }
+
+            // Clock sync requests are answered as soon as they come in, between the state packets
+
+            fd_set readSet;
+            FD_ZERO(&readSet);
+            FD_SET(_fdClock, &readSet);
+
+            struct timeval to;
+            to.tv_sec  = 0;
+            to.tv_usec = std::min<unsigned long>(EFFECT_SYNC_INTERVAL - msSinceSent, EFFECT_SYNC_CHANGE_POLL) * 1000;
+
+            int ready = select(_fdClock + 1, &readSet, nullptr, nullptr, &to);
+            if (ready < 0)
+            {
+                debugW("Effect sync select failed with error %d", errno);
+                return;
+            }
+            if (ready > 0)
+                AnswerClockSync();
+
+        #else
+
+            if (!ReceiveState())
+            {
+                debugW("Effect sync receive failed with error %d", errno);
+                return;
+            }
+
+        #endif
+    }
+}
+
+// EffectSync::StartPending
+//
+// Starts the effect the leader started, and the palette it's on, now that its start time has come
+
+void EffectSync::StartPending()
+{
+    auto & effectManager = g_ptrSystem->EffectManager();
+
+    _bPending = false;
+
+    if (_pending.EffectIndex >= effectManager.EffectCount())
+    {
+        debugW("The effect sync leader is on effect %u, but we only have %zu", _pending.EffectIndex, effectManager.EffectCount());
+        return;
+    }
+
+    effectManager.FollowEffect(_pending.EffectIndex, _pending.Seed, _pending.StartMicros);
+    _cStarted++;
+
+    if (_pending.PaletteIndex >= 0)
+    {
+        effectManager.g()->loadPalette(_pending.PaletteIndex);
+        _startedPalette = _pending.PaletteIndex;
+    }
+}
+
+// EffectSync::ApplyToFrame
+//
+// Runs on the drawing thread, so effects are only ever started there
+
+void EffectSync::ApplyToFrame()
+{
+    #if !EFFECT_SYNC_LEADER
+
+        auto & effectManager = g_ptrSystem->EffectManager();
+
+        EffectSyncPacket state;
+        bool bHeard;
+        unsigned long msLastHeard;
+        {
+            std::lock_guard<std::mutex> guard(_mutex);
+            state       = _latest;
+            bHeard      = _bHeard;
+            msLastHeard = _msLastHeard;
+            _bHeard     = false;
+        }
+
+        bool bFollowing = msLastHeard != 0 && millis() - msLastHeard < EFFECT_SYNC_TIMEOUT;
+        if (bFollowing != effectManager.IsFollowing())
+        {
+            debugI(bFollowing ? "Following the effect sync leader" : "Lost the effect sync leader, picking our own effects again");
+            effectManager.SetFollowing(bFollowing);
+
+            if (!bFollowing)
+            {
+                g_Values.AppTime.SetClockOffset(0.0);
+                _startedSeed = 0;
+                _startedMicros = 0;
+                _startedPalette = -1;
+                _bPending = false;
+            }
+        }
+
+        if (!bFollowing)
+            return;
+
+        // The app time follows the leader's clock, as far as clock sync has it, so the effects see the leader's times
+
+        g_Values.AppTime.SetClockOffset(SyncedTime() - CAppTime::CurrentTime());
+
+        if (bHeard && (state.Seed != _startedSeed || state.StartMicros != _startedMicros))
+        {
+            _pending  = state;
+            _bPending = true;
+
+            _startedSeed = state.Seed;
+            _startedMicros = state.StartMicros;
+        }
+
+        // The effect starts on the first frame at or past the leader's start time, which is normally already gone by
+        // the time the packet's here.  One more than EFFECT_SYNC_TIMEOUT ahead can only be a clock that isn't synced
+        // yet, so that's started right away rather than waited for.
+
+        if (_bPending)
+        {
+            int64_t usUntilStart = (int64_t) _pending.StartMicros - SyncedMicros();
+            if (usUntilStart <= 0 || usUntilStart > EFFECT_SYNC_TIMEOUT * 1000LL)
+                StartPending();
+        }
+
+        if (!bHeard)
+            return;
+
+        // The palette is only set when it changes on the leader, so an effect that picks its own still can.  One
+        // that comes in while an effect is waiting to start is left for the start.
+
+        if (!_bPending && state.PaletteIndex >= 0 && state.PaletteIndex != _startedPalette)
+        {
+            effectManager.g()->loadPalette(state.PaletteIndex);
+            _startedPalette = state.PaletteIndex;
+        }
+
+        #if ENABLE_AUDIO
+            if (state.BandCount == NUM_BANDS)
+            {
+                auto peaks = PeakData::FromWire((const uint8_t *) &state + offsetof(EffectSyncPacket, Peaks));
+                peaks.ApplyScalars(PeakData::PCREMOTE);
+                g_Analyzer.SetPeakData(peaks);
+            }
+        #endif
+
+    #endif
+}
+
+#endif
@@ -0,0 +1,492 @@
+//+--------------------------------------------------------------------------
+//
+// File:        espnowlink.cpp
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+//
+// Description:
+//
+//    The ESP-NOW link declared in espnowlink.h
+//
+//---------------------------------------------------------------------------
+
+#include "globals.h"
+
+#if ENABLE_ESPNOW
+
+#include <sys/time.h>
+#include <esp_wifi.h>
+#include "espnowlink.h"
+#include "clocksync.h"
+#include "deflate.h"
+#include "socketserver.h"
+#include "systemcontainer.h"
+#include "soundanalyzer.h"
+
+static const uint8_t kBroadcast[ESP_NOW_ETH_ALEN] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+
+static constexpr int kSendAttempts = 20;                // Ms a fragment waits for the radio to have room for it
+static constexpr int kPollMs       = 5;                 // Longest the link task waits for a fragment before it sends
+
+// The clock ClockSync keeps its samples on
+
+static int64_t ClockMicros()
+{
+    timeval tv;
+    gettimeofday(&tv, nullptr);
+    return (int64_t) tv.tv_sec * MICROS_PER_SECOND + tv.tv_usec;
+}
+
+ESPNowLink::ESPNowLink()
+{
+    _pMessage.reset(PlacedAlloc<uint8_t>(ESPNOW_MAX_MESSAGE, Placement::Cold, "espnow message"));
+    _pSingle.reset(PlacedAlloc<uint8_t>(ESP_NOW_MAX_DATA_LEN, Placement::Hot, "espnow single"));
+    _pExpanded.reset(PlacedAlloc<uint8_t>(MAXIMUM_PACKET_SIZE+1, Placement::Hot, "espnow expanded"));      // +1 for uzlib one byte overreach bug
+
+    #if ESPNOW_SEND_FRAMES
+        _pDeflater = std::make_unique<Deflater>();
+        _pFrame.reset(PlacedAlloc<uint8_t>(MAXIMUM_PACKET_SIZE, Placement::Cold, "espnow frame"));
+        _pLastSent.reset(PlacedAlloc<CRGB>(NUM_LEDS, Placement::Cold, "espnow last frame"));
+    #endif
+}
+
+ESPNowLink::~ESPNowLink()
+{
+    esp_now_deinit();
+    if (_queue)
+        vQueueDelete(_queue);
+}
+
+bool ESPNowLink::begin()
+{
+    #if ESPNOW_SEND_FRAMES
+        if (!_pFrame || !_pLastSent)
+        {
+            debugE("No room for the ESP-NOW frame buffers");
+            return false;
+        }
+    #endif
+
+    if (!_pMessage || !_pSingle || !_pExpanded)
+    {
+        debugE("No room for the ESP-NOW buffers");
+        return false;
+    }
+
+    if (!_queue && !(_queue = xQueueCreate(ESPNOW_QUEUE_DEPTH, sizeof(Fragment))))
+    {
+        debugE("No room for the ESP-NOW queue");
+        return false;
+    }
+
+    // ESP-NOW only needs the radio running, not connected to anything
+
+    if (WiFi.getMode() == WIFI_OFF)
+        WiFi.mode(WIFI_STA);
+
+    if (!WiFi.isConnected())
+        esp_wifi_set_channel(ESPNOW_CHANNEL, WIFI_SECOND_CHAN_NONE);
+
+    esp_err_t err = esp_now_init();
+    if (err != ESP_OK)
+    {
+        debugW("Unable to start ESP-NOW: %s", esp_err_to_name(err));
+        return false;
+    }
+
+    esp_now_register_recv_cb(OnReceive);
+
+    if (!esp_now_is_peer_exist(kBroadcast))
+    {
+        esp_now_peer_info_t peer = {};
+        memcpy(peer.peer_addr, kBroadcast, sizeof(kBroadcast));
+        peer.channel = 0;                                   // Whichever channel the radio is on
+        peer.ifidx   = WIFI_IF_STA;
+        peer.encrypt = false;
+
+        if ((err = esp_now_add_peer(&peer)) != ESP_OK)
+        {
+            debugW("Unable to add the ESP-NOW broadcast peer: %s", esp_err_to_name(err));
+            return false;
+        }
+    }
+
+    debugI("ESP-NOW link up on channel %d", (int) WiFi.channel());
+    return true;
+}
+
+// ESPNowLink::OnReceive
+//
+// Runs on the WiFi task, so it only copies the fragment out for the link task
+
+void ESPNowLink::OnReceive(const uint8_t * pSender, const uint8_t * pData, int cbData)
+{
+    uint32_t magic;
+    if (cbData < (int) sizeof(ESPNowHeader) || cbData > ESP_NOW_MAX_DATA_LEN)
+        return;
+    memcpy(&magic, pData, sizeof(magic));
+    if (magic != ESPNOW_HEADER)
+        return;
+
+    auto & link = g_ptrSystem->ESPNowLink();
+
+    Fragment fragment;
+    memcpy(fragment.Sender, pSender, sizeof(fragment.Sender));
+    fragment.Length = cbData;
+    memcpy(fragment.Data, pData, cbData);
+    fragment.ReceivedMicros = ClockMicros();
+
+    if (xQueueSend(link._queue, &fragment, 0) != pdTRUE)
+        link._cDropped++;
+}
+
+// ESPNowLink::Receive
+//
+// Puts a fragment in its place, and dispatches the message once the last one is in
+
+void ESPNowLink::Receive(const Fragment & fragment)
+{
+    ESPNowHeader header;
+    memcpy(&header, fragment.Data, sizeof(header));
+
+    const uint8_t * pPayload = fragment.Data + sizeof(header);
+    size_t cbPayload = fragment.Length - sizeof(header);
+
+    if (header.FragmentCount == 0 || header.Fragment >= header.FragmentCount || header.Length > ESPNOW_MAX_MESSAGE)
+        return;
+
+    // Most messages fit in one fragment, and those leave alone any message being put together
+
+    if (header.FragmentCount == 1)
+    {
+        if (cbPayload < header.Length)
+            return;
+
+        memcpy(_pSingle.get(), pPayload, header.Length);
+        Dispatch(header.Kind, _pSingle, header.Length, header.SentMicros, fragment.ReceivedMicros);
+        return;
+    }
+
+    // The fragments of the others come in order, one message at a time.  Another message starting gives up on the
+    // one under way, and a gap in it drops it.
+
+    bool bSameMessage = _nextFragment != 0 && header.Message == _messageId && !memcmp(_sender, fragment.Sender, sizeof(_sender));
+
+    if (header.Fragment == 0)
+    {
+        if (_nextFragment != 0)
+            _cDropped++;
+
+        memcpy(_sender, fragment.Sender, sizeof(_sender));
+        _messageId = header.Message;
+        _cbMessage = 0;
+    }
+    else if (!bSameMessage)
+    {
+        return;
+    }
+
+    if ((header.Fragment != 0 && header.Fragment != _nextFragment) || _cbMessage + cbPayload > header.Length)
+    {
+        _nextFragment = 0;
+        _cDropped++;
+        return;
+    }
+
+    memcpy(&_pMessage[_cbMessage], pPayload, cbPayload);
+    _cbMessage    += cbPayload;
+    _nextFragment  = header.Fragment + 1;
+
+    if (_nextFragment == header.FragmentCount)
+    {
+        _nextFragment = 0;
+        if (_cbMessage == header.Length)
+            Dispatch(header.Kind, _pMessage, _cbMessage, header.SentMicros, fragment.ReceivedMicros);
+        else
+            _cDropped++;
+    }
+}
+
+// ESPNowLink::Dispatch
+//
+// Sends a whole message wherever the same thing goes when it comes in over WiFi
+
+void ESPNowLink::Dispatch(ESPNowKind kind, std::unique_ptr<uint8_t []> & pMessage, size_t cbMessage, int64_t sentMicros, int64_t receivedMicros)
+{
+    _cReceived++;
+
+    switch (kind)
+    {
+        case ESPNowKind::Packet:
+        {
+            std::unique_ptr<uint8_t []> * pPacket = &pMessage;
+
+            if (cbMessage >= COMPRESSED_HEADER_SIZE && DWORDFromMemory(&pMessage[0]) == COMPRESSED_HEADER)
+            {
+                uint32_t compressedSize = DWORDFromMemory(&pMessage[4]);
+                uint32_t expandedSize   = DWORDFromMemory(&pMessage[8]);
+
+                if (expandedSize > MAXIMUM_PACKET_SIZE || COMPRESSED_HEADER_SIZE + compressedSize > cbMessage)
+                {
+                    debugW("Bad compressed ESP-NOW packet: compressedSize %u, expandedSize %u, message %zu", compressedSize, expandedSize, cbMessage);
+                    return;
+                }
+
+                if (!SocketServer::DecompressBuffer(&pMessage[COMPRESSED_HEADER_SIZE], compressedSize, _pExpanded.get(), expandedSize))
+                    return;
+
+                pPacket   = &_pExpanded;
+                cbMessage = expandedSize;
+            }
+
+            if (cbMessage < STANDARD_DATA_HEADER_SIZE)
+                return;
+
+            ProcessIncomingData(*pPacket, cbMessage);
+            break;
+        }
+
+        case ESPNowKind::EffectState:
+        {
+            #if ENABLE_EFFECT_SYNC && !EFFECT_SYNC_LEADER
+                EffectSyncPacket packet = {};
+                memcpy(&packet, pMessage.get(), std::min(cbMessage, sizeof(packet)));
+
+                // The leader's start times are on its clock, which it stamped the fragment with as it sent it
+
+                #if ENABLE_CLOCK_SYNC
+                    if (g_ptrSystem->EffectSync().TakeState(packet, cbMessage))
+                        g_ClockSync.AddOneWay(receivedMicros, sentMicros);
+                #else
+                    g_ptrSystem->EffectSync().TakeState(packet, cbMessage);
+                #endif
+            #endif
+            break;
+        }
+
+        default:
+            debugV("Unknown ESP-NOW message kind %u", (unsigned) kind);
+            break;
+    }
+}
+
+bool ESPNowLink::Send(ESPNowKind kind, const uint8_t * pData, size_t cbData, bool bWait)
+{
+    if (cbData > ESPNOW_MAX_MESSAGE)
+        return false;
+
+    std::unique_lock<std::mutex> guard(_sendMutex, std::defer_lock);
+    if (bWait)
+        guard.lock();
+    else if (!guard.try_lock())
+        return false;
+
+    ESPNowHeader header = {};
+    header.Magic         = ESPNOW_HEADER;
+    header.Kind          = kind;
+    header.FragmentCount = std::max<size_t>(1, (cbData + kMaxPayload - 1) / kMaxPayload);
+    header.Message       = _message++;
+    header.Length        = cbData;
+
+    uint8_t abFragment[ESP_NOW_MAX_DATA_LEN];
+
+    for (size_t offset = 0; header.Fragment < header.FragmentCount; header.Fragment++, offset += kMaxPayload)
+    {
+        size_t cbPayload = std::min(kMaxPayload, cbData - offset);
+
+        header.SentMicros = SyncedMicros();
+        memcpy(abFragment, &header, sizeof(header));
+        memcpy(abFragment + sizeof(header), pData + offset, cbPayload);
+
+        // The radio only holds a few fragments at a time, so a long message waits for room now and then
+
+        esp_err_t err;
+        for (int attempt = 0; (err = esp_now_send(kBroadcast, abFragment, sizeof(header) + cbPayload)) == ESP_ERR_ESPNOW_NO_MEM && bWait && attempt < kSendAttempts; attempt++)
+            delay(1);
+
+        if (err != ESP_OK)
+        {
+            debugV("Error %s sending ESP-NOW fragment", esp_err_to_name(err));
+            return false;
+        }
+    }
+
+    _cSent++;
+    return true;
+}
+
+#if ENABLE_AUDIO
+
+void ESPNowLink::SendPeaks(const PeakData & peaks)
+{
+    uint8_t abPacket[STANDARD_DATA_HEADER_SIZE + NUM_BANDS * sizeof(float)];
+
+    timeval tv;
+    gettimeofday(&tv, nullptr);
+
+    uint16_t command16 = WIFI_COMMAND_PEAKDATA;
+    uint16_t bands16   = NUM_BANDS;
+    uint32_t length32  = NUM_BANDS * sizeof(float);
+    uint64_t seconds   = tv.tv_sec;
+    uint64_t micros    = tv.tv_usec;
+
+    memcpy(&abPacket[0],  &command16, sizeof(command16));
+    memcpy(&abPacket[2],  &bands16,   sizeof(bands16));
+    memcpy(&abPacket[4],  &length32,  sizeof(length32));
+    memcpy(&abPacket[8],  &seconds,   sizeof(seconds));
+    memcpy(&abPacket[16], &micros,    sizeof(micros));
+    memcpy(&abPacket[STANDARD_DATA_HEADER_SIZE], peaks._Level, length32);
+
+    Send(ESPNowKind::Packet, abPacket, sizeof(abPacket), false);
+}
+
+#endif
+
+#if ESPNOW_SEND_FRAMES
+
+// ESPNowLink::SendFrame
+//
+// The frame the draw loop last put out, if one's due, XORed against the one sent before it unless it's time for a
+// whole one, and compressed as the socket server takes it
+
+void ESPNowLink::SendFrame()
+{
+    auto & effectManager = g_ptrSystem->EffectManager();
+    auto   pGraphics     = effectManager.g();
+
+    uint32_t sequence = effectManager.FrameSequence();
+    if (sequence == _lastSequence || millis() - _msLastFrame < ESPNOW_FRAME_INTERVAL || !pGraphics->leds)
+        return;
+
+    _lastSequence = sequence;
+    _msLastFrame  = millis();
+
+    uint32_t length = std::min<size_t>(pGraphics->GetLEDCount(), NUM_LEDS);
+    bool bKeyframe  = _bNeedKeyframe || length != _lastLength || _cSinceKeyframe >= ESPNOW_KEYFRAME_INTERVAL;
+    _lastLength     = length;
+
+    uint8_t * pColors = &_pFrame[STANDARD_DATA_HEADER_SIZE];
+    uint8_t * pLast   = reinterpret_cast<uint8_t *>(_pLastSent.get());
+
+    memcpy(pColors, pGraphics->leds, length * LED_DATA_SIZE);
+    for (size_t i = 0; i < length * LED_DATA_SIZE; i++)
+    {
+        uint8_t color = pColors[i];
+        if (!bKeyframe)
+            pColors[i] ^= pLast[i];
+        pLast[i] = color;
+    }
+
+    // Without a timestamp the frames are shown as they come in
+
+    uint16_t command16 = bKeyframe ? WIFI_COMMAND_PIXELDATA64 : WIFI_COMMAND_PIXELDELTA64;
+    uint16_t channel16 = 1;
+    uint64_t zero      = 0;
+
+    memcpy(&_pFrame[0],  &command16, sizeof(command16));
+    memcpy(&_pFrame[2],  &channel16, sizeof(channel16));
+    memcpy(&_pFrame[4],  &length,    sizeof(length));
+    memcpy(&_pFrame[8],  &zero,      sizeof(zero));
+    memcpy(&_pFrame[16], &zero,      sizeof(zero));
+
+    // The Deflater writes raw deflate, so the zlib header and checksum DecompressBuffer wants go around it
+
+    size_t cbPacket = STANDARD_DATA_HEADER_SIZE + length * LED_DATA_SIZE;
+
+    _compressed.assign(COMPRESSED_HEADER_SIZE, 0);
+    _compressed.push_back(0x78);                        // Deflate with a 32K window, fastest
+    _compressed.push_back(0x01);
+    _pDeflater->Deflate(_pFrame.get(), cbPacket, _compressed);
+
+    uint32_t adler = uzlib_adler32(_pFrame.get(), cbPacket, 1);
+    for (int shift = 24; shift >= 0; shift -= 8)
+        _compressed.push_back((adler >> shift) & 0xFF);
+
+    uint32_t magic          = COMPRESSED_HEADER;
+    uint32_t compressedSize = _compressed.size() - COMPRESSED_HEADER_SIZE;
+    uint32_t expandedSize   = cbPacket;
+
+    memcpy(&_compressed[0], &magic,          sizeof(magic));
+    memcpy(&_compressed[4], &compressedSize, sizeof(compressedSize));
+    memcpy(&_compressed[8], &expandedSize,   sizeof(expandedSize));
+
+    // A frame that doesn't go out leaves the others without what the next delta would go against
+
+    if (_compressed.size() > ESPNOW_MAX_MESSAGE || !Send(ESPNowKind::Packet, _compressed.data(), _compressed.size()))
+    {
+        debugV("ESP-NOW frame of %zu bytes not sent", _compressed.size());
+        _bNeedKeyframe = true;
+        return;
+    }
+
+    _bNeedKeyframe  = false;
+    _cSinceKeyframe = bKeyframe ? 0 : _cSinceKeyframe + 1;
+}
+
+#endif
+
+void ESPNowLink::LinkLoop()
+{
+    #if ENABLE_EFFECT_SYNC && EFFECT_SYNC_LEADER
+        unsigned long msLastState = millis() - EFFECT_SYNC_INTERVAL;
+    #endif
+
+    for (;;)
+    {
+        Fragment fragment;
+        if (xQueueReceive(_queue, &fragment, pdMS_TO_TICKS(kPollMs)) == pdTRUE)
+            Receive(fragment);
+
+        #if ESPNOW_SEND_FRAMES
+            SendFrame();
+        #endif
+
+        #if ENABLE_EFFECT_SYNC && EFFECT_SYNC_LEADER
+            if (millis() - msLastState >= EFFECT_SYNC_INTERVAL)
+            {
+                auto & effectSync = g_ptrSystem->EffectSync();
+
+                EffectSyncPacket packet;
+                size_t cbPacket = effectSync.BuildState(packet);
+                if (Send(ESPNowKind::EffectState, reinterpret_cast<const uint8_t *>(&packet), cbPacket))
+                    effectSync._cSent++;
+                msLastState = millis();
+            }
+        #endif
+    }
+}
+
+// ESPNowTaskEntry
+//
+// Starts the link, and then runs it; the link works with or without WiFi, so it's never stopped
+
+void IRAM_ATTR ESPNowTaskEntry(void *)
+{
+    auto & link = g_ptrSystem->ESPNowLink();
+
+    while (!link.begin())
+    {
+        debugW("ESP-NOW link didn't start.  Retrying...");
+        delay(1000);
+    }
+
+    link.LinkLoop();
+}
+
+#endif
@@ -29,52 +29,56 @@
 // History:     Sep-15-2023        Rbergen     Created
 //
 //---------------------------------------------------------------------------
+#include <new>
+#include <esp_heap_caps.h>
 #include "globals.h"
 #include "gfxbase.h"
 #include "systemcontainer.h"
+#include "noisefield.h"
 
 #if USE_NOISE
     // The following functions are specializations of noise-related member function
-    // templates declared in gfxbase.h.
+    // templates declared in gfxbase.h.  The two FillGetNoise ones center the lattice a little
+    // differently, and both sample it through the shared noise field cache.
 
     template<>
     void GFXBase::FillGetNoise<NoiseApproach::One>()
     {
-        for (uint16_t i = 0; i < _width; i++)
-        {
-            uint32_t ioffset = _ptrNoise->noise_scale_x * (i - ((_height + 1) / 2));
-
-            for (uint16_t j = 0; j < _height; j++)
-            {
-                uint32_t joffset = _ptrNoise->noise_scale_y * (j - ((_height + 1) / 2));
-
-                uint16_t data = inoise16(_ptrNoise->noise_x + ioffset, _ptrNoise->noise_y + joffset, _ptrNoise->noise_z) >> 8;
+        const int32_t center = (_height + 1) / 2;
 
-                uint8_t olddata = _ptrNoise->noise[i][j];
-                uint8_t newdata = scale8(olddata, _ptrNoise->noisesmoothing) + scale8(data, 256 - _ptrNoise->noisesmoothing);
-                data = newdata;
+        NoiseLattice lattice;
+        lattice.X      = _ptrNoise->noise_x - _ptrNoise->noise_scale_x * center;
+        lattice.Y      = _ptrNoise->noise_y - _ptrNoise->noise_scale_y * center;
+        lattice.StepX  = _ptrNoise->noise_scale_x;
+        lattice.StepY  = _ptrNoise->noise_scale_y;
+        lattice.Width  = _width;
+        lattice.Height = _height;
 
-                _ptrNoise->noise[i][j] = data;
-            }
-        }
+        g_NoiseFields.Fill(lattice, _ptrNoise->noise_z, [&](uint16_t i, uint16_t j, uint16_t value)
+        {
+            uint8_t data = value >> 8;
+            uint8_t olddata = _ptrNoise->noise[i][j];
+            _ptrNoise->noise[i][j] = scale8(olddata, _ptrNoise->noisesmoothing) + scale8(data, 256 - _ptrNoise->noisesmoothing);
+        });
     }
 
     template<>
     void GFXBase::FillGetNoise<NoiseApproach::Two>()
     {
-        for (uint8_t i = 0; i < WIDTH; i++)
+        NoiseLattice lattice;
+        lattice.X      = _ptrNoise->noise_x - _ptrNoise->noise_scale_x * CENTER_X_MINOR;
+        lattice.Y      = _ptrNoise->noise_y - _ptrNoise->noise_scale_y * CENTER_Y_MINOR;
+        lattice.StepX  = _ptrNoise->noise_scale_x;
+        lattice.StepY  = _ptrNoise->noise_scale_y;
+        lattice.Width  = WIDTH;
+        lattice.Height = HEIGHT;
+
+        g_NoiseFields.Fill(lattice, _ptrNoise->noise_z, [&](uint16_t i, uint16_t j, uint16_t value)
         {
-            int32_t ioffset = _ptrNoise->noise_scale_x * (i - CENTER_X_MINOR);
-            for (uint8_t j = 0; j < HEIGHT; j++)
-            {
-                int32_t joffset = _ptrNoise->noise_scale_y * (j - CENTER_Y_MINOR);
-                int8_t data = inoise16(_ptrNoise->noise_x + ioffset, _ptrNoise->noise_y + joffset, _ptrNoise->noise_z) >> 8;
-                int8_t olddata = _ptrNoise->noise[i][j];
-                int8_t newdata = scale8(olddata, _ptrNoise->noisesmoothing) + scale8(data, 255 - _ptrNoise->noisesmoothing);
-                data = newdata;
-                _ptrNoise->noise[i][j] = data;
-            }
-        }
+            int8_t data = value >> 8;
+            int8_t olddata = _ptrNoise->noise[i][j];
+            _ptrNoise->noise[i][j] = scale8(olddata, _ptrNoise->noisesmoothing) + scale8(data, 255 - _ptrNoise->noisesmoothing);
+        });
     }
 
     template<>
@@ -269,6 +273,120 @@ GFXBase::GFXBase(int w, int h) : Adafruit_GFX(w, h),
     ResetOscillators();
 }
 
+#if ENABLE_PALETTE_CACHE
+
+// GFXBase::ExpandPalette
+//
+// The slow path of ExpandedPalette(): builds the table for the brightness, if it's one that has one, and returns
+// nullptr when the color should come straight from the palette instead
+
+const CRGB * GFXBase::ExpandPalette(uint8_t brightness) const
+{
+    // Both cores may be in here during a parallel loop, which could each allocate the cache or build the same table,
+    // so until it's over the colors come straight from the palette.  Tables built beforehand are still used.
+
+    if (g_ParallelFor.IsRunning())
+        return nullptr;
+
+    if (!_pPaletteCache)
+    {
+        if (_bPaletteCacheFailed)
+            return nullptr;
+
+        void * pMem = heap_caps_malloc(sizeof(PaletteCache), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+        if (!pMem)
+        {
+            debugW("Could not allocate %zu bytes for the palette cache, using ColorFromPalette() instead", sizeof(PaletteCache));
+            _bPaletteCacheFailed = true;
+            return nullptr;
+        }
+        _pPaletteCache = new (pMem) PaletteCache();
+    }
+
+    auto & cache = *_pPaletteCache;
+
+    if (brightness == 255)
+    {
+        for (int i = 0; i < 256; i++)
+            cache.Full[i] = ColorFromPalette(_currentPalette, i, 255, _currentBlendType);
+        cache.FullGeneration = _paletteGeneration;
+        return cache.Full;
+    }
+
+    // Effects that work out a brightness per pixel would rebuild the table on every call, so it's only built for a
+    // brightness that keeps being asked for
+
+    if (brightness != cache.Candidate)
+    {
+        cache.Candidate    = brightness;
+        cache.CandidateRun = 0;
+    }
+    if (cache.CandidateRun < PALETTE_CACHE_MIN_RUN)
+    {
+        cache.CandidateRun++;
+        return nullptr;
+    }
+
+    for (int i = 0; i < 256; i++)
+        cache.Dimmed[i] = ColorFromPalette(_currentPalette, i, brightness, _currentBlendType);
+    cache.DimmedBrightness = brightness;
+    cache.DimmedGeneration = _paletteGeneration;
+    return cache.Dimmed;
+}
+
+#endif
+
+#if ENABLE_XY_LOOKUP_TABLE
+
+// GFXBase::AllocateXYTable
+//
+// The table is read for nearly every pixel an effect touches, so it has to be in internal RAM, not PSRAM
+
+bool GFXBase::AllocateXYTable(uint16_t width, uint16_t height)
+{
+    free(_pXYTable);
+    _xyTableWidth = _xyTableHeight = 0;
+
+    _pXYTable = (uint16_t *) heap_caps_malloc(sizeof(uint16_t) * width * height, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (!_pXYTable)
+    {
+        debugE("Could not allocate %zu bytes for the XY lookup table, using xy() instead", sizeof(uint16_t) * width * height);
+        return false;
+    }
+    return true;
+}
+
+bool GFXBase::BuildXYTable(uint16_t width, uint16_t height)
+{
+    if (!AllocateXYTable(width, height))
+        return false;
+
+    for (uint16_t y = 0; y < height; y++)
+        for (uint16_t x = 0; x < width; x++)
+            _pXYTable[y * width + x] = xy(x, y);
+
+    _xyTableWidth  = width;
+    _xyTableHeight = height;
+    return true;
+}
+
+bool GFXBase::SetXYMap(const uint16_t * pMap, uint16_t width, uint16_t height)
+{
+    if (!AllocateXYTable(width, height))
+        return false;
+
+    // Anything that would land outside the LED buffer is clamped to the first pixel rather than trusted
+
+    for (size_t i = 0; i < (size_t) width * height; i++)
+        _pXYTable[i] = pMap[i] < GetLEDCount() ? pMap[i] : 0;
+
+    _xyTableWidth  = width;
+    _xyTableHeight = height;
+    return true;
+}
+
+#endif
+
 // Remove the XY macro definition that was set in gfxbase.h. In this file we won't use it beyond this point anyway.
 #undef XY
 
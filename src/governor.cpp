@@ -0,0 +1,174 @@
+//+--------------------------------------------------------------------------
+//
+// File:        governor.cpp
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+//
+// Description:
+//
+//    Works out the frame rate cap and CPU clock the governor sets, from
+//    the chip temperature, LED power, core load and unchanged frames
+//
+//---------------------------------------------------------------------------
+
+#include "globals.h"
+
+#if ENABLE_GOVERNOR
+
+#include "governor.h"
+#include "systemcontainer.h"
+
+#if CONFIG_PM_ENABLE
+    #include <esp_pm.h>
+#endif
+
+// Evaluate
+//
+// Runs every GOVERNOR_INTERVAL_MS on the draw task
+
+void Governor::Evaluate()
+{
+    _temperature = temperatureRead();
+
+    #if USE_HUB75
+        uint32_t watts = g_Values.MatrixPowerMilliwatts / 1000;
+    #else
+        uint32_t watts = g_Values.Watts;
+    #endif
+
+    bool bOverPower  = GOVERNOR_POWER_LIMIT_W && watts > GOVERNOR_POWER_LIMIT_W;
+    bool bUnderPower = !GOVERNOR_POWER_LIMIT_W || watts * 10 <= GOVERNOR_POWER_LIMIT_W * 9;
+    bool bHot        = _temperature >= GOVERNOR_HOT_C;
+
+    if (bHot)
+        _bHeatLimited = true;
+    else if (_temperature < GOVERNOR_COOL_C)
+        _bHeatLimited = false;
+
+    // Heat and power bring the cap down a quarter at a time, and give it back a third at a time, until it's over
+    // what the effect asks for and so no cap at all
+
+    uint32_t desiredFPS = std::max<size_t>(1, g_ptrSystem->EffectManager().GetCurrentEffect().DesiredFramesPerSecond());
+
+    if (bHot || bOverPower)
+    {
+        _fpsCap = std::max<uint32_t>(GOVERNOR_MIN_FPS, (_fpsCap ? _fpsCap : desiredFPS) * 3 / 4);
+    }
+    else if (_fpsCap && _temperature < GOVERNOR_COOL_C && bUnderPower)
+    {
+        _fpsCap = _fpsCap * 4 / 3 + 1;
+        if (_fpsCap >= desiredFPS)
+            _fpsCap = 0;
+    }
+
+    // Frames that went unsent for being the same as the last say the content is standing still
+
+    uint32_t shown   = g_Values.FramesShown   - _lastShown;
+    uint32_t skipped = g_Values.FramesSkipped - _lastSkipped;
+    _lastShown   = g_Values.FramesShown;
+    _lastSkipped = g_Values.FramesSkipped;
+    _bStatic = (shown + skipped) > 0 && skipped * 10 >= (shown + skipped) * 9;
+
+    // The clock goes down a step when the busier core would still have room at the lower one, and up a step when
+    // it's running short.  Heat takes it down regardless.
+
+    float busier = std::max(CPUMeter::GetCPUUsage(0), CPUMeter::GetCPUUsage(1));
+    constexpr size_t kSlowest = std::size(kFrequencies) - 1;
+
+    if (bHot)
+    {
+        _iFrequency = std::min(kSlowest, _iFrequency + 1);
+    }
+    else if (busier > 80.0f && _iFrequency > 0)
+    {
+        _iFrequency--;
+    }
+    else if (_iFrequency < kSlowest && busier * kFrequencies[_iFrequency] / kFrequencies[_iFrequency + 1] < 60.0f)
+    {
+        _iFrequency++;
+    }
+
+    debugV("Governor: %.0fC, %uW, %.0f%% busy, cap %u fps, %s, %u MHz", _temperature, watts, busier, _fpsCap,
+           _bStatic ? "static" : "moving", kFrequencies[_iFrequency]);
+}
+
+// Apply
+//
+// Sets the CPU clock, and with power management in the IDF build, lets the idle task light sleep between frames
+// while the content is standing still.  A boost skips the steps down for load but not the ones for heat.
+
+void Governor::Apply(bool bBoosted)
+{
+    bool bFull    = bBoosted && !_bHeatLimited;
+    uint32_t mhz  = bFull ? kFrequencies[0] : kFrequencies[_iFrequency];
+    bool bSleep   = GOVERNOR_LIGHT_SLEEP && !bBoosted && _bStatic;
+
+    if (mhz == _mhzApplied && bSleep == _bSleepApplied)
+        return;
+
+    #if CONFIG_PM_ENABLE
+
+        // The clock only drops to the minimum while nothing holds it up, so the radio and drivers that need it
+        // keep it as they always do
+
+        #if CONFIG_IDF_TARGET_ESP32S3
+            esp_pm_config_esp32s3_t config = {};
+        #else
+            esp_pm_config_esp32_t config = {};
+        #endif
+        config.max_freq_mhz       = mhz;
+        config.min_freq_mhz       = kFrequencies[std::size(kFrequencies) - 1];
+        config.light_sleep_enable = bSleep;
+
+        esp_err_t err = esp_pm_configure(&config);
+        if (err != ESP_OK)
+        {
+            debugW("Could not set power management to %u MHz: %s", mhz, esp_err_to_name(err));
+            return;
+        }
+
+    #else
+
+        if (!setCpuFrequencyMhz(mhz))
+        {
+            debugW("Could not set the CPU to %u MHz", mhz);
+            return;
+        }
+
+    #endif
+
+    _mhzApplied    = mhz;
+    _bSleepApplied = bSleep;
+}
+
+void Governor::Update()
+{
+    if (_bBoostPending.exchange(false, std::memory_order_acquire))
+        Apply(true);
+
+    uint32_t msNow = millis();
+    if (msNow - _msLastCheck < GOVERNOR_INTERVAL_MS)
+        return;
+
+    _msLastCheck = msNow;
+    Evaluate();
+    Apply(IsBoosted());
+}
+
+#endif
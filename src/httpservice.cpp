@@ -0,0 +1,284 @@
+//+--------------------------------------------------------------------------
+//
+// File:        httpservice.cpp
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+//
+// Description:
+//
+//    Implementation of the HTTPService declared in httpservice.h
+//
+//---------------------------------------------------------------------------
+
+#include "globals.h"
+
+#if ENABLE_WIFI
+
+#include "httpservice.h"
+#include "network.h"
+
+// ResponseStream
+//
+// A Stream that HTTPClient::writeToStream() can put the body in, which takes care of chunked responses for us
+
+class ResponseStream : public Stream
+{
+    std::vector<char, psram_allocator<char>> & _body;
+
+  public:
+
+    explicit ResponseStream(std::vector<char, psram_allocator<char>> & body) : _body(body)
+    {
+    }
+
+    size_t write(uint8_t b) override
+    {
+        _body.push_back(b);
+        return 1;
+    }
+
+    size_t write(const uint8_t * buffer, size_t size) override
+    {
+        _body.insert(_body.end(), (const char *) buffer, (const char *) buffer + size);
+        return size;
+    }
+
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int peek() override { return -1; }
+    void flush() override {}
+};
+
+String HTTPService::OriginOf(const String & url)
+{
+    int hostStart = url.indexOf("://");
+    hostStart = hostStart < 0 ? 0 : hostStart + 3;
+
+    int hostEnd = url.indexOf('/', hostStart);
+    String origin = hostEnd < 0 ? url : url.substring(0, hostEnd);
+
+    if (origin.indexOf(':', hostStart) < 0)
+        origin += url.startsWith("https://") ? ":443" : ":80";
+    return origin;
+}
+
+std::shared_ptr<const HTTPResponse> HTTPService::FreshResponse(const String & url, unsigned long maxAgeMs)
+{
+    std::lock_guard<std::mutex> guard(_mutex);
+
+    auto it = _cache.find(url);
+    if (it == _cache.end() || millis() - it->second.FetchedMs > maxAgeMs)
+        return nullptr;
+
+    return it->second.Response;
+}
+
+std::unique_lock<std::mutex> HTTPService::AcquireConnection(const String & origin, Connection *& pConnection, std::unique_ptr<Connection> & pTemporary)
+{
+    std::unique_lock<std::mutex> guard(_mutex);
+    Connection * pLeastRecent = nullptr;
+
+    for (auto& pKept : _connections)
+    {
+        if (pKept->Origin == origin)
+        {
+            // Another request to the same host has it; we wait, which is also what lets a second fetch of the same
+            // URL find the first one's response in the cache
+
+            pConnection = pKept.get();
+            guard.unlock();
+            return std::unique_lock<std::mutex>(pConnection->Mutex);
+        }
+
+        if (!pLeastRecent || (long)(pKept->LastUsedMs - pLeastRecent->LastUsedMs) < 0)
+            pLeastRecent = pKept.get();
+    }
+
+    if (_connections.size() < HTTP_MAX_CONNECTIONS)
+    {
+        pConnection = _connections.emplace_back(std::make_unique<Connection>()).get();
+    }
+    else
+    {
+        std::unique_lock<std::mutex> connectionGuard(pLeastRecent->Mutex, std::try_to_lock);
+        if (!connectionGuard.owns_lock())
+        {
+            // They're all busy, so this one gets a connection of its own that's closed when it's done
+            pTemporary = std::make_unique<Connection>();
+            pTemporary->Origin = origin;
+            pConnection = pTemporary.get();
+            return std::unique_lock<std::mutex>(pConnection->Mutex);
+        }
+
+        pConnection = pLeastRecent;
+        pConnection->Origin = origin;
+        return connectionGuard;
+    }
+
+    pConnection->Origin = origin;
+    return std::unique_lock<std::mutex>(pConnection->Mutex);
+}
+
+void HTTPService::Store(const String & url, CacheEntry entry)
+{
+    std::lock_guard<std::mutex> guard(_mutex);
+
+    _cache[url] = std::move(entry);
+
+    // Make room by dropping whatever was fetched longest ago
+
+    while (_cache.size() > HTTP_CACHE_ENTRIES)
+    {
+        auto oldest = _cache.begin();
+        for (auto it = _cache.begin(); it != _cache.end(); ++it)
+            if ((long)(it->second.FetchedMs - oldest->second.FetchedMs) < 0)
+                oldest = it;
+        _cache.erase(oldest);
+    }
+}
+
+void HTTPService::Invalidate(const String & url)
+{
+    std::lock_guard<std::mutex> guard(_mutex);
+    _cache.erase(url);
+}
+
+std::shared_ptr<const HTTPResponse> HTTPService::Get(const String & url, unsigned long maxAgeMs, const JsonDocument * pFilter, size_t cbDocument)
+{
+    if (auto pResponse = FreshResponse(url, maxAgeMs))
+        return pResponse;
+
+    Connection * pConnection = nullptr;
+    std::unique_ptr<Connection> pTemporary;
+    auto origin = OriginOf(url);
+    auto connectionGuard = AcquireConnection(origin, pConnection, pTemporary);
+
+    // A connection that was handed to another host since we last used it is closed, so we don't talk to the wrong one
+
+    if (pConnection->ConnectedOrigin != origin)
+    {
+        pConnection->Http.end();
+        pConnection->Client.stop();
+        pConnection->ConnectedOrigin = origin;
+    }
+
+    // Someone may have fetched it while we were waiting for the connection
+
+    if (auto pResponse = FreshResponse(url, maxAgeMs))
+        return pResponse;
+
+    CacheEntry cached;
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        auto it = _cache.find(url);
+        if (it != _cache.end())
+            cached = it->second;
+    }
+
+    auto& http = pConnection->Http;
+    http.setReuse(!pTemporary);
+    http.useHTTP10(pFilter != nullptr);             // So a filtered body is never chunked, and can be parsed off the stream
+
+    bool bBegun = url.startsWith("https://") ? http.begin(url) : http.begin(pConnection->Client, url);
+    if (!bBegun)
+    {
+        debugW("Could not start request for %s", url.c_str());
+        return nullptr;
+    }
+
+    http.setConnectTimeout(NetworkReader::ReaderTimeout());
+    http.setTimeout(NetworkReader::ReaderTimeout());
+
+    static const char * headerKeys[] = { "ETag", "Last-Modified" };
+    http.collectHeaders(headerKeys, std::size(headerKeys));
+
+    if (cached.Response)
+    {
+        if (!cached.ETag.isEmpty())
+            http.addHeader("If-None-Match", cached.ETag);
+        if (!cached.LastModified.isEmpty())
+            http.addHeader("If-Modified-Since", cached.LastModified);
+    }
+
+    int code = http.GET();
+    pConnection->LastUsedMs = millis();
+
+    if (code <= 0)
+    {
+        debugW("Request for %s failed: %s", url.c_str(), HTTPClient::errorToString(code).c_str());
+        http.end();
+        pConnection->Client.stop();                 // Whatever state it's in, the next request starts afresh
+        return nullptr;
+    }
+
+    // Not modified, so what we have is good for another while
+
+    if (code == HTTP_CODE_NOT_MODIFIED && cached.Response)
+    {
+        http.end();
+        cached.FetchedMs = millis();
+        auto pResponse = cached.Response;
+        Store(url, std::move(cached));
+        return pResponse;
+    }
+
+    auto pResponse = std::make_shared<HTTPResponse>();
+    pResponse->Code = code;
+
+    if (pFilter)
+    {
+        AllocatedJsonDocument doc(cbDocument);
+        auto error = deserializeJson(doc, http.getStream(), DeserializationOption::Filter(*pFilter));
+        if (error)
+        {
+            debugW("Could not parse the response for %s: %s", url.c_str(), error.c_str());
+            http.end();
+            pConnection->Client.stop();             // We may have stopped partway through the body
+            return nullptr;
+        }
+
+        pResponse->Body.resize(measureJson(doc) + 1);
+        pResponse->Body.resize(serializeJson(doc, pResponse->Body.data(), pResponse->Body.size()));
+    }
+    else
+    {
+        auto size = http.getSize();
+        if (size > 0)
+            pResponse->Body.reserve(size);
+
+        ResponseStream stream(pResponse->Body);
+        http.writeToStream(&stream);
+    }
+
+    CacheEntry entry;
+    entry.ETag         = http.header("ETag");
+    entry.LastModified = http.header("Last-Modified");
+    http.end();                                     // Leaves the connection open if the server allows it
+
+    if (code >= 200 && code < 300)
+    {
+        entry.Response  = pResponse;
+        entry.FetchedMs = millis();
+        Store(url, std::move(entry));
+    }
+
+    return pResponse;
+}
+
+#endif // ENABLE_WIFI
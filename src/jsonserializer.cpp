@@ -27,44 +27,127 @@
 // History:     Apr-18-2023         Rbergen     Created
 //---------------------------------------------------------------------------
 
-#include <FS.h>
-#include <SPIFFS.h>
+#include <map>
+#include <mutex>
 
 #include "globals.h"
+#include "storage.h"
 #include "systemcontainer.h"
 #include "taskmgr.h"
 
+extern "C"
+{
+    #include "uzlib/src/uzlib.h"
+}
+
+// What we last wrote to each file, so writing the same again can be skipped
+
+static std::mutex l_WrittenFileMutex;
+static std::map<String, uint32_t> l_WrittenFileCRCs;
+
+// Held while a file is replaced, and while one is recovered and read, so a read from the web server can't find a
+// write from the JSON writer half done and "recover" it
+
+static std::mutex l_FileAccessMutex;
+
 bool BoolFromText(const String& text)
 {
     return text == "true" || strtol(text.c_str(), NULL, 10);
 }
 
+// The buffer size a JSON file last took is kept in a small file next to it, so after a reboot the document
+// that's read from it or written to it can be allocated at the right size straight away
+
+static String BufferSizeFileName(const String & fileName)
+{
+    return fileName + ".len";
+}
+
+static size_t ReadBufferSize(const String & fileName)
+{
+    File file = FILESYSTEM.open(BufferSizeFileName(fileName));
+    if (!file)
+        return 0;
+
+    size_t bufferSize = strtoul(file.readString().c_str(), NULL, 10);
+    file.close();
+    return bufferSize;
+}
+
+static void WriteBufferSize(const String & fileName, size_t bufferSize)
+{
+    File file = FILESYSTEM.open(BufferSizeFileName(fileName), FILE_WRITE);
+    if (!file)
+    {
+        debugW("Unable to open file %s to write the buffer size!", BufferSizeFileName(fileName).c_str());
+        return;
+    }
+
+    file.print(bufferSize);
+    file.close();
+}
+
+// A config file in the binary format starts with this header, and then holds the same document as MessagePack.
+// A JSON file can't start with it, so files written before the binary format are still read as they are.
+
+static constexpr uint8_t kBinaryConfigHeader[] = { 'N', 'D', 'B', BINARY_CONFIG_VERSION };
+
+// IsBinaryConfigFile
+//
+// Leaves the file at the start of the document either way.  Returns false for a binary file of another version
+// too, after saying so, since its contents can't be trusted to mean what we think.
+
+static bool IsBinaryConfigFile(File & file, bool & bUsable)
+{
+    uint8_t header[sizeof(kBinaryConfigHeader)];
+    bUsable = true;
+
+    if (file.read(header, sizeof(header)) == sizeof(header) && !memcmp(header, kBinaryConfigHeader, sizeof(header) - 1))
+    {
+        if (header[sizeof(header) - 1] == BINARY_CONFIG_VERSION)
+            return true;
+
+        debugW("Binary config file has version %u, which we can't read", header[sizeof(header) - 1]);
+        bUsable = false;
+        return false;
+    }
+
+    file.seek(0);
+    return false;
+}
+
 bool LoadJSONFile(const String & fileName, size_t & bufferSize, std::unique_ptr<AllocatedJsonDocument>& pJsonDoc)
 {
     bool jsonReadSuccessful = false;
 
-    File file = SPIFFS.open(fileName);
+    std::lock_guard<std::mutex> fileGuard(l_FileAccessMutex);
+    RecoverInterruptedWrite(fileName);
+    File file = FILESYSTEM.open(fileName);
 
     if (file)
     {
-        if (file.size() > 0)
+        bool bUsable = true;
+        bool bBinary = file.size() > 0 && IsBinaryConfigFile(file, bUsable);
+        size_t documentStart = bBinary ? sizeof(kBinaryConfigHeader) : 0;
+
+        if (file.size() > 0 && bUsable)
         {
-            debugI("Attempting to read JSON file %s", fileName.c_str());
+            debugI("Attempting to read %s file %s", bBinary ? "binary" : "JSON", fileName.c_str());
 
             if (bufferSize == 0)
-                bufferSize = std::max((size_t)JSON_BUFFER_BASE_SIZE, file.size());
+                bufferSize = std::max({ (size_t)JSON_BUFFER_BASE_SIZE, file.size(), ReadBufferSize(fileName) });
 
             // Loop is here to deal with out-of-memory conditions
             while(true)
             {
                 pJsonDoc.reset(new AllocatedJsonDocument(bufferSize));
 
-                DeserializationError error = deserializeJson(*pJsonDoc, file);
+                DeserializationError error = bBinary ? deserializeMsgPack(*pJsonDoc, file) : deserializeJson(*pJsonDoc, file);
 
                 if (error == DeserializationError::NoMemory)
                 {
                     pJsonDoc.reset(nullptr);
-                    file.seek(0);
+                    file.seek(documentStart);
                     bufferSize += JSON_BUFFER_INCREMENT;
 
                     debugW("Out of memory reading JSON from file %s - increasing buffer to %zu bytes", fileName.c_str(), bufferSize);
@@ -88,37 +171,64 @@ bool LoadJSONFile(const String & fileName, size_t & bufferSize, std::unique_ptr<
     return jsonReadSuccessful;
 }
 
-bool SerializeWithBufferSize(std::unique_ptr<AllocatedJsonDocument>& pJsonDoc, size_t& bufferSize, std::function<bool(JsonObject&)> serializationFunction)
+static bool SerializeIntoBuffer(std::unique_ptr<AllocatedJsonDocument>& pJsonDoc, size_t bufferSize, std::function<bool(JsonObject&)> & serializationFunction)
 {
-    // Loop is here to deal with the serialization buffer being too small
-    while(true)
+    pJsonDoc.reset(new AllocatedJsonDocument(bufferSize));
+    if (pJsonDoc->capacity() == 0)
     {
-        pJsonDoc.reset(new AllocatedJsonDocument(bufferSize));
-        if (pJsonDoc->capacity() == 0)
-        {
-            debugE("Allocation of buffer for JSON serialization failed!");
-            return false;
-        }
+        debugE("Allocation of buffer for JSON serialization failed!");
+        pJsonDoc.reset(nullptr);
+        return false;
+    }
 
-        JsonObject jsonObject = pJsonDoc->to<JsonObject>();
+    JsonObject jsonObject = pJsonDoc->to<JsonObject>();
 
-        if (serializationFunction(jsonObject))
-            break;
+    if (serializationFunction(jsonObject))
+        return true;
 
-        pJsonDoc.reset(nullptr);
-        bufferSize += JSON_BUFFER_INCREMENT;
+    pJsonDoc.reset(nullptr);
+    return false;
+}
+
+// SerializeWithBufferSize
+//
+// Serializes into a buffer of the size given, which is normally the size the object took last time.  If that's too
+// small, the object is serialized a second and last time into as much memory as we can spare, and the size it
+// actually took becomes the new bufferSize.
+
+bool SerializeWithBufferSize(std::unique_ptr<AllocatedJsonDocument>& pJsonDoc, size_t& bufferSize, std::function<bool(JsonObject&)> serializationFunction)
+{
+    if (bufferSize > 0 && SerializeIntoBuffer(pJsonDoc, bufferSize, serializationFunction))
+        return true;
 
-        debugW("Buffer memory too small for JSON serialization - increasing buffer to %zu bytes", bufferSize);
+    #if USE_PSRAM
+        size_t largestBlock = heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM);
+    #else
+        size_t largestBlock = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    #endif
+
+    // Keep a quarter of the largest block back, so the measuring pass can't starve anyone else
+    size_t measureSize = std::min((size_t)JSON_MEASURE_MAX_SIZE, largestBlock - largestBlock / 4);
+
+    if (measureSize <= bufferSize || !SerializeIntoBuffer(pJsonDoc, measureSize, serializationFunction))
+    {
+        debugE("Not enough memory for JSON serialization, with %zu bytes to measure with", measureSize);
+        return false;
     }
 
+    pJsonDoc->shrinkToFit();
+    bufferSize = pJsonDoc->memoryUsage() + JSON_BUFFER_SLACK;
+
+    debugW("Buffer memory too small for JSON serialization - measured, and increased buffer to %zu bytes", bufferSize);
     return true;
 }
 
 bool SaveToJSONFile(const String & fileName, size_t& bufferSize, IJSONSerializable& object)
 {
     if (bufferSize == 0)
-        bufferSize = JSON_BUFFER_BASE_SIZE;
+        bufferSize = ReadBufferSize(fileName);
 
+    size_t previousBufferSize = bufferSize;
     std::unique_ptr<AllocatedJsonDocument> pJsonDoc(nullptr);
 
     if (!SerializeWithBufferSize(pJsonDoc, bufferSize, [&object](JsonObject& jsonObject) { return object.SerializeToJSON(jsonObject); }))
@@ -127,38 +237,70 @@ bool SaveToJSONFile(const String & fileName, size_t& bufferSize, IJSONSerializab
         return false;
     }
 
-    SPIFFS.remove(fileName);
+    if (bufferSize != previousBufferSize)
+        WriteBufferSize(fileName, bufferSize);
 
-    File file = SPIFFS.open(fileName, FILE_WRITE);
+    // The file is put together in memory first, so it can be checked against what we wrote last and then written
+    // in one go
 
-    if (!file)
-    {
-        debugE("Unable to open file %s to write JSON!", fileName.c_str());
-        pJsonDoc->clear();
-        return false;
-    }
+    #if ENABLE_BINARY_CONFIG
+        std::vector<uint8_t, psram_allocator<uint8_t>> contents(sizeof(kBinaryConfigHeader) + measureMsgPack(*pJsonDoc));
+        memcpy(contents.data(), kBinaryConfigHeader, sizeof(kBinaryConfigHeader));
+        serializeMsgPack(*pJsonDoc, contents.data() + sizeof(kBinaryConfigHeader), contents.size() - sizeof(kBinaryConfigHeader));
+    #else
+        std::vector<uint8_t, psram_allocator<uint8_t>> contents(measureJson(*pJsonDoc) + 1);     // serializeJson adds a terminator
+        contents.resize(serializeJson(*pJsonDoc, (char *) contents.data(), contents.size()));
+    #endif
 
-    size_t bytesWritten = serializeJson(*pJsonDoc, file);
-    debugI("Number of bytes written to JSON file %s: %zu", fileName.c_str(), bytesWritten);
+    pJsonDoc.reset(nullptr);
 
-    pJsonDoc->clear();
+    uint32_t crc = uzlib_crc32(contents.data(), contents.size(), 0xffffffff);
 
-    file.flush();
-    file.close();
+    {
+        std::lock_guard<std::mutex> guard(l_WrittenFileMutex);
+
+        auto written = l_WrittenFileCRCs.find(fileName);
+        if (written != l_WrittenFileCRCs.end() && written->second == crc && FILESYSTEM.exists(fileName))
+        {
+            debugV("Contents of %s unchanged, so not writing it", fileName.c_str());
+            if (g_ptrSystem->HasJSONWriter())
+                g_ptrSystem->JSONWriter().RecordSkippedWrite();
+            return true;
+        }
+    }
+
+    bool bWritten;
+    {
+        std::lock_guard<std::mutex> fileGuard(l_FileAccessMutex);
+        bWritten = !contents.empty() && WriteFileAtomically(fileName, contents.data(), contents.size());
+    }
 
-    if (bytesWritten == 0)
+    if (!bWritten)
     {
         debugE("Unable to write JSON to file %s!", fileName.c_str());
-        SPIFFS.remove(fileName);
         return false;
     }
 
+    debugI("Number of bytes written to JSON file %s: %zu", fileName.c_str(), contents.size());
+    if (g_ptrSystem->HasJSONWriter())
+        g_ptrSystem->JSONWriter().RecordWrite(contents.size());
+
+    std::lock_guard<std::mutex> guard(l_WrittenFileMutex);
+    l_WrittenFileCRCs[fileName] = crc;
+
     return true;
 }
 
 bool RemoveJSONFile(const String & fileName)
 {
-    return SPIFFS.remove(fileName);
+    {
+        std::lock_guard<std::mutex> guard(l_WrittenFileMutex);
+        l_WrittenFileCRCs.erase(fileName);
+    }
+
+    std::lock_guard<std::mutex> fileGuard(l_FileAccessMutex);
+    FILESYSTEM.remove(BufferSizeFileName(fileName));
+    return FILESYSTEM.remove(fileName);
 }
 
 size_t JSONWriter::RegisterWriter(std::function<void()> writer)
@@ -174,10 +316,16 @@ void JSONWriter::FlagWriter(size_t index)
     if (index >= writers.size())
         return;
 
-    writers[index].flag.store(true);
-    latestFlagMs.store(millis());
+    auto& entry = writers[index];
+    auto now = millis();
 
-    g_ptrSystem->TaskManager().NotifyJSONWriterThread();
+    entry.latestFlagMs.store(now);
+    if (!entry.flag.exchange(true))
+        entry.firstFlagMs.store(now);
+
+    auto& taskManager = g_ptrSystem->TaskManager();
+    taskManager.NotifyJSONWriterThread();
+    taskManager.PostEvent(SystemEvent::ConfigChanged);
 }
 
 void JSONWriter::FlushWrites(bool halt)
@@ -190,47 +338,55 @@ void JSONWriter::FlushWrites(bool halt)
 
 // JSONWriterTaskEntry
 //
-// Invoke functions that write serialized JSON objects to SPIFFS at request, with some delay
+// Invoke functions that write serialized JSON objects to the file system at request.  Each writer is held back on
+// its own, until it's been left alone for a while or has waited long enough, so a slider being dragged or a remote
+// button being held down costs one write every so often rather than one per change.
 void IRAM_ATTR JSONWriterTaskEntry(void *)
 {
+    TickType_t notifyWait = portMAX_DELAY;
+
     for(;;)
     {
-        TickType_t notifyWait = portMAX_DELAY;
+        // Wait until we're woken up by a writer being flagged, or until the next flagged writer is due
+        ulTaskNotifyTake(pdTRUE, notifyWait);
+        notifyWait = portMAX_DELAY;
 
-        for (;;)
-        {
-            // Wait until we're woken up by a writer being flagged, or until we've reached the hold point
-            ulTaskNotifyTake(pdTRUE, notifyWait);
+        g_ptrSystem->TaskManager().WaitWhileNonEssentialPaused();
 
-            if (!g_ptrSystem->HasJSONWriter())
-                continue;
+        if (!g_ptrSystem->HasJSONWriter())
+            continue;
 
-            auto& jsonWriter = g_ptrSystem->JSONWriter();
+        auto& jsonWriter = g_ptrSystem->JSONWriter();
 
-            // If a flush was requested then we execute pending writes now
-            if (jsonWriter.flushRequested.load())
-            {
-                jsonWriter.flushRequested.store(false);
-                break;
-            }
+        // If a flush was requested then we execute pending writes now, even when writes are halted after
+        bool flush = jsonWriter.flushRequested.exchange(false);
+
+        if (!flush && jsonWriter.haltWrites.load())
+            continue;
 
-            // If writes are halted, we don't do anything
-            if (jsonWriter.haltWrites.load())
+        for (auto &entry : jsonWriter.writers)
+        {
+            if (!entry.flag.load())
                 continue;
 
-            unsigned long holdUntil = jsonWriter.latestFlagMs.load() + JSON_WRITER_DELAY;
             unsigned long now = millis();
-            if (now >= holdUntil)
-                break;
+            unsigned long dueAt = entry.DueAt();
 
-            notifyWait = pdMS_TO_TICKS(holdUntil - now);
-        }
+            if (!flush && (long)(dueAt - now) > 0)
+            {
+                notifyWait = std::min(notifyWait, pdMS_TO_TICKS(dueAt - now));
+                continue;
+            }
 
-        for (auto &entry : g_ptrSystem->JSONWriter().writers)
-        {
             // Unset flag before we do the actual write. This makes that we don't miss another flag raise if it happens while writing
             if (entry.flag.exchange(false))
+            {
+                entry.lastWriteMs = now;
+                entry.hasWritten = true;
+
+                TRACE_SPAN("JSON_WRITE");
                 entry.writer();
+            }
         }
     }
 }
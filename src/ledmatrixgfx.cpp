@@ -35,17 +35,104 @@
 #include "effects/matrix/Boid.h"
 #include "effects/matrix/Vector.h"
 #include <SmartMatrix.h>
+#include <esp_heap_caps.h>
+#include "audiolatency.h"
 #include "ledmatrixgfx.h"
 #include "systemcontainer.h"
+#include "textraster.h"
 
 const rgb24 defaultBackgroundColor = {0x40, 0, 0};
 
+// Refresh settings
+//
+// SmartMatrix is only told the refresh rate and calc divider when they change.  With ENABLE_MATRIX_AUTOTUNE they
+// follow how the effect is doing: while it falls short of the frame rate it asks for, and the core the refresh
+// calculation shares is busy, the refresh rate steps down, though never below MATRIX_MIN_REFRESH_RATE where the
+// panels start to flicker.  Once it keeps up with room to spare for a few seconds it steps back up towards
+// MATRIX_REFRESH_RATE.  The divider follows the refresh rate, so the panel is still recalculated at least as often
+// as the effect draws, but never less often than MATRIX_CALC_DIVIDER would have it.
+
+static DRAM_ATTR uint16_t l_refreshRate        = MATRIX_REFRESH_RATE;
+static DRAM_ATTR uint8_t  l_calcDivider        = MATRIX_CALC_DIVIDER;
+static DRAM_ATTR uint16_t l_appliedRefreshRate = 0;
+static DRAM_ATTR uint8_t  l_appliedCalcDivider = 0;
+
 // The declarations create the "layers" that make up the matrix display
 
 SMLayerBackground<LEDMatrixGFX::SM_RGB, LEDMatrixGFX::kBackgroundLayerOptions> LEDMatrixGFX::backgroundLayer(kMatrixWidth, kMatrixHeight);
 SMLayerBackground<LEDMatrixGFX::SM_RGB, LEDMatrixGFX::kBackgroundLayerOptions> LEDMatrixGFX::titleLayer(kMatrixWidth, kMatrixHeight);
 SmartMatrixHub75Calc<COLOR_DEPTH, LEDMatrixGFX::kMatrixWidth, LEDMatrixGFX::kMatrixHeight, LEDMatrixGFX::kPanelType, LEDMatrixGFX::kMatrixOptions> LEDMatrixGFX::matrix;
 
+// ApplyRefreshSettings
+//
+// Hands SmartMatrix whichever of the refresh settings it doesn't have yet
+
+static void ApplyRefreshSettings()
+{
+    if (l_calcDivider != l_appliedCalcDivider)
+    {
+        LEDMatrixGFX::matrix.setCalcRefreshRateDivider(l_calcDivider);
+        l_appliedCalcDivider = l_calcDivider;
+    }
+
+    if (l_refreshRate != l_appliedRefreshRate)
+    {
+        LEDMatrixGFX::matrix.setRefreshRate(l_refreshRate);
+        l_appliedRefreshRate = l_refreshRate;
+    }
+}
+
+#if ENABLE_MATRIX_AUTOTUNE
+
+// TuneRefreshSettings
+//
+// Called once per tuning window with the frame rate the effect managed over it
+
+static void TuneRefreshSettings()
+{
+    constexpr uint16_t kRefreshStep    = 10;                                            // Hz per adjustment
+    constexpr float    kBusyCPU        = 90.0f;                                         // Percent use of the calc core that counts as no headroom
+    constexpr int      kWindowsToRaise = 3;                                             // Good windows in a row before stepping back up
+
+    static int cGoodWindows = 0;
+
+    constexpr int kCalcCore = (LEDMatrixGFX::kMatrixOptions & SMARTMATRIX_OPTIONS_ESP32_CALC_TASK_CORE_1) ? 1 : 0;
+
+    auto  targetFPS = std::max<size_t>(1, g_ptrSystem->EffectManager().GetCurrentEffect().DesiredFramesPerSecond());
+    float calcCPU   = g_ptrSystem->TaskManager().GetCPUUsagePercent(kCalcCore);
+
+    if (g_Values.FPS * 10 < targetFPS * 9 && calcCPU >= kBusyCPU)
+    {
+        // Falling behind with the calc core flat out, so give it some time back
+
+        cGoodWindows = 0;
+        l_refreshRate = std::max<int>(MATRIX_MIN_REFRESH_RATE, l_refreshRate - kRefreshStep);
+    }
+    else if (g_Values.FPS >= targetFPS && calcCPU < kBusyCPU)
+    {
+        if (++cGoodWindows >= kWindowsToRaise)
+        {
+            cGoodWindows = 0;
+            l_refreshRate = std::min<int>(MATRIX_REFRESH_RATE, l_refreshRate + kRefreshStep);
+        }
+    }
+    else
+    {
+        cGoodWindows = 0;
+    }
+
+    l_calcDivider = std::clamp<int>(l_refreshRate / targetFPS, 1, MATRIX_CALC_DIVIDER);
+
+    if (l_refreshRate != l_appliedRefreshRate || l_calcDivider != l_appliedCalcDivider)
+        debugI("Matrix refresh now %u Hz, calc divider %u, for %zu fps target at %.0f%% calc CPU", l_refreshRate, l_calcDivider, targetFPS, calcCPU);
+}
+
+#endif
+
+#if ENABLE_MATRIX_DIRECT_OUTPUT
+    static void StartDirectOutput();
+#endif
+
 void LEDMatrixGFX::StartMatrix()
 {
     matrix.addLayer(&backgroundLayer);
@@ -55,8 +142,7 @@ void LEDMatrixGFX::StartMatrix()
     // will cause a dim panel with a low refresh, too little will starve other things.  We currently have enough RAM for
     // use so begin() is not being called with a reserve paramter, but it can be if memory becomes scarce.
 
-    matrix.setCalcRefreshRateDivider(MATRIX_CALC_DIVIDER);
-    matrix.setRefreshRate(MATRIX_REFRESH_RATE);
+    ApplyRefreshSettings();
     matrix.setMaxCalculationCpuPercentage(95);
     matrix.begin();
 
@@ -69,8 +155,19 @@ void LEDMatrixGFX::StartMatrix()
     backgroundLayer.swapBuffers(false);
 
     matrix.setBrightness(255);
+
+    #if ENABLE_MATRIX_DIRECT_OUTPUT
+        StartDirectOutput();
+    #endif
 }
 
+// The caption as it's on the title layer, and the brightness the layer was last given, so the layer is only drawn
+// again when the caption itself changes rather than on every frame of its fade
+
+static TextRaster l_captionText;
+static bool       l_bCaptionShown      = false;
+static int        l_captionBrightness  = -1;
+
 void LEDMatrixGFX::PrepareFrame()
 {
     // We treat the internal matrix buffer as our own little playground to draw in, but that assumes they're
@@ -88,63 +185,487 @@ void LEDMatrixGFX::PrepareFrame()
             backgroundLayer.drawString(MATRIX_WIDTH / 2 - (3 * output.length()), MATRIX_HEIGHT / 2 - 5, rgb24(255, 255, 255), rgb24(0, 0, 0), output.c_str());
         #endif
 
-        auto graphics = g_ptrSystem->EffectManager().g();
-
-        matrix.setCalcRefreshRateDivider(MATRIX_CALC_DIVIDER);
-        matrix.setRefreshRate(MATRIX_REFRESH_RATE);
+        auto& effectManager = g_ptrSystem->EffectManager();
 
-        auto pMatrix = std::static_pointer_cast<LEDMatrixGFX>(g_ptrSystem->EffectManager().GetBaseGraphics());
+        auto pMatrix = static_cast<LEDMatrixGFX *>(effectManager.GetBaseGraphics().get());
         pMatrix->setLeds(GetMatrixBackBuffer());
 
         // We set ourselves to the lower of the fader value or the brightness value,
         // so that we can fade between effects without having to change the brightness
         // setting.
 
-        if (g_ptrSystem->EffectManager().GetCurrentEffect().ShouldShowTitle() && pMatrix->GetCaptionTransparency() > 0.00)
+        if (effectManager.GetCurrentEffect().ShouldShowTitle() && pMatrix->GetCaptionTransparency() > 0.00)
         {
-            titleLayer.setFont(font3x5);
             uint8_t brite = (uint8_t)(pMatrix->GetCaptionTransparency() * 255.0);
             debugV("Caption: %d", brite);
 
-            rgb24 chromaKeyColor = rgb24(255, 0, 255);
-            rgb24 shadowColor = rgb24(0, 0, 0);
-            rgb24 titleColor = rgb24(255, 255, 255);
+            // The fade only changes the layer's brightness, so the text is only drawn when it's new.  With the direct
+            // output there's no calc task to lay the title layer over the frame, so the caption is blended in as the
+            // frame is handed over instead.
+
+            if (l_captionText.Update(pMatrix->GetCaption(), font6x10, true) || !l_bCaptionShown)
+            {
+                #if !ENABLE_MATRIX_DIRECT_OUTPUT
+                    rgb24 chromaKeyColor = rgb24(255, 0, 255);
+                    rgb24 shadowColor = rgb24(0, 0, 0);
+                    rgb24 titleColor = rgb24(255, 255, 255);
+
+                    titleLayer.setChromaKeyColor(chromaKeyColor);
+                    titleLayer.fillScreen(chromaKeyColor);
+
+                    int y = MATRIX_HEIGHT - 2 - l_captionText.Height();
+                    int x = (MATRIX_WIDTH / 2) - (l_captionText.Width() / 2) + 1;
+
+                    l_captionText.Draw(titleLayer, x, y, titleColor, shadowColor);
+
+                    // We enable the chromakey overlay just for the strip of screen where it appears.  This support is
+                    // only present in the private fork of SmartMatrix that is linked to the mesermizer project.
+
+                    titleLayer.swapBuffers(false);
+                    titleLayer.enableChromaKey(true, y, y + l_captionText.Height());
+                #endif
+                l_bCaptionShown = true;
+            }
+
+            if (brite != l_captionBrightness)
+            {
+                #if !ENABLE_MATRIX_DIRECT_OUTPUT
+                    titleLayer.setBrightness(brite); // 255 would obscure it entirely
+                #endif
+                l_captionBrightness = brite;
+            }
+        }
+        else if (l_bCaptionShown || l_captionBrightness != 0)
+        {
+            #if !ENABLE_MATRIX_DIRECT_OUTPUT
+                titleLayer.enableChromaKey(false);
+                titleLayer.setBrightness(0);
+            #endif
+            l_bCaptionShown = false;
+            l_captionBrightness = 0;
+        }
+    }
+}
+
+#if ENABLE_MATRIX_DITHER
+
+// The output stage applies gamma and brightness through a table that keeps 8 bits of fraction below each output
+// step, and an ordered dither that shifts every frame spreads that fraction over space and time.  Low brightness
+// then still gets the in-between levels that the panel's own brightness scaling would have rounded away.
+
+static DRAM_ATTR uint16_t l_outputLUT[256];
+static DRAM_ATTR int      l_lutBrightness = -1;                                       // Brightness the table was built for
+static DRAM_ATTR CRGB *   l_pCleanFrame   = nullptr;                                  // The frame as drawn, before the output stage
+static DRAM_ATTR uint8_t  l_ditherFrame   = 0;
+
+static const DRAM_ATTR uint8_t l_abBayer4x4[16] = { 0, 8, 2, 10, 12, 4, 14, 6, 3, 11, 1, 9, 15, 7, 13, 5 };
+
+static void BuildOutputLUT(uint8_t brightness)
+{
+    for (int i = 0; i < 256; i++)
+    {
+        float level = powf(i / 255.0f, MATRIX_DITHER_GAMMA) * brightness / 255.0f;
+        l_outputLUT[i] = (uint16_t) (level * 255.0f * 256.0f + 0.5f);
+    }
+    l_lutBrightness = brightness;
+}
+
+// LEDMatrixGFX::ApplyOutputStage
+//
+// Keeps a copy of the frame as drawn, then maps every channel through the table and dithers off the fraction
+
+void LEDMatrixGFX::ApplyOutputStage(uint8_t brightness)
+{
+    const size_t cbFrame = sizeof(CRGB) * _width * _height;
+
+    if (brightness != l_lutBrightness)
+        BuildOutputLUT(brightness);
+
+    if (!l_pCleanFrame)
+        l_pCleanFrame = (CRGB *) heap_caps_malloc(cbFrame, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (l_pCleanFrame)
+        memcpy(l_pCleanFrame, leds, cbFrame);
+
+    l_ditherFrame++;
+
+    for (int y = 0; y < _height; y++)
+    {
+        CRGB * pRow = leds + y * _width;
+        const uint8_t * pBayerRow = &l_abBayer4x4[((y + l_ditherFrame) & 3) * 4];
+
+        for (int x = 0; x < _width; x++)
+        {
+            // Thresholds run from 8 to 248, and the table tops out at 255 * 256, so this can't overflow a channel
+
+            uint16_t threshold = (pBayerRow[(x + (l_ditherFrame >> 2)) & 3] << 4) + 8;
+            CRGB & pixel = pRow[x];
+            pixel.r = (l_outputLUT[pixel.r] + threshold) >> 8;
+            pixel.g = (l_outputLUT[pixel.g] + threshold) >> 8;
+            pixel.b = (l_outputLUT[pixel.b] + threshold) >> 8;
+        }
+    }
+}
+
+// LEDMatrixGFX::RestoreCleanFrame
+//
+// Puts the frame as drawn back into the back buffer after a swap that copied the processed one there
+
+void LEDMatrixGFX::RestoreCleanFrame()
+{
+    if (l_pCleanFrame)
+        memcpy((void *) GetMatrixBackBuffer(), l_pCleanFrame, sizeof(CRGB) * _width * _height);
+}
+
+#endif
+
+#if ENABLE_MATRIX_DIRECT_OUTPUT
+
+#if ENABLE_PIPELINED_PRESENT
+    #error ENABLE_MATRIX_DIRECT_OUTPUT and ENABLE_PIPELINED_PRESENT each have a PresentTaskEntry, so build one or the other
+#endif
+
+// Direct output
+//
+// SmartMatrix normally has a calc task that, whenever the refresh has a DMA buffer free, reads the layers a row at a
+// time, corrects their color, and packs them into the bit planes the panel is clocked from.  With the direct output
+// that task is left waiting for good, and the present task does that work in a single pass: the draw loop hands
+// over a copy of each finished frame, with the caption blended in, and the present task packs it into the free DMA
+// buffer.  Gamma goes in through a table that spreads each pixel level straight into its bit planes, and brightness
+// through the output enable timing that's worked out once for each brightness, so the pass is table lookups, ORs
+// and stores.
+//
+// The layout is the one the ESP32 refresh of the SmartMatrix fork we link works from: a frame is a set of rows, one
+// for each scan address.  Each row is a set of bit planes, least significant first, and each plane is a 16 bit word
+// for every pixel clocked out.  A word holds the color bits of a pixel in each half of the panel and the address,
+// latch and output enable lines, with each pair of words swapped, as the I2S sends them that way round.
+
+using MatrixRefresh = decltype(LEDMatrixGFX::matrixRefresh);
+
+static constexpr int kDirectRows      = MATRIX_PANEL_HEIGHT / 2;                   // Scan addresses; each lights a row in both halves
+static constexpr int kDirectPlanes    = COLOR_DEPTH / 3;
+static constexpr int kPixelsPerLatch  = MATRIX_WIDTH;
+
+static_assert(COLOR_DEPTH == 24, "The direct output packs 8 bit planes");
+static_assert(MATRIX_HEIGHT == MATRIX_PANEL_HEIGHT, "The direct output drives a single row of panels; chains that stack them use the calc task");
+static_assert(sizeof(MatrixRefresh::frameStruct) == sizeof(uint16_t) * kDirectRows * kDirectPlanes * kPixelsPerLatch,
+              "The SmartMatrix frame isn't laid out the way the direct output packs it");
+static_assert((BIT_R1 | BIT_G1 | BIT_B1 | BIT_R2 | BIT_G2 | BIT_B2) <= 0xFF, "The color bits have to be in the low byte of each word");
+
+static DRAM_ATTR uint64_t          l_planeSpread[256];                              // A level through the gamma, one bit plane a byte
+static DRAM_ATTR uint16_t          l_controlWords[kDirectPlanes][kPixelsPerLatch];  // Latch and output enable for each clock of each plane
+static DRAM_ATTR int               l_controlBrightness = -1;                        // What the control words were worked out for
+static DRAM_ATTR int               l_controlTransition = -1;
+
+static DRAM_ATTR CRGB *            l_pStagedFrame       = nullptr;                  // The frame handed to the present task
+static DRAM_ATTR uint8_t           l_stagedBrightness   = 255;
+static DRAM_ATTR int               l_stagedCaption      = 0;                        // How strongly the caption was blended in
+static DRAM_ATTR uint8_t           l_directBrightness   = 255;                      // The brightness the next frame goes out at
+static DRAM_ATTR uint8_t           l_directFrameIndex   = 0;
+static DRAM_ATTR SemaphoreHandle_t l_semPresentIdle     = nullptr;                  // Given when the present task can take a frame
+static DRAM_ATTR SemaphoreHandle_t l_semBufferFree      = nullptr;                  // Given by the refresh as it lets a DMA buffer go
+
+static constexpr int kShiftR1 = __builtin_ctz(BIT_R1);
+static constexpr int kShiftG1 = __builtin_ctz(BIT_G1);
+static constexpr int kShiftB1 = __builtin_ctz(BIT_B1);
+static constexpr int kShiftR2 = __builtin_ctz(BIT_R2);
+static constexpr int kShiftG2 = __builtin_ctz(BIT_G2);
+static constexpr int kShiftB2 = __builtin_ctz(BIT_B2);
+
+// BuildPlaneSpread
+//
+// With the dither stage the pixels already have their gamma, so then the table only spreads them
+
+static void BuildPlaneSpread()
+{
+    const float gamma = ENABLE_MATRIX_DITHER ? 1.0f : MATRIX_DIRECT_GAMMA;
+
+    for (int i = 0; i < 256; i++)
+    {
+        uint8_t level = (uint8_t) (powf(i / 255.0f, gamma) * 255.0f + 0.5f);
+        uint64_t spread = 0;
+        for (int plane = 0; plane < kDirectPlanes; plane++)
+            if (level & (1 << plane))
+                spread |= 1ULL << (plane * 8);
+        l_planeSpread[i] = spread;
+    }
+}
+
+// BuildControlWords
+//
+// What SmartMatrix's calc sets for each clock: output enable goes off for the first clock, to hide the change of
+// row, and for the last, where the latch is.  The planes the refresh shows for longer, and the first, which is
+// clocked in while the last row's top plane is lit, are lit for the brightness's share of the clocks.  The ones up
+// to the transition bit are shown once each, and so are lit for half as long for every plane they are below it.
+
+static void BuildControlWords(uint8_t brightness, int transitionBit)
+{
+    const int litClocks = brightness * kPixelsPerLatch / 255;
+
+    for (int plane = 0; plane < kDirectPlanes; plane++)
+    {
+        for (int clock = 0; clock < kPixelsPerLatch; clock++)
+        {
+            uint16_t word = 0;
+
+            if (clock == 0)
+                word |= BIT_OE;
+            if (clock == kPixelsPerLatch - 1)
+                word |= BIT_LAT | BIT_OE;
+
+            if ((plane > transitionBit || plane == 0) && clock >= litClocks)
+                word |= BIT_OE;
+            if (plane && plane <= transitionBit && clock >= (litClocks >> (transitionBit - plane + 1)))
+                word |= BIT_OE;
+
+            l_controlWords[plane][clock] = word;
+        }
+    }
+
+    l_controlBrightness = brightness;
+    l_controlTransition = transitionBit;
+}
+
+static inline uint16_t AddressBits(int row)
+{
+    return ((row & 0x01) ? BIT_A : 0) | ((row & 0x02) ? BIT_B : 0) | ((row & 0x04) ? BIT_C : 0) |
+           ((row & 0x08) ? BIT_D : 0) | ((row & 0x10) ? BIT_E : 0);
+}
+
+// PackFrame
+//
+// Fills a DMA frame from the pixels, each scan row with the pixels of its row in the top and bottom half
+
+static void IRAM_ATTR PackFrame(MatrixRefresh::frameStruct * pFrame, const CRGB * pPixels)
+{
+    constexpr bool bReversed = (LEDMatrixGFX::kMatrixOptions & SMARTMATRIX_OPTIONS_C_SHAPE_STACKING) != 0;
+
+    for (int row = 0; row < kDirectRows; row++)
+    {
+        const CRGB * pTop    = pPixels + row * MATRIX_WIDTH;
+        const CRGB * pBottom = pPixels + (row + kDirectRows) * MATRIX_WIDTH;
+        auto & rowData = pFrame->rowdata[row];
+
+        // The first plane goes out while the row before is still lit, so it carries that row's address
+
+        const uint16_t address         = AddressBits(row);
+        const uint16_t previousAddress = AddressBits((row + kDirectRows - 1) % kDirectRows);
+
+        for (int clock = 0; clock < kPixelsPerLatch; clock++)
+        {
+            const int x = bReversed ? kPixelsPerLatch - 1 - clock : clock;
+            const CRGB & top    = pTop[x];
+            const CRGB & bottom = pBottom[x];
+
+            const uint64_t bits = (l_planeSpread[top.r]    << kShiftR1) | (l_planeSpread[top.g]    << kShiftG1) |
+                                  (l_planeSpread[top.b]    << kShiftB1) | (l_planeSpread[bottom.r] << kShiftR2) |
+                                  (l_planeSpread[bottom.g] << kShiftG2) | (l_planeSpread[bottom.b] << kShiftB2);
+
+            const int index = clock ^ 1;
+            rowData.rowbits[0].data[index] = l_controlWords[0][clock] | previousAddress | (uint8_t) bits;
+            for (int plane = 1; plane < kDirectPlanes; plane++)
+                rowData.rowbits[plane].data[index] = l_controlWords[plane][clock] | address | (uint8_t) (bits >> (plane * 8));
+        }
+    }
+}
+
+// OnFrameBufferFree
+//
+// Takes the place of the calc task's callback, so the refresh wakes the present task instead
 
-            titleLayer.setChromaKeyColor(chromaKeyColor);
-            titleLayer.setFont(font6x10);
-            titleLayer.fillScreen(chromaKeyColor);
+static void IRAM_ATTR OnFrameBufferFree()
+{
+    if (xPortInIsrContext())
+    {
+        BaseType_t bWoken = pdFALSE;
+        xSemaphoreGiveFromISR(l_semBufferFree, &bWoken);
+        if (bWoken)
+            portYIELD_FROM_ISR();
+    }
+    else
+    {
+        xSemaphoreGive(l_semBufferFree);
+    }
+}
 
-            const size_t kCharWidth = 6;
-            const size_t kCharHeight = 10;
+// StartDirectOutput
+//
+// Called once the matrix is running and has shown its splash, which still went through the calc task.  The
+// semaphores are made here rather than as statics are initialized, when FreeRTOS may not be ready for them; the
+// present task has nothing to do until the first frame is handed over, which can only come after this.
+
+static void StartDirectOutput()
+{
+    const size_t cbFrame = sizeof(CRGB) * MATRIX_WIDTH * MATRIX_HEIGHT;
+
+    l_pStagedFrame = (CRGB *) heap_caps_malloc(cbFrame, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (!l_pStagedFrame)
+        l_pStagedFrame = (CRGB *) malloc(cbFrame);
+    if (!l_pStagedFrame)
+        throw std::runtime_error("Unable to allocate the frame for the direct matrix output");
+
+    l_semPresentIdle = xSemaphoreCreateBinary();
+    l_semBufferFree  = xSemaphoreCreateBinary();
+    if (!l_semPresentIdle || !l_semBufferFree)
+        throw std::runtime_error("Unable to create the semaphores for the direct matrix output");
+    xSemaphoreGive(l_semPresentIdle);
+
+    BuildPlaneSpread();
+    MatrixRefresh::setMatrixCalculationsCallback(OnFrameBufferFree);
+}
+
+void LEDMatrixGFX::SetDirectBrightness(uint8_t brightness)
+{
+    l_directBrightness = brightness;
+}
 
-            const auto caption = pMatrix->GetCaption();
+// Even a frame that hasn't changed has to be packed again if it's to go out at another brightness, or with the
+// caption faded further
 
-            int y = MATRIX_HEIGHT - 2 - kCharHeight;
-            int w = caption.length() * kCharWidth;
-            int x = (MATRIX_WIDTH / 2) - (w / 2) + 1;
+bool LEDMatrixGFX::DirectFrameNeeded()
+{
+    return l_directBrightness != l_stagedBrightness || (l_bCaptionShown ? l_captionBrightness : 0) != l_stagedCaption;
+}
+
+// A SmartMatrix layer look-alike that TextRaster can draw on, which blends the caption into the staged frame
+
+struct CaptionBlender
+{
+    CRGB *  pFrame;
+    uint8_t amount;
+
+    void drawPixel(int16_t x, int16_t y, const CRGB & color)
+    {
+        if (x >= 0 && x < MATRIX_WIDTH && y >= 0 && y < MATRIX_HEIGHT)
+            nblend(pFrame[y * MATRIX_WIDTH + x], color, amount);
+    }
+};
+
+// HandOverDirectFrame
+//
+// Waits for the present task to be done with the last frame, and gives it this one
+
+static void HandOverDirectFrame(const CRGB * pLeds)
+{
+    {
+        TIME_STAGE(PresentWait);
+        xSemaphoreTake(l_semPresentIdle, portMAX_DELAY);
+    }
+
+    memcpy(l_pStagedFrame, pLeds, sizeof(CRGB) * MATRIX_WIDTH * MATRIX_HEIGHT);
+
+    l_stagedCaption = l_bCaptionShown ? l_captionBrightness : 0;
+    if (l_stagedCaption > 0)
+    {
+        CaptionBlender blender = { l_pStagedFrame, (uint8_t) l_captionBrightness };
+        int y = MATRIX_HEIGHT - 2 - l_captionText.Height();
+        int x = (MATRIX_WIDTH / 2) - (l_captionText.Width() / 2) + 1;
+        l_captionText.Draw(blender, x, y, CRGB(CRGB::White), CRGB(CRGB::Black));
+    }
+
+    l_stagedBrightness = l_directBrightness;
+
+    #if ENABLE_AUDIO && ENABLE_AUDIO_LATENCY
+        g_AudioLatency.FrameHandedOver();
+    #endif
+
+    g_ptrSystem->TaskManager().NotifyPresentThread();
+}
+
+// PresentTaskEntry
+//
+// Packs each frame the draw loop hands over into the next DMA buffer once the refresh has one free, as the calc
+// task would have, and flips the refresh over to it
+
+void IRAM_ATTR PresentTaskEntry(void *)
+{
+    for (;;)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
 
-            auto szCaption = caption.c_str();
-            titleLayer.drawString(x - 1, y, shadowColor, szCaption);
-            titleLayer.drawString(x + 1, y, shadowColor, szCaption);
-            titleLayer.drawString(x, y - 1, shadowColor, szCaption);
-            titleLayer.drawString(x, y + 1, shadowColor, szCaption);
-            titleLayer.drawString(x, y, titleColor, szCaption);
+        // The wait times out so a wake-up that was missed only costs a few milliseconds
 
-            // We enable the chromakey overlay just for the strip of screen where it appears.  This support is only
-            // present in the private fork of SmartMatrix that is linked to the mesermizer project.
+        while (!MatrixRefresh::isFrameBufferFree())
+            xSemaphoreTake(l_semBufferFree, pdMS_TO_TICKS(5));
 
-            titleLayer.swapBuffers(false);
-            titleLayer.enableChromaKey(true, y, y + kCharHeight);
-            titleLayer.setBrightness(brite); // 255 would obscure it entirely
+        int transitionBit = MatrixRefresh::getLsbMsbTransitionBit();
+        if (l_stagedBrightness != l_controlBrightness || transitionBit != l_controlTransition)
+            BuildControlWords(l_stagedBrightness, transitionBit);
+
+        PackFrame(MatrixRefresh::getNextFrameBufferPtr(), l_pStagedFrame);
+        MatrixRefresh::writeFrameBuffer(l_directFrameIndex);
+        l_directFrameIndex ^= 1;
+
+        #if ENABLE_AUDIO && ENABLE_AUDIO_LATENCY
+            g_AudioLatency.FrameShown();
+        #endif
+
+        xSemaphoreGive(l_semPresentIdle);
+    }
+}
+
+#endif
+
+#if ENABLE_DIRTY_TRACKING
+
+// LEDMatrixGFX::FrameHasDamage
+//
+// Compares the rows that may have changed against the last frame we swapped forward, and brings that copy up to
+// date.  Info screens like the clock or subscriber count redraw the same pixels most frames, and this is how
+// we notice.  If the effect only draws through the primitives, we only look inside the dirty region they kept.
+
+bool LEDMatrixGFX::FrameHasDamage(bool bTrustDirtyRegion)
+{
+    const size_t cbFrame = sizeof(CRGB) * _width * _height;
+
+    if (!_pLastFrame)
+    {
+        _pLastFrame = (CRGB *) heap_caps_malloc(cbFrame, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+        if (_pLastFrame)
+        {
+            memcpy(_pLastFrame, leds, cbFrame);
+            _lastFrameSums = ChannelSums();
+            _lastFrameSums.Add(_pLastFrame, _width * _height);
         }
-        else
+        return true;                                                                    // Without a copy to compare to, it's all damage
+    }
+
+    int16_t x0 = 0, y0 = 0, x1 = _width - 1, y1 = _height - 1;
+
+    if (bTrustDirtyRegion)
+    {
+        const auto & region = GetDirtyRegion();
+        if (region.IsEmpty())
+            return false;
+
+        x0 = std::max(x0, region.x0);
+        y0 = std::max(y0, region.y0);
+        x1 = std::min(x1, region.x1);
+        y1 = std::min(y1, region.y1);
+    }
+
+    bool bDamaged = false;
+    const size_t cbSpan = sizeof(CRGB) * (x1 - x0 + 1);
+
+    for (int y = y0; y <= y1; y++)
+    {
+        auto pCurrent = leds + y * _width + x0;
+        auto pLast    = _pLastFrame + y * _width + x0;
+
+        if (memcmp(pCurrent, pLast, cbSpan))
         {
-            titleLayer.enableChromaKey(false);
-            titleLayer.setBrightness(0);
+            // Swap the row's contribution to the power estimate for its new one as we copy it
+
+            _lastFrameSums.Subtract(pLast, x1 - x0 + 1);
+            _lastFrameSums.Add(pCurrent, x1 - x0 + 1);
+            memcpy(pLast, pCurrent, cbSpan);
+            bDamaged = true;
         }
     }
+    return bDamaged;
 }
 
+#endif
+
 // PostProcessFrame
 //
 // Things we do with the matrix after rendering a frame, such as setting the brightness and swapping the backbuffer forward
@@ -155,16 +676,38 @@ void LEDMatrixGFX::PostProcessFrame(uint16_t localPixelsDrawn, uint16_t wifiPixe
     if ((localPixelsDrawn + wifiPixelsDrawn) == 0)
         return;
 
-    auto pMatrix = std::static_pointer_cast<LEDMatrixGFX>(g_ptrSystem->EffectManager().g());
+    auto& effectManager = g_ptrSystem->EffectManager();
+    auto pMatrix = static_cast<LEDMatrixGFX *>(effectManager.g().get());
+
+    // A frame that's identical to the last one doesn't need its power estimated again or to be swapped forward
+
+    #if ENABLE_DIRTY_TRACKING
+        bool bTrustDirtyRegion = (wifiPixelsDrawn == 0) && effectManager.GetCurrentEffect().DrawsOnlyWithPrimitives();
+        bool bDamaged = pMatrix->FrameHasDamage(bTrustDirtyRegion);
+        pMatrix->ResetDirtyRegion();
+    #else
+        constexpr bool bDamaged = true;
+    #endif
 
     constexpr auto kCaptionPower = 500;                                                 // A guess as the power the caption will consume
-    g_Values.MatrixPowerMilliwatts = pMatrix->EstimatePowerDraw();                             // What our drawn pixels will consume
+    {
+        TIME_STAGE(PowerEstimate);
+        #if ENABLE_DIRTY_TRACKING
+            if (bDamaged)
+                pMatrix->_lastPowerDraw = pMatrix->EstimatePowerDraw();
+            g_Values.MatrixPowerMilliwatts = pMatrix->_lastPowerDraw;
+        #else
+            g_Values.MatrixPowerMilliwatts = pMatrix->EstimatePowerDraw();                     // What our drawn pixels will consume
+        #endif
+    }
 
     if (pMatrix->GetCaptionTransparency() > 0)
         g_Values.MatrixPowerMilliwatts += kCaptionPower;
 
-    const double kMaxPower = g_ptrSystem->DeviceConfig().GetPowerLimit();
-    uint8_t scaledBrightness = std::clamp(kMaxPower / g_Values.MatrixPowerMilliwatts, 0.0, 1.0) * 255;
+    // Only the part of the load that comes from the pixels dims with them, so the board's own draw is left out
+
+    const uint32_t kMaxPower = g_ptrSystem->DeviceConfig().GetPowerLimit();
+    uint8_t scaledBrightness = kPowerModel.LimitScale(g_Values.MatrixPowerMilliwatts, NUM_LEDS, 255, kMaxPower);
 
     // If the target brightness is lower than current, we drop to it immediately, but if its higher, we ramp the brightness back in
     // somewhat slowly to avoid flicker.  We do this by using a weighted average of the current and former brightness.  To avoid
@@ -183,9 +726,50 @@ void LEDMatrixGFX::PostProcessFrame(uint16_t localPixelsDrawn, uint16_t wifiPixe
     auto targetBrightness = min({ g_ptrSystem->DeviceConfig().GetBrightness(), g_Values.Fader, g_Values.MatrixScaledBrightness });
 
     debugV("MW: %d, Setting Scaled Brightness to: %d", g_Values.MatrixPowerMilliwatts, targetBrightness);
-    pMatrix->SetBrightness(targetBrightness);
 
-    MatrixSwapBuffers((wifiPixelsDrawn == 0) && (g_ptrSystem->EffectManager().GetCurrentEffect().RequiresDoubleBuffering() || pMatrix->GetCaptionTransparency() > 0.0));
+    // With dithering, the brightness goes into the pixels on the way out and the panel itself stays at full.  The
+    // dither moves every frame, so in that case even an unchanged frame has to be swapped forward.
+
+    #if ENABLE_MATRIX_DITHER
+        pMatrix->SetBrightness(255);
+        pMatrix->ApplyOutputStage(targetBrightness);
+        bool bMustSwap = true;
+    #else
+        pMatrix->SetBrightness(targetBrightness);
+        bool bMustSwap = false;
+    #endif
+
+    #if ENABLE_MATRIX_DIRECT_OUTPUT
+        bMustSwap = bMustSwap || DirectFrameNeeded();
+    #endif
+
+    TIME_STAGE(Present);
+    if (bDamaged || bMustSwap)
+    {
+        bool bSwapBackground = (wifiPixelsDrawn == 0) && (effectManager.GetCurrentEffect().RequiresDoubleBuffering() || pMatrix->GetCaptionTransparency() > 0.0);
+        MatrixSwapBuffers(bSwapBackground);
+
+        // The direct output hands the frame over and shows it on the present task, which notes the times itself
+
+        #if ENABLE_AUDIO && ENABLE_AUDIO_LATENCY && !ENABLE_MATRIX_DIRECT_OUTPUT
+            g_AudioLatency.FrameHandedOver();
+            g_AudioLatency.FrameShown();
+        #endif
+
+        // The swap copied the processed frame back for the effect to carry on from, so hand it the original instead.
+        // The direct output never swaps, so there the processed frame is still in the back buffer.
+
+        #if ENABLE_MATRIX_DITHER
+            if (bSwapBackground || ENABLE_MATRIX_DIRECT_OUTPUT)
+                pMatrix->RestoreCleanFrame();
+        #endif
+
+        g_Values.FramesShown++;
+    }
+    else
+    {
+        g_Values.FramesSkipped++;
+    }
 
     FastLED.countFPS();
 }
@@ -202,11 +786,23 @@ void LEDMatrixGFX::MatrixSwapBuffers(bool bSwapBackground)
 {
     // If an effect redraws itself entirely ever frame, it can skip saving the most recent buffer, so
     // can swap without waiting for a copy.
-    matrix.setCalcRefreshRateDivider(MATRIX_CALC_DIVIDER);
-    matrix.setRefreshRate(MATRIX_REFRESH_RATE);
-    matrix.setMaxCalculationCpuPercentage(95);
 
-    backgroundLayer.swapBuffers(bSwapBackground);
+    #if ENABLE_MATRIX_AUTOTUNE
+        EVERY_N_MILLIS(MATRIX_AUTOTUNE_INTERVAL)
+        {
+            TuneRefreshSettings();
+        }
+    #endif
+    ApplyRefreshSettings();
+
+    // The direct output draws in the back buffer for good, as only the calc task could swap it, so the effects
+    // always find their last frame there whatever they asked for
+
+    #if ENABLE_MATRIX_DIRECT_OUTPUT
+        HandOverDirectFrame((const CRGB *) backgroundLayer.getRealBackBuffer());
+    #else
+        backgroundLayer.swapBuffers(bSwapBackground);
+    #endif
 }
 
 #endif
@@ -33,4 +33,9 @@
 #include "types.h"
 #include "ledstripeffect.h"
 
-std::vector<SettingSpec, psram_allocator<SettingSpec>> LEDStripEffect::_baseSettingSpecs = {};
\ No newline at end of file
+std::vector<SettingSpec, psram_allocator<SettingSpec>> LEDStripEffect::_baseSettingSpecs = {};
+
+#if ENABLE_EFFECT_MEMORY_ACCOUNTING
+    thread_local EffectMemoryAccount * g_pEffectMemoryAccount = nullptr;
+    thread_local bool g_bConstructingEffect = false;
+#endif
\ No newline at end of file
@@ -29,9 +29,175 @@
 //---------------------------------------------------------------------------
 
 #include "globals.h"
+#include "audiolatency.h"
 #include "ledstripgfx.h"
 #include "systemcontainer.h"
 
+#if ENABLE_PIPELINED_PRESENT
+
+// With the pipelined present, the draw loop only hands each finished frame over, and the present task on the
+// other core does the brightness scaling, power estimate and FastLED.show() while the next frame is rendered.
+// Each channel has a second pixel array that belongs to the present task, and that's what FastLED is pointed at.
+
+static DRAM_ATTR SemaphoreHandle_t l_semPresentIdle  = xSemaphoreCreateBinary();  // Given when the present task can take a frame
+static DRAM_ATTR uint16_t          l_pixelsToPresent = 0;
+
+#endif
+
+// The channel totals of the frame being shown, which the pipelined present works out as it copies the frame over
+
+static DRAM_ATTR GFXBase::ChannelSums l_channelSums[NUM_CHANNELS];
+
+#ifdef POWER_SUPPLY_LIMIT_MW
+
+// The color correction each channel had before the supply limit was laid over it, and what ShowFrame last set.  A
+// correction that's changed since ShowFrame set it was set by someone else, so it's taken as the new one to build on.
+
+static DRAM_ATTR CRGB l_baseCorrection[NUM_CHANNELS];
+static DRAM_ATTR CRGB l_supplyCorrection[NUM_CHANNELS];
+static DRAM_ATTR bool l_bCorrectionsTaken = false;
+
+#endif
+
+#if ENABLE_SKIP_UNCHANGED_FRAMES
+
+// The fingerprint of the last frame sent out, with the scale it went at, and when that was
+
+static DRAM_ATTR uint32_t      l_lastShownFingerprint = 0;
+static DRAM_ATTR unsigned long l_msLastShown          = 0;
+static DRAM_ATTR bool          l_bShownOnce           = false;
+
+#endif
+
+// ShowFrame
+//
+// Shows and measures whatever the FastLED channels are currently pointed at.  The brightness setting, the fader and
+// the power limit come together in one scale that FastLED applies as it sends the pixels out, so the pixels
+// themselves are left as they were, and the effects that build on the last frame don't see it darkened.  With the
+// pipelined present, the scale is applied to the present task's own copy instead.  Effects shouldn't call
+// FastLED.show() themselves, as nothing would hold what they show to the limit.
+//
+// With POWER_SUPPLY_LIMIT_MW, each group of POWER_SUPPLY_CHANNELS channels is held to its own supply's limit as
+// well.  That part goes through each channel's color correction, as FastLED only takes the one scale for all, and
+// is laid over whatever correction the channel already had.  Brite then reports the most limited supply's scale.
+//
+// With ENABLE_SKIP_UNCHANGED_FRAMES, a frame whose pixels and scale are the same as the last one sent isn't sent
+// again, which leaves the RMT and the CPU to the network, other than every UNCHANGED_FRAME_REFRESH_MS.  The pixels
+// are fingerprinted in the pass that adds them up for the power estimate, so telling costs no walk of its own.
+
+static void ShowFrame(bool bSumsReady)
+{
+    const auto & model = LEDStripGFX::kPowerModel;
+    uint8_t scale = scale8_video(g_ptrSystem->DeviceConfig().GetBrightness(), g_Values.Fader);
+    uint8_t firstScale;
+    [[maybe_unused]] uint32_t fingerprint;
+
+    {
+        TIME_STAGE(PowerEstimate);
+
+        GFXBase::ChannelSums sums;
+        size_t cPixels = 0;
+        for (int i = 0; i < NUM_CHANNELS; i++)
+        {
+            if (!bSumsReady)
+            {
+                l_channelSums[i] = GFXBase::ChannelSums();
+                l_channelSums[i].Add(FastLED[i].leds(), FastLED[i].size());
+            }
+            sums.Add(l_channelSums[i]);
+            cPixels += FastLED[i].size();
+        }
+
+        #ifdef POWER_LIMIT_MW
+            scale = model.LimitScale(model.Milliwatts(sums, cPixels), cPixels, scale, POWER_LIMIT_MW);
+        #endif
+
+        firstScale = scale;
+
+        #ifdef POWER_SUPPLY_LIMIT_MW
+            uint8_t lowestScale = scale;
+
+            for (int supply = 0; supply < NUM_CHANNELS; supply += POWER_SUPPLY_CHANNELS)
+            {
+                GFXBase::ChannelSums supplySums;
+                size_t cSupplyPixels = 0;
+                for (int i = supply; i < std::min(supply + POWER_SUPPLY_CHANNELS, NUM_CHANNELS); i++)
+                {
+                    supplySums.Add(l_channelSums[i]);
+                    cSupplyPixels += FastLED[i].size();
+                }
+
+                uint8_t supplyScale = model.LimitScale(model.Milliwatts(supplySums, cSupplyPixels), cSupplyPixels, scale, POWER_SUPPLY_LIMIT_MW);
+                uint8_t correction  = scale ? supplyScale * 255 / scale : 255;
+                for (int i = supply; i < std::min(supply + POWER_SUPPLY_CHANNELS, NUM_CHANNELS); i++)
+                {
+                    CRGB current = FastLED[i].getCorrection();
+                    if (!l_bCorrectionsTaken || current != l_supplyCorrection[i])
+                        l_baseCorrection[i] = current;
+
+                    l_supplyCorrection[i] = CRGB(scale8(l_baseCorrection[i].r, correction),
+                                                 scale8(l_baseCorrection[i].g, correction),
+                                                 scale8(l_baseCorrection[i].b, correction));
+                    FastLED[i].setCorrection(l_supplyCorrection[i]);
+                }
+
+                if (supply == 0)
+                    firstScale = supplyScale;
+                lowestScale = std::min(lowestScale, supplyScale);
+            }
+            l_bCorrectionsTaken = true;
+
+            g_Values.Brite = 100.0 * lowestScale / 255;
+        #else
+            g_Values.Brite = 100.0 * scale / 255;
+        #endif
+
+        g_Values.Watts = model.ScaledMilliwatts(l_channelSums[0], FastLED[0].size(), firstScale) / 1000; // 1000 for mw->W
+
+        fingerprint = GFXBase::ChannelSums::Fingerprint(GFXBase::ChannelSums::Fingerprint(sums.fingerprint, scale), cPixels);
+    }
+
+    #if ENABLE_SKIP_UNCHANGED_FRAMES
+        unsigned long msNow = millis();
+
+        if (l_bShownOnce && fingerprint == l_lastShownFingerprint && msNow - l_msLastShown < UNCHANGED_FRAME_REFRESH_MS)
+        {
+            g_Values.FramesSkipped++;
+            FastLED.countFPS();                     // The frame still counts; it just didn't need sending
+            g_Values.FPS = FastLED.getFPS();
+            return;
+        }
+
+        l_lastShownFingerprint = fingerprint;
+        l_msLastShown          = msNow;
+        l_bShownOnce           = true;
+    #endif
+
+    {
+        TIME_STAGE(Present);
+
+        // The present task's copy is its own to scale, and nscale8_video keeps the dimmest pixels lit where FastLED's
+        // scale would round them off.  Without the pipeline the pixels are the effect's, so FastLED has to scale them.
+
+        #if ENABLE_PIPELINED_PRESENT
+            auto& effectManager = g_ptrSystem->EffectManager();
+            for (int i = 0; i < NUM_CHANNELS; i++)
+                nscale8_video(std::static_pointer_cast<LEDStripGFX>(effectManager.g(i))->PresentLeds(), FastLED[i].size(), scale);
+            FastLED.show(255); //Shows the pixels
+        #else
+            FastLED.show(scale); //Shows the pixels
+        #endif
+    }
+
+    #if ENABLE_AUDIO && ENABLE_AUDIO_LATENCY
+        g_AudioLatency.FrameShown();
+    #endif
+
+    g_Values.FramesShown++;
+
+    g_Values.FPS = FastLED.getFPS();
+}
+
 void LEDStripGFX::PostProcessFrame(uint16_t localPixelsDrawn, uint16_t wifiPixelsDrawn)
 {
     auto pixelsDrawn = wifiPixelsDrawn > 0 ? wifiPixelsDrawn : localPixelsDrawn;
@@ -53,18 +219,66 @@ void LEDStripGFX::PostProcessFrame(uint16_t localPixelsDrawn, uint16_t wifiPixel
 
     auto& effectManager = g_ptrSystem->EffectManager();
 
-    for (int i = 0; i < NUM_CHANNELS; i++)
-    {
-        FastLED[i].setLeds(effectManager.g(i)->leds, pixelsDrawn);
-        fadeLightBy(FastLED[i].leds(), FastLED[i].size(), 255 - g_ptrSystem->DeviceConfig().GetBrightness());
-    }
-    FastLED.show(g_Values.Fader); //Shows the pixels
+    #if ENABLE_PIPELINED_PRESENT
+
+        // Wait for the present task to be done with the last frame, then copy this one over and let it go; the copy
+        // leaves our own leds untouched, as effects build each frame on top of the last
+
+        {
+            TIME_STAGE(PresentWait);
+            xSemaphoreTake(l_semPresentIdle, portMAX_DELAY);
+        }
+
+        for (int i = 0; i < NUM_CHANNELS; i++)
+        {
+            auto pStrip = std::static_pointer_cast<LEDStripGFX>(effectManager.g(i));
+            l_channelSums[i] = GFXBase::ChannelSums();
+            l_channelSums[i].AddCopy(pStrip->PresentLeds(), pStrip->leds, std::min<size_t>(pixelsDrawn, pStrip->GetLEDCount()));
+        }
+        l_pixelsToPresent = pixelsDrawn;
+
+        #if ENABLE_AUDIO && ENABLE_AUDIO_LATENCY
+            g_AudioLatency.FrameHandedOver();
+        #endif
+
+        g_ptrSystem->TaskManager().NotifyPresentThread();
 
-    g_Values.FPS = FastLED.getFPS();
-    #ifdef POWER_LIMIT_MW
-        g_Values.Brite = 100.0 * calculate_max_brightness_for_power_mW(g_ptrSystem->DeviceConfig().GetBrightness(), POWER_LIMIT_MW) / 255;
     #else
-        g_Values.Brite = 100.0 * g_ptrSystem->DeviceConfig().GetBrightness() / 255;
+
+        for (int i = 0; i < NUM_CHANNELS; i++)
+            FastLED[i].setLeds(effectManager.g(i)->leds, pixelsDrawn);
+
+        #if ENABLE_AUDIO && ENABLE_AUDIO_LATENCY
+            g_AudioLatency.FrameHandedOver();
+        #endif
+
+        ShowFrame(false);
+
     #endif
-    g_Values.Watts = calculate_unscaled_power_mW(effectManager.g()->leds, pixelsDrawn) / 1000; // 1000 for mw->W
 }
+
+#if ENABLE_PIPELINED_PRESENT
+
+// PresentTaskEntry
+//
+// Shows each frame the draw loop hands over, then signals that it's ready for the next one
+
+void IRAM_ATTR PresentTaskEntry(void *)
+{
+    xSemaphoreGive(l_semPresentIdle);
+
+    for (;;)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        auto& effectManager = g_ptrSystem->EffectManager();
+        for (int i = 0; i < NUM_CHANNELS; i++)
+            FastLED[i].setLeds(std::static_pointer_cast<LEDStripGFX>(effectManager.g(i))->PresentLeds(), l_pixelsToPresent);
+
+        ShowFrame(true);
+
+        xSemaphoreGive(l_semPresentIdle);
+    }
+}
+
+#endif
@@ -164,6 +164,7 @@
 #include "soundanalyzer.h"
 #include "values.h"
 #include "improvserial.h"                       // ImprovSerial impl for setting WiFi credentials over the serial port
+#include "storage.h"
 #include <TJpg_Decoder.h>
 
 #if defined(TOGGLE_BUTTON_1) || defined(TOGGLE_BUTTON_2)
@@ -180,7 +181,41 @@ std::unique_ptr<SystemContainer> g_ptrSystem;
 Values g_Values;
 SoundAnalyzer g_Analyzer;
 RemoteDebug Debug;                                                        // Instance of our telnet debug server
-std::mutex g_buffer_mutex;
+std::mutex g_buffer_mutex;                                                // Serializes producers adding frames to the LED buffer rings
+
+#if ENABLE_FRAME_TIMING
+DRAM_ATTR FrameTiming g_FrameTiming;                                      // Per-stage timing histograms for /statistics
+#endif
+
+#if ENABLE_STALL_WATCH
+StallWatch g_StallWatch;                                                  // The frames and lock waits that ran far over, for /stalls
+#endif
+
+#if ENABLE_TRACING
+Tracer g_Tracer;                                                          // Spans of the tasks' work, for /trace
+#endif
+
+#if ENABLE_GOVERNOR
+Governor g_Governor;                                                      // Holds the frame rate and clock down when nothing needs them
+#endif
+
+#if ENABLE_AUDIO && ENABLE_AUDIO_LATENCY
+AudioLatency g_AudioLatency;                                              // How long the sound takes to become light
+#endif
+
+BootTiming g_BootTiming;                                                  // When each stage of setup() finished
+ParallelFor g_ParallelFor;                                                // Shares the heaviest drawing loops with the other core
+ScratchArena g_DrawScratch(DRAW_SCRATCH_SIZE, "draw scratch");           // Per-frame buffers for the draw task
+MemoryPool g_JsonPool("json", JSON_POOL_BLOCK_SIZE, JSON_POOL_BLOCKS);    // Blocks set aside for JSON documents
+HeapMonitor g_HeapMonitor;                                                // Watches the heap break up over time
+EffectWorkerPool g_EffectWorkers;                                         // Runs the effects' background work
+MemoryPlacementReport g_MemoryPlacement;                                  // Where the hot and cold buffers ended up
+ErrorCounters g_ErrorCounters;                                            // The errors the hot paths recovered from
+IngestStats g_IngestStats;                                                // What became of the frames that came in over the wire
+
+#if ENABLE_METRICS
+Metrics g_Metrics;                                                        // Timing histograms for /metrics and StatsD
+#endif
 
 // The one and only instance of ImprovSerial.  We instantiate it as the type needed
 // for the serial port on this module.  That's usually HardwareSerial but can be
@@ -221,6 +256,9 @@ void PrintOutputHeader()
     debugI("Version %u: Wifi SSID: \"%s\" - ESP32 Free Memory: %u, PSRAM:%u, PSRAM Free: %u",
             FLASH_VERSION, cszSSID, ESP.getFreeHeap(), ESP.getPsramSize(), ESP.getFreePsram());
     debugI("ESP32 Clock Freq : %d MHz", ESP.getCpuFreqMHz());
+
+    if (g_BootTiming.IsDone(BootStage::Core))
+        debugI("Boot stages: %s", g_BootTiming.ToString().c_str());
 }
 
 // TerminateHandler
@@ -253,6 +291,139 @@ Bounce2::Button Button1;
 Bounce2::Button Button2;
 #endif
 
+// SetupNetwork
+//
+// The last stage of startup: WiFi, Improv, the socket and web servers, and the tasks that go with them.  None of
+// it is needed to draw local effects, so with ENABLE_FAST_BOOT it runs on the boot task while they already show.
+
+void SetupNetwork()
+{
+    auto& taskManager = g_ptrSystem->TaskManager();
+
+    #if ENABLE_WIFI
+        String WiFi_ssid;
+        String WiFi_password;
+
+        // Read the WiFi crendentials from NVS.  If it fails, writes the defaults based on secrets.h
+
+        if (!ReadWiFiConfig(WiFi_ssid, WiFi_password))
+        {
+            debugW("Could not read WiFI Credentials");
+            WiFi_ssid     = cszSSID;
+            WiFi_password = cszPassword;
+            if (!WriteWiFiConfig(WiFi_ssid, WiFi_password))
+                debugW("Could not even write defaults to WiFi Credentials");
+        }
+        else if (WiFi_ssid.length() == 0)
+        {
+            WiFi_ssid     = cszSSID;
+            WiFi_password = cszPassword;
+        }
+
+        // This chip alone is special-cased by Improv, so we pull it
+        // from build flags. CONFIG_IDF_TARGET will be "esp32s3".
+        #if CONFIG_IDF_TARGET_ESP32S3
+            String family = "ESP32-S3";
+        #else
+            String family = "ESP32";
+        #endif
+
+        debugW("Starting ImprovSerial for %s", family.c_str());
+        String name = "NDESP32" + get_mac_address().substring(6);
+        g_pImprovSerial = make_unique_psram<ImprovSerial<typeof(Serial)>>();
+        g_pImprovSerial->setup(PROJECT_NAME, FLASH_VERSION_NAME, family, name.c_str(), &Serial);
+
+    #endif
+
+    #if INCOMING_WIFI_ENABLED
+        g_ptrSystem->SetupSocketServer(NetworkPort::IncomingWiFi, NUM_LEDS);  // $C000 is free RAM on the C64, fwiw!
+    #endif
+
+    #if ENABLE_UDP_INGEST
+        g_ptrSystem->SetupUDPServer(NetworkPort::IncomingUDP);
+    #endif
+
+    #if ENABLE_DMX_INGEST
+        g_ptrSystem->SetupDMXServer();
+    #endif
+
+    #if ENABLE_DDP_INGEST
+        g_ptrSystem->SetupDDPServer();
+    #endif
+
+    #if ENABLE_SHOW_PLAYBACK
+        g_ptrSystem->SetupShowPlayer();
+    #endif
+
+    #if ENABLE_SHOW_RECORDER
+        g_ptrSystem->SetupShowRecorder();
+    #endif
+
+    #if ENABLE_EFFECT_SYNC
+        g_ptrSystem->SetupEffectSync();
+    #endif
+
+    #if ENABLE_ESPNOW
+        g_ptrSystem->SetupESPNowLink();
+    #endif
+
+    #if ENABLE_WIFI && ENABLE_WEBSERVER
+        g_ptrSystem->SetupWebServer();
+
+        #if ENABLE_LIVE_STATE_SOCKET
+            // Push the live state to the web UI at a steady rate, however many browsers have it open
+            g_ptrSystem->NetworkReader().RegisterReader([] { g_ptrSystem->WebServer().PushLiveState(); }, LIVE_STATE_INTERVAL);
+        #endif
+
+        #if ENABLE_LED_PREVIEW_SOCKET
+            // Encode the LEDs for the web UI's preview on the network core, at the fastest rate any client is sent
+            g_ptrSystem->NetworkReader().RegisterReader([] { g_ptrSystem->WebServer().PushLEDPreview(); }, 1000 / LED_PREVIEW_MAX_FPS);
+        #endif
+    #endif
+
+    #if ENABLE_WIFI
+        debugI("Making initial attempt to connect to WiFi.");
+        ConnectToWiFi(WiFi_ssid, WiFi_password);
+        Debug.setSerialEnabled(true);
+    #endif
+
+    // Start the network-dependent services.  These will be NOPs on a non-wifi build.
+
+    taskManager.StartSerialThread();
+    taskManager.StartNetworkThread();
+    taskManager.StartOTAThread();
+    taskManager.StartNetworkReaderThreads();
+    taskManager.StartColorDataThread();
+    taskManager.StartSocketThread();
+    taskManager.StartUDPThread();
+    taskManager.StartDMXThread();
+    taskManager.StartDDPThread();
+    taskManager.StartShowThread();
+    taskManager.StartShowRecorderThread();
+    taskManager.StartEffectSyncThread();
+    taskManager.StartClockSyncThread();
+    taskManager.StartESPNowThread();
+
+    SaveEffectManagerConfig();
+
+    g_BootTiming.StageDone(BootStage::Network);
+    debugI("Boot stages: %s", g_BootTiming.ToString().c_str());
+}
+
+#if ENABLE_FAST_BOOT
+
+// BootTaskEntry
+//
+// Runs the network stage of startup, and then goes away
+
+void BootTaskEntry(void *)
+{
+    SetupNetwork();
+    vTaskDelete(nullptr);
+}
+
+#endif
+
 // setup
 //
 // Invoked once at boot, does initial chip setup and application initial init, then spins off worker tasks and returns
@@ -266,7 +437,15 @@ Bounce2::Button Button2;
 // RemoteLoop                   - Handles the remote control loop
 // NetworkHandlingLoopEntry     - Connects to WiFi, handles reconnects, OTA updates, web server
 // SocketServerTaskEntry        - Creates the socket and listens for incoming wifi color data
+// UDPServerTaskEntry           - Receives color data datagrams, optionally from a multicast group
+// DMXServerTaskEntry           - Receives sACN and Art-Net DMX universes and puts them together into frames
+// DDPServerTaskEntry           - Receives DDP fragments straight into the frame and commits it on the push flag
+// ShowPlaybackTaskEntry        - Plays the pre-rendered show from the show partition into the rings
+// ShowRecorderTaskEntry        - Writes the frames coming in to the show partition while a recording runs
+// EffectSyncTaskEntry          - Sends the leader's effect state to the followers, or takes it in on a follower
+// ESPNowTaskEntry              - Trades frames, effect state and audio with the other nodes over ESP-NOW
 // AudioSamplerTaskEntry        - Listens to room audio, creates spectrum analysis, beat detection, etc.
+// BootTaskEntry                - With ENABLE_FAST_BOOT, brings up the network while the effects already draw
 
 void setup()
 {
@@ -279,9 +458,9 @@ void setup()
     // Re-route debug output to the serial port
     Debug.setSerialEnabled(true);
 
-    // Intialialize SPIFFS for file access to non-volatile storage
-    if (!SPIFFS.begin(true))
-        Serial.println("WARNING: SPIFFs could not be initialized!");
+    // Intialialize the file system for access to non-volatile storage
+    if (!BeginFileSystem())
+        Serial.println("WARNING: File system could not be initialized!");
 
     // Enabling PSRAM allows us to use the extra 4MB of RAM on the ESP32-WROVER chip, but it caused
     // problems with the S3 rebooting when WiFi connected, so for now, I've limited the default
@@ -291,6 +470,15 @@ void setup()
         heap_caps_malloc_extmem_enable(96);
     #endif
 
+    // Set aside the blocks for the big allocations that come and go, before anything else can break up the heap
+    g_JsonPool.Reserve();
+
+    // The trace ring comes next, so the tasks' spans are kept from the moment they start
+
+    #if ENABLE_TRACING
+        g_Tracer.begin();
+    #endif
+
     // Initialize LZ library for decompressing compressed wifi packets
     uzlib_init();
 
@@ -321,64 +509,42 @@ void setup()
 
     ESP_ERROR_CHECK(err);
 
-    #if ENABLE_WIFI
-        String WiFi_ssid;
-        String WiFi_password;
-
-        // Read the WiFi crendentials from NVS.  If it fails, writes the defaults based on secrets.h
-
-        if (!ReadWiFiConfig(WiFi_ssid, WiFi_password))
-        {
-            debugW("Could not read WiFI Credentials");
-            WiFi_ssid     = cszSSID;
-            WiFi_password = cszPassword;
-            if (!WriteWiFiConfig(WiFi_ssid, WiFi_password))
-                debugW("Could not even write defaults to WiFi Credentials");
-        }
-        else if (WiFi_ssid.length() == 0)
-        {
-            WiFi_ssid     = cszSSID;
-            WiFi_password = cszPassword;
-        }
-
-        // This chip alone is special-cased by Improv, so we pull it
-        // from build flags. CONFIG_IDF_TARGET will be "esp32s3".
-        #if CONFIG_IDF_TARGET_ESP32S3
-            String family = "ESP32-S3";
-        #else
-            String family = "ESP32";
-        #endif
-
-        debugW("Starting ImprovSerial for %s", family.c_str());
-        String name = "NDESP32" + get_mac_address().substring(6);
-        g_pImprovSerial = make_unique_psram<ImprovSerial<typeof(Serial)>>();
-        g_pImprovSerial->setup(PROJECT_NAME, FLASH_VERSION_NAME, family, name.c_str(), &Serial);
-
-    #endif
-
     // Setup config objects
     g_ptrSystem->SetupConfig();
 
+    // The tasks started from here on are placed by the task profile the device is configured for
+    taskManager.SetTaskProfile(g_ptrSystem->DeviceConfig().GetTaskProfile());
+
     #if ENABLE_WIFI
         // We create the network reader here, so classes can register their readers from this point onwards.
         //   Note that the thread that executes the readers is started further down, along with other networking
         //   threads.
         auto & networkReader = g_ptrSystem->SetupNetworkReader();
+        g_ptrSystem->SetupHTTPService();
 
         #if ENABLE_NTP
             // Register a network reader to update the device clock at regular intervals
             networkReader.RegisterReader(UpdateNTPTime, (NTP_DELAY_ERROR_SECONDS) * 1000UL);
         #endif
-    #endif
 
-    #if INCOMING_WIFI_ENABLED
-        g_ptrSystem->SetupSocketServer(NetworkPort::IncomingWiFi, NUM_LEDS);  // $C000 is free RAM on the C64, fwiw!
-    #endif
+        #if ENABLE_MDNS
+            // One to keep the frame rate we advertise over mDNS current
+            networkReader.RegisterReader(UpdateMDNSRecords, MDNS_TXT_INTERVAL);
+        #endif
 
-    #if ENABLE_WIFI && ENABLE_WEBSERVER
-        g_ptrSystem->SetupWebServer();
+        #if ENABLE_CLOCK_SYNC
+            // And one to keep our frame clock in step with the sender's
+            networkReader.RegisterReader([] { g_ClockSync.Exchange(); }, CLOCK_SYNC_INTERVAL);
+        #endif
+
+        #if ENABLE_METRICS_STATSD
+            // And one to push the metrics to the StatsD server
+            networkReader.RegisterReader(PushStatsDMetrics, STATSD_INTERVAL);
+        #endif
     #endif
 
+    g_BootTiming.StageDone(BootStage::Core);
+
     // If we have a remote control enabled, set the direction on its input pin accordingly
 
     #if ENABLE_REMOTE
@@ -500,29 +666,35 @@ void setup()
         InitSplashEffectManager();
     #endif
 
+    g_BootTiming.StageDone(BootStage::Display);
+
+    // The assets are mapped before the effects are made, as the GIF effects look theirs up when they start
+
+    #if ENABLE_ASSET_STORE
+        g_ptrSystem->SetupAssetStore().begin();
+    #endif
+
     InitEffectsManager();
 
     // Start things that do not depend on the network
 
+    taskManager.StartPresentThread();
+    taskManager.StartParallelThread();
     taskManager.StartDrawThread();
+    taskManager.StartEffectPrepareThread();
     taskManager.StartScreenThread();
     taskManager.StartAudioThread();
     taskManager.StartRemoteThread();
 
-    #if ENABLE_WIFI
-        debugI("Making initial attempt to connect to WiFi.");
-        ConnectToWiFi(WiFi_ssid, WiFi_password);
-        Debug.setSerialEnabled(true);
-    #endif
+    g_BootTiming.StageDone(BootStage::Effects);
 
-    // Start the network-dependent services.  These will be NOPs on a non-wifi build.
-
-    taskManager.StartSerialThread();
-    taskManager.StartNetworkThread();
-    taskManager.StartColorDataThread();
-    taskManager.StartSocketThread();
+    // With fast boot, the effects are drawing by now and the rest can take its time on a task of its own
 
-    SaveEffectManagerConfig();
+    #if ENABLE_FAST_BOOT
+        taskManager.StartBootThread();
+    #else
+        SetupNetwork();
+    #endif
 }
 
 // loop - main execution loop
@@ -535,21 +707,11 @@ void loop()
     while(true)
     {
         #if ENABLE_WIFI
+            // Improv only exists once the network stage of startup is done, which with fast boot can be a while
             EVERY_N_MILLIS(20)
             {
-                g_pImprovSerial->loop();
-            }
-        #endif
-
-        #if ENABLE_OTA
-            try
-            {
-                if (WiFi.isConnected())
-                    ArduinoOTA.handle();
-            }
-            catch(const std::exception& e)
-            {
-                debugW("Exception in OTA code caught");
+                if (g_BootTiming.IsDone(BootStage::Network))
+                    g_pImprovSerial->loop();
             }
         #endif
 
@@ -557,11 +719,13 @@ void loop()
         {
             String strOutput;
 
+            g_HeapMonitor.Sample();
+
             #if ENABLE_WIFI
                 strOutput += str_sprintf("WiFi: %s, IP: %s, ", WLtoString(WiFi.status()), WiFi.localIP().toString().c_str());
             #endif
 
-            strOutput += str_sprintf("Mem: %u, LargestBlk: %u, PSRAM Free: %u/%u, ", ESP.getFreeHeap(), ESP.getMaxAllocHeap(), ESP.getFreePsram(), ESP.getPsramSize());
+            strOutput += str_sprintf("Mem: %u, LargestBlk: %u, Frag: %d%%, PSRAM Free: %u/%u, ", ESP.getFreeHeap(), ESP.getMaxAllocHeap(), g_HeapMonitor.FragmentationPercent(), ESP.getFreePsram(), ESP.getPsramSize());
             strOutput += str_sprintf("LED FPS: %d ", g_Values.FPS);
 
             #if USE_WS281X
@@ -591,9 +755,6 @@ void loop()
             debugI("%s", strOutput.c_str());
         }
 
-        // Once an update is underway, we loop tightly on ArduinoOTA.handle.  Otherwise, we delay a bit to share the CPU.
-
-        if (!g_Values.UpdateStarted)
-            delay(10);
+        delay(10);
     }
 }
@@ -0,0 +1,287 @@
+//+--------------------------------------------------------------------------
+//
+// File:        metrics.cpp
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+//
+// Description:
+//
+//    Gathers the counters and gauges the subsystems keep, with the metric
+//    histograms, and writes them out for Prometheus and StatsD
+//
+//---------------------------------------------------------------------------
+
+#include "globals.h"
+
+#if ENABLE_METRICS
+
+#include <vector>
+#include "metrics.h"
+#include "systemcontainer.h"
+#include "soundanalyzer.h"
+
+#if ENABLE_METRICS_STATSD
+    #include <WiFi.h>
+    #include <WiFiUdp.h>
+#endif
+
+// MetricSample
+//
+// One counter or gauge as it stands.  A label, if there is one, tells apart the samples that share a name, and
+// becomes the last part of the name for StatsD.
+
+struct MetricSample
+{
+    enum Kind : uint8_t { Counter, Gauge };
+
+    const char * Name;
+    const char * Help;
+    Kind         Type;
+    double       Value;
+    const char * LabelName  = nullptr;
+    const char * LabelValue = nullptr;
+};
+
+// CollectSamples
+//
+// Reads the counters and gauges, always in the same order, so a push can tell what each counter gained since the
+// last one.  Samples that share a name are kept together for the Prometheus help and type lines.
+
+static std::vector<MetricSample> CollectSamples()
+{
+    std::vector<MetricSample> samples;
+    samples.reserve(32);
+
+    auto counter = [&](const char * name, const char * help, double value, const char * labelName = nullptr, const char * labelValue = nullptr)
+    {
+        samples.push_back({ name, help, MetricSample::Counter, value, labelName, labelValue });
+    };
+
+    auto gauge = [&](const char * name, const char * help, double value)
+    {
+        samples.push_back({ name, help, MetricSample::Gauge, value });
+    };
+
+    counter("frames_shown_total",     "Frames sent out to the LEDs",                           g_Values.FramesShown);
+    counter("frames_skipped_total",   "Frames not sent because they matched the last one",     g_Values.FramesSkipped);
+    counter("frames_late_total",      "Local frames that finished after their deadline",       g_Values.MissedFrames);
+
+    counter("ingest_frames_total",    "Frames received and committed to a buffer ring",       g_IngestStats._cFrames.load());
+    counter("ingest_dropped_total",   "Frames received and dropped",                           g_IngestStats._cFull.load(),  "reason", "full");
+    counter("ingest_dropped_total",   "Frames received and dropped",                           g_IngestStats._cStale.load(), "reason", "stale");
+    counter("ingest_presented_total", "Received frames that were shown",                       g_IngestStats._cPresented.load());
+
+    for (size_t i = 0; i < (size_t) ErrorCounter::Count; i++)
+        counter("errors_total", "Errors the drawing and display paths recovered from", g_ErrorCounters.Get((ErrorCounter) i), "kind", ErrorCounters::Name((ErrorCounter) i));
+
+    if (g_ptrSystem->HasJSONWriter())
+    {
+        auto& jsonWriter = g_ptrSystem->JSONWriter();
+        counter("json_writes_total",         "JSON files written",                              jsonWriter.WriteCount());
+        counter("json_writes_skipped_total", "JSON writes skipped as nothing had changed",      jsonWriter.SkippedWriteCount());
+        counter("json_write_bytes_total",    "Bytes of JSON written",                           jsonWriter.BytesWritten());
+    }
+
+    gauge("fps",                 "Frames drawn per second",                    g_Values.FPS);
+    #if ENABLE_AUDIO
+        gauge("audio_fps",       "Audio passes per second",                    g_Analyzer._AudioFPS);
+        #if ENABLE_AUDIO_LATENCY
+            gauge("audio_to_light_us",       "Time from hearing the sound to showing its light", g_AudioLatency.AudioToLightMicros());
+            gauge("audio_capture_publish_us", "Time from hearing the sound to its levels being out", g_AudioLatency.CaptureToPublishMicros());
+            gauge("audio_draw_light_us",     "Time from starting a frame to showing it",         g_AudioLatency.DrawToLightMicros());
+        #endif
+    #endif
+
+    if (g_ptrSystem->HasBufferManagers() && !g_ptrSystem->BufferManagers().empty())
+        gauge("buffer_depth",        "Frames waiting in the first channel's ring", g_ptrSystem->BufferManagers()[0].Depth());
+
+    #if ENABLE_GOVERNOR
+        gauge("cpu_mhz",                  "CPU clock the governor has set",            g_Governor.FrequencyMHz());
+        gauge("chip_temperature_celsius", "Chip temperature",                          g_Governor.Temperature());
+        gauge("governor_fps_cap",         "Frame rate the governor holds to, or 0",    g_Governor.FramesPerSecondCap());
+    #endif
+
+    gauge("heap_free_bytes",          "Free internal heap",                        ESP.getFreeHeap());
+    gauge("heap_min_free_bytes",      "Lowest the free internal heap has been",    ESP.getMinFreeHeap());
+    gauge("heap_largest_block_bytes", "Largest block that can be allocated",       g_HeapMonitor.LargestBlock());
+    gauge("psram_free_bytes",         "Free PSRAM",                                ESP.getFreePsram());
+    gauge("wifi_rssi_dbm",            "WiFi signal strength",                      g_Values.WiFiRSSI);
+    gauge("power_watts",              "Estimated power draw of the LEDs",          g_Values.Watts);
+    gauge("uptime_seconds",           "Time since boot",                           esp_timer_get_time() / (double) MICROS_PER_SECOND);
+
+    return samples;
+}
+
+// WritePrometheusMetrics
+//
+// The text exposition format: a help and type line for each name, then its samples.  Histogram buckets count
+// everything up to their bound, so each one includes the ones before it.
+
+void WritePrometheusMetrics(Print & out)
+{
+    const char * pLastName = nullptr;
+
+    for (const auto & sample : CollectSamples())
+    {
+        if (!pLastName || strcmp(pLastName, sample.Name))
+        {
+            out.printf("# HELP nightdriver_%s %s\n", sample.Name, sample.Help);
+            out.printf("# TYPE nightdriver_%s %s\n", sample.Name, sample.Type == MetricSample::Counter ? "counter" : "gauge");
+            pLastName = sample.Name;
+        }
+
+        if (sample.LabelName)
+            out.printf("nightdriver_%s{%s=\"%s\"} %.10g\n", sample.Name, sample.LabelName, sample.LabelValue, sample.Value);
+        else
+            out.printf("nightdriver_%s %.10g\n", sample.Name, sample.Value);
+    }
+
+    for (size_t i = 0; i < (size_t) MetricHistogram::Count; i++)
+    {
+        auto name = Metrics::Name((MetricHistogram) i);
+        const auto & histogram = g_Metrics.Histogram((MetricHistogram) i);
+
+        out.printf("# HELP nightdriver_%s_seconds %s\n", name, Metrics::Help((MetricHistogram) i));
+        out.printf("# TYPE nightdriver_%s_seconds histogram\n", name);
+
+        uint32_t cumulative = 0;
+        for (size_t bucket = 0; bucket < FixedHistogram::kBuckets - 1; bucket++)
+        {
+            cumulative += histogram.Bucket(bucket);
+            out.printf("nightdriver_%s_seconds_bucket{le=\"%g\"} %u\n", name, FixedHistogram::kBounds[bucket] / (double) MICROS_PER_SECOND, (unsigned) cumulative);
+        }
+        cumulative += histogram.Bucket(FixedHistogram::kBuckets - 1);
+
+        out.printf("nightdriver_%s_seconds_bucket{le=\"+Inf\"} %u\n", name, (unsigned) cumulative);
+        out.printf("nightdriver_%s_seconds_sum %.6f\n", name, histogram.Sum() / (double) MICROS_PER_SECOND);
+        out.printf("nightdriver_%s_seconds_count %u\n", name, (unsigned) cumulative);
+    }
+}
+
+#if ENABLE_METRICS_STATSD
+
+static WiFiUDP l_StatsDUdp;
+
+// What the counters and histograms stood at on the last push
+
+static std::vector<double> l_lastCounters;
+static uint32_t l_lastHistogramCounts[(size_t) MetricHistogram::Count] = {};
+static uint64_t l_lastHistogramSums[(size_t) MetricHistogram::Count] = {};
+
+// StatsDPacket
+//
+// Collects lines and sends them as packets that fit in one Ethernet frame
+
+class StatsDPacket
+{
+    static constexpr size_t kMaxPacket = 1400;
+
+    String _prefix;
+    String _text;
+
+  public:
+
+    StatsDPacket()
+    {
+        _prefix = STATSD_PREFIX ".";
+        _prefix += WiFi.getHostname();
+        _prefix += ".";
+        _text.reserve(kMaxPacket);
+    }
+
+    void Add(const char * name, const char * suffix, double value, const char * type)
+    {
+        String line = _prefix + name;
+        if (suffix)
+            line += String(".") + suffix;
+        line += str_sprintf(":%.10g|%s\n", value, type);
+
+        if (_text.length() + line.length() > kMaxPacket)
+            Send();
+        _text += line;
+    }
+
+    void Send()
+    {
+        if (_text.isEmpty())
+            return;
+
+        l_StatsDUdp.beginPacket(STATSD_HOST, STATSD_PORT);
+        l_StatsDUdp.write((const uint8_t *) _text.c_str(), _text.length());
+        l_StatsDUdp.endPacket();
+        _text = "";
+    }
+};
+
+// PushStatsDMetrics
+//
+// Gauges go as they stand, counters as what they gained since the last push, and each histogram as the number of
+// durations observed since the last push and their mean, as a timing
+
+void PushStatsDMetrics()
+{
+    if (!WiFi.isConnected() || !strlen(STATSD_HOST))
+        return;
+
+    auto samples = CollectSamples();
+    bool bFirstPush = l_lastCounters.size() != samples.size();
+    if (bFirstPush)
+        l_lastCounters.assign(samples.size(), 0.0);
+
+    StatsDPacket packet;
+
+    for (size_t i = 0; i < samples.size(); i++)
+    {
+        const auto & sample = samples[i];
+
+        if (sample.Type == MetricSample::Gauge)
+        {
+            packet.Add(sample.Name, sample.LabelValue, sample.Value, "g");
+            continue;
+        }
+
+        // The counts run from boot, so the first push only takes note of where they stand
+
+        if (!bFirstPush && sample.Value >= l_lastCounters[i])
+            packet.Add(sample.Name, sample.LabelValue, sample.Value - l_lastCounters[i], "c");
+        l_lastCounters[i] = sample.Value;
+    }
+
+    for (size_t i = 0; i < (size_t) MetricHistogram::Count; i++)
+    {
+        const auto & histogram = g_Metrics.Histogram((MetricHistogram) i);
+        uint32_t count = histogram.Count() - l_lastHistogramCounts[i];
+        uint64_t sum   = histogram.Sum() - l_lastHistogramSums[i];
+
+        l_lastHistogramCounts[i] += count;
+        l_lastHistogramSums[i]   += sum;
+
+        if (count && !bFirstPush)
+        {
+            packet.Add(Metrics::Name((MetricHistogram) i), "count", count, "c");
+            packet.Add(Metrics::Name((MetricHistogram) i), nullptr, sum / (double) count / 1000.0, "ms");
+        }
+    }
+
+    packet.Send();
+}
+
+#endif
+
+#endif
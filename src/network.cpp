@@ -70,8 +70,16 @@ DRAM_ATTR std::mutex NTPTimeClient::_clockMutex;
             debugA("Displaying statistics....");
             debugA("%s:%zux%d %uK", FLASH_VERSION_NAME, g_ptrSystem->Devices().size(), NUM_LEDS, ESP.getFreeHeap() / 1024);
             debugA("%sdB:%s",String(WiFi.RSSI()).substring(1).c_str(), WiFi.isConnected() ? WiFi.localIP().toString().c_str() : "None");
-            debugA("BUFR:%02zu/%02zu [%dfps]", bufferManager.Depth(), bufferManager.BufferCount(), g_Values.FPS);
+            debugA("BUFR:%02zu/%02zu [%dfps, %u late]", bufferManager.Depth(), bufferManager.BufferCount(), g_Values.FPS, g_Values.MissedFrames);
             debugA("DATA:%+04.2lf-%+04.2lf", bufferManager.AgeOfOldestBuffer(), bufferManager.AgeOfNewestBuffer());
+            debugA("INGS: %u in, %u full, %u stale, %u shown", g_IngestStats._cFrames.load(), g_IngestStats._cFull.load(),
+                   g_IngestStats._cStale.load(), g_IngestStats._cPresented.load());
+
+            #if ENABLE_JITTER_BUFFER
+                auto& jitterBuffer = bufferManager.GetJitterBuffer();
+                debugA("JITR: lead %.3lf, jitter %.3lf, drift %+.5lf, target %.3lf, offset %+.3lf",
+                       jitterBuffer.LeadMean(), jitterBuffer.Jitter(), jitterBuffer.Drift(), jitterBuffer.TargetLead(), jitterBuffer.PresentationOffset());
+            #endif
 
             #if ENABLE_AUDIO
                 debugA("g_Analyzer._VU: %.2f, g_Analyzer._MinVU: %.2f, g_Analyzer.g_Analyzer._PeakVU: %.2f, g_Analyzer.gVURatio: %.2f", g_Analyzer._VU, g_Analyzer._MinVU, g_Analyzer._PeakVU, g_Analyzer._VURatio);
@@ -80,6 +88,37 @@ DRAM_ATTR std::mutex NTPTimeClient::_clockMutex;
             #if INCOMING_WIFI_ENABLED
                 debugA("Socket Buffer _cbReceived: %zu", g_ptrSystem->SocketServer()._cbReceived);
             #endif
+
+            #if ENABLE_UDP_INGEST
+                debugA("UDP Datagrams received: %u, dropped: %u", g_ptrSystem->UDPServer()._cReceived, g_ptrSystem->UDPServer()._cDropped);
+            #endif
+
+            #if ENABLE_DMX_INGEST
+                debugA("DMX Packets received: %u, dropped: %u, frames: %u", g_ptrSystem->DMXServer()._cReceived, g_ptrSystem->DMXServer()._cDropped, g_ptrSystem->DMXServer()._cFrames);
+            #endif
+
+            #if ENABLE_DDP_INGEST
+                debugA("DDP Packets received: %u, dropped: %u, frames: %u", g_ptrSystem->DDPServer()._cReceived, g_ptrSystem->DDPServer()._cDropped, g_ptrSystem->DDPServer()._cFrames);
+            #endif
+
+            #if ENABLE_SHOW_PLAYBACK
+                debugA("Show frames played: %u, errors: %u, passes: %u", g_ptrSystem->ShowPlayer()._cFrames, g_ptrSystem->ShowPlayer()._cErrors, g_ptrSystem->ShowPlayer()._cPasses);
+            #endif
+
+            #if ENABLE_SHOW_RECORDER
+                debugA("Show recording: %s, frames: %u, dropped: %u, bytes: %zu", g_ptrSystem->ShowRecorder().IsRecording() ? "on" : "off",
+                       g_ptrSystem->ShowRecorder()._cFrames.load(), g_ptrSystem->ShowRecorder()._cDropped.load(), g_ptrSystem->ShowRecorder()._cbWritten.load());
+            #endif
+
+            #if ENABLE_EFFECT_SYNC
+                debugA("Effect sync %s: sent: %u, received: %u, effects followed: %u", EFFECT_SYNC_LEADER ? "leader" : "follower",
+                       g_ptrSystem->EffectSync()._cSent.load(), g_ptrSystem->EffectSync()._cReceived.load(), g_ptrSystem->EffectSync()._cStarted.load());
+            #endif
+
+            #if ENABLE_ESPNOW
+                debugA("ESP-NOW messages sent: %u, received: %u, dropped: %u", g_ptrSystem->ESPNowLink()._cSent.load(),
+                       g_ptrSystem->ESPNowLink()._cReceived.load(), g_ptrSystem->ESPNowLink()._cDropped.load());
+            #endif
         }
         else if (str.equalsIgnoreCase("clearsettings"))
         {
@@ -119,7 +158,9 @@ void SetupOTA(const String & strHostname)
     ArduinoOTA
         .onStart([]()
         {
+            g_Values.UpdateProgress = 0;
             g_Values.UpdateStarted = true;
+            g_ptrSystem->TaskManager().SuspendNonEssentialTasks();
 
             String type;
             if (ArduinoOTA.getCommand() == U_FLASH)
@@ -142,6 +183,8 @@ void SetupOTA(const String & strHostname)
         })
         .onProgress([](unsigned int progress, unsigned int total)
         {
+            g_Values.UpdateProgress = total ? (uint64_t) progress * 100 / total : 0;
+
             static uint last_time = millis();
             if (millis() - last_time > 1000)
             {
@@ -150,7 +193,7 @@ void SetupOTA(const String & strHostname)
                 debugI("OTA Progress: %u%%\r", p);
 
                 #if USE_HUB75
-                    auto pMatrix = std::static_pointer_cast<LEDMatrixGFX>(g_ptrSystem->EffectManager().GetBaseGraphics());
+                    auto pMatrix = static_cast<LEDMatrixGFX *>(g_ptrSystem->EffectManager().GetBaseGraphics().get());
                     pMatrix->SetCaption(str_sprintf("Update:%d%%", p), CAPTION_TIME);
 //                    pMatrix->setLeds(_GFX[0]->GetMatrixBackBuffer());
                 #endif
@@ -164,6 +207,7 @@ void SetupOTA(const String & strHostname)
         .onError([](ota_error_t error)
         {
             g_Values.UpdateStarted = false;
+            g_ptrSystem->TaskManager().ResumeNonEssentialTasks();
             debugW("Error[%u]: ", error);
             if (error == OTA_AUTH_ERROR)
             {
@@ -192,11 +236,41 @@ void SetupOTA(const String & strHostname)
 #endif
 }
 
+// OTATaskEntry
+//
+// Pumps ArduinoOTA on core 0.  Once an update starts, handle() doesn't return until the new image is written, which
+// it does through the Update library's sector sized buffer in internal RAM, while the draw loop on core 1 shows its
+// progress.
+
+#if ENABLE_OTA
+
+void IRAM_ATTR OTATaskEntry(void *)
+{
+    for (;;)
+    {
+        WaitForWiFi();
+
+        try
+        {
+            ArduinoOTA.handle();
+        }
+        catch(const std::exception& e)
+        {
+            debugW("Exception in OTA code caught");
+        }
+
+        delay(10);
+    }
+}
+
+#endif
+
 // RemoteLoopEntry
 //
 // If enabled, this is the main thread loop for the remote control.  It is initialized and then
-// called once every 20ms to pump its work queue and scan for new remote codes, etc.  If no
-// remote is being used, this code and thread doesn't exist in the build.
+// acts on each code as it arrives.  Decoding edges, it sleeps until a key is pressed; polling
+// IRremoteESP8266 instead, it checks for new codes every 20ms.  If no remote is being used,
+// this code and thread doesn't exist in the build.
 
 #if ENABLE_REMOTE
 
@@ -209,110 +283,276 @@ void IRAM_ATTR RemoteLoopEntry(void *)
     remoteControl.begin();
     while (true)
     {
-        remoteControl.handle();
-        delay(20);
+        uint code;
+        if (remoteControl.ReceiveCode(code))
+            remoteControl.HandleCode(code);
+        else
+            delay(20);
     }
 }
 #endif
 
 #if ENABLE_WIFI
 
-    #define WIFI_WAIT_BASE      4000    // Initial time to wait for WiFi to come up, in ms
-    #define WIFI_WAIT_INCREASE  1000    // Increase of WiFi waiting time per cycle, in ms
+    #define WIFI_WAIT_BASE      500     // Time to wait before the first retry after losing WiFi, in ms
     #define WIFI_WAIT_MAX       60000   // Maximum gap between retries, in ms
+    #define WIFI_CONNECT_TIMEOUT 10000  // Time an attempt gets before we try again, in ms
 
-    #define WIFI_WAIT_INIT      (WIFI_WAIT_BASE - WIFI_WAIT_INCREASE)
+    // The connection manager
+    //
+    // WiFi events tell us when the connection comes up or goes down; the network task acts on them, and on the
+    // retry timer, when ConnectToWiFi() is called without credentials.  A dropped connection is retried after an
+    // exponentially growing delay, first on the access point and channel we were on, which skips the scan and gets
+    // us back quickly after a short flap, and then with a full scan for the strongest access point with our SSID,
+    // which is how we roam to another one.  Whether WiFi is up is kept as the WiFiUp state on the task manager's event
+    // bus, and tasks that need the network wait for it with WaitForWiFi().
+
+    enum class WiFiState : uint8_t
+    {
+        Idle,                                   // Not connected, waiting for the retry timer
+        Connecting,
+        Connected
+    };
 
-    // ConnectToWiFi
+    static struct
+    {
+        std::mutex      Mutex;                  // For the access point, which the WiFi event task writes
+        uint8_t         BSSID[6] = {};
+        int32_t         Channel = 0;
+        bool            bHaveAccessPoint = false;
+
+        std::atomic<WiFiState> State = WiFiState::Idle;
+        unsigned long   AttemptStartMs = 0;
+        unsigned long   NextAttemptMs = 0;
+        unsigned long   RetryDelay = WIFI_WAIT_BASE;
+        bool            bPinnedAttempt = false;
+        bool            bServicesStarted = false;
+        String          SSID;
+        String          Password;
+    } l_WiFi;
+
+    // The radio profile that was applied on this connection, or -1 until one has been
+    static std::atomic<int> l_AppliedRadioProfile = -1;
+
+    int GetAppliedRadioProfile()
+    {
+        return l_AppliedRadioProfile;
+    }
+
+    // ApplyRadioProfile
     //
-    // Try to connect to WiFi using the SSID and password passed as arguments
-    WiFiConnectResult ConnectToWiFi(const String& ssid, const String& password)
+    // Sets the modem sleep and transmit power for the profile.  The lwIP TCP window is fixed when the framework is
+    // built, so the streaming profile's larger receive buffer is asked for per socket by the socket server instead.
+
+    static void ApplyRadioProfile(int profile)
     {
-        return ConnectToWiFi(&ssid, &password);
+        switch (profile)
+        {
+            case RADIO_PROFILE_STREAMING:
+                WiFi.setSleep(WIFI_PS_NONE);
+                WiFi.setTxPower(WIFI_POWER_19_5dBm);
+                break;
+
+            case RADIO_PROFILE_INFORMATIONAL:
+                WiFi.setSleep(WIFI_PS_MAX_MODEM);
+                break;
+
+            default:
+                WiFi.setSleep(WIFI_PS_MIN_MODEM);
+                break;
+        }
+
+        debugI("Applied WiFi radio profile %d", profile);
+        l_AppliedRadioProfile = profile;
     }
 
-    // ConnectToWiFi
+    bool IsWiFiConnected()
+    {
+        return g_ptrSystem->TaskManager().IsEventStateSet(SystemEvent::WiFiUp);
+    }
+
+    bool WaitForWiFi(TickType_t ticksToWait)
+    {
+        return g_ptrSystem->TaskManager().WaitForEventState(SystemEvent::WiFiUp, ticksToWait);
+    }
+
+    // OnWiFiEvent
     //
-    // Try to connect to WiFi using either the SSID and password pointed to by arguments, or the credentials
-    // that were saved from an earlier call if no/nullptr arguments are passed.
-    WiFiConnectResult ConnectToWiFi(const String* ssid = nullptr, const String* password = nullptr)
+    // Runs on the WiFi event task, so it only takes note of what happened and wakes the network task to act on it
+
+    static void OnWiFiEvent(WiFiEvent_t event, WiFiEventInfo_t info)
     {
-        static bool bPreviousConnection = false;
-        static unsigned long millisAtLastAttempt = 0;
-        static unsigned long retryDelay = WIFI_WAIT_INIT;
-        static String WiFi_ssid;
-        static String WiFi_password;
+        switch (event)
+        {
+            case ARDUINO_EVENT_WIFI_STA_CONNECTED:
+            {
+                std::lock_guard<std::mutex> guard(l_WiFi.Mutex);
+                memcpy(l_WiFi.BSSID, info.wifi_sta_connected.bssid, sizeof(l_WiFi.BSSID));
+                l_WiFi.Channel = info.wifi_sta_connected.channel;
+                l_WiFi.bHaveAccessPoint = true;
+                break;
+            }
 
-        bool haveNewCredentials = (ssid != nullptr && password != nullptr && (WiFi_ssid != *ssid || WiFi_password != *password));
+            case ARDUINO_EVENT_WIFI_STA_GOT_IP:
+                l_WiFi.State = WiFiState::Connected;
+                g_ptrSystem->TaskManager().SetEventState(SystemEvent::WiFiUp, true);
+                break;
 
-        // If we have new credentials then always reconnect using them
-        if (haveNewCredentials)
+            case ARDUINO_EVENT_WIFI_STA_DISCONNECTED:
+                g_ptrSystem->TaskManager().SetEventState(SystemEvent::WiFiUp, false);
+                l_AppliedRadioProfile = -1;             // So it's applied again on the next connection
+
+                // Leaving is what we do ourselves just before an attempt, so that one isn't a failure
+                if (info.wifi_sta_disconnected.reason != WIFI_REASON_ASSOC_LEAVE)
+                    l_WiFi.State = WiFiState::Idle;
+                break;
+
+            case ARDUINO_EVENT_WIFI_STA_LOST_IP:
+                g_ptrSystem->TaskManager().SetEventState(SystemEvent::WiFiUp, false);
+                l_WiFi.State = WiFiState::Idle;
+                break;
+
+            default:
+                return;
+        }
+
+        if (g_ptrSystem && g_ptrSystem->HasTaskManager())
+            g_ptrSystem->TaskManager().NotifyNetworkThread();
+    }
+
+    // StartWiFiAttempt
+    //
+    // Begins connecting, and returns right away; the events tell us how it went
+
+    static void StartWiFiAttempt()
+    {
+        static bool bEventsRegistered = false;
+        if (!bEventsRegistered)
         {
-            WiFi_ssid = *ssid;
-            WiFi_password = *password;
-            retryDelay = WIFI_WAIT_INIT;
-            debugI("WiFi credentials passed for SSID \"%s\"", WiFi_ssid.c_str());
+            WiFi.onEvent(OnWiFiEvent);
+            WiFi.setAutoReconnect(false);           // We do the reconnecting, so we can choose how
+            bEventsRegistered = true;
         }
-        // If we're already connected and services are running then go no further
-        else if (bPreviousConnection && WiFi.isConnected())
+
+        auto hostname = g_ptrSystem->DeviceConfig().GetHostname().c_str();
+
+        if (hostname[0] == '\0')
         {
-            return WiFiConnectResult::Connected;
+            debugI("No hostname configured, so skipping setting it.");
+        }
+        else
+        {
+            debugI("Setting host name to %s...", hostname);
+            WiFi.setHostname(hostname);
         }
 
-        // (Re)connect if credentials have changed, or our last attempt was long enough ago
-        if (haveNewCredentials || millisAtLastAttempt == 0 || millis() - millisAtLastAttempt >= retryDelay)
+        debugV("Wifi.disconnect");
+        WiFi.disconnect();
+        debugV("Wifi.mode");
+        WiFi.mode(WIFI_STA);
+
+        uint8_t bssid[6];
+        int32_t channel = 0;
+        {
+            std::lock_guard<std::mutex> guard(l_WiFi.Mutex);
+            l_WiFi.bPinnedAttempt = l_WiFi.bHaveAccessPoint && !l_WiFi.bPinnedAttempt;
+            memcpy(bssid, l_WiFi.BSSID, sizeof(bssid));
+            channel = l_WiFi.Channel;
+        }
+
+        l_WiFi.State = WiFiState::Connecting;
+        l_WiFi.AttemptStartMs = millis();
+
+        if (l_WiFi.bPinnedAttempt)
+        {
+            debugW("Reconnecting to Wifi SSID: \"%s\" on BSSID %02X:%02X:%02X:%02X:%02X:%02X, channel %d",
+                   l_WiFi.SSID.c_str(), bssid[0], bssid[1], bssid[2], bssid[3], bssid[4], bssid[5], (int) channel);
+            WiFi.begin(l_WiFi.SSID.c_str(), l_WiFi.Password.c_str(), channel, bssid);
+        }
+        else
         {
-            millisAtLastAttempt = millis();
-            retryDelay = std::min<unsigned long>(retryDelay + WIFI_WAIT_INCREASE, WIFI_WAIT_MAX);
+            debugW("Connecting to Wifi SSID: \"%s\" - ESP32 Free Memory: %u, PSRAM:%u, PSRAM Free: %u\n",
+                   l_WiFi.SSID.c_str(), ESP.getFreeHeap(), ESP.getPsramSize(), ESP.getFreePsram());
+            WiFi.setScanMethod(WIFI_ALL_CHANNEL_SCAN);
+            WiFi.setSortMethod(WIFI_CONNECT_AP_BY_SIGNAL);
+            WiFi.begin(l_WiFi.SSID.c_str(), l_WiFi.Password.c_str());
+        }
+
+        debugV("Done Wifi.begin, waiting for connection...");
+    }
+
+    #if ENABLE_MDNS
 
-            if (WiFi_ssid.length() == 0)
+        static std::atomic<bool> l_bMDNSStarted { false };
+
+        // StartMDNS
+        //
+        // Advertises what we serve over DNS-SD, so senders can find us without static IPs and see from the TXT
+        // records what each node can take before they connect
+
+        static void StartMDNS()
+        {
+            if (!MDNS.begin(WiFi.getHostname()))
             {
-                debugW("WiFi credentials not set, cannot connect.");
-                return WiFiConnectResult::NoCredentials;
+                debugW("Error starting mDNS");
+                return;
             }
-            else
-            {
-                auto hostname = g_ptrSystem->DeviceConfig().GetHostname().c_str();
 
-                if (hostname[0] == '\0')
-                {
-                    debugI("No hostname configured, so skipping setting it.");
-                }
-                else
-                {
-                    debugI("Setting host name to %s...", hostname);
-                    WiFi.setHostname(hostname);
-                }
+            #if INCOMING_WIFI_ENABLED
+                auto& bufferManagers = g_ptrSystem->BufferManagers();
+
+                MDNS.addService("nightdriver", "tcp", NetworkPort::IncomingWiFi);
+                MDNS.addServiceTxt("nightdriver", "tcp", "leds",     String(NUM_LEDS));
+                MDNS.addServiceTxt("nightdriver", "tcp", "channels", String(NUM_CHANNELS));
+                MDNS.addServiceTxt("nightdriver", "tcp", "buffers",  String(bufferManagers.empty() ? 0 : bufferManagers[0].BufferCount()));
+                MDNS.addServiceTxt("nightdriver", "tcp", "compress", "1");
+                MDNS.addServiceTxt("nightdriver", "tcp", "delta",    "1");
+                MDNS.addServiceTxt("nightdriver", "tcp", "udp",      ENABLE_UDP_INGEST ? String((int) NetworkPort::IncomingUDP) : String("0"));
+                MDNS.addServiceTxt("nightdriver", "tcp", "fps",      String(g_Values.FPS));
+            #endif
 
-                debugV("Wifi.disconnect");
-                WiFi.disconnect();
-                debugV("Wifi.mode");
-                WiFi.mode(WIFI_STA);
-                debugW("Connecting to Wifi SSID: \"%s\" - ESP32 Free Memory: %u, PSRAM:%u, PSRAM Free: %u\n",
-                       WiFi_ssid.c_str(), ESP.getFreeHeap(), ESP.getPsramSize(), ESP.getFreePsram());
+            #if COLORDATA_SERVER_ENABLED
+                MDNS.addService("ndcolor", "tcp", NetworkPort::ColorServer);
+            #endif
 
-                WiFi.begin(WiFi_ssid.c_str(), WiFi_password.c_str());
+            #if ENABLE_WEBSERVER
+                MDNS.addService("http", "tcp", NetworkPort::Webserver);
+            #endif
 
-                debugV("Done Wifi.begin, waiting for connection...");
-            }
+            l_bMDNSStarted = true;
+            debugI("mDNS started as %s.local", WiFi.getHostname());
         }
 
-        if (WiFi.isConnected())
-        {
-            debugW("Connected to AP with BSSID: \"%s\", received IP: %s", WiFi.BSSIDstr().c_str(), WiFi.localIP().toString().c_str());
-        }
-        else
-        // Additional services onwards are reliant on network so return if WiFi is not up (yet)
+        // UpdateMDNSRecords
+        //
+        // Keeps the TXT records that change up to date, which for now is just the frame rate.  It's only sent again
+        // when it's moved, so a sender browsing for nodes sees each one's current rate without the network being
+        // flooded with announcements every frame.
+
+        void UpdateMDNSRecords()
         {
-            debugW("Not yet connected to WiFi, waiting...");
-            return WiFiConnectResult::Disconnected;
+            #if INCOMING_WIFI_ENABLED
+                static uint32_t lastFPS = UINT32_MAX;
+
+                if (!l_bMDNSStarted || !IsWiFiConnected() || g_Values.FPS == lastFPS)
+                    return;
+
+                lastFPS = g_Values.FPS;
+                MDNS.addServiceTxt("nightdriver", "tcp", "fps", String(lastFPS));
+            #endif
         }
 
-        // If we were connected before, network-dependent services will have been started already
-        if (bPreviousConnection)
-            return WiFiConnectResult::Connected;
+    #endif
+
+    // StartNetworkServices
+    //
+    // Brings up what depends on the network, the first time we're connected
 
-        bPreviousConnection = true;
+    static void StartNetworkServices()
+    {
+        #if ENABLE_MDNS
+            StartMDNS();
+        #endif
 
         #if INCOMING_WIFI_ENABLED
             auto& socketServer = g_ptrSystem->SocketServer();
@@ -341,8 +581,116 @@ void IRAM_ATTR RemoteLoopEntry(void *)
             g_ptrSystem->WebServer().begin();
             debugI("Web Server begin called!");
         #endif
+    }
+
+    // ConnectToWiFi
+    //
+    // Try to connect to WiFi using the SSID and password passed as arguments
+    WiFiConnectResult ConnectToWiFi(const String& ssid, const String& password)
+    {
+        return ConnectToWiFi(&ssid, &password);
+    }
+
+    // ConnectToWiFi
+    //
+    // Try to connect to WiFi using either the SSID and password pointed to by arguments, or the credentials
+    // that were saved from an earlier call if no/nullptr arguments are passed.  Never waits for the connection;
+    // call it again when woken by a WiFi event, or once WiFiRetryDueMs() has passed.
+    WiFiConnectResult ConnectToWiFi(const String* ssid = nullptr, const String* password = nullptr)
+    {
+        bool haveNewCredentials = (ssid != nullptr && password != nullptr && (l_WiFi.SSID != *ssid || l_WiFi.Password != *password));
+
+        // If we have new credentials then always reconnect using them
+        if (haveNewCredentials)
+        {
+            l_WiFi.SSID = *ssid;
+            l_WiFi.Password = *password;
+            l_WiFi.RetryDelay = WIFI_WAIT_BASE;
+            {
+                std::lock_guard<std::mutex> guard(l_WiFi.Mutex);
+                l_WiFi.bHaveAccessPoint = false;    // That was for the old network
+            }
+            debugI("WiFi credentials passed for SSID \"%s\"", l_WiFi.SSID.c_str());
+        }
+        else if (l_WiFi.State == WiFiState::Connected && IsWiFiConnected())
+        {
+            // Network-dependent services are started once, the first time we're connected
+
+            if (!l_WiFi.bServicesStarted)
+            {
+                debugW("Connected to AP with BSSID: \"%s\", received IP: %s", WiFi.BSSIDstr().c_str(), WiFi.localIP().toString().c_str());
+                l_WiFi.bServicesStarted = true;
+                StartNetworkServices();
+            }
+            l_WiFi.RetryDelay = WIFI_WAIT_BASE;
+            l_WiFi.bPinnedAttempt = false;
+
+            // On every connection, and whenever the setting changes
+            auto radioProfile = g_ptrSystem->DeviceConfig().GetRadioProfile();
+            if (radioProfile != l_AppliedRadioProfile)
+                ApplyRadioProfile(radioProfile);
+
+            return WiFiConnectResult::Connected;
+        }
+
+        if (l_WiFi.SSID.length() == 0)
+        {
+            debugW("WiFi credentials not set, cannot connect.");
+            return WiFiConnectResult::NoCredentials;
+        }
+
+        unsigned long now = millis();
+
+        if (!haveNewCredentials)
+        {
+            // An attempt that's still going gets its time; one that timed out or failed sets the retry timer
+
+            if (l_WiFi.State == WiFiState::Connecting)
+            {
+                if (now - l_WiFi.AttemptStartMs < WIFI_CONNECT_TIMEOUT)
+                    return WiFiConnectResult::Disconnected;
+
+                debugW("WiFi connection attempt timed out.");
+                l_WiFi.State = WiFiState::Idle;
+            }
+
+            if (l_WiFi.NextAttemptMs == 0)
+            {
+                // A pinned attempt that failed is followed right away by a scan for any access point with our SSID,
+                // and the delay only starts growing after that
+
+                l_WiFi.NextAttemptMs = now + (l_WiFi.bPinnedAttempt ? 0 : l_WiFi.RetryDelay);
+                if (!l_WiFi.bPinnedAttempt)
+                    l_WiFi.RetryDelay = std::min<unsigned long>(l_WiFi.RetryDelay * 2, WIFI_WAIT_MAX);
+            }
+
+            if ((long)(now - l_WiFi.NextAttemptMs) < 0)
+                return WiFiConnectResult::Disconnected;
+        }
+
+        l_WiFi.NextAttemptMs = 0;
+        StartWiFiAttempt();
+        return WiFiConnectResult::Disconnected;
+    }
+
+    // How long until ConnectToWiFi() has something to do without a WiFi event, so the network task can sleep until then
+    unsigned long WiFiRetryDueMs()
+    {
+        unsigned long now = millis();
 
-        return WiFiConnectResult::Connected;
+        switch (l_WiFi.State.load())
+        {
+            case WiFiState::Connecting:
+                return std::max<long>(0, (long)(l_WiFi.AttemptStartMs + WIFI_CONNECT_TIMEOUT - now));
+
+            case WiFiState::Idle:
+                if (l_WiFi.SSID.length() == 0)
+                    return WIFI_WAIT_MAX;
+                return l_WiFi.NextAttemptMs == 0 ? 0 : std::max<long>(0, (long)(l_WiFi.NextAttemptMs - now));
+
+            default:
+                return WIFI_WAIT_MAX;
+        }
     }
 
     #if ENABLE_NTP
@@ -350,7 +698,7 @@ void IRAM_ATTR RemoteLoopEntry(void *)
         {
             static unsigned long lastUpdate = 0;
 
-            if (WiFi.isConnected())
+            if (IsWiFiConnected())
             {
                 // If we've already retrieved the time successfully, we'll only actually update every NTP_DELAY_SECONDS seconds
                 if (!NTPTimeClient::HasClockBeenSet() || (millis() - lastUpdate) > ((NTP_DELAY_SECONDS) * 1000))
@@ -401,9 +749,51 @@ bool ProcessIncomingData(std::unique_ptr<uint8_t []> & payloadData, size_t paylo
                     seconds,
                     micros);
 
-                PeakData peaks((double *)(payloadData.get() + STANDARD_DATA_HEADER_SIZE));
+                // The socket server checks the size before it gets here, but UDP datagrams come straight in
+
+                if (numbands != NUM_BANDS || length32 != NUM_BANDS * sizeof(float) || payloadLength < STANDARD_DATA_HEADER_SIZE + length32)
+                {
+                    debugW("Ignoring peak data with %u bands in %u bytes, expecting %d bands of floats", numbands, length32, NUM_BANDS);
+                    return false;
+                }
+
+                auto peaks = PeakData::FromWire(payloadData.get() + STANDARD_DATA_HEADER_SIZE);
                 peaks.ApplyScalars(PeakData::PCREMOTE);
-                g_Analyzer.SetPeakData(peaks);
+
+                // A sender that stamps its peaks says when it heard them; if its clock and ours agree closely enough
+                // for the age to make sense, the peaks are timed from then rather than from when they got here
+
+                int64_t captureMicros = esp_timer_get_time();
+                if (seconds)
+                {
+                    timeval tv;
+                    gettimeofday(&tv, nullptr);
+                    int64_t age = ((int64_t) tv.tv_sec - (int64_t) seconds) * MICROS_PER_SECOND + ((int64_t) tv.tv_usec - (int64_t) micros);
+                    if (age > 0 && age < (int64_t) MICROS_PER_SECOND)
+                        captureMicros -= age;
+                }
+                g_Analyzer.SetPeakData(peaks, captureMicros);
+            #endif
+            return true;
+        }
+
+        // WIFI_COMMAND_BEATDATA has a header whose second word is 1 for a major beat, then the beat's strength as a float
+
+        case WIFI_COMMAND_BEATDATA:
+        {
+            #if ENABLE_AUDIO
+                uint16_t major16   = WORDFromMemory(&payloadData[2]);
+                uint32_t length32  = DWORDFromMemory(&payloadData[4]);
+
+                if (length32 != sizeof(float) || payloadLength < STANDARD_DATA_HEADER_SIZE + length32)
+                {
+                    debugW("Ignoring beat data of %u bytes", length32);
+                    return false;
+                }
+
+                float strength;
+                memcpy(&strength, payloadData.get() + STANDARD_DATA_HEADER_SIZE, sizeof(strength));
+                g_Analyzer.SetRemoteBeat(strength, major16 != 0);
             #endif
             return true;
         }
@@ -412,6 +802,8 @@ bool ProcessIncomingData(std::unique_ptr<uint8_t []> & payloadData, size_t paylo
 
         case WIFI_COMMAND_PIXELDATA64:
         {
+            IngestStats::DecodeTimer timer(g_IngestStats);
+
             uint16_t channel16 = WORDFromMemory(&payloadData[2]);
             uint32_t length32  = DWORDFromMemory(&payloadData[4]);
             uint64_t seconds   = ULONGFromMemory(&payloadData[8]);
@@ -430,36 +822,110 @@ bool ProcessIncomingData(std::unique_ptr<uint8_t []> & payloadData, size_t paylo
                 channel16 = 1;
 
             // Go through the channel mask to see which bits are set in the channel16 specifier, and send the data to each and every
-            // channel that matches the mask.  So if the send channel 7, that means the lowest 3 channels will be set.
+            // channel that matches the mask.  So if the send channel 7, that means the lowest 3 channels will be set.  The mutex
+            // only keeps us apart from other producers, the draw loop never takes it.
 
-            std::lock_guard<std::mutex> guard(g_buffer_mutex);
+            auto guard = TimedLock(g_buffer_mutex, FrameStage::ProducerLock);
 
-            for (int iChannel = 0, channelMask = 1; iChannel < g_ptrSystem->BufferManagers().size(); iChannel++, channelMask <<= 1)
+            // When the mask picks more than one channel, the colors are copied once into a shared frame that all of
+            // their buffers show.  If the pool has none free even after the rings let go of the ones they're done
+            // with, each channel gets its own copy as before.
+
+            auto& bufferManagers = g_ptrSystem->BufferManagers();
+            std::shared_ptr<CRGB> pSharedFrame;
+
+            if (g_ptrSystem->HasSharedFrames() && __builtin_popcount(channel16 & ((1u << bufferManagers.size()) - 1)) > 1)
+            {
+                pSharedFrame = g_ptrSystem->SharedFrames().Acquire();
+                if (!pSharedFrame)
+                {
+                    for (auto& bufferManager : bufferManagers)
+                        bufferManager.ReleaseSharedFrames();
+                    pSharedFrame = g_ptrSystem->SharedFrames().Acquire();
+                }
+            }
+
+            bool bFillFrame = true;
+
+            for (int iChannel = 0, channelMask = 1; iChannel < bufferManagers.size(); iChannel++, channelMask <<= 1)
             {
                 if ((channelMask & channel16) != 0)
                 {
                     debugV("Processing for Channel %d", iChannel);
 
-                    bool bDone = false;
+                    // The newest buffer may already be in the draw loop's hands, so even a resend of it with the same
+                    // timestamp goes into a fresh buffer; the draw loop chews through to the later of the two.
+
+                    auto& bufferManager = bufferManagers[iChannel];
+                    auto pNewBuffer = bufferManager.ReserveNewBuffer();
+                    bool bUpdated = pSharedFrame ? pNewBuffer->ShareFromWire(pSharedFrame, bFillFrame, payloadData, payloadLength)
+                                                 : pNewBuffer->UpdateFromWire(payloadData, payloadLength);
+                    if (!bUpdated)
+                        return false;
+                    bFillFrame = false;
+                    if (bufferManager.CommitNewBuffer())
+                    {
+                        #if ENABLE_SHOW_RECORDER
+                            g_ptrSystem->ShowRecorder().TeeNewest(iChannel, bufferManager);
+                        #endif
+                    }
+                }
+            }
+            return true;
+        }
+
+        // WIFI_COMMAND_PIXELDELTA64 has the same header as WIFI_COMMAND_PIXELDATA64, but its CRGBs are XORed against the
+        // last frame sent on that channel, so unchanged pixels are zeros that compress down to almost nothing.  The
+        // sender follows up with a regular PIXELDATA64 keyframe every so often, which resyncs us after a lost frame.
+
+        case WIFI_COMMAND_PIXELDELTA64:
+        {
+            IngestStats::DecodeTimer timer(g_IngestStats);
+
+            uint16_t channel16 = WORDFromMemory(&payloadData[2]);
+            uint32_t length32  = DWORDFromMemory(&payloadData[4]);
+            uint64_t seconds   = ULONGFromMemory(&payloadData[8]);
+            uint64_t micros    = ULONGFromMemory(&payloadData[16]);
+
+            debugV("ProcessIncomingData -- Delta Channel: %u, Length: %u, Seconds: %llu, Micros: %llu ... ",
+                   channel16,
+                   length32,
+                   seconds,
+                   micros);
+
+            if (channel16 == 0)
+                channel16 = 1;
+
+            auto guard = TimedLock(g_buffer_mutex, FrameStage::ProducerLock);
+
+            for (int iChannel = 0, channelMask = 1; iChannel < g_ptrSystem->BufferManagers().size(); iChannel++, channelMask <<= 1)
+            {
+                if ((channelMask & channel16) != 0)
+                {
                     auto& bufferManager = g_ptrSystem->BufferManagers()[iChannel];
+                    auto pBaseBuffer = bufferManager.PeekLastBufferAdded();
+
+                    // Until a keyframe arrives there's nothing to apply the delta to, so we just wait for one
 
-                    if (!bufferManager.IsEmpty())
+                    if (!pBaseBuffer || pBaseBuffer->Length() != length32)
                     {
-                        auto pNewestBuffer = bufferManager.PeekNewestBuffer();
-                        if (micros != 0 && pNewestBuffer->MicroSeconds() == micros && pNewestBuffer->Seconds() == seconds)
-                        {
-                            debugV("Updating existing buffer");
-                            if (!pNewestBuffer->UpdateFromWire(payloadData, payloadLength))
-                                return false;
-                            bDone = true;
-                        }
+                        debugV("No keyframe for delta on Channel %d yet", iChannel);
+                        continue;
                     }
-                    if (!bDone)
+
+                    // A resend of the newest frame was encoded against the frame before it, and we already have it anyway
+
+                    if (micros != 0 && !bufferManager.IsEmpty() && pBaseBuffer->MicroSeconds() == micros && pBaseBuffer->Seconds() == seconds)
+                        continue;
+
+                    auto pNewBuffer = bufferManager.ReserveNewBuffer();
+                    if (!pNewBuffer->UpdateFromWireDelta(*pBaseBuffer, payloadData, payloadLength))
+                        return false;
+                    if (bufferManager.CommitNewBuffer())
                     {
-                        debugV("No match so adding new buffer");
-                        auto pNewBuffer = bufferManager.GetNewBuffer();
-                        if (!pNewBuffer->UpdateFromWire(payloadData, payloadLength))
-                            return false;
+                        #if ENABLE_SHOW_RECORDER
+                            g_ptrSystem->ShowRecorder().TeeNewest(iChannel, bufferManager);
+                        #endif
                     }
                 }
             }
@@ -595,8 +1061,7 @@ bool WriteWiFiConfig(const String& WiFi_ssid, const String& WiFi_password)
         Debug.showColors(false);                                // Colors
         Debug.setCallBackProjectCmds(&processRemoteDebugCmd);   // Func called to handle any debug externsions we add
 
-        while (!WiFi.isConnected())                             // Wait for wifi, no point otherwise
-            delay(100);
+        WaitForWiFi();                                          // Wait for wifi, no point otherwise
 
         Debug.begin(WiFi.getHostname(), RemoteDebug::INFO);     // Initialize the WiFi debug server
 
@@ -622,15 +1087,106 @@ bool WriteWiFiConfig(const String& WiFi_ssid, const String& WiFi_password)
     {
         for (;;)
         {
-            if (WiFi.isConnected())
-            {
-                auto& socketServer = g_ptrSystem->SocketServer();
+            WaitForWiFi();
 
-                socketServer.release();
-                socketServer.begin();
-                socketServer.ProcessIncomingConnectionsLoop();
-                debugW("Socket connection closed.  Retrying...\n");
-            }
+            auto& socketServer = g_ptrSystem->SocketServer();
+
+            socketServer.release();
+            socketServer.begin();
+            socketServer.ProcessIncomingConnectionsLoop();
+            debugW("Socket connection closed.  Retrying...\n");
+            delay(500);
+        }
+    }
+#endif
+
+#if ENABLE_UDP_INGEST
+
+    // UDPServerTaskEntry
+    //
+    // Opens the UDP socket (and joins the multicast group, if any) whenever WiFi is up, and receives datagrams
+
+    void IRAM_ATTR UDPServerTaskEntry(void *)
+    {
+        for (;;)
+        {
+            WaitForWiFi();
+
+            auto& udpServer = g_ptrSystem->UDPServer();
+
+            udpServer.release();
+            if (udpServer.begin())
+                udpServer.ProcessIncomingDatagramsLoop();
+            debugW("UDP server stopped.  Retrying...\n");
+            delay(500);
+        }
+    }
+#endif
+
+#if ENABLE_DMX_INGEST
+
+    // DMXServerTaskEntry
+    //
+    // Opens the sACN and Art-Net sockets whenever WiFi is up, and receives universes
+
+    void IRAM_ATTR DMXServerTaskEntry(void *)
+    {
+        for (;;)
+        {
+            WaitForWiFi();
+
+            auto& dmxServer = g_ptrSystem->DMXServer();
+
+            dmxServer.release();
+            if (dmxServer.begin())
+                dmxServer.ProcessIncomingPacketsLoop();
+            debugW("DMX server stopped.  Retrying...\n");
+            delay(500);
+        }
+    }
+#endif
+
+#if ENABLE_DDP_INGEST
+
+    // DDPServerTaskEntry
+    //
+    // Opens the DDP socket whenever WiFi is up, and receives fragments
+
+    void IRAM_ATTR DDPServerTaskEntry(void *)
+    {
+        for (;;)
+        {
+            WaitForWiFi();
+
+            auto& ddpServer = g_ptrSystem->DDPServer();
+
+            ddpServer.release();
+            if (ddpServer.begin())
+                ddpServer.ProcessIncomingFragmentsLoop();
+            debugW("DDP server stopped.  Retrying...\n");
+            delay(500);
+        }
+    }
+#endif
+
+#if ENABLE_EFFECT_SYNC
+
+    // EffectSyncTaskEntry
+    //
+    // Opens the effect sync sockets whenever WiFi is up, and sends or receives the effect state
+
+    void IRAM_ATTR EffectSyncTaskEntry(void *)
+    {
+        for (;;)
+        {
+            WaitForWiFi();
+
+            auto& effectSync = g_ptrSystem->EffectSync();
+
+            effectSync.release();
+            if (effectSync.begin())
+                effectSync.SyncLoop();
+            debugW("Effect sync stopped.  Retrying...\n");
             delay(500);
         }
     }
@@ -644,12 +1200,12 @@ bool WriteWiFiConfig(const String& WiFi_ssid, const String& WiFi_password)
     void IRAM_ATTR ColorDataTaskEntry(void *)
     {
         LEDViewer _viewer(NetworkPort::ColorServer);
-        int socket = -1;
+        ColorDataFanOut fanOut;
+        uint32_t lastFrame = 0;
 
         for(;;)
         {
-            while (!WiFi.isConnected())
-                delay(250);
+            WaitForWiFi();
 
             if (!_viewer.begin())
             {
@@ -664,42 +1220,29 @@ bool WriteWiFiConfig(const String& WiFi_ssid, const String& WiFi_password)
             }
         }
 
+        g_ptrSystem->TaskManager().SubscribeToEvents((uint32_t) SystemEvent::FrameDrawn);
+
         for (;;)
         {
-            if (socket < 0)
-                socket = _viewer.CheckForConnection();
+            // The draw loop posts an event for every frame; the timeout keeps new connections and slow sockets
+            // moving while nothing is being drawn
 
-            while (socket >= 0)
-            {
-                auto& effectManager = g_ptrSystem->EffectManager();
+            NightDriverTaskManager::WaitForEvents(pdMS_TO_TICKS(fanOut.HasClients() ? 10 : 250));
+            g_ptrSystem->TaskManager().WaitWhileNonEssentialPaused();
 
-                if (effectManager.IsNewFrameAvailable())
-                {
-                    effectManager.SetNewFrameAvailable(false);
-
-                    debugV("Sending color data packet");
-                    // Potentially too large for the stack, so we allocate it on the heap instead
-                    std::unique_ptr<ColorDataPacket> pPacket = std::make_unique<ColorDataPacket>();
-                    pPacket->header = COLOR_DATA_PACKET_HEADER;
-                    pPacket->width  = effectManager.g()->width();
-                    pPacket->height = effectManager.g()->height();
-                    if (effectManager.g()->leds != nullptr)
-                    {
-                        memcpy(pPacket->colors, effectManager.g()->leds, sizeof(CRGB) * NUM_LEDS);
-
-                        if (!_viewer.SendPacket(socket, pPacket.get(), sizeof(ColorDataPacket)))
-                        {
-                            // If anything goes wrong, we close the socket so it can accept new incoming attempts
-                            debugW("Error on color data socket, so closing");
-                            close(socket);
-                            socket = -1;
-                            break;
-                        }
-                    }
-                }
-                delay(10);
+            auto& effectManager = g_ptrSystem->EffectManager();
+
+            fanOut.AcceptClients(_viewer);
+            fanOut.Service();
+
+            uint32_t frame = effectManager.FrameSequence();
+            if (frame != lastFrame && fanOut.HasClients() && effectManager.g()->leds != nullptr)
+            {
+                debugV("Sending color data packets");
+                fanOut.SendFrame(*effectManager.g());
+                fanOut.Service();                   // Start them on their way now rather than on the next pass
             }
-            delay(1000);
+            lastFrame = frame;
         }
     }
 #endif // COLORDATA_SERVER_ENABLED
@@ -717,9 +1260,6 @@ bool WriteWiFiConfig(const String& WiFi_ssid, const String& WiFi_password)
         static unsigned long millisAtLastConnected = millis();
 
         //debugI(">> NetworkHandlingLoopEntry\n");
-        if(!MDNS.begin("esp32")) {
-            Serial.println("Error starting mDNS");
-        }
 
         TickType_t notifyWait = 0;
 
@@ -728,129 +1268,235 @@ bool WriteWiFiConfig(const String& WiFi_ssid, const String& WiFi_password)
             // Wait until we're woken up by a reader being flagged, or until we've reached the hold point
             ulTaskNotifyTake(pdTRUE, notifyWait);
 
-            // Every second we check WiFi, and reconnect if we've lost the connection. If we are unable to restart
-            // it for any reason, we reboot the chip in cases where its required, which we assume from WAIT_FOR_WIFI.
+            // WiFi events wake us, as does the retry timer. If we are unable to restart WiFi for any reason, we reboot
+            // the chip in cases where its required, which we assume from WAIT_FOR_WIFI.
 
-            EVERY_N_SECONDS(1)
-            {
-                auto connectResult = ConnectToWiFi();
+            auto connectResult = ConnectToWiFi();
+            unsigned long wifiHoldMs = WiFiRetryDueMs();
 
-                if (connectResult == WiFiConnectResult::Connected)
-                {
-                    millisAtLastConnected = millis();
-                }
-                else
+            if (connectResult == WiFiConnectResult::Connected)
+            {
+                millisAtLastConnected = millis();
+                EVERY_N_SECONDS(1)
                 {
-                    debugV("Still waiting for WiFi to connect.");
-                    #if WAIT_FOR_WIFI
-                        // Reboot if we've been waiting for a connection for more than the maximum delay between
-                        // connection retries and we _do_ have credentials
-                        if (connectResult != WiFiConnectResult::NoCredentials && millis() - millisAtLastConnected > WIFI_WAIT_MAX)
-                        {
-                            debugE("Rebooting in 5 seconds due to no Wifi available.");
-                            delay(5000);
-                            throw new std::runtime_error("Rebooting due to no Wifi available.");
-                        }
-                    #endif
+                    g_Values.WiFiRSSI = WiFi.RSSI();
                 }
             }
+            else
+            {
+                debugV("Still waiting for WiFi to connect.");
+                #if WAIT_FOR_WIFI
+                    // Reboot if we've been waiting for a connection for more than the maximum delay between
+                    // connection retries and we _do_ have credentials
+                    if (connectResult != WiFiConnectResult::NoCredentials && millis() - millisAtLastConnected > WIFI_WAIT_MAX)
+                    {
+                        debugE("Rebooting in 5 seconds due to no Wifi available.");
+                        delay(5000);
+                        throw new std::runtime_error("Rebooting due to no Wifi available.");
+                    }
+                #endif
+            }
 
             // If the reader container isn't available yet, we'll sleep for a second before we check again
             if (!g_ptrSystem->HasNetworkReader())
             {
-                notifyWait = pdMS_TO_TICKS(1000);
+                notifyWait = pdMS_TO_TICKS(std::min(1000UL, wifiHoldMs));
                 continue;
             }
 
-            auto& networkReader = g_ptrSystem->NetworkReader();
-            unsigned long now = millis();
+            // Hand the readers that are due to the workers, and sleep until the next one is, or we're woken by a flag.
+            // Without WiFi they wait; the event that brings it back wakes us to send them on their way.
 
-            // Flag entries of which the read interval has passed
-            for (auto& entry : networkReader.readers)
-            {
-                if (entry.canceled.load())
-                    continue;
+            unsigned long holdMs = IsWiFiConnected() ? g_ptrSystem->NetworkReader().DispatchDueReaders() : 1000;
+
+            notifyWait = pdMS_TO_TICKS(std::min(holdMs, wifiHoldMs));
+        }
+    }
 
-                auto interval = entry.readInterval.load();
-                unsigned long targetMs = entry.lastReadMs.load() + interval;
+    // NetworkReaderTaskEntry
+    //
+    // One of the workers that run the network readers.  They wait for the network task to hand them a reader
+    // that's due, so any number of readers share the few workers there are.
 
-                // The last check captures cases where millis() returns bogus data; if the delta between now and lastReadMs is greater
-                //   than the interval then something's up with our timekeeping, so we trigger the reader just to be sure
-                if (interval && (targetMs <= now || (std::max(now, targetMs) - std::min(now, targetMs)) > interval))
-                    entry.flag.store(true);
+    void IRAM_ATTR NetworkReaderTaskEntry(void *)
+    {
+        while (!g_ptrSystem->HasNetworkReader())
+            delay(1000);
 
-                // Unset flag before we do the actual read. This makes that we don't miss another flag raise if it happens while reading
-                if (entry.flag.exchange(false))
-                {
-                    entry.reader();
-                    entry.lastReadMs.store(millis());
-                }
-            }
+        auto& networkReader = g_ptrSystem->NetworkReader();
+
+        for (;;)
+        {
+            size_t index;
+            if (xQueueReceive(networkReader.workQueue, &index, portMAX_DELAY) == pdTRUE)
+                networkReader.RunReader(index);
+        }
+    }
+
+    thread_local unsigned long NetworkReader::currentTimeoutMs = NETREADER_TIMEOUT;
+
+    NetworkReader::NetworkReader()
+    {
+        workQueue = xQueueCreate(NETREADER_QUEUE_LENGTH, sizeof(size_t));
+    }
+
+    void NetworkReader::ScheduleRead(size_t index, unsigned long dueMs)
+    {
+        auto& entry = readers[index];
+
+        if (entry.scheduled && (long)(dueMs - entry.dueMs) >= 0)
+            return;
+
+        // If there's a later read in the heap already it's left there, and skipped when its turn comes
+        entry.scheduled = true;
+        entry.dueMs = dueMs;
+        schedule.push_back({ dueMs, index, false });
+        std::push_heap(schedule.begin(), schedule.end(), LaterThan);
+    }
+
+    unsigned long NetworkReader::DispatchDueReaders()
+    {
+        std::lock_guard<std::mutex> guard(readerMutex);
+        unsigned long now = millis();
 
-            // We wake up at least once every second
-            unsigned long holdMs = 1000;
-            now = millis();
+        while (!schedule.empty() && (long)(schedule.front().dueMs - now) <= 0)
+        {
+            std::pop_heap(schedule.begin(), schedule.end(), LaterThan);
+            auto item = schedule.back();
+            schedule.pop_back();
+
+            auto& entry = readers[item.index];
 
-            // Calculate how long we can sleep. This is determined by the reader that is closest to its interval passing.
-            for (auto& entry : networkReader.readers)
+            if (item.bTimeoutCheck)
             {
-                if (entry.canceled.load())
-                    continue;
+                if (entry.running && (long)(now - entry.startedMs) >= (long)entry.timeoutMs)
+                    debugW("Network reader %zu has been running for %lu ms, past its %lu ms timeout", item.index, now - entry.startedMs, entry.timeoutMs);
+                continue;
+            }
 
-                auto interval = entry.readInterval.load();
-                auto lastReadMs = entry.lastReadMs.load();
+            // Skip the reads that were moved up, or are for readers that were canceled since
 
-                if (!interval)
-                    continue;
+            if (!entry.scheduled || entry.dueMs != item.dueMs || entry.canceled.load())
+                continue;
+            entry.scheduled = false;
 
-                // If one of the reader intervals passed then we're up for another read cycle right away, so we can stop looking further
-                if (lastReadMs + interval <= now)
-                {
-                    holdMs = 0;
-                    break;
-                }
-                else
-                {
-                    unsigned long entryHoldMs = std::min(interval, interval - (now - lastReadMs));
-                    if (entryHoldMs < holdMs)
-                        holdMs = entryHoldMs;
-                }
+            // A reader that's still running from last time goes again when it's done
+            if (entry.running)
+            {
+                entry.flag.store(true);
+                continue;
             }
 
-            notifyWait = pdMS_TO_TICKS(holdMs);
+            if (xQueueSend(workQueue, &item.index, 0) != pdTRUE)
+            {
+                debugW("Network reader workers are all busy, so reader %zu has to wait", item.index);
+                ScheduleRead(item.index, now + 1000);
+                continue;
+            }
+
+            entry.running = true;
+            entry.startedMs = now;
+            schedule.push_back({ now + entry.timeoutMs, item.index, true });
+            std::push_heap(schedule.begin(), schedule.end(), LaterThan);
         }
+
+        // We wake up at least once every second
+
+        if (schedule.empty())
+            return 1000;
+        return std::min<unsigned long>(1000, schedule.front().dueMs - now);
     }
 
-    size_t NetworkReader::RegisterReader(std::function<void()> reader, unsigned long interval, bool flag)
+    void NetworkReader::RunReader(size_t index)
     {
-        // Add the reader with its flag unset
-        auto& readerEntry = readers.emplace_back(reader, interval);
+        std::function<void()> reader;
+        ReaderEntry * pEntry;
 
-        // If an interval is specified, start the interval timer now.
-        if (interval)
-            readerEntry.lastReadMs.store(millis());
+        {
+            std::lock_guard<std::mutex> guard(readerMutex);
+            pEntry = &readers[index];
+            reader = pEntry->reader;                // A copy, so canceling it while it runs is safe
+            currentTimeoutMs = pEntry->timeoutMs;
+        }
+
+        // Unset flag before we do the actual read. This makes that we don't miss another flag raise if it happens while reading
+        pEntry->flag.store(false);
+
+        if (reader && !pEntry->canceled.load())
+        {
+            TRACE_SPAN("NET_READER");
+            reader();
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(readerMutex);
+
+            unsigned long now = millis();
+            pEntry->running = false;
+            pEntry->lastReadMs.store(now);
+
+            if (!pEntry->canceled.load())
+            {
+                if (pEntry->flag.exchange(false))
+                    ScheduleRead(index, now);
+                else if (auto interval = pEntry->readInterval.load())
+                    ScheduleRead(index, now + interval);
+            }
+        }
 
-        size_t index = readers.size() - 1;
+        // The network task may be sleeping past the read we just scheduled
+        g_ptrSystem->TaskManager().NotifyNetworkThread();
+    }
+
+    size_t NetworkReader::RegisterReader(std::function<void()> reader, unsigned long interval, bool flag, unsigned long timeoutMs)
+    {
+        size_t index;
+
+        {
+            std::lock_guard<std::mutex> guard(readerMutex);
+
+            // Add the reader with its flag unset
+            auto& readerEntry = readers.emplace_back(reader, interval, timeoutMs);
+            index = readers.size() - 1;
+
+            // If an interval is specified, start the interval timer now.
+            readerEntry.lastReadMs.store(millis());
+            if (interval)
+                ScheduleRead(index, millis() + interval);
+        }
 
         if (flag)
             FlagReader(index);
+        else if (interval)
+            g_ptrSystem->TaskManager().NotifyNetworkThread();
 
         return index;
     }
 
     void NetworkReader::FlagReader(size_t index)
     {
-        // Check if we received a valid reader index
-        if (index >= readers.size())
-            return;
+        {
+            std::lock_guard<std::mutex> guard(readerMutex);
+
+            // Check if we received a valid reader index
+            if (index >= readers.size())
+                return;
 
-        readers[index].flag.store(true);
+            auto& entry = readers[index];
+            entry.flag.store(true);
+
+            // One that's running goes again when it's done; otherwise it's up right away
+            if (!entry.running)
+                ScheduleRead(index, millis());
+        }
 
         g_ptrSystem->TaskManager().NotifyNetworkThread();
     }
 
     void NetworkReader::CancelReader(size_t index)
     {
+        std::lock_guard<std::mutex> guard(readerMutex);
+
         // Check if we received a valid reader index
         if (index >= readers.size())
             return;
@@ -859,6 +1505,7 @@ bool WriteWiFiConfig(const String& WiFi_ssid, const String& WiFi_password)
         entry.canceled.store(true);
         entry.readInterval.store(0);
         entry.reader = nullptr;
+        entry.scheduled = false;
     }
 
 #endif // ENABLE_WIFI
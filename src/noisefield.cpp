@@ -0,0 +1,274 @@
+//+--------------------------------------------------------------------------
+//
+// File:        noisefield.cpp
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+//
+// Description:
+//
+//    Sampling and z blending for the noise field cache
+//
+//---------------------------------------------------------------------------
+
+#include "globals.h"
+
+#if USE_NOISE
+
+#include "noisefield.h"
+
+NoiseFieldCache g_NoiseFields;
+
+// The most pixels a field keeps, which is enough for a full grid over the largest square the effects ask for
+
+static constexpr size_t kMaxDimension = std::max(MATRIX_WIDTH, MATRIX_HEIGHT);
+static constexpr size_t kFieldCapacity = kMaxDimension * kMaxDimension;
+
+// How far apart the z slices are, in the units of the noise function
+
+uint32_t NoiseFieldCache::ZSpan(NoiseDepth depth) const
+{
+    return depth == NoiseDepth::Eight ? std::max<uint32_t>(1, NOISE_FIELD_Z_SPAN >> 8) : NOISE_FIELD_Z_SPAN;
+}
+
+void NoiseFieldCache::SampleSlice(const Field & field, uint16_t * pSlice, uint32_t z)
+{
+    for (uint16_t r = 0; r < field.Rows; r++)
+    {
+        uint32_t y = field.GridY + field.CellY * r;
+        for (uint16_t c = 0; c < field.Columns; c++)
+            *pSlice++ = field.Lattice.Sample(field.GridX + field.CellX * c, y, z);
+    }
+}
+
+// ScrollSlice
+//
+// Moves the samples of a slice by whole cells to where they are in the field's new grid, and samples the ones that
+// have come into view.  Each sample is taken from further along the slice when the grid moves forward, and from
+// further back when it moves back, so going through in that same direction reads each one before it's overwritten.
+
+void NoiseFieldCache::ScrollSlice(const Field & field, uint16_t * pSlice, int32_t dx, int32_t dy, uint32_t z)
+{
+    const int32_t columns = field.Columns;
+    const int32_t rows    = field.Rows;
+    const int32_t count   = columns * rows;
+    const bool bForward   = dy * columns + dx > 0;
+
+    for (int32_t n = 0; n < count; n++)
+    {
+        const int32_t i  = bForward ? n : count - 1 - n;
+        const int32_t r  = i / columns;
+        const int32_t c  = i % columns;
+        const int32_t sr = r + dy;
+        const int32_t sc = c + dx;
+
+        if (sr >= 0 && sr < rows && sc >= 0 && sc < columns)
+            pSlice[i] = pSlice[sr * columns + sc];
+        else
+            pSlice[i] = field.Lattice.Sample(field.GridX + field.CellX * c, field.GridY + field.CellY * r, z);
+    }
+}
+
+// Translate
+//
+// The slices scroll when the grid has moved by whole cells, and are sampled again when it hasn't, which only happens
+// to grids of pixels whose origin moved by part of a pixel, or to the samples of a lattice with no step in one
+// direction, which all move at once
+
+void NoiseFieldCache::Translate(Field & field, const NoiseLattice & lattice, uint32_t zMask)
+{
+    const uint32_t gridX = GridOrigin(lattice.X, field.CellX, field.Shift);
+    const uint32_t gridY = GridOrigin(lattice.Y, field.CellY, field.Shift);
+    const int32_t  moveX = (int32_t)(gridX - field.GridX);
+    const int32_t  moveY = (int32_t)(gridY - field.GridY);
+
+    field.Lattice = lattice;
+    if (!moveX && !moveY)
+        return;
+
+    const bool bWholeCells = (moveX == 0 || (field.CellX && moveX % (int32_t) field.CellX == 0))
+                          && (moveY == 0 || (field.CellY && moveY % (int32_t) field.CellY == 0));
+
+    field.GridX  = gridX;
+    field.GridY  = gridY;
+    field.bBlend = false;
+
+    const uint32_t z1 = (field.Z0 + ZSpan(lattice.Depth)) & zMask;
+
+    if (bWholeCells)
+    {
+        const int32_t dx = moveX ? moveX / (int32_t) field.CellX : 0;
+        const int32_t dy = moveY ? moveY / (int32_t) field.CellY : 0;
+
+        ScrollSlice(field, field.Slice0.get(), dx, dy, field.Z0);
+        if (field.bPair)
+            ScrollSlice(field, field.Slice1.get(), dx, dy, z1);
+    }
+    else
+    {
+        SampleSlice(field, field.Slice0.get(), field.Z0);
+        if (field.bPair)
+            SampleSlice(field, field.Slice1.get(), z1);
+    }
+}
+
+const NoiseFieldCache::Field * NoiseFieldCache::Prepare(const NoiseLattice & lattice, uint32_t z)
+{
+    if ((size_t) lattice.Width * lattice.Height > kFieldCapacity || lattice.Width == 0 || lattice.Height == 0)
+        return nullptr;
+
+    const uint32_t zMask = lattice.Depth == NoiseDepth::Eight ? 0xFFFF : 0xFFFFFFFF;
+    const uint32_t span  = ZSpan(lattice.Depth);
+    z &= zMask;
+
+    // Look for a field of the same shape, the one with its grid nearest the origin if there's more than one, and
+    // failing that take over the field that's gone longest without use
+
+    Field * pField = &_fields[0];
+    Field * pMatch = nullptr;
+    uint32_t matchDistance = 0;
+
+    for (auto & field : _fields)
+    {
+        if (field.Slice0 && field.Lattice.SameShape(lattice))
+        {
+            uint32_t distance = std::abs((int32_t)(lattice.X - field.Lattice.X)) + std::abs((int32_t)(lattice.Y - field.Lattice.Y));
+            if (!pMatch || distance < matchDistance)
+            {
+                pMatch = &field;
+                matchDistance = distance;
+            }
+        }
+        if (!field.Slice0 || field.LastUse < pField->LastUse)
+            pField = &field;
+    }
+
+    const bool bFound = pMatch;
+    if (bFound)
+        pField = pMatch;
+
+    Field & field = *pField;
+    field.LastUse = ++_useCount;
+
+    if (bFound)
+    {
+        Translate(field, lattice, zMask);
+    }
+    else
+    {
+        if (!field.Slice0)
+        {
+            field.Slice0.reset(static_cast<uint16_t *>(PreferPSRAMAlloc(kFieldCapacity * sizeof(uint16_t))));
+            field.Slice1.reset(static_cast<uint16_t *>(PreferPSRAMAlloc(kFieldCapacity * sizeof(uint16_t))));
+            field.Blend.reset(static_cast<uint16_t *>(PreferPSRAMAlloc(kFieldCapacity * sizeof(uint16_t))));
+        }
+
+        if (!field.Slice0 || !field.Slice1 || !field.Blend)
+        {
+            field.Slice0.reset();
+            field.Slice1.reset();
+            field.Blend.reset();
+            return nullptr;
+        }
+
+        // The grid is as coarse as it can be while the samples stay within a quarter of a lattice cell of each other
+
+        const uint32_t quarterCell = lattice.Depth == NoiseDepth::Eight ? 64 : 16384;
+        const uint32_t step = std::max(lattice.StepX, lattice.StepY);
+
+        uint8_t shift = 0;
+        while ((2u << shift) <= NOISE_FIELD_MAX_STEP && (uint64_t) step * (2u << shift) <= quarterCell)
+            shift++;
+
+        // A grid that's filled in between has its first cell wherever the origin falls, and so needs a column and
+        // row more than the pixels would, and another for the cell past the last one that's partly in view.  A long
+        // thin lattice may not have room for them, and gets a grid of pixels instead.
+
+        const uint16_t spare = 2;
+        if (shift && (size_t)(((lattice.Width - 1) >> shift) + 1 + spare) * (((lattice.Height - 1) >> shift) + 1 + spare) > kFieldCapacity)
+            shift = 0;
+
+        field.Lattice = lattice;
+        field.Shift   = shift;
+        field.CellX   = lattice.StepX << field.Shift;
+        field.CellY   = lattice.StepY << field.Shift;
+        field.GridX   = GridOrigin(lattice.X, field.CellX, field.Shift);
+        field.GridY   = GridOrigin(lattice.Y, field.CellY, field.Shift);
+        field.Columns = ((lattice.Width - 1) >> field.Shift) + 1 + (field.Shift ? spare : 0);
+        field.Rows    = ((lattice.Height - 1) >> field.Shift) + 1 + (field.Shift ? spare : 0);
+        field.bPair   = false;
+        field.bBlend  = false;
+        field.Z0      = z;
+        SampleSlice(field, field.Slice0.get(), z);
+        field.pGrid = field.Slice0.get();
+        return &field;
+    }
+
+    uint32_t dz = (z - field.Z0) & zMask;
+
+    // When z has moved past the far slice by less than a span, the far slice becomes the near one and only the
+    // new far slice is sampled.  When it's jumped further than that (or backwards) we start over at z.
+
+    if (field.bPair && dz > span && dz <= span * 2)
+    {
+        std::swap(field.Slice0, field.Slice1);
+        field.Z0 = (field.Z0 + span) & zMask;
+        field.bPair = false;
+        field.bBlend = false;
+        dz -= span;
+    }
+    else if (dz > span)
+    {
+        field.Z0 = z;
+        field.bPair = false;
+        field.bBlend = false;
+        SampleSlice(field, field.Slice0.get(), z);
+        dz = 0;
+    }
+
+    if (dz == 0)
+    {
+        field.pGrid = field.Slice0.get();
+        return &field;
+    }
+
+    if (!field.bPair)
+    {
+        SampleSlice(field, field.Slice1.get(), (field.Z0 + span) & zMask);
+        field.bPair = true;
+    }
+
+    if (!field.bBlend || field.BlendZ != z)
+    {
+        const int32_t t = (int32_t)(((uint64_t) dz << 15) / span);     // 15 bits, so the product below fits
+        const uint16_t * p0 = field.Slice0.get();
+        const uint16_t * p1 = field.Slice1.get();
+        uint16_t * pBlend = field.Blend.get();
+
+        for (size_t i = 0, n = field.Columns * field.Rows; i < n; i++)
+            pBlend[i] = p0[i] + (((p1[i] - p0[i]) * t) >> 15);
+
+        field.BlendZ = z;
+        field.bBlend = true;
+    }
+
+    field.pGrid = field.Blend.get();
+    return &field;
+}
+
+#endif
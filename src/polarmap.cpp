@@ -0,0 +1,71 @@
+//+--------------------------------------------------------------------------
+//
+// File:        polarmap.cpp
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+//
+// Description:
+//
+//    Builds the shared polar coordinate tables
+//
+//---------------------------------------------------------------------------
+
+#include "globals.h"
+#include "polarmap.h"
+
+PolarMap g_PolarMap;
+
+bool PolarMap::Prepare()
+{
+    if (_bReady.load(std::memory_order_acquire))
+        return true;
+
+    std::lock_guard<std::mutex> guard(_mutex);
+    if (_bReady.load(std::memory_order_relaxed))
+        return true;                                    // Built by the other task while we waited
+
+    auto angle           = make_unique_psram_array<uint8_t>(MATRIX_WIDTH * MATRIX_HEIGHT);
+    auto radius          = make_unique_psram_array<uint16_t>(MATRIX_WIDTH * MATRIX_HEIGHT);
+    auto inverseDistance = make_unique_psram_array<uint16_t>(MATRIX_WIDTH * MATRIX_HEIGHT);
+
+    if (!angle || !radius || !inverseDistance)
+    {
+        debugE("Not enough memory for the polar map");
+        return false;
+    }
+
+    for (int y = 0; y < MATRIX_HEIGHT; y++)
+    {
+        for (int x = 0; x < MATRIX_WIDTH; x++)
+        {
+            int dx = x - CenterX;
+            int dy = y - CenterY;
+
+            angle[Index(x, y)]           = (uint8_t)(int)(128 * (atan2(dy, dx) / PI));
+            radius[Index(x, y)]          = (uint16_t)(hypot(dx, dy) * 256);
+            inverseDistance[Index(x, y)] = (32768 + sqrt16(x * x + y * y + 1) - 1) / sqrt16(x * x + y * y + 1);
+        }
+    }
+
+    _angle           = std::move(angle);
+    _radius          = std::move(radius);
+    _inverseDistance = std::move(inverseDistance);
+    _bReady.store(true, std::memory_order_release);
+    return true;
+}
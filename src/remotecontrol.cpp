@@ -36,18 +36,143 @@
 
 #define BRIGHTNESS_STEP     20
 
-void RemoteControl::handle()
+#if REMOTE_EDGE_DECODE
+
+// Whether a mark or space is close enough to its nominal length.  Receivers stretch the marks and shrink the spaces
+// by up to a hundred microseconds or so, which matters most for the short ones, so there's some slack on top.
+
+static inline bool IRAM_ATTR NearLength(uint32_t us, uint32_t nominal)
+{
+    return us + nominal / 4 + 150 >= nominal && us <= nominal + nominal / 4 + 150;
+}
+
+bool IRAM_ATTR NECDecoder::Mark(uint32_t us, uint32_t & code)
+{
+    // A header starts a code over, whatever came before it
+
+    if (NearLength(us, 9000))
+    {
+        _state = State::Header;
+        return false;
+    }
+
+    State state = _state;
+    _state = State::Idle;
+
+    if (!NearLength(us, 560))
+        return false;
+
+    switch (state)
+    {
+        case State::Bits:
+            _state = State::Bits;
+            return false;
+
+        case State::Stop:
+            code = _code;
+            return true;
+
+        case State::RepeatStop:
+            code = 0xFFFFFFFF;
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+void IRAM_ATTR NECDecoder::Space(uint32_t us)
+{
+    State state = _state;
+    _state = State::Idle;
+
+    if (state == State::Header)
+    {
+        if (NearLength(us, 4500))
+        {
+            _state = State::Bits;
+            _cBits = 0;
+            _code  = 0;
+        }
+        else if (NearLength(us, 2250))
+        {
+            _state = State::RepeatStop;
+        }
+    }
+    else if (state == State::Bits)
+    {
+        if (NearLength(us, 1690))
+            _code = (_code << 1) | 1;
+        else if (NearLength(us, 560))
+            _code = _code << 1;
+        else
+            return;
+
+        _state = ++_cBits == 32 ? State::Stop : State::Bits;
+    }
+}
+
+// OnEdge
+//
+// The receiver holds its output low while it sees the carrier, so a rising edge ends a mark and a falling one ends
+// a space
+
+void IRAM_ATTR RemoteControl::OnEdge(void * pv)
+{
+    auto pThis = static_cast<RemoteControl *>(pv);
+
+    int64_t now = esp_timer_get_time();
+    uint32_t us = (uint32_t)(now - pThis->_lastEdge);
+    pThis->_lastEdge = now;
+
+    if (!digitalRead(IR_REMOTE_PIN))
+    {
+        pThis->_decoder.Space(us);
+        return;
+    }
+
+    uint32_t code;
+    if (!pThis->_decoder.Mark(us, code))
+        return;
+
+    BaseType_t bWoken = pdFALSE;
+    xQueueSendFromISR(pThis->_codes, &code, &bWoken);
+    if (bWoken)
+        portYIELD_FROM_ISR();
+}
+
+bool RemoteControl::ReceiveCode(uint & code)
+{
+    uint32_t received;
+    if (!_codes || xQueueReceive(_codes, &received, portMAX_DELAY) != pdTRUE)
+        return false;
+
+    code = received;
+    debugI("Received IR Remote Code: 0x%08X\n", code);
+    return true;
+}
+
+#else
+
+bool RemoteControl::ReceiveCode(uint & code)
 {
     decode_results results;
-    static uint lastResult = 0;
 
     if (!_IR_Receive.decode(&results))
-        return;
+        return false;
 
-    uint result = results.value;
+    code = results.value;
     _IR_Receive.resume();
 
-    debugI("Received IR Remote Code: 0x%08X, Decode: %08X\n", result, results.decode_type);
+    debugI("Received IR Remote Code: 0x%08X, Decode: %08X\n", code, results.decode_type);
+    return true;
+}
+
+#endif
+
+void RemoteControl::HandleCode(uint result)
+{
+    static uint lastResult = 0;
 
     if (0xFFFFFFFF == result || result == lastResult)
     {
@@ -29,6 +29,7 @@
 //---------------------------------------------------------------------------
 
 #include <algorithm>
+#include <atomic>
 #include "globals.h"
 #include "systemcontainer.h"
 #include "soundanalyzer.h"
@@ -48,11 +49,174 @@
 
 DRAM_ATTR std::mutex Screen::_screenMutex;              // The storage for the mutex of the screen class
 
-// How many screen pages do we have
-constexpr uint8_t g_InfoPageCount = std::clamp(NUM_INFO_PAGES, 1, 2);
+// How many screen pages do we have.  The LED preview, if there is one, comes after the info pages.
+constexpr uint8_t g_InfoPageCount = std::clamp(NUM_INFO_PAGES, 1, 2) + (ENABLE_SCREEN_PREVIEW ? 1 : 0);
+constexpr uint8_t g_PreviewPage   = std::clamp(NUM_INFO_PAGES, 1, 2);
 
 // What page of screen we are showing
-DRAM_ATTR uint8_t g_InfoPage = g_InfoPageCount - 1;      // Default to last page
+DRAM_ATTR uint8_t g_InfoPage = g_PreviewPage - 1;        // Default to last info page
+
+// StatusLines
+//
+// What each line of a status page said when it was last drawn.  A line that says the same again isn't drawn at all,
+// and one that changed is rendered off-screen into a canvas one line tall and sent to the display as one block,
+// rather than glyph pixel by glyph pixel over a slow bus.  The whole line is cleared, so shorter text leaves no tail.
+
+template <size_t N>
+class StatusLines
+{
+    String _text[N];
+    bool   _bDrawn[N] = {};
+    std::unique_ptr<GFXcanvas16> _pCanvas;
+
+  public:
+
+    void Invalidate()
+    {
+        std::fill_n(_bDrawn, N, false);
+    }
+
+    void Draw(Screen & display, size_t line, int16_t x, int16_t y, int16_t w, const String & text, uint8_t textSize, uint16_t textColor, uint16_t backColor)
+    {
+        if (_bDrawn[line] && display.RetainsContent() && _text[line] == text)
+            return;
+
+        int16_t h = display.fontHeight();
+        if (!_pCanvas || _pCanvas->width() != w || _pCanvas->height() != h)
+            _pCanvas = std::make_unique<GFXcanvas16>(w, h);
+
+        if (!_pCanvas->getBuffer())
+        {
+            // No room for the canvas, so draw straight to the display as we always have
+
+            display.setTextColor(textColor, backColor);
+            display.setCursor(x, y);
+            display.print(text);
+        }
+        else
+        {
+            _pCanvas->setTextSize(textSize);
+            _pCanvas->setTextWrap(false);
+            _pCanvas->fillScreen(backColor);
+            _pCanvas->setTextColor(textColor, backColor);
+            _pCanvas->setCursor(0, 0);
+            _pCanvas->print(text);
+            display.PushRect(x, y, w, h, _pCanvas->getBuffer());
+        }
+
+        _text[line] = text;
+        _bDrawn[line] = true;
+    }
+};
+
+#if ENABLE_SCREEN_PREVIEW
+
+// The preview page's copy of the LED frame.  The draw loop only copies into it while the page is up and a preview
+// frame is due, and if the screen task happens to be reading it right then, it skips the copy rather than wait.
+
+static DRAM_ATTR std::mutex    l_previewMutex;
+static DRAM_ATTR CRGB *        l_pPreviewFrame   = nullptr;
+static DRAM_ATTR size_t        l_previewWidth    = 0;
+static DRAM_ATTR size_t        l_previewHeight   = 0;
+static std::atomic<bool>       l_bPreviewWanted  { false };
+static std::atomic<bool>       l_bPreviewFresh   { false };
+static DRAM_ATTR unsigned long l_msLastPreview   = 0;
+
+void CaptureScreenPreview()
+{
+    if (!l_bPreviewWanted || millis() - l_msLastPreview < MILLIS_PER_SECOND / SCREEN_PREVIEW_FPS)
+        return;
+
+    std::unique_lock<std::mutex> lock(l_previewMutex, std::try_to_lock);
+    if (!lock.owns_lock() || !l_pPreviewFrame)
+        return;
+
+    auto graphics = g_ptrSystem->EffectManager().g();
+    memcpy(l_pPreviewFrame, graphics->leds, sizeof(CRGB) * l_previewWidth * l_previewHeight);
+    l_msLastPreview = millis();
+    l_bPreviewFresh = true;
+}
+
+// LEDPreview
+//
+// The page that shows what's on the LEDs, scaled to fit the screen with the pixels kept square.  A strip, being one
+// row, is wrapped into as many rows as fill the screen best.  The screen is sent a band of rows at a time.
+
+void LEDPreview(bool bRedraw)
+{
+    auto& display = g_ptrSystem->Display();
+
+    if (!l_pPreviewFrame)
+    {
+        auto graphics = g_ptrSystem->EffectManager().g();
+        std::lock_guard<std::mutex> lock(l_previewMutex);
+        l_previewWidth  = graphics->width();
+        l_previewHeight = graphics->height();
+        l_pPreviewFrame = (CRGB *) PreferPSRAMAlloc(sizeof(CRGB) * l_previewWidth * l_previewHeight);
+        if (!l_pPreviewFrame)
+            return;
+    }
+
+    l_bPreviewWanted = true;
+
+    if (bRedraw)
+        display.fillScreen(BLACK16);
+
+    if (!l_bPreviewFresh)
+        return;
+
+    // Lay the frame out as a grid of cols x rows, wrapping a strip until its aspect is closest to the screen's
+
+    const size_t cLEDs = l_previewWidth * l_previewHeight;
+    size_t cols = l_previewWidth, rows = l_previewHeight;
+    if (rows == 1)
+    {
+        cols = std::max<size_t>(1, ceil(sqrt((double) cLEDs * display.width() / display.height())));
+        rows = (cLEDs + cols - 1) / cols;
+    }
+
+    const float scale = std::min((float) display.width() / cols, (float) display.height() / rows);
+    const int w = std::max(1, (int) (cols * scale));
+    const int h = std::max(1, (int) (rows * scale));
+    const int x0 = (display.width() - w) / 2;
+    const int y0 = (display.height() - h) / 2;
+
+    constexpr int kBandRows = 8;
+    static std::unique_ptr<uint16_t[]> pBand;
+    static int bandWidth = 0;
+    if (bandWidth != w)
+    {
+        pBand.reset(new(std::nothrow) uint16_t[w * kBandRows]);
+        bandWidth = pBand ? w : 0;
+        if (!pBand)
+            return;
+    }
+
+    std::lock_guard<std::mutex> lock(l_previewMutex);
+
+    for (int yBand = 0; yBand < h; yBand += kBandRows)
+    {
+        int bandRows = std::min(kBandRows, h - yBand);
+
+        for (int y = 0; y < bandRows; y++)
+        {
+            size_t row = (yBand + y) * rows / h;
+            uint16_t * pOut = &pBand[y * w];
+
+            for (int x = 0; x < w; x++)
+            {
+                size_t index = row * cols + x * cols / w;
+                pOut[x] = index < cLEDs ? Screen::to16bit(l_pPreviewFrame[index]) : BLACK16;
+            }
+        }
+
+        display.PushRect(x0, y0 + yBand, w, bandRows, pBand.get());
+    }
+
+    l_bPreviewFresh = false;
+}
+
+#endif
 
 // BasicInfoSummary
 //
@@ -90,8 +254,15 @@ void BasicInfoSummary(bool bRedraw)
 
     auto& display = g_ptrSystem->Display();
 
+    // The text lines are only sent to the display when they change, see StatusLines
+
+    static StatusLines<7> lines;
+
     if (bRedraw)
+    {
         display.fillScreen(bkgndColor);
+        lines.Invalidate();
+    }
 
     // Status line 1
 
@@ -102,30 +273,35 @@ void BasicInfoSummary(bool bRedraw)
     cStatus++;
 
     //display.setFont();
-    display.setTextSize(display.width() >= 240 ? 2 : 1);
+    const uint8_t textSize = display.width() >= 240 ? 2 : 1;
+    display.setTextSize(textSize);
     #if USE_OLED
-        display.setTextColor(WHITE16, BLACK16);
+        const uint16_t lineColor = WHITE16, lineBack = BLACK16;
     #else
-        display.setTextColor(textColor, bkgndColor); // Second color is background color, giving us text overwrite
+        const uint16_t lineColor = textColor, lineBack = bkgndColor;
     #endif
 
-    display.setCursor(xMargin, yMargin);
-    display.println(str_sprintf("%s:%dx%d %c %dK", FLASH_VERSION_NAME, g_ptrSystem->Devices().size(), NUM_LEDS, chStatus, ESP.getFreeHeap() / 1024));
+    const int lineWidth = display.width() - xMargin * 2;
+    auto drawLine = [&](size_t line, int y, const String & text)
+    {
+        lines.Draw(display, line, xMargin, y, lineWidth, text, textSize, lineColor, lineBack);
+    };
+
+    drawLine(0, yMargin, str_sprintf("%s:%dx%d %c %dK", FLASH_VERSION_NAME, g_ptrSystem->Devices().size(), NUM_LEDS, chStatus, ESP.getFreeHeap() / 1024));
 
     // WiFi info line 2
 
     auto lineHeight = display.fontHeight();
-    display.setCursor(xMargin + 0, yMargin + lineHeight);
 
     if (WiFi.isConnected() == false)
     {
-        display.println("No Wifi");
+        drawLine(1, yMargin + lineHeight, "No Wifi");
     }
     else
     {
         const IPAddress address = WiFi.localIP();
-        display.println(str_sprintf("%ddB:%d.%d.%d.%d",
-                                    (int)labs(WiFi.RSSI()), // skip sign in first character
+        drawLine(1, yMargin + lineHeight, str_sprintf("%ddB:%d.%d.%d.%d",
+                                    (int)labs(g_Values.WiFiRSSI), // skip sign in first character
                                     address[0], address[1], address[2], address[3]));
     }
 
@@ -133,16 +309,14 @@ void BasicInfoSummary(bool bRedraw)
 
     auto& bufferManager = g_ptrSystem->BufferManagers()[0];
 
-    display.setCursor(xMargin + 0, yMargin + lineHeight * 4);
-    display.println(str_sprintf("BUFR:%02d/%02d %dfps ",
+    drawLine(2, yMargin + lineHeight * 4, str_sprintf("BUFR:%02d/%02d %dfps ",
                                 bufferManager.Depth(),
                                 bufferManager.BufferCount(),
                                 g_Values.FPS));
 
     // Data Status Line 4
 
-    display.setCursor(xMargin + 0, yMargin + lineHeight * 2);
-    display.println(str_sprintf("DATA:%+06.2lf-%+06.2lf",
+    drawLine(3, yMargin + lineHeight * 2, str_sprintf("DATA:%+06.2lf-%+06.2lf",
                                 std::min(99.99, bufferManager.AgeOfOldestBuffer()),
                                 std::min(99.99, bufferManager.AgeOfNewestBuffer())));
 
@@ -156,8 +330,7 @@ void BasicInfoSummary(bool bRedraw)
     char szTime[16];
     strftime(szTime, ARRAYSIZE(szTime), "%H:%M:%S", tmp);
 
-    display.setCursor(xMargin + 0, yMargin + lineHeight * 3);
-    display.println(str_sprintf("CLCK:%s %04.3lf",
+    drawLine(4, yMargin + lineHeight * 3, str_sprintf("CLCK:%s %04.3lf",
                                 g_Values.AppTime.CurrentTime() > 100000 ? szTime : "Unset",
                                 g_Values.FreeDrawTime));
 
@@ -165,8 +338,7 @@ void BasicInfoSummary(bool bRedraw)
 
     if (display.height() >= lineHeight * 5 + lineHeight)
     {
-        display.setCursor(xMargin + 0, yMargin + lineHeight * 5);
-        display.println(str_sprintf("POWR:%3.0lf%% %4uW\n",
+        drawLine(5, yMargin + lineHeight * 5, str_sprintf("POWR:%3.0lf%% %4uW",
                                     g_Values.Brite,
                                     g_Values.Watts));
     }
@@ -176,8 +348,7 @@ void BasicInfoSummary(bool bRedraw)
     if (display.height() >= lineHeight * 7)
     {
         auto& taskManager = g_ptrSystem->TaskManager();
-        display.setCursor(xMargin + 0, yMargin + lineHeight * 6);
-        display.println(str_sprintf("CPU: %3.0f%%, %3.0f%%  ", taskManager.GetCPUUsagePercent(0), taskManager.GetCPUUsagePercent(1)));
+        drawLine(6, yMargin + lineHeight * 6, str_sprintf("CPU: %3.0f%%, %3.0f%%  ", taskManager.GetCPUUsagePercent(0), taskManager.GetCPUUsagePercent(1)));
     }
 
     /* Old PSRAM code
@@ -230,7 +401,8 @@ void BasicInfoSummary(bool bRedraw)
 
 
 #ifndef ARDUINO_HELTEC_WIFI_KIT_32
-    display.drawRect(0, 0, display.width(), display.height(), borderColor);
+    if (bRedraw || !display.RetainsContent())
+        display.drawRect(0, 0, display.width(), display.height(), borderColor);
 #endif
 }
 
@@ -334,7 +506,8 @@ void CurrentEffectSummary(bool bRedraw)
     float ySizeVU = display.height() / 16; // vu is 1/20th the screen height, height of each block
     int cPixels = 16;
     float xSize = xHalf / cPixels + 1;                          // xSize is count of pixels in each block
-    int litBlocks = (g_Analyzer._VURatioFade / 2.0f) * cPixels; // litPixels is number that are lit
+    auto audio = g_Analyzer.GetAudioSnapshot();
+    int litBlocks = (audio.VURatioFade / 2.0f) * cPixels;      // litPixels is number that are lit
 
     for (int iPixel = 0; iPixel < cPixels; iPixel++) // For each pixel
     {
@@ -353,10 +526,10 @@ void CurrentEffectSummary(bool bRedraw)
         CRGB bandColor = ColorFromPalette(RainbowColors_p, ((int)map(iBand, 0, NUM_BANDS, 0, 255) + 0) % 256);
         int bandWidth = display.width() / NUM_BANDS;
         auto color16 = display.to16bit(bandColor);
-        auto topSection = bandHeight - bandHeight * g_Analyzer._peak2Decay[iBand];
+        auto topSection = bandHeight - bandHeight * audio.Peak2Decay[iBand];
         if (topSection > 0)
             display.fillRect(iBand * bandWidth, spectrumTop, bandWidth - 1, topSection, BLACK16);
-        auto val = min(1.0f, g_Analyzer._peak2Decay[iBand]);
+        auto val = min(1.0f, audio.Peak2Decay[iBand]);
         assert(bandHeight * val <= bandHeight);
         display.fillRect(iBand * bandWidth, spectrumTop + topSection, bandWidth - 1, bandHeight - topSection, color16);
     }
@@ -390,6 +563,16 @@ void IRAM_ATTR UpdateScreen(bool bRedraw)
 
     display.StartFrame();
 
+    #if ENABLE_SCREEN_PREVIEW
+        l_bPreviewWanted = (g_InfoPage == g_PreviewPage);
+        if (g_InfoPage == g_PreviewPage)
+        {
+            LEDPreview(bRedraw);
+            display.EndFrame();
+            return;
+        }
+    #endif
+
     switch (g_InfoPage)
     {
     case 0:
@@ -401,7 +584,8 @@ void IRAM_ATTR UpdateScreen(bool bRedraw)
         break;
 
     default:
-        throw new std::runtime_error("Invalid info page in UpateScreen");
+        COUNT_ERROR(ErrorCounter::InvalidInfoPage, "Invalid info page %d in UpdateScreen", (int) g_InfoPage);
+        g_InfoPage = 0;
         break;
     }
 
@@ -428,6 +612,10 @@ void IRAM_ATTR ScreenUpdateLoopEntry(void *)
 {
     //debugI(">> ScreenUpdateLoopEntry\n");
 
+    // A changed setting can change what the pages show, so it gets a redraw rather than waiting for the next one
+
+    g_ptrSystem->TaskManager().SubscribeToEvents((uint32_t) SystemEvent::ConfigChanged);
+
     bool bRedraw = true;
     for (;;)
     {
@@ -475,12 +663,9 @@ void IRAM_ATTR ScreenUpdateLoopEntry(void *)
 #endif
 
         UpdateScreen(bRedraw);
-        if (g_Values.UpdateStarted)
-            delay(200);
-        else
-            delay(50);
 
-        bRedraw = false;
+        auto events = NightDriverTaskManager::WaitForEvents(pdMS_TO_TICKS(g_Values.UpdateStarted ? 200 : 50));
+        bRedraw = events & (uint32_t) SystemEvent::ConfigChanged;
     }
 }
 
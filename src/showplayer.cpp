@@ -0,0 +1,198 @@
+//+--------------------------------------------------------------------------
+//
+// File:        showplayer.cpp
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+// Description:
+//
+//    Playback of pre-rendered shows from flash
+//
+//---------------------------------------------------------------------------
+
+#include "globals.h"
+#include "systemcontainer.h"
+#include "showplayer.h"
+
+#if ENABLE_SHOW_PLAYBACK
+
+bool ShowPlayer::begin()
+{
+    auto pPartition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, SHOW_PARTITION_LABEL);
+    if (!pPartition)
+    {
+        debugI("No %s partition, so no show to play", SHOW_PARTITION_LABEL);
+        return false;
+    }
+
+    const void * pMapped = nullptr;
+    if (esp_partition_mmap(pPartition, 0, pPartition->size, ESP_PARTITION_MMAP_DATA, &pMapped, &_hMapping) != ESP_OK)
+    {
+        debugW("Could not map the %s partition", SHOW_PARTITION_LABEL);
+        return false;
+    }
+
+    _pShow  = static_cast<const uint8_t *>(pMapped);
+    _cbShow = pPartition->size;
+
+    if (_cbShow < sizeof(ShowFileHeader) || Header().Magic != SHOW_FILE_MAGIC || Header().Version != SHOW_FILE_VERSION
+        || Header().FrameCount == 0 || Header().DurationMicros == 0)
+    {
+        debugI("The %s partition doesn't hold a show", SHOW_PARTITION_LABEL);
+        return false;
+    }
+
+    _pPacket.reset(PlacedAlloc<uint8_t>(STANDARD_DATA_HEADER_SIZE + NUM_LEDS * LED_DATA_SIZE + 1, Placement::Hot, "show packet"));
+    if (!_pPacket)
+    {
+        debugW("No memory to expand show frames into");
+        return false;
+    }
+
+    debugI("Show of %u frames, %.1f seconds long", Header().FrameCount, Header().DurationMicros / (double) MICROS_PER_SECOND);
+    return true;
+}
+
+bool ShowPlayer::AnyRingFull(uint16_t channel16) const
+{
+    auto & bufferManagers = g_ptrSystem->BufferManagers();
+
+    for (size_t iChannel = 0; iChannel < bufferManagers.size(); iChannel++)
+        if ((channel16 & (1 << iChannel)) && bufferManagers[iChannel].IsFull())
+            return true;
+    return false;
+}
+
+// PlayFrame
+//
+// Expands one frame straight from flash, stamps it with its time in this pass of the show, and hands it to the rings
+// once they have room for it
+
+bool ShowPlayer::PlayFrame(const ShowFrame & frame, const uint8_t * pStream, double showStart)
+{
+    if (frame.ExpandedSize < STANDARD_DATA_HEADER_SIZE || frame.ExpandedSize > STANDARD_DATA_HEADER_SIZE + NUM_LEDS * LED_DATA_SIZE)
+        return false;
+
+    if (!SocketServer::DecompressBuffer(pStream, frame.CompressedSize, _pPacket.get(), frame.ExpandedSize))
+        return false;
+
+    uint16_t command16 = WORDFromMemory(&_pPacket[0]);
+    if (command16 != WIFI_COMMAND_PIXELDATA64 && command16 != WIFI_COMMAND_PIXELDELTA64)
+        return false;
+
+    uint16_t channel16 = WORDFromMemory(&_pPacket[2]);
+    if (channel16 == 0)
+        channel16 = 1;
+
+    if (command16 == WIFI_COMMAND_PIXELDELTA64 && (channel16 & _brokenChannels))
+        return false;
+
+    // Whole seconds and the micros are kept apart so frames stay exact however long the clock has been running
+
+    double   due     = showStart + frame.OffsetMicros / (double) MICROS_PER_SECOND;
+    uint64_t seconds = (uint64_t) due;
+    uint64_t micros  = (uint64_t) ((due - seconds) * MICROS_PER_SECOND);
+
+    memcpy(&_pPacket[8], &seconds, sizeof(seconds));
+    memcpy(&_pPacket[16], &micros, sizeof(micros));
+
+    // The rings drop a frame they've no room for without saying so, so we wait for room, but no longer than until
+    // the frame is due, when it's too late to show anyway
+
+    while (AnyRingFull(channel16) && SyncedTime() < due)
+        delay(1);
+
+    if (AnyRingFull(channel16))
+    {
+        _brokenChannels |= channel16;
+        return false;
+    }
+
+    if (command16 == WIFI_COMMAND_PIXELDATA64)
+        _brokenChannels &= ~channel16;
+
+    return ProcessIncomingData(_pPacket, frame.ExpandedSize);
+}
+
+void ShowPlayer::PlaybackLoop()
+{
+    // The first pass starts a lead from now, so its first frame is in the rings in time to be shown
+
+    double showStart = SyncedTime() + SHOW_PLAYBACK_LEAD;
+    const double duration = Header().DurationMicros / (double) MICROS_PER_SECOND;
+
+    for (;;)
+    {
+        size_t offset = sizeof(ShowFileHeader);
+
+        for (uint32_t iFrame = 0; iFrame < Header().FrameCount; iFrame++)
+        {
+            if (offset + sizeof(ShowFrame) > _cbShow)
+                return;
+
+            ShowFrame frame;
+            memcpy(&frame, _pShow + offset, sizeof(frame));
+            offset += sizeof(frame);
+
+            if (offset + frame.CompressedSize > _cbShow)
+                return;
+
+            // Sleep until the frame is a lead away from being due.  If the clock jumped, as it does when it's first
+            // set from the network, the show just starts its timing over from here.
+
+            double untilQueued = showStart + frame.OffsetMicros / (double) MICROS_PER_SECOND - SHOW_PLAYBACK_LEAD - SyncedTime();
+            if (untilQueued > duration || untilQueued < -SHOW_PLAYBACK_LEAD)
+            {
+                debugI("Clock moved by %.1f seconds, retiming the show", untilQueued);
+                showStart -= untilQueued;
+                untilQueued = 0;
+            }
+            if (untilQueued > 0)
+                delay((uint32_t) (untilQueued * MILLIS_PER_SECOND));
+
+            if (PlayFrame(frame, _pShow + offset, showStart))
+                _cFrames++;
+            else
+                _cErrors++;
+
+            offset += frame.CompressedSize;
+        }
+
+        showStart += duration;
+        _cPasses++;
+    }
+}
+
+// ShowPlaybackTaskEntry
+//
+// Plays the show if there is one, and otherwise ends itself
+
+void IRAM_ATTR ShowPlaybackTaskEntry(void *)
+{
+    auto& showPlayer = g_ptrSystem->ShowPlayer();
+
+    if (showPlayer.begin())
+    {
+        showPlayer.PlaybackLoop();
+        debugW("Show in the %s partition is damaged, playback stopped", SHOW_PARTITION_LABEL);
+    }
+
+    vTaskDelete(nullptr);
+}
+
+#endif
@@ -0,0 +1,332 @@
+//+--------------------------------------------------------------------------
+//
+// File:        showrecorder.cpp
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+// Description:
+//
+//    Recording network frames to the show partition
+//
+//---------------------------------------------------------------------------
+
+#include "globals.h"
+#include "systemcontainer.h"
+#include "showplayer.h"
+#include "showrecorder.h"
+
+#if ENABLE_SHOW_RECORDER
+
+static constexpr size_t kPacketSize = STANDARD_DATA_HEADER_SIZE + NUM_LEDS * LED_DATA_SIZE;
+
+bool ShowRecorder::Start()
+{
+    if (!_pPartition)
+        _pPartition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, SHOW_PARTITION_LABEL);
+    if (!_pPartition || _pPartition->size < 2 * kSectorSize)
+        return false;
+
+    _command = Command::Start;
+    return true;
+}
+
+void ShowRecorder::Stop()
+{
+    _command = Command::Stop;
+}
+
+// FlushSector
+//
+// Erases one sector of the partition and writes it.  Flash operations hold up both cores while they run, which is as
+// good a reason as any for doing a sector at a time rather than erasing the partition up front.
+
+bool ShowRecorder::FlushSector(size_t iSector, const uint8_t * pSector)
+{
+    if (esp_partition_erase_range(_pPartition, iSector * kSectorSize, kSectorSize) != ESP_OK
+        || esp_partition_write(_pPartition, iSector * kSectorSize, pSector, kSectorSize) != ESP_OK)
+    {
+        debugW("Could not write sector %zu of the show", iSector);
+        return false;
+    }
+    return true;
+}
+
+// Append
+//
+// Adds bytes to the show, writing out each sector as it fills.  Returns false once the partition is full.
+
+bool ShowRecorder::Append(const void * pData, size_t cbData)
+{
+    auto pBytes = static_cast<const uint8_t *>(pData);
+
+    while (cbData > 0)
+    {
+        if (_offset >= _pPartition->size)
+            return false;
+
+        size_t iSector  = _offset / kSectorSize;
+        size_t inSector = _offset % kSectorSize;
+        size_t cbCopy   = std::min(cbData, kSectorSize - inSector);
+        uint8_t * pDest = iSector == 0 ? _pFirstSector.get() : _pSector.get();
+
+        memcpy(pDest + inSector, pBytes, cbCopy);
+        _offset += cbCopy;
+        pBytes  += cbCopy;
+        cbData  -= cbCopy;
+
+        if (iSector > 0 && _offset % kSectorSize == 0 && !FlushSector(iSector, _pSector.get()))
+            return false;
+    }
+    return true;
+}
+
+// Compress
+//
+// Makes a zlib stream of the data in the compressor's output buffer, and returns its length, or 0 if the buffer
+// couldn't grow to hold it.  uzlib only writes the deflate block, so the zlib header and the adler32 that the
+// player's uzlib checks are added around it.  The block can end part way through a byte, and the bits still pending
+// after it are only padding, so the adler32 goes in whole bytes after the last full one.
+
+size_t ShowRecorder::Compress(const uint8_t * pData, size_t cbData)
+{
+    memset(_pHashTable.get(), 0, sizeof(uzlib_hash_entry_t) << _comp.hash_bits);
+    _comp.out.outlen   = 0;
+    _comp.out.outbits  = 0;
+    _comp.out.noutbits = 0;
+
+    outbits(&_comp.out, 0x0178, 16);                    // 0x78 0x01: deflate with a 32K window, fastest
+    zlib_start_block(&_comp.out);
+    uzlib_compress(&_comp, pData, cbData);
+    zlib_finish_block(&_comp.out);
+
+    if (_comp.out.outlen + sizeof(uint32_t) > _comp.out.outsize)
+    {
+        auto pGrown = (unsigned char *) realloc(_comp.out.outbuf, _comp.out.outlen + sizeof(uint32_t));
+        if (!pGrown)
+            return 0;
+        _comp.out.outbuf  = pGrown;
+        _comp.out.outsize = _comp.out.outlen + sizeof(uint32_t);
+    }
+
+    uint32_t adler = uzlib_adler32(pData, cbData, 1);
+    for (int shift = 24; shift >= 0; shift -= 8)
+        _comp.out.outbuf[_comp.out.outlen++] = (adler >> shift) & 0xFF;
+
+    return _comp.out.outlen;
+}
+
+// Begin
+//
+// Sets up for a new recording.  The buffers are only around while recording, so a recorder that's never used costs
+// next to nothing.
+
+void ShowRecorder::Begin()
+{
+    _pFirstSector.reset(PlacedAlloc<uint8_t>(kSectorSize, Placement::Cold, "show sector 0"));
+    _pSector.reset(PlacedAlloc<uint8_t>(kSectorSize, Placement::Cold, "show sector"));
+    _pPacket.reset(PlacedAlloc<uint8_t>(kPacketSize, Placement::Cold, "show packet"));
+    _pPrevious.reset(PlacedAlloc<CRGB>(NUM_CHANNELS * NUM_LEDS, Placement::Cold, "show previous"));
+    _pHashTable.reset(PlacedAlloc<uzlib_hash_entry_t>(1 << SHOW_RECORD_HASH_BITS, Placement::Hot, "show hash"));
+
+    // uzlib grows its output buffer with realloc(), so it's the one buffer that comes straight from the heap
+
+    if (!_comp.out.outbuf)
+    {
+        _comp.out.outsize = kPacketSize / 2;
+        _comp.out.outbuf  = (unsigned char *) malloc(_comp.out.outsize);
+    }
+
+    if (!_pFirstSector || !_pSector || !_pPacket || !_pPrevious || !_pHashTable || !_comp.out.outbuf)
+    {
+        debugW("No memory to record a show");
+        Finish();
+        return;
+    }
+
+    _comp.hash_table = _pHashTable.get();
+    _comp.hash_bits  = SHOW_RECORD_HASH_BITS;
+    _comp.dict_size  = 32768;
+
+    memset(_pFirstSector.get(), 0xFF, kSectorSize);
+    memset(_cChannelFrames, 0, sizeof(_cChannelFrames));
+    memset(_channelLength, 0, sizeof(_channelLength));
+    _offset      = sizeof(ShowFileHeader);
+    _startMicros = -1;
+    _lastOffset  = 0;
+    _lastGap     = 0;
+    _bFull       = false;
+    _cFrames     = 0;
+    _cDropped    = 0;
+    _cbWritten   = 0;
+
+    xQueueReset(_queue);
+    _bRecording = true;
+    debugI("Recording a show to the %s partition", SHOW_PARTITION_LABEL);
+}
+
+// Finish
+//
+// Writes out the last sector and then the first, with the header, so an interrupted recording never looks like a
+// show, and lets go of the buffers
+
+void ShowRecorder::Finish()
+{
+    _bRecording = false;
+
+    if (_pFirstSector && _cFrames > 0)
+    {
+        size_t iLastSector = _offset / kSectorSize;
+        if (!_bFull && iLastSector > 0 && _offset % kSectorSize != 0)
+            FlushSector(iLastSector, _pSector.get());
+
+        ShowFileHeader header = { SHOW_FILE_MAGIC, SHOW_FILE_VERSION, 0, _cFrames, _lastOffset + std::max<uint64_t>(_lastGap, 1) };
+        memcpy(_pFirstSector.get(), &header, sizeof(header));
+        FlushSector(0, _pFirstSector.get());
+
+        debugI("Recorded a show of %u frames in %zu bytes, %u dropped", _cFrames.load(), _offset, _cDropped.load());
+    }
+
+    _pFirstSector.reset();
+    _pSector.reset();
+    _pPacket.reset();
+    _pPrevious.reset();
+    _pHashTable.reset();
+    free(_comp.out.outbuf);
+    _comp.out.outbuf = nullptr;
+}
+
+// RecordFrame
+//
+// Copies the frame out of its slot, and gives up on it if the producer has started on another frame in the slot since
+
+void ShowRecorder::RecordFrame(const TeeEntry & entry)
+{
+    const LEDBuffer & buffer = *entry.pBuffer;
+    uint32_t length  = std::min<uint32_t>(buffer.Length(), NUM_LEDS);
+    uint64_t seconds = buffer.Seconds();
+    uint64_t micros  = buffer.MicroSeconds();
+
+    memcpy(&_pPacket[STANDARD_DATA_HEADER_SIZE], buffer.Pixels(), length * LED_DATA_SIZE);
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (buffer.Generation() != entry.generation)
+    {
+        _cDropped++;
+        return;
+    }
+
+    // The offsets count from the first frame, by the frames' own timestamps where they have them
+
+    int64_t frameMicros = seconds ? (int64_t) (seconds * MICROS_PER_SECOND + micros) : entry.arrivalMicros;
+    if (_startMicros < 0)
+        _startMicros = frameMicros;
+    uint64_t offsetMicros = std::max<int64_t>(frameMicros - _startMicros, (int64_t) _lastOffset);
+
+    // Every so often a channel gets a keyframe, so one bad frame can't spoil the rest of the show; the rest are XORed
+    // against the channel's previous frame, which mostly zeroes them out and compresses them to very little.  A frame
+    // whose length changed has nothing to be a delta of.
+
+    CRGB * pPrevious = &_pPrevious[entry.iChannel * NUM_LEDS];
+    auto & cFrames   = _cChannelFrames[entry.iChannel];
+    bool bKeyframe   = cFrames % SHOW_RECORD_KEYFRAME_INTERVAL == 0 || _channelLength[entry.iChannel] != length;
+    _channelLength[entry.iChannel] = length;
+
+    uint8_t * pColors = &_pPacket[STANDARD_DATA_HEADER_SIZE];
+    uint8_t * pLast   = reinterpret_cast<uint8_t *>(pPrevious);
+
+    for (size_t i = 0; i < length * LED_DATA_SIZE; i++)
+    {
+        uint8_t color = pColors[i];
+        if (!bKeyframe)
+            pColors[i] ^= pLast[i];
+        pLast[i] = color;
+    }
+
+    uint16_t command16 = bKeyframe ? WIFI_COMMAND_PIXELDATA64 : WIFI_COMMAND_PIXELDELTA64;
+    uint16_t channel16 = 1 << entry.iChannel;
+    uint64_t zero      = 0;                             // The player stamps each frame with its time in the show
+
+    memcpy(&_pPacket[0], &command16, sizeof(command16));
+    memcpy(&_pPacket[2], &channel16, sizeof(channel16));
+    memcpy(&_pPacket[4], &length, sizeof(length));
+    memcpy(&_pPacket[8], &zero, sizeof(zero));
+    memcpy(&_pPacket[16], &zero, sizeof(zero));
+
+    size_t cbPacket     = STANDARD_DATA_HEADER_SIZE + length * LED_DATA_SIZE;
+    size_t cbCompressed = Compress(_pPacket.get(), cbPacket);
+    if (!cbCompressed)
+    {
+        _channelLength[entry.iChannel] = 0;             // The next frame has no delta to build on, so make it a keyframe
+        _cDropped++;
+        return;
+    }
+
+    ShowFrame frame     = { offsetMicros, (uint32_t) cbCompressed, (uint32_t) cbPacket };
+
+    size_t offsetBefore = _offset;
+    if (!Append(&frame, sizeof(frame)) || !Append(_comp.out.outbuf, cbCompressed))
+    {
+        // Out of room: the show ends with the last frame that fit, and the sectors up to it have all been written
+
+        _offset = offsetBefore;
+        _bFull  = true;
+        _cDropped++;
+        debugW("Show partition is full, stopping the recording");
+        Finish();
+        return;
+    }
+
+    if (offsetMicros > _lastOffset)
+        _lastGap = offsetMicros - _lastOffset;
+    _lastOffset = offsetMicros;
+    cFrames++;
+    _cFrames++;
+    _cbWritten = _offset;
+}
+
+void ShowRecorder::WriterLoop()
+{
+    for (;;)
+    {
+        auto command = _command.exchange(Command::None);
+
+        if (command == Command::Stop && _bRecording)
+            Finish();
+        else if (command == Command::Start)
+        {
+            if (_bRecording)
+                Finish();
+            Begin();
+        }
+
+        TeeEntry entry;
+        if (xQueueReceive(_queue, &entry, pdMS_TO_TICKS(100)) == pdTRUE && _bRecording)
+            RecordFrame(entry);
+    }
+}
+
+// ShowRecorderTaskEntry
+//
+// The writer task, which spends nearly all its time waiting for frames
+
+void IRAM_ATTR ShowRecorderTaskEntry(void *)
+{
+    g_ptrSystem->ShowRecorder().WriterLoop();
+}
+
+#endif
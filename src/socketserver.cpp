@@ -3,6 +3,228 @@
 
 #if INCOMING_WIFI_ENABLED
 
+extern DRAM_ATTR std::mutex g_buffer_mutex;
+
+// ReserveChannelBuffer
+//
+// Claims the head slot of a channel's ring so it can be filled without holding the (producer side) mutex
+
+static std::shared_ptr<LEDBuffer> ReserveChannelBuffer(size_t iChannel)
+{
+    auto guard = TimedLock(g_buffer_mutex, FrameStage::ProducerLock);
+    return g_ptrSystem->BufferManagers()[iChannel].ReserveNewBuffer();
+}
+
+// CommitChannelBuffer
+//
+// Publishes the slot claimed by ReserveChannelBuffer.  A resend of the newest frame just becomes another frame with
+// the same timestamp, as ProcessIncomingData does, and the draw loop skips over the older of the two.
+
+static void CommitChannelBuffer(size_t iChannel)
+{
+    auto guard = TimedLock(g_buffer_mutex, FrameStage::ProducerLock);
+    auto& bufferManager = g_ptrSystem->BufferManagers()[iChannel];
+
+    if (bufferManager.CommitNewBuffer())
+    {
+        #if ENABLE_SHOW_RECORDER
+            g_ptrSystem->ShowRecorder().TeeNewest(iChannel, bufferManager);
+        #endif
+    }
+}
+
+// ReceivePixelDataInPlace
+//
+// The normal path reads the whole packet into _pBuffer and then UpdateFromWire copies the pixels into an LEDBuffer,
+// which is two full-frame copies per packet.  Here we claim the head slot of the ring, read the payload into it, and
+// then publish it.  The slot at the head of the ring is never readable by the draw loop, so the only consumer-visible
+// step is the commit.
+
+bool SocketServer::ReceivePixelDataInPlace(int socket, size_t iChannel, uint32_t pixelCount, uint64_t seconds, uint64_t micros)
+{
+    auto pBuffer = ReserveChannelBuffer(iChannel);
+
+    if (false == ReadIntoBuffer(socket, pBuffer->RawPixels(), pixelCount * LED_DATA_SIZE))
+        return false;
+
+    if (false == pBuffer->SetFrameInfo(pixelCount, seconds, micros))
+        return false;
+
+    CommitChannelBuffer(iChannel);
+    return true;
+}
+
+#if SOCKET_STREAMING_INFLATE
+
+// The inflate state lives in internal RAM rather than on the socket task's stack, as the huffman trees alone
+// are over a kilobyte.  The uzlib_uncomp must come first, as the read callback casts back to the outer struct.
+
+struct SocketInflateSource
+{
+    struct uzlib_uncomp d;
+    SocketServer *      pServer;
+    int                 socket;
+    size_t              cbRemaining;
+};
+
+static DRAM_ATTR SocketInflateSource l_inflateSource;
+static DRAM_ATTR uint8_t l_abInflateChunk[SOCKET_INFLATE_CHUNK_SIZE];
+
+// ReadCompressedFromSocket
+//
+// uzlib source callback that refills the small chunk buffer from the socket, never reading past the end of the
+// current compressed packet
+
+static int ReadCompressedFromSocket(struct uzlib_uncomp * pd)
+{
+    auto pSource = reinterpret_cast<SocketInflateSource *>(pd);
+    if (pSource->cbRemaining == 0)
+        return -1;
+
+    int cbRead = pSource->pServer->ReadSocket(pSource->socket, l_abInflateChunk, std::min(pSource->cbRemaining, sizeof(l_abInflateChunk)));
+    if (cbRead <= 0)
+    {
+        debugW("ERROR: %d bytes read from socket with %u compressed bytes outstanding\n", cbRead, pSource->cbRemaining);
+        return -1;
+    }
+
+    pSource->cbRemaining -= cbRead;
+    pd->source       = l_abInflateChunk + 1;
+    pd->source_limit = l_abInflateChunk + cbRead;
+    return l_abInflateChunk[0];
+}
+
+// InflateInto
+//
+// Expands exactly cbWanted bytes of the stream into pDest.  Because back-references are served from the dictionary
+// ring, consecutive calls can target unrelated buffers.
+
+static bool InflateInto(uint8_t * pDest, size_t cbWanted)
+{
+    auto& d = l_inflateSource.d;
+    if (cbWanted == 0)
+        return true;
+
+    d.dest_start = pDest;
+    d.dest       = pDest;
+    d.dest_limit = pDest + cbWanted;
+
+    int res = uzlib_uncompress_chksum(&d);
+    if ((res != TINF_OK && res != TINF_DONE) || d.dest != d.dest_limit)
+    {
+        debugE("Error during decompression after producing %d of %u bytes: %d\n", d.dest - pDest, cbWanted, res);
+        return false;
+    }
+    return true;
+}
+
+// FinishInflate
+//
+// Runs the stream to its end so the checksum gets verified, then discards anything the sender put after it so the
+// next packet header starts where we expect.  This replaces the old one byte overreach on the output buffer.
+
+static bool FinishInflate()
+{
+    auto& d = l_inflateSource.d;
+    uint8_t extra;
+
+    d.dest_start = &extra;
+    d.dest       = &extra;
+    d.dest_limit = &extra + 1;
+
+    int res = uzlib_uncompress_chksum(&d);
+    if (res != TINF_DONE || d.dest != &extra)
+    {
+        debugE("Compressed data did not end where expected: %d\n", res);
+        return false;
+    }
+
+    while (l_inflateSource.cbRemaining > 0)
+        if (ReadCompressedFromSocket(&d) < 0)
+            return false;
+
+    return true;
+}
+
+// ReceiveCompressedPacket
+//
+// Inflates a compressed packet as it comes off the socket, so the compressed bytes are never staged in _pBuffer (or
+// a PSRAM bounce buffer) first.  The inner header is expanded on its own, and if it turns out to be a single-channel
+// pixel packet the color data is inflated directly into the channel's next LEDBuffer.  Anything else is expanded
+// into _abOutputBuffer and goes through ProcessIncomingData like before.
+
+bool SocketServer::ReceiveCompressedPacket(int socket, uint32_t compressedSize, uint32_t expandedSize)
+{
+    if (!_abInflateDict)
+    {
+        debugE("No dictionary for streaming decompression\n");
+        return false;
+    }
+
+    if (expandedSize < STANDARD_DATA_HEADER_SIZE || _cbReceived > COMPRESSED_HEADER_SIZE + compressedSize)
+    {
+        debugW("Compressed packet sizes don't add up: compressed %u, expanded %u\n", compressedSize, expandedSize);
+        return false;
+    }
+
+    // Whatever part of the stream came in with the header read is used first, then the callback takes over
+
+    auto& d = l_inflateSource.d;
+    memset(&d, 0, sizeof(d));
+    uzlib_uncompress_init(&d, _abInflateDict.get(), SOCKET_INFLATE_DICT_SIZE);
+
+    d.source                    = &_pBuffer[COMPRESSED_HEADER_SIZE];
+    d.source_limit              = &_pBuffer[_cbReceived];
+    d.source_read_cb            = ReadCompressedFromSocket;
+    l_inflateSource.pServer     = this;
+    l_inflateSource.socket      = socket;
+    l_inflateSource.cbRemaining = COMPRESSED_HEADER_SIZE + compressedSize - _cbReceived;
+
+    if (uzlib_zlib_parse_header(&d) < 0)
+    {
+        debugE("ERROR: Cannot parse zlib data header\n");
+        return false;
+    }
+
+    if (false == InflateInto(_abOutputBuffer.get(), STANDARD_DATA_HEADER_SIZE))
+        return false;
+
+    #if SOCKET_ZERO_COPY
+        uint16_t command16   = WORDFromMemory(&_abOutputBuffer[0]);
+        uint16_t channel16   = WORDFromMemory(&_abOutputBuffer[2]);
+        uint32_t length32    = DWORDFromMemory(&_abOutputBuffer[4]);
+        uint64_t seconds     = ULONGFromMemory(&_abOutputBuffer[8]);
+        uint64_t micros      = ULONGFromMemory(&_abOutputBuffer[16]);
+        uint16_t channelMask = channel16 == 0 ? 1 : channel16;
+        size_t   iChannel    = __builtin_ctz(channelMask);
+
+        if (command16 == WIFI_COMMAND_PIXELDATA64
+            && (channelMask & (channelMask - 1)) == 0
+            && iChannel < g_ptrSystem->BufferManagers().size()
+            && length32 <= NUM_LEDS
+            && expandedSize == STANDARD_DATA_HEADER_SIZE + length32 * LED_DATA_SIZE)
+        {
+            auto pBuffer = ReserveChannelBuffer(iChannel);
+
+            if (false == InflateInto(pBuffer->RawPixels(), length32 * LED_DATA_SIZE) || false == FinishInflate())
+                return false;
+
+            if (false == pBuffer->SetFrameInfo(length32, seconds, micros))
+                return false;
+
+            CommitChannelBuffer(iChannel);
+            return true;
+        }
+    #endif
+
+    if (false == InflateInto(&_abOutputBuffer[STANDARD_DATA_HEADER_SIZE], expandedSize - STANDARD_DATA_HEADER_SIZE) || false == FinishInflate())
+        return false;
+
+    return ProcessIncomingData(_abOutputBuffer, expandedSize);
+}
+
+#endif
+
 int SocketServer::ProcessIncomingConnectionsLoop()
 {
     if (0 == _server_fd)
@@ -34,6 +256,26 @@ int SocketServer::ProcessIncomingConnectionsLoop()
 
     debugV("Incoming connection from: %s", inet_ntoa(addr.sin_addr));
 
+    #if ENABLE_CLOCK_SYNC && ENABLE_WIFI
+        g_ClockSync.SetReference(addr.sin_addr.s_addr);     // Whoever sends us frames is who we time them against
+    #endif
+
+    ResetReadAhead();
+    _lastResponseZone = -1;                             // So the new sender hears from us on its first packet
+
+    // The response packets are small, and we don't want Nagle holding them back waiting for more.  A bigger receive
+    // window lets a sender keep several frames in flight; lwIP may not support changing it, which is fine.
+
+    int nodelay = 1;
+    if (setsockopt(new_socket, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay)) < 0)
+        debugW("Unable to set TCP_NODELAY on socket");
+
+    // The streaming radio profile asks for a bigger one still, as it's there to keep frames coming in quickly
+
+    int rcvbuf = GetAppliedRadioProfile() == RADIO_PROFILE_STREAMING ? std::max(SOCKET_RCVBUF, SOCKET_STREAMING_RCVBUF) : SOCKET_RCVBUF;
+    if (rcvbuf && setsockopt(new_socket, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)) < 0)
+        debugW("Unable to set SO_RCVBUF to %d on socket", rcvbuf);
+
     // Set a timeout of 3 seconds on the socket so we don't permanently hang on a corrupt or partial packet
 
     struct timeval to;
@@ -51,6 +293,10 @@ int SocketServer::ProcessIncomingConnectionsLoop()
     {
         bool bSendResponsePacket = false;
 
+        #if USE_PSRAM && !SOCKET_STREAMING_INFLATE
+            _scratch.Reset();
+        #endif
+
             // Read until we have at least enough for the data header
 
         if (false == ReadUntilNBytesReceived(new_socket, STANDARD_DATA_HEADER_SIZE))
@@ -59,6 +305,8 @@ int SocketServer::ProcessIncomingConnectionsLoop()
             break;
         }
 
+        TIME_STAGE(SocketPacket);
+
         // Now that we have the header we can see how much more data is expected to follow
 
         const uint32_t header  = _pBuffer[3] << 24  | _pBuffer[2] << 16  | _pBuffer[1] << 8  | _pBuffer[0];
@@ -75,37 +323,56 @@ int SocketServer::ProcessIncomingConnectionsLoop()
                 break;
             }
 
-            if (false == ReadUntilNBytesReceived(new_socket, COMPRESSED_HEADER_SIZE + compressedSize))
-            {
-                debugW("Could not read compressed data from stream\n");
-                break;
-            }
-            debugV("Successfuly read %u bytes", COMPRESSED_HEADER_SIZE + compressedSize);
+            #if SOCKET_STREAMING_INFLATE
 
-            // If our buffer is in PSRAM it would be expensive to decompress in place, as the SPIRAM doesn't like
-            // non-linear access from what I can tell.  I bet it must send addr+len to request each unique read, so
-            // one big read one time would work best, and we use that to copy it to a regular RAM buffer.
+                if (false == ReceiveCompressedPacket(new_socket, compressedSize, expandedSize))
+                {
+                    debugW("Error receiving compressed data\n");
+                    break;
+                }
 
-            #if USE_PSRAM
-                std::unique_ptr<uint8_t []> _abTempBuffer = std::make_unique<uint8_t []>(MAXIMUM_PACKET_SIZE+1);    // Plus one for uzlib buffer overreach bug
-                memcpy(_abTempBuffer.get(), _pBuffer.get(), MAXIMUM_PACKET_SIZE);
-                auto pSourceBuffer = &_abTempBuffer[COMPRESSED_HEADER_SIZE];
             #else
-                auto pSourceBuffer = &_pBuffer[COMPRESSED_HEADER_SIZE];
-            #endif
 
-            if (!DecompressBuffer(pSourceBuffer, compressedSize, _abOutputBuffer.get(), expandedSize))
-            {
-                debugW("Error decompressing data\n");
-                break;
-            }
+                if (false == ReadUntilNBytesReceived(new_socket, COMPRESSED_HEADER_SIZE + compressedSize))
+                {
+                    debugW("Could not read compressed data from stream\n");
+                    break;
+                }
+                debugV("Successfuly read %u bytes", COMPRESSED_HEADER_SIZE + compressedSize);
+
+                // If our buffer is in PSRAM it would be expensive to decompress in place, as the SPIRAM doesn't like
+                // non-linear access from what I can tell.  I bet it must send addr+len to request each unique read, so
+                // one big read one time would work best, and we use that to copy it to a regular RAM buffer.
+
+                #if USE_PSRAM
+                    // The copy comes out of the packet's scratch memory, so it's only allocated on the heap if that
+                    // couldn't be had at startup
+                    std::unique_ptr<uint8_t []> _abTempBuffer;
+                    auto pTempBuffer = _scratch.Allocate<uint8_t>(MAXIMUM_PACKET_SIZE+1);                            // Plus one for uzlib buffer overreach bug
+                    if (!pTempBuffer)
+                    {
+                        _abTempBuffer = std::make_unique<uint8_t []>(MAXIMUM_PACKET_SIZE+1);
+                        pTempBuffer = _abTempBuffer.get();
+                    }
+                    memcpy(pTempBuffer, _pBuffer.get(), MAXIMUM_PACKET_SIZE);
+                    auto pSourceBuffer = &pTempBuffer[COMPRESSED_HEADER_SIZE];
+                #else
+                    auto pSourceBuffer = &_pBuffer[COMPRESSED_HEADER_SIZE];
+                #endif
 
-            if (false == ProcessIncomingData(_abOutputBuffer, expandedSize))
-            {
-                debugW("Error processing data\n");
-                break;
+                if (!DecompressBuffer(pSourceBuffer, compressedSize, _abOutputBuffer.get(), expandedSize))
+                {
+                    debugW("Error decompressing data\n");
+                    break;
+                }
 
-            }
+                if (false == ProcessIncomingData(_abOutputBuffer, expandedSize))
+                {
+                    debugW("Error processing data\n");
+                    break;
+                }
+
+            #endif
             ResetReadBuffer();
             bSendResponsePacket = true;
         }
@@ -155,9 +422,10 @@ int SocketServer::ProcessIncomingConnectionsLoop()
                 ResetReadBuffer();
 
             }
-            else if (command16 == WIFI_COMMAND_PIXELDATA64)
+            else if (command16 == WIFI_COMMAND_PIXELDATA64 || command16 == WIFI_COMMAND_PIXELDELTA64)
             {
-                // We know it's pixel data, so we do some validation before calling Process.
+                // We know it's pixel data, so we do some validation before calling Process.  Deltas have the same
+                // layout but need the previous frame, so they always go through ProcessIncomingData.
 
                 uint16_t channel16 = WORDFromMemory(&_pBuffer.get()[2]);
                 uint32_t length32  = DWORDFromMemory(&_pBuffer.get()[4]);
@@ -173,19 +441,40 @@ int SocketServer::ProcessIncomingConnectionsLoop()
                     break;
                 }
 
-                debugV("Expecting %zu total bytes", totalExpected);
-                if (false == ReadUntilNBytesReceived(new_socket, totalExpected))
-                {
-                    debugW("Error in getting pixel data from wifi\n");
-                    break;
-                }
+                bool bReceivedInPlace = false;
 
-                // Add it to the buffer ring
+                #if SOCKET_ZERO_COPY
+                    // If the packet is for exactly one channel, we can read the color data straight into its buffer ring
 
-                if (false == ProcessIncomingData(_pBuffer, totalExpected))
+                    uint16_t channelMask = channel16 == 0 ? 1 : channel16;
+                    size_t iChannel = __builtin_ctz(channelMask);
+                    if (command16 == WIFI_COMMAND_PIXELDATA64 && (channelMask & (channelMask - 1)) == 0 && iChannel < g_ptrSystem->BufferManagers().size())
+                    {
+                        if (false == ReceivePixelDataInPlace(new_socket, iChannel, length32, seconds, micros))
+                        {
+                            debugW("Error in receiving pixel data in place from wifi\n");
+                            break;
+                        }
+                        bReceivedInPlace = true;
+                    }
+                #endif
+
+                if (!bReceivedInPlace)
                 {
-                    debugW("Error in processing pixel data from wifi\n");
-                    break;
+                    debugV("Expecting %zu total bytes", totalExpected);
+                    if (false == ReadUntilNBytesReceived(new_socket, totalExpected))
+                    {
+                        debugW("Error in getting pixel data from wifi\n");
+                        break;
+                    }
+
+                    // Add it to the buffer ring
+
+                    if (false == ProcessIncomingData(_pBuffer, totalExpected))
+                    {
+                        debugW("Error in processing pixel data from wifi\n");
+                        break;
+                    }
                 }
 
                 // Consume the data by resetting the buffer
@@ -205,10 +494,15 @@ int SocketServer::ProcessIncomingConnectionsLoop()
 
         ResetReadBuffer();
 
-        if (bSendResponsePacket)
+        auto& bufferManager = g_ptrSystem->BufferManagers()[0];
+
+        if (bSendResponsePacket && ShouldSendResponse(bufferManager))
         {
             debugV("Sending Response Packet from Socket Server");
-            auto& bufferManager = g_ptrSystem->BufferManagers()[0];
+
+            #if SOCKET_RESPONSE_FEEDBACK
+                auto presented = g_IngestStats.LastPresented();
+            #endif
 
             SocketResponse response = {
                                         .size = sizeof(SocketResponse),
@@ -217,11 +511,28 @@ int SocketServer::ProcessIncomingConnectionsLoop()
                                         .oldestPacket = bufferManager.AgeOfOldestBuffer(),
                                         .newestPacket = bufferManager.AgeOfNewestBuffer(),
                                         .brightness   = g_Values.Brite,
-                                        .wifiSignal   = (float) WiFi.RSSI(),
+                                        .wifiSignal   = (float) g_Values.WiFiRSSI,
                                         .bufferSize   = bufferManager.BufferCount(),
                                         .bufferPos    = bufferManager.Depth(),
                                         .fpsDrawing   = g_Values.FPS,
-                                        .watts        = g_Values.Watts
+                                        .watts        = g_Values.Watts,
+                                        .radioProfile = (uint32_t) g_ptrSystem->DeviceConfig().GetRadioProfile(),
+                                        .extensions   = (SOCKET_RESPONSE_STATS ? SOCKET_RESPONSE_HAS_STATS : 0u)
+                                                      | (SOCKET_RESPONSE_FEEDBACK ? SOCKET_RESPONSE_HAS_FEEDBACK : 0u),
+                                    #if SOCKET_RESPONSE_STATS
+                                        .framesReceived  = g_IngestStats._cFrames.load(),
+                                        .framesFull      = g_IngestStats._cFull.load(),
+                                        .framesStale     = g_IngestStats._cStale.load(),
+                                        .framesPresented = g_IngestStats._cPresented.load(),
+                                        .decodeMicros    = g_IngestStats._usDecode.load(),
+                                        .latencyMicros   = g_IngestStats._usLatency.load(),
+                                    #endif
+                                    #if SOCKET_RESPONSE_FEEDBACK
+                                        .presentedTimestamp = presented.Timestamp,
+                                        .presentedDelta     = presented.Delta,
+                                        .frameMicros        = g_Values.FrameMicros,
+                                        .reserved2          = 0,
+                                    #endif
                                     };
 
             // I dont think this is fatal, and doesn't affect the read buffer, so content to ignore for now if it happens
@@ -232,6 +543,10 @@ int SocketServer::ProcessIncomingConnectionsLoop()
 
     close(new_socket);
     ResetReadBuffer();
+    ResetReadAhead();
+    #if USE_PSRAM && !SOCKET_STREAMING_INFLATE
+        _scratch.Release();                                                         // Held only while a client is connected
+    #endif
     return false;
 }
 
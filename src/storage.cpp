@@ -0,0 +1,99 @@
+//+--------------------------------------------------------------------------
+//
+// File:        storage.cpp
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+//
+// Description:
+//
+//    Implementations for the functions declared in storage.h
+//
+//---------------------------------------------------------------------------
+
+#include "globals.h"
+#include "storage.h"
+
+bool BeginFileSystem()
+{
+    #if USE_LITTLEFS
+        return LittleFS.begin(true, "/littlefs", 10, STORAGE_PARTITION_LABEL);
+    #else
+        return SPIFFS.begin(true);
+    #endif
+}
+
+bool WriteFileAtomically(const String & fileName, const uint8_t * pData, size_t length)
+{
+    String tempName = fileName + ATOMIC_WRITE_SUFFIX;
+
+    File file = FILESYSTEM.open(tempName, FILE_WRITE);
+    if (!file)
+    {
+        debugE("Unable to open file %s for writing!", tempName.c_str());
+        return false;
+    }
+
+    size_t bytesWritten = file.write(pData, length);
+    file.close();
+
+    if (bytesWritten != length)
+    {
+        debugE("Unable to write to file %s!", tempName.c_str());
+        FILESYSTEM.remove(tempName);
+        return false;
+    }
+
+    // LittleFS renames over the old file in one step.  SPIFFS won't rename onto a file that exists, so it has to go
+    // first; if the power goes in between, RecoverInterruptedWrite finds the new file under its temporary name.
+
+    #if !USE_LITTLEFS
+        FILESYSTEM.remove(fileName);
+    #endif
+
+    if (!FILESYSTEM.rename(tempName, fileName))
+    {
+        debugE("Unable to rename %s to %s!", tempName.c_str(), fileName.c_str());
+        FILESYSTEM.remove(tempName);
+        return false;
+    }
+
+    return true;
+}
+
+void RecoverInterruptedWrite(const String & fileName)
+{
+    String tempName = fileName + ATOMIC_WRITE_SUFFIX;
+
+    if (!FILESYSTEM.exists(tempName))
+        return;
+
+    // With the file still there, the write stopped before the temporary one was complete.  Without it, the
+    // temporary one was complete and only the rename is left to do.
+
+    if (FILESYSTEM.exists(fileName))
+    {
+        debugW("Removing incomplete write to %s", fileName.c_str());
+        FILESYSTEM.remove(tempName);
+    }
+    else
+    {
+        debugW("Completing interrupted write to %s", fileName.c_str());
+        FILESYSTEM.rename(tempName, fileName);
+    }
+}
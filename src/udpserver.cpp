@@ -0,0 +1,161 @@
+//+--------------------------------------------------------------------------
+//
+// File:        udpserver.cpp
+//
+// NightDriverStrip - (c) 2018 Plummer's Software LLC.  All Rights Reserved.
+//
+// This file is part of the NightDriver software project.
+//
+//    NightDriver is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    NightDriver is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with Nightdriver.  It is normally found in copying.txt
+//    If not, see <https://www.gnu.org/licenses/>.
+//
+// Description:
+//
+//    UDP/multicast ingest of LED data
+//
+//---------------------------------------------------------------------------
+
+#include "globals.h"
+#include "systemcontainer.h"
+
+#if ENABLE_UDP_INGEST
+
+// IsCurrentSequence
+//
+// Checks the sequence number against the last one seen for every channel in the mask, and records it if the
+// datagram is newer.  Sequence numbers are compared with wraparound, and one that is far behind is taken to mean
+// the sender restarted, in which case we resync to it.
+
+bool UDPServer::IsCurrentSequence(uint16_t channelMask, uint32_t sequence)
+{
+    for (int iChannel = 0; iChannel < NUM_CHANNELS; iChannel++)
+    {
+        if ((channelMask & (1 << iChannel)) == 0 || !_bHaveSequence[iChannel])
+            continue;
+
+        int32_t delta = (int32_t)(sequence - _lastSequence[iChannel]);
+        if (delta <= 0 && delta > -UDP_SEQUENCE_RESYNC)
+            return false;
+    }
+
+    for (int iChannel = 0; iChannel < NUM_CHANNELS; iChannel++)
+    {
+        if (channelMask & (1 << iChannel))
+        {
+            _lastSequence[iChannel]  = sequence;
+            _bHaveSequence[iChannel] = true;
+        }
+    }
+    return true;
+}
+
+// ProcessDatagram
+//
+// Validates and dispatches one packet, which has been received into _pBuffer
+
+bool UDPServer::ProcessDatagram(uint32_t sequence, size_t cbPacket)
+{
+    if (cbPacket < COMPRESSED_HEADER_SIZE)
+        return false;
+
+    std::unique_ptr<uint8_t []> * pPacket = &_pBuffer;
+
+    const uint32_t header = DWORDFromMemory(&_pBuffer[0]);
+    if (header == COMPRESSED_HEADER)
+    {
+        uint32_t compressedSize = DWORDFromMemory(&_pBuffer[4]);
+        uint32_t expandedSize   = DWORDFromMemory(&_pBuffer[8]);
+
+        if (expandedSize > MAXIMUM_PACKET_SIZE || COMPRESSED_HEADER_SIZE + compressedSize > cbPacket)
+        {
+            debugW("Bad compressed UDP packet: compressedSize %u, expandedSize %u, datagram %zu", compressedSize, expandedSize, cbPacket);
+            return false;
+        }
+
+        if (!SocketServer::DecompressBuffer(&_pBuffer[COMPRESSED_HEADER_SIZE], compressedSize, _abOutputBuffer.get(), expandedSize))
+            return false;
+
+        pPacket  = &_abOutputBuffer;
+        cbPacket = expandedSize;
+    }
+
+    if (cbPacket < STANDARD_DATA_HEADER_SIZE)
+        return false;
+
+    uint16_t command16 = WORDFromMemory(&(*pPacket)[0]);
+    if (command16 == WIFI_COMMAND_PIXELDATA64 || command16 == WIFI_COMMAND_PIXELDELTA64)
+    {
+        uint16_t channel16 = WORDFromMemory(&(*pPacket)[2]);
+        if (!IsCurrentSequence(channel16 == 0 ? 1 : channel16, sequence))
+        {
+            debugV("Dropping stale UDP datagram with sequence %u", sequence);
+            _cDropped++;
+            return true;
+        }
+    }
+    else if (command16 != WIFI_COMMAND_PEAKDATA && command16 != WIFI_COMMAND_BEATDATA)
+    {
+        debugW("Unknown command in UDP packet received: %d\n", command16);
+        return false;
+    }
+
+    return ProcessIncomingData(*pPacket, cbPacket);
+}
+
+// ProcessIncomingDatagramsLoop
+//
+// The UDP header is scattered into its own small buffer so the packet itself lands at the start of _pBuffer,
+// where ProcessIncomingData expects it.
+
+void UDPServer::ProcessIncomingDatagramsLoop()
+{
+    uint8_t abHeader[UDP_PIXEL_HEADER_SIZE];
+
+    while (WiFi.isConnected())
+    {
+        struct iovec iov[2];
+        iov[0].iov_base = abHeader;
+        iov[0].iov_len  = sizeof(abHeader);
+        iov[1].iov_base = _pBuffer.get();
+        iov[1].iov_len  = MAXIMUM_PACKET_SIZE;
+
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov    = iov;
+        msg.msg_iovlen = 2;
+
+        int cbRead = recvmsg(_fd, &msg, 0);
+        if (cbRead < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                continue;
+
+            debugW("Error %d receiving UDP datagram", errno);
+            return;
+        }
+
+        if (cbRead < UDP_PIXEL_HEADER_SIZE || DWORDFromMemory(abHeader) != UDP_PIXEL_HEADER || (msg.msg_flags & MSG_TRUNC))
+        {
+            debugV("Ignoring malformed UDP datagram of %d bytes", cbRead);
+            _cDropped++;
+            continue;
+        }
+
+        _cReceived++;
+        if (!ProcessDatagram(DWORDFromMemory(&abHeader[4]), cbRead - UDP_PIXEL_HEADER_SIZE))
+            _cDropped++;
+    }
+}
+
+#endif
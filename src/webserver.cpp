@@ -33,6 +33,16 @@
 #include "systemcontainer.h"
 #include "soundanalyzer.h"
 #include "improvserial.h"
+#include "effectreplay.h"
+
+#if ENABLE_SPEC_RESPONSE_CACHE
+#include "deflate.h"
+
+extern "C"
+{
+    #include "uzlib/src/uzlib.h"
+}
+#endif
 
 // Static member initializers
 
@@ -41,12 +51,22 @@ const std::map<String, CWebServer::ValueValidator> CWebServer::settingValidators
 {
     { DeviceConfig::OpenWeatherApiKeyTag, [](const String& value) { return g_ptrSystem->DeviceConfig().ValidateOpenWeatherAPIKey(value); } },
     { DeviceConfig::PowerLimitTag,        [](const String& value) { return g_ptrSystem->DeviceConfig().ValidatePowerLimit(value); } },
-    { DeviceConfig::BrightnessTag,        [](const String& value) { return g_ptrSystem->DeviceConfig().ValidateBrightness(value); } }
+    { DeviceConfig::BrightnessTag,        [](const String& value) { return g_ptrSystem->DeviceConfig().ValidateBrightness(value); } },
+#if ENABLE_AUDIO
+    { DeviceConfig::AudioProfileTag,      [](const String& value) { return g_ptrSystem->DeviceConfig().ValidateAudioProfile(value); } },
+#endif
+    { DeviceConfig::RadioProfileTag,      [](const String& value) { return g_ptrSystem->DeviceConfig().ValidateRadioProfile(value); } },
+    { DeviceConfig::TaskProfileTag,       [](const String& value) { return g_ptrSystem->DeviceConfig().ValidateTaskProfile(value); } },
 };
 
 std::vector<SettingSpec, psram_allocator<SettingSpec>> CWebServer::mySettingSpecs = {};
 std::vector<std::reference_wrapper<SettingSpec>> CWebServer::deviceSettingSpecs{};
 
+#if ENABLE_SPEC_RESPONSE_CACHE
+std::map<const LEDStripEffect *, std::shared_ptr<const CWebServer::CachedResponse>> CWebServer::specResponseCache{};
+uint32_t CWebServer::specResponseCacheVersion = 0;
+#endif
+
 // Member function template specializations
 
 // Push param that represents a bool. Values considered true are text "true" and any whole number not equal to 0
@@ -97,6 +117,109 @@ void CWebServer::AddCORSHeaderAndSendResponse<AsyncJsonResponse>(AsyncWebServerR
     AddCORSHeaderAndSendResponse<AsyncWebServerResponse>(pRequest, pResponse);
 }
 
+// Send a JSON stream as a chunked response, so it goes out a piece at a time
+void CWebServer::SendJsonStream(AsyncWebServerRequest * pRequest, std::shared_ptr<JsonArrayStream> pStream)
+{
+    auto response = pRequest->beginChunkedResponse("application/json", [pStream](uint8_t * buffer, size_t maxLen, size_t index)
+    {
+        return pStream->Fill(buffer, maxLen);
+    });
+    AddCORSHeaderAndSendResponse(pRequest, response);
+}
+
+#if ENABLE_SPEC_RESPONSE_CACHE
+
+// Gzip
+//
+// Compresses text into the gzip format a browser takes with Content-Encoding: gzip, which is deflate with a
+// header and a trailer around it
+
+static void Gzip(const std::vector<uint8_t, psram_allocator<uint8_t>> & text, uint32_t crc, std::vector<uint8_t, psram_allocator<uint8_t>> & out)
+{
+    static const uint8_t kGzipHeader[] = { 0x1f, 0x8b, 0x08, 0, 0, 0, 0, 0, 0x04, 0x03 };   // Deflate, no name or time, fastest, Unix
+
+    out.clear();
+    out.insert(out.end(), kGzipHeader, kGzipHeader + sizeof(kGzipHeader));
+    Deflater().Deflate(text.data(), text.size(), out);
+
+    // The trailer is the CRC and length of the text, both little endian
+
+    for (uint32_t value : { crc, (uint32_t) text.size() })
+        for (int i = 0; i < 4; i++)
+            out.push_back(value >> (8 * i));
+}
+
+// Runs a JSON stream to the end and keeps what it produced gzipped, with the CRC of the text as its ETag
+std::shared_ptr<const CWebServer::CachedResponse> CWebServer::BuildCachedResponse(JsonArrayStream & stream)
+{
+    std::vector<uint8_t, psram_allocator<uint8_t>> text;
+
+    size_t length;
+    do
+    {
+        size_t used = text.size();
+        text.resize(used + JSON_STREAM_ELEMENT_SIZE);
+        length = stream.Fill(text.data() + used, JSON_STREAM_ELEMENT_SIZE);
+        text.resize(used + length);
+    } while (length > 0);
+
+    auto pCached = std::make_shared<CachedResponse>();
+    uint32_t crc = ~uzlib_crc32(text.data(), text.size(), 0xffffffff);
+
+    pCached->ETag = "\"" + String(crc, HEX) + "\"";
+    Gzip(text, crc, pCached->Body);
+
+    debugV("Cached %zu bytes of JSON as %zu gzipped", text.size(), pCached->Body.size());
+    return pCached;
+}
+
+// Send a JSON stream from the cache, building it first if it's not in there yet.  Clients that don't take gzip
+//   get the stream as it is.  The cache is only used from the web server's own task, so it goes without a lock.
+void CWebServer::SendCachedResponse(AsyncWebServerRequest * pRequest, const LEDStripEffect * pKey, std::shared_ptr<JsonArrayStream> pStream)
+{
+    auto acceptEncoding = pRequest->getHeader("Accept-Encoding");
+    if (!acceptEncoding || acceptEncoding->value().indexOf("gzip") < 0)
+    {
+        SendJsonStream(pRequest, pStream);
+        return;
+    }
+
+    auto listVersion = g_ptrSystem->EffectManager().EffectListVersion();
+    if (listVersion != specResponseCacheVersion)
+    {
+        specResponseCache.clear();
+        specResponseCacheVersion = listVersion;
+    }
+
+    auto& pCachedEntry = specResponseCache[pKey];
+    if (!pCachedEntry)
+        pCachedEntry = BuildCachedResponse(*pStream);
+
+    // Holding on to our own reference keeps the body around until it's sent, even if the cache is emptied before then
+    auto pCached = pCachedEntry;
+
+    auto ifNoneMatch = pRequest->getHeader("If-None-Match");
+    if (ifNoneMatch && ifNoneMatch->value() == pCached->ETag)
+    {
+        auto response = pRequest->beginResponse(HTTP_CODE_NOT_MODIFIED);
+        response->addHeader("ETag", pCached->ETag);
+        AddCORSHeaderAndSendResponse(pRequest, response);
+        return;
+    }
+
+    auto response = pRequest->beginResponse("application/json", pCached->Body.size(), [pCached](uint8_t * buffer, size_t maxLen, size_t index)
+    {
+        size_t length = std::min(maxLen, pCached->Body.size() - index);
+        memcpy(buffer, pCached->Body.data() + index, length);
+        return length;
+    });
+    response->addHeader("Content-Encoding", "gzip");
+    response->addHeader("ETag", pCached->ETag);
+    AddCORSHeaderAndSendResponse(pRequest, response);
+}
+
+#endif
+
 // Member function implementations
 
 // begin - register page load handlers and start serving pages
@@ -133,11 +256,11 @@ void CWebServer::begin()
 
     debugI("Connecting Web Endpoints");
 
-    // SPIFFS file requests
+    // File system file requests
 
-    _server.on("/effectsConfig",         HTTP_GET,  [](AsyncWebServerRequest* pRequest) { pRequest->send(SPIFFS, EFFECTS_CONFIG_FILE,   "text/json"); });
+    _server.on("/effectsConfig",         HTTP_GET,  GetEffectsConfig);
     #if ENABLE_IMPROV_LOGGING
-        _server.on(IMPROV_LOG_FILE,      HTTP_GET,  [](AsyncWebServerRequest* pRequest) { pRequest->send(SPIFFS, IMPROV_LOG_FILE,       "text/plain"); });
+        _server.on(IMPROV_LOG_FILE,      HTTP_GET,  [](AsyncWebServerRequest* pRequest) { pRequest->send(FILESYSTEM, IMPROV_LOG_FILE,       "text/plain"); });
     #endif
 
     // Instance handler requests
@@ -145,6 +268,18 @@ void CWebServer::begin()
     _server.on("/statistics",            HTTP_GET,  [this](AsyncWebServerRequest* pRequest) { this->GetStatistics(pRequest); });
     _server.on("/getStatistics",         HTTP_GET,  [this](AsyncWebServerRequest* pRequest) { this->GetStatistics(pRequest); });
 
+    #if ENABLE_METRICS
+        _server.on("/metrics",           HTTP_GET,  GetMetrics);
+    #endif
+
+    #if ENABLE_STALL_WATCH
+        _server.on("/stalls",            HTTP_GET,  GetStalls);
+    #endif
+
+    #if ENABLE_TRACING
+        _server.on("/trace",             HTTP_GET,  GetTrace);
+    #endif
+
     // Static handler requests
 
     _server.on("/effects",               HTTP_GET,  GetEffectListText);
@@ -159,6 +294,32 @@ void CWebServer::begin()
     _server.on("/moveEffect",            HTTP_POST, MoveEffect);
     _server.on("/copyEffect",            HTTP_POST, CopyEffect);
     _server.on("/deleteEffect",          HTTP_POST, DeleteEffect);
+    _server.on("/effectBatch",           HTTP_POST, ApplyEffectBatch);
+
+    #if ENABLE_EFFECT_REPLAY
+        _server.on("/replay/record",     HTTP_POST, RecordReplayAudio);
+        _server.on("/replay",            HTTP_GET,  GetReplayReport);
+        _server.on("/replay",            HTTP_POST, StartReplay);
+    #endif
+
+    #if ENABLE_SHOW_RECORDER
+        _server.on("/show/record",       HTTP_GET,  GetShowRecording);
+        _server.on("/show/record",       HTTP_POST, SetShowRecording);
+    #endif
+
+    #if ENABLE_ASSET_STORE
+        _server.on("/assets/delete",     HTTP_POST, DeleteAsset);
+        _server.on("/assets/clear",      HTTP_POST, ClearAssets);
+        _server.on("/assets",            HTTP_GET,  GetAssets);
+        _server.on("/assets",            HTTP_POST, UploadAsset, nullptr, ReceiveAssetBody);
+    #endif
+
+    #if ENABLE_PLAYLISTS
+        _server.on("/playlists",         HTTP_GET,  GetPlaylists);
+        _server.on("/playlist",          HTTP_POST, SetPlaylist);
+        _server.on("/activatePlaylist",  HTTP_POST, ActivatePlaylist);
+        _server.on("/deletePlaylist",    HTTP_POST, DeletePlaylist);
+    #endif
 
     _server.on("/settings/effect/specs", HTTP_GET,  GetEffectSettingSpecs);
     _server.on("/settings/effect",       HTTP_GET,  GetEffectSettings);
@@ -183,6 +344,23 @@ void CWebServer::begin()
         ServeEmbeddedFile("/favicon.ico", ico_file);
     #endif
 
+    #if ENABLE_LIVE_STATE_SOCKET
+        _liveSocket.onEvent([this](AsyncWebSocket *, AsyncWebSocketClient *, AwsEventType type, void *, uint8_t *, size_t)
+        {
+            if (type == WS_EVT_CONNECT)
+                _bLiveStateFull = true;
+        });
+        _server.addHandler(&_liveSocket);
+    #endif
+
+    #if ENABLE_LED_PREVIEW_SOCKET
+        _previewSocket.onEvent([this](AsyncWebSocket *, AsyncWebSocketClient * pClient, AwsEventType type, void * pArg, uint8_t * pData, size_t length)
+        {
+            OnPreviewEvent(pClient, type, pArg, pData, length);
+        });
+        _server.addHandler(&_previewSocket);
+    #endif
+
     // Not found handler
 
     _server.onNotFound([](AsyncWebServerRequest *request)
@@ -217,62 +395,338 @@ long CWebServer::GetEffectIndexFromParam(AsyncWebServerRequest * pRequest, bool
     return strtol(pRequest->getParam("effectIndex", post, false)->value().c_str(), NULL, 10);
 }
 
+// Sends the effects config file as JSON, whichever format it's stored in
+void CWebServer::GetEffectsConfig(AsyncWebServerRequest * pRequest)
+{
+    #if ENABLE_BINARY_CONFIG
+        size_t bufferSize = 0;
+        std::unique_ptr<AllocatedJsonDocument> pJsonDoc;
+
+        if (!LoadJSONFile(EFFECTS_CONFIG_FILE, bufferSize, pJsonDoc))
+        {
+            pRequest->send(HTTP_CODE_NOT_FOUND);
+            return;
+        }
+
+        auto response = pRequest->beginResponseStream("text/json");
+        serializeJson(*pJsonDoc, *response);
+        pRequest->send(response);
+    #else
+        pRequest->send(FILESYSTEM, EFFECTS_CONFIG_FILE, "text/json");
+    #endif
+}
+
+// The per-effect fields of the effect list, in the order of the names the fields parameter picks them by
+
+enum EffectListField : uint8_t
+{
+    FieldName,
+    FieldEnabled,
+    FieldCore,
+    FieldDrawMs,
+    FieldFPS,
+    FieldTargetFPS,
+    FieldOverBudget,
+    FieldQuality,
+    FieldDRAM,
+    FieldPSRAM,
+    FieldMemoryOverBudget
+};
+
+static const char * const kEffectListFieldNames[] =
+{
+    "name", "enabled", "core", "drawMs", "fps", "targetFps", "overBudget", "quality", "dram", "psram", "memoryOverBudget"
+};
+
 void CWebServer::GetEffectListText(AsyncWebServerRequest * pRequest)
 {
-    static size_t jsonBufferSize = JSON_BUFFER_BASE_SIZE;
-    bool bufferOverflow;
     debugV("GetEffectListText");
 
-    do
+    auto& effectManager = g_ptrSystem->EffectManager();
+    auto& allEffects = effectManager.EffectsList();
+    auto version = effectManager.EffectChangeVersion();
+    StaticJsonDocument<384> headDoc;
+
+    headDoc["currentEffect"]         = effectManager.GetCurrentEffectIndex();
+    headDoc["millisecondsRemaining"] = effectManager.GetTimeRemainingForCurrentEffect();
+    headDoc["eternalInterval"]       = effectManager.IsIntervalEternal();
+    headDoc["effectInterval"]        = effectManager.GetInterval();
+    headDoc["effectCount"]           = allEffects.size();
+    headDoc["version"]               = version;
+
+    // Optional query parameters pick a range of the list and the fields to include for each effect
+
+    size_t start = pRequest->hasParam("start") ? strtoul(pRequest->getParam("start")->value().c_str(), NULL, 10) : 0;
+    start = std::min(start, allEffects.size());
+
+    size_t count = allEffects.size() - start;
+    if (pRequest->hasParam("count"))
+        count = std::min<size_t>(count, strtoul(pRequest->getParam("count")->value().c_str(), NULL, 10));
+
+    uint32_t fields = UINT32_MAX;
+    if (pRequest->hasParam("fields"))
     {
-        bufferOverflow = false;
-        auto response = std::make_unique<AsyncJsonResponse>(false, jsonBufferSize);
-        auto& j = response->getRoot();
-        auto& effectManager = g_ptrSystem->EffectManager();
+        fields = 0;
+        String fieldList = "," + pRequest->getParam("fields")->value() + ",";
+        for (size_t i = 0; i < std::size(kEffectListFieldNames); i++)
+            if (fieldList.indexOf(String(",") + kEffectListFieldNames[i] + ",") >= 0)
+                fields |= 1 << i;
+    }
+
+    // A client that already has this version of the list only needs the head, as none of the effects changed since
+
+    if (pRequest->hasParam("since") && strtoul(pRequest->getParam("since")->value().c_str(), NULL, 10) == version)
+    {
+        headDoc["unchanged"] = true;
+        count = 0;
+    }
+
+    if (start > 0)
+        headDoc["start"] = start;
 
-        j["currentEffect"]         = effectManager.GetCurrentEffectIndex();
-        j["millisecondsRemaining"] = effectManager.GetTimeRemainingForCurrentEffect();
-        j["eternalInterval"]       = effectManager.IsIntervalEternal();
-        j["effectInterval"]        = effectManager.GetInterval();
+    // The range is copied so the effects stay around while the response goes out, even if one is deleted meanwhile
 
-        for (auto effect : effectManager.EffectsList())
+    std::vector<std::shared_ptr<LEDStripEffect>> effects(allEffects.begin() + start, allEffects.begin() + start + count);
+
+    SendJsonStream(pRequest, std::make_shared<JsonArrayStream>(JsonArrayStream::ObjectHead(headDoc, "Effects"), effects.size(),
+        [effects, fields](size_t i, JsonObject & effectDoc)
         {
-            StaticJsonDocument<256> effectDoc;
+            auto& effect = effects[i];
+            auto wanted = [fields](EffectListField field) { return (fields & (1 << field)) != 0; };
+
+            if (wanted(FieldName))
+                effectDoc["name"]       = effect->FriendlyName();
+            if (wanted(FieldEnabled))
+                effectDoc["enabled"]    = effect->IsEnabled();
+            if (wanted(FieldCore))
+                effectDoc["core"]       = effect->IsCoreEffect();
+            if (wanted(FieldDrawMs))
+                effectDoc["drawMs"]     = effect->AverageDrawMilliseconds();
+            if (wanted(FieldFPS))
+                effectDoc["fps"]        = effect->AverageFramesPerSecond();
+            if (wanted(FieldTargetFPS))
+                effectDoc["targetFps"]  = effect->DesiredFramesPerSecond();
+            if (wanted(FieldOverBudget))
+                effectDoc["overBudget"] = effect->IsOverBudget();
+            if (wanted(FieldQuality))
+                effectDoc["quality"]    = effect->Quality();
+
+            #if ENABLE_EFFECT_MEMORY_ACCOUNTING
+                if (wanted(FieldDRAM))
+                    effectDoc["dram"]             = effect->MemoryAccount().DRAM.load();
+                if (wanted(FieldPSRAM))
+                    effectDoc["psram"]            = effect->MemoryAccount().PSRAM.load();
+                if (wanted(FieldMemoryOverBudget))
+                    effectDoc["memoryOverBudget"] = effect->IsOverMemoryBudget();
+            #endif
+
+            return true;
+        },
+        "]}"));
+}
 
-            effectDoc["name"]    = effect->FriendlyName();
-            effectDoc["enabled"] = effect->IsEnabled();
-            effectDoc["core"]    = effect->IsCoreEffect();
+#if ENABLE_STALL_WATCH
+
+// GetStalls
+//
+// The latest frames and buffer mutex waits that went over their thresholds, oldest first, with the stage that took
+// the time and the task that held things up
+
+void CWebServer::GetStalls(AsyncWebServerRequest * pRequest)
+{
+    debugV("GetStalls");
 
-            if (!j["Effects"].add(effectDoc))
+    uint32_t count;
+    auto history = g_StallWatch.History(count);
+
+    auto response = new AsyncJsonResponse(false, JSON_BUFFER_BASE_SIZE + StallWatch::kHistory * 768);
+    auto& j = response->getRoot();
+
+    j["COUNT"]             = count;
+    j["THRESHOLD_MS"]      = STALL_THRESHOLD_MS;
+    j["LOCK_THRESHOLD_MS"] = STALL_LOCK_THRESHOLD_MS;
+    j["NOW"]               = millis();
+
+    auto stalls = j.createNestedArray("STALLS");
+    for (const auto& record : history)
+    {
+        auto s = stalls.createNestedObject();
+        s["KIND"]          = record.Type == StallRecord::Frame ? "FRAME" : "LOCK";
+        s["TIMESTAMP"]     = record.Timestamp;
+        s["MICROS"]        = record.Micros;
+        s["STAGE"]         = FrameStageName(record.Stage);
+        s["STAGE_MICROS"]  = record.StageMicros;
+        s["STALLED"]       = String(record.Stalled);
+        s["CULPRIT"]       = String(record.Culprit);
+
+        if (record.Type != StallRecord::Frame)
+            continue;
+
+        s["CULPRIT_TICKS"] = record.CulpritTicks;
+
+        auto stages = s.createNestedObject("STAGES");
+        for (size_t i = 0; i < (size_t) FrameStage::Count; i++)
+            if (record.Stages[i])
+                stages[FrameStageName((FrameStage) i)] = record.Stages[i];
+    }
+
+    AddCORSHeaderAndSendResponse(pRequest, response);
+}
+
+#endif
+
+#if ENABLE_TRACING
+
+// GetTrace
+//
+// The spans in the trace ring as Chrome trace events, which Perfetto and chrome://tracing open as they are.  Each
+// core is a process and each task a thread in it, so a task that runs on either core shows up under both.
+
+void CWebServer::GetTrace(AsyncWebServerRequest * pRequest)
+{
+    debugV("GetTrace");
+
+    // No spans are added until the stream is done with, which is when the last copy of this goes
+
+    std::shared_ptr<void> pPause(nullptr, [](void *) { g_Tracer.Resume(); });
+    g_Tracer.Pause();
+
+    uint32_t first, last;
+    g_Tracer.Window(first, last);
+
+    const size_t cTasks    = g_Tracer.TaskCount();
+    const size_t cMetadata = portNUM_PROCESSORS * (1 + cTasks);         // The name of each core, then of each task on it
+
+    SendJsonStream(pRequest, std::make_shared<JsonArrayStream>("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", cMetadata + (last - first),
+        [pPause, first, cTasks, cMetadata](size_t index, JsonObject & object)
+        {
+            if (index < cMetadata)
             {
-                bufferOverflow = true;
-                jsonBufferSize += JSON_BUFFER_INCREMENT;
-                debugV("JSON response buffer overflow! Increased buffer to %zu bytes", jsonBufferSize);
-                break;
+                int core     = index / (1 + cTasks);
+                size_t entry = index % (1 + cTasks);
+
+                object["ph"]  = "M";
+                object["pid"] = core;
+
+                if (entry == 0)
+                {
+                    object["name"]         = "process_name";
+                    object["args"]["name"] = str_sprintf("Core %d", core);
+                    return true;
+                }
+
+                const char * pName = g_Tracer.TaskName(entry - 1);
+                if (!pName)
+                    return false;
+
+                object["name"]         = "thread_name";
+                object["tid"]          = entry - 1;
+                object["args"]["name"] = pName;
+                return true;
             }
-        }
 
-        if (!bufferOverflow)
-            AddCORSHeaderAndSendResponse(pRequest, response.release());
+            TraceEvent event;
+            if (!g_Tracer.Read(first + (index - cMetadata), event))
+                return false;
+
+            object["name"] = event.Name;
+            object["ph"]   = "X";
+            object["ts"]   = event.Start;
+            object["dur"]  = event.Duration;
+            object["pid"]  = event.Core;
+            object["tid"]  = event.Task;
+            return true;
+        },
+        "]}"));
+}
 
-    } while (bufferOverflow);
+#endif
+
+#if ENABLE_METRICS
+
+// GetMetrics
+//
+// The counters, gauges and histograms in the Prometheus text format, for a scraper to collect
+
+void CWebServer::GetMetrics(AsyncWebServerRequest * pRequest)
+{
+    debugV("GetMetrics");
+
+    auto response = pRequest->beginResponseStream("text/plain; version=0.0.4");
+    WritePrometheusMetrics(*response);
+    pRequest->send(response);
 }
 
+#endif
+
 void CWebServer::GetStatistics(AsyncWebServerRequest * pRequest)
 {
     debugV("GetStatistics");
 
-    auto response = new AsyncJsonResponse(false, JSON_BUFFER_BASE_SIZE);
+    size_t bufferSize = JSON_BUFFER_BASE_SIZE;
+    #if ENABLE_FRAME_TIMING
+        bufferSize += JSON_BUFFER_INCREMENT;
+    #endif
+    #if ENABLE_TASK_STATS
+        bufferSize += JSON_BUFFER_INCREMENT;
+    #endif
+    bufferSize += JSON_BUFFER_INCREMENT;                        // For the heap, pool and placement figures
+    auto response = new AsyncJsonResponse(false, bufferSize);
     auto& j = response->getRoot();
 
     j["LED_FPS"]               = g_Values.FPS;
+    j["LED_FRAMES_SHOWN"]      = g_Values.FramesShown;
+    j["LED_FRAMES_SKIPPED"]    = g_Values.FramesSkipped;  // Unchanged, so not sent again
     j["SERIAL_FPS"]            = g_Analyzer._serialFPS;
     j["AUDIO_FPS"]             = g_Analyzer._AudioFPS;
+    #if ENABLE_AUDIO && ENABLE_AUDIO_LATENCY
+        j["AUDIO_LATENCY_US"]            = g_AudioLatency.AudioToLightMicros();    // From hearing the sound to showing its light
+        j["AUDIO_CAPTURE_TO_PUBLISH_US"] = g_AudioLatency.CaptureToPublishMicros();
+        j["AUDIO_DRAW_TO_LIGHT_US"]      = g_AudioLatency.DrawToLightMicros();
+    #endif
 
     j["HEAP_SIZE"]             = _staticStats.HeapSize;
     j["HEAP_FREE"]             = ESP.getFreeHeap();
     j["HEAP_MIN"]              = ESP.getMinFreeHeap();
 
+    // How broken up the heap is, and whether it's getting worse
+
+    j["HEAP_LARGEST"]          = g_HeapMonitor.LargestBlock();
+    j["HEAP_LARGEST_MIN"]      = g_HeapMonitor.LowestLargestBlock();
+    j["HEAP_LARGEST_TREND"]    = g_HeapMonitor.TrendBytesPerHour();
+    j["HEAP_FRAGMENTATION"]    = g_HeapMonitor.FragmentationPercent();
+
+    auto pools = j.createNestedArray("POOLS");
+    for (const MemoryPool * pPool : { &g_JsonPool })
+    {
+        auto pool = pools.createNestedObject();
+        pool["NAME"]               = pPool->Name();
+        pool["BLOCK_SIZE"]         = pPool->BlockSize();
+        pool["BLOCKS"]             = pPool->BlockCount();
+        pool["IN_USE"]             = pPool->InUse();
+        pool["PEAK"]               = pPool->PeakInUse();
+        pool["HITS"]               = pPool->Hits();
+        pool["MISSES"]             = pPool->Misses();
+    }
+
+    // Which of the buffers on the hot paths got the internal RAM they asked for
+
+    auto placements = j.createNestedArray("PLACEMENT");
+    for (const auto& entry : g_MemoryPlacement.Entries())
+    {
+        auto placement = placements.createNestedObject();
+        placement["NAME"]          = entry.Name;
+        placement["BYTES"]         = entry.Bytes;
+        placement["HOT"]           = entry.Wanted != Placement::Cold;
+        placement["INTERNAL"]      = entry.bInternal;
+    }
+
+    // The errors the drawing and display paths counted and carried on from
+
+    auto errors = j.createNestedObject("ERRORS");
+    for (size_t i = 0; i < (size_t) ErrorCounter::Count; i++)
+        errors[ErrorCounters::Name((ErrorCounter) i)] = g_ErrorCounters.Get((ErrorCounter) i);
+
     j["DMA_SIZE"]              = _staticStats.DmaHeapSize;
     j["DMA_FREE"]              = heap_caps_get_free_size(MALLOC_CAP_DMA);
     j["DMA_MIN"]               = heap_caps_get_largest_free_block(MALLOC_CAP_DMA);
@@ -295,10 +749,260 @@ void CWebServer::GetStatistics(AsyncWebServerRequest * pRequest)
     j["CPU_USED"]              = taskManager.GetCPUUsagePercent();
     j["CPU_USED_CORE0"]        = taskManager.GetCPUUsagePercent(0);
     j["CPU_USED_CORE1"]        = taskManager.GetCPUUsagePercent(1);
+    #if ENABLE_GOVERNOR
+        j["CPU_MHZ"]               = g_Governor.FrequencyMHz();
+        j["CHIP_TEMP_C"]           = g_Governor.Temperature();
+        j["GOVERNOR_FPS_CAP"]      = g_Governor.IsBoosted() ? 0 : g_Governor.FramesPerSecondCap();
+        j["GOVERNOR_STATIC"]       = g_Governor.IsStatic();
+    #endif
+
+    // Every task's core, priority, least stack left and, when FreeRTOS keeps run time stats, CPU share since boot,
+    // under the task profile that placed them
+
+    j["TASK_PROFILE"]          = NightDriverTaskManager::TaskProfileName(taskManager.GetTaskProfile());
+
+    #if ENABLE_TASK_STATS
+        auto tasks = j.createNestedArray("TASKS");
+        for (const auto& task : taskManager.GetTaskStats())
+        {
+            auto t = tasks.createNestedObject();
+            t["NAME"]              = task.Name;
+            t["CORE"]              = task.Core;
+            t["PRIORITY"]          = task.Priority;
+            t["STACK_FREE"]        = task.StackFree;
+            if (task.CPUPercent >= 0)
+                t["CPU"]           = task.CPUPercent;
+        }
+    #endif
+
+    if (g_ptrSystem->HasJSONWriter())
+    {
+        auto& jsonWriter = g_ptrSystem->JSONWriter();
+
+        j["JSON_WRITES"]           = jsonWriter.WriteCount();
+        j["JSON_WRITES_SKIPPED"]   = jsonWriter.SkippedWriteCount();
+        j["JSON_WRITE_BYTES"]      = jsonWriter.BytesWritten();
+    }
+
+    // What the effects' state takes, all together and for the one that's running
+
+    #if ENABLE_EFFECT_MEMORY_ACCOUNTING
+        auto& effectManager = g_ptrSystem->EffectManager();
+        size_t effectsDRAM = 0, effectsPSRAM = 0;
+
+        for (const auto& effect : effectManager.EffectsList())
+        {
+            effectsDRAM  += effect->MemoryAccount().DRAM;
+            effectsPSRAM += effect->MemoryAccount().PSRAM;
+        }
+
+        j["EFFECTS_DRAM"]          = effectsDRAM;
+        j["EFFECTS_PSRAM"]         = effectsPSRAM;
+        j["EFFECT_DRAM"]           = effectManager.GetCurrentEffect().MemoryAccount().DRAM.load();
+        j["EFFECT_PSRAM"]          = effectManager.GetCurrentEffect().MemoryAccount().PSRAM.load();
+    #endif
+
+    // The WiFi radio profile in effect, or -1 while WiFi is down
+
+    j["RADIO_PROFILE"]         = GetAppliedRadioProfile();
+
+    // How far our frame clock is from the sender's, and how well we know it
+
+    #if ENABLE_CLOCK_SYNC
+        j["CLOCK_SYNCED"]          = g_ClockSync.IsSynced();
+        j["CLOCK_OFFSET_US"]       = g_ClockSync.OffsetMicros();
+        j["CLOCK_SKEW_PPM"]        = g_ClockSync.SkewPPM();
+        j["CLOCK_SYNC_DELAY_US"]   = g_ClockSync.BestDelayMicros();
+    #endif
+
+    // How long each stage of startup took, in milliseconds
+
+    auto boot = j.createNestedObject("BOOT_TIMING");
+    for (size_t i = 0; i < (size_t) BootStage::Count; i++)
+        if (g_BootTiming.IsDone((BootStage) i))
+            boot[BootTiming::StageName((BootStage) i)] = g_BootTiming.StageMilliseconds((BootStage) i);
+
+    // Per-stage durations in microseconds, as measured by the frame timing probes
+
+    #if ENABLE_FRAME_TIMING
+        auto timing = j.createNestedObject("FRAME_TIMING");
+
+        for (size_t i = 0; i < (size_t) FrameStage::Count; i++)
+        {
+            auto stage = (FrameStage) i;
+            const auto& histogram = g_FrameTiming.Stage(stage);
+
+            auto s = timing.createNestedObject(FrameTiming::StageName(stage));
+            s["COUNT"]             = histogram.Count();
+            s["P50"]               = histogram.Percentile(50);
+            s["P95"]               = histogram.Percentile(95);
+            s["P99"]               = histogram.Percentile(99);
+            s["MAX"]               = histogram.Max();
+        }
+    #endif
 
     AddCORSHeaderAndSendResponse(pRequest, response);
 }
 
+#if ENABLE_LIVE_STATE_SOCKET
+
+// PushLiveState
+//
+// The message is put together once for all the clients, and holds only the figures that have changed.  The time
+// remaining only goes out with the effect or its interval, since the UI counts it down by itself in between.
+
+void CWebServer::PushLiveState()
+{
+    _liveSocket.cleanupClients();
+    if (_liveSocket.count() == 0)
+        return;
+
+    auto& effectManager = g_ptrSystem->EffectManager();
+    auto& taskManager = g_ptrSystem->TaskManager();
+    bool bFull = _bLiveStateFull.exchange(false);
+
+    StaticJsonDocument<256> jsonDoc;
+
+    auto putIfChanged = [&](const char * key, auto value, auto & lastValue)
+    {
+        if (!bFull && value == lastValue)
+            return false;
+
+        jsonDoc[key] = value;
+        lastValue = value;
+        return true;
+    };
+
+    putIfChanged("fps",     g_Values.FPS,                                   _lastLiveState.FPS);
+    putIfChanged("cpu",     (int) taskManager.GetCPUUsagePercent(),         _lastLiveState.CPU);
+    putIfChanged("c0",      (int) taskManager.GetCPUUsagePercent(0),        _lastLiveState.CPUCore0);
+    putIfChanged("c1",      (int) taskManager.GetCPUUsagePercent(1),        _lastLiveState.CPUCore1);
+    putIfChanged("heap",    ESP.getFreeHeap(),                              _lastLiveState.Heap);
+    putIfChanged("heapMin", ESP.getMinFreeHeap(),                           _lastLiveState.HeapMin);
+    putIfChanged("psram",   ESP.getFreePsram(),                             _lastLiveState.PSRAM);
+    putIfChanged("eter",    effectManager.IsIntervalEternal(),              _lastLiveState.Eternal);
+
+    bool bEffectChanged = putIfChanged("eff", effectManager.GetCurrentEffectIndex(), _lastLiveState.Effect);
+    bEffectChanged |= putIfChanged("ivl", effectManager.GetInterval(), _lastLiveState.Interval);
+
+    if (bEffectChanged)
+        jsonDoc["rem"] = effectManager.GetTimeRemainingForCurrentEffect();
+
+    if (jsonDoc.size() == 0)
+        return;
+
+    String message;
+    serializeJson(jsonDoc, message);
+    _liveSocket.textAll(message);
+}
+
+#endif
+
+#if ENABLE_LED_PREVIEW_SOCKET
+
+// OnPreviewEvent
+//
+// A new client is streamed run-length encoded deltas at LED_PREVIEW_MAX_FPS until it sends a ColorStreamRequest,
+// as one binary message, for something else.  It can ask for fewer frames, but not for more.
+
+void CWebServer::OnPreviewEvent(AsyncWebSocketClient * pClient, AwsEventType type, void * pArg, uint8_t * pData, size_t length)
+{
+    std::lock_guard<std::mutex> guard(_previewMutex);
+
+    if (type == WS_EVT_CONNECT)
+    {
+        PreviewClient client;
+        client.Settings.bStreaming = true;
+        client.Settings.Flags      = ColorStreamRLE | ColorStreamDelta;
+        client.Settings.MaxFPS     = LED_PREVIEW_MAX_FPS;
+        _previewClients[pClient->id()] = client;
+    }
+    else if (type == WS_EVT_DISCONNECT)
+    {
+        _previewClients.erase(pClient->id());
+    }
+    else if (type == WS_EVT_DATA)
+    {
+        auto pInfo = static_cast<AwsFrameInfo *>(pArg);
+        auto entry = _previewClients.find(pClient->id());
+
+        if (entry == _previewClients.end() || pInfo->opcode != WS_BINARY || pInfo->index != 0 || pInfo->len != length || length != sizeof(ColorStreamRequest))
+            return;
+
+        ColorStreamRequest request;
+        memcpy(&request, pData, sizeof(request));
+        if (request.header != COLOR_STREAM_REQUEST_HEADER)
+            return;
+
+        auto& client = entry->second;
+        client.Settings = ColorStreamSettings::FromRequest(request);
+        if (client.Settings.MaxFPS == 0 || client.Settings.MaxFPS > LED_PREVIEW_MAX_FPS)
+            client.Settings.MaxFPS = LED_PREVIEW_MAX_FPS;
+
+        client.pEncoder.reset();                        // So it's matched up with an encoder for the new settings
+        client.bNeedsKeyFrame = true;
+    }
+}
+
+// PushLEDPreview
+//
+// Runs as a network reader, so the encoding is done off the drawing core.  Each frame is encoded once for every
+// client that asked for the same form, and copied out to each of them.  A client whose queue is still full from
+// earlier frames skips this one, and when it gets deltas it's sent a key frame next.
+
+void CWebServer::PushLEDPreview()
+{
+    _previewSocket.cleanupClients();
+
+    auto& effectManager = g_ptrSystem->EffectManager();
+    std::vector<std::pair<uint32_t, std::shared_ptr<const ColorPacket>>> sends;
+
+    {
+        std::lock_guard<std::mutex> guard(_previewMutex);
+
+        uint32_t frame = effectManager.FrameSequence();
+        if (_previewClients.empty() || frame == _lastPreviewFrame || effectManager.g()->leds == nullptr)
+            return;
+        _lastPreviewFrame = frame;
+
+        for (auto& [id, client] : _previewClients)
+            if (!client.pEncoder)
+                client.pEncoder = _previewEncoders.EncoderFor(client.Settings);
+        _previewEncoders.Prune();
+
+        for (auto& pEncoder : _previewEncoders)
+        {
+            if (!pEncoder->NextFrame(*effectManager.g()))
+                continue;
+
+            for (auto& [id, client] : _previewClients)
+            {
+                if (client.pEncoder != pEncoder)
+                    continue;
+
+                auto pSocketClient = _previewSocket.client(id);
+                if (!pSocketClient || pSocketClient->queueIsFull())
+                {
+                    client.bNeedsKeyFrame = true;
+                    continue;
+                }
+
+                bool bDelta = !client.bNeedsKeyFrame && pEncoder->UsesDeltas();
+                sends.emplace_back(id, pEncoder->Packet(bDelta));
+                client.bNeedsKeyFrame = false;
+            }
+        }
+    }
+
+    // Sending can close a client, which comes back through OnPreviewEvent, so it's done without the lock
+
+    for (auto& [id, pPacket] : sends)
+        if (auto pSocketClient = _previewSocket.client(id))
+            pSocketClient->binary((const char *) pPacket->data(), pPacket->size());
+}
+
+#endif
+
 void CWebServer::SetCurrentEffectIndex(AsyncWebServerRequest * pRequest)
 {
     debugV("SetCurrentEffectIndex");
@@ -335,6 +1039,65 @@ void CWebServer::MoveEffect(AsyncWebServerRequest * pRequest)
     AddCORSHeaderAndSendOKResponse(pRequest);
 }
 
+// Applies a list of enables, disables and moves in one request, so the effects are only saved once
+void CWebServer::ApplyEffectBatch(AsyncWebServerRequest * pRequest)
+{
+    debugV("ApplyEffectBatch");
+
+    if (!pRequest->hasParam("operations", true, false))
+    {
+        AddCORSHeaderAndSendBadRequest(pRequest, "Missing operations");
+        return;
+    }
+
+    std::vector<EffectOperation> operations;
+
+    const char * p = pRequest->getParam("operations", true, false)->value().c_str();
+    while (*p)
+    {
+        char * end;
+        EffectOperation operation;
+        operation.Type = (EffectOperation::OperationType) *p;
+
+        bool bMove = operation.Type == EffectOperation::OperationType::Move;
+        if ((!bMove && operation.Type != EffectOperation::OperationType::Enable && operation.Type != EffectOperation::OperationType::Disable)
+            || p[1] != ':')
+        {
+            AddCORSHeaderAndSendBadRequest(pRequest, "Malformed operations");
+            return;
+        }
+
+        operation.Index = strtoul(p + 2, &end, 10);
+        if (end == p + 2 || (bMove && *end != ':'))
+        {
+            AddCORSHeaderAndSendBadRequest(pRequest, "Malformed operations");
+            return;
+        }
+
+        if (bMove)
+        {
+            const char * newIndex = end + 1;
+            operation.NewIndex = strtoul(newIndex, &end, 10);
+            if (end == newIndex)
+            {
+                AddCORSHeaderAndSendBadRequest(pRequest, "Malformed operations");
+                return;
+            }
+        }
+
+        operations.push_back(operation);
+        p = *end == ',' ? end + 1 : end;
+    }
+
+    if (!g_ptrSystem->EffectManager().ApplyEffectOperations(operations))
+    {
+        AddCORSHeaderAndSendBadRequest(pRequest, "Invalid effect index in operations");
+        return;
+    }
+
+    AddCORSHeaderAndSendOKResponse(pRequest);
+}
+
 void CWebServer::CopyEffect(AsyncWebServerRequest * pRequest)
 {
     debugV("CopyEffect");
@@ -396,23 +1159,423 @@ void CWebServer::PreviousEffect(AsyncWebServerRequest * pRequest)
     AddCORSHeaderAndSendOKResponse(pRequest);
 }
 
-void CWebServer::SendSettingSpecsResponse(AsyncWebServerRequest * pRequest, const std::vector<std::reference_wrapper<SettingSpec>> & settingSpecs)
+#if ENABLE_EFFECT_REPLAY
+
+// GetReplayReport
+//
+// The results of the last replay, one row per effect, with the CRC and cycles of every frame if it was just the one
+
+void CWebServer::GetReplayReport(AsyncWebServerRequest * pRequest)
+{
+    static size_t jsonBufferSize = JSON_BUFFER_BASE_SIZE;
+    bool bufferOverflow;
+    debugV("GetReplayReport");
+
+    auto report = GetEffectReplayReport();
+
+    do
+    {
+        bufferOverflow = false;
+        auto response = std::make_unique<AsyncJsonResponse>(false, jsonBufferSize);
+        auto& j = response->getRoot();
+
+        j["pending"]       = report.Pending;
+        j["frames"]        = report.Frames;
+        j["seed"]          = report.Seed;
+        j["recordedAudio"] = report.RecordedAudio;
+        j["cpuMHz"]        = ESP.getCpuFreqMHz();
+        auto resultsArray  = j.createNestedArray("results");
+
+        for (const auto& result : report.Results)
+        {
+            auto resultObject = resultsArray.createNestedObject();
+            auto framesArray  = resultObject.createNestedArray("frameData");
+            bufferOverflow = framesArray.isNull();
+
+            resultObject["effectIndex"]   = result.EffectIndex;
+            resultObject["name"]          = result.Name;
+            resultObject["crc"]           = result.SequenceCRC;
+            resultObject["deterministic"] = result.Deterministic;
+            resultObject["minCycles"]     = result.MinCycles;
+            resultObject["maxCycles"]     = result.MaxCycles;
+            resultObject["avgCycles"]     = (uint32_t)(result.TotalCycles / std::max<uint>(1, report.Frames));
+
+            for (const auto& frame : result.Frames)
+            {
+                if (bufferOverflow)
+                    break;
+
+                auto frameArray = framesArray.createNestedArray();
+                bufferOverflow = !frameArray.add(frame.CRC) || !frameArray.add(frame.Cycles);
+            }
+
+            if (bufferOverflow)
+            {
+                jsonBufferSize += JSON_BUFFER_INCREMENT;
+                debugV("JSON response buffer overflow! Increased buffer to %zu bytes", jsonBufferSize);
+                break;
+            }
+        }
+
+        if (!bufferOverflow)
+            AddCORSHeaderAndSendResponse(pRequest, response.release());
+
+    } while (bufferOverflow);
+}
+
+void CWebServer::StartReplay(AsyncWebServerRequest * pRequest)
+{
+    debugV("StartReplay");
+
+    auto index = GetEffectIndexFromParam(pRequest, true);
+    size_t frames = REPLAY_DEFAULT_FRAMES;
+    size_t seed = 1;
+
+    PushPostParamIfPresent<size_t>(pRequest, "frames", SET_VALUE(frames = value));
+    PushPostParamIfPresent<size_t>(pRequest, "seed", SET_VALUE(seed = value));
+
+    if (!QueueEffectReplay(index == -1 ? std::nullopt : std::optional<size_t>(index), frames, seed))
+    {
+        AddCORSHeaderAndSendBadRequest(pRequest, "A replay is already running or the effect index is out of bounds");
+        return;
+    }
+
+    AddCORSHeaderAndSendOKResponse(pRequest);
+}
+
+void CWebServer::RecordReplayAudio(AsyncWebServerRequest * pRequest)
+{
+    debugV("RecordReplayAudio");
+
+    size_t frames = REPLAY_MAX_FRAMES;
+    PushPostParamIfPresent<size_t>(pRequest, "frames", SET_VALUE(frames = value));
+
+    if (!QueueReplayAudioRecording(frames))
+    {
+        AddCORSHeaderAndSendBadRequest(pRequest, "Can't record audio now, or there's no audio to record");
+        return;
+    }
+
+    AddCORSHeaderAndSendOKResponse(pRequest);
+}
+
+#endif
+
+#if ENABLE_SHOW_RECORDER
+
+void CWebServer::GetShowRecording(AsyncWebServerRequest * pRequest)
+{
+    debugV("GetShowRecording");
+
+    auto& recorder = g_ptrSystem->ShowRecorder();
+    auto response = std::make_unique<AsyncJsonResponse>(false, JSON_BUFFER_BASE_SIZE);
+    auto& j = response->getRoot();
+
+    j["recording"] = recorder.IsRecording();
+    j["frames"]    = recorder._cFrames.load();
+    j["dropped"]   = recorder._cDropped.load();
+    j["bytes"]     = recorder._cbWritten.load();
+    j["capacity"]  = recorder.Capacity();
+
+    AddCORSHeaderAndSendResponse(pRequest, response.release());
+}
+
+// SetShowRecording
+//
+// Starts a recording over whatever show is in the partition, or finishes the one that's running
+
+void CWebServer::SetShowRecording(AsyncWebServerRequest * pRequest)
+{
+    debugV("SetShowRecording");
+
+    bool bRecord = true;
+    PushPostParamIfPresent<bool>(pRequest, "record", SET_VALUE(bRecord = value));
+
+    auto& recorder = g_ptrSystem->ShowRecorder();
+    if (!bRecord)
+        recorder.Stop();
+    else if (!recorder.Start())
+    {
+        AddCORSHeaderAndSendBadRequest(pRequest, "There's no " SHOW_PARTITION_LABEL " partition to record to");
+        return;
+    }
+
+    AddCORSHeaderAndSendOKResponse(pRequest);
+}
+
+#endif
+
+#if ENABLE_ASSET_STORE
+
+static void AssetToJSON(JsonObject object, const AssetEntry & entry)
+{
+    object["id"]     = entry.Id;
+    object["type"]   = AssetStore::TypeName(entry.Type);
+    object["name"]   = entry.Name;
+    object["length"] = entry.Length;
+    if (entry.Type == AssetType::GIF)
+        object["fps"] = entry.Param;
+}
+
+void CWebServer::GetAssets(AsyncWebServerRequest * pRequest)
+{
+    debugV("GetAssets");
+
+    auto& assets = g_ptrSystem->AssetStore();
+    auto entries = assets.Entries();
+    auto response = std::make_unique<AsyncJsonResponse>(false, JSON_BUFFER_BASE_SIZE + entries.size() * 128);
+    auto& j = response->getRoot();
+
+    j["capacity"] = assets.Capacity();
+    j["free"]     = assets.FreeSpace();
+
+    auto assetsArray = j.createNestedArray("assets");
+    for (const auto & entry : entries)
+        AssetToJSON(assetsArray.createNestedObject(), entry);
+
+    AddCORSHeaderAndSendResponse(pRequest, response.release());
+}
+
+// ReceiveAssetBody
+//
+// Writes the body of an upload to flash as it comes in.  The first piece starts the upload from the query
+// parameters, and leaves what came of that in the request's temporary object for UploadAsset: an empty string if the
+// upload is under way, or why it isn't.  The request frees the object when it's done.
+
+void CWebServer::ReceiveAssetBody(AsyncWebServerRequest * pRequest, uint8_t * pData, size_t length, size_t index, size_t total)
+{
+    auto& assets = g_ptrSystem->AssetStore();
+
+    if (index == 0)
+    {
+        String error;
+        auto pId   = pRequest->getParam("id");
+        auto pType = pRequest->getParam("type");
+        auto pName = pRequest->getParam("name");
+        auto pFPS  = pRequest->getParam("fps");
+
+        if (!pId || !pType)
+            error = "An upload needs an id and a type";
+        else if (pId->value().toInt() < 0 || pId->value().toInt() > UINT16_MAX)
+            error = "Asset ids go from 0 to 65535";
+        else
+            assets.BeginUpload(pId->value().toInt(), AssetStore::TypeFromName(pType->value()), pName ? pName->value() : String(),
+                               pFPS ? pFPS->value().toInt() : 0, total, error);
+
+        free(pRequest->_tempObject);
+        pRequest->_tempObject = strdup(error.c_str());
+        if (!error.isEmpty())
+            return;
+    }
+
+    auto pState = static_cast<const char *>(pRequest->_tempObject);
+    if (pState && !*pState)
+        assets.WriteUpload(pData, length);
+}
+
+void CWebServer::UploadAsset(AsyncWebServerRequest * pRequest)
+{
+    debugV("UploadAsset");
+
+    auto pState = static_cast<const char *>(pRequest->_tempObject);
+    if (!pState)
+    {
+        AddCORSHeaderAndSendBadRequest(pRequest, "Send the asset as the body of the request");
+        return;
+    }
+    if (*pState)
+    {
+        AddCORSHeaderAndSendBadRequest(pRequest, pState);
+        return;
+    }
+
+    String error;
+    auto entry = g_ptrSystem->AssetStore().FinishUpload(error);
+    if (!entry)
+    {
+        AddCORSHeaderAndSendBadRequest(pRequest, error);
+        return;
+    }
+
+    auto response = std::make_unique<AsyncJsonResponse>(false, JSON_BUFFER_BASE_SIZE);
+    AssetToJSON(response->getRoot().as<JsonObject>(), *entry);
+    AddCORSHeaderAndSendResponse(pRequest, response.release());
+}
+
+void CWebServer::DeleteAsset(AsyncWebServerRequest * pRequest)
+{
+    debugV("DeleteAsset");
+
+    size_t id = 0;
+    bool bHasId = PushPostParamIfPresent<size_t>(pRequest, "id", SET_VALUE(id = value));
+
+    if (!bHasId || id > UINT16_MAX || !g_ptrSystem->AssetStore().Remove(id))
+    {
+        AddCORSHeaderAndSendBadRequest(pRequest, "There's no asset with that id, or it couldn't be removed");
+        return;
+    }
+
+    AddCORSHeaderAndSendOKResponse(pRequest);
+}
+
+void CWebServer::ClearAssets(AsyncWebServerRequest * pRequest)
+{
+    debugV("ClearAssets");
+
+    if (!g_ptrSystem->AssetStore().Clear())
+    {
+        AddCORSHeaderAndSendBadRequest(pRequest, "There's no " ASSET_PARTITION_LABEL " partition");
+        return;
+    }
+
+    AddCORSHeaderAndSendOKResponse(pRequest);
+}
+
+#endif
+
+#if ENABLE_PLAYLISTS
+
+void CWebServer::GetPlaylists(AsyncWebServerRequest * pRequest)
 {
     static size_t jsonBufferSize = JSON_BUFFER_BASE_SIZE;
     bool bufferOverflow;
+    debugV("GetPlaylists");
+
+    auto& scheduler = g_ptrSystem->EffectManager().Scheduler();
+    auto playlists = scheduler.Playlists();
 
     do
     {
         bufferOverflow = false;
         auto response = std::make_unique<AsyncJsonResponse>(false, jsonBufferSize);
-        auto jsonArray = response->getRoot().to<JsonArray>();
+        auto& j = response->getRoot();
+
+        j["activePlaylist"] = scheduler.ActiveName();
+        auto playlistsArray = j.createNestedArray("playlists");
+
+        for (const auto& playlist : playlists)
+        {
+            auto playlistObject = playlistsArray.createNestedObject();
+            auto entriesArray = playlistObject.createNestedArray("entries");
+            bufferOverflow = entriesArray.isNull();
+
+            playlistObject["name"]    = playlist.Name;
+            playlistObject["shuffle"] = playlist.Shuffle;
+
+            for (const auto& entry : playlist.Entries)
+            {
+                if (bufferOverflow)
+                    break;
+
+                auto entryObject = entriesArray.createNestedObject();
+                bufferOverflow = !entryObject["effectIndex"].set(entry.EffectIndex)
+                              || !entryObject["seconds"].set(entry.Seconds)
+                              || !entryObject["weight"].set(entry.Weight);
+            }
+
+            if (bufferOverflow)
+            {
+                jsonBufferSize += JSON_BUFFER_INCREMENT;
+                debugV("JSON response buffer overflow! Increased buffer to %zu bytes", jsonBufferSize);
+                break;
+            }
+        }
+
+        if (!bufferOverflow)
+            AddCORSHeaderAndSendResponse(pRequest, response.release());
+
+    } while (bufferOverflow);
+}
+
+// SetPlaylist
+//
+// Adds or replaces a playlist.  The entries come as one compact list, "index[:seconds[:weight]]" separated by
+// commas, like "3:30,7,12:0:4", where seconds of 0 use the effect interval and the weight defaults to 1.
+
+void CWebServer::SetPlaylist(AsyncWebServerRequest * pRequest)
+{
+    debugV("SetPlaylist");
+
+    if (!pRequest->hasParam("name", true, false) || !pRequest->hasParam("entries", true, false))
+    {
+        AddCORSHeaderAndSendBadRequest(pRequest, "Missing name or entries");
+        return;
+    }
+
+    Playlist playlist;
+    playlist.Name    = pRequest->getParam("name", true, false)->value();
+    playlist.Shuffle = IsPostParamTrue(pRequest, "shuffle");
 
-        for (auto& specWrapper : settingSpecs)
+    const char * p = pRequest->getParam("entries", true, false)->value().c_str();
+    while (*p)
+    {
+        char * end;
+        unsigned long index   = strtoul(p, &end, 10);
+        unsigned long seconds = 0;
+        unsigned long weight  = 1;
+        bool bParsed = end != p;
+
+        if (*end == ':')
+            seconds = strtoul(end + 1, &end, 10);
+        if (*end == ':')
+            weight = strtoul(end + 1, &end, 10);
+
+        if (!bParsed || index > UINT16_MAX || seconds > UINT16_MAX || weight > UINT8_MAX)
         {
-            auto& spec = specWrapper.get();
-            auto specObject = jsonArray.createNestedObject();
+            AddCORSHeaderAndSendBadRequest(pRequest, "Malformed playlist entries");
+            return;
+        }
+
+        PlaylistEntry entry;
+        entry.EffectIndex = index;
+        entry.Seconds     = seconds;
+        entry.Weight      = weight;
+        playlist.Entries.push_back(entry);
+        p = *end == ',' ? end + 1 : end;
+    }
+
+    if (!g_ptrSystem->EffectManager().SetPlaylist(std::move(playlist)))
+    {
+        AddCORSHeaderAndSendBadRequest(pRequest, "Playlist has no valid entries");
+        return;
+    }
+
+    AddCORSHeaderAndSendOKResponse(pRequest);
+}
+
+void CWebServer::ActivatePlaylist(AsyncWebServerRequest * pRequest)
+{
+    debugV("ActivatePlaylist");
+
+    String name = pRequest->hasParam("name", true, false) ? pRequest->getParam("name", true, false)->value() : String();
 
-            StaticJsonDocument<384> jsonDoc;
+    if (!g_ptrSystem->EffectManager().ActivatePlaylist(name))
+    {
+        AddCORSHeaderAndSendBadRequest(pRequest, "No such playlist");
+        return;
+    }
+
+    AddCORSHeaderAndSendOKResponse(pRequest);
+}
+
+void CWebServer::DeletePlaylist(AsyncWebServerRequest * pRequest)
+{
+    debugV("DeletePlaylist");
+    PushPostParamIfPresent<String>(pRequest, "name", SET_VALUE(g_ptrSystem->EffectManager().DeletePlaylist(value)));
+    AddCORSHeaderAndSendOKResponse(pRequest);
+}
+
+#endif
+
+void CWebServer::SendSettingSpecsResponse(AsyncWebServerRequest * pRequest, const std::vector<std::reference_wrapper<SettingSpec>> & settingSpecs,
+                                          std::shared_ptr<LEDStripEffect> owner)
+{
+    // The owner, if there is one, is held on to so the specs it owns outlast the response
+
+    auto pStream = std::make_shared<JsonArrayStream>("[", settingSpecs.size(),
+        [settingSpecs, owner](size_t i, JsonObject & jsonDoc)
+        {
+            auto& spec = settingSpecs[i].get();
 
             jsonDoc["name"] = spec.Name;
             jsonDoc["friendlyName"] = spec.FriendlyName;
@@ -443,22 +1606,17 @@ void CWebServer::SendSettingSpecsResponse(AsyncWebServerRequest * pRequest, cons
                     break;
             }
 
-            if (jsonDoc.overflowed())
-                debugE("JSON buffer overflow while serializing SettingSpec - object incomplete!");
+            return true;
+        },
+        "]");
 
-            if (!specObject.set(jsonDoc.as<JsonObjectConst>()))
-            {
-                bufferOverflow = true;
-                jsonBufferSize += JSON_BUFFER_INCREMENT;
-                debugV("JSON response buffer overflow! Increased buffer to %zu bytes", jsonBufferSize);
-                break;
-            }
-        }
-
-        if (!bufferOverflow)
-            AddCORSHeaderAndSendResponse(pRequest, response.release());
+    // Specs don't change while their effect is in the list, so they're only built once when the cache is on
 
-    } while (bufferOverflow);
+    #if ENABLE_SPEC_RESPONSE_CACHE
+        SendCachedResponse(pRequest, owner.get(), pStream);
+    #else
+        SendJsonStream(pRequest, pStream);
+    #endif
 }
 
 const std::vector<std::reference_wrapper<SettingSpec>> & CWebServer::LoadDeviceSettingSpecs()
@@ -527,6 +1685,13 @@ void CWebServer::SetSettingsIfPresent(AsyncWebServerRequest * pRequest)
     PushPostParamIfPresent<bool>(pRequest, DeviceConfig::ShowVUMeterTag, SET_VALUE(effectManager.ShowVU(value)));
     #endif
 
+    #if ENABLE_AUDIO
+    PushPostParamIfPresent<int>(pRequest, DeviceConfig::AudioProfileTag, SET_VALUE(deviceConfig.SetAudioProfile(value)));
+    #endif
+
+    PushPostParamIfPresent<int>(pRequest, DeviceConfig::RadioProfileTag, SET_VALUE(deviceConfig.SetRadioProfile(value)));
+    PushPostParamIfPresent<int>(pRequest, DeviceConfig::TaskProfileTag, SET_VALUE(deviceConfig.SetTaskProfile(value)));
+
     std::optional<CRGB> globalColor = {};
     std::optional<CRGB> secondColor = {};
 
@@ -575,7 +1740,7 @@ void CWebServer::GetEffectSettingSpecs(AsyncWebServerRequest * pRequest)
 
     auto settingSpecs = effect->GetSettingSpecs();
 
-    SendSettingSpecsResponse(pRequest, settingSpecs);
+    SendSettingSpecsResponse(pRequest, settingSpecs, effect);
 }
 
 void CWebServer::SendEffectSettingsResponse(AsyncWebServerRequest * pRequest, std::shared_ptr<LEDStripEffect> & effect)
@@ -634,7 +1799,10 @@ void CWebServer::SetEffectSettings(AsyncWebServerRequest * pRequest)
         return;
 
     if (ApplyEffectSettings(pRequest, effect))
+    {
+        g_ptrSystem->EffectManager().NoteEffectChanged();
         SaveEffectManagerConfig();
+    }
 
     SendEffectSettingsResponse(pRequest, effect);
 }
@@ -0,0 +1,101 @@
+#!/usr/bin/env python
+
+#--------------------------------------------------------------------------
+#
+# File:        build_show.py
+#
+# NightDriverStrip - (c) 2023 Plummer's Software LLC.  All Rights Reserved.
+#
+# This file is part of the NightDriver software project.
+#
+#    NightDriver is free software: you can redistribute it and/or modify
+#    it under the terms of the GNU General Public License as published by
+#    the Free Software Foundation, either version 3 of the License, or
+#    (at your option) any later version.
+#
+#    NightDriver is distributed in the hope that it will be useful,
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#    GNU General Public License for more details.
+#
+#    You should have received a copy of the GNU General Public License
+#    along with Nightdriver.  It is normally found in copying.txt
+#    If not, see <https://www.gnu.org/licenses/>.
+#
+# Description:
+#
+#    Turns a file of raw RGB frames into a show for ENABLE_SHOW_PLAYBACK
+#    (see include/showplayer.h).  Every frame is stored as a zlib compressed
+#    PIXELDATA64 keyframe or PIXELDELTA64 delta, with a keyframe every so
+#    often so a damaged frame doesn't spoil the rest of the show.
+#
+#    Raw frames can come straight out of ffmpeg, for example:
+#
+#    $ ffmpeg -i show.mp4 -vf scale=144:8 -r 30 -f rawvideo -pix_fmt rgb24 show.rgb
+#    $ tools/build_show.py show.rgb show.bin --pixels 1152 --fps 30
+#    $ parttool.py write_partition --partition-name show --input show.bin
+#
+#    The show must fit in the show partition, such as the one in
+#    config/partitions_custom_8M_show.csv.
+#
+
+import argparse
+import struct
+import zlib
+
+SHOW_FILE_MAGIC             = 0x5753444E            # "NDSW"
+SHOW_FILE_VERSION           = 1
+WIFI_COMMAND_PIXELDATA64    = 3
+WIFI_COMMAND_PIXELDELTA64   = 5
+
+def packet(command, channels, colors):
+    # The player puts in the real timestamp, so the seconds and micros are left at zero
+    return struct.pack('<HHIQQ', command, channels, len(colors) // 3, 0, 0) + colors
+
+def main():
+    parser = argparse.ArgumentParser(description='Build a NightDriverStrip show from raw RGB frames')
+    parser.add_argument('input', help='file of raw rgb24 frames, one after the other')
+    parser.add_argument('output', help='show file to write')
+    parser.add_argument('--pixels', type=int, required=True, help='pixels per frame')
+    parser.add_argument('--fps', type=float, default=30.0, help='frames per second')
+    parser.add_argument('--channels', type=lambda s: int(s, 0), default=1, help='channel mask the frames go to, like 0x0F')
+    parser.add_argument('--keyframe-interval', type=int, default=30, help='frames between keyframes')
+    args = parser.parse_args()
+
+    frameSize = args.pixels * 3
+    records = []
+    previous = None
+
+    with open(args.input, 'rb') as f:
+        while True:
+            colors = f.read(frameSize)
+            if len(colors) < frameSize:
+                break
+
+            index = len(records)
+            if previous is None or index % args.keyframe_interval == 0:
+                data = packet(WIFI_COMMAND_PIXELDATA64, args.channels, colors)
+            else:
+                delta = bytes(a ^ b for a, b in zip(colors, previous))
+                data = packet(WIFI_COMMAND_PIXELDELTA64, args.channels, delta)
+
+            compressed = zlib.compress(data, 9)
+            offsetMicros = round(index * 1000000 / args.fps)
+            records.append(struct.pack('<QII', offsetMicros, len(compressed), len(data)) + compressed)
+            previous = colors
+
+    if not records:
+        raise SystemExit('No whole frames of %d pixels in %s' % (args.pixels, args.input))
+
+    durationMicros = round(len(records) * 1000000 / args.fps)
+
+    with open(args.output, 'wb') as f:
+        f.write(struct.pack('<IHHIQ', SHOW_FILE_MAGIC, SHOW_FILE_VERSION, 0, len(records), durationMicros))
+        for record in records:
+            f.write(record)
+        size = f.tell()
+
+    print('%d frames, %.1f seconds, %d bytes' % (len(records), durationMicros / 1000000, size))
+
+if __name__ == '__main__':
+    main()